@@ -34,7 +34,7 @@ yellow() {
 }
 
 if [ -x "$(command -v apt)" ]; then
-    PACKAGES="build-essential make libssl-dev libfuse-dev openssl"
+    PACKAGES="build-essential make libssl-dev libfuse-dev liburing-dev openssl"
     if [ "$WITH_TESTS" = "true" ]; then
         PACKAGES="$PACKAGES libcriterion-dev"
     fi
@@ -43,7 +43,7 @@ if [ -x "$(command -v apt)" ]; then
     apt install -y $PACKAGES
 
 elif [ -x "$(command -v pacman)" ]; then
-    PACKAGES="base-devel make libssl-dev libfuse-dev openssl"
+    PACKAGES="base-devel make libssl-dev libfuse-dev liburing openssl"
     if [ "$WITH_TESTS" = "true" ]; then
         PACKAGES="$PACKAGES criterion"
     fi
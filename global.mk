@@ -17,4 +17,6 @@ TESTS_DIR = $(PROJECT_DIR)/tests/criterion
 SRC_DIR = $(PROJECT_DIR)/src
 FS_CORE_DIR = $(SRC_DIR)/fs
 FUSE_CORE_DIR = $(SRC_DIR)/fuse
+LIB_CORE_DIR = $(SRC_DIR)/lib
+PRELOAD_CORE_DIR = $(SRC_DIR)/preload
 
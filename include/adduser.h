@@ -1,6 +1,8 @@
 #ifndef ADDUSER_H
 #define ADDUSER_H
 
+#include <stddef.h>
+
 /**
  * @brief Add a user public key to the keys storage
  *
@@ -14,4 +16,23 @@
 int cryptfs_adduser(const char *device_path, const char *other_public_key_path,
                     const char *my_private_key_path);
 
+/**
+ * @brief Add several user public keys to the keys storage, in one pass
+ *
+ * @details Only the key slots are read, and only the key slots of the new
+ * users are written (the master key is decrypted once).
+ *
+ * @note No action is performed if one of the public keys is already in the
+ * keys storage (or given twice), or if there are not enough free key slots
+ *
+ * @param device_path The path of the device to add users to
+ * @param other_public_key_paths The paths of the public keys to add
+ * @param nb_users The number of public keys to add
+ * @param my_private_key_path A path to the private key already registered
+ * @return int 0 if success, -1 users not added
+ */
+int cryptfs_addusers(const char *device_path,
+                     const char *const *other_public_key_paths,
+                     size_t nb_users, const char *my_private_key_path);
+
 #endif /* ADDUSER_H */
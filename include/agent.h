@@ -0,0 +1,121 @@
+#ifndef AGENT_H
+#define AGENT_H
+
+#include <openssl/sha.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "cryptfs.h"
+
+#define AGENT_SOCKET_ENV "SHLKFS_AGENT_SOCK" // Socket of the running agent
+#define AGENT_MAX_KEYS 512 // Number of master keys held by an agent
+#define AGENT_TIMEOUT_SEC 5 // Timeout of a request
+
+/**
+ * @brief Operations served by the agent.
+ */
+enum agent_op
+{
+    AGENT_OP_ADD = 1, // Hold the master key of a key slot
+    AGENT_OP_GET, // Get the master key of one of the given key slots
+    AGENT_OP_CLEAR, // Forget all the master keys
+};
+
+/**
+ * @brief Request sent to the agent.
+ *
+ * @details A key slot is identified by the SHA-256 of its encrypted master key
+ * (`aes_key_ciphered`): the agent does not know the volumes, it replaces the
+ * RSA decryption of a key slot it has already seen (a rotation of the master
+ * key rewraps the key slots, so the old master key is never served again).
+ */
+struct agent_request
+{
+    uint8_t op; // enum agent_op
+    uint8_t nb_slots; // Number of key slots (AGENT_OP_GET), 1 (AGENT_OP_ADD)
+    uint8_t slot_ids[NB_ENCRYPTION_KEYS][SHA256_DIGEST_LENGTH]; // Key slots
+    uint8_t aes_key[AES_KEY_SIZE_BYTES]; // Master key (AGENT_OP_ADD)
+} __attribute__((packed));
+
+/**
+ * @brief Response of the agent.
+ */
+struct agent_response
+{
+    int8_t status; // 0 on success, -1 if the master key is unknown (or error)
+    uint8_t index; // Index of the key slot in the request (AGENT_OP_GET)
+    uint8_t aes_key[AES_KEY_SIZE_BYTES]; // Master key (AGENT_OP_GET)
+} __attribute__((packed));
+
+/**
+ * @brief Create the listening socket of an agent.
+ *
+ * @details The socket is only accessible by the user (and the requests of the
+ * other users are rejected anyway, see agent_serve).
+ *
+ * @param socket_path The path of the socket (replaced if it exists).
+ * @return int The listening socket, -1 on error (error printed).
+ */
+int agent_listen(const char *socket_path);
+
+/**
+ * @brief Serve the requests of the tools until SIGINT or SIGTERM.
+ *
+ * @details The master keys are held in locked memory (never swapped out, and
+ * excluded from the core dumps), and are wiped on exit. Only the processes of
+ * the user running the agent are served (checked with SO_PEERCRED).
+ *
+ * @param listen_fd The listening socket (see agent_listen), closed on exit.
+ * @param socket_path The path of the socket (removed on exit).
+ * @return int 0 on success, -1 on error (error printed).
+ */
+int agent_serve(int listen_fd, const char *socket_path);
+
+/**
+ * @brief Give the master key of a key slot to the running agent (see
+ * AGENT_SOCKET_ENV).
+ *
+ * @param key_slot The key slot.
+ * @param aes_key The master key decrypted from the key slot.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+int agent_add_key(const struct CryptFS_KeySlot *key_slot,
+                  const unsigned char *aes_key);
+
+/**
+ * @brief Make the running agent forget all the master keys.
+ *
+ * @return int 0 on success, -1 on error (error printed).
+ */
+int agent_clear(void);
+
+/**
+ * @brief Get the master key of a volume from the running agent, if any.
+ *
+ * @details Only the key slots of the device are read (the key slots of a key
+ * table are sent by batches of NB_ENCRYPTION_KEYS). Nothing is printed if no
+ * agent is running or if it does not know the volume: the caller falls back to
+ * the private key of the user.
+ *
+ * @param device_path The path of the device of the volume.
+ * @param index The index of the key slot of the user (filled if not NULL).
+ * @return unsigned char* The master key, NULL if not served by an agent (or
+ * if the device cannot be read: the program does not exit).
+ */
+unsigned char *agent_extract_aes_key(const char *device_path, ssize_t *index);
+
+/**
+ * @brief Unlock volumes with a private key, and give their master keys to the
+ * running agent (the passphrase is asked and the private key is loaded once).
+ *
+ * @param device_paths The paths of the devices of the volumes.
+ * @param nb_devices The number of devices.
+ * @param private_key_path A path to a private key registered in the volumes.
+ * @return int 0 if success, -1 if a volume was not added.
+ */
+int cryptfs_agent_add(const char *const *device_paths, size_t nb_devices,
+                      const char *private_key_path);
+
+#endif /* AGENT_H */
@@ -0,0 +1,84 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CRYPTFS_BACKUP_MAGIC "shlkbak" // Magic number of a backup file
+#define CRYPTFS_BACKUP_MAGIC_SIZE (sizeof(CRYPTFS_BACKUP_MAGIC) - 1)
+#define CRYPTFS_BACKUP_VERSION 1
+#define CRYPTFS_RESTORE_SUFFIX ".restored" // Suffix of the restore state
+
+/**
+ * @brief Header of a backup file, followed by extents of blocks.
+ *
+ * @details A backup contains the blocks of a device as they are on the device
+ * (encrypted): all of them for a full backup, the ones written since the
+ * previous backup for an incremental backup (see cbt.h).
+ */
+struct CryptFS_Backup_Header
+{
+    uint8_t magic[CRYPTFS_BACKUP_MAGIC_SIZE]; // Magic number
+    uint16_t version; // CRYPTFS_BACKUP_VERSION
+    uint8_t incremental; // 1 for an incremental backup, 0 for a full one
+    uint32_t block_size; // in bytes
+    uint64_t device_size; // Size of the device (in bytes)
+    uint64_t epoch; // Number of the backup
+} __attribute__((packed));
+
+/**
+ * @brief An extent of a backup file, followed by its blocks. The backup ends
+ * with an extent of 0 blocks.
+ */
+struct CryptFS_Backup_Extent
+{
+    uint64_t start_block; // First block of the extent
+    uint64_t nb_blocks; // Number of blocks of the extent
+} __attribute__((packed));
+
+/**
+ * @brief Restore state of a device: the last backup restored on it. It is
+ * stored in a state file of the device (see cbt_state_path), so that the
+ * incremental backups are restored in order.
+ */
+struct CryptFS_Restore_State
+{
+    uint8_t magic[CRYPTFS_BACKUP_MAGIC_SIZE]; // Magic number
+    uint16_t version; // CRYPTFS_BACKUP_VERSION
+    uint32_t block_size; // in bytes
+    uint64_t epoch; // Number of the last restored backup
+} __attribute__((packed));
+
+/**
+ * @brief Back up the blocks of a device (the volume must not be mounted).
+ *
+ * @details A full backup enables the changed-block tracking of the device
+ * (see cbt.h), and each backup resets it: an incremental backup only contains
+ * the blocks written since the previous backup. The blocks are copied
+ * encrypted, so no key is needed. The device is locked exclusively until the
+ * copy ends, so it cannot be mounted meanwhile (see block_device_lock).
+ *
+ * @param device_path The path of the device of the volume.
+ * @param backup_path The path of the backup file to write.
+ * @param incremental true for an incremental backup, false for a full one.
+ * @return int 0 if success, -1 otherwise.
+ */
+int cryptfs_backup(const char *device_path, const char *backup_path,
+                   bool incremental);
+
+/**
+ * @brief Restore a backup on a device (the volume must not be mounted).
+ *
+ * @note The full backup is restored first (the device is created if it does
+ * not exist), then the incremental backups made after it, in order: an
+ * incremental backup is refused if the previous backup (by epoch) is not the
+ * last one restored on the device. The device must not be written between
+ * the restores.
+ *
+ * @param device_path The path of the device.
+ * @param backup_path The path of the backup file to restore.
+ * @return int 0 if success, -1 otherwise.
+ */
+int cryptfs_restore(const char *device_path, const char *backup_path);
+
+#endif /* BACKUP_H */
@@ -1,6 +1,7 @@
 #ifndef BLOCK_H
 #define BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
@@ -9,26 +10,290 @@ typedef size_t block_t;
 typedef ssize_t sblock_t;
 
 /**
- * @brief Set the device path global variable.
+ * @brief Cipher of the blocks of a volume (`cipher` of struct CryptFS_Header).
+ */
+enum cryptfs_cipher
+{
+    CRYPTFS_CIPHER_AES_256_CBC = 0, // AES-256-CBC, the same IV for all the
+                                    // blocks (volumes of version 1)
+    CRYPTFS_CIPHER_AES_256_XTS = 1, // AES-256-XTS, tweaked by the block number
+    CRYPTFS_CIPHER_CHACHA20 = 2, // ChaCha20, the block number as nonce
+};
+
+/**
+ * @brief A request of a batch of reads/writes (see read_blocks_batch).
+ */
+struct block_request
+{
+    block_t start_block; // The first block to read/write
+    size_t nb_blocks; // The number of contiguous blocks to read/write
+    void *buffer; // At least get_block_size() * nb_blocks bytes
+};
+
+/**
+ * @brief A device opened by the block layer (see block_device_open).
+ */
+struct block_device;
+
+/**
+ * @brief Set the path of the default device, and open it. Exits the program
+ * if the device cannot be opened or is too small.
+ *
+ * @note The block functions access the device used by the calling thread
+ * (see block_device_use), which is the default device unless another one is
+ * used. Accessing the default device before it is opened exits the program,
+ * so that a missing block_device_use (or SHLKFS_CTX_SCOPE) is not silent.
  *
  * @param path The path of the device.
  */
 void set_device_path(const char *path);
 
 /**
- * @brief Get the device path global variable.
+ * @brief Get the path of the device used by the calling thread.
  *
- * @return The device path global variable.
+ * @return The path of the device.
  */
 const char *get_device_path(void);
 
+/**
+ * @brief Open a device, independently of the default device. It keeps the
+ * modes set when it is opened (the backend, see set_block_backend, the
+ * discard and the direct I/O modes) until it is closed.
+ *
+ * @note The opened devices (including the default device) hold a shared lock
+ * (flock) on their file, so that it cannot be backed up meanwhile (see
+ * cryptfs_backup).
+ *
+ * @param path The path of the device.
+ * @param block_size The block size of the device (must be supported).
+ * @return struct block_device* The device, NULL on error (the device cannot
+ * be opened or is too small).
+ */
+struct block_device *block_device_open(const char *path, size_t block_size);
+
+/**
+ * @brief Close a device opened with block_device_open.
+ *
+ * @warning The device must not be used by another thread anymore.
+ *
+ * @param device The device (can be NULL).
+ */
+void block_device_close(struct block_device *device);
+
+/**
+ * @brief Turn the shared lock of a device opened with block_device_open into
+ * an exclusive one, held until the device is closed: the device cannot be
+ * opened by anyone else meanwhile (see cryptfs_backup).
+ *
+ * @param device The device.
+ * @return int 0 on success, -1 on error (error printed, e.g. if the device is
+ * opened elsewhere).
+ */
+int block_device_lock(struct block_device *device);
+
+/**
+ * @brief Set the device accessed by the block functions called from the
+ * calling thread.
+ *
+ * @param device The device, NULL for the default device.
+ * @return struct block_device* The device used before (NULL for the default
+ * device), to restore it.
+ */
+struct block_device *block_device_use(struct block_device *device);
+
+/**
+ * @brief Check if the given block size is supported by this implementation.
+ *
+ * @note A supported block size is a power of two between
+ * CRYPTFS_BLOCK_SIZE_BYTES and CRYPTFS_BLOCK_SIZE_MAX_BYTES.
+ *
+ * @param block_size The block size to check (in bytes).
+ * @return true if the block size is supported, false otherwise.
+ */
+bool is_block_size_supported(size_t block_size);
+
+/**
+ * @brief Set the block size of the device used by the calling thread
+ * (CRYPTFS_BLOCK_SIZE_BYTES by default). Exits the program if the block size
+ * is not supported.
+ *
+ * @param block_size The block size of the device (in bytes).
+ */
+void set_block_size(size_t block_size);
+
+/**
+ * @brief Get the block size of the device used by the calling thread.
+ *
+ * @return The block size of the device (in bytes).
+ */
+size_t get_block_size(void);
+
+/**
+ * @brief Set the cipher of the blocks of the device used by the calling
+ * thread (CRYPTFS_CIPHER_AES_256_CBC by default): the encryption and
+ * decryption functions go through its operations (see block_cipher.h). Exits
+ * the program if the cipher is not supported.
+ *
+ * @param cipher The cipher of the device.
+ */
+void set_block_cipher(enum cryptfs_cipher cipher);
+
+/**
+ * @brief Get the cipher of the blocks of the device used by the calling
+ * thread.
+ *
+ * @return enum cryptfs_cipher The cipher of the device.
+ */
+enum cryptfs_cipher get_block_cipher(void);
+
+/**
+ * @brief Get the size of the device used by the calling thread.
+ *
+ * @return The size of the device (in bytes).
+ */
+size_t get_device_size(void);
+
+/**
+ * @brief Enable or disable the discard mode of the devices opened from now on
+ * (see block_device_open) and of the default device.
+ *
+ * @note When the discard mode is enabled, the blocks freed by the filesystem
+ * are discarded on the device (see discard_blocks).
+ *
+ * @param enabled true to discard freed blocks, false otherwise.
+ */
+void set_discard_mode(bool enabled);
+
+/**
+ * @brief Get the discard mode of the device used by the calling thread.
+ *
+ * @return true if freed blocks are discarded, false otherwise.
+ */
+bool get_discard_mode(void);
+
+/**
+ * @brief Enable or disable the io_uring mode of the devices opened from now on
+ * (see block_device_open). The default device is opened again.
+ *
+ * @note When the io_uring mode is enabled, the device is accessed through an
+ * io_uring instance: the requests of a batch (see read_blocks_batch) are
+ * submitted with a single syscall and completed asynchronously. Exits the
+ * program if SherlockFS was compiled without io_uring support
+ * (SHLKFS_IO_URING=1).
+ *
+ * @param enabled true to use io_uring, false to use stdio.
+ */
+void set_io_uring_mode(bool enabled);
+
+/**
+ * @brief Get the io_uring mode of the devices opened from now on.
+ *
+ * @return true if the device is accessed through io_uring, false otherwise.
+ */
+bool get_io_uring_mode(void);
+
+/**
+ * @brief Enable or disable the direct I/O mode of the devices opened from now
+ * on (see block_device_open). The default device is opened again.
+ *
+ * @note When the direct I/O mode is enabled, the device is opened with
+ * O_DIRECT: the blocks do not go through the page cache of the host, which
+ * would otherwise hold the ciphertext in addition to the plaintext cached
+ * above FUSE. Exits the program if the device does not support direct I/O.
+ *
+ * @param enabled true to bypass the page cache, false otherwise.
+ */
+void set_direct_io_mode(bool enabled);
+
+/**
+ * @brief Get the direct I/O mode of the device used by the calling thread.
+ *
+ * @return true if the device is opened with O_DIRECT, false otherwise.
+ */
+bool get_direct_io_mode(void);
+
+/**
+ * @brief Enable or disable the mmap mode of the devices opened from now on
+ * (see block_device_open). The default device is opened again.
+ *
+ * @note When the mmap mode is enabled, the device (an image file) is mapped
+ * in memory: reading and writing blocks are memory copies, and the blocks are
+ * decrypted straight out of (encrypted straight into) the mapping. The image
+ * file and the mapping grow on demand. The writes reach the image file on
+ * flush_blocks. Exits the program if the device cannot be mapped.
+ *
+ * @param enabled true to map the device in memory, false otherwise.
+ */
+void set_mmap_mode(bool enabled);
+
+/**
+ * @brief Get the mmap mode of the devices opened from now on.
+ *
+ * @return true if the device is mapped in memory, false otherwise.
+ */
+bool get_mmap_mode(void);
+
+/**
+ * @brief Read bytes of a device (e.g. the headers of a filesystem, before its
+ * block size is known).
+ *
+ * @note The device is accessed with the backend of the block layer (see
+ * set_block_backend), through the opened device if `path` is the device path.
+ *
+ * @param path The path of the device.
+ * @param offset The offset to read from.
+ * @param size The number of bytes to read (inside the device).
+ * @param buffer The buffer to fill.
+ * @return 0 on success, BLOCK_ERROR on error (the device cannot be opened or
+ * is too small).
+ */
+int read_device_bytes(const char *path, off_t offset, size_t size,
+                      void *buffer);
+
+/**
+ * @brief Write bytes to a device (see read_device_bytes).
+ *
+ * @param path The path of the device.
+ * @param offset The offset to write at.
+ * @param size The number of bytes to write (inside the device).
+ * @param buffer The bytes to write.
+ * @return 0 on success, BLOCK_ERROR on error (the device cannot be opened or
+ * is too small).
+ */
+int write_device_bytes(const char *path, off_t offset, size_t size,
+                       const void *buffer);
+
+/**
+ * @brief Make the blocks written so far durable on the device (msync in mmap
+ * mode, fsync otherwise), after the changed-block tracking file if any.
+ *
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+int flush_blocks(void);
+
+/**
+ * @brief Discard blocks of the device, so that the underlying storage can
+ * reclaim them.
+ *
+ * @note Uses BLKDISCARD on block devices and punches a hole
+ * (fallocate(FALLOC_FL_PUNCH_HOLE)) in image files. Does nothing if the
+ * discard mode is disabled. A device which does not support discarding is not
+ * considered as an error.
+ *
+ * @param start_block The first block to discard.
+ * @param nb_blocks The number of blocks to discard.
+ *
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+int discard_blocks(block_t start_block, size_t nb_blocks);
+
 /**
  * @brief Read blocks from the device.
  *
  * @param start_block The first block to read.
  * @param nb_blocks The number of blocks to read.
  * @param buffer The buffer to fill with the blocks.
- * (Must be allocated with at least CRYPTFS_BLOCK_SIZE_BYTES * nb_blocks bytes)
+ * (Must be allocated with at least get_block_size() * nb_blocks bytes)
  *
  * @return 0 on success, -1 on error.
  */
@@ -37,6 +302,10 @@ int read_blocks(block_t start_block, size_t nb_blocks, void *buffer);
 /**
  * @brief Write blocks to the device.
  *
+ * @note If the changed-block tracking of the device is enabled (see cbt.h),
+ * the blocks are marked as changed before being written (as for all the
+ * writes of the block layer).
+ *
  * @param start_block The first block to write.
  * @param nb_blocks The number of blocks to write.
  * @param buffer The buffer containing the blocks.
@@ -45,6 +314,34 @@ int read_blocks(block_t start_block, size_t nb_blocks, void *buffer);
  */
 int write_blocks(block_t start_block, size_t nb_blocks, const void *buffer);
 
+/**
+ * @brief Read a batch of (non contiguous) blocks from the device.
+ *
+ * @note In io_uring mode, all the requests are in flight at the same time.
+ * Otherwise, they are read one after the other.
+ *
+ * @param requests The requests (the buffers are filled with the blocks).
+ * @param nb_requests The number of requests.
+ *
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+int read_blocks_batch(const struct block_request *requests,
+                      size_t nb_requests);
+
+/**
+ * @brief Write a batch of (non contiguous) blocks to the device.
+ *
+ * @note In io_uring mode, all the requests are in flight at the same time.
+ * Otherwise, they are written one after the other.
+ *
+ * @param requests The requests (the buffers contain the blocks).
+ * @param nb_requests The number of requests.
+ *
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+int write_blocks_batch(const struct block_request *requests,
+                       size_t nb_requests);
+
 /**
  * @brief Read a block from the device and decrypt it.
  *
@@ -71,4 +368,110 @@ int write_blocks_with_encryption(const unsigned char *aes_key,
                                  block_t start_block, size_t nb_blocks,
                                  const void *buffer);
 
+/**
+ * @brief Read a batch of (non contiguous) blocks from the device and decrypt
+ * them.
+ *
+ * @details Unless they are large, the requests are read together, then their
+ * blocks decrypted by batches spanning the requests (see struct
+ * block_cipher_ops).
+ *
+ * @param aes_key The AES key to use for decryption.
+ * @param requests The requests (the buffers are filled with the blocks).
+ * @param nb_requests The number of requests.
+ * @return int 0 on success, -1 on error.
+ */
+int read_blocks_batch_with_decryption(const unsigned char *aes_key,
+                                      const struct block_request *requests,
+                                      size_t nb_requests);
+
+/**
+ * @brief Encrypt a batch of (non contiguous) blocks and write them to the
+ * device.
+ *
+ * @details Unless they are large, the blocks of the requests are encrypted by
+ * batches spanning the requests, then written together.
+ *
+ * @param aes_key The AES key to use for encryption.
+ * @param requests The requests (the buffers contain the blocks).
+ * @param nb_requests The number of requests.
+ * @return int 0 on success, -1 on error.
+ */
+int write_blocks_batch_with_encryption(const unsigned char *aes_key,
+                                       const struct block_request *requests,
+                                       size_t nb_requests);
+
+/**
+ * @brief Decrypt in place a batch of (non contiguous) blocks already read from
+ * the device (on all cores if they are large enough).
+ *
+ * @param aes_key The AES key to use for decryption.
+ * @param requests The requests (the buffers contain the encrypted blocks,
+ * replaced by the decrypted ones).
+ * @param nb_requests The number of requests.
+ * @return int 0 on success, -1 on error.
+ */
+int decrypt_blocks_batch(const unsigned char *aes_key,
+                         const struct block_request *requests,
+                         size_t nb_requests);
+
+/**
+ * @brief Encrypt in place a batch of (non contiguous) blocks before writing
+ * them to the device (on all cores if they are large enough).
+ *
+ * @param aes_key The AES key to use for encryption.
+ * @param requests The requests (the buffers contain the blocks, replaced by
+ * the encrypted ones).
+ * @param nb_requests The number of requests.
+ * @return int 0 on success, -1 on error.
+ */
+int encrypt_blocks_batch(const unsigned char *aes_key,
+                         const struct block_request *requests,
+                         size_t nb_requests);
+
+/**
+ * @brief Decrypt blocks already read from the device (on all cores if they
+ * are large enough).
+ *
+ * @param aes_key The AES key to use for decryption.
+ * @param blocks The number of each block (they are not necessarily
+ * contiguous, and the cipher may depend on them).
+ * @param encrypted The encrypted blocks.
+ * @param decrypted The buffer to fill with the decrypted blocks.
+ * @param nb_blocks The number of blocks.
+ * @return int 0 on success, -1 on error.
+ */
+int decrypt_blocks(const unsigned char *aes_key, const block_t *blocks,
+                   const void *encrypted, void *decrypted, size_t nb_blocks);
+
+/**
+ * @brief Encrypt blocks before writing them to the device (on all cores if
+ * they are large enough).
+ *
+ * @param aes_key The AES key to use for encryption.
+ * @param blocks The number of each block (they are not necessarily
+ * contiguous, and the cipher may depend on them).
+ * @param decrypted The blocks to encrypt.
+ * @param encrypted The buffer to fill with the encrypted blocks (can be
+ * `decrypted`).
+ * @param nb_blocks The number of blocks.
+ * @return int 0 on success, -1 on error.
+ */
+int encrypt_blocks(const unsigned char *aes_key, const block_t *blocks,
+                   const void *decrypted, void *encrypted, size_t nb_blocks);
+
+/**
+ * @brief Decrypt only the beginning of a block already read from the device.
+ *
+ * @param aes_key The AES key to use for decryption.
+ * @param block The number of the block.
+ * @param encrypted The encrypted block.
+ * @param decrypted The buffer to fill with the first `size` decrypted bytes.
+ * @param size The number of bytes to decrypt (a multiple of the AES block
+ * size).
+ * @return int 0 on success, -1 on error.
+ */
+int decrypt_block_head(const unsigned char *aes_key, block_t block,
+                       const void *encrypted, void *decrypted, size_t size);
+
 #endif /* BLOCK_H */
@@ -0,0 +1,211 @@
+#ifndef BLOCK_BACKEND_H
+#define BLOCK_BACKEND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "block.h"
+
+/**
+ * @brief Operations of a block device backend (the way the device is
+ * accessed).
+ *
+ * @details A backend opens a device (identified by its path) into a handle,
+ * and the block layer uses the handle for all the accesses to the device.
+ * The offsets and sizes are in bytes, the requests of readv/writev are in
+ * blocks (of the block size of the device, given by the block layer).
+ *
+ * @note The optional operations are NULL when not supported.
+ */
+struct block_backend_ops
+{
+    const char *name; // Name of the backend
+
+    /**
+     * @brief Open a device.
+     *
+     * @param path The path of the device.
+     * @param direct_io true to bypass the page cache (O_DIRECT), for the
+     * backends accessing a file descriptor kept open.
+     * @return void* The handle of the device, NULL on error.
+     */
+    void *(*open)(const char *path, bool direct_io);
+
+    /**
+     * @brief Close a device.
+     *
+     * @param handle The handle of the device.
+     */
+    void (*close)(void *handle);
+
+    /**
+     * @brief Read bytes from a device.
+     *
+     * @param handle The handle of the device.
+     * @param offset The offset to read from.
+     * @param size The number of bytes to read.
+     * @param buffer The buffer to fill.
+     * @return 0 on success, BLOCK_ERROR on error.
+     */
+    int (*read)(void *handle, off_t offset, size_t size, void *buffer);
+
+    /**
+     * @brief Write bytes to a device.
+     *
+     * @param handle The handle of the device.
+     * @param offset The offset to write at.
+     * @param size The number of bytes to write.
+     * @param buffer The bytes to write.
+     * @return 0 on success, BLOCK_ERROR on error.
+     */
+    int (*write)(void *handle, off_t offset, size_t size, const void *buffer);
+
+    /**
+     * @brief Read a batch of requests from a device.
+     *
+     * @param handle The handle of the device.
+     * @param block_size The block size of the device.
+     * @param requests The requests (the buffers are filled with the blocks).
+     * @param nb_requests The number of requests.
+     * @return 0 on success, BLOCK_ERROR on error.
+     */
+    int (*readv)(void *handle, size_t block_size,
+                 const struct block_request *requests, size_t nb_requests);
+
+    /**
+     * @brief Write a batch of requests to a device.
+     *
+     * @param handle The handle of the device.
+     * @param block_size The block size of the device.
+     * @param requests The requests (the buffers contain the blocks).
+     * @param nb_requests The number of requests.
+     * @return 0 on success, BLOCK_ERROR on error.
+     */
+    int (*writev)(void *handle, size_t block_size,
+                  const struct block_request *requests, size_t nb_requests);
+
+    /**
+     * @brief Make the writes durable on a device.
+     *
+     * @param handle The handle of the device.
+     * @return 0 on success, BLOCK_ERROR on error.
+     */
+    int (*flush)(void *handle);
+
+    /**
+     * @brief Discard a range of a device (a device which does not support
+     * discarding is not considered as an error).
+     *
+     * @param handle The handle of the device.
+     * @param offset The offset of the range.
+     * @param size The size of the range.
+     * @return 0 on success, BLOCK_ERROR on error.
+     */
+    int (*discard)(void *handle, off_t offset, size_t size);
+
+    /**
+     * @brief Get the size of a device.
+     *
+     * @param handle The handle of the device.
+     * @return size_t The size of the device in bytes.
+     */
+    size_t (*size)(void *handle);
+
+    /**
+     * @brief (Optional) Get a pointer to a range of a device held in memory,
+     * and lock it in memory until unmap is called.
+     *
+     * @param handle The handle of the device.
+     * @param offset The offset of the range.
+     * @param size The size of the range.
+     * @param writing true if the range is going to be written (the device
+     * grows if needed).
+     * @return unsigned char* The range (locked), NULL if it is out of the
+     * device (not locked).
+     */
+    unsigned char *(*map)(void *handle, off_t offset, size_t size,
+                          bool writing);
+
+    /**
+     * @brief (Optional) Unlock a range returned by map.
+     *
+     * @param handle The handle of the device.
+     */
+    void (*unmap)(void *handle);
+};
+
+// stdio (fopen/fread/fwrite) on each access: the default backend
+extern const struct block_backend_ops block_backend_stdio;
+// pread/pwrite on a file descriptor kept open (O_DIRECT if asked)
+extern const struct block_backend_ops block_backend_pio;
+// Shared memory mapping of an image file
+extern const struct block_backend_ops block_backend_mmap;
+// Named devices held in memory (see ram_disk_create)
+extern const struct block_backend_ops block_backend_ram;
+#ifdef SHLKFS_IO_URING
+// io_uring instance, the requests of a batch are submitted together
+extern const struct block_backend_ops block_backend_uring;
+#endif /* SHLKFS_IO_URING */
+
+/**
+ * @brief Set the backend used by the block layer to open the devices. The
+ * default device is closed: it must be set again (see set_device_path).
+ *
+ * @note By default (NULL), the backend is chosen from the modes:
+ * block_backend_mmap in mmap mode, block_backend_uring in io_uring mode,
+ * block_backend_pio in direct I/O mode, block_backend_stdio otherwise.
+ *
+ * @param backend The backend, NULL to choose it from the modes.
+ */
+void set_block_backend(const struct block_backend_ops *backend);
+
+/**
+ * @brief Get the backend of the device used by the calling thread.
+ *
+ * @return The backend of the device.
+ */
+const struct block_backend_ops *get_block_backend(void);
+
+/**
+ * @brief Discard a range of an open device (BLKDISCARD on block devices, hole
+ * punching on image files). Used by the backends accessing a file.
+ *
+ * @param fd The file descriptor of the device.
+ * @param path The path of the device (for error messages).
+ * @param offset The offset of the range.
+ * @param size The size of the range.
+ * @return 0 on success (or if discarding is not supported), BLOCK_ERROR on
+ * error.
+ */
+int block_backend_discard_fd(int fd, const char *path, off_t offset,
+                             size_t size);
+
+/**
+ * @brief Get the size of an open device (image file or block device). Used
+ * by the backends accessing a file.
+ *
+ * @param fd The file descriptor of the device.
+ * @return size_t The size of the device in bytes, 0 on error.
+ */
+size_t block_backend_size_fd(int fd);
+
+/**
+ * @brief Create a zeroed RAM disk, which can then be used as a device with
+ * the block_backend_ram backend.
+ *
+ * @note A RAM disk which already exists with the same name is replaced.
+ *
+ * @param name The name of the RAM disk (its device path).
+ * @param size The size of the RAM disk in bytes.
+ */
+void ram_disk_create(const char *name, size_t size);
+
+/**
+ * @brief Destroy a RAM disk.
+ *
+ * @param name The name of the RAM disk.
+ */
+void ram_disk_destroy(const char *name);
+
+#endif /* BLOCK_BACKEND_H */
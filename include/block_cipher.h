@@ -0,0 +1,91 @@
+#ifndef BLOCK_CIPHER_H
+#define BLOCK_CIPHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "block.h"
+
+// Size of the largest key of the blocks (see derive_key)
+#define BLOCK_CIPHER_KEY_MAX_BYTES 64
+
+/**
+ * @brief A block of a batch of encryptions/decryptions (see crypt).
+ */
+struct block_cipher_request
+{
+    block_t block; // The number of the block
+    const void *src; // The block to encrypt/decrypt
+    void *dst; // The encrypted/decrypted block (can be `src`)
+};
+
+/**
+ * @brief Operations of a block cipher (the way the blocks of a volume are
+ * encrypted, see `cipher` in struct CryptFS_Header).
+ *
+ * @details The key of the blocks is derived from the master key once per
+ * request, then each block is encrypted on its own, with its number: the
+ * blocks of a request can be spread on several threads, by batches.
+ */
+struct block_cipher_ops
+{
+    const char *name; // Name of the cipher (see shlkfs.mkfs)
+
+    size_t key_size; // Size of the key of the blocks (in bytes)
+
+    /**
+     * @brief Derive the key of the blocks from the master key.
+     *
+     * @param aes_key The master key (AES_KEY_SIZE_BYTES).
+     * @param key The key of the blocks (returned, `key_size` bytes).
+     */
+    void (*derive_key)(const unsigned char *aes_key, unsigned char *key);
+
+    /**
+     * @brief Encrypt or decrypt a batch of blocks, with a single cipher
+     * context (the key is set up once, only the IV changes with the blocks).
+     *
+     * @note Only the beginning of the blocks can be decrypted (the first
+     * `size` bytes of the blocks are given).
+     *
+     * @param key The key of the blocks (see derive_key).
+     * @param requests The blocks.
+     * @param nb_requests The number of blocks.
+     * @param size The number of bytes to encrypt/decrypt per block (a
+     * multiple of the AES block size).
+     * @param encrypt true to encrypt, false to decrypt.
+     * @return 0 on success, -1 on error.
+     */
+    int (*crypt)(const unsigned char *key,
+                 const struct block_cipher_request *requests,
+                 size_t nb_requests, size_t size, bool encrypt);
+};
+
+// AES-256-CBC, the same IV for all the blocks (volumes of version 1)
+extern const struct block_cipher_ops block_cipher_aes_256_cbc;
+// AES-256-XTS, tweaked by the number of the block
+extern const struct block_cipher_ops block_cipher_aes_256_xts;
+// ChaCha20, with the number of the block as nonce: a rewritten block reuses
+// its keystream, so it only opens the volumes already formatted with it (not
+// offered by shlkfs.mkfs)
+extern const struct block_cipher_ops block_cipher_chacha20;
+
+/**
+ * @brief Get the operations of a cipher.
+ *
+ * @param cipher The cipher (`cipher` of struct CryptFS_Header).
+ * @return const struct block_cipher_ops* The operations of the cipher, NULL
+ * if the cipher is not supported by this implementation.
+ */
+const struct block_cipher_ops *block_cipher_get(enum cryptfs_cipher cipher);
+
+/**
+ * @brief Find a cipher from its name.
+ *
+ * @param name The name of the cipher (e.g. "aes-256-xts").
+ * @param cipher The cipher (returned).
+ * @return int 0 on success, -1 if no cipher has this name.
+ */
+int block_cipher_find(const char *name, enum cryptfs_cipher *cipher);
+
+#endif /* BLOCK_CIPHER_H */
@@ -0,0 +1,157 @@
+#ifndef CBT_H
+#define CBT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CBT_MAGIC "shlkcbt" // Magic number of a changed-block tracking file
+#define CBT_MAGIC_SIZE (sizeof(CBT_MAGIC) - 1) // exclude '\0'
+#define CBT_VERSION 1
+#define CBT_SUFFIX ".cbt" // Suffix of the tracking file of a device
+// Directory of the state files of the devices that are not image files
+#define CBT_STATE_DIR "/var/lib/sherlockfs"
+
+/**
+ * @brief Header of a changed-block tracking file, followed by the bitmap of
+ * the blocks of the device (bit i of byte j is set if the block j * 8 + i was
+ * written since the last backup).
+ *
+ * @details The path of the tracking file of a device is its state path with
+ * CBT_SUFFIX (see cbt_state_path). The tracking is enabled when the file
+ * exists: it is created by the first full backup, and reset by each backup
+ * (see backup.h).
+ *
+ * @note The blocks beyond the bitmap (when the device grows) are always
+ * considered as changed.
+ */
+struct CryptFS_CBT_Header
+{
+    uint8_t magic[CBT_MAGIC_SIZE]; // Magic number
+    uint16_t version; // CBT_VERSION
+    uint32_t block_size; // Size of the tracked blocks (in bytes)
+    uint64_t nb_blocks; // Number of blocks of the bitmap
+    uint64_t epoch; // Number of the last backup (incremented at each reset)
+} __attribute__((packed));
+
+/**
+ * @brief A changed-block tracking file mapped in memory.
+ */
+struct cbt;
+
+/**
+ * @brief Get the path of a state file of a device (such as its tracking
+ * file): the path of an image file followed by `suffix`, or, for a block
+ * device, a file of CBT_STATE_DIR named after the path of the device ('/'
+ * replaced by '!') followed by `suffix` (/dev does not outlive a reboot).
+ *
+ * @note CBT_STATE_DIR is created if needed.
+ *
+ * @param device_path The path of the device.
+ * @param suffix The suffix of the state file.
+ * @return char* The path of the state file. (to free)
+ */
+char *cbt_state_path(const char *device_path, const char *suffix);
+
+/**
+ * @brief Open the tracking file of a device, if the tracking is enabled.
+ *
+ * @param device_path The path of the device.
+ * @param cbt The tracking file (returned, NULL if the tracking is disabled).
+ * @return int 0 on success, -1 if the tracking file is invalid (error
+ * printed).
+ */
+int cbt_open(const char *device_path, struct cbt **cbt);
+
+/**
+ * @brief Enable the tracking of a device (all the blocks are clean), or reset
+ * it if it is already enabled.
+ *
+ * @param device_path The path of the device.
+ * @param block_size The size of the tracked blocks (in bytes).
+ * @param nb_blocks The number of blocks of the device.
+ * @param epoch The number of the backup the tracking starts from.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+int cbt_enable(const char *device_path, size_t block_size, size_t nb_blocks,
+               uint64_t epoch);
+
+/**
+ * @brief Disable the tracking of a device (its tracking file is removed).
+ *
+ * @param device_path The path of the device.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+int cbt_disable(const char *device_path);
+
+/**
+ * @brief Close a tracking file (the marks are kept).
+ *
+ * @param cbt The tracking file (can be NULL).
+ */
+void cbt_close(struct cbt *cbt);
+
+/**
+ * @brief Mark the blocks of a range of bytes of the device as changed.
+ *
+ * @note Safe to call from several threads.
+ *
+ * @param cbt The tracking file (nothing is done if NULL).
+ * @param offset The offset of the range (in bytes).
+ * @param size The size of the range (in bytes).
+ */
+void cbt_mark(struct cbt *cbt, off_t offset, size_t size);
+
+/**
+ * @brief Merge the marks of a previous tracking file of a device into its
+ * current one, which starts from the epoch of the previous one again (when
+ * the backup that replaced it failed).
+ *
+ * @note All the blocks are marked if the block sizes differ.
+ *
+ * @param cbt The current tracking file.
+ * @param previous The previous tracking file.
+ */
+void cbt_merge(struct cbt *cbt, const struct cbt *previous);
+
+/**
+ * @brief Check if a block was written since the last backup.
+ *
+ * @param cbt The tracking file.
+ * @param block The block (in blocks of the tracking file).
+ * @return true if the block changed (or is beyond the bitmap), false
+ * otherwise.
+ */
+bool cbt_is_changed(const struct cbt *cbt, size_t block);
+
+/**
+ * @brief Find the first block written since the last backup, from a block.
+ *
+ * @param cbt The tracking file.
+ * @param block The block to start from (in blocks of the tracking file).
+ * @return size_t The first changed block from `block` (the blocks beyond the
+ * bitmap are changed).
+ */
+size_t cbt_next_changed(const struct cbt *cbt, size_t block);
+
+/**
+ * @brief Get the header of a tracking file.
+ *
+ * @param cbt The tracking file.
+ * @return const struct CryptFS_CBT_Header* The header.
+ */
+const struct CryptFS_CBT_Header *cbt_header(const struct cbt *cbt);
+
+/**
+ * @brief Write the marks of a tracking file to its storage.
+ *
+ * @note Called before the device is flushed, so that the marks of the
+ * durable blocks are durable too.
+ *
+ * @param cbt The tracking file (nothing is done if NULL).
+ * @return int 0 on success, -1 on error.
+ */
+int cbt_sync(struct cbt *cbt);
+
+#endif /* CBT_H */
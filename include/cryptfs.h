@@ -14,15 +14,36 @@
 #define CRYPTFS_MAGIC "sfkcolrehs" // reverse("sherlockfs")
 #define CRYPTFS_MAGIC_SIZE (sizeof(CRYPTFS_MAGIC) - 1) // exclude '\0'
 #define CRYPTFS_LABEL_SIZE 128 // reverse("sherlockfs")
-#define CRYPTFS_VERSION 1
-#define CRYPTFS_BLOCK_SIZE_BYTES 4096
+#define CRYPTFS_VERSION 2 // Version of the volumes formatted
+#define CRYPTFS_VERSION_MIN 1 // Oldest version of the volumes supported
+#define CRYPTFS_BLOCK_SIZE_BYTES 4096 // Default (and minimal) block size
 #define CRYPTFS_BLOCK_SIZE_BITS (CRYPTFS_BLOCK_SIZE_BYTES * 8)
+#define CRYPTFS_BLOCK_SIZE_MAX_BYTES 65536 // Maximal block size
+
+#define RSA_KEY_SIZE_BITS 2048
+#define RSA_KEY_SIZE_BYTES (RSA_KEY_SIZE_BITS / 8)
+
+#define AES_KEY_SIZE_BITS 256
+#define AES_KEY_SIZE_BYTES (AES_KEY_SIZE_BITS / 8)
 
 /**
  * @brief HEADER (block 0) of the filesystem.
  *
  * The header is the first block of the filesystem. It contains fields that
  * describe the filesystem (magic number, version, block size, ...).
+ *
+ * @note The header always fits in the first CRYPTFS_BLOCK_SIZE_BYTES bytes of
+ * the device, so it can be read before knowing the block size of the device.
+ *
+ * @note Once a volume has a key table (see keytable.h), its key slots are
+ * stored in the key table instead of the keys storage.
+ *
+ * @note The `cipher` field appeared in the version 2: it is zero (AES-256-CBC)
+ * in the headers of version 1.
+ *
+ * @note During a rotation of the master key (see rekey.h), the blocks below
+ * `rekey_watermark` are encrypted with the new master key, the others with the
+ * current one: the volume cannot be opened until the rotation is finished.
  */
 struct CryptFS_Header
 {
@@ -33,6 +54,17 @@ struct CryptFS_Header
     uint32_t blocksize; // in bytes
     uint8_t label[CRYPTFS_LABEL_SIZE]; // Filesystem label
     uint64_t last_fat_block; // Last FAT block index
+    uint8_t rekey_in_progress; // 1 during a rotation of the master key
+    uint64_t rekey_watermark; // First block not encrypted with the new key yet
+    uint8_t rekey_new_key[RSA_KEY_SIZE_BYTES]; // New master key, encrypted
+                                               // with the RSA public key of
+                                               // the user rotating it
+    uint8_t rekey_fingerprint[SHA256_DIGEST_LENGTH]; // Fingerprint of the RSA
+                                                     // key of the user
+                                                     // rotating the master key
+    uint64_t key_table_block; // First block of the key table (0 if the key
+                              // slots are in the keys storage, see keytable.h)
+    uint8_t cipher; // Cipher of the blocks (enum cryptfs_cipher)
 } __attribute__((packed, aligned(CRYPTFS_BLOCK_SIZE_BYTES)));
 
 // -----------------------------------------------------------------------------
@@ -41,12 +73,6 @@ struct CryptFS_Header
 
 #define NB_ENCRYPTION_KEYS 64
 
-#define RSA_KEY_SIZE_BITS 2048
-#define RSA_KEY_SIZE_BYTES (RSA_KEY_SIZE_BITS / 8)
-
-#define AES_KEY_SIZE_BITS 256
-#define AES_KEY_SIZE_BYTES (AES_KEY_SIZE_BITS / 8)
-
 /**
  * @brief Structure that contains a key used to encrypt/decrypt the filesystem.
  *
@@ -60,6 +86,8 @@ struct CryptFS_KeySlot
     uint8_t aes_key_ciphered[RSA_KEY_SIZE_BYTES]; // AES key ciphered with RSA
     uint8_t rsa_n[RSA_KEY_SIZE_BYTES]; // RSA public modulus 'n'
     uint32_t rsa_e; // RSA public exponent 'e'
+    uint8_t rsa_n_fingerprint[SHA256_DIGEST_LENGTH]; // SHA-256 of 'n' (zeros
+                                                     // if not computed)
 } __attribute__((packed, aligned(CRYPTFS_BLOCK_SIZE_BYTES)));
 
 // -----------------------------------------------------------------------------
@@ -98,8 +126,7 @@ struct CryptFS_FAT
 } __attribute__((packed, aligned(CRYPTFS_BLOCK_SIZE_BYTES)));
 
 #define NB_FAT_ENTRIES_PER_BLOCK                                               \
-    ((CRYPTFS_BLOCK_SIZE_BYTES - sizeof(uint64_t))                             \
-     / sizeof(struct CryptFS_FAT_Entry))
+    ((get_block_size() - sizeof(uint64_t)) / sizeof(struct CryptFS_FAT_Entry))
 
 enum SHLKFS_ERRORS
 {
@@ -187,14 +214,21 @@ struct CryptFS_Entry_ID
 } __attribute__((packed));
 
 #define NB_ENTRIES_PER_BLOCK                                                   \
-    ((CRYPTFS_BLOCK_SIZE_BYTES - sizeof(struct CryptFS_Entry_ID))              \
+    ((get_block_size() - sizeof(struct CryptFS_Entry_ID))                      \
      / sizeof(struct CryptFS_Entry))
 
+/**
+ * @brief Structure that contains a directory block.
+ *
+ * @note The number of entries depends on the block size of the device
+ * (NB_ENTRIES_PER_BLOCK), a directory block must then be allocated with
+ * get_block_size() bytes.
+ */
 struct CryptFS_Directory
 {
     struct CryptFS_Entry_ID current_directory_entry; // Current CryptFS_Entry
                                                      // Directory identifier (.)
-    struct CryptFS_Entry entries[NB_ENTRIES_PER_BLOCK];
+    struct CryptFS_Entry entries[]; // NB_ENTRIES_PER_BLOCK entries
 } __attribute__((packed, aligned(CRYPTFS_BLOCK_SIZE_BYTES)));
 
 // -----------------------------------------------------------------------------
@@ -207,6 +241,13 @@ struct CryptFS_Directory
 #define ROOT_ENTRY_BLOCK (FIRST_FAT_BLOCK + 1) // struct CryptFS_Entry
 #define ROOT_DIR_BLOCK (ROOT_ENTRY_BLOCK + 1) // struct CryptFS_Directory
 
+/**
+ * @brief Headers of the filesystem (blocks 0 to ROOT_DIR_BLOCK).
+ *
+ * @note Only the first CRYPTFS_BLOCK_SIZE_BYTES bytes of each block are held
+ * by this structure. With a larger block size, the blocks are spread on the
+ * device every get_block_size() bytes (see read_cryptfs_headers).
+ */
 struct CryptFS
 {
     struct CryptFS_Header header; // BLOCK 0: Header
@@ -9,6 +9,10 @@
 
 #include "cryptfs.h"
 
+// IV of aes_encrypt_data and aes_decrypt_data (and of the blocks of the
+// AES-256-CBC volumes)
+#define AES_CBC_IV "SherlockFScrypto"
+
 /**
  * @brief Encrypts `data` of size `data_size` with `rsa_key` public key.
  *
@@ -92,6 +96,18 @@ EVP_PKEY *generate_rsa_keypair(void);
  */
 bool is_key_valid(EVP_PKEY *rsa_key);
 
+/**
+ * @brief Stores the RSA modulus and the RSA public exponent in a key slot.
+ *
+ * @param key_slot The key slot (marked as occupied).
+ * @param rsa_keypair The RSA keypair: modulus and public exponent will be
+ * stored.
+ * @param aes_key The AES key: RSAPUB_Encrypt(aes_key) will be stored.
+ */
+void store_keys_in_key_slot(struct CryptFS_KeySlot *key_slot,
+                            EVP_PKEY *rsa_keypair,
+                            const unsigned char *aes_key);
+
 /**
  * @brief Stores the RSA modulus and the RSA public exponent in a keys storage.
  *
@@ -99,10 +115,12 @@ bool is_key_valid(EVP_PKEY *rsa_key);
  * @param rsa_keypair The RSA keypair: modulus and public exponent will be
  * stored.
  * @param aes_key The AES key: RSAPUB_Encrypt(aes_key) will be stored.
+ * @return size_t The index of the key slot where the keys are stored (the
+ * first free one).
  */
-void store_keys_in_keys_storage(struct CryptFS_KeySlot *keys_storage,
-                                EVP_PKEY *rsa_keypair,
-                                const unsigned char *aes_key);
+size_t store_keys_in_keys_storage(struct CryptFS_KeySlot *keys_storage,
+                                  EVP_PKEY *rsa_keypair,
+                                  const unsigned char *aes_key);
 
 /**
  * @brief Writes the RSA private and public keys to a file.
@@ -116,10 +134,22 @@ void store_keys_in_keys_storage(struct CryptFS_KeySlot *keys_storage,
 void write_rsa_keys_on_disk(EVP_PKEY *rsa_keypair, const char *public_key_path,
                             const char *private_key_path, char *passphrase);
 
+/**
+ * @brief Compute the fingerprint of an RSA key: the SHA-256 of its public
+ * modulus, as stored in a key slot (see struct CryptFS_KeySlot).
+ *
+ * @param rsa_key The RSA key.
+ * @return unsigned char* The fingerprint (of length SHA256_DIGEST_LENGTH).
+ */
+unsigned char *rsa_key_fingerprint(EVP_PKEY *rsa_key);
+
 /**
  * @brief Find the key in the keys storage which matches the given RSA
  * keypair (user one).
  *
+ * @details The public numbers of the keypair are extracted once, and the
+ * fingerprints of the key slots skip the slots of the other users.
+ *
  * @param rsa_private The RSA of the user.
  * @param keys_storage The keys storage to search in.
  * @return ssize_t The index of the key in the header, -1 if not found.
@@ -127,6 +157,14 @@ void write_rsa_keys_on_disk(EVP_PKEY *rsa_keypair, const char *public_key_path,
 ssize_t find_rsa_matching_key(EVP_PKEY *rsa_private,
                               const struct CryptFS_KeySlot *keys_storage);
 
+/**
+ * @brief Rebuild the RSA public key of a user from its key slot.
+ *
+ * @param key_slot The (occupied) key slot.
+ * @return EVP_PKEY* The RSA public key, NULL on error.
+ */
+EVP_PKEY *load_rsa_public_key_from_slot(const struct CryptFS_KeySlot *key_slot);
+
 /**
  * @brief Loads the RSA private and public keys from the given file.
  *
@@ -0,0 +1,31 @@
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+#include <stdbool.h>
+
+/**
+ * @brief Defragment the files of a volume (the volume must not be mounted).
+ *
+ * @details The FAT is loaded in memory and the directory tree is walked to
+ * find the files (and symbolic links) whose chain is split in several runs of
+ * contiguous blocks. Each of them is copied to a contiguous run of free
+ * blocks (by large chunks, decrypted and encrypted on all cores), then the
+ * volume is switched to the new chains by batches, in an order which never
+ * leaves it inconsistent: the copies and the new chains are written first,
+ * then the entries (and the hardlinks) are pointed to the new chains, and the
+ * old chains are freed last. A crash at any time leaks blocks at most (see
+ * cryptfs_fsck).
+ *
+ * @note The directories are not moved, and the files for which no run of free
+ * blocks is big enough are left as they are. The fragmentation statistics are
+ * printed before and after.
+ *
+ * @param device_path The path of the device of the volume.
+ * @param private_key_path A path to a private key registered in the volume.
+ * @param dry_run true to only print the fragmentation statistics.
+ * @return int 0 if success, -1 otherwise.
+ */
+int cryptfs_defrag(const char *device_path, const char *private_key_path,
+                   bool dry_run);
+
+#endif /* DEFRAG_H */
@@ -2,6 +2,7 @@
 #define ENTRIES_H
 
 #include "cryptfs.h"
+#include "shlkfs_ctx.h"
 
 /**
  * @param size Entry size field.
@@ -18,54 +19,54 @@ int __blocks_needed_for_dir(size_t size);
 /**
  * @brief Get an entry from its ID.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param entry_id The ID of the entry to get.
  *
  * @return The entry corresponding to the ID. NULL if an error occurred.
  */
-struct CryptFS_Entry *get_entry_from_id(const unsigned char *aes_key,
+struct CryptFS_Entry *get_entry_from_id(struct shlkfs_ctx *ctx,
                                         struct CryptFS_Entry_ID entry_id);
 
 /**
  * @brief Write an entry to the file system.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param entry_id The ID of the entry to write.
  * @param entry The entry to write.
  * @return int 0 when success, enum SHLKFS_ERROR otherwise.
  */
-int write_entry_from_id(const unsigned char *aes_key,
+int write_entry_from_id(struct shlkfs_ctx *ctx,
                         struct CryptFS_Entry_ID entry_id,
                         struct CryptFS_Entry *entry);
 
 /**
  * @brief Given a string path, search for the entry unique identifier.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param path The path to the entry.
  * @return A entry unique identifier.
  * enum SHLKFS_ERROR if an error occurred.
  */
-struct CryptFS_Entry_ID *get_entry_by_path(const unsigned char *aes_key,
+struct CryptFS_Entry_ID *get_entry_by_path(struct shlkfs_ctx *ctx,
                                            const char *path);
 
 /**
  * @brief Create a directory by its path.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param path The path to the directory. The directory must be at the end of
  * the path and must not exist.
  *
  * @return The entry unique identifier of the created directory.
  * enum SHLKFS_ERROR if an error occurred.
  */
-struct CryptFS_Entry_ID *create_directory_by_path(const unsigned char *aes_key,
+struct CryptFS_Entry_ID *create_directory_by_path(struct shlkfs_ctx *ctx,
                                                   const char *path);
 
 /**
  * @brief Create a symlink by its path.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param path The path to the symlink. The symlink must be at the end of the
  * path and must not exist.
  * @param symlink The string corresponding to the symlink's path.
@@ -73,7 +74,7 @@ struct CryptFS_Entry_ID *create_directory_by_path(const unsigned char *aes_key,
  * @return The entry unique identifier of the created symlink.
  * enum SHLKFS_ERROR if an error occurred.
  */
-struct CryptFS_Entry_ID *create_symlink_by_path(const unsigned char *aes_key,
+struct CryptFS_Entry_ID *create_symlink_by_path(struct shlkfs_ctx *ctx,
                                                 const char *path,
                                                 const char *symlink);
 /**
@@ -81,7 +82,7 @@ struct CryptFS_Entry_ID *create_symlink_by_path(const unsigned char *aes_key,
  *
  * @warning The hardlink path must target an entry IN the mounted environment.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param path The path to the hardlink. The hardlink must be at the end of the
  * path and must not exist.
  * @param target_path The path to the target of the hardlink.
@@ -89,31 +90,31 @@ struct CryptFS_Entry_ID *create_symlink_by_path(const unsigned char *aes_key,
  * @return The entry unique identifier of the created hardlink.
  * enum SHLKFS_ERROR if an error occurred.
  */
-struct CryptFS_Entry_ID *create_hardlink_by_path(const unsigned char *aes_key,
+struct CryptFS_Entry_ID *create_hardlink_by_path(struct shlkfs_ctx *ctx,
                                                  const char *path,
                                                  const char *target_path);
 
 /**
  * @brief Create a file by its path.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param path The path to the file. The file must be at the end of the path and
  * must not exist.
  *
  * @return The entry unique identifier of the created file.
  * enum SHLKFS_ERROR if an error occurred.
  */
-struct CryptFS_Entry_ID *create_file_by_path(const unsigned char *aes_key,
+struct CryptFS_Entry_ID *create_file_by_path(struct shlkfs_ctx *ctx,
                                              const char *path);
 
 /**
  * @brief Delete an entry by its path.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param path The path to the entry to delete.
  * @return int 0 when success, enum SHLKFS_ERROR otherwise.
  */
-int delete_entry_by_path(const unsigned char *aes_key, const char *path);
+int delete_entry_by_path(struct shlkfs_ctx *ctx, const char *path);
 
 /**
  * @brief Search for the directory block where the index is pointing to.
@@ -121,12 +122,12 @@ int delete_entry_by_path(const unsigned char *aes_key, const char *path);
  * @example If index = 26, the function will update the numbers like so:
  * `directory_block` = FAT[directory] and `index` = 3.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param entry_id A entry unique identifier. Can be wrong (oversized `index`).
  * This function will update it with the correct values.
  * @return 0 when success, -1 otherwise.
  */
-int goto_entry_in_directory(const unsigned char *aes_key,
+int goto_entry_in_directory(struct shlkfs_ctx *ctx,
                             struct CryptFS_Entry_ID *entry_id);
 
 /**
@@ -139,34 +140,34 @@ int goto_entry_in_directory(const unsigned char *aes_key,
  * @example If the directory contains [used, used, free, used], and the given
  * index is 2, the function will return 3.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param directory_entry_id The entry ID of the directory to search in.
  * @param index The index of the first used entry.
  * @return struct CryptFS_Entry_ID* The entry unique identifier of the first
  * used entry in the directory.
  */
 struct CryptFS_Entry_ID *
-goto_used_entry_in_directory(const unsigned char *aes_key,
+goto_used_entry_in_directory(struct shlkfs_ctx *ctx,
                              struct CryptFS_Entry_ID directory_entry_id,
                              size_t index);
 
 /**
  * @brief Modify an cryptFS_entry size. Equivalent to Linux truncate syscall.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param entry_id Structure, composed of the block number where a struct
  * CryptFS_Directory starts and the index of the entry within this current
  * CryptFS_Directory, serves to uniquely identify an entry on the file system.
  * @param new_size The new size for the entry.
  * @return 0 when success, BLOCK_ERROR otherwise.
  */
-int entry_truncate(const unsigned char *aes_key,
+int entry_truncate(struct shlkfs_ctx *ctx,
                    struct CryptFS_Entry_ID entry_id, size_t new_size);
 
 /**
  * @brief Write a buffer to an entry from a specific index.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param file_entry_id Structure, composed of the block number where a struct
  * CryptFS_Directory starts and the index of the entry within this current
  * CryptFS_Directory, serves to uniquely identify an entry on the file system.
@@ -175,7 +176,7 @@ int entry_truncate(const unsigned char *aes_key,
  * @param count The size of the source buffer.
  * @return 0 when success, BLOCK_ERROR otherwise.
  */
-int entry_write_buffer_from(const unsigned char *aes_key,
+int entry_write_buffer_from(struct shlkfs_ctx *ctx,
                             struct CryptFS_Entry_ID file_entry_id,
                             size_t start_from, const void *buffer,
                             size_t count);
@@ -183,7 +184,7 @@ int entry_write_buffer_from(const unsigned char *aes_key,
 /**
  * @brief Write a buffer to an entry.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param file_entry_id Structure, composed of the block number where a struct
  * CryptFS_Directory starts and the index of the entry within this current
  * CryptFS_Directory, serves to uniquely identify an entry on the file system.
@@ -191,14 +192,14 @@ int entry_write_buffer_from(const unsigned char *aes_key,
  * @param count The size of the source buffer.
  * @return 0 when success, BLOCK_ERROR otherwise.
  */
-int entry_write_buffer(const unsigned char *aes_key,
+int entry_write_buffer(struct shlkfs_ctx *ctx,
                        struct CryptFS_Entry_ID file_entry_id,
                        const void *buffer, size_t count);
 
 /**
  * @brief Read raw data from an entry.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param file_entry_id Structure, composed of the block number where a struct
  * CryptFS_Directory starts and the index of the entry within this current
  * CryptFS_Directory, serves to uniquely identify an entry on the file system.
@@ -207,27 +208,27 @@ int entry_write_buffer(const unsigned char *aes_key,
  * @param count The maximum size to read.
  * @return The actual size read on success, or BLOCK_ERROR otherwise.
  */
-ssize_t entry_read_raw_data(const unsigned char *aes_key,
+ssize_t entry_read_raw_data(struct shlkfs_ctx *ctx,
                             struct CryptFS_Entry_ID file_entry_id,
                             size_t start_from, void *buf, size_t count);
 
 /**
  * @brief Delete an entry.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param entry_id Structure, composed of the block number where a
  * struct CryptFS_Directory starts and the index of the entry within this
  * current CryptFS_Directory, serves to uniquely identify an entry on the file
  * system.
  * @return 0 when success, BLOCK_ERROR otherwise.
  */
-int entry_delete(const unsigned char *aes_key,
+int entry_delete(struct shlkfs_ctx *ctx,
                  struct CryptFS_Entry_ID entry_id);
 
 /**
  * @brief Create an empty file.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param parent_dir_entry_id Structure, composed of the block number where a
  * struct CryptFS_Directory starts and the index of the entry within this
  * current CryptFS_Directory, serves to uniquely identify an entry on the file
@@ -236,14 +237,14 @@ int entry_delete(const unsigned char *aes_key,
  * @return Index where the file entry is located in parent_directory on success,
  * or BLOCK_ERROR otherwise.
  */
-uint32_t entry_create_empty_file(const unsigned char *aes_key,
+uint32_t entry_create_empty_file(struct shlkfs_ctx *ctx,
                                  struct CryptFS_Entry_ID parent_dir_entry_id,
                                  const char *name);
 
 /**
  * @brief Create a directory.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param parent_dir_entry_id Structure, composed of the block number where a
  * struct CryptFS_Directory starts and the index of the entry within this
  * current CryptFS_Directory, serves to uniquely identify an entry on the file
@@ -252,14 +253,14 @@ uint32_t entry_create_empty_file(const unsigned char *aes_key,
  * @return Index where the directory entry is located in parent_directory on
  * success, or BLOCK_ERROR otherwise.
  */
-uint32_t entry_create_directory(const unsigned char *aes_key,
+uint32_t entry_create_directory(struct shlkfs_ctx *ctx,
                                 struct CryptFS_Entry_ID parent_dir_entry_id,
                                 const char *name);
 
 /**
  * @brief Create a hardlink.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param parent_dir_entry_id Structure, composed of the block number where a
  * struct CryptFS_Directory starts and the index of the entry within this
  * current CryptFS_Directory, serves to uniquely identify an entry on the file
@@ -271,14 +272,14 @@ uint32_t entry_create_directory(const unsigned char *aes_key,
  * @return Index where the directory entry is located in parent_directory on
  * success, or BLOCK_ERROR otherwise.
  */
-uint32_t entry_create_hardlink(const unsigned char *aes_key,
+uint32_t entry_create_hardlink(struct shlkfs_ctx *ctx,
                                struct CryptFS_Entry_ID parent_dir_entry_id,
                                const char *name,
                                struct CryptFS_Entry_ID target_entry_id);
 /**
  * @brief Create a symlink.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param parent_dir_entry_id Structure, composed of the block number where a
  * struct CryptFS_Directory starts and the index of the entry within this
  * current CryptFS_Directory, serves to uniquely identify an entry on the file
@@ -288,7 +289,7 @@ uint32_t entry_create_hardlink(const unsigned char *aes_key,
  * @return Index where the symlink entry is located in parent_directory on
  * success, or BLOCK_ERROR otherwise.
  */
-uint32_t entry_create_symlink(const unsigned char *aes_key,
+uint32_t entry_create_symlink(struct shlkfs_ctx *ctx,
                               struct CryptFS_Entry_ID parent_dir_entry_id,
                               const char *name, const char *symlink);
 
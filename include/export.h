@@ -0,0 +1,30 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+/**
+ * @brief Export a directory tree of a volume, reading it straight from the
+ * device (the volume must not be mounted).
+ *
+ * @details The FAT is loaded in memory, so that the blocks of each file are
+ * resolved into extents without reading the device. The content of the files
+ * is read by large chunks (decrypted on all cores), and each chunk is written
+ * to the destination while the next one is read.
+ *
+ * @note Regular files, directories and symbolic links are exported (a
+ * hardlink is exported as a regular file). Exported to a directory, the
+ * entries keep their permissions and modification times; exported to a tar
+ * archive, they also keep their owners.
+ *
+ * @param device_path The path of the device of the volume.
+ * @param volume_path The path of the directory (or file) to export in the
+ * volume ("/" for the whole volume).
+ * @param destination_path The directory to export the content of
+ * `volume_path` to (created if needed), or "-" to write a tar archive of it
+ * to the standard output.
+ * @param private_key_path A path to a private key registered in the volume.
+ * @return int 0 if success, -1 otherwise.
+ */
+int cryptfs_export(const char *device_path, const char *volume_path,
+                   const char *destination_path, const char *private_key_path);
+
+#endif /* EXPORT_H */
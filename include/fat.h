@@ -2,34 +2,35 @@
 #define FAT_H
 
 #include "cryptfs.h"
+#include "shlkfs_ctx.h"
 
 /**
  * @brief Find the first free block in the FAT table.
  *
- * @param aes_key The AES key to use for in place decryption of the FAT tables.
+ * @param ctx The context of the volume.
  *
  * @return sblock_t The index of the first free block,
  * or BLOCK_ERROR first_fat is NULL or if an error occured. In case of out
  * of range, a negative value is returned (the absolute value is the index of
  * the first out of range [and also available] block).
  */
-sblock_t find_first_free_block(const unsigned char *aes_key);
+sblock_t find_first_free_block(struct shlkfs_ctx *ctx);
 
 /**
  * @brief Find the first safe free block in the FAT table, the difference with
  * "find_first_free_block" is that it only return a positive block index as it
  * initialize another FAT in case of out of range.
  *
- * @param aes_key The AES key to use for in place decryption of the FAT tables.
+ * @param ctx The context of the volume.
  *
  * @return sblock_t The index of the first free block.
  */
-block_t find_first_free_block_safe(const unsigned char *aes_key);
+block_t find_first_free_block_safe(struct shlkfs_ctx *ctx);
 
 /**
  * @brief Append a FAT table to the FAT linked-list.
  *
- * @param aes_key The AES key to use for in place decryption of the FAT tables.
+ * @param ctx The context of the volume.
  *
  * @note The function still works if you pass any FAT table as first_fat
  * (not only the first one).
@@ -37,28 +38,115 @@ block_t find_first_free_block_safe(const unsigned char *aes_key);
  * @return sblock_t The block where the new FAT is stored,
  * or BLOCK_ERROR if an error occurs.
  */
-sblock_t create_fat(const unsigned char *aes_key);
+sblock_t create_fat(struct shlkfs_ctx *ctx);
 
 /**
  * @brief Write `value` to the FAT table at `offset` index.
  *
- * @param aes_key The AES key to use for in place decryption of the FAT tables.
+ * @param ctx The context of the volume.
  * @param offset The index of the FAT table to write to.
  * @param value The value to write.
  * @return int 0 on success, BLOCK_ERROR on error. FAT_INDEX_OOB in case of out
  * of range.
  */
-int write_fat_offset(const unsigned char *aes_key, uint64_t offset,
-                     uint64_t value);
+int write_fat_offset(struct shlkfs_ctx *ctx, uint64_t offset, uint64_t value);
 
 /**
  * @brief Read the value at `offset` index in the FAT table.
  *
- * @param aes_key The AES key to use for in place decryption of the FAT tables.
+ * @param ctx The context of the volume.
  * @param offset The index of the FAT table to read from.
  * @return uint32_t The value at `offset` index in the FAT table. BLOCK_ERROR
  * on error. FAT_INDEX_OOB in case of out of range.
  */
-uint32_t read_fat_offset(const unsigned char *aes_key, uint64_t offset);
+uint32_t read_fat_offset(struct shlkfs_ctx *ctx, uint64_t offset);
+
+/**
+ * @brief Make sure that the FAT tables hold at least `nb_blocks` free
+ * entries, appending FAT tables to the FAT linked-list if needed.
+ *
+ * @note Creating the FAT tables ahead keeps them out of the chains allocated
+ * afterwards (see allocate_blocks).
+ *
+ * @param ctx The context of the volume.
+ * @param nb_blocks The number of free entries needed.
+ * @return int 0 on success, BLOCK_ERROR on error.
+ */
+int reserve_blocks(struct shlkfs_ctx *ctx, size_t nb_blocks);
+
+/**
+ * @brief Allocate a chain of `nb_blocks` blocks in the FAT table. The first
+ * free blocks are used, so the chain is contiguous if the free space is.
+ *
+ * @param ctx The context of the volume.
+ * @param nb_blocks The number of blocks of the chain (at least 1).
+ * @return sblock_t The first block of the chain (the chain ends with
+ * BLOCK_END), or BLOCK_ERROR if an error occurs.
+ */
+sblock_t allocate_blocks(struct shlkfs_ctx *ctx, size_t nb_blocks);
+
+/**
+ * @brief Load the FAT of a volume in memory. Until fat_cache_unload, the FAT
+ * functions above work on the loaded FAT tables, and the FAT is only written
+ * to the device by fat_cache_commit (and by shlkfs_ctx_flush or
+ * shlkfs_ctx_close).
+ *
+ * @note This suits bulk operations on a volume used by a single process: each
+ * FAT block is written once, instead of once per modified entry. The FAT
+ * tables are decrypted on all cores (only the first AES block of each table
+ * is decrypted to follow the chain).
+ *
+ * @param ctx The context of the volume.
+ * @return int 0 on success (or if the FAT is already loaded), BLOCK_ERROR on
+ * error.
+ */
+int fat_cache_load(struct shlkfs_ctx *ctx);
+
+/**
+ * @brief Write the FAT tables modified since fat_cache_load (or since the
+ * last commit) to the device, and update the header if FAT tables were
+ * appended.
+ *
+ * @param ctx The context of the volume.
+ * @return int 0 on success (or if the FAT is not loaded), BLOCK_ERROR on
+ * error.
+ */
+int fat_cache_commit(struct shlkfs_ctx *ctx);
+
+/**
+ * @brief read_fat_offset on the FAT loaded in memory, without locking the
+ * volume: several threads can read the FAT at once, as long as it is not
+ * modified meanwhile.
+ *
+ * @param ctx The context of the volume (its FAT is loaded).
+ * @param offset The offset of the entry.
+ * @return uint32_t The value of the entry, FAT_INDEX_OOB if out of the FAT.
+ */
+uint32_t fat_cache_read(const struct shlkfs_ctx *ctx, uint64_t offset);
+
+/**
+ * @brief Get the number of entries of the FAT loaded in memory.
+ *
+ * @param ctx The context of the volume (its FAT is loaded).
+ * @return uint64_t The number of entries.
+ */
+uint64_t fat_cache_nb_entries(const struct shlkfs_ctx *ctx);
+
+/**
+ * @brief Get the blocks where the FAT tables loaded in memory are stored.
+ *
+ * @param ctx The context of the volume (its FAT is loaded).
+ * @param nb_tables The number of FAT tables. (returned)
+ * @return const block_t* The blocks of the FAT tables, in the chain order.
+ */
+const block_t *fat_cache_tables(const struct shlkfs_ctx *ctx,
+                                size_t *nb_tables);
+
+/**
+ * @brief Drop the FAT loaded in memory, without committing it.
+ *
+ * @param ctx The context of the volume.
+ */
+void fat_cache_unload(struct shlkfs_ctx *ctx);
 
 #endif /* FAT_H */
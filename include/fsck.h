@@ -0,0 +1,37 @@
+#ifndef FSCK_H
+#define FSCK_H
+
+#include <stdbool.h>
+
+// Results of a check (the exit codes of fsck(8))
+#define FSCK_CLEAN 0 // No error found
+#define FSCK_REPAIRED 1 // Errors found and repaired
+#define FSCK_ERRORS 4 // Errors left unrepaired
+#define FSCK_FAILURE 8 // The check failed (device, key or I/O error)
+
+/**
+ * @brief Check the consistency of the FAT and of the directory tree of a
+ * volume (the volume must not be mounted).
+ *
+ * @details The FAT is loaded in memory (decrypted on all cores), then the
+ * directory tree is walked level by level, the entries of a level being
+ * checked in parallel by the thread pool (work-stealing). Each block of a
+ * chain is claimed in a reachability bitmap. The errors found are:
+ * - the chains which are broken (pointing to a free block or out of the FAT),
+ * cross-linked (claiming a block of another chain) or longer than the size of
+ * their file: the chain is cut at the last block it owns;
+ * - the sizes which disagree with the chain of a file, or with the number of
+ * used entries of a directory: the size is fixed;
+ * - the leaked blocks (used in the FAT but reached by no chain): they are
+ * freed;
+ * - the hardlinks to a chain owned by no file (reported only).
+ *
+ * @param device_path The path of the device of the volume.
+ * @param private_key_path A path to a private key registered in the volume.
+ * @param repair true to repair the errors, false to only report them.
+ * @return int FSCK_CLEAN, FSCK_REPAIRED, FSCK_ERRORS or FSCK_FAILURE.
+ */
+int cryptfs_fsck(const char *device_path, const char *private_key_path,
+                 bool repair);
+
+#endif /* FSCK_H */
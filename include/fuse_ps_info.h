@@ -9,6 +9,7 @@
 #include <stdbool.h>
 
 #include "cryptfs.h"
+#include "shlkfs_ctx.h"
 
 // ------------------- File descriptor management -------------------
 
@@ -33,44 +34,20 @@ struct fs_file_info
 // ------------------- File system information management -------------------
 
 /**
- * @brief Sets the AES key for the file system into memory from a device and a
- * private key path.
+ * @brief Opens the context of a volume, with the master key extracted from
+ * the device with a private key (the passphrase of the private key is asked
+ * if needed). Exits the program on error.
  *
- * @note The master key is XOR encrypted in memory in order to prevent easy loot
- * in case of memory corruption.
+ * @note The master key is XOR encrypted in the context in order to prevent
+ * easy loot in case of memory corruption (see struct shlkfs_ctx).
  *
  * @param device_path The path to the device where the master key is stored.
  * @param private_key_path The path to the private key used to decrypt the
  * master key.
+ * @return struct shlkfs_ctx* The context of the volume (to close with
+ * shlkfs_ctx_close).
  */
-void fpi_register_master_key_from_path(const char *device_path,
-                                       const char *private_key_path);
-
-/**
- * @brief Sets the AES key for the file system into memory.
- *
- * @note The master key is XOR encrypted in memory in order to prevent easy loot
- * in case of memory corruption.
- *
- * @param key The AES key to set. In order to better control where the master
- * key is in memory, its value is zeroed after being registered (so don't use it
- * after this, call fpi_get_master_key() instead).
- */
-void fpi_register_master_key(unsigned char *key);
-
-/**
- * @brief Retrieves the AES key of the file system from memory.
- *
- * @warning You must use fpi_clear_decoded_key() just after using this function.
- * @warning Also avoid copying the key to another memory location.
- *
- * @return The AES key. NULL if the key is not set.
- */
-const unsigned char *fpi_get_master_key();
-
-/**
- * @brief Zeroes the decoded key in memory.
- */
-void fpi_clear_decoded_key();
+struct shlkfs_ctx *fpi_open_ctx_from_path(const char *device_path,
+                                          const char *private_key_path);
 
 #endif /* FUSE_PS_INFO_H */
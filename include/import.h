@@ -0,0 +1,25 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+/**
+ * @brief Import a directory tree at the root of a volume, writing it straight
+ * to the device (the volume must not be mounted).
+ *
+ * @details The FAT is loaded in memory for the whole import and written once
+ * at the end, only if the import succeeds. The blocks of each file are
+ * allocated at once, so that they are contiguous on a fresh volume, and its
+ * content is encrypted and written by large chunks.
+ *
+ * @note Regular files, directories and symbolic links are imported. Existing
+ * directories of the volume are merged, any other existing entry is an error.
+ *
+ * @param device_path The path of the device of the volume.
+ * @param source_path The directory to import, or "-" to read a tar archive
+ * (ustar, GNU or pax) from the standard input.
+ * @param private_key_path A path to a private key registered in the volume.
+ * @return int 0 if success, -1 otherwise.
+ */
+int cryptfs_import(const char *device_path, const char *source_path,
+                   const char *private_key_path);
+
+#endif /* IMPORT_H */
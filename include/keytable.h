@@ -0,0 +1,167 @@
+#ifndef KEYTABLE_H
+#define KEYTABLE_H
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "cryptfs.h"
+#include "shlkfs_ctx.h"
+
+// Number of index entries per expected user in a fully occupied key table
+#define KEY_TABLE_INDEX_FACTOR 2
+
+/**
+ * @brief First block of the key table of a volume (see `key_table_block` in
+ * struct CryptFS_Header).
+ *
+ * @details The key table replaces the NB_ENCRYPTION_KEYS key slots of the
+ * keys storage once a volume needs more of them. It is a run of contiguous
+ * blocks, reserved in the FAT but not encrypted (like the keys storage):
+ * - this block;
+ * - `nb_buckets` blocks of struct CryptFS_KeyTable_Entry: the index of the
+ * key slots by fingerprint, a hash table whose bucket is a block (the bucket
+ * of a fingerprint is given by its first 8 bytes);
+ * - the blocks of the `nb_slots` struct CryptFS_KeyTable_Slot, packed.
+ *
+ * The `nb_users` first key slots are the occupied ones: finding, adding or
+ * removing a user reads and writes a few blocks, whatever the number of
+ * users. The table is rebuilt (twice as large) when it is full, or if a
+ * bucket overflows.
+ */
+struct CryptFS_KeyTable
+{
+    uint64_t nb_blocks; // Number of blocks of the key table (this one
+                        // included)
+    uint32_t nb_buckets; // Number of blocks of the index
+    uint32_t nb_slots; // Number of key slots
+    uint32_t nb_users; // Number of occupied key slots (the first ones)
+} __attribute__((packed, aligned(CRYPTFS_BLOCK_SIZE_BYTES)));
+
+/**
+ * @brief A key slot of the key table (struct CryptFS_KeySlot, packed).
+ */
+struct CryptFS_KeyTable_Slot
+{
+    uint8_t occupied; // 1 if the slot is occupied, 0 if free
+    uint8_t aes_key_ciphered[RSA_KEY_SIZE_BYTES]; // AES key ciphered with RSA
+    uint8_t rsa_n[RSA_KEY_SIZE_BYTES]; // RSA public modulus 'n'
+    uint32_t rsa_e; // RSA public exponent 'e'
+    uint8_t rsa_n_fingerprint[SHA256_DIGEST_LENGTH]; // SHA-256 of 'n'
+} __attribute__((packed));
+
+/**
+ * @brief An entry of the index of the key table.
+ */
+struct CryptFS_KeyTable_Entry
+{
+    uint32_t slot; // Index of the key slot + 1 (0 if the entry is free)
+    uint8_t rsa_n_fingerprint[SHA256_DIGEST_LENGTH]; // Fingerprint of the key
+} __attribute__((packed));
+
+#define NB_KEY_TABLE_SLOTS_PER_BLOCK                                           \
+    (get_block_size() / sizeof(struct CryptFS_KeyTable_Slot))
+#define NB_KEY_TABLE_ENTRIES_PER_BLOCK                                         \
+    (get_block_size() / sizeof(struct CryptFS_KeyTable_Entry))
+
+/**
+ * @brief Find the key slot of a user in the keys storage of a volume, or in
+ * its key table (only the blocks of the key slot and of its index are read).
+ *
+ * @note The block size of the device is set (set_block_size) from the header,
+ * if it is supported.
+ *
+ * @param device_path The path of the device of the volume.
+ * @param rsa_key The RSA key of the user.
+ * @param key_slot The key slot of the user (filled if found and not NULL).
+ * @return ssize_t The index of the key slot (in the keys storage or in the key
+ * table), -1 if not found.
+ */
+ssize_t find_key_slot(const char *device_path, EVP_PKEY *rsa_key,
+                      struct CryptFS_KeySlot *key_slot);
+
+/**
+ * @brief Read the key table of a volume, from the header of the volume.
+ *
+ * @param device_path The path of the device of the volume.
+ * @param key_table The key table (filled if the volume has a key table).
+ * @return block_t The first block of the key table, 0 if the volume has none.
+ * Exits the program if the device cannot be read.
+ */
+block_t read_key_table(const char *device_path,
+                       struct CryptFS_KeyTable *key_table);
+
+/**
+ * @brief Same as read_key_table, but returns BLOCK_ERROR instead of exiting
+ * the program if the device cannot be read (for the library paths).
+ *
+ * @param device_path The path of the device of the volume.
+ * @param key_table The key table (filled if the volume has a key table).
+ * @return sblock_t The first block of the key table, 0 if the volume has none,
+ * BLOCK_ERROR on error.
+ */
+sblock_t try_read_key_table(const char *device_path,
+                            struct CryptFS_KeyTable *key_table);
+
+/**
+ * @brief Read key slots of the key table of the device used by the calling
+ * thread.
+ *
+ * @param table_block The first block of the key table.
+ * @param key_table The key table.
+ * @param first The index of the first key slot to read.
+ * @param nb_slots The number of key slots to read.
+ * @param key_slots The key slots. (returned)
+ * @return int 0 on success, -1 on error.
+ */
+int read_key_table_slots(block_t table_block,
+                         const struct CryptFS_KeyTable *key_table, size_t first,
+                         size_t nb_slots, struct CryptFS_KeySlot *key_slots);
+
+/**
+ * @brief Write key slots of the key table of the device used by the calling
+ * thread (the index is not updated: the fingerprints of the occupied key
+ * slots must not change).
+ *
+ * @param table_block The first block of the key table.
+ * @param key_table The key table.
+ * @param first The index of the first key slot to write.
+ * @param nb_slots The number of key slots to write.
+ * @param key_slots The key slots.
+ * @return int 0 on success, -1 on error.
+ */
+int write_key_table_slots(block_t table_block,
+                          const struct CryptFS_KeyTable *key_table,
+                          size_t first, size_t nb_slots,
+                          const struct CryptFS_KeySlot *key_slots);
+
+/**
+ * @brief Add key slots to the key table of a volume. The key table is
+ * created (with the occupied key slots of the keys storage, which is wiped)
+ * if the volume has none, and rebuilt if it is full.
+ *
+ * @note Creating or rebuilding the key table allocates blocks in the FAT: the
+ * volume must not be mounted meanwhile.
+ *
+ * @param ctx The context of the volume.
+ * @param key_slots The key slots to add (their users are not registered yet).
+ * @param nb_slots The number of key slots to add (0 to only create the key
+ * table).
+ * @return int 0 on success, -1 on error (error printed).
+ */
+int key_table_add(struct shlkfs_ctx *ctx,
+                  const struct CryptFS_KeySlot *key_slots, size_t nb_slots);
+
+/**
+ * @brief Remove a key slot from the key table of a volume (the last key slot
+ * is moved to its place).
+ *
+ * @param device_path The path of the device of the volume.
+ * @param index The index of the key slot (see find_key_slot).
+ * @return int 0 on success, -1 on error (error printed).
+ */
+int key_table_remove(const char *device_path, size_t index);
+
+#endif /* KEYTABLE_H */
@@ -2,5 +2,6 @@
 #define MATHS_H
 
 #define MIN(x, y) ((x) > (y) ? (y) : (x))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
 
 #endif /* MATHS_H */
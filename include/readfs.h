@@ -6,9 +6,34 @@
 /**
  * @brief Read the headers of a CryptFS device
  *
+ * @note The block size of the device is set (set_block_size) from the header,
+ * if it is supported, and so is its cipher (set_block_cipher).
+ *
  * @param device_path Path to the CryptFS device
  * @return struct CryptFS* Pointer to a CryptFS struct
  */
 struct CryptFS *read_cryptfs_headers(const char *device_path);
 
+/**
+ * @brief Read the keys storage of a CryptFS device (only the blocks of the key
+ * slots are read)
+ *
+ * @note The block size of the device is set (set_block_size) from the header,
+ * if it is supported.
+ *
+ * @param device_path Path to the CryptFS device
+ * @return struct CryptFS_KeySlot* The NB_ENCRYPTION_KEYS key slots
+ */
+struct CryptFS_KeySlot *read_key_slots(const char *device_path);
+
+/**
+ * @brief Same as read_key_slots, but returns NULL instead of exiting the
+ * program if the device cannot be read (for the library paths)
+ *
+ * @param device_path Path to the CryptFS device
+ * @return struct CryptFS_KeySlot* The NB_ENCRYPTION_KEYS key slots, NULL on
+ * error
+ */
+struct CryptFS_KeySlot *try_read_key_slots(const char *device_path);
+
 #endif /* READFS_H */
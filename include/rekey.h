@@ -0,0 +1,59 @@
+#ifndef REKEY_H
+#define REKEY_H
+
+#include <openssl/sha.h>
+#include <stdint.h>
+
+#define REKEY_SUFFIX ".rekey" // Suffix of the journal file of a device
+#define REKEY_MAGIC "shlkrky" // Magic number of a journal file
+#define REKEY_MAGIC_SIZE (sizeof(REKEY_MAGIC) - 1)
+#define REKEY_VERSION 1
+
+/**
+ * @brief Header of the journal of a rotation of the master key, followed by
+ * `nb_blocks` struct CryptFS_Rekey_Block.
+ *
+ * @details The journal describes the chunk of blocks being re-encrypted: it is
+ * written before the blocks, so that a chunk interrupted while its blocks
+ * were written is resumed block by block (a block whose hash is the journaled
+ * one is already encrypted with the new master key).
+ */
+struct CryptFS_Rekey_Journal
+{
+    uint8_t magic[REKEY_MAGIC_SIZE]; // Magic number
+    uint16_t version; // REKEY_VERSION
+    uint64_t start_block; // Watermark before the chunk
+    uint64_t end_block; // Watermark after the chunk
+    uint64_t nb_blocks; // Number of re-encrypted blocks of the chunk
+} __attribute__((packed));
+
+/**
+ * @brief A block of the chunk being re-encrypted.
+ */
+struct CryptFS_Rekey_Block
+{
+    uint64_t block; // The block
+    uint8_t hash[SHA256_DIGEST_LENGTH]; // SHA-256 of the block encrypted with
+                                        // the new master key
+} __attribute__((packed));
+
+/**
+ * @brief Rotate the master key of a volume (the volume must not be mounted).
+ *
+ * @details A new master key is generated, and every allocated block is
+ * re-encrypted with it, by large chunks (decrypted and encrypted on all
+ * cores). The progress is kept in the header of the volume (see struct
+ * CryptFS_Header): if the rotation is interrupted, running it again with the
+ * same private key resumes it (the volume cannot be opened meanwhile, and the
+ * new master key is only encrypted with the RSA public key of this user until
+ * then). Once all the blocks are re-encrypted, the new master key is
+ * encrypted with the public key of every registered user, and the free key
+ * slots are wiped: the master key known by a deleted user becomes useless.
+ *
+ * @param device_path The path of the device of the volume.
+ * @param private_key_path A path to a private key registered in the volume.
+ * @return int 0 if success, -1 otherwise.
+ */
+int cryptfs_rekey(const char *device_path, const char *private_key_path);
+
+#endif /* REKEY_H */
@@ -0,0 +1,200 @@
+#ifndef SHLKFS_H
+#define SHLKFS_H
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * @brief A SherlockFS volume opened by an application (libshlkfs).
+ *
+ * @details libshlkfs gives direct access to a volume, without going through
+ * FUSE (and the kernel): the files are read and written with a POSIX-like
+ * API. The functions are thread-safe, and several volumes can be opened at the
+ * same time.
+ *
+ * @note On error, the functions return -1 (NULL for shlkfs_mount) and set
+ * errno, as their POSIX counterparts.
+ */
+struct shlkfs;
+
+/**
+ * @brief Callback of shlkfs_readdir, called for each entry of a directory.
+ *
+ * @param arg The argument given to shlkfs_readdir.
+ * @param name The name of the entry.
+ * @param st The attributes of the entry.
+ * @return 0 to continue, any other value to stop the listing.
+ */
+typedef int (*shlkfs_readdir_cb)(void *arg, const char *name,
+                                 const struct stat *st);
+
+/**
+ * @brief Open a volume with the private key of one of its users.
+ *
+ * @param device_path The path of the device of the volume.
+ * @param private_key_path The path of the private key of the user.
+ * @param passphrase The passphrase of the private key, NULL if the private
+ * key is not encrypted.
+ * @return struct shlkfs* The volume, NULL on error (errno is set to ENODEV if
+ * the device is not a SherlockFS volume, to EACCES if the private key is not
+ * one of the users of the volume).
+ */
+struct shlkfs *shlkfs_mount(const char *device_path,
+                            const char *private_key_path,
+                            const char *passphrase);
+
+/**
+ * @brief Close a volume: its files are closed and its blocks are made
+ * durable on the device.
+ *
+ * @param fs The volume.
+ * @return 0 on success, -1 on error.
+ */
+int shlkfs_umount(struct shlkfs *fs);
+
+/**
+ * @brief Open a file of a volume.
+ *
+ * @note Supported flags: O_RDONLY, O_WRONLY, O_RDWR, O_CREAT, O_EXCL,
+ * O_TRUNC and O_APPEND.
+ *
+ * @param fs The volume.
+ * @param path The absolute path of the file in the volume.
+ * @param flags The flags of the opening (see open(2)).
+ * @param mode The permissions of the file if it is created.
+ * @return The file descriptor (specific to the volume), -1 on error.
+ */
+int shlkfs_open(struct shlkfs *fs, const char *path, int flags, mode_t mode);
+
+/**
+ * @brief Close a file of a volume.
+ *
+ * @param fs The volume.
+ * @param fd The file descriptor.
+ * @return 0 on success, -1 on error.
+ */
+int shlkfs_close(struct shlkfs *fs, int fd);
+
+/**
+ * @brief Read from a file at its current offset, and move the offset.
+ *
+ * @param fs The volume.
+ * @param fd The file descriptor.
+ * @param buf The buffer to fill.
+ * @param count The number of bytes to read.
+ * @return The number of bytes read (0 at the end of the file), -1 on error.
+ */
+ssize_t shlkfs_read(struct shlkfs *fs, int fd, void *buf, size_t count);
+
+/**
+ * @brief Write to a file at its current offset (at its end in O_APPEND
+ * mode), and move the offset.
+ *
+ * @param fs The volume.
+ * @param fd The file descriptor.
+ * @param buf The bytes to write.
+ * @param count The number of bytes to write.
+ * @return The number of bytes written, -1 on error.
+ */
+ssize_t shlkfs_write(struct shlkfs *fs, int fd, const void *buf,
+                     size_t count);
+
+/**
+ * @brief Read from a file at a given offset (the offset of the file is not
+ * changed).
+ *
+ * @param fs The volume.
+ * @param fd The file descriptor.
+ * @param buf The buffer to fill.
+ * @param count The number of bytes to read.
+ * @param offset The offset to read from.
+ * @return The number of bytes read (0 at the end of the file), -1 on error.
+ */
+ssize_t shlkfs_pread(struct shlkfs *fs, int fd, void *buf, size_t count,
+                     off_t offset);
+
+/**
+ * @brief Write to a file at a given offset (the offset of the file is not
+ * changed).
+ *
+ * @param fs The volume.
+ * @param fd The file descriptor.
+ * @param buf The bytes to write.
+ * @param count The number of bytes to write.
+ * @param offset The offset to write at.
+ * @return The number of bytes written, -1 on error.
+ */
+ssize_t shlkfs_pwrite(struct shlkfs *fs, int fd, const void *buf,
+                      size_t count, off_t offset);
+
+/**
+ * @brief Move the offset of a file (see lseek(2)).
+ *
+ * @param fs The volume.
+ * @param fd The file descriptor.
+ * @param offset The offset, relative to whence.
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END.
+ * @return The new offset of the file, -1 on error.
+ */
+off_t shlkfs_lseek(struct shlkfs *fs, int fd, off_t offset, int whence);
+
+/**
+ * @brief Get the attributes of an entry of a volume.
+ *
+ * @param fs The volume.
+ * @param path The absolute path of the entry in the volume.
+ * @param st The attributes to fill.
+ * @return 0 on success, -1 on error.
+ */
+int shlkfs_stat(struct shlkfs *fs, const char *path, struct stat *st);
+
+/**
+ * @brief Get the attributes of an opened file of a volume.
+ *
+ * @param fs The volume.
+ * @param fd The file descriptor.
+ * @param st The attributes to fill.
+ * @return 0 on success, -1 on error.
+ */
+int shlkfs_fstat(struct shlkfs *fs, int fd, struct stat *st);
+
+/**
+ * @brief List the entries of a directory of a volume ("." and ".." are not
+ * listed).
+ *
+ * @warning The directory must not be modified by the callback.
+ *
+ * @param fs The volume.
+ * @param path The absolute path of the directory in the volume.
+ * @param callback The function called for each entry.
+ * @param arg The argument given to the callback.
+ * @return 0 on success (or if the callback stopped the listing), -1 on error.
+ */
+int shlkfs_readdir(struct shlkfs *fs, const char *path,
+                   shlkfs_readdir_cb callback, void *arg);
+
+/**
+ * @brief Create a directory in a volume.
+ *
+ * @param fs The volume.
+ * @param path The absolute path of the directory in the volume.
+ * @param mode The permissions of the directory.
+ * @return 0 on success, -1 on error.
+ */
+int shlkfs_mkdir(struct shlkfs *fs, const char *path, mode_t mode);
+
+/**
+ * @brief Delete a file (not a directory) of a volume.
+ *
+ * @warning The file must not be opened anymore.
+ *
+ * @param fs The volume.
+ * @param path The absolute path of the file in the volume.
+ * @return 0 on success, -1 on error.
+ */
+int shlkfs_unlink(struct shlkfs *fs, const char *path);
+
+#endif /* SHLKFS_H */
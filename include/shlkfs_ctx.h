@@ -0,0 +1,115 @@
+#ifndef SHLKFS_CTX_H
+#define SHLKFS_CTX_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "block.h"
+#include "cryptfs.h"
+
+struct fat_cache;
+
+/**
+ * @brief Context of an opened SherlockFS volume.
+ *
+ * @details The context owns everything needed to access a volume: its device
+ * (backend, handle and block size) and its master key. It is given to the
+ * entries.h and fat.h functions, so that several volumes can be used by the
+ * same process, from several threads.
+ *
+ * @note The master key is XOR encrypted in memory in order to prevent easy
+ * loot in case of memory corruption. It is only decoded (in `aes_key`) while
+ * an operation runs on the volume (see SHLKFS_CTX_SCOPE).
+ */
+struct shlkfs_ctx
+{
+    struct block_device *device; // The device of the volume
+    unsigned char aes_key[AES_KEY_SIZE_BYTES]; // Decoded master key (zeroed
+                                               // out of the scopes)
+    unsigned char masked_key[AES_KEY_SIZE_BYTES]; // XORed master key
+    unsigned char xor_key[AES_KEY_SIZE_BYTES]; // Master key XOR key
+    struct fat_cache *fat_cache; // FAT loaded in memory (see fat_cache_load),
+                                 // NULL if the FAT is read from the device
+    size_t depth; // Number of nested scopes (protected by `lock`)
+    pthread_mutex_t lock; // Recursive, serializes the operations on the volume
+};
+
+/**
+ * @brief A scope of operations on a volume (see SHLKFS_CTX_SCOPE).
+ */
+struct shlkfs_ctx_scope
+{
+    struct shlkfs_ctx *ctx; // The context of the scope (can be NULL)
+    struct block_device *previous_device; // Device used before the scope
+};
+
+/**
+ * @brief Open a SherlockFS volume.
+ *
+ * @note The block size is read from the header of the volume.
+ *
+ * @param device_path The path of the device of the volume.
+ * @param aes_key The master key of the volume (copied).
+ * @return struct shlkfs_ctx* The context of the volume, NULL if the device
+ * cannot be opened or is not a SherlockFS volume.
+ */
+struct shlkfs_ctx *shlkfs_ctx_open(const char *device_path,
+                                   const unsigned char *aes_key);
+
+/**
+ * @brief Open a SherlockFS volume with a private key registered in its keys
+ * storage (the passphrase of the private key is asked if it is encrypted).
+ *
+ * @param device_path The path of the device of the volume.
+ * @param private_key_path A path to the private key.
+ * @return struct shlkfs_ctx* The context of the volume, NULL if the device is
+ * not a SherlockFS volume or if the private key is not registered.
+ */
+struct shlkfs_ctx *shlkfs_ctx_open_with_key(const char *device_path,
+                                            const char *private_key_path);
+
+/**
+ * @brief Close a SherlockFS volume.
+ *
+ * @note The FAT loaded in memory, if any, is committed first.
+ *
+ * @param ctx The context of the volume (can be NULL).
+ */
+void shlkfs_ctx_close(struct shlkfs_ctx *ctx);
+
+/**
+ * @brief Make the blocks written so far on a volume durable (including the
+ * FAT loaded in memory, if any).
+ *
+ * @param ctx The context of the volume.
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+int shlkfs_ctx_flush(struct shlkfs_ctx *ctx);
+
+/**
+ * @brief Start a scope of operations on a volume: lock the volume, decode its
+ * master key, and make the calling thread use its device.
+ *
+ * @param ctx The context of the volume (nothing is done if NULL).
+ * @return struct shlkfs_ctx_scope The scope, to give to shlkfs_ctx_leave.
+ */
+struct shlkfs_ctx_scope shlkfs_ctx_enter(struct shlkfs_ctx *ctx);
+
+/**
+ * @brief End a scope of operations on a volume (see shlkfs_ctx_enter).
+ *
+ * @param scope The scope.
+ */
+void shlkfs_ctx_leave(struct shlkfs_ctx_scope *scope);
+
+/**
+ * @brief Run the rest of the enclosing block in a scope of operations on a
+ * volume. The scope ends when the block is left, whatever the return path.
+ *
+ * @param ctx The context of the volume.
+ */
+#define SHLKFS_CTX_SCOPE(ctx)                                                  \
+    struct shlkfs_ctx_scope __ctx_scope                                        \
+        __attribute__((cleanup(shlkfs_ctx_leave))) = shlkfs_ctx_enter(ctx)
+
+#endif /* SHLKFS_CTX_H */
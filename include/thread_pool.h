@@ -0,0 +1,60 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+/**
+ * @brief Task executed by the thread pool for each item of a job.
+ *
+ * @param arg The argument given to thread_pool_parallel_for.
+ * @param index The index of the item to process.
+ * @return 0 on success, any other value on error.
+ */
+typedef int (*thread_pool_task_t)(void *arg, size_t index);
+
+/**
+ * @brief Start the thread pool global variable.
+ *
+ * @note Calling this function when the pool is already started restarts it
+ * with the new number of threads.
+ *
+ * @param nb_threads The number of threads working on a job, the calling
+ * thread included. 0 to use the number of online cores.
+ */
+void thread_pool_init(size_t nb_threads);
+
+/**
+ * @brief Stop the thread pool global variable and join its threads.
+ */
+void thread_pool_destroy(void);
+
+/**
+ * @brief Get the number of threads working on a job (calling thread
+ * included). Starts the pool with the number of online cores if needed.
+ *
+ * @return The number of threads of the pool.
+ */
+size_t thread_pool_size(void);
+
+/**
+ * @brief Run `task` on every index in [0, nb_items) using the thread pool and
+ * the calling thread. Returns once all the items are processed.
+ *
+ * @details The items are split in one contiguous range per thread. A thread
+ * which has finished its range steals half of the biggest remaining range of
+ * another thread (work-stealing), so that uneven items do not leave cores
+ * idle.
+ *
+ * @note The pool is started with the number of online cores if needed. A job
+ * is run at a time: concurrent callers are serialized. A job submitted by a
+ * task is run inline, on the thread of the task.
+ *
+ * @param task The task to run on each item.
+ * @param arg The argument given to each task.
+ * @param nb_items The number of items.
+ * @return 0 if all the tasks succeeded, -1 otherwise.
+ */
+int thread_pool_parallel_for(thread_pool_task_t task, void *arg,
+                             size_t nb_items);
+
+#endif /* THREAD_POOL_H */
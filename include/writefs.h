@@ -12,4 +12,35 @@
 void write_cryptfs_headers(const char *device_path,
                            const struct CryptFS *cryptfs);
 
+/**
+ * @brief Write some key slots of a keys storage to the device, in one pass
+ *
+ * @details Only the blocks of the given key slots are written (the other
+ * blocks may be written by a mounted volume meanwhile), then the device is
+ * flushed once.
+ *
+ * @note The block size of the device must be set (see read_key_slots).
+ *
+ * @param device_path Path to the CryptFS device
+ * @param keys_storage The NB_ENCRYPTION_KEYS key slots
+ * @param indexes The indexes of the key slots to write
+ * @param nb_indexes The number of key slots to write
+ * @return int 0 on success, -1 on error (error printed)
+ */
+int write_key_slots(const char *device_path,
+                    const struct CryptFS_KeySlot *keys_storage,
+                    const size_t *indexes, size_t nb_indexes);
+
+/**
+ * @brief Write a key slot of a keys storage to the device (see
+ * write_key_slots)
+ *
+ * @param device_path Path to the CryptFS device
+ * @param keys_storage The NB_ENCRYPTION_KEYS key slots
+ * @param index The index of the key slot to write
+ * @return int 0 on success, -1 on error (error printed)
+ */
+int write_key_slot(const char *device_path,
+                   const struct CryptFS_KeySlot *keys_storage, size_t index);
+
 #endif /* WRITEFS_H */
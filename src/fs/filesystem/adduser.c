@@ -1,27 +1,133 @@
 #include "adduser.h"
 
 #include <assert.h>
+#include <stdbool.h>
+#include <string.h>
 
+#include "agent.h"
 #include "crypto.h"
+#include "deluser.h"
 #include "format.h"
+#include "keytable.h"
 #include "passphrase.h"
 #include "print.h"
 #include "readfs.h"
+#include "shlkfs_ctx.h"
 #include "writefs.h"
+#include "xalloc.h"
+
+/**
+ * @brief Store the public keys of new users in the keys storage.
+ *
+ * @param keys_storage The keys storage.
+ * @param other_public_key_paths The paths of the public keys to add.
+ * @param nb_users The number of public keys to add.
+ * @param master_key The master key (encrypted with each public key).
+ * @param indexes The indexes of the key slots where the keys are stored.
+ * @return int 0 if success, -1 if a public key is already in the keys
+ * storage.
+ */
+static int __store_users(struct CryptFS_KeySlot *keys_storage,
+                         const char *const *other_public_key_paths,
+                         size_t nb_users, const unsigned char *master_key,
+                         size_t *indexes)
+{
+    for (size_t i = 0; i < nb_users; i++)
+    {
+        // Loading the other user public key from disk in memory
+        print_info("Loading other user public key '%s' from disk...\n",
+                   other_public_key_paths[i]);
+        EVP_PKEY *other_rsa =
+            load_rsa_keypair_from_disk(other_public_key_paths[i], NULL, NULL);
+
+        // Check if other user is already in the keys storage (or in the batch)
+        if (find_rsa_matching_key(other_rsa, keys_storage) != -1)
+        {
+            print_warning("The user with the public key '%s' is already in "
+                          "the keys storage\n",
+                          other_public_key_paths[i]);
+            EVP_PKEY_free(other_rsa);
+            return -1;
+        }
+
+        indexes[i] =
+            store_keys_in_keys_storage(keys_storage, other_rsa, master_key);
+        EVP_PKEY_free(other_rsa);
+    }
 
-int cryptfs_adduser(const char *device_path, const char *other_public_key_path,
-                    const char *my_private_key_path)
+    return 0;
+}
+
+/**
+ * @brief Store the public keys of new users in the key table of a volume
+ * (created if the volume has none).
+ *
+ * @param device_path The path of the device of the volume.
+ * @param other_public_key_paths The paths of the public keys to add.
+ * @param nb_users The number of public keys to add.
+ * @param master_key The master key (encrypted with each public key).
+ * @return int 0 if success, -1 if a public key is already registered (or on
+ * error).
+ */
+static int __store_users_in_table(const char *device_path,
+                                  const char *const *other_public_key_paths,
+                                  size_t nb_users,
+                                  const unsigned char *master_key)
 {
-    char *passphrase = NULL;
+    struct CryptFS_KeySlot *key_slots = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, nb_users, sizeof(struct CryptFS_KeySlot));
+    int res = 0;
+    for (size_t i = 0; res == 0 && i < nb_users; i++)
+    {
+        // Loading the other user public key from disk in memory
+        print_info("Loading other user public key '%s' from disk...\n",
+                   other_public_key_paths[i]);
+        EVP_PKEY *other_rsa =
+            load_rsa_keypair_from_disk(other_public_key_paths[i], NULL, NULL);
+
+        // Check if other user is already in the key table (or in the batch)
+        bool exists = find_key_slot(device_path, other_rsa, NULL) != -1;
+        if (!exists)
+            store_keys_in_key_slot(&key_slots[i], other_rsa, master_key);
+        for (size_t j = 0; !exists && j < i; j++)
+            exists = memcmp(key_slots[j].rsa_n_fingerprint,
+                            key_slots[i].rsa_n_fingerprint,
+                            SHA256_DIGEST_LENGTH)
+                == 0;
+        if (exists)
+        {
+            print_warning("The user with the public key '%s' is already in "
+                          "the keys storage\n",
+                          other_public_key_paths[i]);
+            res = -1;
+        }
+        EVP_PKEY_free(other_rsa);
+    }
 
-    // Check if the device is already formatted
-    if (!is_already_formatted(device_path))
+    // The FAT is needed if the key table is created (or grows)
+    if (res == 0)
     {
-        error_exit(
-            "The device '%s' is not formatted. Please format it first.\n",
-            EXIT_FAILURE, device_path);
+        struct shlkfs_ctx *ctx = shlkfs_ctx_open(device_path, master_key);
+        res = ctx == NULL ? -1 : key_table_add(ctx, key_slots, nb_users);
+        shlkfs_ctx_close(ctx);
     }
 
+    free(key_slots);
+    return res;
+}
+
+/**
+ * @brief Decrypt the master key with the private key of a registered user.
+ *
+ * @param device_path The path of the device of the volume.
+ * @param my_private_key_path A path to the private key already registered.
+ * @return unsigned char* The master key.
+ */
+static unsigned char *__decrypt_master_key(const char *device_path,
+                                           const char *my_private_key_path)
+{
+    char *passphrase = NULL;
+
     // Check if my private key is encrypted
     if (rsa_private_is_encrypted(my_private_key_path))
         passphrase = ask_user_passphrase(false);
@@ -30,33 +136,12 @@ int cryptfs_adduser(const char *device_path, const char *other_public_key_path,
     print_info("Loading registred user private key from disk...\n");
     EVP_PKEY *my_rsa =
         load_rsa_keypair_from_disk(NULL, my_private_key_path, passphrase);
-
-    // Loading the other user public key from disk in memory
-    print_info("Loading other user public key from disk...\n");
-    EVP_PKEY *other_rsa =
-        load_rsa_keypair_from_disk(other_public_key_path, NULL, NULL);
-
-    // Find matching RSA key in the keys storage
-    struct CryptFS *cryptfs = read_cryptfs_headers(device_path);
-
-    // Check if other user is already in the keys storage
-    ssize_t index = find_rsa_matching_key(other_rsa, cryptfs->keys_storage);
-
-    if (index != -1)
-    {
-        print_warning(
-            "The user with the public key '%s' is already in the keys "
-            "storage of the device '%s'\n",
-            other_public_key_path, device_path);
-        free(cryptfs);
-        free(passphrase);
-        EVP_PKEY_free(my_rsa);
-        EVP_PKEY_free(other_rsa);
-        return -1;
-    }
+    free(passphrase);
 
     print_info("Finding registred user private key in the keys storage...\n");
-    index = find_rsa_matching_key(my_rsa, cryptfs->keys_storage);
+    struct CryptFS_KeySlot *key_slot = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_KeySlot));
+    ssize_t index = find_key_slot(device_path, my_rsa, key_slot);
 
     if (index == -1)
         error_exit("User private key is not registered in the keys "
@@ -67,30 +152,86 @@ int cryptfs_adduser(const char *device_path, const char *other_public_key_path,
     print_info("Decrypting the master key...\n");
     size_t decrypted_master_key_size = 0;
     unsigned char *decrypted_master_key =
-        rsa_decrypt_data(my_rsa, cryptfs->keys_storage[index].aes_key_ciphered,
+        rsa_decrypt_data(my_rsa, key_slot->aes_key_ciphered,
                          RSA_KEY_SIZE_BYTES, &decrypted_master_key_size);
+    EVP_PKEY_free(my_rsa);
+    free(key_slot);
 
     assert(decrypted_master_key_size == AES_KEY_SIZE_BYTES);
+    return decrypted_master_key;
+}
 
-    print_info("Storing the other user public key in the keys storage and "
-               "encrypting the master key with it...\n");
-    store_keys_in_keys_storage(cryptfs->keys_storage, other_rsa,
-                               decrypted_master_key);
+int cryptfs_addusers(const char *device_path,
+                     const char *const *other_public_key_paths,
+                     size_t nb_users, const char *my_private_key_path)
+{
+    // Check if the device is already formatted
+    if (!is_already_formatted(device_path))
+    {
+        error_exit(
+            "The device '%s' is not formatted. Please format it first.\n",
+            EXIT_FAILURE, device_path);
+    }
 
-    // Write the new CryptFS headers on device
-    print_info("Writing the new headers on device...\n");
-    write_cryptfs_headers(device_path, cryptfs);
+    // Only the key slots are read (and written), from the keys storage
+    // until it is full
+    struct CryptFS_KeyTable *key_table = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_KeyTable));
+    struct CryptFS_KeySlot *keys_storage = NULL;
+    if (read_key_table(device_path, key_table) == 0)
+        keys_storage = read_key_slots(device_path);
+    free(key_table);
+    if (keys_storage != NULL && available_key_slots(keys_storage) < nb_users)
+    {
+        print_info("There are only %zu free key slots in the keys storage of "
+                   "the device '%s' (%zu users to add): the key slots are "
+                   "moved to a key table\n",
+                   available_key_slots(keys_storage), device_path, nb_users);
+        free(keys_storage);
+        keys_storage = NULL;
+    }
 
-    // Free memory
-    if (passphrase != NULL)
-        free(passphrase);
-    EVP_PKEY_free(my_rsa);
-    EVP_PKEY_free(other_rsa);
+    // The running agent (if any) may already know the master key
+    unsigned char *decrypted_master_key =
+        agent_extract_aes_key(device_path, NULL);
+    if (decrypted_master_key == NULL)
+        decrypted_master_key =
+            __decrypt_master_key(device_path, my_private_key_path);
+
+    // Nothing is written if one of the users cannot be added
+    print_info("Storing the other users public keys in the keys storage and "
+               "encrypting the master key with them...\n");
+    int res = 0;
+    if (keys_storage == NULL)
+        res = __store_users_in_table(device_path, other_public_key_paths,
+                                     nb_users, decrypted_master_key);
+    else
+    {
+        size_t *indexes = xcalloc(nb_users, sizeof(size_t));
+        res = __store_users(keys_storage, other_public_key_paths, nb_users,
+                            decrypted_master_key, indexes);
+        if (res == 0)
+        {
+            print_info("Writing the new key slots on device...\n");
+            res = write_key_slots(device_path, keys_storage, indexes,
+                                  nb_users);
+        }
+        free(indexes);
+        free(keys_storage);
+    }
+    memset(decrypted_master_key, 0, AES_KEY_SIZE_BYTES);
     free(decrypted_master_key);
-    free(cryptfs);
 
-    print_success("The user with the public key '%s' has been added to the "
-                  "keys storage of the device '%s' successfully!\n",
-                  other_public_key_path, device_path);
-    return 0;
+    for (size_t i = 0; res == 0 && i < nb_users; i++)
+        print_success("The user with the public key '%s' has been added to "
+                      "the keys storage of the device '%s' successfully!\n",
+                      other_public_key_paths[i], device_path);
+    return res;
+}
+
+int cryptfs_adduser(const char *device_path, const char *other_public_key_path,
+                    const char *my_private_key_path)
+{
+    return cryptfs_addusers(device_path, &other_public_key_path, 1,
+                            my_private_key_path);
 }
@@ -0,0 +1,538 @@
+#include "backup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "cbt.h"
+#include "cryptfs.h"
+#include "format.h"
+#include "maths.h"
+#include "print.h"
+#include "xalloc.h"
+
+// Size of the chunks of blocks read (or written) at once
+#define BACKUP_CHUNK_BYTES (16 * 1024 * 1024)
+
+/**
+ * @brief Write a whole buffer to a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param data The data to write.
+ * @param size The size of the data.
+ * @return int 0 on success, -1 on error.
+ */
+static int __write_full(int fd, const void *data, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t res = write(fd, (const char *)data + done, size - done);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res == -1)
+            return -1;
+        done += res;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read a whole buffer from a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param data The buffer to fill.
+ * @param size The size of the buffer.
+ * @return int 0 on success, -1 on error or if the end of file is reached
+ * before.
+ */
+static int __read_full(int fd, void *data, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t res = read(fd, (char *)data + done, size - done);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return -1;
+        done += res;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read the block size of a volume from its header.
+ *
+ * @param device_path The path of the device of the volume.
+ * @return size_t The block size, 0 on error (error printed).
+ */
+static size_t __volume_block_size(const char *device_path)
+{
+    if (!is_already_formatted(device_path))
+    {
+        print_error("The device '%s' is not a SherlockFS volume\n",
+                    device_path);
+        return 0;
+    }
+
+    struct CryptFS_Header *header = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Header));
+    size_t block_size = 0;
+    if (read_device_bytes(device_path, 0, sizeof(struct CryptFS_Header),
+                          header)
+            == 0
+        && is_block_size_supported(header->blocksize))
+        block_size = header->blocksize;
+    else
+        print_error("Failed to read the header of the device '%s'\n",
+                    device_path);
+    free(header);
+
+    return block_size;
+}
+
+/**
+ * @brief Copy the blocks of the device used by the calling thread to a
+ * backup file.
+ *
+ * @details The extents of each chunk are read at once (see
+ * read_blocks_batch), then written to the backup file.
+ *
+ * @param fd The file descriptor of the backup file.
+ * @param header The header of the backup.
+ * @param cbt The tracking file to copy the changed blocks only, NULL to copy
+ * all the blocks.
+ * @param nb_copied The number of copied blocks. (returned)
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __backup_blocks(int fd, const struct CryptFS_Backup_Header *header,
+                           const struct cbt *cbt, uint64_t *nb_copied)
+{
+    size_t block_size = header->block_size;
+    size_t nb_blocks = header->device_size / block_size;
+    size_t chunk_blocks = MAX(BACKUP_CHUNK_BYTES / block_size, 1);
+    unsigned char *buffer =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, chunk_blocks, block_size);
+    struct block_request *requests =
+        xcalloc(chunk_blocks, sizeof(struct block_request));
+
+    int res = __write_full(fd, header, sizeof(*header));
+    size_t block = 0;
+    while (res == 0 && block < nb_blocks)
+    {
+        // Gather the extents to copy until the chunk is full
+        size_t nb_requests = 0;
+        size_t filled = 0;
+        while (filled < chunk_blocks)
+        {
+            if (cbt != NULL)
+                block = cbt_next_changed(cbt, block);
+            if (block >= nb_blocks)
+                break;
+
+            struct block_request *request = &requests[nb_requests++];
+            request->start_block = block;
+            request->nb_blocks = 0;
+            request->buffer = buffer + filled * block_size;
+            while (block < nb_blocks && filled < chunk_blocks
+                   && (cbt == NULL || cbt_is_changed(cbt, block)))
+            {
+                block++;
+                filled++;
+                request->nb_blocks++;
+            }
+        }
+        if (nb_requests == 0)
+            break;
+
+        if (read_blocks_batch(requests, nb_requests))
+        {
+            print_error("Failed to read the blocks of the device\n");
+            res = -1;
+            break;
+        }
+
+        for (size_t i = 0; res == 0 && i < nb_requests; i++)
+        {
+            struct CryptFS_Backup_Extent extent = {
+                .start_block = requests[i].start_block,
+                .nb_blocks = requests[i].nb_blocks,
+            };
+            res = __write_full(fd, &extent, sizeof(extent))
+                || __write_full(fd, requests[i].buffer,
+                                requests[i].nb_blocks * block_size);
+        }
+        *nb_copied += filled;
+    }
+
+    // The backup ends with an empty extent
+    struct CryptFS_Backup_Extent end = { 0 };
+    if (res == 0 && (__write_full(fd, &end, sizeof(end)) || fsync(fd)))
+        res = -1;
+
+    free(requests);
+    free(buffer);
+    return res;
+}
+
+/**
+ * @brief Track the changes of a device as before a backup that failed: the
+ * marks of the tracking file replaced by the backup are merged into the new
+ * one, which is removed if there was none before.
+ *
+ * @param device_path The path of the device.
+ * @param previous The tracking file replaced by the backup, NULL if none.
+ */
+static void __restore_tracking(const char *device_path,
+                               const struct cbt *previous)
+{
+    struct cbt *cbt = NULL;
+    if (previous != NULL && cbt_open(device_path, &cbt) == 0 && cbt != NULL)
+    {
+        cbt_merge(cbt, previous);
+        int res = cbt_sync(cbt);
+        cbt_close(cbt);
+        if (res == 0)
+            return;
+    }
+
+    // The blocks written since the previous backup are unknown
+    if (previous != NULL)
+        print_error("The changes of the device '%s' are no longer tracked: "
+                    "make a full backup\n",
+                    device_path);
+    cbt_disable(device_path);
+}
+
+int cryptfs_backup(const char *device_path, const char *backup_path,
+                   bool incremental)
+{
+    size_t block_size = __volume_block_size(device_path);
+    if (block_size == 0)
+        return -1;
+
+    // The device is locked exclusively for the whole backup: it is not written
+    // while it is copied, and no device keeps marking the tracking file
+    // replaced below
+    struct block_device *device = block_device_open(device_path, block_size);
+    if (device == NULL)
+        return -1;
+    if (block_device_lock(device))
+    {
+        block_device_close(device);
+        return -1;
+    }
+    struct block_device *previous_device = block_device_use(device);
+
+    struct cbt *cbt = NULL;
+    int res = cbt_open(device_path, &cbt);
+    if (res == 0 && incremental
+        && (cbt == NULL || cbt_header(cbt)->block_size != block_size))
+    {
+        print_error("The changes of the device '%s' are not tracked: make a "
+                    "full backup first\n",
+                    device_path);
+        res = -1;
+    }
+
+    // The blocks written from now on are tracked for the next backup, while
+    // the previous tracking file (still mapped) tells the blocks to copy
+    uint64_t epoch = cbt != NULL ? cbt_header(cbt)->epoch + 1 : 0;
+    if (res == 0
+        && cbt_enable(device_path, block_size, get_device_size() / block_size,
+                      epoch))
+        res = -1;
+    if (res != 0)
+    {
+        block_device_use(previous_device);
+        block_device_close(device);
+        cbt_close(cbt);
+        return -1;
+    }
+
+    struct CryptFS_Backup_Header header = {
+        .version = CRYPTFS_BACKUP_VERSION,
+        .incremental = incremental,
+        .block_size = block_size,
+        .device_size = get_device_size(),
+        .epoch = epoch,
+    };
+    memcpy(header.magic, CRYPTFS_BACKUP_MAGIC, CRYPTFS_BACKUP_MAGIC_SIZE);
+
+    if (incremental)
+        print_info("Backing up the blocks written since the backup #%lu...\n",
+                   (unsigned long)cbt_header(cbt)->epoch);
+    else
+        print_info("Backing up all the blocks of the device...\n");
+
+    res = -1;
+    uint64_t nb_copied = 0;
+    int fd = open(backup_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1)
+        print_error("Failed to create the backup file '%s': %s\n", backup_path,
+                    strerror(errno));
+    else
+    {
+        res = __backup_blocks(fd, &header, incremental ? cbt : NULL,
+                              &nb_copied);
+        if (close(fd) != 0 || res != 0)
+        {
+            print_error("Failed to write the backup file '%s'\n",
+                        backup_path);
+            res = -1;
+        }
+    }
+
+    // The next incremental backup starts from the previous one again
+    if (res != 0)
+        __restore_tracking(device_path, cbt);
+    cbt_close(cbt);
+
+    block_device_use(previous_device);
+    block_device_close(device);
+
+    if (res == 0)
+        print_success("The backup #%lu of the device '%s' has been written to "
+                      "'%s' successfully (%lu blocks, %lu bytes)!\n",
+                      (unsigned long)header.epoch, device_path, backup_path,
+                      (unsigned long)nb_copied,
+                      (unsigned long)(nb_copied * block_size));
+    return res;
+}
+
+/**
+ * @brief Write the extents of a backup file to the device used by the calling
+ * thread.
+ *
+ * @param fd The file descriptor of the backup file (after its header).
+ * @param header The header of the backup.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __restore_blocks(int fd, const struct CryptFS_Backup_Header *header)
+{
+    size_t block_size = header->block_size;
+    size_t nb_blocks = header->device_size / block_size;
+    size_t chunk_blocks = MAX(BACKUP_CHUNK_BYTES / block_size, 1);
+    unsigned char *buffer =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, chunk_blocks, block_size);
+
+    int res = 0;
+    while (res == 0)
+    {
+        struct CryptFS_Backup_Extent extent;
+        if (__read_full(fd, &extent, sizeof(extent)))
+        {
+            print_error("The backup is truncated\n");
+            res = -1;
+            break;
+        }
+        if (extent.nb_blocks == 0)
+            break;
+        if (extent.start_block >= nb_blocks
+            || extent.nb_blocks > nb_blocks - extent.start_block)
+        {
+            print_error("The backup is corrupted\n");
+            res = -1;
+            break;
+        }
+
+        for (uint64_t done = 0; res == 0 && done < extent.nb_blocks;)
+        {
+            size_t nb = MIN(chunk_blocks, extent.nb_blocks - done);
+            if (__read_full(fd, buffer, nb * block_size))
+            {
+                print_error("The backup is truncated\n");
+                res = -1;
+            }
+            else if (write_blocks(extent.start_block + done, nb, buffer))
+            {
+                print_error("Failed to write the blocks to the device\n");
+                res = -1;
+            }
+            done += nb;
+        }
+    }
+
+    if (res == 0 && flush_blocks())
+        res = -1;
+
+    free(buffer);
+    return res;
+}
+
+/**
+ * @brief Check that an incremental backup follows the last backup restored on
+ * a device.
+ *
+ * @param device_path The path of the device.
+ * @param header The header of the incremental backup.
+ * @return int 0 if the backup can be restored, -1 otherwise (error printed).
+ */
+static int __check_restore_order(const char *device_path,
+                                 const struct CryptFS_Backup_Header *header)
+{
+    char *path = cbt_state_path(device_path, CRYPTFS_RESTORE_SUFFIX);
+    struct CryptFS_Restore_State state;
+    int fd = open(path, O_RDONLY);
+    int res = fd == -1 ? -1 : __read_full(fd, &state, sizeof(state));
+    if (fd != -1)
+        close(fd);
+    free(path);
+
+    if (res != 0
+        || memcmp(state.magic, CRYPTFS_BACKUP_MAGIC, CRYPTFS_BACKUP_MAGIC_SIZE)
+            != 0
+        || state.version != CRYPTFS_BACKUP_VERSION
+        || state.block_size != header->block_size)
+    {
+        print_error("No backup was restored on the device '%s': restore the "
+                    "full backup first\n",
+                    device_path);
+        return -1;
+    }
+    if (state.epoch + 1 != header->epoch)
+    {
+        print_error("The backup #%lu does not follow the backup #%lu restored "
+                    "on the device '%s'\n",
+                    (unsigned long)header->epoch, (unsigned long)state.epoch,
+                    device_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Record the last backup restored on a device.
+ *
+ * @param device_path The path of the device.
+ * @param header The header of the backup, NULL to forget the restored backup
+ * (while the device is being written).
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __write_restore_state(const char *device_path,
+                                 const struct CryptFS_Backup_Header *header)
+{
+    char *path = cbt_state_path(device_path, CRYPTFS_RESTORE_SUFFIX);
+    int res = 0;
+    if (header == NULL)
+    {
+        if (unlink(path) != 0 && errno != ENOENT)
+            res = -1;
+    }
+    else
+    {
+        struct CryptFS_Restore_State state = {
+            .version = CRYPTFS_BACKUP_VERSION,
+            .block_size = header->block_size,
+            .epoch = header->epoch,
+        };
+        memcpy(state.magic, CRYPTFS_BACKUP_MAGIC, CRYPTFS_BACKUP_MAGIC_SIZE);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        res = fd == -1 || __write_full(fd, &state, sizeof(state)) || fsync(fd)
+            ? -1
+            : 0;
+        if (fd != -1)
+            close(fd);
+    }
+    if (res != 0)
+        print_error("Failed to write the restore state '%s': %s\n", path,
+                    strerror(errno));
+
+    free(path);
+    return res;
+}
+
+int cryptfs_restore(const char *device_path, const char *backup_path)
+{
+    int fd = open(backup_path, O_RDONLY);
+    if (fd == -1)
+    {
+        print_error("Failed to open the backup file '%s': %s\n", backup_path,
+                    strerror(errno));
+        return -1;
+    }
+
+    struct CryptFS_Backup_Header header;
+    if (__read_full(fd, &header, sizeof(header))
+        || memcmp(header.magic, CRYPTFS_BACKUP_MAGIC,
+                  CRYPTFS_BACKUP_MAGIC_SIZE)
+            != 0
+        || header.version != CRYPTFS_BACKUP_VERSION
+        || !is_block_size_supported(header.block_size))
+    {
+        print_error("'%s' is not a SherlockFS backup\n", backup_path);
+        close(fd);
+        return -1;
+    }
+    if (header.incremental && __check_restore_order(device_path, &header))
+    {
+        close(fd);
+        return -1;
+    }
+
+    // A full backup creates (or resizes) an image file, an incremental backup
+    // grows it if the device grew
+    int device_fd = open(device_path,
+                         header.incremental ? O_WRONLY : O_WRONLY | O_CREAT,
+                         0600);
+    struct stat st;
+    if (device_fd == -1 || fstat(device_fd, &st) != 0
+        || (S_ISREG(st.st_mode)
+            && (header.incremental
+                    ? (uint64_t)st.st_size < header.device_size
+                    : (uint64_t)st.st_size != header.device_size)
+            && ftruncate(device_fd, header.device_size) != 0))
+    {
+        print_error("Failed to prepare the device '%s': %s\n", device_path,
+                    strerror(errno));
+        if (device_fd != -1)
+            close(device_fd);
+        close(fd);
+        return -1;
+    }
+    close(device_fd);
+
+    struct block_device *device =
+        block_device_open(device_path, header.block_size);
+    if (device == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+    struct block_device *previous_device = block_device_use(device);
+
+    int res = -1;
+    if (get_device_size() < header.device_size)
+        print_error("The device '%s' is smaller than the backed up one\n",
+                    device_path);
+    else
+    {
+        print_info("Restoring the %s backup #%lu...\n",
+                   header.incremental ? "incremental" : "full",
+                   (unsigned long)header.epoch);
+        // The device matches no backup until the restore ends
+        res = __write_restore_state(device_path, NULL);
+        if (res == 0)
+            res = __restore_blocks(fd, &header);
+        if (res == 0)
+            res = __write_restore_state(device_path, &header);
+    }
+
+    block_device_use(previous_device);
+    block_device_close(device);
+    close(fd);
+
+    if (res == 0)
+        print_success("The backup '%s' has been restored on the device '%s' "
+                      "successfully!\n",
+                      backup_path, device_path);
+    return res;
+}
@@ -2,153 +2,1193 @@
 
 #include <assert.h>
 #include <errno.h>
-#include <stdio.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
 
+#include "block_backend.h"
+#include "block_cipher.h"
+#include "cbt.h"
 #include "cryptfs.h"
-#include "crypto.h"
 #include "print.h"
+#include "thread_pool.h"
 #include "xalloc.h"
 
-const char *DEVICE_PATH = NULL;
+// Size from which multi-block encryption/decryption uses the thread pool
+#define PARALLEL_CRYPTO_THRESHOLD_BYTES (256 * 1024)
+// Number of blocks given at once to the cipher by a task of the thread pool
+#define CRYPTO_BATCH_BLOCKS 16
+// Size of a chunk of a pipelined transfer
+#define PIPELINE_CHUNK_BYTES (1024 * 1024)
+// Maximum number of chunks in flight (encrypted but not written yet, or read
+// but not decrypted yet) during a pipelined transfer
+#define PIPELINE_DEPTH 4
+// Size from which a transfer is pipelined
+#define PIPELINE_THRESHOLD_BYTES (2 * PIPELINE_CHUNK_BYTES)
 
-void set_device_path(const char *path)
+/**
+ * @brief A device opened by the block layer.
+ */
+struct block_device
 {
-    assert(path != NULL);
-    DEVICE_PATH = path;
-
-    // Create file (if not created)
-    FILE *tmp_file = fopen(path, "r+");
-    if (!tmp_file)
-        error_exit("Impossible to open the device '%s': %s\n", EXIT_FAILURE,
-                   path, strerror(errno));
-
-    // Check file size
-    fseek(tmp_file, 0, SEEK_END);
-    size_t file_size = ftell(tmp_file);
-    if (file_size < sizeof(struct CryptFS))
-        error_exit(
-            "The device '%s' is too small to be a SherlockFS filesystem\n",
-            EXIT_FAILURE, path);
+    const char *path; // Path of the device
+    const struct block_backend_ops *backend; // The backend of `handle`
+    void *handle; // The device opened by `backend`, NULL if not opened
+    size_t block_size; // Block size of the device (in bytes)
+    enum cryptfs_cipher cipher; // Cipher of the blocks of the device
+    const struct block_cipher_ops *cipher_ops; // The operations of `cipher`
+    struct cbt *cbt; // Changed-block tracking file, NULL if not tracked
+    int lock_fd; // Holds the shared lock of the device, -1 if not opened
+    bool discard_mode; // The freed blocks are discarded (see discard_blocks)
+    bool direct_io_mode; // The device is opened with O_DIRECT
+};
 
-    fseek(tmp_file, 0, SEEK_SET);
-    fclose(tmp_file);
+// The device set with set_device_path
+struct block_device DEFAULT_DEVICE = {
+    .path = NULL,
+    .backend = &block_backend_stdio,
+    .handle = NULL,
+    .block_size = CRYPTFS_BLOCK_SIZE_BYTES,
+    .cipher = CRYPTFS_CIPHER_AES_256_CBC,
+    .cipher_ops = &block_cipher_aes_256_cbc,
+    .cbt = NULL,
+    .lock_fd = -1,
+    .discard_mode = false,
+    .direct_io_mode = false,
+};
+// The device used by the calling thread, NULL for DEFAULT_DEVICE
+static __thread struct block_device *CURRENT_DEVICE = NULL;
+// The modes of the devices opened from now on (see __open_device)
+static bool DISCARD_MODE = false;
+static bool IO_URING_MODE = false;
+static bool DIRECT_IO_MODE = false;
+static bool MMAP_MODE = false;
+// Backend chosen with set_block_backend, NULL to choose it from the modes
+static const struct block_backend_ops *BACKEND_OVERRIDE = NULL;
+
+/**
+ * @brief Get the device used by the calling thread, to read its settings.
+ *
+ * @return struct block_device* The device used by the calling thread.
+ */
+static struct block_device *__device(void)
+{
+    return CURRENT_DEVICE != NULL ? CURRENT_DEVICE : &DEFAULT_DEVICE;
 }
 
-const char *get_device_path()
+/**
+ * @brief Get the device used by the calling thread, to access it. Exits the
+ * program if the thread uses no device: the default device is only used by
+ * the programs which opened it with set_device_path, the other ones use their
+ * devices explicitly (see block_device_use and SHLKFS_CTX_SCOPE).
+ *
+ * @return struct block_device* The device used by the calling thread.
+ */
+static struct block_device *__opened_device(void)
 {
-    assert(DEVICE_PATH != NULL);
-    return DEVICE_PATH;
+    struct block_device *device = __device();
+    if (device->handle == NULL)
+        internal_error_exit("No device is used by the calling thread (see "
+                            "block_device_use)\n",
+                            EXIT_FAILURE);
+    return device;
 }
 
-int read_blocks(block_t start_block, size_t nb_blocks, void *buffer)
+/**
+ * @brief Get the backend to open the devices with: the one set with
+ * set_block_backend, otherwise the one of the enabled mode.
+ *
+ * @return const struct block_backend_ops* The backend.
+ */
+static const struct block_backend_ops *__mode_backend(void)
 {
-    assert(DEVICE_PATH != NULL);
+    if (BACKEND_OVERRIDE != NULL)
+        return BACKEND_OVERRIDE;
+    if (MMAP_MODE)
+        return &block_backend_mmap;
+#ifdef SHLKFS_IO_URING
+    if (IO_URING_MODE)
+        return &block_backend_uring;
+#endif
+    if (DIRECT_IO_MODE)
+        return &block_backend_pio;
+    return &block_backend_stdio;
+}
 
-    if (nb_blocks == 0)
-        return 0;
-    if (!buffer)
+/**
+ * @brief Open a device with its backend, and check that it is large enough
+ * to be a SherlockFS filesystem.
+ *
+ * @param device The device (path, backend and block size set).
+ * @return 0 on success, BLOCK_ERROR on error (error printed).
+ */
+static int __open_device(struct block_device *device)
+{
+    // The modes are the ones of the device until it is closed
+    device->discard_mode = DISCARD_MODE;
+    device->direct_io_mode = DIRECT_IO_MODE;
+    device->handle = device->backend->open(device->path,
+                                           device->direct_io_mode);
+    if (device->handle == NULL)
+    {
+        print_error("Impossible to open the device '%s' (%s backend): %s\n",
+                    device->path, device->backend->name, strerror(errno));
         return BLOCK_ERROR;
+    }
 
-    FILE *file = fopen(DEVICE_PATH, "r");
-    if (!file)
+    if (device->backend->size(device->handle)
+        < (ROOT_DIR_BLOCK + 1) * device->block_size)
     {
-        error_exit("fopen '%s' failed: %s\n", EXIT_FAILURE, DEVICE_PATH,
-                   strerror(errno));
+        print_error(
+            "The device '%s' is too small to be a SherlockFS filesystem\n",
+            device->path);
+        device->backend->close(device->handle);
+        device->handle = NULL;
         return BLOCK_ERROR;
     }
 
-    if (fseek(file, start_block * CRYPTFS_BLOCK_SIZE_BYTES, SEEK_SET) != 0)
+    // The device is locked before its tracking file is opened: a backup
+    // replaces the tracking file under the exclusive lock (see cryptfs_backup).
+    // The devices of the backends that are not files (RAM disks) are not.
+    device->lock_fd = open(device->path, O_RDONLY);
+    int res = device->lock_fd == -1 && errno != ENOENT ? -1 : 0;
+    while (res == 0 && device->lock_fd != -1
+           && flock(device->lock_fd, LOCK_SH) != 0)
+        if (errno != EINTR)
+            res = -1;
+    if (res != 0)
+        print_error("Impossible to lock the device '%s': %s\n", device->path,
+                    strerror(errno));
+
+    // The writes are tracked if the tracking file of the device exists
+    if (res != 0 || cbt_open(device->path, &device->cbt))
     {
-        print_error("fseek '%s' failed: %s\n", EXIT_FAILURE, DEVICE_PATH,
+        if (device->lock_fd != -1)
+            close(device->lock_fd);
+        device->lock_fd = -1;
+        device->backend->close(device->handle);
+        device->handle = NULL;
+        return BLOCK_ERROR;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Close a device (if opened).
+ *
+ * @param device The device.
+ */
+static void __close_device(struct block_device *device)
+{
+    if (device->handle != NULL)
+        device->backend->close(device->handle);
+    device->handle = NULL;
+    cbt_close(device->cbt);
+    device->cbt = NULL;
+    if (device->lock_fd != -1)
+        close(device->lock_fd);
+    device->lock_fd = -1;
+}
+
+/**
+ * @brief Open the default device again with the backend of the modes. Exits
+ * the program if it cannot be opened.
+ */
+static void __reopen_default_device(void)
+{
+    __close_device(&DEFAULT_DEVICE);
+    DEFAULT_DEVICE.backend = __mode_backend();
+    DEFAULT_DEVICE.direct_io_mode = DIRECT_IO_MODE;
+    if (DEFAULT_DEVICE.path != NULL && __open_device(&DEFAULT_DEVICE))
+        exit(EXIT_FAILURE);
+}
+
+void set_device_path(const char *path)
+{
+    assert(path != NULL);
+    __close_device(&DEFAULT_DEVICE);
+    // The path is copied: the caller's one may not outlive the device
+    char *device_path = strdup(path);
+    free((char *)DEFAULT_DEVICE.path);
+    DEFAULT_DEVICE.path = device_path;
+    DEFAULT_DEVICE.backend = __mode_backend();
+    if (__open_device(&DEFAULT_DEVICE))
+        exit(EXIT_FAILURE);
+}
+
+const char *get_device_path()
+{
+    assert(__device()->path != NULL);
+    return __device()->path;
+}
+
+struct block_device *block_device_open(const char *path, size_t block_size)
+{
+    assert(path != NULL && is_block_size_supported(block_size));
+
+    struct block_device *device = xcalloc(1, sizeof(struct block_device));
+    device->path = strdup(path);
+    device->backend = __mode_backend();
+    device->block_size = block_size;
+    device->cipher = CRYPTFS_CIPHER_AES_256_CBC;
+    device->cipher_ops = &block_cipher_aes_256_cbc;
+    device->lock_fd = -1;
+    if (__open_device(device))
+    {
+        free((char *)device->path);
+        free(device);
+        return NULL;
+    }
+
+    return device;
+}
+
+void block_device_close(struct block_device *device)
+{
+    if (device == NULL)
+        return;
+
+    assert(device != &DEFAULT_DEVICE);
+    if (CURRENT_DEVICE == device)
+        CURRENT_DEVICE = NULL;
+    __close_device(device);
+    free((char *)device->path);
+    free(device);
+}
+
+int block_device_lock(struct block_device *device)
+{
+    if (device->lock_fd == -1)
+        return 0;
+
+    int res;
+    while ((res = flock(device->lock_fd, LOCK_EX | LOCK_NB)) != 0
+           && errno == EINTR)
+        continue;
+    if (res != 0 && errno == EWOULDBLOCK)
+        print_error("The device '%s' is in use (unmount it first)\n",
+                    device->path);
+    else if (res != 0)
+        print_error("Failed to lock the device '%s': %s\n", device->path,
                     strerror(errno));
+    return res != 0 ? -1 : 0;
+}
+
+struct block_device *block_device_use(struct block_device *device)
+{
+    struct block_device *previous = CURRENT_DEVICE;
+    CURRENT_DEVICE = device;
+    return previous;
+}
+
+void set_block_backend(const struct block_backend_ops *backend)
+{
+    // The device paths of a backend may not exist for another one
+    __close_device(&DEFAULT_DEVICE);
+    free((char *)DEFAULT_DEVICE.path);
+    DEFAULT_DEVICE.path = NULL;
+    BACKEND_OVERRIDE = backend;
+    __reopen_default_device();
+}
+
+const struct block_backend_ops *get_block_backend(void)
+{
+    return __device()->backend;
+}
+
+bool is_block_size_supported(size_t block_size)
+{
+    return block_size >= CRYPTFS_BLOCK_SIZE_BYTES
+        && block_size <= CRYPTFS_BLOCK_SIZE_MAX_BYTES
+        && (block_size & (block_size - 1)) == 0;
+}
+
+void set_block_size(size_t block_size)
+{
+    if (!is_block_size_supported(block_size))
+        error_exit("The block size '%zu' is not supported (power of two "
+                   "between %d and %d bytes expected)\n",
+                   EXIT_FAILURE, block_size, CRYPTFS_BLOCK_SIZE_BYTES,
+                   CRYPTFS_BLOCK_SIZE_MAX_BYTES);
+    __device()->block_size = block_size;
+}
+
+size_t get_block_size(void)
+{
+    return __device()->block_size;
+}
+
+void set_block_cipher(enum cryptfs_cipher cipher)
+{
+    const struct block_cipher_ops *cipher_ops = block_cipher_get(cipher);
+    if (cipher_ops == NULL)
+        error_exit("The cipher '%d' is not supported\n", EXIT_FAILURE,
+                   cipher);
+    __device()->cipher = cipher;
+    __device()->cipher_ops = cipher_ops;
+}
+
+enum cryptfs_cipher get_block_cipher(void)
+{
+    return __device()->cipher;
+}
+
+size_t get_device_size(void)
+{
+    struct block_device *device = __opened_device();
+
+    return device->backend->size(device->handle);
+}
+
+void set_discard_mode(bool enabled)
+{
+    DISCARD_MODE = enabled;
+    DEFAULT_DEVICE.discard_mode = enabled;
+}
+
+bool get_discard_mode(void)
+{
+    return __device()->discard_mode;
+}
+
+void set_io_uring_mode(bool enabled)
+{
+#ifndef SHLKFS_IO_URING
+    if (enabled)
+        error_exit("SherlockFS was compiled without io_uring support "
+                   "(SHLKFS_IO_URING=1)\n",
+                   EXIT_FAILURE);
+#endif
+    IO_URING_MODE = enabled;
+    __reopen_default_device();
+}
+
+bool get_io_uring_mode(void)
+{
+    return IO_URING_MODE;
+}
+
+void set_direct_io_mode(bool enabled)
+{
+    DIRECT_IO_MODE = enabled;
+    __reopen_default_device(); // Opened again with(out) O_DIRECT
+}
+
+bool get_direct_io_mode(void)
+{
+    return __device()->direct_io_mode;
+}
+
+void set_mmap_mode(bool enabled)
+{
+    MMAP_MODE = enabled;
+    __reopen_default_device();
+}
+
+bool get_mmap_mode(void)
+{
+    return MMAP_MODE;
+}
+
+/**
+ * @brief Read or write bytes of a device opened with O_DIRECT, which only
+ * transfers aligned ranges to aligned buffers: the blocks enclosing the range
+ * go through an aligned bounce buffer (read, modified then written when
+ * writing).
+ *
+ * @note The device is not locked between the read and the write: the bytes
+ * read or written this way (headers, key slots) are not written concurrently.
+ *
+ * @param backend The backend of the device.
+ * @param handle The device opened by the backend.
+ * @param offset The offset of the transfer.
+ * @param size The number of bytes to transfer.
+ * @param buffer The buffer to fill or to write.
+ * @param writing true to write the buffer, false to fill it.
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+static int __direct_io_bytes(const struct block_backend_ops *backend,
+                             void *handle, off_t offset, size_t size,
+                             void *buffer, bool writing)
+{
+    off_t start = offset - offset % CRYPTFS_BLOCK_SIZE_BYTES;
+    off_t end = offset + size;
+    if (end % CRYPTFS_BLOCK_SIZE_BYTES != 0)
+        end += CRYPTFS_BLOCK_SIZE_BYTES - end % CRYPTFS_BLOCK_SIZE_BYTES;
+    bool aligned = start == offset && (size_t)(end - start) == size
+        && (uintptr_t)buffer % CRYPTFS_BLOCK_SIZE_BYTES == 0;
+    if (aligned)
+        return writing ? backend->write(handle, offset, size, buffer)
+                       : backend->read(handle, offset, size, buffer);
+
+    unsigned char *bounce =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, end - start);
+    int res = 0;
+    bool partial = start != offset || (size_t)(end - start) != size;
+    if (!writing || partial)
+        res = backend->read(handle, start, end - start, bounce);
+    if (res == 0 && writing)
+    {
+        memcpy(bounce + (offset - start), buffer, size);
+        res = backend->write(handle, start, end - start, bounce);
+    }
+    else if (res == 0)
+        memcpy(buffer, bounce + (offset - start), size);
+
+    free(bounce);
+    return res;
+}
+
+/**
+ * @brief Read or write bytes of a device, through the device used by the
+ * calling thread if it is the device, otherwise through a handle opened for
+ * the transfer.
+ *
+ * @note The range must be inside the device. In direct I/O mode, the range
+ * can be unaligned (see __direct_io_bytes).
+ *
+ * @param path The path of the device.
+ * @param offset The offset of the transfer.
+ * @param size The number of bytes to transfer.
+ * @param buffer The buffer to fill or to write.
+ * @param writing true to write the buffer, false to fill it.
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+static int __device_bytes(const char *path, off_t offset, size_t size,
+                          void *buffer, bool writing)
+{
+    struct block_device *device = __device();
+    bool current = device->handle != NULL && strcmp(path, device->path) == 0;
+    const struct block_backend_ops *backend =
+        current ? device->backend : __mode_backend();
+    bool direct_io = current ? device->direct_io_mode : DIRECT_IO_MODE;
+    void *handle = current ? device->handle : backend->open(path, direct_io);
+    if (handle == NULL)
+        return BLOCK_ERROR;
+
+    int res = BLOCK_ERROR;
+    if (offset + size <= backend->size(handle) && writing)
+    {
+        struct cbt *cbt = device->cbt;
+        if (!current && cbt_open(path, &cbt))
+            cbt = NULL;
+        cbt_mark(cbt, offset, size);
+        res = direct_io
+            ? __direct_io_bytes(backend, handle, offset, size, buffer, true)
+            : backend->write(handle, offset, size, buffer);
+        if (!current)
+            cbt_close(cbt);
+    }
+    else if (offset + size <= backend->size(handle))
+        res = direct_io
+            ? __direct_io_bytes(backend, handle, offset, size, buffer, false)
+            : backend->read(handle, offset, size, buffer);
+
+    if (!current)
+        backend->close(handle);
+    return res;
+}
+
+int read_device_bytes(const char *path, off_t offset, size_t size,
+                      void *buffer)
+{
+    return __device_bytes(path, offset, size, buffer, false);
+}
+
+int write_device_bytes(const char *path, off_t offset, size_t size,
+                       const void *buffer)
+{
+    return __device_bytes(path, offset, size, (void *)buffer, true);
+}
+
+int flush_blocks(void)
+{
+    struct block_device *device = __opened_device();
+
+    // The marks of the written blocks are made durable first
+    if (cbt_sync(device->cbt))
         return BLOCK_ERROR;
+
+    return device->backend->flush(device->handle);
+}
+
+int discard_blocks(block_t start_block, size_t nb_blocks)
+{
+    struct block_device *device = __opened_device();
+
+    if (!device->discard_mode || nb_blocks == 0)
+        return 0;
+
+    cbt_mark(device->cbt, start_block * device->block_size,
+             nb_blocks * device->block_size);
+
+    return device->backend->discard(device->handle,
+                                    start_block * device->block_size,
+                                    nb_blocks * device->block_size);
+}
+
+/**
+ * @brief Read or write a batch in direct I/O mode.
+ *
+ * @details O_DIRECT transfers bypass the page cache, so the buffers must be
+ * aligned: the blocks of a request with an unaligned buffer go through an
+ * aligned bounce buffer. The buffers allocated by SherlockFS are already
+ * aligned (xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, ...)).
+ *
+ * @param requests The requests.
+ * @param nb_requests The number of requests.
+ * @param writing true to write the buffers, false to fill them.
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+static int __direct_io_batch(const struct block_request *requests,
+                             size_t nb_requests, bool writing)
+{
+    struct block_device *device = __device();
+    struct block_request *direct_requests =
+        xcalloc(nb_requests, sizeof(struct block_request));
+    for (size_t i = 0; i < nb_requests; i++)
+    {
+        direct_requests[i] = requests[i];
+        if ((uintptr_t)requests[i].buffer % CRYPTFS_BLOCK_SIZE_BYTES == 0)
+            continue;
+
+        direct_requests[i].buffer =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, requests[i].nb_blocks,
+                           device->block_size);
+        if (writing)
+            memcpy(direct_requests[i].buffer, requests[i].buffer,
+                   requests[i].nb_blocks * device->block_size);
     }
 
-    size_t read = 0;
-    while (read < nb_blocks)
+    int res = writing
+        ? device->backend->writev(device->handle, device->block_size,
+                                  direct_requests, nb_requests)
+        : device->backend->readv(device->handle, device->block_size,
+                                 direct_requests, nb_requests);
+
+    for (size_t i = 0; i < nb_requests; i++)
     {
-        size_t n = fread(buffer + read * CRYPTFS_BLOCK_SIZE_BYTES,
-                         CRYPTFS_BLOCK_SIZE_BYTES, nb_blocks - read, file);
-        if (n == 0)
-        {
-            // Glitch: if you can read at a non existing offset, try to right at
-            // this one, then try again
-            write_blocks(start_block + read, 1,
-                         buffer + read * CRYPTFS_BLOCK_SIZE_BYTES);
-            n = fread(buffer + read * CRYPTFS_BLOCK_SIZE_BYTES,
-                      CRYPTFS_BLOCK_SIZE_BYTES, nb_blocks - read, file);
-
-            // If still cannot, this is a real error
-            if (n == 0)
-            {
-                print_error(
-                    "Fail to read '%lu' blocks, starting at block '%lu' "
-                    "from '%s': %s\n",
-                    start_block, nb_blocks, DEVICE_PATH, strerror(errno));
-                return BLOCK_ERROR;
-            }
-        }
+        if (direct_requests[i].buffer == requests[i].buffer)
+            continue;
 
-        read += n;
+        if (!writing && res == 0)
+            memcpy(requests[i].buffer, direct_requests[i].buffer,
+                   requests[i].nb_blocks * device->block_size);
+        free(direct_requests[i].buffer);
     }
 
-    if (fclose(file) != 0)
+    free(direct_requests);
+    return res;
+}
+
+int read_blocks(block_t start_block, size_t nb_blocks, void *buffer)
+{
+    struct block_device *device = __opened_device();
+
+    if (nb_blocks == 0)
+        return 0;
+    if (!buffer)
         return BLOCK_ERROR;
 
-    return 0;
+    if (device->direct_io_mode)
+    {
+        struct block_request request = { .start_block = start_block,
+                                         .nb_blocks = nb_blocks,
+                                         .buffer = buffer };
+        return __direct_io_batch(&request, 1, false);
+    }
+
+    return device->backend->read(device->handle,
+                                 start_block * device->block_size,
+                                 nb_blocks * device->block_size, buffer);
 }
 
 int write_blocks(block_t start_block, size_t nb_blocks, const void *buffer)
 {
-    assert(DEVICE_PATH != NULL);
+    struct block_device *device = __opened_device();
 
     if (nb_blocks == 0)
         return 0;
     if (buffer == NULL)
         return BLOCK_ERROR;
 
-    FILE *file = fopen(DEVICE_PATH, "r+");
-    if (!file)
+    cbt_mark(device->cbt, start_block * device->block_size,
+             nb_blocks * device->block_size);
+
+    if (device->direct_io_mode)
     {
-        print_error("fopen '%s' failed: %s\n", DEVICE_PATH, strerror(errno));
-        return BLOCK_ERROR;
+        struct block_request request = { .start_block = start_block,
+                                         .nb_blocks = nb_blocks,
+                                         .buffer = (void *)buffer };
+        return __direct_io_batch(&request, 1, true);
     }
 
-    if (fseek(file, start_block * CRYPTFS_BLOCK_SIZE_BYTES, SEEK_SET) == -1)
+    return device->backend->write(device->handle,
+                                  start_block * device->block_size,
+                                  nb_blocks * device->block_size, buffer);
+}
+
+int read_blocks_batch(const struct block_request *requests,
+                      size_t nb_requests)
+{
+    struct block_device *device = __opened_device();
+
+    if (device->direct_io_mode)
+        return __direct_io_batch(requests, nb_requests, false);
+
+    return device->backend->readv(device->handle, device->block_size,
+                                  requests, nb_requests);
+}
+
+int write_blocks_batch(const struct block_request *requests,
+                       size_t nb_requests)
+{
+    struct block_device *device = __opened_device();
+
+    for (size_t i = 0; i < nb_requests; i++)
+        cbt_mark(device->cbt, requests[i].start_block * device->block_size,
+                 requests[i].nb_blocks * device->block_size);
+
+    if (device->direct_io_mode)
+        return __direct_io_batch(requests, nb_requests, true);
+
+    return device->backend->writev(device->handle, device->block_size,
+                                   requests, nb_requests);
+}
+
+/**
+ * @brief Check if the requests of a batch are in flight at the same time with
+ * the backend (io_uring).
+ *
+ * @return true if the backend submits a batch at once, false otherwise.
+ */
+static bool __backend_submits_batches(void)
+{
+#ifdef SHLKFS_IO_URING
+    return __device()->backend == &block_backend_uring;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief A multi-block encryption/decryption: the blocks (not necessarily
+ * contiguous, nor of the same request) are given to the cipher by batches.
+ */
+struct block_crypto_job
+{
+    const struct block_cipher_ops *cipher; // The cipher of the device
+    unsigned char key[BLOCK_CIPHER_KEY_MAX_BYTES]; // The key of the blocks,
+                                                   // derived from the AES key
+    size_t block_size; // Number of bytes encrypted/decrypted per block
+    bool encrypt; // true to encrypt, false to decrypt
+    struct block_cipher_request *blocks; // The blocks of the job
+    size_t nb_blocks; // Number of blocks added to the job
+    // `blocks` of the jobs of at most CRYPTO_BATCH_BLOCKS blocks
+    struct block_cipher_request small_blocks[CRYPTO_BATCH_BLOCKS];
+};
+
+/**
+ * @brief Prepare a job on the device used by the calling thread.
+ *
+ * @param job The job to prepare.
+ * @param aes_key The AES key.
+ * @param nb_blocks The number of blocks of the job (see __crypto_job_add).
+ * @param encrypt true to encrypt, false to decrypt.
+ */
+static void __crypto_job_init(struct block_crypto_job *job,
+                              const unsigned char *aes_key, size_t nb_blocks,
+                              bool encrypt)
+{
+    struct block_device *device = __device();
+    job->cipher = device->cipher_ops;
+    job->cipher->derive_key(aes_key, job->key);
+    job->block_size = device->block_size;
+    job->encrypt = encrypt;
+    job->blocks = nb_blocks <= CRYPTO_BATCH_BLOCKS
+        ? job->small_blocks
+        : xcalloc(nb_blocks, sizeof(struct block_cipher_request));
+    job->nb_blocks = 0;
+}
+
+/**
+ * @brief Add contiguous blocks to a job.
+ *
+ * @param job The job.
+ * @param start_block The number of the first block.
+ * @param nb_blocks The number of blocks.
+ * @param src The blocks to encrypt/decrypt.
+ * @param dst The buffer to fill with the encrypted/decrypted blocks (can be
+ * `src`).
+ */
+static void __crypto_job_add(struct block_crypto_job *job, block_t start_block,
+                             size_t nb_blocks, const void *src, void *dst)
+{
+    for (size_t i = 0; i < nb_blocks; i++)
     {
-        print_error("fseek '%s' failed: %s\n", DEVICE_PATH, strerror(errno));
-        return BLOCK_ERROR;
+        job->blocks[job->nb_blocks++] = (struct block_cipher_request){
+            .block = start_block + i,
+            .src = (const unsigned char *)src + i * job->block_size,
+            .dst = (unsigned char *)dst + i * job->block_size,
+        };
+    }
+}
+
+/**
+ * @brief Encrypt or decrypt the batch `index` of a job (thread_pool_task_t).
+ *
+ * @param arg The struct block_crypto_job.
+ * @param index The index of the batch (of CRYPTO_BATCH_BLOCKS blocks) in the
+ * job.
+ * @return 0 on success, -1 on error.
+ */
+static int __crypto_batch_task(void *arg, size_t index)
+{
+    struct block_crypto_job *job = arg;
+    size_t first = index * CRYPTO_BATCH_BLOCKS;
+    size_t nb_blocks = job->nb_blocks - first < CRYPTO_BATCH_BLOCKS
+        ? job->nb_blocks - first
+        : CRYPTO_BATCH_BLOCKS;
+    return job->cipher->crypt(job->key, job->blocks + first, nb_blocks,
+                              job->block_size, job->encrypt);
+}
+
+/**
+ * @brief Encrypt or decrypt all the blocks of a job, and release it.
+ *
+ * @note The blocks are independent: above PARALLEL_CRYPTO_THRESHOLD_BYTES,
+ * their batches are spread on the thread pool. Below, they are processed on
+ * the calling thread as a single batch, avoiding the hand-off cost for small
+ * requests.
+ *
+ * @param job The job.
+ * @return 0 on success, -1 on error.
+ */
+static int __crypto_job_run(struct block_crypto_job *job)
+{
+    int res = 0;
+    if (job->nb_blocks * job->block_size >= PARALLEL_CRYPTO_THRESHOLD_BYTES)
+        res = thread_pool_parallel_for(__crypto_batch_task, job,
+                                       (job->nb_blocks + CRYPTO_BATCH_BLOCKS
+                                        - 1)
+                                           / CRYPTO_BATCH_BLOCKS);
+    else if (job->nb_blocks > 0)
+        res = job->cipher->crypt(job->key, job->blocks, job->nb_blocks,
+                                 job->block_size, job->encrypt);
+
+    if (job->blocks != job->small_blocks)
+        free(job->blocks);
+    return res;
+}
+
+/**
+ * @brief Encrypt or decrypt contiguous blocks of the device used by the
+ * calling thread.
+ *
+ * @param aes_key The AES key.
+ * @param start_block The number of the first block.
+ * @param nb_blocks The number of blocks.
+ * @param src The blocks to encrypt/decrypt.
+ * @param dst The buffer to fill with the encrypted/decrypted blocks.
+ * @param encrypt true to encrypt, false to decrypt.
+ * @return 0 on success, -1 on error.
+ */
+static int __crypt_blocks(const unsigned char *aes_key, block_t start_block,
+                          size_t nb_blocks, const void *src, void *dst,
+                          bool encrypt)
+{
+    struct block_crypto_job job;
+    __crypto_job_init(&job, aes_key, nb_blocks, encrypt);
+    __crypto_job_add(&job, start_block, nb_blocks, src, dst);
+    return __crypto_job_run(&job);
+}
+
+/**
+ * @brief Pipelined transfer: the chunks go through a ring of PIPELINE_DEPTH
+ * slots between a producer and a consumer running concurrently.
+ *
+ * @details Reading: the I/O thread reads the chunk k + 1 while the calling
+ * thread decrypts the chunk k. Writing: the calling thread encrypts the chunk
+ * k + 1 while the I/O thread writes the chunk k.
+ */
+struct block_pipeline
+{
+    pthread_mutex_t lock; // Protects `produced`, `consumed` and `error`
+    pthread_cond_t cond; // Signaled when a slot is produced or consumed
+    unsigned char *slots; // PIPELINE_DEPTH chunks of ciphertext
+    size_t produced; // Number of chunks put in the ring
+    size_t consumed; // Number of chunks taken out of the ring
+    int error; // 1 if the producer or the consumer failed
+    struct block_device *device; // The device of the transfer
+    block_t start_block; // First block of the transfer
+    size_t nb_blocks; // Number of blocks of the transfer
+    size_t chunk_blocks; // Number of blocks in a (full) chunk
+    size_t nb_chunks; // Number of chunks of the transfer
+};
+
+/**
+ * @brief Get the first block and the number of blocks of a chunk.
+ *
+ * @param pipeline The pipeline.
+ * @param chunk The index of the chunk.
+ * @param first The index of the first block of the chunk, relative to the
+ * start of the transfer (returned).
+ * @return size_t The number of blocks of the chunk.
+ */
+static size_t __pipeline_chunk(const struct block_pipeline *pipeline,
+                               size_t chunk, size_t *first)
+{
+    *first = chunk * pipeline->chunk_blocks;
+    size_t left = pipeline->nb_blocks - *first;
+    return left < pipeline->chunk_blocks ? left : pipeline->chunk_blocks;
+}
+
+/**
+ * @brief Get the slot of a chunk.
+ *
+ * @param pipeline The pipeline.
+ * @param chunk The index of the chunk.
+ * @return unsigned char* The slot buffer.
+ */
+static unsigned char *__pipeline_slot(const struct block_pipeline *pipeline,
+                                      size_t chunk)
+{
+    return pipeline->slots
+        + (chunk % PIPELINE_DEPTH) * pipeline->chunk_blocks
+        * pipeline->device->block_size;
+}
+
+/**
+ * @brief Wait for a free slot to produce the next chunk.
+ *
+ * @param pipeline The pipeline.
+ * @return 0 when a slot is free, -1 if the pipeline failed.
+ */
+static int __pipeline_wait_free_slot(struct block_pipeline *pipeline)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->error
+           && pipeline->produced - pipeline->consumed == PIPELINE_DEPTH)
+        pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+    int res = pipeline->error ? -1 : 0;
+    pthread_mutex_unlock(&pipeline->lock);
+    return res;
+}
+
+/**
+ * @brief Wait for a produced chunk to consume it.
+ *
+ * @param pipeline The pipeline.
+ * @return 0 when a chunk is available, -1 if the pipeline failed.
+ */
+static int __pipeline_wait_produced_slot(struct block_pipeline *pipeline)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->error && pipeline->produced == pipeline->consumed)
+        pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+    int res = pipeline->error ? -1 : 0;
+    pthread_mutex_unlock(&pipeline->lock);
+    return res;
+}
+
+/**
+ * @brief Publish the end of the production/consumption of a chunk, or an
+ * error.
+ *
+ * @param pipeline The pipeline.
+ * @param counter &pipeline->produced or &pipeline->consumed.
+ * @param error true if the chunk could not be produced/consumed.
+ */
+static void __pipeline_signal(struct block_pipeline *pipeline, size_t *counter,
+                              bool error)
+{
+    pthread_mutex_lock(&pipeline->lock);
+    if (error)
+        pipeline->error = 1;
+    else
+        (*counter)++;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+/**
+ * @brief I/O thread of a pipelined read: reads the chunks into the ring.
+ *
+ * @param arg The struct block_pipeline.
+ * @return NULL.
+ */
+static void *__pipeline_reader(void *arg)
+{
+    struct block_pipeline *pipeline = arg;
+    block_device_use(pipeline->device);
+
+    for (size_t chunk = 0; chunk < pipeline->nb_chunks; chunk++)
+    {
+        if (__pipeline_wait_free_slot(pipeline))
+            break;
+
+        size_t first = 0;
+        size_t nb = __pipeline_chunk(pipeline, chunk, &first);
+        bool error =
+            read_blocks(pipeline->start_block + first, nb,
+                        __pipeline_slot(pipeline, chunk))
+            != 0;
+        __pipeline_signal(pipeline, &pipeline->produced, error);
+        if (error)
+            break;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief I/O thread of a pipelined write: writes the chunks of the ring.
+ *
+ * @param arg The struct block_pipeline.
+ * @return NULL.
+ */
+static void *__pipeline_writer(void *arg)
+{
+    struct block_pipeline *pipeline = arg;
+    block_device_use(pipeline->device);
+
+    for (size_t chunk = 0; chunk < pipeline->nb_chunks; chunk++)
+    {
+        if (__pipeline_wait_produced_slot(pipeline))
+            break;
+
+        size_t first = 0;
+        size_t nb = __pipeline_chunk(pipeline, chunk, &first);
+        bool error =
+            write_blocks(pipeline->start_block + first, nb,
+                         __pipeline_slot(pipeline, chunk))
+            != 0;
+        __pipeline_signal(pipeline, &pipeline->consumed, error);
+        if (error)
+            break;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief The I/O thread of the pipelined transfers. It is started on the first
+ * transfer and kept for the next ones; a single transfer uses it at a time.
+ */
+static struct
+{
+    bool started; // true if the thread is running
+    bool busy; // true while a transfer owns the thread
+    bool done; // true when the routine of the transfer returned
+    void *(*routine)(void *); // Routine to run, NULL if none is pending
+    struct block_pipeline *pipeline; // Argument of `routine`
+    pthread_t thread; // The thread
+    pthread_mutex_t lock; // Protects the fields above
+    pthread_cond_t cond; // Signaled when a routine is submitted or returns
+} io_thread = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/**
+ * @brief Main function of the I/O thread: runs the submitted routines.
+ *
+ * @param arg Unused.
+ * @return NULL (never returns).
+ */
+static void *__io_thread_main(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&io_thread.lock);
+    for (;;)
+    {
+        while (io_thread.routine == NULL)
+            pthread_cond_wait(&io_thread.cond, &io_thread.lock);
+        void *(*routine)(void *) = io_thread.routine;
+        struct block_pipeline *pipeline = io_thread.pipeline;
+        pthread_mutex_unlock(&io_thread.lock);
+
+        routine(pipeline);
+        // The device of the transfer may be closed once it is over
+        block_device_use(NULL);
+
+        pthread_mutex_lock(&io_thread.lock);
+        io_thread.routine = NULL;
+        io_thread.pipeline = NULL;
+        io_thread.done = true;
+        pthread_cond_broadcast(&io_thread.cond);
     }
 
-    size_t written = 0;
-    while (written < nb_blocks)
+    return NULL;
+}
+
+/**
+ * @brief Take the I/O thread for a transfer, starting it if needed.
+ *
+ * @return true if the calling thread owns the I/O thread, false if another
+ * transfer uses it or if it could not be started.
+ */
+static bool __io_thread_acquire(void)
+{
+    pthread_mutex_lock(&io_thread.lock);
+    if (io_thread.busy)
     {
-        size_t n = fwrite(buffer + written * CRYPTFS_BLOCK_SIZE_BYTES,
-                          CRYPTFS_BLOCK_SIZE_BYTES, nb_blocks - written, file);
-        if (n == 0)
+        pthread_mutex_unlock(&io_thread.lock);
+        return false;
+    }
+
+    if (!io_thread.started)
+    {
+        int res =
+            pthread_create(&io_thread.thread, NULL, __io_thread_main, NULL);
+        if (res != 0)
         {
-            print_error("Fail to write '%lu' blocks, starting at block '%lu' "
-                        "to '%s': %s\n",
-                        start_block, nb_blocks, DEVICE_PATH, strerror(errno));
-            return BLOCK_ERROR;
+            pthread_mutex_unlock(&io_thread.lock);
+            print_error("Failed to start the I/O thread: %s\n",
+                        strerror(res));
+            return false;
         }
+        pthread_detach(io_thread.thread);
+        io_thread.started = true;
+    }
+
+    io_thread.busy = true;
+    pthread_mutex_unlock(&io_thread.lock);
+    return true;
+}
+
+/**
+ * @brief Run a routine of a transfer on the (acquired) I/O thread.
+ *
+ * @param routine __pipeline_reader or __pipeline_writer.
+ * @param pipeline The pipeline of the transfer.
+ */
+static void __io_thread_submit(void *(*routine)(void *),
+                               struct block_pipeline *pipeline)
+{
+    pthread_mutex_lock(&io_thread.lock);
+    io_thread.routine = routine;
+    io_thread.pipeline = pipeline;
+    io_thread.done = false;
+    pthread_cond_broadcast(&io_thread.cond);
+    pthread_mutex_unlock(&io_thread.lock);
+}
+
+/**
+ * @brief Wait for the end of the submitted routine and release the I/O
+ * thread.
+ */
+static void __io_thread_release(void)
+{
+    pthread_mutex_lock(&io_thread.lock);
+    while (!io_thread.done)
+        pthread_cond_wait(&io_thread.cond, &io_thread.lock);
+    io_thread.busy = false;
+    pthread_mutex_unlock(&io_thread.lock);
+}
+
+/**
+ * @brief Read and decrypt (or encrypt and write) a large transfer, overlapping
+ * the I/O of a chunk with the decryption/encryption of another one. The
+ * calling thread must own the I/O thread (see __io_thread_acquire), which is
+ * released on return.
+ *
+ * @param aes_key The AES key to use for decryption/encryption.
+ * @param start_block The first block to read/write.
+ * @param nb_blocks The number of blocks to read/write.
+ * @param buffer The buffer of plaintext blocks (filled when reading).
+ * @param writing true for a pipelined write, false for a pipelined read.
+ * @return int 0 on success, -1 on error.
+ */
+static int __pipelined_transfer(const unsigned char *aes_key,
+                                block_t start_block, size_t nb_blocks,
+                                void *buffer, bool writing)
+{
+    struct block_device *device = __opened_device();
+    size_t chunk_blocks = PIPELINE_CHUNK_BYTES / device->block_size;
+    struct block_pipeline pipeline = {
+        .slots = xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                                PIPELINE_DEPTH * chunk_blocks,
+                                device->block_size),
+        .device = device,
+        .start_block = start_block,
+        .nb_blocks = nb_blocks,
+        .chunk_blocks = chunk_blocks,
+        .nb_chunks = (nb_blocks + chunk_blocks - 1) / chunk_blocks,
+    };
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.cond, NULL);
+
+    __io_thread_submit(writing ? __pipeline_writer : __pipeline_reader,
+                       &pipeline);
+
+    // The calling thread encrypts (producer) or decrypts (consumer) chunks
+    for (size_t chunk = 0; chunk < pipeline.nb_chunks; chunk++)
+    {
+        int wait_res = writing ? __pipeline_wait_free_slot(&pipeline)
+                               : __pipeline_wait_produced_slot(&pipeline);
+        if (wait_res)
+            break;
 
-        written += n;
+        size_t first = 0;
+        size_t nb = __pipeline_chunk(&pipeline, chunk, &first);
+        unsigned char *plain =
+            (unsigned char *)buffer + first * device->block_size;
+        bool error =
+            __crypt_blocks(aes_key, start_block + first, nb,
+                           writing ? plain : __pipeline_slot(&pipeline, chunk),
+                           writing ? __pipeline_slot(&pipeline, chunk) : plain,
+                           writing)
+            != 0;
+        __pipeline_signal(&pipeline,
+                          writing ? &pipeline.produced : &pipeline.consumed,
+                          error);
     }
 
-    if (fclose(file) == -1)
-        return BLOCK_ERROR;
+    __io_thread_release();
 
-    return 0;
+    int res = pipeline.error ? -1 : 0;
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.cond);
+    free(pipeline.slots);
+    return res;
 }
 
 int read_blocks_with_decryption(const unsigned char *aes_key,
                                 block_t start_block, size_t nb_blocks,
                                 void *buffer)
 {
+    struct block_device *device = __opened_device();
+
+    // Decrypt straight out of the device held in memory
+    unsigned char *mapped = device->backend->map != NULL
+        ? device->backend->map(device->handle,
+                               start_block * device->block_size,
+                               nb_blocks * device->block_size, false)
+        : NULL;
+    if (mapped != NULL)
+    {
+        int res = __crypt_blocks(aes_key, start_block, nb_blocks, mapped,
+                                 buffer, false);
+        device->backend->unmap(device->handle);
+        return res;
+    }
+
+    // Concurrent large transfers are not pipelined: only one owns the I/O
+    // thread, the others already overlap with it
+    if (nb_blocks * device->block_size >= PIPELINE_THRESHOLD_BYTES
+        && __io_thread_acquire())
+        return __pipelined_transfer(aes_key, start_block, nb_blocks, buffer,
+                                    false);
+
     unsigned char *encrypted_buffer =
-        xmalloc(nb_blocks, CRYPTFS_BLOCK_SIZE_BYTES);
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, nb_blocks, device->block_size);
     int read_blocks_res = read_blocks(start_block, nb_blocks, encrypted_buffer);
 
     if (read_blocks_res < 0)
@@ -157,53 +1197,51 @@ int read_blocks_with_decryption(const unsigned char *aes_key,
         return read_blocks_res;
     }
 
-    unsigned char *decrypted_buffer = buffer;
-    for (size_t i = 0; i < nb_blocks; i++)
-    {
-        size_t useless_size = 0;
-        unsigned char *decrypted_block = aes_decrypt_data(
-            aes_key, encrypted_buffer + i * CRYPTFS_BLOCK_SIZE_BYTES,
-            CRYPTFS_BLOCK_SIZE_BYTES, &useless_size);
-
-        if (decrypted_block == NULL)
-        {
-            free(encrypted_buffer);
-            return -1;
-        }
-
-        memcpy(decrypted_buffer + i * CRYPTFS_BLOCK_SIZE_BYTES, decrypted_block,
-               CRYPTFS_BLOCK_SIZE_BYTES);
-        free(decrypted_block);
-    }
+    int res = __crypt_blocks(aes_key, start_block, nb_blocks,
+                             encrypted_buffer, buffer, false);
 
     free(encrypted_buffer);
-    return 0;
+    return res;
 }
 
 int write_blocks_with_encryption(const unsigned char *aes_key,
                                  block_t start_block, size_t nb_blocks,
                                  const void *buffer)
 {
-    unsigned char *encrypted_buffer =
-        xmalloc(nb_blocks, CRYPTFS_BLOCK_SIZE_BYTES);
+    struct block_device *device = __opened_device();
 
-    const unsigned char *unencrypted_buffer = buffer;
-    for (size_t i = 0; i < nb_blocks; i++)
+    // Encrypt straight into the device held in memory
+    if (device->backend->map != NULL)
     {
-        size_t useless_size = 0;
-        unsigned char *encrypted_block = aes_encrypt_data(
-            aes_key, unencrypted_buffer + i * CRYPTFS_BLOCK_SIZE_BYTES,
-            CRYPTFS_BLOCK_SIZE_BYTES, &useless_size);
-
-        if (encrypted_block == NULL)
-        {
-            free(encrypted_buffer);
+        cbt_mark(device->cbt, start_block * device->block_size,
+                 nb_blocks * device->block_size);
+        unsigned char *mapped = device->backend->map(
+            device->handle, start_block * device->block_size,
+            nb_blocks * device->block_size, true);
+        if (mapped == NULL)
             return -1;
-        }
 
-        memcpy(encrypted_buffer + i * CRYPTFS_BLOCK_SIZE_BYTES, encrypted_block,
-               CRYPTFS_BLOCK_SIZE_BYTES);
-        free(encrypted_block);
+        int res = __crypt_blocks(aes_key, start_block, nb_blocks, buffer,
+                                 mapped, true);
+        device->backend->unmap(device->handle);
+        return res;
+    }
+
+    // Concurrent large transfers are not pipelined: only one owns the I/O
+    // thread, the others already overlap with it
+    if (nb_blocks * device->block_size >= PIPELINE_THRESHOLD_BYTES
+        && __io_thread_acquire())
+        return __pipelined_transfer(aes_key, start_block, nb_blocks,
+                                    (void *)buffer, true);
+
+    unsigned char *encrypted_buffer =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, nb_blocks, device->block_size);
+
+    if (__crypt_blocks(aes_key, start_block, nb_blocks, buffer,
+                       encrypted_buffer, true))
+    {
+        free(encrypted_buffer);
+        return -1;
     }
 
     int write_blocks_res =
@@ -212,3 +1250,222 @@ int write_blocks_with_encryption(const unsigned char *aes_key,
     free(encrypted_buffer);
     return write_blocks_res;
 }
+
+/**
+ * @brief Get the total number of blocks of a batch.
+ *
+ * @param requests The requests.
+ * @param nb_requests The number of requests.
+ * @return size_t The sum of the number of blocks of the requests.
+ */
+static size_t __batch_nb_blocks(const struct block_request *requests,
+                                size_t nb_requests)
+{
+    size_t nb_blocks = 0;
+    for (size_t i = 0; i < nb_requests; i++)
+        nb_blocks += requests[i].nb_blocks;
+    return nb_blocks;
+}
+
+/**
+ * @brief Check if the requests of a batch are staged together: read (or
+ * written) with a single batch, and decrypted (or encrypted) with a single
+ * job, whose batches of blocks span the requests.
+ *
+ * @details Without a backend having the whole batch in flight, the large
+ * requests are still better pipelined one by one, and the mapped ones
+ * decrypted (or encrypted) in place.
+ *
+ * @param requests The requests.
+ * @param nb_requests The number of requests.
+ * @return true if the batch is staged, false if its requests are processed
+ * one by one.
+ */
+static bool __batch_is_staged(const struct block_request *requests,
+                              size_t nb_requests)
+{
+    struct block_device *device = __device();
+    if (__backend_submits_batches())
+        return true;
+    if (device->backend->map != NULL)
+        return false;
+
+    for (size_t i = 0; i < nb_requests; i++)
+        if (requests[i].nb_blocks * device->block_size
+            >= PIPELINE_THRESHOLD_BYTES)
+            return false;
+    return true;
+}
+
+/**
+ * @brief Allocate the ciphertexts of the requests of a batch (in a single
+ * buffer).
+ *
+ * @param requests The requests.
+ * @param nb_requests The number of requests.
+ * @param encrypted_buffer The buffer of the ciphertexts (returned, to free).
+ * @return struct block_request* The requests on the ciphertexts (to free).
+ */
+static struct block_request *
+__batch_encrypted_requests(const struct block_request *requests,
+                           size_t nb_requests, unsigned char **encrypted_buffer)
+{
+    struct block_device *device = __device();
+    *encrypted_buffer =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                       __batch_nb_blocks(requests, nb_requests),
+                       device->block_size);
+    struct block_request *encrypted_requests =
+        xcalloc(nb_requests, sizeof(struct block_request));
+    size_t offset = 0;
+    for (size_t i = 0; i < nb_requests; i++)
+    {
+        encrypted_requests[i] = requests[i];
+        encrypted_requests[i].buffer = *encrypted_buffer + offset;
+        offset += requests[i].nb_blocks * device->block_size;
+    }
+    return encrypted_requests;
+}
+
+/**
+ * @brief Encrypt or decrypt the blocks of a batch with a single job.
+ *
+ * @param aes_key The AES key.
+ * @param src The requests on the blocks to encrypt/decrypt.
+ * @param dst The requests on the encrypted/decrypted blocks (same blocks as
+ * `src`, can be `src`).
+ * @param nb_requests The number of requests.
+ * @param encrypt true to encrypt, false to decrypt.
+ * @return int 0 on success, -1 on error.
+ */
+static int __crypt_batch(const unsigned char *aes_key,
+                         const struct block_request *src,
+                         const struct block_request *dst, size_t nb_requests,
+                         bool encrypt)
+{
+    struct block_crypto_job job;
+    __crypto_job_init(&job, aes_key, __batch_nb_blocks(src, nb_requests),
+                      encrypt);
+    for (size_t i = 0; i < nb_requests; i++)
+        __crypto_job_add(&job, src[i].start_block, src[i].nb_blocks,
+                         src[i].buffer, dst[i].buffer);
+    return __crypto_job_run(&job);
+}
+
+int read_blocks_batch_with_decryption(const unsigned char *aes_key,
+                                      const struct block_request *requests,
+                                      size_t nb_requests)
+{
+    if (!__batch_is_staged(requests, nb_requests))
+    {
+        for (size_t i = 0; i < nb_requests; i++)
+            if (read_blocks_with_decryption(aes_key, requests[i].start_block,
+                                            requests[i].nb_blocks,
+                                            requests[i].buffer))
+                return -1;
+        return 0;
+    }
+
+    // Read all the ciphertexts with a single batch, then decrypt them
+    unsigned char *encrypted_buffer = NULL;
+    struct block_request *encrypted_requests =
+        __batch_encrypted_requests(requests, nb_requests, &encrypted_buffer);
+    int res = read_blocks_batch(encrypted_requests, nb_requests) ? -1 : 0;
+    if (res == 0)
+        res = __crypt_batch(aes_key, encrypted_requests, requests, nb_requests,
+                            false);
+
+    free(encrypted_requests);
+    free(encrypted_buffer);
+    return res;
+}
+
+int write_blocks_batch_with_encryption(const unsigned char *aes_key,
+                                       const struct block_request *requests,
+                                       size_t nb_requests)
+{
+    if (!__batch_is_staged(requests, nb_requests))
+    {
+        for (size_t i = 0; i < nb_requests; i++)
+            if (write_blocks_with_encryption(aes_key, requests[i].start_block,
+                                             requests[i].nb_blocks,
+                                             requests[i].buffer))
+                return -1;
+        return 0;
+    }
+
+    // Encrypt all the blocks, then write them with a single batch
+    unsigned char *encrypted_buffer = NULL;
+    struct block_request *encrypted_requests =
+        __batch_encrypted_requests(requests, nb_requests, &encrypted_buffer);
+    int res =
+        __crypt_batch(aes_key, requests, encrypted_requests, nb_requests, true);
+    if (res == 0 && write_blocks_batch(encrypted_requests, nb_requests))
+        res = -1;
+
+    free(encrypted_requests);
+    free(encrypted_buffer);
+    return res;
+}
+
+int decrypt_blocks_batch(const unsigned char *aes_key,
+                         const struct block_request *requests,
+                         size_t nb_requests)
+{
+    return __crypt_batch(aes_key, requests, requests, nb_requests, false);
+}
+
+int encrypt_blocks_batch(const unsigned char *aes_key,
+                         const struct block_request *requests,
+                         size_t nb_requests)
+{
+    return __crypt_batch(aes_key, requests, requests, nb_requests, true);
+}
+
+/**
+ * @brief Encrypt or decrypt blocks given by their numbers.
+ *
+ * @param aes_key The AES key.
+ * @param blocks The number of each block.
+ * @param src The blocks to encrypt/decrypt.
+ * @param dst The buffer to fill with the encrypted/decrypted blocks.
+ * @param nb_blocks The number of blocks.
+ * @param encrypt true to encrypt, false to decrypt.
+ * @return int 0 on success, -1 on error.
+ */
+static int __crypt_numbered_blocks(const unsigned char *aes_key,
+                                   const block_t *blocks, const void *src,
+                                   void *dst, size_t nb_blocks, bool encrypt)
+{
+    struct block_crypto_job job;
+    __crypto_job_init(&job, aes_key, nb_blocks, encrypt);
+    for (size_t i = 0; i < nb_blocks; i++)
+        __crypto_job_add(&job, blocks[i], 1,
+                         (const unsigned char *)src + i * job.block_size,
+                         (unsigned char *)dst + i * job.block_size);
+    return __crypto_job_run(&job);
+}
+
+int decrypt_blocks(const unsigned char *aes_key, const block_t *blocks,
+                   const void *encrypted, void *decrypted, size_t nb_blocks)
+{
+    return __crypt_numbered_blocks(aes_key, blocks, encrypted, decrypted,
+                                   nb_blocks, false);
+}
+
+int encrypt_blocks(const unsigned char *aes_key, const block_t *blocks,
+                   const void *decrypted, void *encrypted, size_t nb_blocks)
+{
+    return __crypt_numbered_blocks(aes_key, blocks, decrypted, encrypted,
+                                   nb_blocks, true);
+}
+
+int decrypt_block_head(const unsigned char *aes_key, block_t block,
+                       const void *encrypted, void *decrypted, size_t size)
+{
+    struct block_crypto_job job;
+    __crypto_job_init(&job, aes_key, 1, false);
+    job.block_size = size;
+    __crypto_job_add(&job, block, 1, encrypted, decrypted);
+    return __crypto_job_run(&job);
+}
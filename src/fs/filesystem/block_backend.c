@@ -0,0 +1,65 @@
+#define _GNU_SOURCE // fallocate
+
+#include "block_backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cryptfs.h"
+#include "print.h"
+
+int block_backend_discard_fd(int fd, const char *path, off_t offset,
+                             size_t size)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        print_error("fstat '%s' failed: %s\n", path, strerror(errno));
+        return BLOCK_ERROR;
+    }
+
+    uint64_t range[2] = { offset, size };
+    int res;
+    if (S_ISBLK(st.st_mode))
+        res = ioctl(fd, BLKDISCARD, &range);
+    else
+        res = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                        range[0], range[1]);
+
+    if (res == -1)
+    {
+        // Discarding is only a hint: a device or a filesystem which does not
+        // support it keeps working, the freed blocks are just not trimmed.
+        if (errno == EOPNOTSUPP || errno == ENOTTY)
+            print_debug("Discard is not supported by '%s'\n", path);
+        else
+        {
+            print_error("Fail to discard '%lu' bytes, starting at offset "
+                        "'%lu' on '%s': %s\n",
+                        size, offset, path, strerror(errno));
+            return BLOCK_ERROR;
+        }
+    }
+
+    return 0;
+}
+
+size_t block_backend_size_fd(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        return 0;
+
+    uint64_t size = st.st_size;
+    if (S_ISBLK(st.st_mode) && ioctl(fd, BLKGETSIZE64, &size) == -1)
+        return 0;
+
+    return size;
+}
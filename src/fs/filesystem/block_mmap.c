@@ -0,0 +1,271 @@
+#define _GNU_SOURCE // mremap
+
+#include "block_backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cryptfs.h"
+#include "print.h"
+#include "xalloc.h"
+
+/**
+ * @brief An image file mapped in memory by the mmap backend.
+ */
+struct mmap_device
+{
+    unsigned char *data; // The mapping
+    size_t size; // Size of the mapping (size of the image file)
+    int fd; // File descriptor of the image file
+    char *path; // Path of the image file
+    pthread_rwlock_t lock; // Write-locked to move (grow) the mapping
+};
+
+/**
+ * @brief Map an image file in memory (shared mapping).
+ *
+ * @param path The path of the image file.
+ * @param direct_io Ignored (the mapping goes through the page cache).
+ * @return void* The struct mmap_device, NULL if the device is not an image
+ * file or cannot be mapped.
+ */
+static void *__mmap_open(const char *path, bool direct_io)
+{
+    (void)direct_io;
+    int fd = open(path, O_RDWR);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        print_error("The device '%s' must be an image file to be mapped in "
+                    "memory\n",
+                    path);
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+    if (data == MAP_FAILED)
+    {
+        print_error("mmap '%s' failed: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    struct mmap_device *device = xcalloc(1, sizeof(struct mmap_device));
+    device->data = data;
+    device->size = st.st_size;
+    device->fd = fd;
+    device->path = strdup(path);
+    pthread_rwlock_init(&device->lock, NULL);
+    return device;
+}
+
+static void __mmap_close(void *handle)
+{
+    struct mmap_device *device = handle;
+    munmap(device->data, device->size);
+    close(device->fd);
+    pthread_rwlock_destroy(&device->lock);
+    free(device->path);
+    free(device);
+}
+
+/**
+ * @brief Grow the image file and the mapping up to `size` bytes. The mapping
+ * also follows the image file if it was grown through another handle (e.g.
+ * another device opened on the same image file).
+ *
+ * @param device The device.
+ * @param size The new minimal size of the mapping (0 to only follow the
+ * image file).
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+static int __mmap_grow(struct mmap_device *device, size_t size)
+{
+    pthread_rwlock_wrlock(&device->lock);
+
+    struct stat st;
+    if (fstat(device->fd, &st) == -1)
+    {
+        print_error("fstat '%s' failed: %s\n", device->path, strerror(errno));
+        pthread_rwlock_unlock(&device->lock);
+        return BLOCK_ERROR;
+    }
+    size_t file_size = st.st_size;
+    size_t new_size = size > file_size ? size : file_size;
+    if (new_size <= device->size)
+    {
+        pthread_rwlock_unlock(&device->lock);
+        return 0; // Already grown by another thread
+    }
+
+    // Never shrink the image file
+    if (new_size > file_size && ftruncate(device->fd, new_size) == -1)
+    {
+        print_error("ftruncate '%s' failed: %s\n", device->path,
+                    strerror(errno));
+        pthread_rwlock_unlock(&device->lock);
+        return BLOCK_ERROR;
+    }
+
+    void *data = mremap(device->data, device->size, new_size, MREMAP_MAYMOVE);
+    if (data == MAP_FAILED)
+    {
+        print_error("mremap '%s' failed: %s\n", device->path, strerror(errno));
+        pthread_rwlock_unlock(&device->lock);
+        return BLOCK_ERROR;
+    }
+
+    device->data = data;
+    device->size = new_size;
+    pthread_rwlock_unlock(&device->lock);
+    return 0;
+}
+
+static unsigned char *__mmap_map(void *handle, off_t offset, size_t size,
+                                 bool writing)
+{
+    struct mmap_device *device = handle;
+
+    pthread_rwlock_rdlock(&device->lock);
+    if (offset + size <= device->size)
+        return device->data + offset;
+    pthread_rwlock_unlock(&device->lock);
+
+    if (__mmap_grow(device, writing ? offset + size : 0))
+        return NULL;
+
+    pthread_rwlock_rdlock(&device->lock);
+    if (offset + size > device->size)
+    {
+        pthread_rwlock_unlock(&device->lock);
+        return NULL;
+    }
+
+    return device->data + offset;
+}
+
+static void __mmap_unmap(void *handle)
+{
+    struct mmap_device *device = handle;
+    pthread_rwlock_unlock(&device->lock);
+}
+
+static int __mmap_read(void *handle, off_t offset, size_t size, void *buffer)
+{
+    struct mmap_device *device = handle;
+
+    pthread_rwlock_rdlock(&device->lock);
+    if (offset + size > device->size)
+    {
+        pthread_rwlock_unlock(&device->lock);
+        if (__mmap_grow(device, 0))
+            return BLOCK_ERROR;
+        pthread_rwlock_rdlock(&device->lock);
+    }
+
+    // The blocks past the end of the image file were never written
+    size_t mapped = 0;
+    if ((size_t)offset < device->size)
+    {
+        mapped = device->size - offset < size ? device->size - offset : size;
+        memcpy(buffer, device->data + offset, mapped);
+    }
+    memset((unsigned char *)buffer + mapped, 0, size - mapped);
+
+    pthread_rwlock_unlock(&device->lock);
+    return 0;
+}
+
+static int __mmap_write(void *handle, off_t offset, size_t size,
+                        const void *buffer)
+{
+    unsigned char *data = __mmap_map(handle, offset, size, true);
+    if (data == NULL)
+        return BLOCK_ERROR;
+
+    memcpy(data, buffer, size);
+    __mmap_unmap(handle);
+    return 0;
+}
+
+static int __mmap_readv(void *handle, size_t block_size,
+                        const struct block_request *requests,
+                        size_t nb_requests)
+{
+    for (size_t i = 0; i < nb_requests; i++)
+        __mmap_read(handle, requests[i].start_block * block_size,
+                    requests[i].nb_blocks * block_size,
+                    requests[i].buffer);
+    return 0;
+}
+
+static int __mmap_writev(void *handle, size_t block_size,
+                         const struct block_request *requests,
+                         size_t nb_requests)
+{
+    for (size_t i = 0; i < nb_requests; i++)
+        if (__mmap_write(handle, requests[i].start_block * block_size,
+                         requests[i].nb_blocks * block_size,
+                         requests[i].buffer))
+            return BLOCK_ERROR;
+    return 0;
+}
+
+static int __mmap_flush(void *handle)
+{
+    struct mmap_device *device = handle;
+
+    pthread_rwlock_rdlock(&device->lock);
+    int res = 0;
+    if (msync(device->data, device->size, MS_SYNC) == -1)
+    {
+        print_error("msync '%s' failed: %s\n", device->path, strerror(errno));
+        res = BLOCK_ERROR;
+    }
+    pthread_rwlock_unlock(&device->lock);
+    return res;
+}
+
+static int __mmap_discard(void *handle, off_t offset, size_t size)
+{
+    struct mmap_device *device = handle;
+
+    // The mapping is shared: the hole is seen through it
+    return block_backend_discard_fd(device->fd, device->path, offset, size);
+}
+
+static size_t __mmap_size(void *handle)
+{
+    struct mmap_device *device = handle;
+
+    pthread_rwlock_rdlock(&device->lock);
+    size_t size = device->size;
+    pthread_rwlock_unlock(&device->lock);
+    return size;
+}
+
+const struct block_backend_ops block_backend_mmap = {
+    .name = "mmap",
+    .open = __mmap_open,
+    .close = __mmap_close,
+    .read = __mmap_read,
+    .write = __mmap_write,
+    .readv = __mmap_readv,
+    .writev = __mmap_writev,
+    .flush = __mmap_flush,
+    .discard = __mmap_discard,
+    .size = __mmap_size,
+    .map = __mmap_map,
+    .unmap = __mmap_unmap,
+};
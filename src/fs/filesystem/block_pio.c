@@ -0,0 +1,167 @@
+#define _GNU_SOURCE // O_DIRECT
+
+#include "block_backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cryptfs.h"
+#include "print.h"
+#include "xalloc.h"
+
+/**
+ * @brief A device opened by the pread/pwrite backend.
+ */
+struct pio_device
+{
+    int fd; // File descriptor of the device (O_DIRECT in direct I/O mode)
+    char *path; // Path of the device
+};
+
+/**
+ * @brief Open a device, and keep it open until __pio_close.
+ *
+ * @param path The path of the device.
+ * @param direct_io true to open the device with O_DIRECT.
+ * @return void* The struct pio_device, NULL on error.
+ */
+static void *__pio_open(const char *path, bool direct_io)
+{
+    int fd = open(path, O_RDWR | (direct_io ? O_DIRECT : 0));
+    if (fd == -1)
+        return NULL;
+
+    struct pio_device *device = xcalloc(1, sizeof(struct pio_device));
+    device->fd = fd;
+    device->path = strdup(path);
+    return device;
+}
+
+static void __pio_close(void *handle)
+{
+    struct pio_device *device = handle;
+    close(device->fd);
+    free(device->path);
+    free(device);
+}
+
+/**
+ * @brief Read or write bytes with pread/pwrite, until all of them are
+ * transferred.
+ *
+ * @note Reading past the end of an image file fills the buffer with zeros.
+ *
+ * @param device The device.
+ * @param offset The offset of the transfer.
+ * @param size The number of bytes to transfer.
+ * @param buffer The buffer to fill or to write.
+ * @param writing true to write the buffer, false to fill it.
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+static int __pio_transfer(struct pio_device *device, off_t offset,
+                          size_t size, unsigned char *buffer, bool writing)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = writing
+            ? pwrite(device->fd, buffer + done, size - done, offset + done)
+            : pread(device->fd, buffer + done, size - done, offset + done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == 0 && !writing)
+        {
+            // End of the image file: the blocks were never written
+            memset(buffer + done, 0, size - done);
+            break;
+        }
+        if (n <= 0)
+        {
+            print_error("Fail to %s '%lu' bytes, starting at offset '%lu' on "
+                        "'%s': %s\n",
+                        writing ? "write" : "read", size, offset,
+                        device->path, strerror(n == 0 ? EIO : errno));
+            return BLOCK_ERROR;
+        }
+
+        done += n;
+    }
+
+    return 0;
+}
+
+static int __pio_read(void *handle, off_t offset, size_t size, void *buffer)
+{
+    return __pio_transfer(handle, offset, size, buffer, false);
+}
+
+static int __pio_write(void *handle, off_t offset, size_t size,
+                       const void *buffer)
+{
+    return __pio_transfer(handle, offset, size, (void *)buffer, true);
+}
+
+static int __pio_readv(void *handle, size_t block_size,
+                       const struct block_request *requests,
+                       size_t nb_requests)
+{
+    for (size_t i = 0; i < nb_requests; i++)
+        if (__pio_read(handle, requests[i].start_block * block_size,
+                       requests[i].nb_blocks * block_size,
+                       requests[i].buffer))
+            return BLOCK_ERROR;
+    return 0;
+}
+
+static int __pio_writev(void *handle, size_t block_size,
+                        const struct block_request *requests,
+                        size_t nb_requests)
+{
+    for (size_t i = 0; i < nb_requests; i++)
+        if (__pio_write(handle, requests[i].start_block * block_size,
+                        requests[i].nb_blocks * block_size,
+                        requests[i].buffer))
+            return BLOCK_ERROR;
+    return 0;
+}
+
+static int __pio_flush(void *handle)
+{
+    struct pio_device *device = handle;
+    if (fsync(device->fd) == -1)
+    {
+        print_error("fsync '%s' failed: %s\n", device->path, strerror(errno));
+        return BLOCK_ERROR;
+    }
+    return 0;
+}
+
+static int __pio_discard(void *handle, off_t offset, size_t size)
+{
+    struct pio_device *device = handle;
+    return block_backend_discard_fd(device->fd, device->path, offset, size);
+}
+
+static size_t __pio_size(void *handle)
+{
+    struct pio_device *device = handle;
+    return block_backend_size_fd(device->fd);
+}
+
+const struct block_backend_ops block_backend_pio = {
+    .name = "pio",
+    .open = __pio_open,
+    .close = __pio_close,
+    .read = __pio_read,
+    .write = __pio_write,
+    .readv = __pio_readv,
+    .writev = __pio_writev,
+    .flush = __pio_flush,
+    .discard = __pio_discard,
+    .size = __pio_size,
+    .map = NULL,
+    .unmap = NULL,
+};
@@ -0,0 +1,275 @@
+#include "block_backend.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cryptfs.h"
+#include "print.h"
+#include "xalloc.h"
+
+/**
+ * @brief A device held in memory, identified by its name.
+ */
+struct ram_disk
+{
+    char *name; // Name of the RAM disk (device path)
+    unsigned char *data; // Content of the RAM disk
+    size_t size; // Size of the RAM disk in bytes
+    size_t refs; // Registry reference + open handles (protected by `disks`)
+    pthread_rwlock_t lock; // Write-locked to move (grow) the data
+    struct ram_disk *next; // Next RAM disk of the registry
+};
+
+// Registry of the RAM disks
+static struct
+{
+    struct ram_disk *head; // The RAM disks not destroyed yet
+    pthread_mutex_t lock; // Protects the registry and the references
+} disks = { .head = NULL, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief Find a RAM disk of the registry. `disks.lock` must be held.
+ *
+ * @param name The name of the RAM disk.
+ * @return struct ram_disk* The RAM disk, NULL if it does not exist.
+ */
+static struct ram_disk *__ram_find(const char *name)
+{
+    for (struct ram_disk *disk = disks.head; disk != NULL; disk = disk->next)
+        if (strcmp(disk->name, name) == 0)
+            return disk;
+    return NULL;
+}
+
+/**
+ * @brief Drop a reference to a RAM disk, and free it with the last one.
+ * `disks.lock` must be held.
+ *
+ * @param disk The RAM disk.
+ */
+static void __ram_unref(struct ram_disk *disk)
+{
+    if (--disk->refs > 0)
+        return;
+
+    pthread_rwlock_destroy(&disk->lock);
+    free(disk->data);
+    free(disk->name);
+    free(disk);
+}
+
+void ram_disk_create(const char *name, size_t size)
+{
+    pthread_mutex_lock(&disks.lock);
+
+    struct ram_disk *disk = __ram_find(name);
+    if (disk != NULL)
+    {
+        // Replaced in place: the open handles see the new (zeroed) content
+        pthread_rwlock_wrlock(&disk->lock);
+        free(disk->data);
+        disk->data = xcalloc(1, size ? size : 1);
+        disk->size = size;
+        pthread_rwlock_unlock(&disk->lock);
+        pthread_mutex_unlock(&disks.lock);
+        return;
+    }
+
+    disk = xcalloc(1, sizeof(struct ram_disk));
+    disk->name = strdup(name);
+    disk->data = xcalloc(1, size ? size : 1);
+    disk->size = size;
+    disk->refs = 1;
+    pthread_rwlock_init(&disk->lock, NULL);
+    disk->next = disks.head;
+    disks.head = disk;
+
+    pthread_mutex_unlock(&disks.lock);
+}
+
+void ram_disk_destroy(const char *name)
+{
+    pthread_mutex_lock(&disks.lock);
+
+    for (struct ram_disk **disk = &disks.head; *disk != NULL;
+         disk = &(*disk)->next)
+    {
+        if (strcmp((*disk)->name, name) != 0)
+            continue;
+
+        struct ram_disk *destroyed = *disk;
+        *disk = destroyed->next;
+        __ram_unref(destroyed); // Freed once the last handle is closed
+        break;
+    }
+
+    pthread_mutex_unlock(&disks.lock);
+}
+
+/**
+ * @brief Open a RAM disk.
+ *
+ * @param path The name of the RAM disk.
+ * @param direct_io Ignored (the RAM disk is in memory).
+ * @return void* The struct ram_disk, NULL if it does not exist.
+ */
+static void *__ram_open(const char *path, bool direct_io)
+{
+    (void)direct_io;
+    pthread_mutex_lock(&disks.lock);
+    struct ram_disk *disk = __ram_find(path);
+    if (disk != NULL)
+        disk->refs++;
+    pthread_mutex_unlock(&disks.lock);
+
+    return disk;
+}
+
+static void __ram_close(void *handle)
+{
+    pthread_mutex_lock(&disks.lock);
+    __ram_unref(handle);
+    pthread_mutex_unlock(&disks.lock);
+}
+
+/**
+ * @brief Grow a RAM disk up to `size` bytes (like an image file written past
+ * its end).
+ *
+ * @param disk The RAM disk.
+ * @param size The new minimal size of the RAM disk.
+ */
+static void __ram_grow(struct ram_disk *disk, size_t size)
+{
+    pthread_rwlock_wrlock(&disk->lock);
+    if (size > disk->size)
+    {
+        disk->data = xrealloc(disk->data, 1, size);
+        memset(disk->data + disk->size, 0, size - disk->size);
+        disk->size = size;
+    }
+    pthread_rwlock_unlock(&disk->lock);
+}
+
+static unsigned char *__ram_map(void *handle, off_t offset, size_t size,
+                                bool writing)
+{
+    struct ram_disk *disk = handle;
+
+    if (writing)
+        __ram_grow(disk, offset + size);
+
+    pthread_rwlock_rdlock(&disk->lock);
+    if (offset + size > disk->size)
+    {
+        pthread_rwlock_unlock(&disk->lock);
+        return NULL;
+    }
+
+    return disk->data + offset;
+}
+
+static void __ram_unmap(void *handle)
+{
+    struct ram_disk *disk = handle;
+    pthread_rwlock_unlock(&disk->lock);
+}
+
+static int __ram_read(void *handle, off_t offset, size_t size, void *buffer)
+{
+    struct ram_disk *disk = handle;
+
+    pthread_rwlock_rdlock(&disk->lock);
+
+    // The blocks past the end of the RAM disk were never written
+    size_t stored = 0;
+    if ((size_t)offset < disk->size)
+    {
+        stored = disk->size - offset < size ? disk->size - offset : size;
+        memcpy(buffer, disk->data + offset, stored);
+    }
+    memset((unsigned char *)buffer + stored, 0, size - stored);
+
+    pthread_rwlock_unlock(&disk->lock);
+    return 0;
+}
+
+static int __ram_write(void *handle, off_t offset, size_t size,
+                       const void *buffer)
+{
+    unsigned char *data = __ram_map(handle, offset, size, true);
+    if (data == NULL)
+        return BLOCK_ERROR;
+
+    memcpy(data, buffer, size);
+    __ram_unmap(handle);
+    return 0;
+}
+
+static int __ram_readv(void *handle, size_t block_size,
+                       const struct block_request *requests,
+                       size_t nb_requests)
+{
+    for (size_t i = 0; i < nb_requests; i++)
+        __ram_read(handle, requests[i].start_block * block_size,
+                   requests[i].nb_blocks * block_size,
+                   requests[i].buffer);
+    return 0;
+}
+
+static int __ram_writev(void *handle, size_t block_size,
+                        const struct block_request *requests,
+                        size_t nb_requests)
+{
+    for (size_t i = 0; i < nb_requests; i++)
+        if (__ram_write(handle, requests[i].start_block * block_size,
+                        requests[i].nb_blocks * block_size,
+                        requests[i].buffer))
+            return BLOCK_ERROR;
+    return 0;
+}
+
+static int __ram_flush(void *handle)
+{
+    (void)handle; // Nothing to make durable
+    return 0;
+}
+
+static int __ram_discard(void *handle, off_t offset, size_t size)
+{
+    struct ram_disk *disk = handle;
+
+    // A discarded range reads as zeros, like a hole punched in an image file
+    pthread_rwlock_rdlock(&disk->lock);
+    if ((size_t)offset < disk->size)
+        memset(disk->data + offset, 0,
+               disk->size - offset < size ? disk->size - offset : size);
+    pthread_rwlock_unlock(&disk->lock);
+    return 0;
+}
+
+static size_t __ram_size(void *handle)
+{
+    struct ram_disk *disk = handle;
+
+    pthread_rwlock_rdlock(&disk->lock);
+    size_t size = disk->size;
+    pthread_rwlock_unlock(&disk->lock);
+    return size;
+}
+
+const struct block_backend_ops block_backend_ram = {
+    .name = "ram",
+    .open = __ram_open,
+    .close = __ram_close,
+    .read = __ram_read,
+    .write = __ram_write,
+    .readv = __ram_readv,
+    .writev = __ram_writev,
+    .flush = __ram_flush,
+    .discard = __ram_discard,
+    .size = __ram_size,
+    .map = __ram_map,
+    .unmap = __ram_unmap,
+};
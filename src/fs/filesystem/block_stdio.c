@@ -0,0 +1,222 @@
+#include "block_backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cryptfs.h"
+#include "print.h"
+
+/**
+ * @brief Open a device with stdio (the device is opened again on each
+ * access).
+ *
+ * @param path The path of the device.
+ * @param direct_io Ignored (the device is not kept open).
+ * @return void* The handle (the path), NULL if the device cannot be opened.
+ */
+static void *__stdio_open(const char *path, bool direct_io)
+{
+    (void)direct_io;
+    FILE *file = fopen(path, "r+");
+    if (!file)
+        return NULL;
+    fclose(file);
+
+    return strdup(path);
+}
+
+static void __stdio_close(void *handle)
+{
+    free(handle);
+}
+
+static int __stdio_write(void *handle, off_t offset, size_t size,
+                         const void *buffer)
+{
+    const char *path = handle;
+
+    FILE *file = fopen(path, "r+");
+    if (!file)
+    {
+        print_error("fopen '%s' failed: %s\n", path, strerror(errno));
+        return BLOCK_ERROR;
+    }
+
+    if (fseek(file, offset, SEEK_SET) == -1)
+    {
+        print_error("fseek '%s' failed: %s\n", path, strerror(errno));
+        fclose(file);
+        return BLOCK_ERROR;
+    }
+
+    size_t written = 0;
+    while (written < size)
+    {
+        size_t n = fwrite((const char *)buffer + written, 1, size - written,
+                          file);
+        if (n == 0)
+        {
+            print_error("Fail to write '%lu' bytes, starting at offset '%lu' "
+                        "to '%s': %s\n",
+                        size, offset, path, strerror(errno));
+            fclose(file);
+            return BLOCK_ERROR;
+        }
+
+        written += n;
+    }
+
+    if (fclose(file) == -1)
+        return BLOCK_ERROR;
+
+    return 0;
+}
+
+static int __stdio_read(void *handle, off_t offset, size_t size, void *buffer)
+{
+    const char *path = handle;
+
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        error_exit("fopen '%s' failed: %s\n", EXIT_FAILURE, path,
+                   strerror(errno));
+        return BLOCK_ERROR;
+    }
+
+    if (fseek(file, offset, SEEK_SET) != 0)
+    {
+        print_error("fseek '%s' failed: %s\n", path, strerror(errno));
+        fclose(file);
+        return BLOCK_ERROR;
+    }
+
+    size_t read = 0;
+    while (read < size)
+    {
+        size_t n = fread((char *)buffer + read, 1, size - read, file);
+        if (n == 0)
+        {
+            // Glitch: if you can read at a non existing offset, try to right at
+            // this one, then try again
+            __stdio_write(handle, offset + read, size - read,
+                          (char *)buffer + read);
+            clearerr(file);
+            n = fread((char *)buffer + read, 1, size - read, file);
+
+            // If still cannot, this is a real error
+            if (n == 0)
+            {
+                print_error("Fail to read '%lu' bytes, starting at offset "
+                            "'%lu' from '%s': %s\n",
+                            size, offset, path, strerror(errno));
+                fclose(file);
+                return BLOCK_ERROR;
+            }
+        }
+
+        read += n;
+    }
+
+    if (fclose(file) != 0)
+        return BLOCK_ERROR;
+
+    return 0;
+}
+
+static int __stdio_readv(void *handle, size_t block_size,
+                         const struct block_request *requests,
+                         size_t nb_requests)
+{
+    for (size_t i = 0; i < nb_requests; i++)
+        if (__stdio_read(handle, requests[i].start_block * block_size,
+                         requests[i].nb_blocks * block_size,
+                         requests[i].buffer))
+            return BLOCK_ERROR;
+    return 0;
+}
+
+static int __stdio_writev(void *handle, size_t block_size,
+                          const struct block_request *requests,
+                          size_t nb_requests)
+{
+    for (size_t i = 0; i < nb_requests; i++)
+        if (__stdio_write(handle, requests[i].start_block * block_size,
+                          requests[i].nb_blocks * block_size,
+                          requests[i].buffer))
+            return BLOCK_ERROR;
+    return 0;
+}
+
+/**
+ * @brief Get a file descriptor on the device.
+ *
+ * @param path The path of the device.
+ * @return int The file descriptor, -1 on error.
+ */
+static int __stdio_open_fd(const char *path)
+{
+    int fd = open(path, O_RDWR);
+    if (fd == -1)
+        print_error("open '%s' failed: %s\n", path, strerror(errno));
+    return fd;
+}
+
+static int __stdio_flush(void *handle)
+{
+    int fd = __stdio_open_fd(handle);
+    if (fd == -1)
+        return BLOCK_ERROR;
+
+    int res = 0;
+    if (fsync(fd) == -1)
+    {
+        print_error("fsync '%s' failed: %s\n", (const char *)handle,
+                    strerror(errno));
+        res = BLOCK_ERROR;
+    }
+
+    close(fd);
+    return res;
+}
+
+static int __stdio_discard(void *handle, off_t offset, size_t size)
+{
+    int fd = __stdio_open_fd(handle);
+    if (fd == -1)
+        return BLOCK_ERROR;
+
+    int res = block_backend_discard_fd(fd, handle, offset, size);
+    close(fd);
+    return res;
+}
+
+static size_t __stdio_size(void *handle)
+{
+    int fd = __stdio_open_fd(handle);
+    if (fd == -1)
+        return 0;
+
+    size_t size = block_backend_size_fd(fd);
+    close(fd);
+    return size;
+}
+
+const struct block_backend_ops block_backend_stdio = {
+    .name = "stdio",
+    .open = __stdio_open,
+    .close = __stdio_close,
+    .read = __stdio_read,
+    .write = __stdio_write,
+    .readv = __stdio_readv,
+    .writev = __stdio_writev,
+    .flush = __stdio_flush,
+    .discard = __stdio_discard,
+    .size = __stdio_size,
+    .map = NULL,
+    .unmap = NULL,
+};
@@ -0,0 +1,410 @@
+#ifdef SHLKFS_IO_URING
+
+#define _GNU_SOURCE // O_DIRECT
+
+#include "block_backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <liburing.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cryptfs.h"
+#include "maths.h"
+#include "print.h"
+#include "xalloc.h"
+
+// Number of entries of the submission queue
+#define URING_QUEUE_DEPTH 64
+// Maximal size of a single read/write (the length of a SQE is 32 bits)
+#define URING_MAX_TRANSFER_BYTES (1U << 30)
+
+/**
+ * @brief A device opened by the io_uring backend.
+ */
+struct uring_device
+{
+    struct io_uring ring; // The io_uring instance
+    int fd; // File descriptor of the device (O_DIRECT in direct I/O mode)
+    bool fixed_file; // true if `fd` is registered (fixed file index 0)
+    size_t nb_cancelled; // SQEs cancelled after an error, still in the
+                         // submission queue (see __uring_submit)
+    char *path; // Path of the device
+    pthread_mutex_t lock; // The ring is not thread-safe
+};
+
+/**
+ * @brief A transfer of a batch, and its progress.
+ */
+struct uring_transfer
+{
+    off_t offset; // Offset of the transfer
+    size_t size; // Total number of bytes to transfer
+    unsigned char *buffer; // The buffer to fill or to write
+    size_t done; // Number of bytes already transferred
+};
+
+/**
+ * @brief Open a device and set up its ring.
+ *
+ * @param path The path of the device.
+ * @param direct_io true to open the device with O_DIRECT.
+ * @return void* The struct uring_device, NULL on error.
+ */
+static void *__uring_open(const char *path, bool direct_io)
+{
+    int fd = open(path, O_RDWR | (direct_io ? O_DIRECT : 0));
+    if (fd == -1)
+        return NULL;
+
+    struct uring_device *device = xcalloc(1, sizeof(struct uring_device));
+    int res = io_uring_queue_init(URING_QUEUE_DEPTH, &device->ring, 0);
+    if (res < 0)
+    {
+        print_error("io_uring_queue_init failed: %s\n", strerror(-res));
+        close(fd);
+        free(device);
+        return NULL;
+    }
+
+    // A fixed file saves the lookup of the file descriptor on each request,
+    // but is only an optimization
+    res = io_uring_register_files(&device->ring, &fd, 1);
+    if (res < 0)
+        print_debug("io_uring_register_files failed: %s\n", strerror(-res));
+
+    device->fd = fd;
+    device->fixed_file = res == 0;
+    device->path = strdup(path);
+    pthread_mutex_init(&device->lock, NULL);
+    return device;
+}
+
+static void __uring_close(void *handle)
+{
+    struct uring_device *device = handle;
+    io_uring_queue_exit(&device->ring);
+    close(device->fd);
+    pthread_mutex_destroy(&device->lock);
+    free(device->path);
+    free(device);
+}
+
+/**
+ * @brief Prepare a SQE for the rest of a transfer.
+ *
+ * @param device The device.
+ * @param sqe The SQE to prepare.
+ * @param transfers The transfers of the batch.
+ * @param index The index of the transfer in the batch.
+ * @param writing true to write the buffer, false to fill it.
+ */
+static void __uring_prep(struct uring_device *device,
+                         struct io_uring_sqe *sqe,
+                         const struct uring_transfer *transfers, size_t index,
+                         bool writing)
+{
+    const struct uring_transfer *transfer = &transfers[index];
+    unsigned char *buffer = transfer->buffer + transfer->done;
+    off_t offset = transfer->offset + transfer->done;
+    size_t size = transfer->size - transfer->done;
+    if (size > URING_MAX_TRANSFER_BYTES)
+        size = URING_MAX_TRANSFER_BYTES;
+
+    int fd = device->fixed_file ? 0 : device->fd;
+    if (writing)
+        io_uring_prep_write(sqe, fd, buffer, size, offset);
+    else
+        io_uring_prep_read(sqe, fd, buffer, size, offset);
+    if (device->fixed_file)
+        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+    io_uring_sqe_set_data(sqe, (void *)index);
+}
+
+/**
+ * @brief Account the completion of a SQE.
+ *
+ * @param device The device.
+ * @param cqe The completion.
+ * @param transfers The transfers of the batch.
+ * @param writing true if the batch writes the buffers, false otherwise.
+ * @param error Set to true if the transfer failed.
+ * @return true if the transfer must be resubmitted (short or interrupted
+ * transfer), false if it is over (or failed, see `error`).
+ */
+static bool __uring_complete(const struct uring_device *device,
+                             const struct io_uring_cqe *cqe,
+                             struct uring_transfer *transfers, bool writing,
+                             bool *error)
+{
+    size_t index = (size_t)io_uring_cqe_get_data(cqe);
+    struct uring_transfer *transfer = &transfers[index];
+
+    if (cqe->res == -EINTR || cqe->res == -EAGAIN)
+        return true;
+    if (cqe->res < 0 || (cqe->res == 0 && writing))
+    {
+        print_error("Fail to %s '%lu' bytes, starting at offset '%lu' on "
+                    "'%s': %s\n",
+                    writing ? "write" : "read", transfer->size,
+                    transfer->offset, device->path,
+                    strerror(cqe->res < 0 ? -cqe->res : EIO));
+        *error = true;
+        return false;
+    }
+    if (cqe->res == 0)
+    {
+        // End of the image file: the blocks were never written
+        memset(transfer->buffer + transfer->done, 0,
+               transfer->size - transfer->done);
+        return false;
+    }
+
+    transfer->done += cqe->res;
+    return transfer->done < transfer->size;
+}
+
+// Data of the SQEs of a batch cancelled after an error (see __uring_submit)
+#define URING_CANCELLED ((void *)UINTPTR_MAX)
+
+/**
+ * @brief Wait for a completion, after an error: the kernel may still access
+ * the buffers of the transfers in flight, which cannot be given back to the
+ * caller until they are completed.
+ *
+ * @param device The device.
+ * @param cqe The completion (returned).
+ */
+static void __uring_wait_cqe(struct uring_device *device,
+                             struct io_uring_cqe **cqe)
+{
+    int res = 0;
+    do
+        res = io_uring_wait_cqe(&device->ring, cqe);
+    while (res == -EINTR || res == -EAGAIN);
+    if (res < 0)
+        internal_error_exit("Failed to wait for the transfers in flight on "
+                            "'%s': %s\n",
+                            EXIT_FAILURE, device->path, strerror(-res));
+}
+
+/**
+ * @brief Run a batch of transfers through the ring.
+ *
+ * @details The transfers are queued in the submission queue and submitted
+ * with a single syscall. The completions are reaped in any order: short
+ * transfers are resubmitted, and new transfers are queued as soon as the
+ * submission queue has room, so that the device keeps a deep queue.
+ *
+ * If the submission fails, the SQEs not consumed by the kernel are turned
+ * into NOPs (they would be submitted with the next batch), and the transfers
+ * in flight are waited for before returning.
+ *
+ * @note Reading past the end of an image file fills the buffer with zeros.
+ *
+ * @param device The device.
+ * @param transfers The transfers.
+ * @param nb_transfers The number of transfers.
+ * @param writing true to write the buffers, false to fill them.
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+static int __uring_submit(struct uring_device *device,
+                          struct uring_transfer *transfers,
+                          size_t nb_transfers, bool writing)
+{
+    pthread_mutex_lock(&device->lock);
+
+    // Transfers to resubmit (short transfers), before the new ones
+    size_t *retries = xcalloc(nb_transfers, sizeof(size_t));
+    size_t nb_retries = 0;
+    size_t next = 0; // Next transfer never submitted
+    // SQEs prepared but not consumed by the kernel yet, in submission order
+    struct io_uring_sqe *queued[URING_QUEUE_DEPTH];
+    size_t nb_queued = 0;
+    size_t inflight = 0; // SQEs consumed by the kernel, not completed yet
+    bool error = false;
+
+    while (inflight > 0 || nb_queued > 0
+           || (!error && (nb_retries > 0 || next < nb_transfers)))
+    {
+        // Fill the submission queue
+        while (!error && nb_queued < URING_QUEUE_DEPTH
+               && (nb_retries > 0 || next < nb_transfers))
+        {
+            size_t index = nb_retries > 0 ? retries[nb_retries - 1] : next;
+            if (transfers[index].size == 0)
+            {
+                next++; // Nothing to transfer
+                continue;
+            }
+
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&device->ring);
+            if (sqe == NULL)
+                break; // The submission queue is full
+            if (nb_retries > 0)
+                nb_retries--;
+            else
+                next++;
+
+            __uring_prep(device, sqe, transfers, index, writing);
+            queued[nb_queued++] = sqe;
+        }
+
+        // Submit the whole queue and wait for (at least) one completion with
+        // a single syscall
+        int res = nb_queued > 0 || !error
+            ? io_uring_submit_and_wait(&device->ring,
+                                       inflight + nb_queued > 0 ? 1 : 0)
+            : 0;
+        if (res >= 0)
+        {
+            // The kernel consumes the SQEs in order, the ones cancelled by a
+            // previous batch first
+            size_t cancelled = MIN((size_t)res, device->nb_cancelled);
+            device->nb_cancelled -= cancelled;
+            res -= cancelled;
+            nb_queued -= res;
+            memmove(queued, queued + res, nb_queued * sizeof(*queued));
+            inflight += res;
+        }
+        else if (res != -EINTR && res != -EAGAIN && res != -EBUSY)
+        {
+            print_error("io_uring_submit_and_wait failed: %s\n",
+                        strerror(-res));
+            error = true;
+            for (size_t i = 0; i < nb_queued; i++)
+            {
+                io_uring_prep_nop(queued[i]);
+                io_uring_sqe_set_data(queued[i], URING_CANCELLED);
+            }
+            device->nb_cancelled += nb_queued;
+            nb_queued = 0;
+        }
+
+        // Reap every available completion (all the transfers in flight after
+        // an error)
+        struct io_uring_cqe *cqe = NULL;
+        while (io_uring_peek_cqe(&device->ring, &cqe) == 0
+               || (error && inflight > 0
+                   && (__uring_wait_cqe(device, &cqe), true)))
+        {
+            void *data = io_uring_cqe_get_data(cqe);
+            if (data != URING_CANCELLED)
+            {
+                if (__uring_complete(device, cqe, transfers, writing, &error))
+                    retries[nb_retries++] = (size_t)data;
+                inflight--;
+            }
+            io_uring_cqe_seen(&device->ring, cqe);
+        }
+    }
+
+    free(retries);
+    pthread_mutex_unlock(&device->lock);
+    return error ? BLOCK_ERROR : 0;
+}
+
+static int __uring_read(void *handle, off_t offset, size_t size, void *buffer)
+{
+    struct uring_transfer transfer = { .offset = offset,
+                                       .size = size,
+                                       .buffer = buffer };
+    return __uring_submit(handle, &transfer, 1, false);
+}
+
+static int __uring_write(void *handle, off_t offset, size_t size,
+                         const void *buffer)
+{
+    struct uring_transfer transfer = { .offset = offset,
+                                       .size = size,
+                                       .buffer = (void *)buffer };
+    return __uring_submit(handle, &transfer, 1, true);
+}
+
+/**
+ * @brief Run a batch of requests through the ring.
+ *
+ * @param handle The device.
+ * @param block_size The block size of the device.
+ * @param requests The requests.
+ * @param nb_requests The number of requests.
+ * @param writing true to write the buffers, false to fill them.
+ * @return 0 on success, BLOCK_ERROR on error.
+ */
+static int __uring_submit_requests(void *handle, size_t block_size,
+                                   const struct block_request *requests,
+                                   size_t nb_requests, bool writing)
+{
+    struct uring_transfer *transfers =
+        xcalloc(nb_requests, sizeof(struct uring_transfer));
+    for (size_t i = 0; i < nb_requests; i++)
+    {
+        transfers[i].offset = requests[i].start_block * block_size;
+        transfers[i].size = requests[i].nb_blocks * block_size;
+        transfers[i].buffer = requests[i].buffer;
+    }
+
+    int res = __uring_submit(handle, transfers, nb_requests, writing);
+    free(transfers);
+    return res;
+}
+
+static int __uring_readv(void *handle, size_t block_size,
+                         const struct block_request *requests,
+                         size_t nb_requests)
+{
+    return __uring_submit_requests(handle, block_size, requests, nb_requests,
+                                   false);
+}
+
+static int __uring_writev(void *handle, size_t block_size,
+                          const struct block_request *requests,
+                          size_t nb_requests)
+{
+    return __uring_submit_requests(handle, block_size, requests, nb_requests,
+                                   true);
+}
+
+static int __uring_flush(void *handle)
+{
+    struct uring_device *device = handle;
+    if (fsync(device->fd) == -1)
+    {
+        print_error("fsync '%s' failed: %s\n", device->path, strerror(errno));
+        return BLOCK_ERROR;
+    }
+    return 0;
+}
+
+static int __uring_discard(void *handle, off_t offset, size_t size)
+{
+    struct uring_device *device = handle;
+    return block_backend_discard_fd(device->fd, device->path, offset, size);
+}
+
+static size_t __uring_size(void *handle)
+{
+    struct uring_device *device = handle;
+    return block_backend_size_fd(device->fd);
+}
+
+const struct block_backend_ops block_backend_uring = {
+    .name = "io_uring",
+    .open = __uring_open,
+    .close = __uring_close,
+    .read = __uring_read,
+    .write = __uring_write,
+    .readv = __uring_readv,
+    .writev = __uring_writev,
+    .flush = __uring_flush,
+    .discard = __uring_discard,
+    .size = __uring_size,
+    .map = NULL,
+    .unmap = NULL,
+};
+
+#endif /* SHLKFS_IO_URING */
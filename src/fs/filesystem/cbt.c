@@ -0,0 +1,264 @@
+#include "cbt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "print.h"
+#include "xalloc.h"
+
+/**
+ * @brief A changed-block tracking file mapped in memory.
+ */
+struct cbt
+{
+    struct CryptFS_CBT_Header *header; // The mapped file
+    uint8_t *bitmap; // The bitmap, after the header
+    size_t map_size; // The size of the mapped file
+};
+
+char *cbt_state_path(const char *device_path, const char *suffix)
+{
+    // The image files (and the devices that do not exist yet) keep their
+    // state next to them
+    struct stat st;
+    if (stat(device_path, &st) != 0 || S_ISREG(st.st_mode))
+    {
+        size_t size = strlen(device_path) + strlen(suffix) + 1;
+        char *path = xmalloc(size, sizeof(char));
+        snprintf(path, size, "%s%s", device_path, suffix);
+        return path;
+    }
+
+    // The errors are reported when the state file is opened
+    mkdir(CBT_STATE_DIR, 0700);
+    size_t size = sizeof(CBT_STATE_DIR "/") + strlen(device_path)
+        + strlen(suffix);
+    char *path = xmalloc(size, sizeof(char));
+    int length = snprintf(path, size, "%s/%s%s", CBT_STATE_DIR, device_path,
+                          suffix);
+    for (char *c = path + sizeof(CBT_STATE_DIR); c < path + length; c++)
+        if (*c == '/')
+            *c = '!';
+    return path;
+}
+
+/**
+ * @brief Get the size of a tracking file.
+ *
+ * @param nb_blocks The number of blocks of its bitmap.
+ * @return size_t The size of the tracking file (in bytes).
+ */
+static size_t __cbt_size(uint64_t nb_blocks)
+{
+    return sizeof(struct CryptFS_CBT_Header) + (nb_blocks + 7) / 8;
+}
+
+int cbt_open(const char *device_path, struct cbt **cbt)
+{
+    *cbt = NULL;
+    char *path = cbt_state_path(device_path, CBT_SUFFIX);
+    int fd = open(path, O_RDWR);
+    if (fd == -1)
+    {
+        int res = 0;
+        if (errno != ENOENT && errno != ENOTDIR)
+        {
+            print_error("Failed to open the tracking file '%s': %s\n", path,
+                        strerror(errno));
+            res = -1;
+        }
+        free(path);
+        return res;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0
+        && (size_t)st.st_size >= sizeof(struct CryptFS_CBT_Header))
+        data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                    0);
+    close(fd);
+
+    struct CryptFS_CBT_Header *header = data;
+    if (data == MAP_FAILED
+        || memcmp(header->magic, CBT_MAGIC, CBT_MAGIC_SIZE) != 0
+        || header->version != CBT_VERSION || header->block_size == 0
+        || __cbt_size(header->nb_blocks) > (size_t)st.st_size)
+    {
+        print_error("The tracking file '%s' is corrupted (remove it and make "
+                    "a full backup)\n",
+                    path);
+        if (data != MAP_FAILED)
+            munmap(data, st.st_size);
+        free(path);
+        return -1;
+    }
+    free(path);
+
+    *cbt = xmalloc(1, sizeof(struct cbt));
+    (*cbt)->header = header;
+    (*cbt)->bitmap = (uint8_t *)(header + 1);
+    (*cbt)->map_size = st.st_size;
+    return 0;
+}
+
+int cbt_enable(const char *device_path, size_t block_size, size_t nb_blocks,
+               uint64_t epoch)
+{
+    struct CryptFS_CBT_Header header = { .version = CBT_VERSION,
+                                         .block_size = block_size,
+                                         .nb_blocks = nb_blocks,
+                                         .epoch = epoch };
+    memcpy(header.magic, CBT_MAGIC, CBT_MAGIC_SIZE);
+
+    // The new tracking file replaces the previous one at once (the devices
+    // opened meanwhile keep marking the previous one)
+    char *path = cbt_state_path(device_path, CBT_SUFFIX);
+    size_t tmp_size = strlen(path) + sizeof(".tmp");
+    char *tmp_path = xmalloc(tmp_size, sizeof(char));
+    snprintf(tmp_path, tmp_size, "%s.tmp", path);
+
+    int res = -1;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd != -1 && write(fd, &header, sizeof(header)) == sizeof(header)
+        && ftruncate(fd, __cbt_size(nb_blocks)) == 0 && fsync(fd) == 0
+        && rename(tmp_path, path) == 0)
+        res = 0;
+    else
+        print_error("Failed to write the tracking file '%s': %s\n", path,
+                    strerror(errno));
+    if (fd != -1)
+        close(fd);
+    if (res)
+        unlink(tmp_path);
+
+    free(tmp_path);
+    free(path);
+    return res;
+}
+
+int cbt_disable(const char *device_path)
+{
+    char *path = cbt_state_path(device_path, CBT_SUFFIX);
+    int res = 0;
+    if (unlink(path) != 0 && errno != ENOENT)
+    {
+        print_error("Failed to remove the tracking file '%s': %s\n", path,
+                    strerror(errno));
+        res = -1;
+    }
+
+    free(path);
+    return res;
+}
+
+void cbt_close(struct cbt *cbt)
+{
+    if (cbt == NULL)
+        return;
+
+    munmap(cbt->header, cbt->map_size);
+    free(cbt);
+}
+
+void cbt_mark(struct cbt *cbt, off_t offset, size_t size)
+{
+    if (cbt == NULL || size == 0)
+        return;
+
+    uint64_t block_size = cbt->header->block_size;
+    uint64_t first = offset / block_size;
+    uint64_t last = (offset + size - 1) / block_size;
+    if (last >= cbt->header->nb_blocks)
+        last = cbt->header->nb_blocks - 1;
+    if (cbt->header->nb_blocks == 0 || first > last)
+        return; // Beyond the bitmap: always changed
+
+    // Partial bytes at the edges of the range, whole bytes in between
+    uint8_t *bitmap = cbt->bitmap;
+    while (first <= last && first % 8 != 0)
+    {
+        __atomic_fetch_or(&bitmap[first / 8], 1 << (first % 8),
+                          __ATOMIC_RELAXED);
+        first++;
+    }
+    while (first + 7 <= last)
+    {
+        __atomic_store_n(&bitmap[first / 8], 0xff, __ATOMIC_RELAXED);
+        first += 8;
+    }
+    for (; first <= last; first++)
+        __atomic_fetch_or(&bitmap[first / 8], 1 << (first % 8),
+                          __ATOMIC_RELAXED);
+}
+
+void cbt_merge(struct cbt *cbt, const struct cbt *previous)
+{
+    uint64_t block_size = cbt->header->block_size;
+    uint64_t nb_blocks = cbt->header->nb_blocks;
+    size_t block = previous->header->block_size == block_size
+        ? cbt_next_changed(previous, 0)
+        : 0;
+    while (block < nb_blocks)
+    {
+        // The blocks beyond the previous bitmap are all changed
+        if (block >= previous->header->nb_blocks
+            || previous->header->block_size != block_size)
+        {
+            cbt_mark(cbt, block * block_size, (nb_blocks - block) * block_size);
+            break;
+        }
+        cbt_mark(cbt, block * block_size, block_size);
+        block = cbt_next_changed(previous, block + 1);
+    }
+
+    cbt->header->epoch = previous->header->epoch;
+}
+
+bool cbt_is_changed(const struct cbt *cbt, size_t block)
+{
+    if (block >= cbt->header->nb_blocks)
+        return true;
+
+    return (__atomic_load_n(&cbt->bitmap[block / 8], __ATOMIC_RELAXED)
+            >> (block % 8))
+        & 1;
+}
+
+size_t cbt_next_changed(const struct cbt *cbt, size_t block)
+{
+    size_t nb_blocks = cbt->header->nb_blocks;
+    if (block >= nb_blocks)
+        return block;
+
+    // Skip the clean bytes at once
+    while (block < nb_blocks && !cbt_is_changed(cbt, block))
+    {
+        if (block % 8 == 0
+            && __atomic_load_n(&cbt->bitmap[block / 8], __ATOMIC_RELAXED) == 0)
+            block += 8;
+        else
+            block++;
+    }
+
+    return block < nb_blocks ? block : nb_blocks;
+}
+
+const struct CryptFS_CBT_Header *cbt_header(const struct cbt *cbt)
+{
+    return cbt->header;
+}
+
+int cbt_sync(struct cbt *cbt)
+{
+    if (cbt == NULL)
+        return 0;
+
+    return msync(cbt->header, cbt->map_size, MS_SYNC) == 0 ? 0 : -1;
+}
@@ -0,0 +1,541 @@
+#include "defrag.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "entries.h"
+#include "fat.h"
+#include "maths.h"
+#include "print.h"
+#include "shlkfs_ctx.h"
+#include "xalloc.h"
+
+// Size of the chunks of blocks copied at once
+#define DEFRAG_CHUNK_BYTES (16 * 1024 * 1024)
+// Number of bytes copied before the volume is switched to the new chains
+#define DEFRAG_BATCH_BYTES (256 * 1024 * 1024)
+
+/**
+ * @brief A file (or a symbolic link) of the volume, with the layout of its
+ * chain.
+ */
+struct defrag_file
+{
+    struct CryptFS_Entry_ID id; // The ID of the entry
+    struct CryptFS_Entry entry; // The entry
+    size_t nb_blocks; // Number of blocks of the chain
+    size_t nb_fragments; // Number of runs of contiguous blocks of the chain
+};
+
+/**
+ * @brief A file copied to a new chain, not switched to it yet.
+ */
+struct defrag_move
+{
+    struct defrag_file *file; // The file (its entry still has the old chain)
+    block_t start_block; // First block of the new chain
+};
+
+/**
+ * @brief Fragmentation statistics of a volume.
+ */
+struct defrag_stats
+{
+    uint64_t nb_files; // Number of files with blocks
+    uint64_t nb_fragmented; // Number of files with several fragments
+    uint64_t nb_fragments; // Number of fragments of all the files
+    uint64_t nb_blocks; // Number of blocks of all the files
+};
+
+/**
+ * @brief State of a defragmentation.
+ */
+struct defrag
+{
+    struct shlkfs_ctx *ctx; // The volume (its FAT is loaded)
+    size_t block_size; // Block size of the volume
+    uint64_t nb_blocks; // Number of blocks usable for the new chains
+    struct defrag_file *files; // Files of the volume
+    size_t nb_files; // Number of files
+    struct defrag_file *hardlinks; // Hardlinks, sorted by start block
+    size_t nb_hardlinks; // Number of hardlinks
+    struct defrag_move *moves; // Files copied since the last switch
+    size_t nb_moves; // Number of copied files
+    uint64_t nb_moved_blocks; // Number of blocks copied since the last switch
+    block_t cursor; // Where the search of free runs starts
+    unsigned char *buffer; // Chunk of copied blocks
+    struct block_request *requests; // Extents of a chunk
+    size_t chunk_blocks; // Number of blocks of a chunk
+};
+
+/**
+ * @brief Append a file to a list.
+ *
+ * @param list The list. (updated)
+ * @param nb_items The number of items of the list. (updated)
+ * @param file The file.
+ */
+static void __defrag_push(struct defrag_file **list, size_t *nb_items,
+                          const struct defrag_file *file)
+{
+    // The capacity is the next power of two
+    if ((*nb_items & (*nb_items - 1)) == 0)
+        *list = xrealloc(*list, *nb_items ? *nb_items * 2 : 1,
+                         sizeof(struct defrag_file));
+    (*list)[(*nb_items)++] = *file;
+}
+
+/**
+ * @brief Measure the chain of a file.
+ *
+ * @param defrag The defragmentation.
+ * @param file The file (its chain is measured).
+ * @return int 0 on success, -1 if the chain is broken (error printed).
+ */
+static int __defrag_measure(struct defrag *defrag, struct defrag_file *file)
+{
+    file->nb_blocks = 0;
+    file->nb_fragments = 0;
+
+    block_t previous = 0;
+    block_t block = file->entry.start_block;
+    while (block != (uint32_t)BLOCK_END)
+    {
+        if (block <= ROOT_DIR_BLOCK || block >= defrag->nb_blocks
+            || file->nb_blocks == defrag->nb_blocks)
+        {
+            print_error("The chain of '%s' is broken (run shlkfs.fsck)\n",
+                        file->entry.name);
+            return -1;
+        }
+        if (file->nb_blocks == 0 || block != previous + 1)
+            file->nb_fragments++;
+        file->nb_blocks++;
+        previous = block;
+
+        block = fat_cache_read(defrag->ctx, block);
+        if (block == BLOCK_FREE || block == (uint32_t)BLOCK_ERROR
+            || block == (uint32_t)FAT_INDEX_OOB)
+            block = 0; // Reported above
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Compare two hardlinks by start block (for qsort and bsearch).
+ */
+static int __defrag_compare_start(const void *a, const void *b)
+{
+    block_t start_a = ((const struct defrag_file *)a)->entry.start_block;
+    block_t start_b = ((const struct defrag_file *)b)->entry.start_block;
+    return (start_a > start_b) - (start_a < start_b);
+}
+
+/**
+ * @brief Walk the directory tree, listing the files and the hardlinks, and
+ * compute the fragmentation statistics.
+ *
+ * @param defrag The defragmentation (its lists are replaced).
+ * @param stats The fragmentation statistics. (returned)
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __defrag_scan(struct defrag *defrag, struct defrag_stats *stats)
+{
+    free(defrag->files);
+    free(defrag->hardlinks);
+    defrag->files = NULL;
+    defrag->nb_files = 0;
+    defrag->hardlinks = NULL;
+    defrag->nb_hardlinks = 0;
+    memset(stats, 0, sizeof(*stats));
+
+    struct CryptFS_Entry_ID root_id = { .directory_block = ROOT_ENTRY_BLOCK,
+                                        .directory_index = 0 };
+    struct CryptFS_Entry *root = get_entry_from_id(defrag->ctx, root_id);
+    if (root == NULL)
+    {
+        print_error("Failed to read the root directory\n");
+        return -1;
+    }
+
+    // The directories to walk (breadth-first)
+    struct defrag_file *directories = NULL;
+    size_t nb_directories = 0;
+    struct defrag_file root_directory = { .id = root_id, .entry = *root };
+    __defrag_push(&directories, &nb_directories, &root_directory);
+    free(root);
+
+    struct CryptFS_Directory *dir =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, defrag->block_size);
+    int res = 0;
+    for (size_t i = 0; res == 0 && i < nb_directories; i++)
+    {
+        size_t nb_read = 0;
+        block_t block = directories[i].entry.start_block;
+        while (res == 0 && block != 0 && block != (uint32_t)BLOCK_END)
+        {
+            if (block >= defrag->nb_blocks || nb_read++ == defrag->nb_blocks
+                || read_blocks_with_decryption(defrag->ctx->aes_key, block, 1,
+                                               dir))
+            {
+                print_error("Failed to read the directory '%s'\n",
+                            directories[i].entry.name);
+                res = -1;
+                break;
+            }
+
+            for (uint32_t j = 0; res == 0 && j < NB_ENTRIES_PER_BLOCK; j++)
+            {
+                struct defrag_file file = {
+                    .id = { .directory_block = block, .directory_index = j },
+                    .entry = dir->entries[j],
+                };
+                if (!file.entry.used)
+                    continue;
+                if (file.entry.type == ENTRY_TYPE_DIRECTORY)
+                    __defrag_push(&directories, &nb_directories, &file);
+                else if (file.entry.type == ENTRY_TYPE_HARDLINK)
+                    __defrag_push(&defrag->hardlinks, &defrag->nb_hardlinks,
+                                  &file);
+                else if (file.entry.start_block != 0)
+                {
+                    res = __defrag_measure(defrag, &file);
+                    __defrag_push(&defrag->files, &defrag->nb_files, &file);
+                    stats->nb_files++;
+                    stats->nb_fragmented += file.nb_fragments > 1;
+                    stats->nb_fragments += file.nb_fragments;
+                    stats->nb_blocks += file.nb_blocks;
+                }
+            }
+            block = fat_cache_read(defrag->ctx, block);
+        }
+    }
+
+    if (defrag->nb_hardlinks > 0)
+        qsort(defrag->hardlinks, defrag->nb_hardlinks,
+              sizeof(struct defrag_file), __defrag_compare_start);
+
+    free(dir);
+    free(directories);
+    return res;
+}
+
+/**
+ * @brief Print fragmentation statistics.
+ *
+ * @param when When the statistics were computed.
+ * @param stats The statistics.
+ */
+static void __defrag_print_stats(const char *when,
+                                 const struct defrag_stats *stats)
+{
+    double percent = stats->nb_files > 0
+        ? 100.0 * stats->nb_fragmented / stats->nb_files
+        : 0.0;
+    print_info("%s: %lu files, %lu fragmented (%.1f%%), %lu fragments for "
+               "%lu blocks\n",
+               when, (unsigned long)stats->nb_files,
+               (unsigned long)stats->nb_fragmented, percent,
+               (unsigned long)stats->nb_fragments,
+               (unsigned long)stats->nb_blocks);
+}
+
+/**
+ * @brief Find a run of contiguous free blocks, from the cursor to the end of
+ * the volume, then from the start.
+ *
+ * @param defrag The defragmentation.
+ * @param nb_blocks The number of blocks of the run.
+ * @return block_t The first block of the run, 0 if there is none.
+ */
+static block_t __defrag_find_run(struct defrag *defrag, size_t nb_blocks)
+{
+    block_t starts[2] = { defrag->cursor, ROOT_DIR_BLOCK + 1 };
+    for (size_t pass = 0; pass < 2; pass++)
+    {
+        size_t run = 0;
+        for (uint64_t block = starts[pass]; block < defrag->nb_blocks; block++)
+        {
+            if (fat_cache_read(defrag->ctx, block) != BLOCK_FREE)
+                run = 0;
+            else if (++run == nb_blocks)
+                return block + 1 - nb_blocks;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Copy a file to a run of free blocks, which becomes its new chain in
+ * the FAT (the entry still points to the old chain).
+ *
+ * @param defrag The defragmentation.
+ * @param file The file.
+ * @param start_block The first block of the run.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __defrag_copy(struct defrag *defrag, const struct defrag_file *file,
+                         block_t start_block)
+{
+    for (size_t i = 0; i < file->nb_blocks; i++)
+    {
+        uint32_t next = i + 1 < file->nb_blocks ? start_block + i + 1
+                                                : (uint32_t)BLOCK_END;
+        if (write_fat_offset(defrag->ctx, start_block + i, next))
+            return -1;
+    }
+
+    block_t block = file->entry.start_block;
+    for (size_t done = 0; done < file->nb_blocks;)
+    {
+        size_t chunk_blocks = MIN(defrag->chunk_blocks, file->nb_blocks - done);
+
+        // Resolve the extents of the chunk from the FAT
+        size_t nb_requests = 0;
+        for (size_t i = 0; i < chunk_blocks; nb_requests++)
+        {
+            struct block_request *request = &defrag->requests[nb_requests];
+            request->start_block = block;
+            request->nb_blocks = 0;
+            request->buffer = defrag->buffer + i * defrag->block_size;
+            do
+            {
+                block = fat_cache_read(defrag->ctx, block);
+                request->nb_blocks++;
+                i++;
+            } while (i < chunk_blocks
+                     && block == request->start_block + request->nb_blocks);
+        }
+
+        if (read_blocks_batch_with_decryption(defrag->ctx->aes_key,
+                                              defrag->requests, nb_requests)
+            || write_blocks_with_encryption(defrag->ctx->aes_key,
+                                            start_block + done, chunk_blocks,
+                                            defrag->buffer))
+        {
+            print_error("Failed to copy the blocks of '%s'\n",
+                        file->entry.name);
+            return -1;
+        }
+        done += chunk_blocks;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Point the hardlinks to a file to its new chain.
+ *
+ * @param defrag The defragmentation.
+ * @param old_start The first block of the old chain of the file.
+ * @param new_start The first block of the new chain of the file.
+ * @return int 0 on success, -1 on error.
+ */
+static int __defrag_repoint_hardlinks(struct defrag *defrag,
+                                      block_t old_start, block_t new_start)
+{
+    if (defrag->nb_hardlinks == 0)
+        return 0;
+
+    // The hardlinks are sorted by start block: find the first one to the file
+    struct defrag_file key = { .entry.start_block = old_start };
+    struct defrag_file *end = defrag->hardlinks + defrag->nb_hardlinks;
+    struct defrag_file *link =
+        bsearch(&key, defrag->hardlinks, defrag->nb_hardlinks,
+                sizeof(struct defrag_file), __defrag_compare_start);
+    if (link == NULL)
+        return 0;
+    while (link > defrag->hardlinks && link[-1].entry.start_block == old_start)
+        link--;
+
+    // The list keeps the old start blocks, so that it stays sorted
+    for (; link < end && link->entry.start_block == old_start; link++)
+    {
+        struct CryptFS_Entry entry = link->entry;
+        entry.start_block = new_start;
+        if (write_entry_from_id(defrag->ctx, link->id, &entry))
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Switch the copied files to their new chains, and free their old
+ * chains.
+ *
+ * @param defrag The defragmentation.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __defrag_switch(struct defrag *defrag)
+{
+    if (defrag->nb_moves == 0)
+        return 0;
+
+    // The copies and the new chains must be durable before they are used
+    if (shlkfs_ctx_flush(defrag->ctx))
+        goto err_defrag_switch;
+
+    for (size_t i = 0; i < defrag->nb_moves; i++)
+    {
+        struct defrag_file *file = defrag->moves[i].file;
+        block_t old_start = file->entry.start_block;
+        block_t new_start = defrag->moves[i].start_block;
+
+        file->entry.start_block = new_start;
+        if (write_entry_from_id(defrag->ctx, file->id, &file->entry)
+            || __defrag_repoint_hardlinks(defrag, old_start, new_start))
+            goto err_defrag_switch;
+        defrag->moves[i].start_block = old_start;
+    }
+
+    // The old chains are freed once no entry points to them
+    if (flush_blocks())
+        goto err_defrag_switch;
+    for (size_t i = 0; i < defrag->nb_moves; i++)
+    {
+        block_t block = defrag->moves[i].start_block;
+        for (size_t j = 0; j < defrag->moves[i].file->nb_blocks; j++)
+        {
+            block_t next = fat_cache_read(defrag->ctx, block);
+            if (write_fat_offset(defrag->ctx, block, BLOCK_FREE))
+                goto err_defrag_switch;
+            block = next;
+        }
+    }
+
+    defrag->nb_moves = 0;
+    defrag->nb_moved_blocks = 0;
+    return 0;
+
+err_defrag_switch:
+    print_error("Failed to switch the files to their new blocks\n");
+    return -1;
+}
+
+/**
+ * @brief Move the fragmented files of the volume to contiguous runs of free
+ * blocks.
+ *
+ * @param defrag The defragmentation (the volume is scanned).
+ * @param nb_moved The number of moved files. (returned)
+ * @return int 0 on success, -1 on error.
+ */
+static int __defrag_files(struct defrag *defrag, size_t *nb_moved)
+{
+    defrag->chunk_blocks = MAX(DEFRAG_CHUNK_BYTES / defrag->block_size, 1);
+    defrag->buffer = xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                                    defrag->chunk_blocks, defrag->block_size);
+    defrag->requests =
+        xcalloc(defrag->chunk_blocks, sizeof(struct block_request));
+    defrag->moves = xcalloc(defrag->nb_files, sizeof(struct defrag_move));
+    defrag->cursor = ROOT_DIR_BLOCK + 1;
+
+    int res = 0;
+    for (size_t i = 0; res == 0 && i < defrag->nb_files; i++)
+    {
+        struct defrag_file *file = &defrag->files[i];
+        if (file->nb_fragments <= 1)
+            continue;
+
+        block_t start_block = __defrag_find_run(defrag, file->nb_blocks);
+        if (start_block == 0)
+        {
+            print_warning("No free run of %zu blocks for '%s': it is left "
+                          "fragmented\n",
+                          file->nb_blocks, file->entry.name);
+            continue;
+        }
+
+        res = __defrag_copy(defrag, file, start_block);
+        defrag->cursor = start_block + file->nb_blocks;
+        defrag->moves[defrag->nb_moves].file = file;
+        defrag->moves[defrag->nb_moves].start_block = start_block;
+        defrag->nb_moves++;
+        defrag->nb_moved_blocks += file->nb_blocks;
+        (*nb_moved)++;
+
+        if (res == 0
+            && defrag->nb_moved_blocks * defrag->block_size
+                >= DEFRAG_BATCH_BYTES)
+            res = __defrag_switch(defrag);
+    }
+
+    // The files copied before an error are switched, the others are leaked
+    if (res == 0)
+        res = __defrag_switch(defrag);
+    else
+        defrag->nb_moves = 0;
+
+    free(defrag->moves);
+    free(defrag->requests);
+    free(defrag->buffer);
+    return res;
+}
+
+/**
+ * @brief Defragment an opened volume.
+ *
+ * @param defrag The defragmentation (its volume is set).
+ * @param dry_run true to only print the fragmentation statistics.
+ * @return int 0 on success, -1 on error.
+ */
+static int __defrag(struct defrag *defrag, bool dry_run)
+{
+    SHLKFS_CTX_SCOPE(defrag->ctx);
+
+    if (fat_cache_load(defrag->ctx))
+    {
+        print_error("Failed to load the FAT of the volume\n");
+        return -1;
+    }
+    defrag->block_size = get_block_size();
+    defrag->nb_blocks = MIN(fat_cache_nb_entries(defrag->ctx),
+                            get_device_size() / defrag->block_size);
+
+    struct defrag_stats stats;
+    int res = __defrag_scan(defrag, &stats);
+    if (res == 0)
+        __defrag_print_stats("Before", &stats);
+
+    size_t nb_moved = 0;
+    if (res == 0 && !dry_run && stats.nb_fragmented > 0)
+    {
+        res = __defrag_files(defrag, &nb_moved);
+        if (res == 0 && shlkfs_ctx_flush(defrag->ctx))
+            res = -1;
+        if (res == 0)
+            res = __defrag_scan(defrag, &stats);
+        if (res == 0)
+            __defrag_print_stats("After", &stats);
+    }
+    if (res == 0)
+        print_info("%zu files moved\n", nb_moved);
+
+    free(defrag->files);
+    free(defrag->hardlinks);
+    fat_cache_unload(defrag->ctx);
+    return res;
+}
+
+int cryptfs_defrag(const char *device_path, const char *private_key_path,
+                   bool dry_run)
+{
+    struct defrag defrag = { 0 };
+    defrag.ctx = shlkfs_ctx_open_with_key(device_path, private_key_path);
+    if (defrag.ctx == NULL)
+        return -1;
+
+    int res = __defrag(&defrag, dry_run);
+    shlkfs_ctx_close(defrag.ctx);
+
+    if (res == 0 && !dry_run)
+        print_success("The volume of the device '%s' has been defragmented "
+                      "successfully!\n",
+                      device_path);
+    return res;
+}
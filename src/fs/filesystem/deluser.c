@@ -2,14 +2,17 @@
 
 #include <assert.h>
 
+#include "agent.h"
 #include "crypto.h"
 #include "format.h"
 #include "io.h"
+#include "keytable.h"
 #include "passphrase.h"
 #include "print.h"
 #include "readfs.h"
 #include "string.h"
 #include "writefs.h"
+#include "xalloc.h"
 
 int cryptfs_deluser(const char *device_path, const char *my_private_key_path,
                     const char *deleting_user_public_key_path)
@@ -22,66 +25,83 @@ int cryptfs_deluser(const char *device_path, const char *my_private_key_path,
             EXIT_FAILURE, device_path);
     }
 
-    // Loading the my private key from disk in memory
-    print_info("Loading my private key from disk...\n");
-    EVP_PKEY *my_private_rsa =
-        load_rsa_keypair_from_disk(NULL, my_private_key_path, NULL);
+    // The running agent (if any) knows the key slot of the current user
+    ssize_t index_my_user = -1;
+    EVP_PKEY *my_private_rsa = NULL;
+    unsigned char *agent_key =
+        agent_extract_aes_key(device_path, &index_my_user);
+    if (agent_key != NULL)
+    {
+        memset(agent_key, 0, AES_KEY_SIZE_BYTES);
+        free(agent_key);
+    }
+    else
+    {
+        // Loading the my private key from disk in memory
+        print_info("Loading my private key from disk...\n");
+        my_private_rsa =
+            load_rsa_keypair_from_disk(NULL, my_private_key_path, NULL);
+    }
 
     // Loading the other user public key from disk in memory
     print_info("Loading user to delete public key from disk...\n");
     EVP_PKEY *deluser_rsa =
         load_rsa_keypair_from_disk(deleting_user_public_key_path, NULL, NULL);
 
-    // Find matching RSA key in the keys storage
+    // Find matching RSA key in the keys storage (or in the key table)
     print_info("Reading the headers of the device '%s'...\n", device_path);
-    struct CryptFS *cryptfs = read_cryptfs_headers(device_path);
+    struct CryptFS_KeyTable *key_table = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_KeyTable));
+    struct CryptFS_KeySlot *keys_storage = NULL;
+    size_t nb_users = 0;
+    if (read_key_table(device_path, key_table) == 0)
+    {
+        keys_storage = read_key_slots(device_path);
+        nb_users = occupied_key_slots(keys_storage);
+    }
+    else
+        nb_users = key_table->nb_users;
+    int res = -1;
 
     // Check if my key is in the keys storage
-    ssize_t index_my_user =
-        find_rsa_matching_key(my_private_rsa, cryptfs->keys_storage);
+    if (my_private_rsa != NULL)
+        index_my_user = keys_storage != NULL
+            ? find_rsa_matching_key(my_private_rsa, keys_storage)
+            : find_key_slot(device_path, my_private_rsa, NULL);
     if (index_my_user == -1)
     {
         print_warning("The current user public key (corresponding to '%s' "
                       "private key) is not in the keys "
                       "storage of the device '%s'\n",
                       my_private_key_path, device_path);
-        free(cryptfs);
-        EVP_PKEY_free(my_private_rsa);
-        EVP_PKEY_free(deluser_rsa);
-        return -1;
+        goto end_deluser;
     }
 
     // Check if the key to delete is in the keys storage
-    ssize_t index_deluser =
-        find_rsa_matching_key(deluser_rsa, cryptfs->keys_storage);
+    ssize_t index_deluser = keys_storage != NULL
+        ? find_rsa_matching_key(deluser_rsa, keys_storage)
+        : find_key_slot(device_path, deluser_rsa, NULL);
     if (index_deluser == -1)
     {
         print_warning("The user with the public key '%s' is not in the keys "
                       "storage of the device '%s'\n",
                       deleting_user_public_key_path, device_path);
-        free(cryptfs);
-        EVP_PKEY_free(my_private_rsa);
-        EVP_PKEY_free(deluser_rsa);
-        return -1;
+        goto end_deluser;
     }
 
     // Check if there is only one key in the keys storage
-    if (occupied_key_slots(cryptfs->keys_storage) == 1)
+    if (nb_users == 1)
     {
         print_warning(
             "The user with the public key '%s' (you) is the only user "
             "in the keys storage of the device '%s'. The deletion will not be "
             "performed, aborting.\n",
             deleting_user_public_key_path, device_path);
-        free(cryptfs);
-        EVP_PKEY_free(my_private_rsa);
-        EVP_PKEY_free(deluser_rsa);
-        return -1;
+        goto end_deluser;
     }
 
     // Check if my key is the key to delete
-    if (occupied_key_slots(cryptfs->keys_storage) != 1
-        && index_my_user == index_deluser)
+    if (index_my_user == index_deluser)
     {
         print_warning("You are about to delete your public from the keys "
                       "storage. You will not be able to access the filesystem "
@@ -92,31 +112,33 @@ int cryptfs_deluser(const char *device_path, const char *my_private_key_path,
         if (answer != 'y' && answer != 'Y')
         {
             print_info("Aborting...");
-            free(cryptfs);
-            EVP_PKEY_free(my_private_rsa);
-            EVP_PKEY_free(deluser_rsa);
-            return -1;
+            goto end_deluser;
         }
     }
 
     print_info("Deleting user with key '%s' from the device '%s'...\n",
                deleting_user_public_key_path, device_path);
 
-    // Delete the key from the keys storage
-    cryptfs->keys_storage[index_deluser].occupied = 0;
-    // memset(&cryptfs->keys_storage[index_deluser], 0,
-    // CRYPTFS_BLOCK_SIZE_BYTES);
+    // Only the block of the key slot is written (the key table moves its
+    // last key slot in place of the deleted one)
+    print_info("Writing the new key slot on device...\n");
+    if (keys_storage != NULL)
+    {
+        keys_storage[index_deluser].occupied = 0;
+        res = write_key_slot(device_path, keys_storage, index_deluser);
+    }
+    else
+        res = key_table_remove(device_path, index_deluser);
 
-    // Write the new CryptFS headers on device
-    print_info("Writing the new headers on device...\n");
-    write_cryptfs_headers(device_path, cryptfs);
+    if (res == 0)
+        print_success("The user with the public key '%s' has been deleted from "
+                      "the keys storage of the device '%s' successfully!\n",
+                      deleting_user_public_key_path, device_path);
 
+end_deluser:
     EVP_PKEY_free(my_private_rsa);
     EVP_PKEY_free(deluser_rsa);
-    free(cryptfs);
-
-    print_success("The user with the public key '%s' has been deleted from the "
-                  "keys storage of the device '%s' successfully!\n",
-                  deleting_user_public_key_path, device_path);
-    return 0;
+    free(keys_storage);
+    free(key_table);
+    return res == 0 ? 0 : -1;
 }
@@ -13,12 +13,13 @@
 #include "cryptfs.h"
 #include "fat.h"
 #include "print.h"
+#include "shlkfs_ctx.h"
 #include "xalloc.h"
 
 int __blocks_needed_for_file(size_t size)
 {
-    int result = size / CRYPTFS_BLOCK_SIZE_BYTES;
-    if (size % CRYPTFS_BLOCK_SIZE_BYTES != (float)0)
+    int result = size / get_block_size();
+    if (size % get_block_size() != (float)0)
     {
         return result + 1;
     }
@@ -44,7 +45,7 @@ int __blocks_needed_for_dir(size_t size)
 /**
  * @brief Allocate new blocks to an entry when truncate is needed.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param new_blocks_needed Number of blocks to reach.
  * @param actual_blocks_used Number of blocks already allocated to the entry.
  * @param entry Actual CryptFS_Entry
@@ -53,47 +54,47 @@ int __blocks_needed_for_dir(size_t size)
  * CryptFS_Directory.
  * @return 0 when success, -1 otherwise.
  */
-static int __create_new_blocks(const unsigned char *aes_key,
+static int __create_new_blocks(struct shlkfs_ctx *ctx,
                                size_t new_blocks_needed,
                                size_t actual_blocks_used,
                                struct CryptFS_Entry *entry,
                                struct CryptFS_Entry_ID entry_id)
 {
-    struct CryptFS_Directory *init_dir = xaligned_calloc(
-        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+    struct CryptFS_Directory *init_dir =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
     init_dir->current_directory_entry = entry_id;
     // If entry is empty, initialize start_block
     if (entry->start_block == 0)
     {
-        block_t start = find_first_free_block_safe(aes_key);
+        block_t start = find_first_free_block_safe(ctx);
         if (start == (size_t)BLOCK_ERROR)
             goto err_create_new_block;
         entry->start_block = start;
-        if (write_fat_offset(aes_key, start, BLOCK_END))
+        if (write_fat_offset(ctx, start, BLOCK_END))
             goto err_create_new_block;
         if (entry->type == ENTRY_TYPE_DIRECTORY)
-            write_blocks_with_encryption(aes_key, start, 1, init_dir);
+            write_blocks_with_encryption(ctx->aes_key, start, 1, init_dir);
         actual_blocks_used++;
     }
     // Parcour the FAT to reach last block of this directory
     uint64_t end_block = entry->start_block;
-    while ((int)read_fat_offset(aes_key, end_block) != BLOCK_END)
+    while ((int)read_fat_offset(ctx, end_block) != BLOCK_END)
     {
-        end_block = (uint64_t)read_fat_offset(aes_key, end_block);
+        end_block = (uint64_t)read_fat_offset(ctx, end_block);
     }
     while (actual_blocks_used < new_blocks_needed)
     {
-        block_t new_end = find_first_free_block_safe(aes_key);
+        block_t new_end = find_first_free_block_safe(ctx);
         if (new_end == (size_t)BLOCK_ERROR)
             return -1;
-        if (write_fat_offset(aes_key, end_block, new_end))
+        if (write_fat_offset(ctx, end_block, new_end))
             return -1;
         actual_blocks_used += 1;
         end_block = new_end;
-        if (write_fat_offset(aes_key, end_block, BLOCK_END))
+        if (write_fat_offset(ctx, end_block, BLOCK_END))
             return -1;
         if (entry->type == ENTRY_TYPE_DIRECTORY)
-            write_blocks_with_encryption(aes_key, end_block, 1, init_dir);
+            write_blocks_with_encryption(ctx->aes_key, end_block, 1, init_dir);
     }
     free(init_dir);
     return 0;
@@ -103,35 +104,106 @@ err_create_new_block:
     return BLOCK_ERROR;
 }
 
+/**
+ * @brief Contiguous range of freed blocks waiting to be discarded.
+ */
+struct discard_range
+{
+    block_t start_block; // First block of the range
+    size_t nb_blocks; // Number of blocks in the range
+};
+
+/**
+ * @brief Flush the range of freed blocks to the device (see discard_blocks).
+ *
+ * @param range The range to flush, reset to an empty range afterwards.
+ * @return 0 when success, -1 otherwise.
+ */
+static int __discard_range_flush(struct discard_range *range)
+{
+    int res = discard_blocks(range->start_block, range->nb_blocks);
+    range->nb_blocks = 0;
+    return res == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Add a freed block to the range of blocks to discard. The range is
+ * only flushed when the block is not contiguous to it, so that a contiguous
+ * chain is discarded with a single request.
+ *
+ * @param range The range of freed blocks.
+ * @param block The freed block.
+ * @return 0 when success, -1 otherwise.
+ */
+static int __discard_range_push(struct discard_range *range, block_t block)
+{
+    if (!get_discard_mode())
+        return 0;
+
+    if (range->nb_blocks != 0
+        && block == range->start_block + range->nb_blocks)
+    {
+        range->nb_blocks++;
+        return 0;
+    }
+
+    if (range->nb_blocks != 0 && __discard_range_flush(range))
+        return -1;
+
+    range->start_block = block;
+    range->nb_blocks = 1;
+    return 0;
+}
+
+/**
+ * @brief Mark a block as BLOCK_FREE in the FAT and queue it to be discarded.
+ *
+ * @param ctx The context of the volume.
+ * @param range The range of freed blocks.
+ * @param block The block to free.
+ * @return 0 when success, -1 otherwise.
+ */
+static int __free_block(struct shlkfs_ctx *ctx,
+                        struct discard_range *range, block_t block)
+{
+    if (write_fat_offset(ctx, block, BLOCK_FREE))
+        return -1;
+    return __discard_range_push(range, block);
+}
+
 /**
  * @brief Free blocks to an entry when truncate is needed.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @note If the discard mode is enabled, the freed blocks are discarded on the
+ * device, contiguous blocks being batched together.
+ *
+ * @param ctx The context of the volume.
  * @param new_blocks_needed Number of blocks to reach.
  * @param entry Pointer to a CryptFS_Entry.
  * @return 0 when success, -1 otherwise.
  */
-static int __free_blocks(const unsigned char *aes_key, size_t new_blocks_needed,
+static int __free_blocks(struct shlkfs_ctx *ctx, size_t new_blocks_needed,
                          struct CryptFS_Entry *entry)
 {
     block_t end_block = entry->start_block;
     block_t free_block;
+    struct discard_range range = { 0 };
 
     if (new_blocks_needed == 0)
     {
         // Free all blocks till BLOCK_END
         free_block = end_block;
-        while ((int)read_fat_offset(aes_key, free_block) != BLOCK_END)
+        while ((int)read_fat_offset(ctx, free_block) != BLOCK_END)
         {
-            end_block = read_fat_offset(aes_key, free_block);
+            end_block = read_fat_offset(ctx, free_block);
             if (end_block == (size_t)BLOCK_ERROR)
                 return -1;
-            if (write_fat_offset(aes_key, free_block, BLOCK_FREE))
+            if (__free_block(ctx, &range, free_block))
                 return -1;
             free_block = end_block;
         }
         // Original BLOCK_END becomes BLOCK_FREE
-        if (write_fat_offset(aes_key, free_block, BLOCK_FREE))
+        if (__free_block(ctx, &range, free_block))
             return -1;
         // Update entry.start_entry to 0
         entry->start_block = 0;
@@ -141,32 +213,36 @@ static int __free_blocks(const unsigned char *aes_key, size_t new_blocks_needed,
         // > 1 Because if new_blocks_needed != 0, it is inevitably >=1
         while (new_blocks_needed > 1)
         {
-            end_block = (uint64_t)read_fat_offset(aes_key, end_block);
+            end_block = (uint64_t)read_fat_offset(ctx, end_block);
             new_blocks_needed--;
         }
         // end_block is the new BLOCK_END of the entry
-        free_block = read_fat_offset(aes_key, end_block);
-        if (write_fat_offset(aes_key, end_block, BLOCK_END))
+        free_block = read_fat_offset(ctx, end_block);
+        if (write_fat_offset(ctx, end_block, BLOCK_END))
             return -1;
         // Free all other blocks till original BLOCK_END
-        while ((int)read_fat_offset(aes_key, free_block) != BLOCK_END)
+        while ((int)read_fat_offset(ctx, free_block) != BLOCK_END)
         {
-            end_block = read_fat_offset(aes_key, free_block);
-            if (write_fat_offset(aes_key, free_block, BLOCK_FREE))
+            end_block = read_fat_offset(ctx, free_block);
+            if (__free_block(ctx, &range, free_block))
                 return -1;
             free_block = end_block;
         }
         // Original BLOCK_END becomes BLOCK_FREE
-        if (write_fat_offset(aes_key, free_block, BLOCK_FREE))
+        if (__free_block(ctx, &range, free_block))
             return -1;
     }
+
+    // Discard the last pending range
+    if (range.nb_blocks != 0)
+        return __discard_range_flush(&range);
     return 0;
 }
 
 /**
  * @brief Loop to truncate entry.
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param entry Pointer to CryptFS_Entry.
  * @param entry_id Structure, composed of the block number where a struct
  * CryptFS_Directory starts and the index of the entry within this current
@@ -174,7 +250,7 @@ static int __free_blocks(const unsigned char *aes_key, size_t new_blocks_needed,
  * @param new_size Size to truncate the entry with.
  * @return 0 when success, BLOCK_ERROR otherwise.
  */
-static int __entry_truncate_treatment(const unsigned char *aes_key,
+static int __entry_truncate_treatment(struct shlkfs_ctx *ctx,
                                       struct CryptFS_Entry *entry,
                                       struct CryptFS_Entry_ID entry_id,
                                       size_t new_size)
@@ -198,14 +274,14 @@ static int __entry_truncate_treatment(const unsigned char *aes_key,
 
         if (new_blocks_needed > actual_blocks_used)
         {
-            if (__create_new_blocks(aes_key, new_blocks_needed,
+            if (__create_new_blocks(ctx, new_blocks_needed,
                                     actual_blocks_used, entry, entry_id))
                 return BLOCK_ERROR;
         }
         else if (new_blocks_needed < actual_blocks_used
                  || new_blocks_needed == 0)
         {
-            if (__free_blocks(aes_key, new_blocks_needed, entry))
+            if (__free_blocks(ctx, new_blocks_needed, entry))
                 return BLOCK_ERROR;
         }
         // If the size changed but new_blocks_needed is the same
@@ -221,29 +297,31 @@ static int __entry_truncate_treatment(const unsigned char *aes_key,
     return 0;
 }
 
-struct CryptFS_Entry *get_entry_from_id(const unsigned char *aes_key,
+struct CryptFS_Entry *get_entry_from_id(struct shlkfs_ctx *ctx,
                                         struct CryptFS_Entry_ID entry_id)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     // Correct Entry ID if needed
-    if (goto_entry_in_directory(aes_key, &entry_id))
+    if (goto_entry_in_directory(ctx, &entry_id))
         return NULL;
 
     struct CryptFS_Entry *entry =
-        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, CRYPTFS_BLOCK_SIZE_BYTES);
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
     if (entry_id.directory_block == ROOT_ENTRY_BLOCK)
     {
-        if (read_blocks_with_decryption(aes_key, entry_id.directory_block, 1,
-                                        entry))
+        if (read_blocks_with_decryption(ctx->aes_key, entry_id.directory_block,
+                                        1, entry))
             return NULL;
     }
     else
     {
-        struct CryptFS_Directory *dir = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+        struct CryptFS_Directory *dir =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
-        if (read_blocks_with_decryption(aes_key, entry_id.directory_block, 1,
-                                        dir))
+        if (read_blocks_with_decryption(ctx->aes_key, entry_id.directory_block,
+                                        1, dir))
             return NULL;
         *entry = dir->entries[entry_id.directory_index];
         free(dir);
@@ -252,32 +330,34 @@ struct CryptFS_Entry *get_entry_from_id(const unsigned char *aes_key,
 }
 
 // TODO: Tests
-int write_entry_from_id(const unsigned char *aes_key,
+int write_entry_from_id(struct shlkfs_ctx *ctx,
                         struct CryptFS_Entry_ID entry_id,
                         struct CryptFS_Entry *entry)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     // Sanitize entry_id
-    if (goto_entry_in_directory(aes_key, &entry_id))
+    if (goto_entry_in_directory(ctx, &entry_id))
         return BLOCK_ERROR;
 
     if (entry_id.directory_block == ROOT_ENTRY_BLOCK)
     {
-        char *entry_block = xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1,
-                                           CRYPTFS_BLOCK_SIZE_BYTES);
+        char *entry_block =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
         memcpy(entry_block, entry, sizeof(struct CryptFS_Entry));
-        if (write_blocks_with_encryption(aes_key, entry_id.directory_block, 1,
-                                         entry_block))
+        if (write_blocks_with_encryption(ctx->aes_key, entry_id.directory_block,
+                                         1, entry_block))
             return BLOCK_ERROR;
         free(entry_block);
     }
     else
     {
         // Read the directory block
-        struct CryptFS_Directory *dir = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+        struct CryptFS_Directory *dir =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
-        if (read_blocks_with_decryption(aes_key, entry_id.directory_block, 1,
-                                        dir))
+        if (read_blocks_with_decryption(ctx->aes_key, entry_id.directory_block,
+                                        1, dir))
         {
             free(dir);
             return BLOCK_ERROR;
@@ -287,8 +367,8 @@ int write_entry_from_id(const unsigned char *aes_key,
         dir->entries[entry_id.directory_index] = *entry;
 
         // Write back the directory block
-        if (write_blocks_with_encryption(aes_key, entry_id.directory_block, 1,
-                                         dir))
+        if (write_blocks_with_encryption(ctx->aes_key, entry_id.directory_block,
+                                         1, dir))
         {
             free(dir);
             return BLOCK_ERROR;
@@ -300,10 +380,12 @@ int write_entry_from_id(const unsigned char *aes_key,
     return 0;
 }
 
-struct CryptFS_Entry_ID *get_entry_by_path(const unsigned char *aes_key,
+struct CryptFS_Entry_ID *get_entry_by_path(struct shlkfs_ctx *ctx,
                                            const char *path)
 {
-    if (path == NULL || strlen(path) == 0 || aes_key == NULL)
+    SHLKFS_CTX_SCOPE(ctx);
+
+    if (path == NULL || strlen(path) == 0 || ctx == NULL)
         return (void *)BLOCK_ERROR;
 
     // Copie du chemin pour éviter de modifier l'original
@@ -321,7 +403,7 @@ struct CryptFS_Entry_ID *get_entry_by_path(const unsigned char *aes_key,
     while (dir_name != NULL)
     {
         // Récupération de l'entrée actuelle
-        struct CryptFS_Entry *entry = get_entry_from_id(aes_key, *entry_id);
+        struct CryptFS_Entry *entry = get_entry_from_id(ctx, *entry_id);
 
         // Si l'entrée n'existe pas, renvoie une erreur
         if (!entry)
@@ -349,10 +431,10 @@ struct CryptFS_Entry_ID *get_entry_by_path(const unsigned char *aes_key,
         struct CryptFS_Entry_ID *test_entry_id = NULL;
         for (uint64_t i = 0; i < entry->size; i++)
         {
-            test_entry_id = goto_used_entry_in_directory(aes_key, *entry_id, i);
+            test_entry_id = goto_used_entry_in_directory(ctx, *entry_id, i);
 
             struct CryptFS_Entry *test_entry =
-                get_entry_from_id(aes_key, *test_entry_id);
+                get_entry_from_id(ctx, *test_entry_id);
 
             if (test_entry && strcmp(test_entry->name, dir_name) == 0)
             {
@@ -394,7 +476,7 @@ struct CryptFS_Entry_ID *get_entry_by_path(const unsigned char *aes_key,
  * - Get the base name of the entry to create. (the name of the file or
  * whatever)
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param path The path of the entry to create.
  * @param parent_dir_entry_id Parent directory of the future entry entry ID.
  * (returned)
@@ -404,13 +486,13 @@ struct CryptFS_Entry_ID *get_entry_by_path(const unsigned char *aes_key,
  * @param base_name Name of the entry to create.
  * (returned)
  */
-static int __create_entry_by_path(const unsigned char *aes_key,
+static int __create_entry_by_path(struct shlkfs_ctx *ctx,
                                   const char *path,
                                   struct CryptFS_Entry_ID **parent_dir_entry_id,
                                   char **base_name)
 {
     // Check if file already exists
-    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(aes_key, path);
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, path);
     switch ((uint64_t)entry_id)
     {
     case BLOCK_ERROR:
@@ -427,17 +509,13 @@ static int __create_entry_by_path(const unsigned char *aes_key,
     char *dir_name = dirname(path_copy);
 
     // Get the parent directory entry ID
-    *parent_dir_entry_id = get_entry_by_path(aes_key, dir_name);
+    *parent_dir_entry_id = get_entry_by_path(ctx, dir_name);
 
-    switch ((uint64_t)parent_dir_entry_id)
+    switch ((uint64_t)*parent_dir_entry_id)
     {
     case BLOCK_ERROR:
-        free(*parent_dir_entry_id);
-        free(entry_id);
         return BLOCK_ERROR;
     case ENTRY_NO_SUCH:
-        free(*parent_dir_entry_id);
-        free(entry_id);
         return ENTRY_NO_SUCH;
     default:
         // Get the basename of the path
@@ -450,15 +528,17 @@ static int __create_entry_by_path(const unsigned char *aes_key,
     return 0;
 }
 
-struct CryptFS_Entry_ID *create_file_by_path(const unsigned char *aes_key,
+struct CryptFS_Entry_ID *create_file_by_path(struct shlkfs_ctx *ctx,
                                              const char *path)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     // Create the empty file at the parent directory level
     struct CryptFS_Entry_ID *parent_dir_entry_id = NULL;
     char *base_name = NULL;
 
     switch (
-        __create_entry_by_path(aes_key, path, &parent_dir_entry_id, &base_name))
+        __create_entry_by_path(ctx, path, &parent_dir_entry_id, &base_name))
     {
     case BLOCK_ERROR:
         return (void *)BLOCK_ERROR;
@@ -470,14 +550,14 @@ struct CryptFS_Entry_ID *create_file_by_path(const unsigned char *aes_key,
         // Create the empty file (and remember its index in the parent
         // directory)
         uint32_t entry_index_in_dir =
-            entry_create_empty_file(aes_key, *parent_dir_entry_id, base_name);
+            entry_create_empty_file(ctx, *parent_dir_entry_id, base_name);
 
         if (entry_index_in_dir == (uint32_t)BLOCK_ERROR)
             return (void *)BLOCK_ERROR;
 
         // Get the parent directory entry.start_block (struct CryptFS_Directory)
         struct CryptFS_Entry *parent_dir_entry =
-            get_entry_from_id(aes_key, *parent_dir_entry_id);
+            get_entry_from_id(ctx, *parent_dir_entry_id);
         block_t parent_dir_entry_dir = parent_dir_entry->start_block;
         free(parent_dir_entry);
 
@@ -498,15 +578,17 @@ struct CryptFS_Entry_ID *create_file_by_path(const unsigned char *aes_key,
     return NULL;
 }
 
-struct CryptFS_Entry_ID *create_directory_by_path(const unsigned char *aes_key,
+struct CryptFS_Entry_ID *create_directory_by_path(struct shlkfs_ctx *ctx,
                                                   const char *path)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     // Create the empty directory at the parent directory level
     struct CryptFS_Entry_ID *parent_dir_entry_id = NULL;
     char *base_name = NULL;
 
     switch (
-        __create_entry_by_path(aes_key, path, &parent_dir_entry_id, &base_name))
+        __create_entry_by_path(ctx, path, &parent_dir_entry_id, &base_name))
     {
     case BLOCK_ERROR:
         return (void *)BLOCK_ERROR;
@@ -518,14 +600,14 @@ struct CryptFS_Entry_ID *create_directory_by_path(const unsigned char *aes_key,
         // Create the empty directory (and remember its index in the parent
         // directory)
         uint32_t entry_index_in_dir =
-            entry_create_directory(aes_key, *parent_dir_entry_id, base_name);
+            entry_create_directory(ctx, *parent_dir_entry_id, base_name);
 
         if (entry_index_in_dir == (uint32_t)BLOCK_ERROR)
             return (void *)BLOCK_ERROR;
 
         // Get the parent directory entry.start_block (struct CryptFS_Directory)
         struct CryptFS_Entry *parent_dir_entry =
-            get_entry_from_id(aes_key, *parent_dir_entry_id);
+            get_entry_from_id(ctx, *parent_dir_entry_id);
         block_t parent_dir_entry_dir = parent_dir_entry->start_block;
         free(parent_dir_entry);
 
@@ -545,16 +627,18 @@ struct CryptFS_Entry_ID *create_directory_by_path(const unsigned char *aes_key,
     return NULL;
 }
 
-struct CryptFS_Entry_ID *create_symlink_by_path(const unsigned char *aes_key,
+struct CryptFS_Entry_ID *create_symlink_by_path(struct shlkfs_ctx *ctx,
                                                 const char *path,
                                                 const char *symlink)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     // Create the empty symlink at the parent directory level
     struct CryptFS_Entry_ID *parent_dir_entry_id = NULL;
     char *base_name = NULL;
 
     switch (
-        __create_entry_by_path(aes_key, path, &parent_dir_entry_id, &base_name))
+        __create_entry_by_path(ctx, path, &parent_dir_entry_id, &base_name))
     {
     case BLOCK_ERROR:
         return (void *)BLOCK_ERROR;
@@ -566,14 +650,14 @@ struct CryptFS_Entry_ID *create_symlink_by_path(const unsigned char *aes_key,
         // Create the empty symlink (and remember its index in the parent
         // directory)
         uint32_t entry_index_in_dir = entry_create_symlink(
-            aes_key, *parent_dir_entry_id, base_name, symlink);
+            ctx, *parent_dir_entry_id, base_name, symlink);
 
         if (entry_index_in_dir == (uint32_t)BLOCK_ERROR)
             return (void *)BLOCK_ERROR;
 
         // Get the parent directory entry.start_block (struct CryptFS_Directory)
         struct CryptFS_Entry *parent_dir_entry =
-            get_entry_from_id(aes_key, *parent_dir_entry_id);
+            get_entry_from_id(ctx, *parent_dir_entry_id);
         block_t parent_dir_entry_dir = parent_dir_entry->start_block;
         free(parent_dir_entry);
 
@@ -593,16 +677,18 @@ struct CryptFS_Entry_ID *create_symlink_by_path(const unsigned char *aes_key,
     return NULL;
 }
 
-struct CryptFS_Entry_ID *create_hardlink_by_path(const unsigned char *aes_key,
+struct CryptFS_Entry_ID *create_hardlink_by_path(struct shlkfs_ctx *ctx,
                                                  const char *path,
                                                  const char *target_path)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     // Create the empty hardlink at the parent directory level
     struct CryptFS_Entry_ID *parent_dir_entry_id = NULL;
     char *base_name = NULL;
 
     switch (
-        __create_entry_by_path(aes_key, path, &parent_dir_entry_id, &base_name))
+        __create_entry_by_path(ctx, path, &parent_dir_entry_id, &base_name))
     {
     case BLOCK_ERROR:
         return (void *)BLOCK_ERROR;
@@ -613,7 +699,7 @@ struct CryptFS_Entry_ID *create_hardlink_by_path(const unsigned char *aes_key,
     default:
         // Get hardlink entry ID by path
         struct CryptFS_Entry_ID *hardlink_entry_id =
-            get_entry_by_path(aes_key, target_path);
+            get_entry_by_path(ctx, target_path);
 
         // If the target entry does not exist, return an error
         if (hardlink_entry_id == (void *)ENTRY_NO_SUCH)
@@ -625,14 +711,14 @@ struct CryptFS_Entry_ID *create_hardlink_by_path(const unsigned char *aes_key,
 
         // Create the hardlink (and remember its index in the parent directory)
         uint32_t entry_index_in_dir = entry_create_hardlink(
-            aes_key, *parent_dir_entry_id, base_name, *hardlink_entry_id);
+            ctx, *parent_dir_entry_id, base_name, *hardlink_entry_id);
 
         if (entry_index_in_dir == (uint32_t)BLOCK_ERROR)
             return (void *)BLOCK_ERROR;
 
         // Get the parent directory entry.start_block (struct CryptFS_Directory)
         struct CryptFS_Entry *parent_dir_entry =
-            get_entry_from_id(aes_key, *parent_dir_entry_id);
+            get_entry_from_id(ctx, *parent_dir_entry_id);
         block_t parent_dir_entry_dir = parent_dir_entry->start_block;
         free(parent_dir_entry);
 
@@ -653,10 +739,12 @@ struct CryptFS_Entry_ID *create_hardlink_by_path(const unsigned char *aes_key,
     return NULL;
 }
 
-int delete_entry_by_path(const unsigned char *aes_key, const char *path)
+int delete_entry_by_path(struct shlkfs_ctx *ctx, const char *path)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     // Get the entry ID of the entry to delete
-    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(aes_key, path);
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, path);
 
     // If the entry does not exist, return an error
     if (entry_id == (void *)ENTRY_NO_SUCH)
@@ -669,7 +757,7 @@ int delete_entry_by_path(const unsigned char *aes_key, const char *path)
 
     // Get the parent directory entry ID
     struct CryptFS_Entry_ID *parent_dir_entry_id =
-        get_entry_by_path(aes_key, parent_dir);
+        get_entry_by_path(ctx, parent_dir);
 
     // If there is an error here, this is fatal!
     if ((int64_t)parent_dir_entry_id < 0)
@@ -678,7 +766,7 @@ int delete_entry_by_path(const unsigned char *aes_key, const char *path)
         return BLOCK_ERROR;
     }
 
-    if (entry_delete(aes_key, *entry_id) != 0)
+    if (entry_delete(ctx, *entry_id) != 0)
     {
         free(entry_id);
         free(parent_dir_entry_id);
@@ -690,18 +778,20 @@ int delete_entry_by_path(const unsigned char *aes_key, const char *path)
     return 0;
 }
 
-int goto_entry_in_directory(const unsigned char *aes_key,
+int goto_entry_in_directory(struct shlkfs_ctx *ctx,
                             struct CryptFS_Entry_ID *entry_id)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     if (entry_id->directory_index > NB_ENTRIES_PER_BLOCK - 1)
     {
         int count = __blocks_needed_for_dir(entry_id->directory_index + 1);
         entry_id->directory_index =
             entry_id->directory_index % NB_ENTRIES_PER_BLOCK;
-        while (count > 1 && read_fat_offset(aes_key, entry_id->directory_block))
+        while (count > 1 && read_fat_offset(ctx, entry_id->directory_block))
         {
             entry_id->directory_block =
-                read_fat_offset(aes_key, entry_id->directory_block);
+                read_fat_offset(ctx, entry_id->directory_block);
             count--;
         }
         if (count > 1)
@@ -711,13 +801,14 @@ int goto_entry_in_directory(const unsigned char *aes_key,
 }
 
 struct CryptFS_Entry_ID *
-goto_used_entry_in_directory(const unsigned char *aes_key,
+goto_used_entry_in_directory(struct shlkfs_ctx *ctx,
                              struct CryptFS_Entry_ID directory_entry_id,
                              size_t index)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     // Get entry by id
-    struct CryptFS_Entry *entry =
-        get_entry_from_id(aes_key, directory_entry_id);
+    struct CryptFS_Entry *entry = get_entry_from_id(ctx, directory_entry_id);
 
     if (index + 1 > entry->size)
     {
@@ -735,13 +826,13 @@ goto_used_entry_in_directory(const unsigned char *aes_key,
         if (directory_entry_id.directory_index > NB_ENTRIES_PER_BLOCK - 1)
         {
             directory_entry_id.directory_block =
-                read_fat_offset(aes_key, directory_entry_id.directory_block);
+                read_fat_offset(ctx, directory_entry_id.directory_block);
             directory_entry_id.directory_index = 0;
         }
         else
         {
             // Get entry by id
-            entry = get_entry_from_id(aes_key, directory_entry_id);
+            entry = get_entry_from_id(ctx, directory_entry_id);
             bool is_used = entry->used == 1;
             free(entry);
             if (is_used)
@@ -762,27 +853,29 @@ goto_used_entry_in_directory(const unsigned char *aes_key,
     return entry_id;
 }
 
-int entry_truncate(const unsigned char *aes_key,
+int entry_truncate(struct shlkfs_ctx *ctx,
                    struct CryptFS_Entry_ID entry_id, size_t new_size)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     if (entry_id.directory_block == ROOT_ENTRY_BLOCK)
     {
         // Allocate struct for reading directory_block
-        struct CryptFS_Entry *root_entry = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, CRYPTFS_BLOCK_SIZE_BYTES);
+        struct CryptFS_Entry *root_entry =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
         // Read the root Entry (corner case)
-        if (read_blocks_with_decryption(aes_key, entry_id.directory_block, 1,
-                                        root_entry))
+        if (read_blocks_with_decryption(ctx->aes_key, entry_id.directory_block,
+                                        1, root_entry))
             goto err_truncate_entry_root;
 
         // Truncate treatment of the Entry
-        if (__entry_truncate_treatment(aes_key, root_entry, entry_id, new_size))
+        if (__entry_truncate_treatment(ctx, root_entry, entry_id, new_size))
             goto err_truncate_entry_root;
 
         // Write Back entry changes in ROO_DIR_BLOCK
-        if (write_blocks_with_encryption(aes_key, entry_id.directory_block, 1,
-                                         root_entry))
+        if (write_blocks_with_encryption(ctx->aes_key, entry_id.directory_block,
+                                         1, root_entry))
             goto err_truncate_entry;
 
         free(root_entry);
@@ -794,28 +887,28 @@ int entry_truncate(const unsigned char *aes_key,
     }
     else
     {
-        if (goto_entry_in_directory(aes_key, &entry_id))
+        if (goto_entry_in_directory(ctx, &entry_id))
             return BLOCK_ERROR;
 
         // allocate struct for reading directory_block
-        struct CryptFS_Directory *dir = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+        struct CryptFS_Directory *dir =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
-        if (read_blocks_with_decryption(aes_key, entry_id.directory_block, 1,
-                                        dir))
+        if (read_blocks_with_decryption(ctx->aes_key, entry_id.directory_block,
+                                        1, dir))
             goto err_truncate_entry;
 
         // Get the correct Entry
         struct CryptFS_Entry entry = dir->entries[entry_id.directory_index];
 
         // Truncate treatment of the Entry
-        if (__entry_truncate_treatment(aes_key, &entry, entry_id, new_size))
+        if (__entry_truncate_treatment(ctx, &entry, entry_id, new_size))
             goto err_truncate_entry;
 
         // Write Back entry changes in BLOCK
         dir->entries[entry_id.directory_index] = entry;
-        if (write_blocks_with_encryption(aes_key, entry_id.directory_block, 1,
-                                         dir))
+        if (write_blocks_with_encryption(ctx->aes_key, entry_id.directory_block,
+                                         1, dir))
             goto err_truncate_entry;
 
         free(dir);
@@ -828,20 +921,22 @@ int entry_truncate(const unsigned char *aes_key,
     // Do nothing if new_size is equal to entry.size
 }
 
-int entry_write_buffer_from(const unsigned char *aes_key,
+int entry_write_buffer_from(struct shlkfs_ctx *ctx,
                             struct CryptFS_Entry_ID file_entry_id,
                             size_t start_from, const void *buffer, size_t count)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     // Find the real block and index
-    if (goto_entry_in_directory(aes_key, &file_entry_id))
+    if (goto_entry_in_directory(ctx, &file_entry_id))
         return BLOCK_ERROR;
 
     // allocate struct for reading directory_block
-    struct CryptFS_Directory *dir = xaligned_alloc(
-        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+    struct CryptFS_Directory *dir =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
-    if (read_blocks_with_decryption(aes_key, file_entry_id.directory_block, 1,
-                                    dir))
+    if (read_blocks_with_decryption(ctx->aes_key, file_entry_id.directory_block,
+                                    1, dir))
         goto err_write_buffer_entry;
 
     // Get the correct Entry
@@ -854,50 +949,53 @@ int entry_write_buffer_from(const unsigned char *aes_key,
     size_t sum_writing = start_from + count;
     if (sum_writing > entry.size)
     {
-        entry_truncate(aes_key, file_entry_id, sum_writing);
+        entry_truncate(ctx, file_entry_id, sum_writing);
         // update entry
-        read_blocks_with_decryption(aes_key, file_entry_id.directory_block, 1,
-                                    dir);
+        read_blocks_with_decryption(ctx->aes_key, file_entry_id.directory_block,
+                                    1, dir);
         entry = dir->entries[file_entry_id.directory_index];
     }
 
+    // Go to the block to start writing, start_from becomes the offset in
+    // this block
     block_t s_block = entry.start_block;
-    int count_blocks = start_from
-        / CRYPTFS_BLOCK_SIZE_BYTES; // Number of the block to start writing
-    // int r_start = start_from % CRYPTFS_BLOCK_SIZE_BYTES; // Relative starting
-    // index to the start writing block
-    while (count_blocks > 1 && read_fat_offset(aes_key, s_block))
+    size_t count_blocks = start_from / get_block_size();
+    start_from %= get_block_size();
+    while (count_blocks > 0)
     {
-        s_block = read_fat_offset(aes_key, s_block);
+        s_block = read_fat_offset(ctx, s_block);
+        if ((uint32_t)s_block == (uint32_t)BLOCK_ERROR
+            || (uint32_t)s_block == (uint32_t)BLOCK_END)
+            goto err_write_buffer_entry;
         count_blocks--;
     }
-    if (count_blocks > 1)
-        goto err_write_buffer_entry;
 
     // Loop to write Buffer in buffer_blocks
 
     char *block_buffer =
-        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, CRYPTFS_BLOCK_SIZE_BYTES);
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
     // If block is empty, initialize buffer to avoid reading in STACK
-    if (read_blocks_with_decryption(aes_key, s_block, 1, block_buffer))
-        memset(block_buffer, '\0', CRYPTFS_BLOCK_SIZE_BYTES);
+    if (read_blocks_with_decryption(ctx->aes_key, s_block, 1, block_buffer))
+        memset(block_buffer, '\0', get_block_size());
 
     size_t modulo_index = 0;
     for (size_t i = 0; i < count; i++)
     {
-        if (start_from + modulo_index >= CRYPTFS_BLOCK_SIZE_BYTES)
+        if (start_from + modulo_index >= get_block_size())
         {
             // Write back the block_buffer
-            if (write_blocks_with_encryption(aes_key, s_block, 1, block_buffer))
+            if (write_blocks_with_encryption(ctx->aes_key, s_block, 1,
+                                             block_buffer))
                 goto err_write_buffer_entry_2;
-            s_block = read_fat_offset(aes_key, s_block);
+            s_block = read_fat_offset(ctx, s_block);
             if (s_block == (block_t)BLOCK_ERROR)
                 goto err_write_buffer_entry_2;
             start_from = 0;
             modulo_index = 0;
-            if (read_blocks_with_decryption(aes_key, s_block, 1, block_buffer))
-                memset(block_buffer, '\0', CRYPTFS_BLOCK_SIZE_BYTES);
+            if (read_blocks_with_decryption(ctx->aes_key, s_block, 1,
+                                            block_buffer))
+                memset(block_buffer, '\0', get_block_size());
         }
 
         block_buffer[start_from + modulo_index] = ((char *)buffer)[i];
@@ -905,14 +1003,14 @@ int entry_write_buffer_from(const unsigned char *aes_key,
     }
 
     // Write back the last block_buffer
-    if (write_blocks_with_encryption(aes_key, s_block, 1, block_buffer))
+    if (write_blocks_with_encryption(ctx->aes_key, s_block, 1, block_buffer))
         goto err_write_buffer_entry_2;
 
     // Update entry timestamp
     entry.mtime = (uint32_t)time(NULL);
     dir->entries[file_entry_id.directory_index] = entry;
-    if (write_blocks_with_encryption(aes_key, file_entry_id.directory_block, 1,
-                                     dir))
+    if (write_blocks_with_encryption(ctx->aes_key,
+                                     file_entry_id.directory_block, 1, dir))
         goto err_write_buffer_entry_2;
 
     free(block_buffer);
@@ -929,37 +1027,41 @@ err_write_buffer_entry_2:
     return BLOCK_ERROR;
 }
 
-int entry_write_buffer(const unsigned char *aes_key,
+int entry_write_buffer(struct shlkfs_ctx *ctx,
                        struct CryptFS_Entry_ID file_entry_id,
                        const void *buffer, size_t count)
 {
-    return entry_write_buffer_from(aes_key, file_entry_id, 0, buffer, count);
+    SHLKFS_CTX_SCOPE(ctx);
+
+    return entry_write_buffer_from(ctx, file_entry_id, 0, buffer, count);
 }
 
-ssize_t entry_read_raw_data(const unsigned char *aes_key,
+ssize_t entry_read_raw_data(struct shlkfs_ctx *ctx,
                             struct CryptFS_Entry_ID file_entry_id,
                             size_t start_from, void *buf, size_t count)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     ssize_t result = 0;
 
     // Find the real block and index
-    if (goto_entry_in_directory(aes_key, &file_entry_id))
+    if (goto_entry_in_directory(ctx, &file_entry_id))
     {
         print_error("entry_read_raw_data: goto_entry_in_directory(%p,%p)\n",
-                    aes_key, &file_entry_id);
+                    ctx, &file_entry_id);
         return BLOCK_ERROR;
     }
 
     // allocate struct for reading directory_block
-    struct CryptFS_Directory *dir = xaligned_alloc(
-        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+    struct CryptFS_Directory *dir =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
-    if (read_blocks_with_decryption(aes_key, file_entry_id.directory_block, 1,
-                                    dir))
+    if (read_blocks_with_decryption(ctx->aes_key, file_entry_id.directory_block,
+                                    1, dir))
     {
         print_error(
             "entry_read_raw_data: read_blocks_with_decryption(%p,%lu,%p,%p)\n",
-            aes_key, file_entry_id.directory_block, 1, dir);
+            ctx, file_entry_id.directory_block, 1, dir);
         goto err_read_entry;
     }
 
@@ -977,80 +1079,90 @@ ssize_t entry_read_raw_data(const unsigned char *aes_key,
     if (entry.size < start_from + count)
     {
         free(dir);
-        return entry_read_raw_data(aes_key, file_entry_id, start_from, buf,
+        return entry_read_raw_data(ctx, file_entry_id, start_from, buf,
                                    entry.size - start_from);
     }
 
     sblock_t s_block = entry.start_block;
-    while (start_from >= CRYPTFS_BLOCK_SIZE_BYTES)
+    while (start_from >= get_block_size())
     {
-        s_block = read_fat_offset(aes_key, s_block);
+        s_block = read_fat_offset(ctx, s_block);
         if (s_block < 0)
         {
             print_error("entry_read_raw_data: read_fat_offset(%p,%lu)\n",
-                        aes_key, s_block);
+                        ctx, s_block);
             goto err_read_entry;
         }
-        start_from -= CRYPTFS_BLOCK_SIZE_BYTES;
+        start_from -= get_block_size();
     }
 
-    // allocate block_buffer to read block
+    // Gather the blocks holding [start_from, start_from + count) from the FAT
+    // chain, so that they are read with a single batch (contiguous blocks are
+    // merged in a single request)
+    size_t nb_blocks =
+        (start_from + count + get_block_size() - 1) / get_block_size();
+    struct block_request *requests =
+        xcalloc(nb_blocks, sizeof(struct block_request));
     char *block_buffer =
-        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, CRYPTFS_BLOCK_SIZE_BYTES);
-
-    // If block is empty, return BLOCK_ERROR
-    if (read_blocks_with_decryption(aes_key, s_block, 1, block_buffer))
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, nb_blocks, get_block_size());
+    size_t nb_requests = 0;
+    for (size_t i = 0; i < nb_blocks; i++)
     {
-        print_error(
-            "entry_read_raw_data: read_blocks_with_decryption(%p,%lu,%p,%p)\n",
-            aes_key, s_block, 1, block_buffer);
-        goto err_read_entry2;
-    }
-
-    size_t modulo_index = 0;
-    for (size_t i = 0; i < count; i++)
-    {
-        if (start_from + modulo_index >= CRYPTFS_BLOCK_SIZE_BYTES)
+        if (i > 0)
         {
-            s_block = read_fat_offset(aes_key, s_block);
-            if (s_block == (sblock_t)BLOCK_ERROR)
+            s_block = read_fat_offset(ctx, s_block);
+            if ((uint32_t)s_block == (uint32_t)BLOCK_ERROR
+                || (uint32_t)s_block == (uint32_t)BLOCK_END)
             {
                 print_error("entry_read_raw_data: read_fat_offset(%p,%lu)\n",
-                            aes_key, s_block);
-                goto err_read_entry2;
-            }
-            start_from = 0;
-            modulo_index = 0;
-            if (read_blocks_with_decryption(aes_key, s_block, 1, block_buffer))
-            {
-                print_error("entry_read_raw_data: "
-                            "read_blocks_with_decryption(%p,%lu,%p,%p)\n",
-                            aes_key, s_block, 1, block_buffer);
+                            ctx, s_block);
                 goto err_read_entry2;
             }
         }
-        ((char *)buf)[i] = block_buffer[start_from + modulo_index];
-        modulo_index++;
-        result++;
+
+        if (nb_requests > 0
+            && requests[nb_requests - 1].start_block
+                    + requests[nb_requests - 1].nb_blocks
+                == (block_t)s_block)
+            requests[nb_requests - 1].nb_blocks++;
+        else
+            requests[nb_requests++] = (struct block_request){
+                .start_block = s_block,
+                .nb_blocks = 1,
+                .buffer = block_buffer + i * get_block_size(),
+            };
+    }
+
+    if (read_blocks_batch_with_decryption(ctx->aes_key, requests, nb_requests))
+    {
+        print_error("entry_read_raw_data: "
+                    "read_blocks_batch_with_decryption(%p,%p,%lu)\n",
+                    ctx, requests, nb_requests);
+        goto err_read_entry2;
     }
 
+    memcpy(buf, block_buffer + start_from, count);
+    result = count;
+
     // Update entry timestamp
     entry.atime = (uint32_t)time(NULL);
     dir->entries[file_entry_id.directory_index] = entry;
-    if (write_blocks_with_encryption(aes_key, file_entry_id.directory_block, 1,
-                                     dir))
+    if (write_blocks_with_encryption(ctx->aes_key,
+                                     file_entry_id.directory_block, 1, dir))
     {
         print_error(
             "entry_read_raw_data: write_blocks_with_encryption(%p,%lu,%p,%p)\n",
-            aes_key, file_entry_id.directory_block, 1, dir);
+            ctx, file_entry_id.directory_block, 1, dir);
         goto err_read_entry2;
     }
 
     free(dir);
+    free(requests);
     free(block_buffer);
     return result;
 
 err_read_entry2:
+    free(requests);
     free(block_buffer);
 err_read_entry:
     free(dir);
@@ -1060,22 +1172,22 @@ err_read_entry:
 /**
  * @brief Entry_delete routine (same for root or other)
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param parent_dir_entry Pointer to the CryptFS_Entry of the parent directory.
  * @param new_size Size to truncate the entry with.
  * @return 0 when success, BLOCK_ERROR otherwise.
  */
-// static int __entry_delete_routine(const unsigned char *aes_key,
+// static int __entry_delete_routine(struct shlkfs_ctx *ctx,
 //                                   struct CryptFS_Entry *parent_dir_entry,
 //                                   uint32_t entry_index)
 // {
 //     block_t s_block = parent_dir_entry->start_block;
 //     struct CryptFS_Entry_ID entry_id = { s_block, entry_index };
-//     goto_entry_in_directory(aes_key, &entry_id);
+//     goto_entry_in_directory(ctx, &entry_id);
 
 //     struct CryptFS_Directory *parent_dir = xaligned_alloc(
 //         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
-//     if (read_blocks_with_decryption(aes_key, s_block, 1, parent_dir))
+//     if (read_blocks_with_decryption(ctx->aes_key, s_block, 1, parent_dir))
 //         goto err_entry_delete;
 
 //     // FIXME: Overflow in case of entry_index > NB_ENTRIES_PER_BLOCK?
@@ -1087,15 +1199,15 @@ err_read_entry:
 //         || entry.used == 0)
 //         goto err_entry_delete;
 
-//     if (entry_truncate(aes_key, entry_id, 0))
+//     if (entry_truncate(ctx, entry_id, 0))
 //         goto err_entry_delete;
 
 //     // Update entry;
-//     read_blocks_with_decryption(aes_key, s_block, 1, parent_dir);
+//     read_blocks_with_decryption(ctx->aes_key, s_block, 1, parent_dir);
 //     entry = parent_dir->entries[entry_index];
 //     entry.used = 0;
 //     parent_dir->entries[entry_index] = entry;
-//     write_blocks_with_encryption(aes_key, s_block, 1, parent_dir);
+//     write_blocks_with_encryption(ctx->aes_key, s_block, 1, parent_dir);
 
 //     free(parent_dir);
 //     return 0;
@@ -1105,8 +1217,10 @@ err_read_entry:
 //     return BLOCK_ERROR;
 // }
 
-int entry_delete(const unsigned char *aes_key, struct CryptFS_Entry_ID entry_id)
+int entry_delete(struct shlkfs_ctx *ctx, struct CryptFS_Entry_ID entry_id)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     if (entry_id.directory_block == ROOT_ENTRY_BLOCK)
     {
         // Can't delete root directory
@@ -1114,9 +1228,9 @@ int entry_delete(const unsigned char *aes_key, struct CryptFS_Entry_ID entry_id)
     }
 
     // Allocate struct for reading the directory_block where is the entry_id
-    struct CryptFS_Directory *dir_block_buff = xaligned_alloc(
-        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
-    read_blocks_with_decryption(aes_key, entry_id.directory_block, 1,
+    struct CryptFS_Directory *dir_block_buff =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    read_blocks_with_decryption(ctx->aes_key, entry_id.directory_block, 1,
                                 dir_block_buff);
 
     // Check the entry_id type
@@ -1133,32 +1247,32 @@ int entry_delete(const unsigned char *aes_key, struct CryptFS_Entry_ID entry_id)
         dir_block_buff->current_directory_entry;
 
     struct CryptFS_Entry *dir_entry =
-        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, CRYPTFS_BLOCK_SIZE_BYTES);
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
     // Update Directory Entry
     if (dir_entry_id.directory_block == ROOT_ENTRY_BLOCK)
     {
         // If the actual directory is the Root, then the entry is tacking the
         // entire block
-        read_blocks_with_decryption(aes_key, dir_entry_id.directory_block, 1,
-                                    dir_entry);
+        read_blocks_with_decryption(ctx->aes_key, dir_entry_id.directory_block,
+                                    1, dir_entry);
         dir_entry->size--;
-        write_blocks_with_encryption(aes_key, dir_entry_id.directory_block, 1,
-                                     dir_entry);
+        write_blocks_with_encryption(ctx->aes_key, dir_entry_id.directory_block,
+                                     1, dir_entry);
     }
     else
     {
         // Read block where the directory Entry is stocked
-        read_blocks_with_decryption(aes_key, dir_entry_id.directory_block, 1,
-                                    dir_block_buff);
+        read_blocks_with_decryption(ctx->aes_key, dir_entry_id.directory_block,
+                                    1, dir_block_buff);
         *dir_entry = dir_block_buff->entries[dir_entry_id.directory_index];
         dir_entry->size--;
         dir_block_buff->entries[dir_entry_id.directory_index] = *dir_entry;
-        write_blocks_with_encryption(aes_key, dir_entry_id.directory_block, 1,
-                                     dir_block_buff);
+        write_blocks_with_encryption(ctx->aes_key, dir_entry_id.directory_block,
+                                     1, dir_block_buff);
     }
 
-    entry_truncate(aes_key, entry_id, 0);
+    entry_truncate(ctx, entry_id, 0);
 
     free(dir_block_buff);
     free(dir_entry);
@@ -1168,7 +1282,7 @@ int entry_delete(const unsigned char *aes_key, struct CryptFS_Entry_ID entry_id)
 /**
  * @brief Routine called by entry_create_empty_file
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param entry Pointer of the parent directory CryptFS_Entry. (Used to modify
  * its metadata after adding entry)
  * @param name Name of the empty file.
@@ -1179,31 +1293,32 @@ int entry_delete(const unsigned char *aes_key, struct CryptFS_Entry_ID entry_id)
  * @return 0 when success, BLOCK_ERROR otherwise.
  */
 static int
-__entry_create_empty_file_routine(const unsigned char *aes_key,
+__entry_create_empty_file_routine(struct shlkfs_ctx *ctx,
                                   struct CryptFS_Entry *entry, const char *name,
                                   struct CryptFS_Entry_ID parent_dir_entry_id)
 {
     uint32_t index = 0;
 
     // Find free index in Directory
-    struct CryptFS_Directory *parent_dir = xaligned_alloc(
-        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+    struct CryptFS_Directory *parent_dir =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
     block_t s_block = entry->start_block;
-    read_blocks_with_decryption(aes_key, s_block, 1, parent_dir);
+    read_blocks_with_decryption(ctx->aes_key, s_block, 1, parent_dir);
     while (parent_dir->entries[index % NB_ENTRIES_PER_BLOCK].used != 0)
     {
         index++;
         if (index % NB_ENTRIES_PER_BLOCK == 0)
         {
-            block_t tmp_block = read_fat_offset(aes_key, s_block);
+            block_t tmp_block = read_fat_offset(ctx, s_block);
             if (tmp_block == (uint32_t)BLOCK_END)
             {
-                entry_truncate(aes_key, parent_dir_entry_id, entry->size + 1);
-                tmp_block = read_fat_offset(aes_key, s_block);
+                entry_truncate(ctx, parent_dir_entry_id, entry->size + 1);
+                tmp_block = read_fat_offset(ctx, s_block);
             }
             s_block = tmp_block;
-            if (read_blocks_with_decryption(aes_key, s_block, 1, parent_dir))
+            if (read_blocks_with_decryption(ctx->aes_key, s_block, 1,
+                                            parent_dir))
                 goto err_create_file;
         }
     }
@@ -1225,7 +1340,7 @@ __entry_create_empty_file_routine(const unsigned char *aes_key,
     parent_dir->entries[index % NB_ENTRIES_PER_BLOCK] = new_file;
 
     // Write the block
-    write_blocks_with_encryption(aes_key, s_block, 1, parent_dir);
+    write_blocks_with_encryption(ctx->aes_key, s_block, 1, parent_dir);
 
     free(parent_dir);
     return index;
@@ -1235,38 +1350,41 @@ err_create_file:
     return BLOCK_ERROR;
 }
 
-uint32_t entry_create_empty_file(const unsigned char *aes_key,
+uint32_t entry_create_empty_file(struct shlkfs_ctx *ctx,
                                  struct CryptFS_Entry_ID parent_dir_entry_id,
                                  const char *name)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     uint32_t index;
 
     if (parent_dir_entry_id.directory_block == ROOT_ENTRY_BLOCK)
     {
         // Allocate struct for reading directory_block
-        struct CryptFS_Entry *root_entry = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, CRYPTFS_BLOCK_SIZE_BYTES);
+        struct CryptFS_Entry *root_entry =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
         read_blocks_with_decryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
         int initiated =
             0; // if 0 = directory didn't initialized here, 1 if it init here
         if (root_entry->size == 0)
         {
-            entry_truncate(aes_key, parent_dir_entry_id, 1);
-            read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            entry_truncate(ctx, parent_dir_entry_id, 1);
+            read_blocks_with_decryption(ctx->aes_key,
+                                        parent_dir_entry_id.directory_block, 1,
+                                        root_entry);
             root_entry->size--; // update size only at the end if succes of
                                 // adding file
         }
 
-        int res = __entry_create_empty_file_routine(aes_key, root_entry, name,
+        int res = __entry_create_empty_file_routine(ctx, root_entry, name,
                                                     parent_dir_entry_id);
 
         if (res == BLOCK_ERROR)
         {
             if (initiated)
-                entry_truncate(aes_key, parent_dir_entry_id, 0);
+                entry_truncate(ctx, parent_dir_entry_id, 0);
             goto err_create_file_root;
         }
 
@@ -1275,7 +1393,7 @@ uint32_t entry_create_empty_file(const unsigned char *aes_key,
         // Update Entry
         root_entry->size++;
         write_blocks_with_encryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
 
         free(root_entry);
         return index;
@@ -1286,14 +1404,14 @@ uint32_t entry_create_empty_file(const unsigned char *aes_key,
     }
     else
     {
-        if (goto_entry_in_directory(aes_key, &parent_dir_entry_id))
+        if (goto_entry_in_directory(ctx, &parent_dir_entry_id))
             return BLOCK_ERROR;
         // allocate struct for reading directory_block
-        struct CryptFS_Directory *dir = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+        struct CryptFS_Directory *dir =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
         if (read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, dir))
+                ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir))
             goto err_create_file;
 
         // Get the parent_directory
@@ -1307,21 +1425,21 @@ uint32_t entry_create_empty_file(const unsigned char *aes_key,
             0; // if 0 = directory didn't initialized here, 1 if it init here
         if (entry.size == 0)
         {
-            entry_truncate(aes_key, parent_dir_entry_id, 1);
+            entry_truncate(ctx, parent_dir_entry_id, 1);
             read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, dir);
+                ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir);
             entry = dir->entries[parent_dir_entry_id.directory_index];
             entry.size--; // update size only at the end if succes of adding
         }
 
         // Routine
-        int res = __entry_create_empty_file_routine(aes_key, &entry, name,
+        int res = __entry_create_empty_file_routine(ctx, &entry, name,
                                                     parent_dir_entry_id);
 
         if (res == BLOCK_ERROR)
         {
             if (initiated)
-                entry_truncate(aes_key, parent_dir_entry_id, 0);
+                entry_truncate(ctx, parent_dir_entry_id, 0);
             goto err_create_file;
         }
 
@@ -1330,7 +1448,7 @@ uint32_t entry_create_empty_file(const unsigned char *aes_key,
         entry.size++;
         dir->entries[parent_dir_entry_id.directory_index] = entry;
         write_blocks_with_encryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, dir);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir);
 
         free(dir);
         return index;
@@ -1344,7 +1462,7 @@ uint32_t entry_create_empty_file(const unsigned char *aes_key,
 /**
  * @brief Routine called by entry_create_dir
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param entry Pointer of the parent directory CryptFS_Entry. (Used to modify
  * its metadata after adding entry)
  * @param name Name of the future new directory.
@@ -1355,7 +1473,7 @@ uint32_t entry_create_empty_file(const unsigned char *aes_key,
  * @return 0 when success, BLOCK_ERROR otherwise.
  */
 static int
-__entry_create_dir_routine(const unsigned char *aes_key,
+__entry_create_dir_routine(struct shlkfs_ctx *ctx,
                            struct CryptFS_Entry *entry, const char *name,
                            struct CryptFS_Entry_ID parent_dir_entry_id)
 {
@@ -1364,24 +1482,25 @@ __entry_create_dir_routine(const unsigned char *aes_key,
         return BLOCK_ERROR;
 
     // Find free index in Directory
-    struct CryptFS_Directory *parent_dir = xaligned_alloc(
-        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+    struct CryptFS_Directory *parent_dir =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
     block_t s_block = entry->start_block;
-    read_blocks_with_decryption(aes_key, s_block, 1, parent_dir);
+    read_blocks_with_decryption(ctx->aes_key, s_block, 1, parent_dir);
     while (parent_dir->entries[index % NB_ENTRIES_PER_BLOCK].used != 0)
     {
         index++;
         if (index % NB_ENTRIES_PER_BLOCK == 0)
         {
-            block_t tmp_block = read_fat_offset(aes_key, s_block);
+            block_t tmp_block = read_fat_offset(ctx, s_block);
             if (tmp_block == (uint32_t)BLOCK_END)
             {
-                entry_truncate(aes_key, parent_dir_entry_id, entry->size + 1);
-                tmp_block = read_fat_offset(aes_key, s_block);
+                entry_truncate(ctx, parent_dir_entry_id, entry->size + 1);
+                tmp_block = read_fat_offset(ctx, s_block);
             }
             s_block = tmp_block;
-            if (read_blocks_with_decryption(aes_key, s_block, 1, parent_dir))
+            if (read_blocks_with_decryption(ctx->aes_key, s_block, 1,
+                                            parent_dir))
                 goto err_create_file;
         }
     }
@@ -1403,7 +1522,7 @@ __entry_create_dir_routine(const unsigned char *aes_key,
     parent_dir->entries[index % NB_ENTRIES_PER_BLOCK] = new_dir;
 
     // Write the block
-    write_blocks_with_encryption(aes_key, s_block, 1, parent_dir);
+    write_blocks_with_encryption(ctx->aes_key, s_block, 1, parent_dir);
 
     free(parent_dir);
     return index;
@@ -1413,36 +1532,39 @@ err_create_file:
     return BLOCK_ERROR;
 }
 
-uint32_t entry_create_directory(const unsigned char *aes_key,
+uint32_t entry_create_directory(struct shlkfs_ctx *ctx,
                                 struct CryptFS_Entry_ID parent_dir_entry_id,
                                 const char *name)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     uint32_t index;
 
     if (parent_dir_entry_id.directory_block == ROOT_ENTRY_BLOCK)
     {
         // Allocate struct for reading directory_block
-        struct CryptFS_Entry *root_entry = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, CRYPTFS_BLOCK_SIZE_BYTES);
+        struct CryptFS_Entry *root_entry =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
         read_blocks_with_decryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
         int initiated =
             0; // if 0 = directory didn't initialized here, 1 if it init here
         if (root_entry->size == 0)
         {
-            entry_truncate(aes_key, parent_dir_entry_id, 1);
-            read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            entry_truncate(ctx, parent_dir_entry_id, 1);
+            read_blocks_with_decryption(ctx->aes_key,
+                                        parent_dir_entry_id.directory_block, 1,
+                                        root_entry);
             root_entry
                 ->size--; // update size only at the end if succes of adding
         }
-        int res = __entry_create_dir_routine(aes_key, root_entry, name,
+        int res = __entry_create_dir_routine(ctx, root_entry, name,
                                              parent_dir_entry_id);
         if (res == BLOCK_ERROR)
         {
             if (initiated)
-                entry_truncate(aes_key, parent_dir_entry_id, 0);
+                entry_truncate(ctx, parent_dir_entry_id, 0);
             goto err_create_file_root;
         }
         index = (uint32_t)res;
@@ -1450,7 +1572,7 @@ uint32_t entry_create_directory(const unsigned char *aes_key,
         // Update Entry
         root_entry->size++;
         write_blocks_with_encryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
 
         free(root_entry);
         return index;
@@ -1461,14 +1583,14 @@ uint32_t entry_create_directory(const unsigned char *aes_key,
     }
     else
     {
-        if (goto_entry_in_directory(aes_key, &parent_dir_entry_id))
+        if (goto_entry_in_directory(ctx, &parent_dir_entry_id))
             return BLOCK_ERROR;
         // allocate struct for reading directory_block
-        struct CryptFS_Directory *dir = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+        struct CryptFS_Directory *dir =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
         if (read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, dir))
+                ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir))
             goto err_create_file;
 
         // Get the parent_directory
@@ -1482,20 +1604,20 @@ uint32_t entry_create_directory(const unsigned char *aes_key,
             0; // if 0 = directory didn't initialized here, 1 if it init here
         if (entry.size == 0)
         {
-            entry_truncate(aes_key, parent_dir_entry_id, 1);
+            entry_truncate(ctx, parent_dir_entry_id, 1);
             read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, dir);
+                ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir);
             entry = dir->entries[parent_dir_entry_id.directory_index];
             entry.size--; // update size only at the end if succes of adding
         }
 
         // Routine
-        int res = __entry_create_dir_routine(aes_key, &entry, name,
+        int res = __entry_create_dir_routine(ctx, &entry, name,
                                              parent_dir_entry_id);
         if (res == BLOCK_ERROR)
         {
             if (initiated)
-                entry_truncate(aes_key, parent_dir_entry_id, 0);
+                entry_truncate(ctx, parent_dir_entry_id, 0);
             goto err_create_file;
         }
 
@@ -1504,7 +1626,7 @@ uint32_t entry_create_directory(const unsigned char *aes_key,
         entry.size++;
         dir->entries[parent_dir_entry_id.directory_index] = entry;
         write_blocks_with_encryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, dir);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir);
 
         free(dir);
         return index;
@@ -1518,7 +1640,7 @@ uint32_t entry_create_directory(const unsigned char *aes_key,
 /**
  * @brief Routine called by entry_create_hardlink
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param entry Pointer of the parent directory CryptFS_Entry. (Used to modify
  * its metadata after adding entry)
  * @param name Name of the future hardlink.
@@ -1530,7 +1652,7 @@ uint32_t entry_create_directory(const unsigned char *aes_key,
  * @return 0 when success, BLOCK_ERROR otherwise.
  */
 static int
-__entry_create_hardlink_routine(const unsigned char *aes_key,
+__entry_create_hardlink_routine(struct shlkfs_ctx *ctx,
                                 struct CryptFS_Entry *entry, const char *name,
                                 struct CryptFS_Entry_ID parent_dir_entry_id,
                                 struct CryptFS_Entry entry_to_link)
@@ -1540,24 +1662,25 @@ __entry_create_hardlink_routine(const unsigned char *aes_key,
         return BLOCK_ERROR;
 
     // Find free index in Directory
-    struct CryptFS_Directory *parent_dir = xaligned_alloc(
-        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+    struct CryptFS_Directory *parent_dir =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
     block_t s_block = entry->start_block;
-    read_blocks_with_decryption(aes_key, s_block, 1, parent_dir);
+    read_blocks_with_decryption(ctx->aes_key, s_block, 1, parent_dir);
     while (parent_dir->entries[index % NB_ENTRIES_PER_BLOCK].used != 0)
     {
         index++;
         if (index % NB_ENTRIES_PER_BLOCK == 0)
         {
-            block_t tmp_block = read_fat_offset(aes_key, s_block);
+            block_t tmp_block = read_fat_offset(ctx, s_block);
             if (tmp_block == (uint32_t)BLOCK_END)
             {
-                entry_truncate(aes_key, parent_dir_entry_id, entry->size + 1);
-                tmp_block = read_fat_offset(aes_key, s_block);
+                entry_truncate(ctx, parent_dir_entry_id, entry->size + 1);
+                tmp_block = read_fat_offset(ctx, s_block);
             }
             s_block = tmp_block;
-            if (read_blocks_with_decryption(aes_key, s_block, 1, parent_dir))
+            if (read_blocks_with_decryption(ctx->aes_key, s_block, 1,
+                                            parent_dir))
                 goto err_create_file;
         }
     }
@@ -1579,7 +1702,7 @@ __entry_create_hardlink_routine(const unsigned char *aes_key,
     parent_dir->entries[index % NB_ENTRIES_PER_BLOCK] = new_hard;
 
     // Write the block
-    write_blocks_with_encryption(aes_key, s_block, 1, parent_dir);
+    write_blocks_with_encryption(ctx->aes_key, s_block, 1, parent_dir);
 
     free(parent_dir);
     return index;
@@ -1589,21 +1712,24 @@ err_create_file:
     return BLOCK_ERROR;
 }
 
-uint32_t entry_create_hardlink(const unsigned char *aes_key,
+uint32_t entry_create_hardlink(struct shlkfs_ctx *ctx,
                                struct CryptFS_Entry_ID parent_dir_entry_id,
                                const char *name,
                                struct CryptFS_Entry_ID target_entry_id)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     uint32_t index;
     // Exctract entry to Link
-    if (goto_entry_in_directory(aes_key, &target_entry_id))
+    if (goto_entry_in_directory(ctx, &target_entry_id))
         return BLOCK_ERROR;
 
     // allocate struct for reading target_link_block
-    struct CryptFS_Directory *target_link_dir = xaligned_alloc(
-        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+    struct CryptFS_Directory *target_link_dir =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
-    if (read_blocks_with_decryption(aes_key, target_entry_id.directory_block, 1,
+    if (read_blocks_with_decryption(ctx->aes_key,
+                                    target_entry_id.directory_block, 1,
                                     target_link_dir))
         goto err_create_file_init;
 
@@ -1617,27 +1743,28 @@ uint32_t entry_create_hardlink(const unsigned char *aes_key,
     if (parent_dir_entry_id.directory_block == ROOT_ENTRY_BLOCK)
     {
         // Allocate struct for reading directory_block
-        struct CryptFS_Entry *root_entry = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, CRYPTFS_BLOCK_SIZE_BYTES);
+        struct CryptFS_Entry *root_entry =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
         read_blocks_with_decryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
         int initiated =
             0; // if 0 = directory didn't initialized here, 1 if it init here
         if (root_entry->size == 0)
         {
-            entry_truncate(aes_key, parent_dir_entry_id, 1);
-            read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            entry_truncate(ctx, parent_dir_entry_id, 1);
+            read_blocks_with_decryption(ctx->aes_key,
+                                        parent_dir_entry_id.directory_block, 1,
+                                        root_entry);
             root_entry
                 ->size--; // update size only at the end if succes of adding
         }
         int res = __entry_create_hardlink_routine(
-            aes_key, root_entry, name, parent_dir_entry_id, entry_to_link);
+            ctx, root_entry, name, parent_dir_entry_id, entry_to_link);
         if (res == BLOCK_ERROR)
         {
             if (initiated)
-                entry_truncate(aes_key, parent_dir_entry_id, 0);
+                entry_truncate(ctx, parent_dir_entry_id, 0);
             goto err_create_file_root;
         }
         index = (uint32_t)res;
@@ -1645,7 +1772,7 @@ uint32_t entry_create_hardlink(const unsigned char *aes_key,
         // Update Entry
         root_entry->size++;
         write_blocks_with_encryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
 
         free(root_entry);
         free(target_link_dir);
@@ -1658,16 +1785,16 @@ uint32_t entry_create_hardlink(const unsigned char *aes_key,
     }
     else
     {
-        if (goto_entry_in_directory(aes_key, &parent_dir_entry_id))
+        if (goto_entry_in_directory(ctx, &parent_dir_entry_id))
             return BLOCK_ERROR;
 
         // allocate struct for reading directory_block
-        struct CryptFS_Directory *dir = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+        struct CryptFS_Directory *dir =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
         // Reading block
         if (read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, dir))
+                ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir))
             goto err_create_file;
 
         // Extract Entry
@@ -1682,9 +1809,9 @@ uint32_t entry_create_hardlink(const unsigned char *aes_key,
                            // initialized here, 1 if it init here
         if (entry.size == 0)
         {
-            entry_truncate(aes_key, parent_dir_entry_id, 1);
+            entry_truncate(ctx, parent_dir_entry_id, 1);
             read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, dir);
+                ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir);
             entry = dir->entries[parent_dir_entry_id.directory_index];
             entry.size--; // update size only at the end if succes of adding
             initiated = 1;
@@ -1692,14 +1819,14 @@ uint32_t entry_create_hardlink(const unsigned char *aes_key,
 
         // Routine
         int res = __entry_create_hardlink_routine(
-            aes_key, &entry, name, parent_dir_entry_id, entry_to_link);
+            ctx, &entry, name, parent_dir_entry_id, entry_to_link);
 
         // Check success
         if (res == BLOCK_ERROR)
         {
             // if initiated != 0, restore the block allowed
             if (initiated)
-                entry_truncate(aes_key, parent_dir_entry_id, 0);
+                entry_truncate(ctx, parent_dir_entry_id, 0);
             goto err_create_file;
         }
 
@@ -1708,7 +1835,7 @@ uint32_t entry_create_hardlink(const unsigned char *aes_key,
         entry.size++;
         dir->entries[parent_dir_entry_id.directory_index] = entry;
         write_blocks_with_encryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, dir);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir);
 
         free(dir);
         free(target_link_dir);
@@ -1728,7 +1855,7 @@ err_create_file_init:
 /**
  * @brief Routine called by entry_create_symlink
  *
- * @param aes_key The AES key used for encryption/decryption.
+ * @param ctx The context of the volume.
  * @param entry Pointer of the parent directory CryptFS_Entry. (Used to modify
  * its metadata after adding entry)
  * @param name Name of the future hardlink.
@@ -1740,30 +1867,31 @@ err_create_file_init:
  * @return 0 when success, BLOCK_ERROR otherwise.
  */
 static int __entry_create_symlink_routine(
-    const unsigned char *aes_key, struct CryptFS_Entry *entry, const char *name,
+    struct shlkfs_ctx *ctx, struct CryptFS_Entry *entry, const char *name,
     struct CryptFS_Entry_ID parent_dir_entry_id, const char *symlink)
 {
     uint32_t index = 0;
 
     // Find free index in Directory
-    struct CryptFS_Directory *parent_dir = xaligned_alloc(
-        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+    struct CryptFS_Directory *parent_dir =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
     block_t s_block = entry->start_block;
-    read_blocks_with_decryption(aes_key, s_block, 1, parent_dir);
+    read_blocks_with_decryption(ctx->aes_key, s_block, 1, parent_dir);
     while (parent_dir->entries[index % NB_ENTRIES_PER_BLOCK].used != 0)
     {
         index++;
         if (index % NB_ENTRIES_PER_BLOCK == 0)
         {
-            block_t tmp_block = read_fat_offset(aes_key, s_block);
+            block_t tmp_block = read_fat_offset(ctx, s_block);
             if (tmp_block == (uint32_t)BLOCK_END)
             {
-                entry_truncate(aes_key, parent_dir_entry_id, entry->size + 1);
-                tmp_block = read_fat_offset(aes_key, s_block);
+                entry_truncate(ctx, parent_dir_entry_id, entry->size + 1);
+                tmp_block = read_fat_offset(ctx, s_block);
             }
             s_block = tmp_block;
-            if (read_blocks_with_decryption(aes_key, s_block, 1, parent_dir))
+            if (read_blocks_with_decryption(ctx->aes_key, s_block, 1,
+                                            parent_dir))
                 goto err_create_file;
         }
     }
@@ -1785,7 +1913,7 @@ static int __entry_create_symlink_routine(
     parent_dir->entries[index % NB_ENTRIES_PER_BLOCK] = new_sym;
 
     // Write the block
-    write_blocks_with_encryption(aes_key, s_block, 1, parent_dir);
+    write_blocks_with_encryption(ctx->aes_key, s_block, 1, parent_dir);
 
     // Write symblink in file
     struct CryptFS_Entry_ID entry_id = { s_block,
@@ -1793,7 +1921,7 @@ static int __entry_create_symlink_routine(
     size_t sym_size = strlen(symlink);
     if (symlink[sym_size - 1] == '\0')
         sym_size--;
-    entry_write_buffer(aes_key, entry_id, symlink, sym_size);
+    entry_write_buffer(ctx, entry_id, symlink, sym_size);
 
     free(parent_dir);
     return index;
@@ -1803,10 +1931,12 @@ err_create_file:
     return BLOCK_ERROR;
 }
 
-uint32_t entry_create_symlink(const unsigned char *aes_key,
+uint32_t entry_create_symlink(struct shlkfs_ctx *ctx,
                               struct CryptFS_Entry_ID parent_dir_entry_id,
                               const char *name, const char *symlink)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
     if (!is_readable_ascii(symlink) || strlen(symlink) == 0)
         return BLOCK_ERROR;
 
@@ -1815,27 +1945,28 @@ uint32_t entry_create_symlink(const unsigned char *aes_key,
     if (parent_dir_entry_id.directory_block == ROOT_ENTRY_BLOCK)
     {
         // Allocate struct for reading directory_block
-        struct CryptFS_Entry *root_entry = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, CRYPTFS_BLOCK_SIZE_BYTES);
+        struct CryptFS_Entry *root_entry =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
         read_blocks_with_decryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
         int initiated =
             0; // if 0 = directory didn't initialized here, 1 if it init here
         if (root_entry->size == 0)
         {
-            entry_truncate(aes_key, parent_dir_entry_id, 1);
-            read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            entry_truncate(ctx, parent_dir_entry_id, 1);
+            read_blocks_with_decryption(ctx->aes_key,
+                                        parent_dir_entry_id.directory_block, 1,
+                                        root_entry);
             root_entry
                 ->size--; // update size only at the end if succes of adding
         }
-        int res = __entry_create_symlink_routine(aes_key, root_entry, name,
+        int res = __entry_create_symlink_routine(ctx, root_entry, name,
                                                  parent_dir_entry_id, symlink);
         if (res == BLOCK_ERROR)
         {
             if (initiated)
-                entry_truncate(aes_key, parent_dir_entry_id, 0);
+                entry_truncate(ctx, parent_dir_entry_id, 0);
             goto err_create_file_root;
         }
         index = (uint32_t)res;
@@ -1843,7 +1974,7 @@ uint32_t entry_create_symlink(const unsigned char *aes_key,
         // Update Entry
         root_entry->size++;
         write_blocks_with_encryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, root_entry);
 
         free(root_entry);
         return index;
@@ -1854,14 +1985,14 @@ uint32_t entry_create_symlink(const unsigned char *aes_key,
     }
     else
     {
-        if (goto_entry_in_directory(aes_key, &parent_dir_entry_id))
+        if (goto_entry_in_directory(ctx, &parent_dir_entry_id))
             return BLOCK_ERROR;
         // allocate struct for reading directory_block
-        struct CryptFS_Directory *dir = xaligned_alloc(
-            CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
+        struct CryptFS_Directory *dir =
+            xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
         if (read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, dir))
+                ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir))
             goto err_create_file;
 
         // Get the parent_directory
@@ -1875,20 +2006,20 @@ uint32_t entry_create_symlink(const unsigned char *aes_key,
             0; // if 0 = directory didn't initialized here, 1 if it init here
         if (entry.size == 0)
         {
-            entry_truncate(aes_key, parent_dir_entry_id, 1);
+            entry_truncate(ctx, parent_dir_entry_id, 1);
             read_blocks_with_decryption(
-                aes_key, parent_dir_entry_id.directory_block, 1, dir);
+                ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir);
             entry = dir->entries[parent_dir_entry_id.directory_index];
             entry.size--; // update size only at the end if succes of adding
         }
 
         // Routine
-        int res = __entry_create_symlink_routine(aes_key, &entry, name,
+        int res = __entry_create_symlink_routine(ctx, &entry, name,
                                                  parent_dir_entry_id, symlink);
         if (res == BLOCK_ERROR)
         {
             if (initiated)
-                entry_truncate(aes_key, parent_dir_entry_id, 0);
+                entry_truncate(ctx, parent_dir_entry_id, 0);
             goto err_create_file;
         }
 
@@ -1897,7 +2028,7 @@ uint32_t entry_create_symlink(const unsigned char *aes_key,
         entry.size++;
         dir->entries[parent_dir_entry_id.directory_index] = entry;
         write_blocks_with_encryption(
-            aes_key, parent_dir_entry_id.directory_block, 1, dir);
+            ctx->aes_key, parent_dir_entry_id.directory_block, 1, dir);
 
         free(dir);
         return index;
@@ -0,0 +1,694 @@
+#include "export.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "entries.h"
+#include "fat.h"
+#include "maths.h"
+#include "print.h"
+#include "shlkfs_ctx.h"
+#include "xalloc.h"
+
+// Size of the chunks of file content read and decrypted at once (see
+// read_blocks_batch_with_decryption)
+#define EXPORT_CHUNK_BYTES (16 * 1024 * 1024)
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_NAME_SIZE 100
+
+/**
+ * @brief A thread writing the chunks of content to the destination, while
+ * the next chunks are read from the device.
+ */
+struct export_writer
+{
+    pthread_t thread;
+    pthread_mutex_t lock; // Protects the fields below
+    pthread_cond_t cond; // Signaled when a write is submitted or done
+    int fd; // File descriptor of the pending write
+    const void *data; // Data of the pending write, NULL if there is none
+    size_t size; // Size of the pending write
+    bool stop; // Whether the thread has to stop
+    bool failed; // Whether a write failed
+};
+
+/**
+ * @brief State of an export.
+ */
+struct export
+{
+    struct shlkfs_ctx *ctx; // The volume
+    const char *destination_path; // The destination directory (not for tar)
+    int tar_fd; // The file descriptor of the tar archive, -1 if none
+    unsigned char *buffers[2]; // Buffers of `chunk_blocks` blocks (one is
+                               // read while the other one is written)
+    size_t chunk_blocks; // Number of blocks of a buffer
+    struct block_request *requests; // `chunk_blocks` requests
+    struct export_writer writer; // The writer thread
+    size_t nb_files; // Number of exported files (and symbolic links)
+    size_t nb_directories; // Number of exported directories
+    uint64_t nb_bytes; // Number of exported bytes
+};
+
+/**
+ * @brief An entry of a directory of the volume.
+ */
+struct export_item
+{
+    struct CryptFS_Entry_ID id; // The ID of the entry
+    struct CryptFS_Entry entry; // The entry
+};
+
+/**
+ * @brief Write a whole buffer to a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param data The data to write.
+ * @param size The size of the data.
+ * @return int 0 on success, -1 on error.
+ */
+static int __write_full(int fd, const void *data, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t res = write(fd, (const char *)data + done, size - done);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res == -1)
+            return -1;
+        done += res;
+    }
+
+    return 0;
+}
+
+// ------------------------------ Writer thread ------------------------------
+
+/**
+ * @brief Routine of the writer thread: write the submitted buffers.
+ *
+ * @param arg The writer.
+ * @return void* NULL.
+ */
+static void *__writer_routine(void *arg)
+{
+    struct export_writer *writer = arg;
+
+    pthread_mutex_lock(&writer->lock);
+    while (true)
+    {
+        while (writer->data == NULL && !writer->stop)
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        if (writer->data == NULL)
+            break;
+
+        // The pending write is not modified until it is done
+        pthread_mutex_unlock(&writer->lock);
+        int res = __write_full(writer->fd, writer->data, writer->size);
+        pthread_mutex_lock(&writer->lock);
+
+        if (res)
+            writer->failed = true;
+        writer->data = NULL;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Wait for the pending write of the writer thread.
+ *
+ * @param writer The writer.
+ * @return int 0 if all the writes succeeded so far, -1 otherwise.
+ */
+static int __writer_wait(struct export_writer *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    while (writer->data != NULL)
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    bool failed = writer->failed;
+    pthread_mutex_unlock(&writer->lock);
+
+    return failed ? -1 : 0;
+}
+
+/**
+ * @brief Submit a write to the writer thread (after the pending one).
+ *
+ * @param writer The writer.
+ * @param fd The file descriptor to write to.
+ * @param data The data to write (left untouched until the write is done).
+ * @param size The size of the data.
+ * @return int 0 on success, -1 if a previous write failed.
+ */
+static int __writer_submit(struct export_writer *writer, int fd,
+                           const void *data, size_t size)
+{
+    if (__writer_wait(writer))
+        return -1;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->fd = fd;
+    writer->data = data;
+    writer->size = size;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    return 0;
+}
+
+// ---------------------------------- Tar ------------------------------------
+
+/**
+ * @brief Fill a numeric field of a tar header (octal, or base-256 if the
+ * value does not fit).
+ *
+ * @param field The field.
+ * @param size The size of the field.
+ * @param value The value.
+ */
+static void __tar_number(char *field, size_t size, uint64_t value)
+{
+    if (value < 1ULL << (3 * (size - 1)))
+    {
+        snprintf(field, size, "%0*lo", (int)size - 1, (unsigned long)value);
+        return;
+    }
+
+    memset(field, 0, size);
+    field[0] = (char)0x80;
+    for (size_t i = size - 1; i > 0; i--, value >>= 8)
+        field[i] = value & 0xff;
+}
+
+/**
+ * @brief Size of the padding after the data of a tar member.
+ *
+ * @param size The size of the data.
+ * @return uint64_t The size of the padding.
+ */
+static uint64_t __tar_padding(uint64_t size)
+{
+    return (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+}
+
+/**
+ * @brief Write data to the tar archive, after the pending write.
+ *
+ * @param export The export.
+ * @param data The data.
+ * @param size The size of the data.
+ * @return int 0 on success, -1 on error.
+ */
+static int __tar_write(struct export *export, const void *data, size_t size)
+{
+    if (__writer_wait(&export->writer)
+        || __write_full(export->tar_fd, data, size))
+        return -1;
+
+    return 0;
+}
+
+static int __tar_write_header(struct export *export, const char *name,
+                              char type, uint64_t size,
+                              const struct CryptFS_Entry *entry,
+                              const char *link);
+
+/**
+ * @brief Write a GNU long name (or long link) member, for a name which does
+ * not fit in a tar header.
+ *
+ * @param export The export.
+ * @param type 'L' for a name, 'K' for a link.
+ * @param name The name.
+ * @return int 0 on success, -1 on error.
+ */
+static int __tar_write_long_name(struct export *export, char type,
+                                 const char *name)
+{
+    struct CryptFS_Entry entry = { 0 };
+    size_t size = strlen(name) + 1;
+    if (__tar_write_header(export, "././@LongLink", type, size, &entry, NULL))
+        return -1;
+
+    size_t padded_size = size + __tar_padding(size);
+    char *data = xcalloc(padded_size, 1);
+    memcpy(data, name, size);
+    int res = __tar_write(export, data, padded_size);
+    free(data);
+
+    return res;
+}
+
+/**
+ * @brief Write the header of a tar member (preceded by GNU long name members
+ * if needed).
+ *
+ * @param export The export.
+ * @param name The name of the member.
+ * @param type The type of the member ('0', '2' or '5').
+ * @param size The size of the data of the member.
+ * @param entry The entry of the member (for its metadata).
+ * @param link The target of a symbolic link, NULL otherwise.
+ * @return int 0 on success, -1 on error.
+ */
+static int __tar_write_header(struct export *export, const char *name,
+                              char type, uint64_t size,
+                              const struct CryptFS_Entry *entry,
+                              const char *link)
+{
+    if (strlen(name) > TAR_NAME_SIZE
+        && __tar_write_long_name(export, 'L', name))
+        return -1;
+    if (link != NULL && strlen(link) > TAR_NAME_SIZE
+        && __tar_write_long_name(export, 'K', link))
+        return -1;
+
+    unsigned char header[TAR_BLOCK_SIZE] = { 0 };
+    char *fields = (char *)header;
+    memcpy(fields, name, MIN(strlen(name), TAR_NAME_SIZE));
+    __tar_number(fields + 100, 8, entry->mode & 07777);
+    __tar_number(fields + 108, 8, entry->uid);
+    __tar_number(fields + 116, 8, entry->gid);
+    __tar_number(fields + 124, 12, size);
+    __tar_number(fields + 136, 12, entry->mtime);
+    fields[156] = type;
+    if (link != NULL)
+        memcpy(fields + 157, link, MIN(strlen(link), TAR_NAME_SIZE));
+    memcpy(fields + 257, "ustar  ", 8); // GNU magic and version
+
+    // The checksum is computed with the checksum field filled with spaces
+    memset(fields + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++)
+        checksum += header[i];
+    snprintf(fields + 148, 7, "%06o", checksum);
+
+    return __tar_write(export, header, TAR_BLOCK_SIZE);
+}
+
+// ---------------------------------- Export ---------------------------------
+
+/**
+ * @brief Read the content of a file by chunks, and submit each chunk to the
+ * writer thread.
+ *
+ * @param export The export.
+ * @param entry The entry of the file.
+ * @param fd The file descriptor to write the content to.
+ * @param pad Whether to pad the content to a tar block.
+ * @return int 0 on success, -1 on error.
+ */
+static int __export_content(struct export *export,
+                            const struct CryptFS_Entry *entry, int fd,
+                            bool pad)
+{
+    size_t block_size = get_block_size();
+    block_t block = entry->start_block;
+    uint64_t remaining = entry->size;
+    size_t current = 0;
+
+    while (remaining > 0)
+    {
+        size_t chunk_size = export->chunk_blocks * block_size;
+        if (remaining < chunk_size)
+            chunk_size = remaining;
+        size_t chunk_blocks = (chunk_size + block_size - 1) / block_size;
+        unsigned char *buffer = export->buffers[current];
+
+        // Resolve the extents of the chunk from the FAT
+        size_t nb_requests = 0;
+        for (size_t i = 0; i < chunk_blocks; nb_requests++)
+        {
+            if (block == BLOCK_FREE || block == (uint32_t)BLOCK_END
+                || block == (uint32_t)BLOCK_ERROR)
+            {
+                print_error("The blocks of '%s' are corrupted\n", entry->name);
+                return -1;
+            }
+
+            struct block_request *request = &export->requests[nb_requests];
+            request->start_block = block;
+            request->nb_blocks = 0;
+            request->buffer = buffer + i * block_size;
+            do
+            {
+                block = read_fat_offset(export->ctx, block);
+                request->nb_blocks++;
+                i++;
+            } while (i < chunk_blocks
+                     && block == request->start_block + request->nb_blocks);
+        }
+
+        if (read_blocks_batch_with_decryption(export->ctx->aes_key,
+                                              export->requests, nb_requests))
+        {
+            print_error("Failed to read the content of '%s'\n", entry->name);
+            return -1;
+        }
+
+        // Write the chunk while the next one is read
+        size_t output_size = chunk_size;
+        if (pad && remaining == chunk_size)
+        {
+            memset(buffer + chunk_size, 0, __tar_padding(chunk_size));
+            output_size += __tar_padding(chunk_size);
+        }
+        if (__writer_submit(&export->writer, fd, buffer, output_size))
+            break;
+
+        current = 1 - current;
+        remaining -= chunk_size;
+    }
+
+    if (__writer_wait(&export->writer))
+    {
+        print_error("Failed to write the content of '%s'\n", entry->name);
+        return -1;
+    }
+    export->nb_bytes += entry->size;
+    return 0;
+}
+
+/**
+ * @brief List the used entries of a directory of the volume.
+ *
+ * @param export The export.
+ * @param directory The entry of the directory.
+ * @param items The entries. (returned, to free)
+ * @return ssize_t The number of entries, -1 on error.
+ */
+static ssize_t __list_directory(struct export *export,
+                                const struct CryptFS_Entry *directory,
+                                struct export_item **items)
+{
+    struct CryptFS_Directory *dir =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    *items = xcalloc(directory->size + 1, sizeof(struct export_item));
+
+    size_t nb_items = 0;
+    block_t block = directory->start_block;
+    while (nb_items < directory->size)
+    {
+        if (block == BLOCK_FREE || block == (uint32_t)BLOCK_END
+            || block == (uint32_t)BLOCK_ERROR
+            || read_blocks_with_decryption(export->ctx->aes_key, block, 1,
+                                           dir))
+        {
+            print_error("Failed to read the directory '%s'\n",
+                        directory->name);
+            free(dir);
+            free(*items);
+            return -1;
+        }
+
+        for (uint32_t i = 0;
+             i < NB_ENTRIES_PER_BLOCK && nb_items < directory->size; i++)
+            if (dir->entries[i].used)
+            {
+                (*items)[nb_items].id.directory_block = block;
+                (*items)[nb_items].id.directory_index = i;
+                (*items)[nb_items].entry = dir->entries[i];
+                nb_items++;
+            }
+        block = read_fat_offset(export->ctx, block);
+    }
+
+    free(dir);
+    return nb_items;
+}
+
+static int __export_entry(struct export *export,
+                          const struct export_item *item,
+                          const char *relative_path);
+
+/**
+ * @brief Export the entries of a directory of the volume.
+ *
+ * @param export The export.
+ * @param directory The entry of the directory.
+ * @param relative_path The path of the directory in the destination ("" for
+ * the destination itself).
+ * @return int 0 on success, -1 on error.
+ */
+static int __export_directory(struct export *export,
+                              const struct CryptFS_Entry *directory,
+                              const char *relative_path)
+{
+    struct export_item *items = NULL;
+    ssize_t nb_items = __list_directory(export, directory, &items);
+    if (nb_items == -1)
+        return -1;
+
+    int res = 0;
+    for (ssize_t i = 0; res == 0 && i < nb_items; i++)
+    {
+        char child_path[PATH_MAX];
+        if (relative_path[0] == '\0')
+            snprintf(child_path, PATH_MAX, "%s", items[i].entry.name);
+        else
+            snprintf(child_path, PATH_MAX, "%s/%s", relative_path,
+                     items[i].entry.name);
+        res = __export_entry(export, &items[i], child_path);
+    }
+
+    free(items);
+    return res;
+}
+
+/**
+ * @brief Export an entry of the volume (recursively for a directory).
+ *
+ * @param export The export.
+ * @param item The entry.
+ * @param relative_path The path of the entry in the destination.
+ * @return int 0 on success, -1 on error.
+ */
+static int __export_entry(struct export *export,
+                          const struct export_item *item,
+                          const char *relative_path)
+{
+    const struct CryptFS_Entry *entry = &item->entry;
+    bool to_tar = export->tar_fd != -1;
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%s", export->destination_path,
+             relative_path);
+    struct timespec times[2] = { { .tv_sec = entry->atime },
+                                 { .tv_sec = entry->mtime } };
+
+    switch (entry->type)
+    {
+    case ENTRY_TYPE_DIRECTORY: {
+        export->nb_directories++;
+        if (to_tar)
+        {
+            char name[PATH_MAX];
+            snprintf(name, PATH_MAX, "%s/", relative_path);
+            if (__tar_write_header(export, name, '5', 0, entry, NULL))
+                goto err_write;
+            return __export_directory(export, entry, relative_path);
+        }
+
+        // Writable until its content is exported
+        if (mkdir(path, 0700) != 0 && errno != EEXIST)
+            goto err_write;
+        if (__export_directory(export, entry, relative_path))
+            return -1;
+        if (chmod(path, entry->mode & 07777) != 0
+            || utimensat(AT_FDCWD, path, times, 0) != 0)
+            goto err_write;
+        return 0;
+    }
+    case ENTRY_TYPE_SYMLINK: {
+        export->nb_files++;
+        char target[PATH_MAX] = { 0 };
+        if (entry_read_raw_data(export->ctx, item->id, 0, target,
+                                MIN(entry->size, PATH_MAX - 1))
+            == BLOCK_ERROR)
+        {
+            print_error("Failed to read the link '%s'\n", relative_path);
+            return -1;
+        }
+        if (to_tar ? __tar_write_header(export, relative_path, '2', 0, entry,
+                                        target)
+                   : symlink(target, path))
+            goto err_write;
+        return 0;
+    }
+    default: { // Files and hardlinks
+        export->nb_files++;
+        if (to_tar)
+            return __tar_write_header(export, relative_path, '0', entry->size,
+                                      entry, NULL)
+                ? -1
+                : __export_content(export, entry, export->tar_fd, true);
+
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1)
+            goto err_write;
+        int res = __export_content(export, entry, fd, false);
+        if (res == 0
+            && (fchmod(fd, entry->mode & 07777) != 0
+                || futimens(fd, times) != 0))
+        {
+            print_error("Failed to set the metadata of '%s'\n", path);
+            res = -1;
+        }
+        close(fd);
+        return res;
+    }
+    }
+
+err_write:
+    print_error("Failed to write '%s'\n", to_tar ? relative_path : path);
+    return -1;
+}
+
+/**
+ * @brief Export a directory (or a file) of an opened volume.
+ *
+ * @param export The export (its volume and destination are set).
+ * @param volume_path The path of the directory (or file) in the volume.
+ * @return int 0 on success, -1 on error.
+ */
+static int __export(struct export *export, const char *volume_path)
+{
+    SHLKFS_CTX_SCOPE(export->ctx);
+
+    if (fat_cache_load(export->ctx))
+    {
+        print_error("Failed to load the FAT of the volume\n");
+        return -1;
+    }
+
+    struct CryptFS_Entry_ID *entry_id =
+        get_entry_by_path(export->ctx, volume_path);
+    if (entry_id == (void *)ENTRY_NO_SUCH || entry_id == (void *)BLOCK_ERROR)
+    {
+        print_error("'%s' does not exist in the volume\n", volume_path);
+        return -1;
+    }
+    struct export_item item = { .id = *entry_id };
+    free(entry_id);
+    struct CryptFS_Entry *entry = get_entry_from_id(export->ctx, item.id);
+    if (entry == NULL)
+        return -1;
+    item.entry = *entry;
+    free(entry);
+
+    export->chunk_blocks = EXPORT_CHUNK_BYTES / get_block_size();
+    if (export->chunk_blocks == 0)
+        export->chunk_blocks = 1;
+    for (size_t i = 0; i < 2; i++)
+        export->buffers[i] = xaligned_alloc(
+            CRYPTFS_BLOCK_SIZE_BYTES, export->chunk_blocks, get_block_size());
+    export->requests =
+        xcalloc(export->chunk_blocks, sizeof(struct block_request));
+
+    struct export_writer *writer = &export->writer;
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    int create_res =
+        pthread_create(&writer->thread, NULL, __writer_routine, writer);
+    if (create_res != 0)
+        print_error("Failed to start the writer thread: %s\n",
+                    strerror(create_res));
+
+    print_info("Exporting '%s'...\n", volume_path);
+    int res = 0;
+    if (create_res != 0)
+        res = -1;
+    else if (export->tar_fd == -1 && mkdir(export->destination_path, 0755) != 0
+             && errno != EEXIST)
+    {
+        print_error("Failed to create '%s'\n", export->destination_path);
+        res = -1;
+    }
+    else if (item.entry.type != ENTRY_TYPE_DIRECTORY)
+    {
+        // A file is exported under its name
+        const char *name = strrchr(volume_path, '/');
+        res = __export_entry(export, &item,
+                             name != NULL ? name + 1 : volume_path);
+    }
+    else
+        res = __export_directory(export, &item.entry, "");
+
+    // The archive ends with two zero blocks
+    if (res == 0 && export->tar_fd != -1)
+    {
+        unsigned char end[2 * TAR_BLOCK_SIZE] = { 0 };
+        res = __tar_write(export, end, sizeof(end));
+    }
+
+    if (create_res == 0)
+    {
+        pthread_mutex_lock(&writer->lock);
+        writer->stop = true;
+        pthread_cond_broadcast(&writer->cond);
+        pthread_mutex_unlock(&writer->lock);
+        pthread_join(writer->thread, NULL);
+    }
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->lock);
+
+    free(export->requests);
+    free(export->buffers[0]);
+    free(export->buffers[1]);
+    fat_cache_unload(export->ctx);
+    return res;
+}
+
+int cryptfs_export(const char *device_path, const char *volume_path,
+                   const char *destination_path, const char *private_key_path)
+{
+    struct export export = { .destination_path = destination_path,
+                             .tar_fd = -1 };
+
+    // The archive takes the standard output: the messages go to stderr
+    if (strcmp(destination_path, "-") == 0)
+    {
+        fflush(stdout);
+        export.tar_fd = dup(STDOUT_FILENO);
+        if (export.tar_fd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
+        {
+            print_error("Failed to redirect the standard output\n");
+            return -1;
+        }
+    }
+
+    int res = -1;
+    export.ctx = shlkfs_ctx_open_with_key(device_path, private_key_path);
+    if (export.ctx != NULL)
+    {
+        res = __export(&export, volume_path);
+        shlkfs_ctx_close(export.ctx);
+    }
+
+    if (res == 0)
+        print_success("%zu files and %zu directories (%lu bytes) have been "
+                      "exported from the device '%s' successfully!\n",
+                      export.nb_files, export.nb_directories,
+                      (unsigned long)export.nb_bytes, device_path);
+
+    if (export.tar_fd != -1)
+    {
+        fflush(stdout);
+        dup2(export.tar_fd, STDOUT_FILENO);
+        close(export.tar_fd);
+    }
+    return res;
+}
@@ -1,16 +1,160 @@
 #include <limits.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "block.h"
+#include "crypto.h"
 #include "fat.h"
 #include "print.h"
+#include "shlkfs_ctx.h"
 #include "xalloc.h"
 
-sblock_t find_first_free_block(const unsigned char *aes_key)
+// Number of FAT tables decrypted at once by fat_cache_load
+#define FAT_LOAD_CHUNK 1024
+
+/**
+ * @brief The FAT of a volume loaded in memory (see fat_cache_load).
+ */
+struct fat_cache
+{
+    struct CryptFS_FAT **tables; // Decrypted FAT tables, in the chain order
+    block_t *blocks; // Block where each FAT table is stored
+    bool *dirty; // Whether each FAT table has to be written to the device
+    size_t nb_tables; // Number of FAT tables
+    size_t capacity; // Allocated length of the arrays above
+    uint64_t first_free; // There is no free entry before this index
+    uint64_t nb_free; // Number of free entries in the FAT tables
+};
+
+/**
+ * @brief Append a FAT table to the loaded FAT.
+ *
+ * @param cache The loaded FAT.
+ * @param block The block where the FAT table is stored.
+ * @param table The FAT table (owned by the cache from now on).
+ * @param dirty Whether the FAT table has to be written to the device.
+ */
+static void __fat_cache_append(struct fat_cache *cache, block_t block,
+                               struct CryptFS_FAT *table, bool dirty)
+{
+    if (cache->nb_tables == cache->capacity)
+    {
+        cache->capacity = cache->capacity ? cache->capacity * 2 : 16;
+        cache->tables = xrealloc(cache->tables, cache->capacity,
+                                 sizeof(struct CryptFS_FAT *));
+        cache->blocks = xrealloc(cache->blocks, cache->capacity,
+                                 sizeof(block_t));
+        cache->dirty = xrealloc(cache->dirty, cache->capacity, sizeof(bool));
+    }
+
+    cache->tables[cache->nb_tables] = table;
+    cache->blocks[cache->nb_tables] = block;
+    cache->dirty[cache->nb_tables] = dirty;
+    cache->nb_tables++;
+
+    for (uint64_t i = 0; i < NB_FAT_ENTRIES_PER_BLOCK; i++)
+        if (table->entries[i].next_block == BLOCK_FREE)
+            cache->nb_free++;
+}
+
+/**
+ * @brief read_fat_offset on the loaded FAT.
+ */
+static uint32_t __fat_cache_read(struct fat_cache *cache, uint64_t offset)
+{
+    uint64_t concerned_fat = offset / NB_FAT_ENTRIES_PER_BLOCK;
+    if (concerned_fat >= cache->nb_tables)
+        return FAT_INDEX_OOB;
+
+    return cache->tables[concerned_fat]
+        ->entries[offset % NB_FAT_ENTRIES_PER_BLOCK]
+        .next_block;
+}
+
+/**
+ * @brief write_fat_offset on the loaded FAT.
+ */
+static int __fat_cache_write(struct fat_cache *cache, uint64_t offset,
+                             uint64_t value)
+{
+    uint64_t concerned_fat = offset / NB_FAT_ENTRIES_PER_BLOCK;
+    if (concerned_fat >= cache->nb_tables)
+        return FAT_INDEX_OOB;
+
+    struct CryptFS_FAT_Entry *entry =
+        &cache->tables[concerned_fat]
+             ->entries[offset % NB_FAT_ENTRIES_PER_BLOCK];
+    if (entry->next_block == BLOCK_FREE && value != BLOCK_FREE)
+        cache->nb_free--;
+    else if (entry->next_block != BLOCK_FREE && value == BLOCK_FREE)
+    {
+        cache->nb_free++;
+        if (offset < cache->first_free)
+            cache->first_free = offset;
+    }
+
+    entry->next_block = value;
+    cache->dirty[concerned_fat] = true;
+    return 0;
+}
+
+/**
+ * @brief find_first_free_block on the loaded FAT.
+ */
+static sblock_t __fat_cache_find_free(struct fat_cache *cache)
+{
+    uint64_t nb_entries = cache->nb_tables * NB_FAT_ENTRIES_PER_BLOCK;
+    for (uint64_t i = cache->first_free; i < nb_entries; i++)
+        if (__fat_cache_read(cache, i) == BLOCK_FREE)
+        {
+            cache->first_free = i;
+            return i;
+        }
+
+    cache->first_free = nb_entries;
+    return -(sblock_t)nb_entries;
+}
+
+/**
+ * @brief create_fat on the loaded FAT (the header is updated by
+ * fat_cache_commit).
+ */
+static sblock_t __fat_cache_create(struct fat_cache *cache)
+{
+    struct CryptFS_FAT *new_fat =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    new_fat->next_fat_table = BLOCK_END;
+
+    sblock_t new_fat_block = __fat_cache_find_free(cache);
+    if (new_fat_block < 0) // Out of FAT: the new FAT handles its own block
+    {
+        new_fat_block = -new_fat_block;
+        new_fat->entries[0].next_block = BLOCK_END;
+        __fat_cache_append(cache, new_fat_block, new_fat, true);
+    }
+    else
+    {
+        __fat_cache_append(cache, new_fat_block, new_fat, true);
+        __fat_cache_write(cache, new_fat_block, BLOCK_END);
+    }
+
+    // Link the previous last FAT to the new one
+    cache->tables[cache->nb_tables - 2]->next_fat_table = new_fat_block;
+    cache->dirty[cache->nb_tables - 2] = true;
+
+    return new_fat_block;
+}
+
+sblock_t find_first_free_block(struct shlkfs_ctx *ctx)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
+    if (ctx->fat_cache != NULL)
+        return __fat_cache_find_free(ctx->fat_cache);
+
     for (int64_t i = 0; i < INT64_MAX; i++)
-        switch (read_fat_offset(aes_key, (uint64_t)i))
+        switch (read_fat_offset(ctx, (uint64_t)i))
         {
         case BLOCK_FREE:
             return i;
@@ -25,14 +169,16 @@ sblock_t find_first_free_block(const unsigned char *aes_key)
     return BLOCK_ERROR;
 }
 
-block_t find_first_free_block_safe(const unsigned char *aes_key)
+block_t find_first_free_block_safe(struct shlkfs_ctx *ctx)
 {
-    sblock_t index = find_first_free_block(aes_key);
+    SHLKFS_CTX_SCOPE(ctx);
+
+    sblock_t index = find_first_free_block(ctx);
     if (index == BLOCK_ERROR)
         return BLOCK_ERROR;
     if (index < 0)
     {
-        if (create_fat(aes_key) == BLOCK_ERROR)
+        if (create_fat(ctx) == BLOCK_ERROR)
             return BLOCK_ERROR;
         return -index + 1;
     }
@@ -40,28 +186,33 @@ block_t find_first_free_block_safe(const unsigned char *aes_key)
     return index;
 }
 
-sblock_t create_fat(const unsigned char *aes_key)
+sblock_t create_fat(struct shlkfs_ctx *ctx)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
+    if (ctx->fat_cache != NULL)
+        return __fat_cache_create(ctx->fat_cache);
+
     // Header (which contains last_fat_block index)
-    struct CryptFS_Header *header = xaligned_alloc(
-        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Header));
+    struct CryptFS_Header *header =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
     // Last already in place FAT (at index last_fat_block)
     struct CryptFS_FAT *last_fat =
-        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_FAT));
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
     // New created FAT
-    struct CryptFS_FAT *new_fat = xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, 1,
-                                                  sizeof(struct CryptFS_FAT));
+    struct CryptFS_FAT *new_fat =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
 
     // Loading last in place FAT into memory
     if (read_blocks(HEADER_BLOCK, 1, header) == BLOCK_ERROR)
         goto err_create_fat;
-    if (read_blocks_with_decryption(aes_key, header->last_fat_block, 1,
+    if (read_blocks_with_decryption(ctx->aes_key, header->last_fat_block, 1,
                                     last_fat)
         == BLOCK_ERROR)
         goto err_create_fat;
 
     // Finding an available block to store the new FAT
-    int64_t new_fat_block = find_first_free_block(aes_key);
+    int64_t new_fat_block = find_first_free_block(ctx);
     if (new_fat_block == BLOCK_ERROR)
         return BLOCK_ERROR;
 
@@ -73,14 +224,15 @@ sblock_t create_fat(const unsigned char *aes_key)
         // Creating new FAT at block `new_oob_fat_block`
         new_fat->next_fat_table = BLOCK_END;
         new_fat->entries[0].next_block = BLOCK_END;
-        if (write_blocks_with_encryption(aes_key, new_oob_fat_block, 1, new_fat)
+        if (write_blocks_with_encryption(ctx->aes_key, new_oob_fat_block, 1,
+                                         new_fat)
             == BLOCK_ERROR)
             goto err_create_fat;
 
         // Updating the last FAT to point to the new OOB FAT
         last_fat->next_fat_table = new_oob_fat_block;
-        if (write_blocks_with_encryption(aes_key, header->last_fat_block, 1,
-                                         last_fat)
+        if (write_blocks_with_encryption(ctx->aes_key, header->last_fat_block,
+                                         1, last_fat)
             == BLOCK_ERROR)
             goto err_create_fat;
 
@@ -103,11 +255,12 @@ sblock_t create_fat(const unsigned char *aes_key)
         last_fat->next_fat_table = new_fat_block;
 
         // Write the new FAT block to the disk.
-        if (write_blocks_with_encryption(aes_key, new_fat_block, 1, new_fat))
+        if (write_blocks_with_encryption(ctx->aes_key, new_fat_block, 1,
+                                         new_fat))
             goto err_create_fat;
 
         // Mark the new FAT block as used.
-        if (write_fat_offset(aes_key, new_fat_block, BLOCK_END))
+        if (write_fat_offset(ctx, new_fat_block, BLOCK_END))
             goto err_create_fat;
 
         // Updating the header to point to the new OOB FAT
@@ -128,13 +281,19 @@ err_create_fat:
     return BLOCK_ERROR;
 }
 
-int write_fat_offset(const unsigned char *aes_key, uint64_t offset,
-                     uint64_t value)
+int write_fat_offset(struct shlkfs_ctx *ctx, uint64_t offset, uint64_t value)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
+    if (ctx->fat_cache != NULL)
+        return __fat_cache_write(ctx->fat_cache, offset, value);
+
     // Find a free block in the disk.
-    struct CryptFS_FAT first_fat = { 0 };
-    if (read_blocks_with_decryption(aes_key, FIRST_FAT_BLOCK, 1, &first_fat))
-        return BLOCK_ERROR;
+    struct CryptFS_FAT *first_fat =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    if (read_blocks_with_decryption(ctx->aes_key, FIRST_FAT_BLOCK, 1,
+                                    first_fat))
+        goto err_write_fat_offset;
 
     uint64_t concerned_fat = offset / NB_FAT_ENTRIES_PER_BLOCK;
 
@@ -142,43 +301,291 @@ int write_fat_offset(const unsigned char *aes_key, uint64_t offset,
     uint64_t current_fat_block = FIRST_FAT_BLOCK;
     for (uint64_t i = 0; i < concerned_fat; i++)
     {
-        current_fat_block = first_fat.next_fat_table;
-        if (first_fat.next_fat_table == (uint64_t)BLOCK_END)
+        current_fat_block = first_fat->next_fat_table;
+        if (first_fat->next_fat_table == (uint64_t)BLOCK_END)
+        {
+            free(first_fat);
             return FAT_INDEX_OOB;
-        if (read_blocks_with_decryption(aes_key, first_fat.next_fat_table, 1,
-                                        &first_fat)
+        }
+        if (read_blocks_with_decryption(ctx->aes_key, first_fat->next_fat_table,
+                                        1, first_fat)
             == BLOCK_ERROR)
-            return BLOCK_ERROR;
+            goto err_write_fat_offset;
     }
 
-    first_fat.entries[offset % NB_FAT_ENTRIES_PER_BLOCK].next_block = value;
+    first_fat->entries[offset % NB_FAT_ENTRIES_PER_BLOCK].next_block = value;
 
-    if (write_blocks_with_encryption(aes_key, current_fat_block, 1, &first_fat))
-        return BLOCK_ERROR;
+    if (write_blocks_with_encryption(ctx->aes_key, current_fat_block, 1,
+                                     first_fat))
+        goto err_write_fat_offset;
 
+    free(first_fat);
     return 0;
+
+err_write_fat_offset:
+    free(first_fat);
+    return BLOCK_ERROR;
 }
 
-uint32_t read_fat_offset(const unsigned char *aes_key, uint64_t offset)
+uint32_t read_fat_offset(struct shlkfs_ctx *ctx, uint64_t offset)
 {
+    SHLKFS_CTX_SCOPE(ctx);
+
+    if (ctx->fat_cache != NULL)
+        return __fat_cache_read(ctx->fat_cache, offset);
+
     // Find a free block in the disk.
-    struct CryptFS_FAT tmp_fat = { 0 };
-    if (read_blocks_with_decryption(aes_key, FIRST_FAT_BLOCK, 1, &tmp_fat))
-        return BLOCK_ERROR;
+    struct CryptFS_FAT *tmp_fat =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    if (read_blocks_with_decryption(ctx->aes_key, FIRST_FAT_BLOCK, 1, tmp_fat))
+        goto err_read_fat_offset;
 
     uint64_t concerned_fat = offset / NB_FAT_ENTRIES_PER_BLOCK;
 
     // Parsing the FAT linked-list
     for (uint64_t i = 0; i < concerned_fat; i++)
     {
-        if (tmp_fat.next_fat_table == (uint64_t)BLOCK_END)
+        if (tmp_fat->next_fat_table == (uint64_t)BLOCK_END)
+        {
+            free(tmp_fat);
             return FAT_INDEX_OOB;
+        }
 
-        if (read_blocks_with_decryption(aes_key, tmp_fat.next_fat_table, 1,
-                                        &tmp_fat)
+        if (read_blocks_with_decryption(ctx->aes_key, tmp_fat->next_fat_table,
+                                        1, tmp_fat)
             == -1)
+            goto err_read_fat_offset;
+    }
+
+    uint32_t value =
+        tmp_fat->entries[offset % NB_FAT_ENTRIES_PER_BLOCK].next_block;
+    free(tmp_fat);
+    return value;
+
+err_read_fat_offset:
+    free(tmp_fat);
+    return BLOCK_ERROR;
+}
+
+/**
+ * @brief Count the free entries of the FAT tables stored on the device.
+ *
+ * @param ctx The context of the volume.
+ * @return sblock_t The number of free entries, BLOCK_ERROR on error.
+ */
+static sblock_t __count_free_blocks(struct shlkfs_ctx *ctx)
+{
+    struct CryptFS_FAT *fat =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+
+    sblock_t nb_free = 0;
+    uint64_t fat_block = FIRST_FAT_BLOCK;
+    while (fat_block != (uint64_t)BLOCK_END)
+    {
+        if (read_blocks_with_decryption(ctx->aes_key, fat_block, 1, fat))
+        {
+            free(fat);
             return BLOCK_ERROR;
+        }
+        for (uint64_t i = 0; i < NB_FAT_ENTRIES_PER_BLOCK; i++)
+            if (fat->entries[i].next_block == BLOCK_FREE)
+                nb_free++;
+        fat_block = fat->next_fat_table;
+    }
+
+    free(fat);
+    return nb_free;
+}
+
+int reserve_blocks(struct shlkfs_ctx *ctx, size_t nb_blocks)
+{
+    SHLKFS_CTX_SCOPE(ctx);
+
+    sblock_t nb_free = ctx->fat_cache != NULL
+        ? (sblock_t)ctx->fat_cache->nb_free
+        : __count_free_blocks(ctx);
+    if (nb_free == BLOCK_ERROR)
+        return BLOCK_ERROR;
+
+    while ((size_t)nb_free < nb_blocks)
+    {
+        // A FAT table stored in one of its own entries takes one of them
+        sblock_t new_fat_block = create_fat(ctx);
+        if (new_fat_block == BLOCK_ERROR)
+            return BLOCK_ERROR;
+        nb_free += NB_FAT_ENTRIES_PER_BLOCK - 1;
+    }
+
+    return 0;
+}
+
+sblock_t allocate_blocks(struct shlkfs_ctx *ctx, size_t nb_blocks)
+{
+    SHLKFS_CTX_SCOPE(ctx);
+
+    if (nb_blocks == 0 || reserve_blocks(ctx, nb_blocks))
+        return BLOCK_ERROR;
+
+    sblock_t first_block = BLOCK_END;
+    sblock_t previous_block = BLOCK_END;
+    for (size_t i = 0; i < nb_blocks; i++)
+    {
+        block_t block = find_first_free_block_safe(ctx);
+        if (block == (block_t)BLOCK_ERROR
+            || write_fat_offset(ctx, block, BLOCK_END))
+            return BLOCK_ERROR;
+
+        if (previous_block == BLOCK_END)
+            first_block = block;
+        else if (write_fat_offset(ctx, previous_block, block))
+            return BLOCK_ERROR;
+        previous_block = block;
     }
 
-    return tmp_fat.entries[offset % NB_FAT_ENTRIES_PER_BLOCK].next_block;
+    return first_block;
+}
+
+int fat_cache_load(struct shlkfs_ctx *ctx)
+{
+    SHLKFS_CTX_SCOPE(ctx);
+
+    if (ctx->fat_cache != NULL)
+        return 0;
+
+    struct fat_cache *cache = xcalloc(1, sizeof(struct fat_cache));
+    ctx->fat_cache = cache;
+
+    // A corrupted chain must not be followed forever
+    size_t block_size = get_block_size();
+    size_t max_tables = get_device_size() / block_size;
+    unsigned char *encrypted = xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                                              FAT_LOAD_CHUNK, block_size);
+    unsigned char *decrypted = xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                                              FAT_LOAD_CHUNK, block_size);
+    block_t blocks[FAT_LOAD_CHUNK];
+
+    uint64_t fat_block = FIRST_FAT_BLOCK;
+    while (fat_block != (uint64_t)BLOCK_END)
+    {
+        // The chain is followed by decrypting only the first AES block of
+        // each FAT table (where next_fat_table is)...
+        size_t nb_tables = 0;
+        while (nb_tables < FAT_LOAD_CHUNK && fat_block != (uint64_t)BLOCK_END)
+        {
+            unsigned char *table = encrypted + nb_tables * block_size;
+            if (cache->nb_tables + nb_tables >= max_tables
+                || read_blocks(fat_block, 1, table))
+                goto err_fat_cache_load;
+
+            struct CryptFS_FAT *head =
+                (struct CryptFS_FAT *)(decrypted + nb_tables * block_size);
+            if (decrypt_block_head(ctx->aes_key, fat_block, table, head,
+                                   AES_BLOCK_SIZE))
+                goto err_fat_cache_load;
+            blocks[nb_tables++] = fat_block;
+            fat_block = head->next_fat_table;
+        }
+
+        // ...then the whole tables are decrypted on all cores
+        if (decrypt_blocks(ctx->aes_key, blocks, encrypted, decrypted,
+                           nb_tables))
+            goto err_fat_cache_load;
+        for (size_t i = 0; i < nb_tables; i++)
+        {
+            struct CryptFS_FAT *fat =
+                xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, block_size);
+            memcpy(fat, decrypted + i * block_size, block_size);
+            __fat_cache_append(cache, blocks[i], fat, false);
+        }
+    }
+
+    free(decrypted);
+    free(encrypted);
+    return 0;
+
+err_fat_cache_load:
+    free(decrypted);
+    free(encrypted);
+    fat_cache_unload(ctx);
+    return BLOCK_ERROR;
+}
+
+int fat_cache_commit(struct shlkfs_ctx *ctx)
+{
+    SHLKFS_CTX_SCOPE(ctx);
+
+    struct fat_cache *cache = ctx->fat_cache;
+    if (cache == NULL)
+        return 0;
+
+    // Write all the modified FAT tables at once
+    struct block_request *requests =
+        xcalloc(cache->nb_tables, sizeof(struct block_request));
+    size_t nb_requests = 0;
+    for (size_t i = 0; i < cache->nb_tables; i++)
+        if (cache->dirty[i])
+            requests[nb_requests++] = (struct block_request){
+                .start_block = cache->blocks[i],
+                .nb_blocks = 1,
+                .buffer = cache->tables[i],
+            };
+    int res = nb_requests == 0
+        ? 0
+        : write_blocks_batch_with_encryption(ctx->aes_key, requests,
+                                             nb_requests);
+    free(requests);
+    if (res)
+        return BLOCK_ERROR;
+
+    // Point the header to the last FAT table
+    struct CryptFS_Header *header =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    if (read_blocks(HEADER_BLOCK, 1, header))
+        goto err_fat_cache_commit;
+    if (header->last_fat_block != cache->blocks[cache->nb_tables - 1])
+    {
+        header->last_fat_block = cache->blocks[cache->nb_tables - 1];
+        if (write_blocks(HEADER_BLOCK, 1, header))
+            goto err_fat_cache_commit;
+    }
+    free(header);
+
+    memset(cache->dirty, 0, cache->nb_tables * sizeof(bool));
+    return 0;
+
+err_fat_cache_commit:
+    free(header);
+    return BLOCK_ERROR;
+}
+
+uint32_t fat_cache_read(const struct shlkfs_ctx *ctx, uint64_t offset)
+{
+    return __fat_cache_read(ctx->fat_cache, offset);
+}
+
+uint64_t fat_cache_nb_entries(const struct shlkfs_ctx *ctx)
+{
+    return ctx->fat_cache->nb_tables * NB_FAT_ENTRIES_PER_BLOCK;
+}
+
+const block_t *fat_cache_tables(const struct shlkfs_ctx *ctx,
+                                size_t *nb_tables)
+{
+    *nb_tables = ctx->fat_cache->nb_tables;
+    return ctx->fat_cache->blocks;
+}
+
+void fat_cache_unload(struct shlkfs_ctx *ctx)
+{
+    struct fat_cache *cache = ctx->fat_cache;
+    if (cache == NULL)
+        return;
+
+    for (size_t i = 0; i < cache->nb_tables; i++)
+        free(cache->tables[i]);
+    free(cache->tables);
+    free(cache->blocks);
+    free(cache->dirty);
+    free(cache);
+    ctx->fat_cache = NULL;
 }
@@ -11,37 +11,41 @@
 #include <unistd.h>
 
 #include "block.h"
+#include "block_cipher.h"
 #include "cryptfs.h"
 #include "crypto.h"
 #include "fat.h"
 #include "maths.h"
 #include "print.h"
+#include "writefs.h"
 #include "xalloc.h"
 
 bool is_already_formatted(const char *device_path)
 {
-    FILE *file = fopen(device_path, "r");
-    if (file == NULL)
-        return false;
-
     struct CryptFS_Header header = { 0 };
-
-    fread(&header, sizeof(header), 1, file);
-
-    fclose(file);
+    if (read_device_bytes(device_path, 0, sizeof(header), &header))
+        return false;
 
     // Check if the magic number is correct
     if (strncmp((char *)header.magic, CRYPTFS_MAGIC, CRYPTFS_MAGIC_SIZE) != 0)
         return false;
     // Check if the version is correct
-    else if (header.version != CRYPTFS_VERSION)
+    else if (header.version < CRYPTFS_VERSION_MIN
+             || header.version > CRYPTFS_VERSION)
     {
         print_error("Implementation not supported\n");
         return false;
     }
-    // Check if the blocksize is exactly CRYPTFS_BLOCK_SIZE_BYTES
-    // (the only supported block size in this implementation)
-    else if (header.blocksize != CRYPTFS_BLOCK_SIZE_BYTES)
+    // Check if the cipher is supported by this implementation
+    else if (block_cipher_get(header.cipher) == NULL)
+    {
+        print_error("The cipher '%d' is not supported in this "
+                    "implementation\n",
+                    header.cipher);
+        return false;
+    }
+    // Check if the blocksize is supported by this implementation
+    else if (!is_block_size_supported(header.blocksize))
     {
         print_error("The size '%d' is not supported in this implementation\n",
                     header.blocksize);
@@ -51,11 +55,23 @@ bool is_already_formatted(const char *device_path)
     return true;
 }
 
-void format_fill_filesystem_struct(struct CryptFS *shlkfs, const char *label,
-                                   char *rsa_passphrase,
-                                   EVP_PKEY *existing_rsa_keypair,
-                                   const char *public_key_path,
-                                   const char *private_key_path)
+/**
+ * @brief Fill the `struct CryptFS` structure, leaving the FAT, the root entry
+ * and the root directory unencrypted.
+ *
+ * @param shlkfs The `struct CryptFS` structure to fill.
+ * @param label The label (name) of the filesystem.
+ * @param rsa_passphrase The passphrase used to encrypt the RSA private key on
+ * disk. Set to NULL if no passphrase is needed.
+ * @param existing_rsa_keypair The RSA keypair to use.
+ * @param public_key_path The path where the public key will be stored.
+ * @param private_key_path The path where the private key will be stored.
+ * @param aes_key The AES (master) key of the filesystem.
+ */
+static void __format_fill_filesystem_struct(
+    struct CryptFS *shlkfs, const char *label, char *rsa_passphrase,
+    EVP_PKEY *existing_rsa_keypair, const char *public_key_path,
+    const char *private_key_path, const unsigned char *aes_key)
 {
     /// ------------------------------------------------------------
     /// BLOCK 0 : HEADER
@@ -64,7 +80,7 @@ void format_fill_filesystem_struct(struct CryptFS *shlkfs, const char *label,
     // Craft the header
     memcpy((char *)shlkfs->header.magic, CRYPTFS_MAGIC, CRYPTFS_MAGIC_SIZE);
     shlkfs->header.version = CRYPTFS_VERSION;
-    shlkfs->header.blocksize = CRYPTFS_BLOCK_SIZE_BYTES;
+    shlkfs->header.blocksize = get_block_size();
     if (label)
         memcpy((char *)shlkfs->header.label, label,
                MIN(strlen(label), CRYPTFS_LABEL_SIZE));
@@ -77,9 +93,7 @@ void format_fill_filesystem_struct(struct CryptFS *shlkfs, const char *label,
     /// BLOCK 1 : KEYS STORAGE
     /// ------------------------------------------------------------
 
-    // Generate AES + RSA keys
-    unsigned char *aes_key = generate_aes_key();
-
+    // Generate RSA keys
     EVP_PKEY *rsa_key = NULL;
     if (existing_rsa_keypair != NULL)
         rsa_key = EVP_PKEY_dup((EVP_PKEY *)existing_rsa_keypair);
@@ -158,6 +172,21 @@ void format_fill_filesystem_struct(struct CryptFS *shlkfs, const char *label,
         ROOT_ENTRY_BLOCK;
     shlkfs->root_directory.current_directory_entry.directory_index = 0;
 
+    EVP_PKEY_free(rsa_key);
+}
+
+void format_fill_filesystem_struct(struct CryptFS *shlkfs, const char *label,
+                                   char *rsa_passphrase,
+                                   EVP_PKEY *existing_rsa_keypair,
+                                   const char *public_key_path,
+                                   const char *private_key_path)
+{
+    unsigned char *aes_key = generate_aes_key();
+
+    __format_fill_filesystem_struct(shlkfs, label, rsa_passphrase,
+                                    existing_rsa_keypair, public_key_path,
+                                    private_key_path, aes_key);
+
     /// ------------------------------------------------------------
     /// Encrypting FAT and ROOT DIRECTORY with AES
     /// ------------------------------------------------------------
@@ -184,7 +213,6 @@ void format_fill_filesystem_struct(struct CryptFS *shlkfs, const char *label,
            encrypted_root_dir_size);
 
     free(aes_key);
-    EVP_PKEY_free(rsa_key);
     free(encrypted_fat);
     free(encrypted_root_dir);
     free(encrypted_root_directory);
@@ -199,22 +227,37 @@ void format_fs(const char *path, char *public_key_path, char *private_key_path,
 
     set_device_path(path);
 
-    format_fill_filesystem_struct(shlkfs, label, rsa_passphrase,
-                                  existing_rsa_keypair, public_key_path,
-                                  private_key_path);
-
-    FILE *file = fopen(path, "r+");
-    if (file == NULL)
-        error_exit("Impossible to open the fill\n", EXIT_FAILURE);
+    unsigned char *aes_key = generate_aes_key();
+    __format_fill_filesystem_struct(shlkfs, label, rsa_passphrase,
+                                    existing_rsa_keypair, public_key_path,
+                                    private_key_path, aes_key);
+    shlkfs->header.cipher = get_block_cipher();
+
+    // The FAT, the root entry and the root directory take a whole block each
+    // (which can be larger than their part in `struct CryptFS`), they are
+    // then encrypted separately from the header and the keys storage.
+    size_t nb_metadata_blocks = ROOT_DIR_BLOCK - FIRST_FAT_BLOCK + 1;
+    char *metadata = xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                                     nb_metadata_blocks, get_block_size());
+    char *metadata_in_struct = (char *)&shlkfs->first_fat;
+    for (size_t i = 0; i < nb_metadata_blocks; i++)
+        memcpy(metadata + i * get_block_size(),
+               metadata_in_struct + i * CRYPTFS_BLOCK_SIZE_BYTES,
+               CRYPTFS_BLOCK_SIZE_BYTES);
+    memset(metadata_in_struct, 0,
+           nb_metadata_blocks * CRYPTFS_BLOCK_SIZE_BYTES);
 
     // Write the filesystem structure on the disk
     print_info("Writing the filesystem structure on the device...\n");
-    if (fwrite(shlkfs, sizeof(*shlkfs), 1, file) != 1)
+    write_cryptfs_headers(path, shlkfs);
+    if (write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK,
+                                     nb_metadata_blocks, metadata))
         error_exit("Impossible to write the filesystem structure\n",
                    EXIT_FAILURE);
 
+    free(aes_key);
+    free(metadata);
     free(shlkfs);
-    fclose(file);
 }
 
 bool keypair_in_home_exist(void)
@@ -0,0 +1,534 @@
+#include "fsck.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "entries.h"
+#include "fat.h"
+#include "keytable.h"
+#include "maths.h"
+#include "print.h"
+#include "shlkfs_ctx.h"
+#include "thread_pool.h"
+#include "xalloc.h"
+
+/**
+ * @brief An entry of the directory tree to check.
+ */
+struct fsck_item
+{
+    struct CryptFS_Entry_ID id; // The ID of the entry
+    struct CryptFS_Entry entry; // The entry
+    char *path; // The path of the entry (to free)
+};
+
+/**
+ * @brief An error found on an entry, and its repair.
+ */
+struct fsck_problem
+{
+    struct fsck_item item; // The entry
+    char reason[128]; // Description of the error
+    bool cut; // Whether the chain is cut after its first `nb_blocks` blocks
+    size_t nb_blocks; // Number of blocks kept in the chain (if cut)
+    block_t last_block; // Last block kept in the chain (if cut and not 0)
+    uint64_t size; // The size to set
+    bool repairable; // Whether the error can be repaired
+};
+
+/**
+ * @brief A list of items (see __fsck_push).
+ */
+struct fsck_list
+{
+    struct fsck_item *items; // The items
+    size_t nb_items; // Number of items
+    size_t capacity; // Allocated length of `items`
+};
+
+/**
+ * @brief State of a check.
+ */
+struct fsck
+{
+    struct shlkfs_ctx *ctx; // The volume (its FAT is loaded)
+    size_t block_size; // Block size of the volume
+    uint64_t nb_entries; // Number of entries of the FAT
+    uint8_t *reached; // Bitmap of the blocks claimed by a chain
+    struct fsck_list level; // Entries of the level being checked
+    pthread_mutex_t lock; // Protects the fields below
+    struct fsck_list next_level; // Entries of the next level
+    struct fsck_list hardlinks; // Hardlinks (checked at the end)
+    struct fsck_problem *problems; // Errors found
+    size_t nb_problems; // Number of errors found
+    size_t problems_capacity; // Allocated length of `problems`
+    uint64_t nb_files; // Number of checked files (and links)
+    uint64_t nb_directories; // Number of checked directories
+};
+
+/**
+ * @brief Append an item to a list.
+ *
+ * @param list The list.
+ * @param item The item (its path is owned by the list from now on).
+ */
+static void __fsck_push(struct fsck_list *list, const struct fsck_item *item)
+{
+    if (list->nb_items == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items =
+            xrealloc(list->items, list->capacity, sizeof(struct fsck_item));
+    }
+    list->items[list->nb_items++] = *item;
+}
+
+/**
+ * @brief Free the items of a list, and empty it.
+ *
+ * @param list The list.
+ */
+static void __fsck_clear(struct fsck_list *list)
+{
+    for (size_t i = 0; i < list->nb_items; i++)
+        free(list->items[i].path);
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+/**
+ * @brief Claim a block in the reachability bitmap.
+ *
+ * @param fsck The check.
+ * @param block The block.
+ * @return true if the block was already claimed by another chain, false
+ * otherwise.
+ */
+static bool __fsck_claim(struct fsck *fsck, block_t block)
+{
+    uint8_t bit = 1 << (block % 8);
+    return __atomic_fetch_or(&fsck->reached[block / 8], bit, __ATOMIC_RELAXED)
+        & bit;
+}
+
+/**
+ * @brief Check if a block is claimed by a chain.
+ *
+ * @param fsck The check.
+ * @param block The block.
+ * @return true if the block is claimed, false otherwise.
+ */
+static bool __fsck_is_claimed(const struct fsck *fsck, block_t block)
+{
+    return (fsck->reached[block / 8] >> (block % 8)) & 1;
+}
+
+/**
+ * @brief Record an error found on an entry.
+ *
+ * @param fsck The check.
+ * @param problem The error (the path of its item is copied).
+ */
+static void __fsck_report(struct fsck *fsck,
+                          const struct fsck_problem *problem)
+{
+    pthread_mutex_lock(&fsck->lock);
+    if (fsck->nb_problems == fsck->problems_capacity)
+    {
+        fsck->problems_capacity =
+            fsck->problems_capacity ? fsck->problems_capacity * 2 : 16;
+        fsck->problems = xrealloc(fsck->problems, fsck->problems_capacity,
+                                  sizeof(struct fsck_problem));
+    }
+    struct fsck_problem *copy = &fsck->problems[fsck->nb_problems++];
+    *copy = *problem;
+    copy->item.path = strdup(problem->item.path);
+    pthread_mutex_unlock(&fsck->lock);
+}
+
+/**
+ * @brief Queue the used entries of a directory block for the next level.
+ *
+ * @param fsck The check.
+ * @param parent The directory.
+ * @param block The directory block.
+ * @param directory The decrypted directory block.
+ * @return uint64_t The number of used entries of the block.
+ */
+static uint64_t __fsck_queue_children(struct fsck *fsck,
+                                      const struct fsck_item *parent,
+                                      block_t block,
+                                      const struct CryptFS_Directory *directory)
+{
+    uint64_t nb_used = 0;
+    for (uint32_t i = 0; i < NB_ENTRIES_PER_BLOCK; i++)
+    {
+        const struct CryptFS_Entry *entry = &directory->entries[i];
+        if (!entry->used)
+            continue;
+
+        nb_used++;
+        struct fsck_item child = { .id = { .directory_block = block,
+                                           .directory_index = i },
+                                   .entry = *entry };
+        size_t path_size = strlen(parent->path) + ENTRY_NAME_MAX_LEN + 2;
+        child.path = xmalloc(path_size, sizeof(char));
+        snprintf(child.path, path_size, "%s%s%.*s", parent->path,
+                 strcmp(parent->path, "/") == 0 ? "" : "/",
+                 ENTRY_NAME_MAX_LEN, entry->name);
+
+        pthread_mutex_lock(&fsck->lock);
+        __fsck_push(entry->type == ENTRY_TYPE_HARDLINK ? &fsck->hardlinks
+                                                       : &fsck->next_level,
+                    &child);
+        pthread_mutex_unlock(&fsck->lock);
+    }
+
+    return nb_used;
+}
+
+/**
+ * @brief Check an entry of the current level: claim the blocks of its chain,
+ * check its size, and queue its children if it is a directory.
+ *
+ * @param arg The check.
+ * @param index The index of the entry in the current level.
+ * @return int 0 on success, -1 on I/O error.
+ */
+static int __fsck_entry_task(void *arg, size_t index)
+{
+    struct fsck *fsck = arg;
+    const struct fsck_item *item = &fsck->level.items[index];
+    const struct CryptFS_Entry *entry = &item->entry;
+    bool is_directory = entry->type == ENTRY_TYPE_DIRECTORY;
+
+    // The pool threads read the device of the volume
+    struct block_device *previous_device =
+        block_device_use(fsck->ctx->device);
+    struct CryptFS_Directory *directory =
+        is_directory
+        ? xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, fsck->block_size)
+        : NULL;
+
+    // A file owns the blocks needed by its size, a directory its whole chain
+    uint64_t needed = is_directory
+        ? UINT64_MAX
+        : (entry->size + fsck->block_size - 1) / fsck->block_size;
+    struct fsck_problem problem = { .item = *item, .size = entry->size };
+    uint64_t nb_used = 0;
+    int res = 0;
+
+    block_t block = entry->start_block;
+    while (block != 0 && block != (uint32_t)BLOCK_END)
+    {
+        uint32_t next = block < fsck->nb_entries
+            ? fat_cache_read(fsck->ctx, block)
+            : (uint32_t)FAT_INDEX_OOB;
+        if (problem.nb_blocks == needed)
+            snprintf(problem.reason, sizeof(problem.reason),
+                     "chain longer than the size (%lu bytes)",
+                     (unsigned long)entry->size);
+        else if (block <= ROOT_ENTRY_BLOCK || next == BLOCK_FREE
+                 || next == (uint32_t)BLOCK_ERROR
+                 || next == (uint32_t)FAT_INDEX_OOB)
+            snprintf(problem.reason, sizeof(problem.reason),
+                     "broken chain (block %lu is not allocated)",
+                     (unsigned long)block);
+        else if (__fsck_claim(fsck, block))
+            snprintf(problem.reason, sizeof(problem.reason),
+                     "cross-linked chain (block %lu is claimed twice)",
+                     (unsigned long)block);
+        if (problem.reason[0] != '\0')
+        {
+            problem.cut = true;
+            problem.repairable = true;
+            break;
+        }
+
+        if (is_directory)
+        {
+            if (read_blocks_with_decryption(fsck->ctx->aes_key, block, 1,
+                                            directory))
+            {
+                print_error("Failed to read the directory '%s'\n",
+                            item->path);
+                res = -1;
+                break;
+            }
+            nb_used += __fsck_queue_children(fsck, item, block, directory);
+        }
+
+        problem.last_block = block;
+        problem.nb_blocks++;
+        block = next;
+    }
+
+    // The size must agree with the blocks kept in the chain
+    if (is_directory)
+    {
+        __atomic_fetch_add(&fsck->nb_directories, 1, __ATOMIC_RELAXED);
+        problem.size = nb_used;
+    }
+    else
+    {
+        __atomic_fetch_add(&fsck->nb_files, 1, __ATOMIC_RELAXED);
+        problem.size = MIN(entry->size, problem.nb_blocks * fsck->block_size);
+    }
+    if (problem.size != entry->size && problem.reason[0] == '\0')
+    {
+        snprintf(problem.reason, sizeof(problem.reason),
+                 "size %lu disagrees with the %s (%lu)",
+                 (unsigned long)entry->size,
+                 is_directory ? "used entries" : "chain",
+                 (unsigned long)problem.size);
+        problem.repairable = true;
+    }
+    if (res == 0 && problem.reason[0] != '\0')
+        __fsck_report(fsck, &problem);
+
+    free(directory);
+    block_device_use(previous_device);
+    return res;
+}
+
+/**
+ * @brief Claim the blocks of the headers, of the FAT tables and of the key
+ * table.
+ *
+ * @param fsck The check.
+ * @return int 0 on success, -1 on error.
+ */
+static int __fsck_claim_metadata(struct fsck *fsck)
+{
+    for (block_t block = HEADER_BLOCK; block <= ROOT_ENTRY_BLOCK; block++)
+        __fsck_claim(fsck, block);
+
+    size_t nb_tables = 0;
+    const block_t *tables = fat_cache_tables(fsck->ctx, &nb_tables);
+    for (size_t i = 0; i < nb_tables; i++)
+        if (tables[i] < fsck->nb_entries)
+            __fsck_claim(fsck, tables[i]);
+
+    // The key table is a chain of the FAT owned by no entry
+    struct CryptFS_Header *header =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, fsck->block_size);
+    struct CryptFS_KeyTable *key_table =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, fsck->block_size);
+    int res = read_blocks(HEADER_BLOCK, 1, header);
+    block_t table_block = res == 0 ? header->key_table_block : 0;
+    if (table_block != 0)
+        res = read_blocks(table_block, 1, key_table);
+    for (uint64_t i = 0;
+         res == 0 && table_block != 0 && i < key_table->nb_blocks; i++)
+        if (table_block + i < fsck->nb_entries)
+            __fsck_claim(fsck, table_block + i);
+    if (res)
+        print_error("Failed to read the key table of the volume\n");
+
+    free(key_table);
+    free(header);
+    return res == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Walk the directory tree level by level, checking the entries of a
+ * level in parallel.
+ *
+ * @param fsck The check (its metadata blocks are claimed).
+ * @return int 0 on success, -1 on error.
+ */
+static int __fsck_walk(struct fsck *fsck)
+{
+    struct CryptFS_Entry_ID root_id = { .directory_block = ROOT_ENTRY_BLOCK,
+                                        .directory_index = 0 };
+    struct CryptFS_Entry *root = get_entry_from_id(fsck->ctx, root_id);
+    if (root == NULL)
+    {
+        print_error("Failed to read the root directory\n");
+        return -1;
+    }
+    struct fsck_item root_item = { .id = root_id,
+                                   .entry = *root,
+                                   .path = strdup("/") };
+    free(root);
+    __fsck_push(&fsck->next_level, &root_item);
+
+    int res = 0;
+    for (size_t depth = 0; res == 0 && fsck->next_level.nb_items > 0; depth++)
+    {
+        fsck->level = fsck->next_level;
+        memset(&fsck->next_level, 0, sizeof(fsck->next_level));
+        print_debug("Checking %zu entries at depth %zu...\n",
+                    fsck->level.nb_items, depth);
+
+        res = thread_pool_parallel_for(__fsck_entry_task, fsck,
+                                       fsck->level.nb_items);
+        __fsck_clear(&fsck->level);
+    }
+
+    __fsck_clear(&fsck->next_level);
+    return res;
+}
+
+/**
+ * @brief Report the hardlinks to a chain claimed by no file.
+ *
+ * @param fsck The check (the tree is walked).
+ */
+static void __fsck_check_hardlinks(struct fsck *fsck)
+{
+    for (size_t i = 0; i < fsck->hardlinks.nb_items; i++)
+    {
+        const struct fsck_item *item = &fsck->hardlinks.items[i];
+        block_t block = item->entry.start_block;
+        if (block == 0
+            || (block < fsck->nb_entries && __fsck_is_claimed(fsck, block)))
+            continue;
+
+        struct fsck_problem problem = { .item = *item,
+                                        .size = item->entry.size };
+        snprintf(problem.reason, sizeof(problem.reason),
+                 "hardlink to a chain owned by no file (block %lu)",
+                 (unsigned long)block);
+        __fsck_report(fsck, &problem);
+    }
+    fsck->nb_files += fsck->hardlinks.nb_items;
+}
+
+/**
+ * @brief Repair an error on an entry: cut its chain and fix its size.
+ *
+ * @param fsck The check.
+ * @param problem The error.
+ * @return int 0 on success, -1 on error.
+ */
+static int __fsck_repair(struct fsck *fsck,
+                         const struct fsck_problem *problem)
+{
+    struct CryptFS_Entry entry = problem->item.entry;
+    if (problem->cut && problem->nb_blocks == 0)
+        entry.start_block = 0;
+    else if (problem->cut
+             && write_fat_offset(fsck->ctx, problem->last_block, BLOCK_END))
+        return -1;
+
+    entry.size = problem->size;
+    return write_entry_from_id(fsck->ctx, problem->item.id, &entry) ? -1 : 0;
+}
+
+/**
+ * @brief Check (and repair) an opened volume.
+ *
+ * @param fsck The check (its volume is set).
+ * @param repair true to repair the errors.
+ * @return int FSCK_CLEAN, FSCK_REPAIRED, FSCK_ERRORS or FSCK_FAILURE.
+ */
+static int __fsck(struct fsck *fsck, bool repair)
+{
+    SHLKFS_CTX_SCOPE(fsck->ctx);
+
+    print_info("Loading the FAT...\n");
+    if (fat_cache_load(fsck->ctx))
+    {
+        print_error("Failed to load the FAT of the volume\n");
+        return FSCK_FAILURE;
+    }
+    fsck->block_size = get_block_size();
+    fsck->nb_entries = fat_cache_nb_entries(fsck->ctx);
+    fsck->reached = xcalloc((fsck->nb_entries + 7) / 8, 1);
+    pthread_mutex_init(&fsck->lock, NULL);
+
+    print_info("Walking the directory tree...\n");
+    int res = FSCK_FAILURE;
+    if (__fsck_claim_metadata(fsck) || __fsck_walk(fsck))
+        goto end_fsck;
+    __fsck_check_hardlinks(fsck);
+
+    // The blocks used in the FAT but claimed by no chain are leaked
+    uint64_t nb_used = 0;
+    uint64_t nb_leaked = 0;
+    for (block_t block = 0; block < fsck->nb_entries; block++)
+    {
+        if (fat_cache_read(fsck->ctx, block) == BLOCK_FREE)
+            continue;
+        nb_used++;
+        if (__fsck_is_claimed(fsck, block))
+            continue;
+
+        nb_leaked++;
+        if (repair && write_fat_offset(fsck->ctx, block, BLOCK_FREE))
+            goto end_fsck;
+    }
+
+    bool unrepaired = false;
+    for (size_t i = 0; i < fsck->nb_problems; i++)
+    {
+        const struct fsck_problem *problem = &fsck->problems[i];
+        const char *status = "";
+        if (repair)
+            status = problem->repairable ? " (repaired)" : " (not repaired)";
+        print_warning("'%s': %s%s\n", problem->item.path, problem->reason,
+                      status);
+        if (!problem->repairable || !repair)
+            unrepaired = true;
+        else if (__fsck_repair(fsck, problem))
+            goto end_fsck;
+    }
+    if (nb_leaked > 0)
+    {
+        print_warning("%lu leaked blocks%s\n", (unsigned long)nb_leaked,
+                      repair ? " (freed)" : "");
+        unrepaired |= !repair;
+    }
+
+    if (repair && fat_cache_commit(fsck->ctx))
+        goto end_fsck;
+
+    print_info("%lu files, %lu directories, %lu used blocks\n",
+               (unsigned long)fsck->nb_files,
+               (unsigned long)fsck->nb_directories, (unsigned long)nb_used);
+    if (unrepaired)
+        res = FSCK_ERRORS;
+    else if (fsck->nb_problems > 0 || nb_leaked > 0)
+        res = FSCK_REPAIRED;
+    else
+        res = FSCK_CLEAN;
+
+end_fsck:
+    for (size_t i = 0; i < fsck->nb_problems; i++)
+        free(fsck->problems[i].item.path);
+    free(fsck->problems);
+    __fsck_clear(&fsck->hardlinks);
+    pthread_mutex_destroy(&fsck->lock);
+    free(fsck->reached);
+    fat_cache_unload(fsck->ctx);
+    return res;
+}
+
+int cryptfs_fsck(const char *device_path, const char *private_key_path,
+                 bool repair)
+{
+    struct fsck fsck = { 0 };
+    fsck.ctx = shlkfs_ctx_open_with_key(device_path, private_key_path);
+    if (fsck.ctx == NULL)
+        return FSCK_FAILURE;
+
+    int res = __fsck(&fsck, repair);
+    shlkfs_ctx_close(fsck.ctx);
+
+    if (res == FSCK_CLEAN)
+        print_success("The volume of the device '%s' is clean\n",
+                      device_path);
+    else if (res == FSCK_REPAIRED)
+        print_success("The volume of the device '%s' has been repaired\n",
+                      device_path);
+    else if (res == FSCK_ERRORS)
+        print_warning("The volume of the device '%s' has errors%s\n",
+                      device_path, repair ? "" : " (run with --repair)");
+    return res;
+}
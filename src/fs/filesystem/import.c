@@ -0,0 +1,858 @@
+#include "import.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "entries.h"
+#include "fat.h"
+#include "print.h"
+#include "shlkfs_ctx.h"
+#include "xalloc.h"
+
+// Size of the chunks of file content read from the source, then encrypted
+// and written at once (see write_blocks_with_encryption)
+#define IMPORT_CHUNK_BYTES (16 * 1024 * 1024)
+
+#define TAR_BLOCK_SIZE 512
+
+/**
+ * @brief State of an import.
+ */
+struct import
+{
+    struct shlkfs_ctx *ctx; // The volume
+    unsigned char *buffer; // Buffer of `chunk_blocks` blocks
+    size_t chunk_blocks; // Number of blocks of the buffer
+    size_t nb_files; // Number of imported files (and symbolic links)
+    size_t nb_directories; // Number of imported directories
+    uint64_t nb_bytes; // Number of imported bytes
+};
+
+/**
+ * @brief An entry to import.
+ */
+struct import_entry
+{
+    const char *path; // The path of the entry in the volume
+    enum ENTRY_TYPE type; // The type of the entry
+    uint64_t size; // The size of the content (files only)
+    const char *target; // The target (symbolic links only)
+    uint32_t mode; // Permissions
+    uint32_t uid; // User ID
+    uint32_t gid; // Group ID
+    uint32_t mtime; // Modification time
+};
+
+/**
+ * @brief Read up to `size` bytes from a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param buffer The buffer to fill.
+ * @param size The number of bytes to read.
+ * @return ssize_t The number of bytes read (less than `size` only at the end
+ * of the file), -1 on error.
+ */
+static ssize_t __read_full(int fd, void *buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t res = read(fd, (char *)buffer + done, size - done);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res == -1)
+            return -1;
+        if (res == 0)
+            break;
+        done += res;
+    }
+
+    return done;
+}
+
+/**
+ * @brief Free a chain allocated by __import_content.
+ *
+ * @param import The import.
+ * @param first_block The first block of the chain.
+ */
+static void __free_content(struct import *import, block_t first_block)
+{
+    block_t block = first_block;
+    while (block != (uint32_t)BLOCK_END)
+    {
+        uint32_t next = read_fat_offset(import->ctx, block);
+        if (next == (uint32_t)BLOCK_ERROR
+            || write_fat_offset(import->ctx, block, BLOCK_FREE))
+            return;
+        block = next;
+    }
+}
+
+/**
+ * @brief Write the content of a file in newly allocated blocks.
+ *
+ * @param import The import.
+ * @param fd The file descriptor to read the content from.
+ * @param path The path of the entry in the volume (for the error messages).
+ * @param size The size of the content.
+ * @return sblock_t The first block of the content, BLOCK_ERROR on error (the
+ * blocks are freed).
+ */
+static sblock_t __import_content(struct import *import, int fd,
+                                 const char *path, uint64_t size)
+{
+    size_t block_size = get_block_size();
+    size_t nb_blocks = (size + block_size - 1) / block_size;
+
+    sblock_t first_block = allocate_blocks(import->ctx, nb_blocks);
+    if (first_block == BLOCK_ERROR)
+    {
+        print_error("Failed to allocate %zu blocks for '%s'\n", nb_blocks,
+                    path);
+        return BLOCK_ERROR;
+    }
+
+    block_t block = first_block;
+    uint64_t remaining = size;
+    while (remaining > 0)
+    {
+        size_t chunk_size = import->chunk_blocks * block_size;
+        if (remaining < chunk_size)
+            chunk_size = remaining;
+        if (__read_full(fd, import->buffer, chunk_size) != (ssize_t)chunk_size)
+        {
+            print_error("Failed to read the content of '%s'\n", path);
+            __free_content(import, first_block);
+            return BLOCK_ERROR;
+        }
+        size_t chunk_blocks = (chunk_size + block_size - 1) / block_size;
+        memset(import->buffer + chunk_size, 0,
+               chunk_blocks * block_size - chunk_size);
+
+        // Write the chunk with one request per contiguous run of blocks
+        for (size_t i = 0; i < chunk_blocks;)
+        {
+            block_t run_start = block;
+            size_t run_length = 0;
+            do
+            {
+                block = read_fat_offset(import->ctx, block);
+                run_length++;
+            } while (i + run_length < chunk_blocks
+                     && block == run_start + run_length);
+
+            if (block == (uint32_t)BLOCK_ERROR
+                || write_blocks_with_encryption(
+                    import->ctx->aes_key, run_start, run_length,
+                    import->buffer + i * block_size))
+            {
+                print_error("Failed to write the content of '%s'\n", path);
+                __free_content(import, first_block);
+                return BLOCK_ERROR;
+            }
+            i += run_length;
+        }
+
+        remaining -= chunk_size;
+    }
+
+    return first_block;
+}
+
+/**
+ * @brief Import an entry in a directory of the volume.
+ *
+ * @param import The import.
+ * @param parent_id The ID of the parent directory in the volume.
+ * @param check Whether the entry can already exist in the volume (false if
+ * the parent directory has just been created by the import).
+ * @param entry The entry to import.
+ * @param fd The file descriptor to read the content from (files only).
+ * @param entry_id The ID of the entry in the volume. (returned, can be NULL)
+ * @return int 0 if the entry was created, 1 if it is an existing directory,
+ * -1 on error.
+ */
+static int __import_entry(struct import *import,
+                          struct CryptFS_Entry_ID parent_id, bool check,
+                          const struct import_entry *entry, int fd,
+                          struct CryptFS_Entry_ID *entry_id)
+{
+    struct shlkfs_ctx *ctx = import->ctx;
+
+    if (check)
+    {
+        struct CryptFS_Entry_ID *existing_id =
+            get_entry_by_path(ctx, entry->path);
+        if (existing_id == (void *)BLOCK_ERROR)
+            return -1;
+        if (existing_id != (void *)ENTRY_NO_SUCH)
+        {
+            struct CryptFS_Entry *existing =
+                get_entry_from_id(ctx, *existing_id);
+            bool merge = existing != NULL
+                && existing->type == ENTRY_TYPE_DIRECTORY
+                && entry->type == ENTRY_TYPE_DIRECTORY;
+            if (merge && entry_id != NULL)
+                *entry_id = *existing_id;
+            free(existing);
+            free(existing_id);
+            if (merge)
+                return 1;
+            print_error("'%s' already exists in the volume\n", entry->path);
+            return -1;
+        }
+    }
+
+    const char *name = strrchr(entry->path, '/') + 1;
+    if (strlen(name) >= ENTRY_NAME_MAX_LEN)
+    {
+        print_error("The name of '%s' is too long\n", entry->path);
+        return -1;
+    }
+
+    // Create the entry in its parent directory
+    uint32_t index;
+    switch (entry->type)
+    {
+    case ENTRY_TYPE_DIRECTORY:
+        index = entry_create_directory(ctx, parent_id, name);
+        break;
+    case ENTRY_TYPE_SYMLINK:
+        index = entry_create_symlink(ctx, parent_id, name, entry->target);
+        break;
+    default:
+        index = entry_create_empty_file(ctx, parent_id, name);
+        break;
+    }
+    if (index == (uint32_t)BLOCK_ERROR)
+    {
+        print_error("Failed to create '%s'\n", entry->path);
+        return -1;
+    }
+
+    struct CryptFS_Entry *parent = get_entry_from_id(ctx, parent_id);
+    if (parent == NULL)
+        return -1;
+    struct CryptFS_Entry_ID id = { .directory_block = parent->start_block,
+                                   .directory_index = index };
+    free(parent);
+
+    // Write the content, then the metadata of the entry
+    sblock_t start_block = 0;
+    if (entry->type == ENTRY_TYPE_FILE && entry->size > 0)
+    {
+        start_block = __import_content(import, fd, entry->path, entry->size);
+        if (start_block == BLOCK_ERROR)
+            return -1;
+    }
+
+    struct CryptFS_Entry *new_entry = get_entry_from_id(ctx, id);
+    if (new_entry == NULL)
+        return -1;
+    if (entry->type == ENTRY_TYPE_FILE)
+    {
+        new_entry->start_block = start_block;
+        new_entry->size = entry->size;
+    }
+    new_entry->mode = entry->mode & 07777;
+    new_entry->uid = entry->uid;
+    new_entry->gid = entry->gid;
+    new_entry->atime = entry->mtime;
+    new_entry->mtime = entry->mtime;
+    int res = write_entry_from_id(ctx, id, new_entry);
+    free(new_entry);
+    if (res)
+        return -1;
+
+    if (entry->type == ENTRY_TYPE_DIRECTORY)
+        import->nb_directories++;
+    else
+        import->nb_files++;
+    import->nb_bytes += entry->size;
+    if (entry_id != NULL)
+        *entry_id = id;
+    return 0;
+}
+
+// ---------------------------- Directory import -----------------------------
+
+/**
+ * @brief Compute the number of blocks needed to import a directory (its
+ * content, plus one directory block per NB_ENTRIES_PER_BLOCK entries).
+ *
+ * @param host_path The path of the directory.
+ * @param nb_blocks The number of blocks to increase.
+ * @return int 0 on success, -1 on error.
+ */
+static int __directory_blocks(const char *host_path, size_t *nb_blocks)
+{
+    DIR *dir = opendir(host_path);
+    if (dir == NULL)
+    {
+        print_error("Failed to open the directory '%s'\n", host_path);
+        return -1;
+    }
+
+    size_t nb_entries = 0;
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL)
+    {
+        if (strcmp(dirent->d_name, ".") == 0
+            || strcmp(dirent->d_name, "..") == 0)
+            continue;
+        nb_entries++;
+
+        char child_path[PATH_MAX];
+        snprintf(child_path, PATH_MAX, "%s/%s", host_path, dirent->d_name);
+        struct stat st;
+        if (lstat(child_path, &st) != 0)
+            continue;
+        if (S_ISREG(st.st_mode))
+            *nb_blocks +=
+                (st.st_size + get_block_size() - 1) / get_block_size();
+        else if (S_ISLNK(st.st_mode))
+            (*nb_blocks)++;
+        else if (S_ISDIR(st.st_mode)
+                 && __directory_blocks(child_path, nb_blocks))
+        {
+            closedir(dir);
+            return -1;
+        }
+    }
+    closedir(dir);
+
+    *nb_blocks += nb_entries / NB_ENTRIES_PER_BLOCK + 1;
+    return 0;
+}
+
+/**
+ * @brief Import the content of a directory in a directory of the volume.
+ *
+ * @param import The import.
+ * @param host_path The path of the directory to import.
+ * @param volume_path The path of the directory in the volume ("" for the
+ * root).
+ * @param dir_id The ID of the directory in the volume.
+ * @param check Whether the entries can already exist in the volume.
+ * @return int 0 on success, -1 on error.
+ */
+static int __import_directory(struct import *import, const char *host_path,
+                              const char *volume_path,
+                              struct CryptFS_Entry_ID dir_id, bool check)
+{
+    DIR *dir = opendir(host_path);
+    if (dir == NULL)
+    {
+        print_error("Failed to open the directory '%s'\n", host_path);
+        return -1;
+    }
+
+    int res = 0;
+    struct dirent *dirent;
+    while (res == 0 && (dirent = readdir(dir)) != NULL)
+    {
+        if (strcmp(dirent->d_name, ".") == 0
+            || strcmp(dirent->d_name, "..") == 0)
+            continue;
+
+        char child_host_path[PATH_MAX];
+        char child_volume_path[PATH_MAX];
+        snprintf(child_host_path, PATH_MAX, "%s/%s", host_path,
+                 dirent->d_name);
+        snprintf(child_volume_path, PATH_MAX, "%s/%s", volume_path,
+                 dirent->d_name);
+
+        struct stat st;
+        if (lstat(child_host_path, &st) != 0)
+        {
+            print_error("Failed to stat '%s'\n", child_host_path);
+            res = -1;
+            break;
+        }
+        struct import_entry entry = { .path = child_volume_path,
+                                      .mode = st.st_mode,
+                                      .uid = st.st_uid,
+                                      .gid = st.st_gid,
+                                      .mtime = st.st_mtime };
+
+        if (S_ISREG(st.st_mode))
+        {
+            int fd = open(child_host_path, O_RDONLY);
+            if (fd == -1)
+            {
+                print_error("Failed to open '%s'\n", child_host_path);
+                res = -1;
+                break;
+            }
+            entry.type = ENTRY_TYPE_FILE;
+            entry.size = st.st_size;
+            res = __import_entry(import, dir_id, check, &entry, fd, NULL);
+            close(fd);
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            entry.type = ENTRY_TYPE_DIRECTORY;
+            struct CryptFS_Entry_ID child_id;
+            int created =
+                __import_entry(import, dir_id, check, &entry, -1, &child_id);
+            res = created == -1
+                ? -1
+                : __import_directory(import, child_host_path,
+                                     child_volume_path, child_id,
+                                     created == 1);
+        }
+        else if (S_ISLNK(st.st_mode))
+        {
+            char target[PATH_MAX] = { 0 };
+            if (readlink(child_host_path, target, PATH_MAX - 1) == -1)
+            {
+                print_error("Failed to read the link '%s'\n", child_host_path);
+                res = -1;
+                break;
+            }
+            entry.type = ENTRY_TYPE_SYMLINK;
+            entry.target = target;
+            res = __import_entry(import, dir_id, check, &entry, -1, NULL);
+        }
+        else
+            print_warning("Skipping '%s': unsupported file type\n",
+                          child_host_path);
+    }
+
+    closedir(dir);
+    return res;
+}
+
+// ------------------------------- Tar import --------------------------------
+
+/**
+ * @brief Parse a numeric field of a tar header (octal, or base-256 if the
+ * high bit of its first byte is set).
+ *
+ * @param field The field.
+ * @param size The size of the field.
+ * @return uint64_t The value of the field.
+ */
+static uint64_t __tar_number(const char *field, size_t size)
+{
+    uint64_t value = 0;
+    if ((unsigned char)field[0] & 0x80)
+    {
+        value = (unsigned char)field[0] & 0x7f;
+        for (size_t i = 1; i < size; i++)
+            value = (value << 8) | (unsigned char)field[i];
+        return value;
+    }
+
+    size_t i = 0;
+    while (i < size && field[i] == ' ')
+        i++;
+    for (; i < size && field[i] >= '0' && field[i] <= '7'; i++)
+        value = value * 8 + (field[i] - '0');
+    return value;
+}
+
+/**
+ * @brief Check the checksum of a tar header.
+ *
+ * @param header The header (TAR_BLOCK_SIZE bytes).
+ * @return bool true if the checksum is valid.
+ */
+static bool __tar_checksum_valid(const unsigned char *header)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE; i++)
+        sum += i >= 148 && i < 156 ? ' ' : header[i];
+
+    return sum == __tar_number((const char *)header + 148, 8);
+}
+
+/**
+ * @brief Skip bytes of a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param size The number of bytes to skip.
+ * @param buffer A buffer to read the skipped bytes in.
+ * @param buffer_size The size of `buffer`.
+ * @return int 0 on success, -1 if there are less than `size` bytes.
+ */
+static int __skip_bytes(int fd, uint64_t size, unsigned char *buffer,
+                        size_t buffer_size)
+{
+    while (size > 0)
+    {
+        size_t length = size < buffer_size ? size : buffer_size;
+        if (__read_full(fd, buffer, length) != (ssize_t)length)
+            return -1;
+        size -= length;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Size of the padding after the data of a tar member.
+ *
+ * @param size The size of the data.
+ * @return uint64_t The size of the padding.
+ */
+static uint64_t __tar_padding(uint64_t size)
+{
+    return (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+}
+
+/**
+ * @brief Parse the records of a pax extended header ("<length> key=value\n"),
+ * keeping the path and the link path.
+ *
+ * @param records The records (NUL terminated).
+ * @param path The path. (returned, PATH_MAX bytes)
+ * @param link_path The link path. (returned, PATH_MAX bytes)
+ */
+static void __tar_parse_pax(char *records, char *path, char *link_path)
+{
+    char *record = records;
+    while (*record != '\0')
+    {
+        char *end;
+        unsigned long length = strtoul(record, &end, 10);
+        if (length == 0 || *end != ' ' || strlen(record) < length)
+            return;
+
+        char *key = end + 1;
+        char *value = strchr(key, '=');
+        record[length - 1] = '\0';
+        if (value != NULL)
+        {
+            *value++ = '\0';
+            if (strcmp(key, "path") == 0)
+                snprintf(path, PATH_MAX, "%s", value);
+            else if (strcmp(key, "linkpath") == 0)
+                snprintf(link_path, PATH_MAX, "%s", value);
+        }
+        record += length;
+    }
+}
+
+/**
+ * @brief Make the path of a tar member a path of the volume: "./a/b/" becomes
+ * "/a/b".
+ *
+ * @param name The path of the member.
+ * @param path The path in the volume. (returned, PATH_MAX bytes, "" for the
+ * root)
+ * @return int 0 on success, -1 if the path leaves the root.
+ */
+static int __tar_volume_path(const char *name, char *path)
+{
+    char copy[PATH_MAX];
+    snprintf(copy, PATH_MAX, "%s", name);
+
+    path[0] = '\0';
+    char *saveptr = NULL;
+    for (char *part = strtok_r(copy, "/", &saveptr); part != NULL;
+         part = strtok_r(NULL, "/", &saveptr))
+    {
+        if (strcmp(part, "..") == 0)
+            return -1;
+        if (strcmp(part, ".") != 0)
+            snprintf(path + strlen(path), PATH_MAX - strlen(path), "/%s",
+                     part);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Get the ID of a directory of the volume, creating it (and its
+ * parents) if it does not exist.
+ *
+ * @param import The import.
+ * @param path The path of the directory ("" for the root).
+ * @param dir_id The ID of the directory. (returned)
+ * @return int 0 on success, -1 on error.
+ */
+static int __tar_directory(struct import *import, const char *path,
+                           struct CryptFS_Entry_ID *dir_id)
+{
+    struct CryptFS_Entry_ID *id =
+        get_entry_by_path(import->ctx, path[0] == '\0' ? "/" : path);
+    if (id == (void *)BLOCK_ERROR)
+        return -1;
+    if (id != (void *)ENTRY_NO_SUCH)
+    {
+        *dir_id = *id;
+        free(id);
+        return 0;
+    }
+
+    char parent_path[PATH_MAX];
+    snprintf(parent_path, PATH_MAX, "%s", path);
+    *strrchr(parent_path, '/') = '\0';
+    struct CryptFS_Entry_ID parent_id;
+    if (__tar_directory(import, parent_path, &parent_id))
+        return -1;
+
+    struct import_entry entry = { .path = path,
+                                  .type = ENTRY_TYPE_DIRECTORY,
+                                  .mode = 0755,
+                                  .uid = getuid(),
+                                  .gid = getgid(),
+                                  .mtime = time(NULL) };
+    return __import_entry(import, parent_id, false, &entry, -1, dir_id) == -1
+        ? -1
+        : 0;
+}
+
+/**
+ * @brief Import the members of a tar archive at the root of the volume.
+ *
+ * @param import The import.
+ * @param fd The file descriptor of the archive.
+ * @return int 0 on success, -1 on error.
+ */
+static int __import_tar(struct import *import, int fd)
+{
+    unsigned char header[TAR_BLOCK_SIZE];
+    char long_name[PATH_MAX] = { 0 };
+    char long_link[PATH_MAX] = { 0 };
+    size_t skip_size = import->chunk_blocks * get_block_size();
+
+    while (true)
+    {
+        ssize_t res = __read_full(fd, header, TAR_BLOCK_SIZE);
+        if (res == 0)
+            return 0;
+        if (res != TAR_BLOCK_SIZE)
+            goto err_truncated;
+
+        // The archive ends with zero blocks
+        bool end = true;
+        for (size_t i = 0; end && i < TAR_BLOCK_SIZE; i++)
+            end = header[i] == 0;
+        if (end)
+            return 0;
+        if (!__tar_checksum_valid(header))
+        {
+            print_error("Invalid tar header\n");
+            return -1;
+        }
+
+        char *fields = (char *)header;
+        uint64_t size = __tar_number(fields + 124, 12);
+        char type = fields[156];
+
+        // Headers describing the next member
+        if (type == 'L' || type == 'K' || type == 'x')
+        {
+            if (size >= skip_size)
+            {
+                print_error("Too long tar extended header\n");
+                return -1;
+            }
+            char *data = xcalloc(size + 1, 1);
+            if (__read_full(fd, data, size) != (ssize_t)size
+                || __skip_bytes(fd, __tar_padding(size), import->buffer,
+                                skip_size))
+            {
+                free(data);
+                goto err_truncated;
+            }
+            if (type == 'x')
+                __tar_parse_pax(data, long_name, long_link);
+            else
+                snprintf(type == 'L' ? long_name : long_link, PATH_MAX, "%s",
+                         data);
+            free(data);
+            continue;
+        }
+
+        // Name of the member (ustar splits it into a prefix and a name)
+        char name[PATH_MAX];
+        if (long_name[0] != '\0')
+            snprintf(name, PATH_MAX, "%s", long_name);
+        else if (memcmp(fields + 257, "ustar", 5) == 0 && fields[345] != '\0')
+            snprintf(name, PATH_MAX, "%.155s/%.100s", fields + 345, fields);
+        else
+            snprintf(name, PATH_MAX, "%.100s", fields);
+        char target[PATH_MAX];
+        if (long_link[0] != '\0')
+            snprintf(target, PATH_MAX, "%s", long_link);
+        else
+            snprintf(target, PATH_MAX, "%.100s", fields + 157);
+        long_name[0] = '\0';
+        long_link[0] = '\0';
+
+        char path[PATH_MAX];
+        if (__tar_volume_path(name, path))
+        {
+            print_error("'%s' is outside of the archive root\n", name);
+            return -1;
+        }
+
+        struct import_entry entry = { .path = path,
+                                      .target = target,
+                                      .mode = __tar_number(fields + 100, 8),
+                                      .uid = __tar_number(fields + 108, 8),
+                                      .gid = __tar_number(fields + 116, 8),
+                                      .mtime = __tar_number(fields + 136, 12) };
+        bool has_data = false;
+        switch (type)
+        {
+        case '0':
+        case '\0':
+        case '7':
+            entry.type = ENTRY_TYPE_FILE;
+            entry.size = size;
+            has_data = true;
+            break;
+        case '5':
+            entry.type = ENTRY_TYPE_DIRECTORY;
+            break;
+        case '2':
+            entry.type = ENTRY_TYPE_SYMLINK;
+            break;
+        default:
+            print_warning("Skipping '%s': unsupported member type '%c'\n",
+                          name, type);
+            if (__skip_bytes(fd, size + __tar_padding(size), import->buffer,
+                             skip_size))
+                goto err_truncated;
+            continue;
+        }
+        if (path[0] == '\0') // The root of the archive
+            continue;
+
+        char parent_path[PATH_MAX];
+        snprintf(parent_path, PATH_MAX, "%s", path);
+        *strrchr(parent_path, '/') = '\0';
+        struct CryptFS_Entry_ID parent_id;
+        if (__tar_directory(import, parent_path, &parent_id)
+            || __import_entry(import, parent_id, true, &entry, fd, NULL) == -1)
+            return -1;
+
+        // Skip the padding of the content
+        if (has_data
+            && __skip_bytes(fd, __tar_padding(size), import->buffer,
+                            skip_size))
+            goto err_truncated;
+    }
+
+err_truncated:
+    print_error("Truncated tar archive\n");
+    return -1;
+}
+
+// ---------------------------------- Import ---------------------------------
+
+/**
+ * @brief Import a directory tree at the root of an opened volume.
+ *
+ * @param import The import (its volume is set).
+ * @param source_path The directory to import, or "-" for a tar archive read
+ * from the standard input.
+ * @return int 0 on success, -1 on error.
+ */
+static int __import(struct import *import, const char *source_path)
+{
+    SHLKFS_CTX_SCOPE(import->ctx);
+
+    if (fat_cache_load(import->ctx))
+    {
+        print_error("Failed to load the FAT of the volume\n");
+        return -1;
+    }
+
+    import->chunk_blocks = IMPORT_CHUNK_BYTES / get_block_size();
+    if (import->chunk_blocks == 0)
+        import->chunk_blocks = 1;
+    import->buffer = xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                                    import->chunk_blocks, get_block_size());
+
+    int res = 0;
+    if (strcmp(source_path, "-") == 0)
+    {
+        print_info("Importing the tar archive from the standard input...\n");
+        res = __import_tar(import, STDIN_FILENO);
+    }
+    else
+    {
+        // Create the FAT tables ahead, so that they do not split the content
+        // of the files
+        print_info("Computing the space needed by '%s'...\n", source_path);
+        size_t nb_blocks = 0;
+        res = __directory_blocks(source_path, &nb_blocks);
+        if (res == 0 && reserve_blocks(import->ctx, nb_blocks))
+        {
+            print_error("Failed to reserve %zu blocks\n", nb_blocks);
+            res = -1;
+        }
+
+        print_info("Importing '%s'...\n", source_path);
+        struct CryptFS_Entry_ID root_id = { .directory_block = ROOT_ENTRY_BLOCK,
+                                            .directory_index = 0 };
+        if (res == 0)
+            res = __import_directory(import, source_path, "", root_id, true);
+    }
+    free(import->buffer);
+
+    // The FAT of a failed import is dropped: the blocks allocated by the
+    // import stay free on the device
+    if (res == 0)
+    {
+        print_info("Writing the FAT...\n");
+        if (fat_cache_commit(import->ctx))
+        {
+            print_error("Failed to write the FAT of the volume\n");
+            res = -1;
+        }
+    }
+    else
+        print_warning("The FAT is not written: check the volume with "
+                      "shlkfs.fsck\n");
+    fat_cache_unload(import->ctx);
+
+    return res;
+}
+
+int cryptfs_import(const char *device_path, const char *source_path,
+                   const char *private_key_path)
+{
+    struct stat st;
+    if (strcmp(source_path, "-") != 0
+        && (stat(source_path, &st) != 0 || !S_ISDIR(st.st_mode)))
+    {
+        print_error("'%s' is not a directory\n", source_path);
+        return -1;
+    }
+
+    struct shlkfs_ctx *ctx =
+        shlkfs_ctx_open_with_key(device_path, private_key_path);
+    if (ctx == NULL)
+        return -1;
+
+    struct import import = { .ctx = ctx };
+    int res = __import(&import, source_path);
+    if (shlkfs_ctx_flush(ctx))
+        res = -1;
+    shlkfs_ctx_close(ctx);
+
+    if (res)
+        return -1;
+    print_success("%zu files and %zu directories (%lu bytes) have been "
+                  "imported to the device '%s' successfully!\n",
+                  import.nb_files, import.nb_directories,
+                  (unsigned long)import.nb_bytes, device_path);
+    return 0;
+}
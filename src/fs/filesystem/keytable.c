@@ -0,0 +1,751 @@
+#include "keytable.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "crypto.h"
+#include "fat.h"
+#include "hash.h"
+#include "maths.h"
+#include "print.h"
+#include "readfs.h"
+#include "xalloc.h"
+
+/**
+ * @brief Get the block of the bucket of a fingerprint.
+ *
+ * @param table_block The first block of the key table.
+ * @param key_table The key table.
+ * @param fingerprint The fingerprint.
+ * @return block_t The block of the bucket.
+ */
+static block_t __key_table_bucket(block_t table_block,
+                                  const struct CryptFS_KeyTable *key_table,
+                                  const uint8_t *fingerprint)
+{
+    uint64_t hash = 0;
+    memcpy(&hash, fingerprint, sizeof(hash));
+    return table_block + 1 + hash % key_table->nb_buckets;
+}
+
+/**
+ * @brief Get the first block of the key slots of a key table.
+ *
+ * @param table_block The first block of the key table.
+ * @param key_table The key table.
+ * @return block_t The first block of the key slots.
+ */
+static block_t __key_table_slots(block_t table_block,
+                                 const struct CryptFS_KeyTable *key_table)
+{
+    return table_block + 1 + key_table->nb_buckets;
+}
+
+/**
+ * @brief Get a packed key slot in the blocks of key slots of a key table.
+ *
+ * @param blocks The blocks of key slots.
+ * @param index The index of the key slot in the blocks.
+ * @return struct CryptFS_KeyTable_Slot* The packed key slot.
+ */
+static struct CryptFS_KeyTable_Slot *__key_table_packed(unsigned char *blocks,
+                                                       size_t index)
+{
+    size_t slots_per_block = NB_KEY_TABLE_SLOTS_PER_BLOCK;
+    return (struct CryptFS_KeyTable_Slot *)(blocks
+                                            + index / slots_per_block
+                                                * get_block_size())
+        + index % slots_per_block;
+}
+
+/**
+ * @brief Pack a key slot.
+ *
+ * @param packed The packed key slot. (returned)
+ * @param key_slot The key slot.
+ */
+static void __key_table_pack(struct CryptFS_KeyTable_Slot *packed,
+                             const struct CryptFS_KeySlot *key_slot)
+{
+    packed->occupied = key_slot->occupied;
+    memcpy(packed->aes_key_ciphered, key_slot->aes_key_ciphered,
+           RSA_KEY_SIZE_BYTES);
+    memcpy(packed->rsa_n, key_slot->rsa_n, RSA_KEY_SIZE_BYTES);
+    packed->rsa_e = key_slot->rsa_e;
+    memcpy(packed->rsa_n_fingerprint, key_slot->rsa_n_fingerprint,
+           SHA256_DIGEST_LENGTH);
+}
+
+/**
+ * @brief Unpack a key slot.
+ *
+ * @param key_slot The key slot. (returned)
+ * @param packed The packed key slot.
+ */
+static void __key_table_unpack(struct CryptFS_KeySlot *key_slot,
+                               const struct CryptFS_KeyTable_Slot *packed)
+{
+    memset(key_slot, 0, sizeof(struct CryptFS_KeySlot));
+    key_slot->occupied = packed->occupied;
+    memcpy(key_slot->aes_key_ciphered, packed->aes_key_ciphered,
+           RSA_KEY_SIZE_BYTES);
+    memcpy(key_slot->rsa_n, packed->rsa_n, RSA_KEY_SIZE_BYTES);
+    key_slot->rsa_e = packed->rsa_e;
+    memcpy(key_slot->rsa_n_fingerprint, packed->rsa_n_fingerprint,
+           SHA256_DIGEST_LENGTH);
+}
+
+/**
+ * @brief Read the bucket of a fingerprint, and find the entry of the
+ * fingerprint in it.
+ *
+ * @param table_block The first block of the key table.
+ * @param key_table The key table.
+ * @param fingerprint The fingerprint.
+ * @param bucket The bucket (a block-sized buffer). (returned)
+ * @return ssize_t The index of the entry in the bucket, -1 if not found,
+ * BLOCK_ERROR on error.
+ */
+static ssize_t __key_table_read_bucket(block_t table_block,
+                                       const struct CryptFS_KeyTable *key_table,
+                                       const uint8_t *fingerprint,
+                                       struct CryptFS_KeyTable_Entry *bucket)
+{
+    if (read_blocks(__key_table_bucket(table_block, key_table, fingerprint), 1,
+                    bucket))
+        return BLOCK_ERROR;
+
+    for (size_t i = 0; i < NB_KEY_TABLE_ENTRIES_PER_BLOCK; i++)
+        if (bucket[i].slot != 0
+            && memcmp(bucket[i].rsa_n_fingerprint, fingerprint,
+                      SHA256_DIGEST_LENGTH)
+                == 0)
+            return i;
+    return -1;
+}
+
+sblock_t try_read_key_table(const char *device_path,
+                            struct CryptFS_KeyTable *key_table)
+{
+    struct CryptFS_Header *header = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Header));
+    if (read_device_bytes(device_path, 0, sizeof(struct CryptFS_Header),
+                          header))
+    {
+        free(header);
+        return BLOCK_ERROR;
+    }
+    if (is_block_size_supported(header->blocksize))
+        set_block_size(header->blocksize);
+    block_t table_block = header->key_table_block;
+    free(header);
+
+    if (table_block != 0
+        && read_device_bytes(device_path, table_block * get_block_size(),
+                             sizeof(struct CryptFS_KeyTable), key_table))
+        return BLOCK_ERROR;
+    return table_block;
+}
+
+block_t read_key_table(const char *device_path,
+                       struct CryptFS_KeyTable *key_table)
+{
+    sblock_t table_block = try_read_key_table(device_path, key_table);
+    if (table_block == BLOCK_ERROR)
+        error_exit("Cannot read the filesystem structure.\n", EXIT_FAILURE);
+    return table_block;
+}
+
+int read_key_table_slots(block_t table_block,
+                         const struct CryptFS_KeyTable *key_table, size_t first,
+                         size_t nb_slots, struct CryptFS_KeySlot *key_slots)
+{
+    if (nb_slots == 0)
+        return 0;
+
+    // The key slots are read at once
+    size_t slots_per_block = NB_KEY_TABLE_SLOTS_PER_BLOCK;
+    size_t first_block = first / slots_per_block;
+    size_t nb_blocks = (first + nb_slots - 1) / slots_per_block + 1
+        - first_block;
+    unsigned char *blocks = xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                                           nb_blocks, get_block_size());
+    if (read_blocks(__key_table_slots(table_block, key_table) + first_block,
+                    nb_blocks, blocks))
+    {
+        free(blocks);
+        return -1;
+    }
+
+    for (size_t i = 0; i < nb_slots; i++)
+        __key_table_unpack(
+            &key_slots[i],
+            __key_table_packed(blocks,
+                               first + i - first_block * slots_per_block));
+
+    free(blocks);
+    return 0;
+}
+
+int write_key_table_slots(block_t table_block,
+                          const struct CryptFS_KeyTable *key_table,
+                          size_t first, size_t nb_slots,
+                          const struct CryptFS_KeySlot *key_slots)
+{
+    if (nb_slots == 0)
+        return 0;
+
+    // The blocks are read first: they hold other key slots
+    size_t slots_per_block = NB_KEY_TABLE_SLOTS_PER_BLOCK;
+    size_t first_block = first / slots_per_block;
+    size_t nb_blocks = (first + nb_slots - 1) / slots_per_block + 1
+        - first_block;
+    block_t start_block =
+        __key_table_slots(table_block, key_table) + first_block;
+    unsigned char *blocks = xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                                           nb_blocks, get_block_size());
+    if (read_blocks(start_block, nb_blocks, blocks))
+    {
+        free(blocks);
+        return -1;
+    }
+
+    for (size_t i = 0; i < nb_slots; i++)
+        __key_table_pack(
+            __key_table_packed(blocks,
+                               first + i - first_block * slots_per_block),
+            &key_slots[i]);
+
+    int res = write_blocks(start_block, nb_blocks, blocks);
+    free(blocks);
+    return res == 0 ? 0 : -1;
+}
+
+ssize_t find_key_slot(const char *device_path, EVP_PKEY *rsa_key,
+                      struct CryptFS_KeySlot *key_slot)
+{
+    struct CryptFS_KeyTable *key_table = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_KeyTable));
+    block_t table_block = read_key_table(device_path, key_table);
+
+    // The volumes without a key table use the keys storage
+    if (table_block == 0)
+    {
+        free(key_table);
+        struct CryptFS_KeySlot *keys_storage = read_key_slots(device_path);
+        ssize_t index = find_rsa_matching_key(rsa_key, keys_storage);
+        if (index != -1 && key_slot != NULL)
+            memcpy(key_slot, &keys_storage[index],
+                   sizeof(struct CryptFS_KeySlot));
+        free(keys_storage);
+        return index;
+    }
+
+    // The device is opened once for the bucket and the key slot
+    struct block_device *device =
+        block_device_open(device_path, get_block_size());
+    if (device == NULL)
+        error_exit("Cannot read the filesystem structure.\n", EXIT_FAILURE);
+    struct block_device *previous_device = block_device_use(device);
+
+    unsigned char *fingerprint = rsa_key_fingerprint(rsa_key);
+    struct CryptFS_KeyTable_Entry *bucket =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    struct CryptFS_KeySlot *found = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_KeySlot));
+    ssize_t index = -1;
+    ssize_t entry =
+        __key_table_read_bucket(table_block, key_table, fingerprint, bucket);
+    if (entry >= 0)
+    {
+        index = bucket[entry].slot - 1;
+        if ((size_t)index >= key_table->nb_users
+            || read_key_table_slots(table_block, key_table, index, 1, found))
+            entry = BLOCK_ERROR;
+    }
+
+    block_device_use(previous_device);
+    block_device_close(device);
+    if (entry == BLOCK_ERROR)
+        error_exit("Cannot read the filesystem structure.\n", EXIT_FAILURE);
+
+    // The key slot must hold the key of the index
+    if (entry >= 0)
+    {
+        unsigned char *modulus_fingerprint =
+            sha256_data(found->rsa_n, RSA_KEY_SIZE_BYTES);
+        if (!found->occupied
+            || memcmp(modulus_fingerprint, fingerprint, SHA256_DIGEST_LENGTH)
+                != 0)
+            index = -1;
+        free(modulus_fingerprint);
+    }
+    if (index != -1 && key_slot != NULL)
+        memcpy(key_slot, found, sizeof(struct CryptFS_KeySlot));
+
+    free(found);
+    free(bucket);
+    free(fingerprint);
+    free(key_table);
+    return index;
+}
+
+/**
+ * @brief Add a key slot to a key table which is not full, if the bucket of
+ * its fingerprint is not full either.
+ *
+ * @param table_block The first block of the key table.
+ * @param key_table The key table (its number of users is updated).
+ * @param key_slot The key slot.
+ * @param bucket A block-sized buffer.
+ * @return int 0 on success, 1 if the bucket is full, -1 on error.
+ */
+static int __key_table_insert(block_t table_block,
+                              struct CryptFS_KeyTable *key_table,
+                              const struct CryptFS_KeySlot *key_slot,
+                              struct CryptFS_KeyTable_Entry *bucket)
+{
+    const uint8_t *fingerprint = key_slot->rsa_n_fingerprint;
+    if (__key_table_read_bucket(table_block, key_table, fingerprint, bucket)
+        == BLOCK_ERROR)
+        return -1;
+
+    size_t entry = 0;
+    while (entry < NB_KEY_TABLE_ENTRIES_PER_BLOCK && bucket[entry].slot != 0)
+        entry++;
+    if (entry == NB_KEY_TABLE_ENTRIES_PER_BLOCK)
+        return 1;
+
+    bucket[entry].slot = key_table->nb_users + 1;
+    memcpy(bucket[entry].rsa_n_fingerprint, fingerprint,
+           SHA256_DIGEST_LENGTH);
+    if (write_key_table_slots(table_block, key_table, key_table->nb_users, 1,
+                              key_slot)
+        || write_blocks(__key_table_bucket(table_block, key_table, fingerprint),
+                        1, bucket))
+        return -1;
+
+    key_table->nb_users++;
+    return 0;
+}
+
+/**
+ * @brief Read the key slots to move to a new key table: the occupied key
+ * slots of the keys storage, or the key slots of the current key table.
+ *
+ * @param table_block The first block of the current key table (0 if none).
+ * @param key_table The current key table.
+ * @param key_slots The key slots (with room for the new ones). (returned)
+ * @param nb_slots The number of key slots. (returned)
+ * @return int 0 on success, -1 on error.
+ */
+static int __key_table_read_users(block_t table_block,
+                                  const struct CryptFS_KeyTable *key_table,
+                                  struct CryptFS_KeySlot *key_slots,
+                                  size_t *nb_slots)
+{
+    if (table_block != 0)
+    {
+        *nb_slots = key_table->nb_users;
+        return read_key_table_slots(table_block, key_table, 0, *nb_slots,
+                                    key_slots);
+    }
+
+    // Each key slot of the keys storage is at the start of its own block
+    unsigned char *blocks = xaligned_alloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, NB_ENCRYPTION_KEYS, get_block_size());
+    if (read_blocks(KEYS_STORAGE_BLOCK, NB_ENCRYPTION_KEYS, blocks))
+    {
+        free(blocks);
+        return -1;
+    }
+
+    *nb_slots = 0;
+    for (size_t i = 0; i < NB_ENCRYPTION_KEYS; i++)
+    {
+        const struct CryptFS_KeySlot *key_slot =
+            (const struct CryptFS_KeySlot *)(blocks + i * get_block_size());
+        if (key_slot->occupied)
+            memcpy(&key_slots[(*nb_slots)++], key_slot,
+                   sizeof(struct CryptFS_KeySlot));
+    }
+
+    free(blocks);
+    return 0;
+}
+
+/**
+ * @brief Build the blocks of a key table, doubling the number of buckets
+ * until none overflows.
+ *
+ * @param key_slots The key slots of the users.
+ * @param nb_users The number of users.
+ * @param key_table The key table (its number of buckets is a minimum, and is
+ * updated). (returned)
+ * @return unsigned char* The blocks of the key table.
+ */
+static unsigned char *__key_table_build(const struct CryptFS_KeySlot *key_slots,
+                                        size_t nb_users,
+                                        struct CryptFS_KeyTable *key_table)
+{
+    size_t block_size = get_block_size();
+    size_t entries_per_block = NB_KEY_TABLE_ENTRIES_PER_BLOCK;
+    size_t nb_slot_blocks = key_table->nb_slots / NB_KEY_TABLE_SLOTS_PER_BLOCK;
+    for (;;)
+    {
+        key_table->nb_blocks = 1 + key_table->nb_buckets + nb_slot_blocks;
+        unsigned char *blocks = xaligned_calloc(
+            CRYPTFS_BLOCK_SIZE_BYTES, key_table->nb_blocks, block_size);
+
+        size_t i = 0;
+        for (; i < nb_users; i++)
+        {
+            const uint8_t *fingerprint = key_slots[i].rsa_n_fingerprint;
+            block_t bucket_block =
+                __key_table_bucket(0, key_table, fingerprint);
+            struct CryptFS_KeyTable_Entry *bucket =
+                (struct CryptFS_KeyTable_Entry *)(blocks
+                                                  + bucket_block * block_size);
+            size_t entry = 0;
+            while (entry < entries_per_block && bucket[entry].slot != 0)
+                entry++;
+            if (entry == entries_per_block)
+                break;
+
+            bucket[entry].slot = i + 1;
+            memcpy(bucket[entry].rsa_n_fingerprint, fingerprint,
+                   SHA256_DIGEST_LENGTH);
+        }
+        if (i < nb_users)
+        {
+            free(blocks);
+            key_table->nb_buckets *= 2;
+            continue;
+        }
+
+        // The key slots are packed after the buckets
+        key_table->nb_users = nb_users;
+        unsigned char *slots =
+            blocks + __key_table_slots(0, key_table) * block_size;
+        for (i = 0; i < nb_users; i++)
+            __key_table_pack(__key_table_packed(slots, i), &key_slots[i]);
+        memcpy(blocks, key_table, sizeof(struct CryptFS_KeyTable));
+        return blocks;
+    }
+}
+
+/**
+ * @brief Allocate a run of contiguous blocks in the FAT loaded in memory (the
+ * FAT tables are extended to the whole device if needed).
+ *
+ * @param ctx The context of the volume.
+ * @param nb_blocks The number of blocks.
+ * @return block_t The first block of the run (a chain in the FAT), 0 if there
+ * is no such run.
+ */
+static block_t __key_table_allocate(struct shlkfs_ctx *ctx, size_t nb_blocks)
+{
+    uint64_t nb_device_blocks = get_device_size() / get_block_size();
+    for (;;)
+    {
+        uint64_t nb_entries =
+            MIN(fat_cache_nb_entries(ctx), nb_device_blocks);
+        size_t run = 0;
+        block_t start_block = 0;
+        for (uint64_t block = ROOT_DIR_BLOCK + 1; block < nb_entries; block++)
+        {
+            if (fat_cache_read(ctx, block) != BLOCK_FREE)
+                run = 0;
+            else if (++run == nb_blocks)
+            {
+                start_block = block + 1 - nb_blocks;
+                break;
+            }
+        }
+
+        if (start_block != 0)
+        {
+            for (size_t i = 0; i < nb_blocks; i++)
+            {
+                uint32_t next = i + 1 < nb_blocks ? start_block + i + 1
+                                                  : (uint32_t)BLOCK_END;
+                if (write_fat_offset(ctx, start_block + i, next))
+                    return 0;
+            }
+            return start_block;
+        }
+
+        // The FAT tables do not describe the end of the device yet
+        if (nb_entries == nb_device_blocks || create_fat(ctx) == BLOCK_ERROR)
+            return 0;
+    }
+}
+
+/**
+ * @brief Move the key slots to a new key table, twice as large as the
+ * current one (or as the keys storage), with new key slots.
+ *
+ * @param ctx The context of the volume (its FAT is loaded).
+ * @param header The header of the volume (a whole block, updated).
+ * @param key_table The current key table (a whole block, updated).
+ * @param key_slots The new key slots.
+ * @param nb_slots The number of new key slots.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __key_table_rebuild(struct shlkfs_ctx *ctx,
+                               struct CryptFS_Header *header,
+                               struct CryptFS_KeyTable *key_table,
+                               const struct CryptFS_KeySlot *key_slots,
+                               size_t nb_slots)
+{
+    block_t old_block = header->key_table_block;
+    uint64_t old_nb_blocks = key_table->nb_blocks;
+    size_t capacity = old_block != 0 ? key_table->nb_users : NB_ENCRYPTION_KEYS;
+    struct CryptFS_KeySlot *users =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, capacity + nb_slots,
+                        sizeof(struct CryptFS_KeySlot));
+    size_t nb_users = 0;
+    if (__key_table_read_users(old_block, key_table, users, &nb_users))
+    {
+        print_error("Failed to read the key slots of the volume\n");
+        free(users);
+        return -1;
+    }
+    memcpy(&users[nb_users], key_slots,
+           nb_slots * sizeof(struct CryptFS_KeySlot));
+    nb_users += nb_slots;
+
+    // The key slots stored before the fingerprints are indexed too
+    for (size_t i = 0; i < nb_users; i++)
+    {
+        unsigned char *fingerprint =
+            sha256_data(users[i].rsa_n, RSA_KEY_SIZE_BYTES);
+        memcpy(users[i].rsa_n_fingerprint, fingerprint, SHA256_DIGEST_LENGTH);
+        free(fingerprint);
+    }
+
+    size_t slots_per_block = NB_KEY_TABLE_SLOTS_PER_BLOCK;
+    size_t entries_per_block = NB_KEY_TABLE_ENTRIES_PER_BLOCK;
+    size_t nb_slot_blocks = (2 * MAX(nb_users, old_block != 0
+                                         ? key_table->nb_slots
+                                         : NB_ENCRYPTION_KEYS)
+                             + slots_per_block - 1)
+        / slots_per_block;
+    struct CryptFS_KeyTable new_table = {
+        .nb_slots = nb_slot_blocks * slots_per_block,
+    };
+    new_table.nb_buckets =
+        (KEY_TABLE_INDEX_FACTOR * new_table.nb_slots + entries_per_block - 1)
+        / entries_per_block;
+    unsigned char *blocks = __key_table_build(users, nb_users, &new_table);
+    free(users);
+
+    // The new key table is durable before the header points to it
+    block_t new_block = __key_table_allocate(ctx, new_table.nb_blocks);
+    if (new_block == 0)
+    {
+        print_error("No free run of %lu blocks for the key table (see "
+                    "shlkfs.defrag)\n",
+                    (unsigned long)new_table.nb_blocks);
+        free(blocks);
+        return -1;
+    }
+    int res = fat_cache_commit(ctx)
+        || write_blocks(new_block, new_table.nb_blocks, blocks)
+        || flush_blocks();
+    free(blocks);
+    header->key_table_block = new_block;
+    if (res || write_blocks(HEADER_BLOCK, 1, header) || flush_blocks())
+    {
+        print_error("Failed to write the key table of the volume\n");
+        return -1;
+    }
+    memcpy(key_table, &new_table, sizeof(struct CryptFS_KeyTable));
+
+    // The key slots are only in the new key table from now on
+    if (old_block == 0)
+    {
+        unsigned char *zeros = xaligned_calloc(
+            CRYPTFS_BLOCK_SIZE_BYTES, NB_ENCRYPTION_KEYS, get_block_size());
+        res = write_blocks(KEYS_STORAGE_BLOCK, NB_ENCRYPTION_KEYS, zeros);
+        free(zeros);
+    }
+    for (uint64_t i = 0; res == 0 && i < old_nb_blocks; i++)
+        res = write_fat_offset(ctx, old_block + i, BLOCK_FREE);
+    if (res || fat_cache_commit(ctx) || flush_blocks())
+    {
+        print_error("Failed to free the former key slots of the volume\n");
+        return -1;
+    }
+
+    print_info("The key table holds %lu key slots (%lu users)\n",
+               (unsigned long)new_table.nb_slots,
+               (unsigned long)new_table.nb_users);
+    return 0;
+}
+
+int key_table_add(struct shlkfs_ctx *ctx,
+                  const struct CryptFS_KeySlot *key_slots, size_t nb_slots)
+{
+    SHLKFS_CTX_SCOPE(ctx);
+
+    struct CryptFS_Header *header =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    struct CryptFS_KeyTable *key_table =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    struct CryptFS_KeyTable_Entry *bucket =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    block_t table_block = 0;
+    int res = read_blocks(HEADER_BLOCK, 1, header);
+    if (res == 0)
+    {
+        table_block = header->key_table_block;
+        if (table_block != 0)
+            res = read_blocks(table_block, 1, key_table);
+    }
+    if (res)
+    {
+        print_error("Failed to read the key table of the volume\n");
+        res = -1;
+        goto end_add;
+    }
+
+    // The key slots are added in place while the key table has room
+    size_t added = 0;
+    if (table_block != 0
+        && key_table->nb_users + nb_slots <= key_table->nb_slots)
+    {
+        while (res == 0 && added < nb_slots)
+        {
+            res = __key_table_insert(table_block, key_table, &key_slots[added],
+                                     bucket);
+            if (res == 0)
+                added++;
+        }
+        if (res != -1
+            && (write_blocks(table_block, 1, key_table) || flush_blocks()))
+            res = -1;
+        if (res == -1)
+        {
+            print_error("Failed to write the key table of the volume\n");
+            goto end_add;
+        }
+    }
+
+    // Otherwise (or if a bucket is full), a larger key table is built
+    if (table_block == 0 || added < nb_slots)
+    {
+        bool loaded = ctx->fat_cache == NULL;
+        if (fat_cache_load(ctx))
+        {
+            print_error("Failed to load the FAT of the volume\n");
+            res = -1;
+            goto end_add;
+        }
+        res = __key_table_rebuild(ctx, header, key_table, key_slots + added,
+                                  nb_slots - added);
+        if (loaded)
+            fat_cache_unload(ctx);
+    }
+
+end_add:
+    free(bucket);
+    free(key_table);
+    free(header);
+    return res;
+}
+
+int key_table_remove(const char *device_path, size_t index)
+{
+    struct CryptFS_KeyTable *key_table = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_KeyTable));
+    block_t table_block = read_key_table(device_path, key_table);
+    if (table_block == 0 || index >= key_table->nb_users)
+    {
+        print_error("There is no key slot %zu in the key table of the "
+                    "device '%s'\n",
+                    index, device_path);
+        free(key_table);
+        return -1;
+    }
+
+    // The device is opened (and flushed) once for all the blocks
+    struct block_device *device =
+        block_device_open(device_path, get_block_size());
+    if (device == NULL)
+    {
+        print_error("Cannot open the device '%s'\n", device_path);
+        free(key_table);
+        return -1;
+    }
+    struct block_device *previous_device = block_device_use(device);
+
+    // The last key slot takes the place of the removed one
+    size_t last = key_table->nb_users - 1;
+    struct CryptFS_KeySlot *key_slots = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 2, sizeof(struct CryptFS_KeySlot));
+    struct CryptFS_KeyTable_Entry *bucket =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    int res = read_key_table_slots(table_block, key_table, index, 1,
+                                   &key_slots[0])
+        || read_key_table_slots(table_block, key_table, last, 1,
+                                &key_slots[1]);
+
+    const uint8_t *fingerprint = key_slots[0].rsa_n_fingerprint;
+    ssize_t entry = res ? BLOCK_ERROR
+                        : __key_table_read_bucket(table_block, key_table,
+                                                  fingerprint, bucket);
+    if (entry >= 0)
+    {
+        memset(&bucket[entry], 0, sizeof(struct CryptFS_KeyTable_Entry));
+        res = write_blocks(
+            __key_table_bucket(table_block, key_table, fingerprint), 1, bucket);
+    }
+    else
+        res = -1;
+
+    if (res == 0 && index != last)
+    {
+        fingerprint = key_slots[1].rsa_n_fingerprint;
+        entry = __key_table_read_bucket(table_block, key_table, fingerprint,
+                                        bucket);
+        if (entry >= 0)
+        {
+            bucket[entry].slot = index + 1;
+            res = write_key_table_slots(table_block, key_table, index, 1,
+                                        &key_slots[1])
+                || write_blocks(
+                    __key_table_bucket(table_block, key_table, fingerprint), 1,
+                    bucket);
+        }
+        else
+            res = -1;
+    }
+
+    // The place of the last key slot is wiped
+    if (res == 0)
+    {
+        memset(&key_slots[1], 0, sizeof(struct CryptFS_KeySlot));
+        key_table->nb_users--;
+        res = write_key_table_slots(table_block, key_table, last, 1,
+                                    &key_slots[1])
+            || write_device_bytes(device_path, table_block * get_block_size(),
+                                  sizeof(struct CryptFS_KeyTable), key_table)
+            || flush_blocks();
+    }
+
+    block_device_use(previous_device);
+    block_device_close(device);
+    free(bucket);
+    free(key_slots);
+    free(key_table);
+    if (res)
+    {
+        print_error("Cannot write the key table of the device '%s'\n",
+                    device_path);
+        return -1;
+    }
+    return 0;
+}
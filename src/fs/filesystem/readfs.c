@@ -1,23 +1,79 @@
 #include "readfs.h"
 
-#include <stdio.h>
 #include <stdlib.h>
 
+#include "block_cipher.h"
 #include "print.h"
 #include "xalloc.h"
 
 struct CryptFS *read_cryptfs_headers(const char *device_path)
 {
-    FILE *device = fopen(device_path, "r");
-    if (device == NULL)
-        error_exit("Cannot open device '%s'.\n", EXIT_FAILURE, device_path);
-
     struct CryptFS *cryptfs =
         xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS));
-    if (fread(cryptfs, sizeof(struct CryptFS), 1, device) != 1)
+
+    // The header is at the beginning of the device, whatever the block size
+    if (read_device_bytes(device_path, 0, sizeof(struct CryptFS_Header),
+                          &cryptfs->header))
         error_exit("Cannot read the filesystem structure.\n", EXIT_FAILURE);
+    if (is_block_size_supported(cryptfs->header.blocksize))
+        set_block_size(cryptfs->header.blocksize);
+    if (block_cipher_get(cryptfs->header.cipher) != NULL)
+        set_block_cipher(cryptfs->header.cipher);
 
-    fclose(device);
+    // The other blocks are spread every get_block_size() bytes
+    for (block_t i = HEADER_BLOCK + 1; i <= ROOT_DIR_BLOCK; i++)
+        if (read_device_bytes(device_path, i * get_block_size(),
+                              CRYPTFS_BLOCK_SIZE_BYTES,
+                              (char *)cryptfs + i * CRYPTFS_BLOCK_SIZE_BYTES))
+            error_exit("Cannot read the filesystem structure.\n", EXIT_FAILURE);
 
     return cryptfs;
 }
+
+struct CryptFS_KeySlot *try_read_key_slots(const char *device_path)
+{
+    struct CryptFS_Header *header = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Header));
+    int res = read_device_bytes(device_path, 0, sizeof(struct CryptFS_Header),
+                                header);
+    if (res == 0 && is_block_size_supported(header->blocksize))
+        set_block_size(header->blocksize);
+    free(header);
+    if (res)
+        return NULL;
+
+    // The device is opened once for all the key slots
+    struct block_device *device =
+        block_device_open(device_path, get_block_size());
+    if (device == NULL)
+        return NULL;
+    struct block_device *previous_device = block_device_use(device);
+
+    struct CryptFS_KeySlot *keys_storage =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, NB_ENCRYPTION_KEYS,
+                        sizeof(struct CryptFS_KeySlot));
+    for (size_t i = 0; res == 0 && i < NB_ENCRYPTION_KEYS; i++)
+        res = read_device_bytes(device_path,
+                                (KEYS_STORAGE_BLOCK + i) * get_block_size(),
+                                sizeof(struct CryptFS_KeySlot),
+                                &keys_storage[i]);
+
+    block_device_use(previous_device);
+    block_device_close(device);
+    if (res)
+    {
+        free(keys_storage);
+        return NULL;
+    }
+
+    return keys_storage;
+}
+
+struct CryptFS_KeySlot *read_key_slots(const char *device_path)
+{
+    struct CryptFS_KeySlot *keys_storage = try_read_key_slots(device_path);
+    if (keys_storage == NULL)
+        error_exit("Cannot read the filesystem structure.\n", EXIT_FAILURE);
+
+    return keys_storage;
+}
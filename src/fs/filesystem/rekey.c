@@ -0,0 +1,773 @@
+#include "rekey.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "cryptfs.h"
+#include "crypto.h"
+#include "format.h"
+#include "hash.h"
+#include "keytable.h"
+#include "maths.h"
+#include "passphrase.h"
+#include "print.h"
+#include "thread_pool.h"
+#include "xalloc.h"
+
+// Size of the chunks of blocks re-encrypted at once
+#define REKEY_CHUNK_BYTES (16 * 1024 * 1024)
+
+/**
+ * @brief State of a rotation of the master key.
+ */
+struct rekey
+{
+    char *journal_path; // Path of the journal file
+    size_t block_size; // Block size of the volume
+    uint64_t nb_blocks; // Number of blocks of the device
+    struct CryptFS_Header *header; // Header of the volume (a whole block)
+    EVP_PKEY *rsa_keypair; // RSA keypair of the user rotating the master key
+    unsigned char *old_key; // Master key before the rotation (NULL if all
+                            // the blocks are re-encrypted)
+    unsigned char *new_key; // Master key after the rotation
+    uint8_t *allocated; // Bitmap of the allocated blocks
+    unsigned char *buffer; // Chunk of re-encrypted blocks
+    struct block_request *requests; // Extents of a chunk
+    struct CryptFS_Rekey_Block *blocks; // Journal of a chunk
+    size_t chunk_blocks; // Number of blocks of a chunk
+};
+
+/**
+ * @brief Write a whole buffer to a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param data The data to write.
+ * @param size The size of the data.
+ * @return int 0 on success, -1 on error.
+ */
+static int __write_full(int fd, const void *data, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t res = write(fd, (const char *)data + done, size - done);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res == -1)
+            return -1;
+        done += res;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read a whole buffer from a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param data The buffer to fill.
+ * @param size The size of the buffer.
+ * @return int 0 on success, -1 on error or if the end of file is reached
+ * before.
+ */
+static int __read_full(int fd, void *data, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t res = read(fd, (char *)data + done, size - done);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return -1;
+        done += res;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Write the header of the volume, and make it durable.
+ *
+ * @param rekey The rotation.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __rekey_write_header(struct rekey *rekey)
+{
+    if (write_blocks(HEADER_BLOCK, 1, rekey->header) || flush_blocks())
+    {
+        print_error("Failed to write the header of the device\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Start a rotation, or find the keys of the interrupted one.
+ *
+ * @details The new master key is kept in the header until the key slots hold
+ * it, encrypted with the RSA public key of the user rotating it: the master
+ * key known by a deleted user does not give the new one, so only this user
+ * can resume an interrupted rotation.
+ *
+ * @param rekey The rotation (its header is read).
+ * @param user_key The master key decrypted from the key slot of the user.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __rekey_keys(struct rekey *rekey, const unsigned char *user_key)
+{
+    struct CryptFS_Header *header = rekey->header;
+    unsigned char *fingerprint = rsa_key_fingerprint(rekey->rsa_keypair);
+    size_t size = 0;
+
+    if (!header->rekey_in_progress)
+    {
+        rekey->old_key = xmalloc(AES_KEY_SIZE_BYTES, 1);
+        memcpy(rekey->old_key, user_key, AES_KEY_SIZE_BYTES);
+        rekey->new_key = generate_aes_key();
+
+        unsigned char *wrapped_key =
+            rsa_encrypt_data(rekey->rsa_keypair, rekey->new_key,
+                             AES_KEY_SIZE_BYTES, &size);
+        if (wrapped_key == NULL || size != RSA_KEY_SIZE_BYTES)
+        {
+            print_error("Failed to encrypt the new master key\n");
+            free(wrapped_key);
+            free(fingerprint);
+            return -1;
+        }
+        memcpy(header->rekey_new_key, wrapped_key, RSA_KEY_SIZE_BYTES);
+        memcpy(header->rekey_fingerprint, fingerprint, SHA256_DIGEST_LENGTH);
+        free(wrapped_key);
+        free(fingerprint);
+        header->rekey_watermark = FIRST_FAT_BLOCK;
+        header->rekey_in_progress = 1;
+
+        print_info("Starting the rotation of the master key...\n");
+        return __rekey_write_header(rekey);
+    }
+
+    bool is_owner =
+        memcmp(fingerprint, header->rekey_fingerprint, SHA256_DIGEST_LENGTH)
+        == 0;
+    free(fingerprint);
+    if (!is_owner)
+    {
+        print_error("The rotation of the master key was started by another "
+                    "user: resume it with their private key\n");
+        return -1;
+    }
+    rekey->new_key = rsa_decrypt_data(rekey->rsa_keypair,
+                                      header->rekey_new_key,
+                                      RSA_KEY_SIZE_BYTES, &size);
+    if (size != AES_KEY_SIZE_BYTES)
+    {
+        print_error("The rotation of the master key is corrupted\n");
+        return -1;
+    }
+
+    // The key slots hold the new key once all the blocks are re-encrypted
+    if (memcmp(user_key, rekey->new_key, AES_KEY_SIZE_BYTES) == 0)
+    {
+        if (header->rekey_watermark < rekey->nb_blocks)
+        {
+            print_error("The rotation of the master key is corrupted\n");
+            return -1;
+        }
+        print_info("Resuming the rotation of the master key (all the blocks "
+                   "are re-encrypted)...\n");
+        return 0;
+    }
+
+    rekey->old_key = xmalloc(AES_KEY_SIZE_BYTES, 1);
+    memcpy(rekey->old_key, user_key, AES_KEY_SIZE_BYTES);
+    print_info("Resuming the rotation of the master key at block %lu...\n",
+               (unsigned long)header->rekey_watermark);
+    return 0;
+}
+
+/**
+ * @brief Mark a block as allocated.
+ *
+ * @param rekey The rotation.
+ * @param block The block.
+ */
+static void __rekey_allocate(struct rekey *rekey, uint64_t block)
+{
+    if (block < rekey->nb_blocks)
+        rekey->allocated[block / 8] |= 1 << (block % 8);
+}
+
+/**
+ * @brief Check if a block is allocated.
+ *
+ * @param rekey The rotation.
+ * @param block The block.
+ * @return true if the block is allocated, false otherwise.
+ */
+static bool __rekey_is_allocated(const struct rekey *rekey, uint64_t block)
+{
+    return (rekey->allocated[block / 8] >> (block % 8)) & 1;
+}
+
+/**
+ * @brief Load the allocated blocks from the FAT (the FAT tables below the
+ * watermark are encrypted with the new master key).
+ *
+ * @param rekey The rotation.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __rekey_load_allocation(struct rekey *rekey)
+{
+    rekey->allocated = xcalloc((rekey->nb_blocks + 7) / 8, 1);
+    struct CryptFS_FAT *fat =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, rekey->block_size);
+    uint64_t nb_entries = NB_FAT_ENTRIES_PER_BLOCK;
+
+    int res = 0;
+    block_t fat_block = FIRST_FAT_BLOCK;
+    for (uint64_t index = 0; fat_block != (block_t)BLOCK_END; index++)
+    {
+        const unsigned char *key = fat_block < rekey->header->rekey_watermark
+            ? rekey->new_key
+            : rekey->old_key;
+        if (fat_block >= rekey->nb_blocks || index == rekey->nb_blocks
+            || read_blocks_with_decryption(key, fat_block, 1, fat))
+        {
+            print_error("Failed to read the FAT of the volume\n");
+            res = -1;
+            break;
+        }
+
+        __rekey_allocate(rekey, fat_block);
+        for (uint64_t i = 0; i < nb_entries; i++)
+            if (fat->entries[i].next_block != BLOCK_FREE)
+                __rekey_allocate(rekey, index * nb_entries + i);
+        fat_block = fat->next_fat_table;
+    }
+
+    // The key table is reserved in the FAT, but not encrypted
+    block_t table_block = rekey->header->key_table_block;
+    struct CryptFS_KeyTable *key_table = (struct CryptFS_KeyTable *)fat;
+    if (res == 0 && table_block != 0)
+    {
+        if (read_blocks(table_block, 1, key_table))
+        {
+            print_error("Failed to read the key table of the volume\n");
+            res = -1;
+        }
+        for (uint64_t i = 0; res == 0 && i < key_table->nb_blocks; i++)
+            if (table_block + i < rekey->nb_blocks)
+                rekey->allocated[(table_block + i) / 8] &=
+                    ~(1 << ((table_block + i) % 8));
+    }
+
+    free(fat);
+    return res;
+}
+
+/**
+ * @brief Re-encrypt a block with the new master key, unless its hash shows it
+ * already is.
+ *
+ * @param rekey The rotation.
+ * @param journaled The block and its hash once re-encrypted.
+ * @param buffer A block-sized buffer.
+ * @return int 0 on success, -1 on error.
+ */
+static int __rekey_recover_block(struct rekey *rekey,
+                                 const struct CryptFS_Rekey_Block *journaled,
+                                 unsigned char *buffer)
+{
+    if (read_blocks(journaled->block, 1, buffer))
+        return -1;
+
+    unsigned char *hash = sha256_data(buffer, rekey->block_size);
+    bool done = memcmp(hash, journaled->hash, SHA256_DIGEST_LENGTH) == 0;
+    free(hash);
+    if (done)
+        return 0;
+
+    block_t block = journaled->block;
+    if (decrypt_blocks(rekey->old_key, &block, buffer, buffer, 1)
+        || encrypt_blocks(rekey->new_key, &block, buffer, buffer, 1)
+        || write_blocks(journaled->block, 1, buffer))
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Finish the chunk being re-encrypted when the rotation was
+ * interrupted, from its journal.
+ *
+ * @param rekey The rotation.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __rekey_recover(struct rekey *rekey)
+{
+    int fd = open(rekey->journal_path, O_RDONLY);
+    if (fd == -1 && errno == ENOENT)
+        return 0; // No chunk was being written
+    if (fd == -1)
+    {
+        print_error("Failed to open the journal '%s': %s\n",
+                    rekey->journal_path, strerror(errno));
+        return -1;
+    }
+
+    struct CryptFS_Rekey_Journal journal;
+    if (__read_full(fd, &journal, sizeof(journal))
+        || memcmp(journal.magic, REKEY_MAGIC, REKEY_MAGIC_SIZE) != 0
+        || journal.version != REKEY_VERSION)
+    {
+        print_error("The journal '%s' is corrupted\n", rekey->journal_path);
+        close(fd);
+        return -1;
+    }
+    if (journal.start_block != rekey->header->rekey_watermark)
+    {
+        close(fd); // The chunk of the journal was finished
+        return 0;
+    }
+
+    print_info("Finishing the interrupted chunk (%lu blocks)...\n",
+               (unsigned long)journal.nb_blocks);
+    unsigned char *buffer =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, rekey->block_size);
+    int res = 0;
+    for (uint64_t i = 0; res == 0 && i < journal.nb_blocks; i++)
+    {
+        struct CryptFS_Rekey_Block journaled;
+        if (__read_full(fd, &journaled, sizeof(journaled))
+            || journaled.block < journal.start_block
+            || journaled.block >= journal.end_block
+            || journaled.block >= rekey->nb_blocks)
+        {
+            print_error("The journal '%s' is corrupted\n",
+                        rekey->journal_path);
+            res = -1;
+        }
+        else if (__rekey_recover_block(rekey, &journaled, buffer))
+        {
+            print_error("Failed to re-encrypt the block %lu\n",
+                        (unsigned long)journaled.block);
+            res = -1;
+        }
+    }
+    free(buffer);
+    close(fd);
+
+    if (res == 0 && flush_blocks())
+        res = -1;
+    if (res == 0)
+    {
+        rekey->header->rekey_watermark = journal.end_block;
+        res = __rekey_write_header(rekey);
+    }
+    return res;
+}
+
+/**
+ * @brief Hash the block `index` of the chunk (thread_pool_task_t).
+ *
+ * @param arg The rotation.
+ * @param index The index of the block in the chunk.
+ * @return int 0.
+ */
+static int __rekey_hash_task(void *arg, size_t index)
+{
+    struct rekey *rekey = arg;
+    unsigned char *hash = sha256_data(
+        rekey->buffer + index * rekey->block_size, rekey->block_size);
+    memcpy(rekey->blocks[index].hash, hash, SHA256_DIGEST_LENGTH);
+    free(hash);
+    return 0;
+}
+
+/**
+ * @brief Write the journal of a chunk, and make it durable.
+ *
+ * @param rekey The rotation (the blocks of the chunk are journaled).
+ * @param end_block The watermark after the chunk.
+ * @param nb_blocks The number of blocks of the chunk.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __rekey_write_journal(struct rekey *rekey, uint64_t end_block,
+                                 size_t nb_blocks)
+{
+    struct CryptFS_Rekey_Journal journal = {
+        .version = REKEY_VERSION,
+        .start_block = rekey->header->rekey_watermark,
+        .end_block = end_block,
+        .nb_blocks = nb_blocks,
+    };
+    memcpy(journal.magic, REKEY_MAGIC, REKEY_MAGIC_SIZE);
+
+    int fd = open(rekey->journal_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int res = fd == -1 || __write_full(fd, &journal, sizeof(journal))
+            || __write_full(fd, rekey->blocks,
+                            nb_blocks * sizeof(struct CryptFS_Rekey_Block))
+            || fsync(fd)
+        ? -1
+        : 0;
+    if (res)
+        print_error("Failed to write the journal '%s': %s\n",
+                    rekey->journal_path, strerror(errno));
+    if (fd != -1)
+        close(fd);
+    return res;
+}
+
+/**
+ * @brief Re-encrypt a chunk of allocated blocks from the watermark, and move
+ * the watermark after it.
+ *
+ * @param rekey The rotation.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __rekey_chunk(struct rekey *rekey)
+{
+    // Gather the extents of allocated blocks until the chunk is full
+    uint64_t block = rekey->header->rekey_watermark;
+    size_t nb_requests = 0;
+    size_t filled = 0;
+    while (filled < rekey->chunk_blocks && block < rekey->nb_blocks)
+    {
+        if (block % 8 == 0 && rekey->allocated[block / 8] == 0)
+        {
+            block += 8;
+            continue;
+        }
+        if (!__rekey_is_allocated(rekey, block))
+        {
+            block++;
+            continue;
+        }
+
+        struct block_request *request = &rekey->requests[nb_requests++];
+        request->start_block = block;
+        request->nb_blocks = 0;
+        request->buffer = rekey->buffer + filled * rekey->block_size;
+        while (block < rekey->nb_blocks && filled < rekey->chunk_blocks
+               && __rekey_is_allocated(rekey, block))
+        {
+            rekey->blocks[filled].block = block;
+            block++;
+            filled++;
+            request->nb_blocks++;
+        }
+    }
+    block = MIN(block, rekey->nb_blocks);
+
+    // The journal is durable before the blocks are overwritten
+    if (filled > 0
+        && (read_blocks_batch(rekey->requests, nb_requests)
+            || decrypt_blocks_batch(rekey->old_key, rekey->requests,
+                                    nb_requests)
+            || encrypt_blocks_batch(rekey->new_key, rekey->requests,
+                                    nb_requests)
+            || thread_pool_parallel_for(__rekey_hash_task, rekey, filled)
+            || __rekey_write_journal(rekey, block, filled)
+            || write_blocks_batch(rekey->requests, nb_requests)
+            || flush_blocks()))
+    {
+        print_error("Failed to re-encrypt the blocks from %lu\n",
+                    (unsigned long)rekey->header->rekey_watermark);
+        return -1;
+    }
+
+    rekey->header->rekey_watermark = block;
+    return __rekey_write_header(rekey);
+}
+
+/**
+ * @brief Re-encrypt all the allocated blocks from the watermark.
+ *
+ * @param rekey The rotation.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __rekey_blocks(struct rekey *rekey)
+{
+    // The blocks of the interrupted chunk (FAT tables included) use either
+    // key until the chunk is finished
+    if (__rekey_recover(rekey) || __rekey_load_allocation(rekey))
+        return -1;
+
+    rekey->chunk_blocks = MAX(REKEY_CHUNK_BYTES / rekey->block_size, 1);
+    rekey->buffer = xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                                   rekey->chunk_blocks, rekey->block_size);
+    rekey->requests =
+        xcalloc(rekey->chunk_blocks, sizeof(struct block_request));
+    rekey->blocks =
+        xcalloc(rekey->chunk_blocks, sizeof(struct CryptFS_Rekey_Block));
+
+    int res = 0;
+    uint64_t last_tenth = rekey->header->rekey_watermark * 10
+        / rekey->nb_blocks;
+    while (res == 0 && rekey->header->rekey_watermark < rekey->nb_blocks)
+    {
+        res = __rekey_chunk(rekey);
+
+        uint64_t tenth = rekey->header->rekey_watermark * 10 / rekey->nb_blocks;
+        if (res == 0 && tenth != last_tenth)
+            print_info("%lu%% of the blocks re-encrypted\n",
+                       (unsigned long)tenth * 10);
+        last_tenth = tenth;
+    }
+
+    free(rekey->blocks);
+    free(rekey->requests);
+    free(rekey->buffer);
+    return res;
+}
+
+/**
+ * @brief Encrypt the new master key with the public key of the user of an
+ * occupied key slot.
+ *
+ * @param rekey The rotation.
+ * @param slot The key slot.
+ * @param index The index of the key slot.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __rekey_wrap_slot(struct rekey *rekey, struct CryptFS_KeySlot *slot,
+                             size_t index)
+{
+    EVP_PKEY *public_key = load_rsa_public_key_from_slot(slot);
+    size_t size = 0;
+    unsigned char *wrapped_key = public_key == NULL
+        ? NULL
+        : rsa_encrypt_data(public_key, rekey->new_key, AES_KEY_SIZE_BYTES,
+                           &size);
+    int res = 0;
+    if (wrapped_key == NULL || size != RSA_KEY_SIZE_BYTES)
+    {
+        print_error("Failed to encrypt the master key for the key slot %zu\n",
+                    index);
+        res = -1;
+    }
+    else
+        memcpy(slot->aes_key_ciphered, wrapped_key, RSA_KEY_SIZE_BYTES);
+    free(wrapped_key);
+    EVP_PKEY_free(public_key);
+    return res;
+}
+
+/**
+ * @brief Encrypt the new master key with the public key of every user
+ * registered in the key table (its free key slots are already wiped).
+ *
+ * @param rekey The rotation.
+ * @param nb_users The number of registered users. (returned)
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __rekey_wrap_table(struct rekey *rekey, size_t *nb_users)
+{
+    block_t table_block = rekey->header->key_table_block;
+    struct CryptFS_KeyTable *key_table =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, rekey->block_size);
+    if (read_blocks(table_block, 1, key_table))
+    {
+        print_error("Failed to read the key table of the device\n");
+        free(key_table);
+        return -1;
+    }
+
+    *nb_users = key_table->nb_users;
+    struct CryptFS_KeySlot *slots =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, MAX(*nb_users, 1),
+                        sizeof(struct CryptFS_KeySlot));
+    int res = read_key_table_slots(table_block, key_table, 0, *nb_users,
+                                   slots);
+    if (res)
+        print_error("Failed to read the key table of the device\n");
+    for (size_t i = 0; res == 0 && i < *nb_users; i++)
+        res = __rekey_wrap_slot(rekey, &slots[i], i);
+
+    if (res == 0
+        && (write_key_table_slots(table_block, key_table, 0, *nb_users, slots)
+            || flush_blocks()))
+    {
+        print_error("Failed to write the key table of the device\n");
+        res = -1;
+    }
+
+    free(slots);
+    free(key_table);
+    return res;
+}
+
+/**
+ * @brief Encrypt the new master key with the public key of every registered
+ * user, and wipe the free key slots.
+ *
+ * @param rekey The rotation.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __rekey_wrap_slots(struct rekey *rekey)
+{
+    // Each key slot is at the start of its own block
+    unsigned char *slots = xaligned_alloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, NB_ENCRYPTION_KEYS, rekey->block_size);
+    if (read_blocks(KEYS_STORAGE_BLOCK, NB_ENCRYPTION_KEYS, slots))
+    {
+        print_error("Failed to read the key slots of the device\n");
+        free(slots);
+        return -1;
+    }
+
+    int res = 0;
+    size_t nb_users = 0;
+    for (size_t i = 0; res == 0 && i < NB_ENCRYPTION_KEYS; i++)
+    {
+        struct CryptFS_KeySlot *slot =
+            (struct CryptFS_KeySlot *)(slots + i * rekey->block_size);
+        if (!slot->occupied)
+            memset(slot, 0, sizeof(struct CryptFS_KeySlot));
+        else if ((res = __rekey_wrap_slot(rekey, slot, i)) == 0)
+            nb_users++;
+    }
+
+    if (res == 0
+        && (write_blocks(KEYS_STORAGE_BLOCK, NB_ENCRYPTION_KEYS, slots)
+            || flush_blocks()))
+    {
+        print_error("Failed to write the key slots of the device\n");
+        res = -1;
+    }
+
+    // The key slots of a volume with a key table are in the key table
+    if (res == 0 && rekey->header->key_table_block != 0)
+        res = __rekey_wrap_table(rekey, &nb_users);
+    if (res == 0)
+        print_info("The new master key is registered for %zu users\n",
+                   nb_users);
+
+    free(slots);
+    return res;
+}
+
+/**
+ * @brief Rotate the master key of the volume of the device used by the
+ * calling thread.
+ *
+ * @param rekey The rotation.
+ * @param user_key The master key decrypted from the key slot of the user.
+ * @return int 0 on success, -1 on error (error printed).
+ */
+static int __rekey(struct rekey *rekey, const unsigned char *user_key)
+{
+    rekey->nb_blocks = get_device_size() / rekey->block_size;
+    rekey->header =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, rekey->block_size);
+    if (read_blocks(HEADER_BLOCK, 1, rekey->header))
+    {
+        print_error("Failed to read the header of the device\n");
+        return -1;
+    }
+    set_block_cipher(rekey->header->cipher);
+
+    if (__rekey_keys(rekey, user_key))
+        return -1;
+    if (rekey->old_key != NULL && __rekey_blocks(rekey))
+        return -1;
+    if (__rekey_wrap_slots(rekey))
+        return -1;
+
+    // The volume can be opened again
+    struct CryptFS_Header *header = rekey->header;
+    header->rekey_in_progress = 0;
+    header->rekey_watermark = 0;
+    memset(header->rekey_new_key, 0, RSA_KEY_SIZE_BYTES);
+    memset(header->rekey_fingerprint, 0, SHA256_DIGEST_LENGTH);
+    if (__rekey_write_header(rekey))
+        return -1;
+    if (unlink(rekey->journal_path) != 0 && errno != ENOENT)
+        print_warning("Failed to remove the journal '%s': %s\n",
+                      rekey->journal_path, strerror(errno));
+    return 0;
+}
+
+int cryptfs_rekey(const char *device_path, const char *private_key_path)
+{
+    if (!is_already_formatted(device_path))
+    {
+        print_error("The device '%s' is not formatted. Please format it "
+                    "first.\n",
+                    device_path);
+        return -1;
+    }
+
+    struct CryptFS_Header *header = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Header));
+    int res = read_device_bytes(device_path, 0, sizeof(struct CryptFS_Header),
+                                header);
+    struct rekey rekey = { .block_size = header->blocksize };
+    free(header);
+    if (res)
+        return -1;
+
+    char *passphrase = NULL;
+    if (rsa_private_is_encrypted(private_key_path))
+        passphrase = ask_user_passphrase(false);
+    print_info("Extracting master key from the device...\n");
+    unsigned char *user_key =
+        extract_aes_key(device_path, private_key_path, passphrase);
+    if (user_key != NULL)
+        rekey.rsa_keypair =
+            load_rsa_keypair_from_disk(NULL, private_key_path, passphrase);
+    free(passphrase);
+    if (user_key == NULL)
+    {
+        print_error("The private key '%s' is not registered in the keys "
+                    "storage of the device '%s'\n",
+                    private_key_path, device_path);
+        return -1;
+    }
+
+    struct block_device *device =
+        block_device_open(device_path, rekey.block_size);
+    if (device == NULL)
+    {
+        memset(user_key, 0, AES_KEY_SIZE_BYTES);
+        free(user_key);
+        EVP_PKEY_free(rekey.rsa_keypair);
+        return -1;
+    }
+    struct block_device *previous_device = block_device_use(device);
+
+    size_t path_size = strlen(device_path) + sizeof(REKEY_SUFFIX);
+    rekey.journal_path = xmalloc(path_size, sizeof(char));
+    snprintf(rekey.journal_path, path_size, "%s%s", device_path,
+             REKEY_SUFFIX);
+
+    res = __rekey(&rekey, user_key);
+
+    block_device_use(previous_device);
+    block_device_close(device);
+    memset(user_key, 0, AES_KEY_SIZE_BYTES);
+    free(user_key);
+    if (rekey.old_key != NULL)
+        memset(rekey.old_key, 0, AES_KEY_SIZE_BYTES);
+    if (rekey.new_key != NULL)
+        memset(rekey.new_key, 0, AES_KEY_SIZE_BYTES);
+    free(rekey.old_key);
+    free(rekey.new_key);
+    EVP_PKEY_free(rekey.rsa_keypair);
+    free(rekey.allocated);
+    free(rekey.header);
+    free(rekey.journal_path);
+
+    if (res == 0)
+        print_success("The master key of the device '%s' has been rotated "
+                      "successfully!\n",
+                      device_path);
+    return res;
+}
@@ -0,0 +1,154 @@
+#include "shlkfs_ctx.h"
+
+#include <openssl/rand.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "agent.h"
+#include "crypto.h"
+#include "fat.h"
+#include "format.h"
+#include "passphrase.h"
+#include "print.h"
+#include "xalloc.h"
+
+struct shlkfs_ctx *shlkfs_ctx_open(const char *device_path,
+                                   const unsigned char *aes_key)
+{
+    if (!is_already_formatted(device_path))
+    {
+        print_error("The device '%s' is not a SherlockFS volume\n",
+                    device_path);
+        return NULL;
+    }
+
+    struct CryptFS_Header *header =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, 1,
+                        sizeof(struct CryptFS_Header));
+    int res = read_device_bytes(device_path, 0, sizeof(struct CryptFS_Header),
+                                header);
+    size_t block_size = header->blocksize;
+    enum cryptfs_cipher cipher = header->cipher;
+    bool rekey_in_progress = header->rekey_in_progress;
+    free(header);
+    if (res)
+        return NULL;
+    if (rekey_in_progress)
+    {
+        print_error("The master key of the device '%s' is being rotated: "
+                    "resume the rotation with shlkfs.rekey first\n",
+                    device_path);
+        return NULL;
+    }
+
+    struct block_device *device = block_device_open(device_path, block_size);
+    if (device == NULL)
+        return NULL;
+    struct block_device *previous_device = block_device_use(device);
+    set_block_cipher(cipher);
+    block_device_use(previous_device);
+
+    struct shlkfs_ctx *ctx = xcalloc(1, sizeof(struct shlkfs_ctx));
+    ctx->device = device;
+    if (RAND_bytes(ctx->xor_key, AES_KEY_SIZE_BYTES) != 1)
+        internal_error_exit("Failed to generate the master key XOR key\n",
+                            EXIT_FAILURE);
+    for (size_t i = 0; i < AES_KEY_SIZE_BYTES; i++)
+        ctx->masked_key[i] = aes_key[i] ^ ctx->xor_key[i];
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&ctx->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    return ctx;
+}
+
+struct shlkfs_ctx *shlkfs_ctx_open_with_key(const char *device_path,
+                                            const char *private_key_path)
+{
+    if (!is_already_formatted(device_path))
+    {
+        print_error("The device '%s' is not formatted. Please format it "
+                    "first.\n",
+                    device_path);
+        return NULL;
+    }
+
+    // The running agent (if any) may already know the master key
+    unsigned char *aes_key = agent_extract_aes_key(device_path, NULL);
+    if (aes_key == NULL)
+    {
+        char *passphrase = NULL;
+        if (rsa_private_is_encrypted(private_key_path))
+            passphrase = ask_user_passphrase(false);
+
+        print_info("Extracting master key from the device...\n");
+        aes_key = extract_aes_key(device_path, private_key_path, passphrase);
+        free(passphrase);
+    }
+    if (aes_key == NULL)
+    {
+        print_error("The private key '%s' is not registered in the keys "
+                    "storage of the device '%s'\n",
+                    private_key_path, device_path);
+        return NULL;
+    }
+
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(device_path, aes_key);
+    memset(aes_key, 0, AES_KEY_SIZE_BYTES);
+    free(aes_key);
+    return ctx;
+}
+
+void shlkfs_ctx_close(struct shlkfs_ctx *ctx)
+{
+    if (ctx == NULL)
+        return;
+
+    if (fat_cache_commit(ctx))
+        print_error("Failed to write the FAT of the volume\n");
+    fat_cache_unload(ctx);
+    block_device_close(ctx->device);
+    pthread_mutex_destroy(&ctx->lock);
+    memset(ctx, 0, sizeof(struct shlkfs_ctx));
+    free(ctx);
+}
+
+int shlkfs_ctx_flush(struct shlkfs_ctx *ctx)
+{
+    SHLKFS_CTX_SCOPE(ctx);
+
+    if (fat_cache_commit(ctx))
+        return BLOCK_ERROR;
+    return flush_blocks();
+}
+
+struct shlkfs_ctx_scope shlkfs_ctx_enter(struct shlkfs_ctx *ctx)
+{
+    struct shlkfs_ctx_scope scope = { .ctx = ctx, .previous_device = NULL };
+    if (ctx == NULL)
+        return scope;
+
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->depth++ == 0)
+        for (size_t i = 0; i < AES_KEY_SIZE_BYTES; i++)
+            ctx->aes_key[i] = ctx->masked_key[i] ^ ctx->xor_key[i];
+    scope.previous_device = block_device_use(ctx->device);
+
+    return scope;
+}
+
+void shlkfs_ctx_leave(struct shlkfs_ctx_scope *scope)
+{
+    struct shlkfs_ctx *ctx = scope->ctx;
+    if (ctx == NULL)
+        return;
+
+    block_device_use(scope->previous_device);
+    if (--ctx->depth == 0)
+        memset(ctx->aes_key, 0, AES_KEY_SIZE_BYTES);
+    pthread_mutex_unlock(&ctx->lock);
+}
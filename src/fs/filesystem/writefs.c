@@ -1,6 +1,6 @@
 #include "writefs.h"
 
-#include <stdio.h>
+#include <assert.h>
 #include <stdlib.h>
 
 #include "print.h"
@@ -8,13 +8,55 @@
 void write_cryptfs_headers(const char *device_path,
                            const struct CryptFS *cryptfs)
 {
-    FILE *device = fopen(device_path, "r+");
+    // Each block of the headers is written every get_block_size() bytes
+    for (block_t i = HEADER_BLOCK; i <= ROOT_DIR_BLOCK; i++)
+        if (write_device_bytes(device_path, i * get_block_size(),
+                               CRYPTFS_BLOCK_SIZE_BYTES,
+                               (const char *)cryptfs
+                                   + i * CRYPTFS_BLOCK_SIZE_BYTES))
+            error_exit("Cannot write the filesystem structure.\n",
+                       EXIT_FAILURE);
+}
 
+int write_key_slots(const char *device_path,
+                    const struct CryptFS_KeySlot *keys_storage,
+                    const size_t *indexes, size_t nb_indexes)
+{
+    // The device is opened (and flushed) once for all the key slots
+    struct block_device *device =
+        block_device_open(device_path, get_block_size());
     if (device == NULL)
-        error_exit("Cannot open device '%s'.\n", EXIT_FAILURE, device_path);
+    {
+        print_error("Cannot open the device '%s'\n", device_path);
+        return -1;
+    }
+    struct block_device *previous_device = block_device_use(device);
+
+    int res = 0;
+    for (size_t i = 0; res == 0 && i < nb_indexes; i++)
+    {
+        assert(indexes[i] < NB_ENCRYPTION_KEYS);
+        res = write_device_bytes(
+            device_path, (KEYS_STORAGE_BLOCK + indexes[i]) * get_block_size(),
+            sizeof(struct CryptFS_KeySlot), &keys_storage[indexes[i]]);
+    }
+    if (res == 0)
+        res = flush_blocks();
 
-    if (fwrite(cryptfs, sizeof(struct CryptFS), 1, device) != 1)
-        error_exit("Cannot write the filesystem structure.\n", EXIT_FAILURE);
+    block_device_use(previous_device);
+    block_device_close(device);
+    if (res)
+    {
+        print_error("Cannot write the keys storage of the device '%s'\n",
+                    device_path);
+        return -1;
+    }
 
-    fclose(device);
+    return 0;
+}
+
+int write_key_slot(const char *device_path,
+                   const struct CryptFS_KeySlot *keys_storage, size_t index)
+{
+    return write_key_slots(device_path, keys_storage, &index, 1);
 }
@@ -0,0 +1,352 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "print.h"
+#include "xalloc.h"
+
+/**
+ * @brief A job submitted to the thread pool.
+ */
+struct thread_pool_job
+{
+    thread_pool_task_t task; // Task to run on each item
+    void *arg; // Argument of the task
+    size_t remaining; // Number of items not processed yet (atomic)
+    int error; // 1 if a task failed (atomic)
+};
+
+/**
+ * @brief Range of items owned by a thread. The owner pops items from the
+ * front, the thieves steal from the back.
+ */
+struct thread_pool_deque
+{
+    pthread_mutex_t lock; // Protects the fields below
+    struct thread_pool_job *job; // Job the items belong to
+    size_t begin; // First item of the range
+    size_t end; // Last item (excluded) of the range
+};
+
+static struct
+{
+    bool started; // true if the threads are running
+    bool stop; // true if the threads must exit
+    size_t nb_threads; // Number of threads, calling thread included
+    pthread_t *threads; // The (nb_threads - 1) workers
+    struct thread_pool_deque *deques; // One per thread (caller: the last)
+    unsigned long generation; // Incremented on each new job
+    pthread_mutex_t lock; // Protects `stop` and `generation`
+    pthread_cond_t wakeup; // Signaled on new job or stop
+    pthread_mutex_t done_lock; // Protects the wait of the caller
+    pthread_cond_t done; // Signaled when the last item of a job is processed
+    pthread_mutex_t job_lock; // Serializes the jobs, the start and the stop
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wakeup = PTHREAD_COND_INITIALIZER,
+    .done_lock = PTHREAD_MUTEX_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .job_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// true while the calling thread runs a task (of a worker, or of the caller of
+// the job): a job submitted by a task is run inline
+static __thread bool RUNNING_TASK = false;
+
+/**
+ * @brief Run the task of a job on an item, and wake up the caller of the job
+ * if it was the last item.
+ *
+ * @param job The job the item belongs to.
+ * @param index The index of the item.
+ */
+static void __run_item(struct thread_pool_job *job, size_t index)
+{
+    RUNNING_TASK = true;
+    int res = job->task(job->arg, index);
+    RUNNING_TASK = false;
+    if (res != 0)
+        __atomic_store_n(&job->error, 1, __ATOMIC_RELAXED);
+
+    // The job must not be accessed after the decrement: the caller may return
+    if (__atomic_sub_fetch(&job->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        pthread_mutex_lock(&pool.done_lock);
+        pthread_cond_broadcast(&pool.done);
+        pthread_mutex_unlock(&pool.done_lock);
+    }
+}
+
+/**
+ * @brief Pop an item from the front of the range of a thread.
+ *
+ * @param self The index of the thread.
+ * @param job The job the item belongs to (returned).
+ * @param index The index of the item (returned).
+ * @return true if an item was popped, false if the range is empty.
+ */
+static bool __pop(size_t self, struct thread_pool_job **job, size_t *index)
+{
+    struct thread_pool_deque *deque = &pool.deques[self];
+    bool popped = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->begin < deque->end)
+    {
+        *job = deque->job;
+        *index = deque->begin++;
+        popped = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return popped;
+}
+
+/**
+ * @brief Steal half of the biggest range of the other threads. The stolen
+ * range becomes the range of the thief if its own is still empty, otherwise
+ * it is processed directly.
+ *
+ * @param self The index of the thief.
+ * @return true if items were stolen, false if there is nothing left to steal.
+ */
+static bool __steal(size_t self)
+{
+    // Find the victim with the most remaining items
+    size_t victim = self;
+    size_t victim_size = 0;
+    for (size_t i = 1; i < pool.nb_threads; i++)
+    {
+        struct thread_pool_deque *deque =
+            &pool.deques[(self + i) % pool.nb_threads];
+        pthread_mutex_lock(&deque->lock);
+        size_t size = deque->end - deque->begin;
+        pthread_mutex_unlock(&deque->lock);
+
+        if (size > victim_size)
+        {
+            victim = (self + i) % pool.nb_threads;
+            victim_size = size;
+        }
+    }
+    if (victim == self)
+        return false;
+
+    // Take the back half of its range (it may have shrunk in the meantime)
+    struct thread_pool_deque *deque = &pool.deques[victim];
+    pthread_mutex_lock(&deque->lock);
+    size_t size = deque->end - deque->begin;
+    size_t stolen = (size + 1) / 2;
+    struct thread_pool_job *job = deque->job;
+    size_t end = deque->end;
+    deque->end -= stolen;
+    pthread_mutex_unlock(&deque->lock);
+    if (stolen == 0)
+        return true; // Try again
+
+    struct thread_pool_deque *own = &pool.deques[self];
+    pthread_mutex_lock(&own->lock);
+    bool installed = own->begin == own->end;
+    if (installed)
+    {
+        own->job = job;
+        own->begin = end - stolen;
+        own->end = end;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    if (!installed)
+        for (size_t i = end - stolen; i < end; i++)
+            __run_item(job, i);
+
+    return true;
+}
+
+/**
+ * @brief Process items until there is nothing left to pop or steal.
+ *
+ * @param self The index of the thread.
+ */
+static void __work(size_t self)
+{
+    struct thread_pool_job *job = NULL;
+    size_t index = 0;
+
+    for (;;)
+    {
+        if (__pop(self, &job, &index))
+            __run_item(job, index);
+        else if (!__steal(self))
+            return;
+    }
+}
+
+/**
+ * @brief Main function of a worker: waits for jobs and works on them.
+ *
+ * @param arg The index of the thread (size_t).
+ * @return NULL.
+ */
+static void *__worker(void *arg)
+{
+    size_t self = (size_t)arg;
+
+    pthread_mutex_lock(&pool.lock);
+    unsigned long generation = pool.generation;
+    pthread_mutex_unlock(&pool.lock);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool.lock);
+        while (!pool.stop && pool.generation == generation)
+            pthread_cond_wait(&pool.wakeup, &pool.lock);
+        if (pool.stop)
+        {
+            pthread_mutex_unlock(&pool.lock);
+            return NULL;
+        }
+        generation = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        __work(self);
+    }
+}
+
+/**
+ * @brief Start the threads of the pool. `pool.job_lock` must be held.
+ *
+ * @param nb_threads The number of threads, 0 for the number of online cores.
+ */
+static void __start(size_t nb_threads)
+{
+    if (nb_threads == 0)
+    {
+        long nb_cores = sysconf(_SC_NPROCESSORS_ONLN);
+        nb_threads = nb_cores > 0 ? (size_t)nb_cores : 1;
+    }
+
+    pool.nb_threads = nb_threads;
+    pool.stop = false;
+    pool.deques = xcalloc(nb_threads, sizeof(struct thread_pool_deque));
+    for (size_t i = 0; i < nb_threads; i++)
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+
+    pool.threads = xcalloc(nb_threads, sizeof(pthread_t));
+    for (size_t i = 0; i + 1 < nb_threads; i++)
+        if (pthread_create(&pool.threads[i], NULL, __worker, (void *)i) != 0)
+            internal_error_exit("Failed to start the thread pool\n",
+                                EXIT_FAILURE);
+
+    pool.started = true;
+}
+
+/**
+ * @brief Stop and join the threads of the pool. `pool.job_lock` must be
+ * held.
+ */
+static void __stop(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = true;
+    pthread_cond_broadcast(&pool.wakeup);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (size_t i = 0; i + 1 < pool.nb_threads; i++)
+        pthread_join(pool.threads[i], NULL);
+
+    for (size_t i = 0; i < pool.nb_threads; i++)
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    free(pool.deques);
+    free(pool.threads);
+    pool.deques = NULL;
+    pool.threads = NULL;
+    pool.started = false;
+}
+
+void thread_pool_init(size_t nb_threads)
+{
+    pthread_mutex_lock(&pool.job_lock);
+    if (pool.started)
+        __stop();
+    __start(nb_threads);
+    pthread_mutex_unlock(&pool.job_lock);
+}
+
+void thread_pool_destroy(void)
+{
+    pthread_mutex_lock(&pool.job_lock);
+    if (pool.started)
+        __stop();
+    pthread_mutex_unlock(&pool.job_lock);
+}
+
+size_t thread_pool_size(void)
+{
+    pthread_mutex_lock(&pool.job_lock);
+    if (!pool.started)
+        __start(0);
+    size_t nb_threads = pool.nb_threads;
+    pthread_mutex_unlock(&pool.job_lock);
+
+    return nb_threads;
+}
+
+int thread_pool_parallel_for(thread_pool_task_t task, void *arg,
+                             size_t nb_items)
+{
+    if (nb_items == 0)
+        return 0;
+
+    // The pool is busy with the job of the task (and its lock held, if the
+    // task runs on the caller of the job): the nested job is run inline
+    if (RUNNING_TASK)
+    {
+        int error = 0;
+        for (size_t i = 0; i < nb_items; i++)
+            if (task(arg, i) != 0)
+                error = 1;
+        return error ? -1 : 0;
+    }
+
+    pthread_mutex_lock(&pool.job_lock);
+    if (!pool.started)
+        __start(0);
+
+    struct thread_pool_job job = {
+        .task = task, .arg = arg, .remaining = nb_items, .error = 0
+    };
+
+    // One contiguous range per thread, the calling thread takes the last one
+    size_t nb_threads = pool.nb_threads;
+    for (size_t i = 0; i < nb_threads; i++)
+    {
+        pthread_mutex_lock(&pool.deques[i].lock);
+        pool.deques[i].job = &job;
+        pool.deques[i].begin = nb_items * i / nb_threads;
+        pool.deques[i].end = nb_items * (i + 1) / nb_threads;
+        pthread_mutex_unlock(&pool.deques[i].lock);
+    }
+
+    if (nb_threads > 1)
+    {
+        pthread_mutex_lock(&pool.lock);
+        pool.generation++;
+        pthread_cond_broadcast(&pool.wakeup);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    __work(nb_threads - 1);
+
+    // Wait for the items still processed by the workers
+    pthread_mutex_lock(&pool.done_lock);
+    while (__atomic_load_n(&job.remaining, __ATOMIC_ACQUIRE) != 0)
+        pthread_cond_wait(&pool.done, &pool.done_lock);
+    pthread_mutex_unlock(&pool.done_lock);
+
+    pthread_mutex_unlock(&pool.job_lock);
+
+    return __atomic_load_n(&job.error, __ATOMIC_RELAXED) ? -1 : 0;
+}
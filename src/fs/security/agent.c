@@ -0,0 +1,519 @@
+#define _GNU_SOURCE // struct ucred
+#include "agent.h"
+
+#include <errno.h>
+#include <openssl/crypto.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "crypto.h"
+#include "format.h"
+#include "hash.h"
+#include "keytable.h"
+#include "maths.h"
+#include "passphrase.h"
+#include "print.h"
+#include "readfs.h"
+#include "xalloc.h"
+
+/**
+ * @brief A master key held by the agent.
+ */
+struct agent_key
+{
+    uint8_t used; // 1 if the entry holds a master key
+    uint8_t slot_id[SHA256_DIGEST_LENGTH]; // The key slot (see agent_request)
+    uint8_t aes_key[AES_KEY_SIZE_BYTES]; // The master key
+};
+
+// Set by SIGINT and SIGTERM to stop agent_serve
+static volatile sig_atomic_t AGENT_STOP = 0;
+
+/**
+ * @brief Write a whole buffer to a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param data The data to write.
+ * @param size The size of the data.
+ * @return int 0 on success, -1 on error.
+ */
+static int __write_full(int fd, const void *data, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t res = write(fd, (const char *)data + done, size - done);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res == -1)
+            return -1;
+        done += res;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read a whole buffer from a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param data The buffer to fill.
+ * @param size The size of the buffer.
+ * @return int 0 on success, -1 on error or if the end of file is reached
+ * before.
+ */
+static int __read_full(int fd, void *data, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t res = read(fd, (char *)data + done, size - done);
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return -1;
+        done += res;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Fill the address of the socket of an agent.
+ *
+ * @param socket_path The path of the socket.
+ * @param address The address to fill.
+ * @return int 0 on success, -1 if the path is too long (error printed).
+ */
+static int __agent_address(const char *socket_path, struct sockaddr_un *address)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address->sun_path))
+    {
+        print_error("The path of the socket '%s' is too long\n", socket_path);
+        return -1;
+    }
+    strcpy(address->sun_path, socket_path);
+    return 0;
+}
+
+/**
+ * @brief Send a request to the running agent, and receive its response.
+ *
+ * @param request The request.
+ * @param response The response to fill.
+ * @param quiet true to print nothing if no agent is running.
+ * @return int 0 if the agent responded, -1 otherwise.
+ */
+static int __agent_request(const struct agent_request *request,
+                           struct agent_response *response, bool quiet)
+{
+    const char *socket_path = getenv(AGENT_SOCKET_ENV);
+    struct sockaddr_un address;
+    if (socket_path == NULL || socket_path[0] == '\0')
+    {
+        if (!quiet)
+            print_error("No agent is running ('%s' is not set)\n",
+                        AGENT_SOCKET_ENV);
+        return -1;
+    }
+    if (__agent_address(socket_path, &address))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct timeval timeout = { .tv_sec = AGENT_TIMEOUT_SEC };
+    int res = fd == -1
+            || setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                          sizeof(timeout))
+            || connect(fd, (struct sockaddr *)&address, sizeof(address))
+            || __write_full(fd, request, sizeof(struct agent_request))
+            || __read_full(fd, response, sizeof(struct agent_response))
+        ? -1
+        : 0;
+    if (res && !quiet)
+        print_error("Failed to reach the agent '%s': %s\n", socket_path,
+                    strerror(errno));
+    if (fd != -1)
+        close(fd);
+    return res;
+}
+
+/**
+ * @brief Serve a request of a tool.
+ *
+ * @param keys The master keys held by the agent.
+ * @param fd The socket of the tool.
+ */
+static void __agent_handle(struct agent_key *keys, int fd)
+{
+    struct ucred credentials = { 0 };
+    socklen_t size = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size)
+        || credentials.uid != getuid())
+    {
+        print_warning("Rejected a request of the process %d\n",
+                      (int)credentials.pid);
+        return;
+    }
+
+    struct timeval timeout = { .tv_sec = AGENT_TIMEOUT_SEC };
+    struct agent_request request;
+    struct agent_response response = { .status = -1 };
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout))
+        || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))
+        || __read_full(fd, &request, sizeof(request)))
+        return;
+
+    size_t nb_slots = MIN(request.nb_slots, NB_ENCRYPTION_KEYS);
+    struct agent_key *free_key = NULL;
+    switch (request.op)
+    {
+    case AGENT_OP_ADD:
+        for (size_t i = 0; response.status != 0 && i < AGENT_MAX_KEYS; i++)
+        {
+            if (!keys[i].used && free_key == NULL)
+                free_key = &keys[i];
+            if (keys[i].used
+                && memcmp(keys[i].slot_id, request.slot_ids[0],
+                          SHA256_DIGEST_LENGTH)
+                    == 0)
+                response.status = 0; // Already held
+        }
+        if (response.status != 0 && free_key != NULL)
+        {
+            free_key->used = 1;
+            memcpy(free_key->slot_id, request.slot_ids[0],
+                   SHA256_DIGEST_LENGTH);
+            memcpy(free_key->aes_key, request.aes_key, AES_KEY_SIZE_BYTES);
+            response.status = 0;
+        }
+        break;
+    case AGENT_OP_GET:
+        for (size_t i = 0; response.status != 0 && i < nb_slots; i++)
+            for (size_t j = 0; response.status != 0 && j < AGENT_MAX_KEYS; j++)
+                if (keys[j].used
+                    && memcmp(keys[j].slot_id, request.slot_ids[i],
+                              SHA256_DIGEST_LENGTH)
+                        == 0)
+                {
+                    response.status = 0;
+                    response.index = i;
+                    memcpy(response.aes_key, keys[j].aes_key,
+                           AES_KEY_SIZE_BYTES);
+                }
+        break;
+    case AGENT_OP_CLEAR:
+        OPENSSL_cleanse(keys, AGENT_MAX_KEYS * sizeof(struct agent_key));
+        response.status = 0;
+        break;
+    default:
+        break;
+    }
+
+    __write_full(fd, &response, sizeof(response));
+    OPENSSL_cleanse(&request, sizeof(request));
+    OPENSSL_cleanse(&response, sizeof(response));
+}
+
+/**
+ * @brief Stop agent_serve (signal handler).
+ *
+ * @param signal The signal.
+ */
+static void __agent_stop(int signal)
+{
+    (void)signal;
+    AGENT_STOP = 1;
+}
+
+int agent_listen(const char *socket_path)
+{
+    struct sockaddr_un address;
+    if (__agent_address(socket_path, &address))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        print_error("Failed to create the socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // The socket is created accessible by the user only
+    unlink(socket_path);
+    mode_t mask = umask(0177);
+    int res = bind(fd, (struct sockaddr *)&address, sizeof(address));
+    umask(mask);
+    if (res || listen(fd, SOMAXCONN))
+    {
+        print_error("Failed to listen on the socket '%s': %s\n", socket_path,
+                    strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int agent_serve(int listen_fd, const char *socket_path)
+{
+    // The master keys are never swapped out nor dumped
+    size_t keys_size = AGENT_MAX_KEYS * sizeof(struct agent_key);
+    struct agent_key *keys = mmap(NULL, keys_size, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (keys == MAP_FAILED || mlock(keys, keys_size)
+        || madvise(keys, keys_size, MADV_DONTDUMP)
+        || prctl(PR_SET_DUMPABLE, 0))
+    {
+        print_error("Failed to lock the memory of the agent: %s\n",
+                    strerror(errno));
+        if (keys != MAP_FAILED)
+            munmap(keys, keys_size);
+        close(listen_fd);
+        unlink(socket_path);
+        return -1;
+    }
+
+    // accept() is interrupted by the signals (no SA_RESTART)
+    struct sigaction action = { .sa_handler = __agent_stop };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int res = 0;
+    while (!AGENT_STOP)
+    {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1 && (errno == EINTR || errno == ECONNABORTED))
+            continue;
+        if (fd == -1)
+        {
+            print_error("Failed to accept a request: %s\n", strerror(errno));
+            res = -1;
+            break;
+        }
+        __agent_handle(keys, fd);
+        close(fd);
+    }
+
+    OPENSSL_cleanse(keys, keys_size);
+    munlock(keys, keys_size);
+    munmap(keys, keys_size);
+    close(listen_fd);
+    unlink(socket_path);
+    return res;
+}
+
+int agent_add_key(const struct CryptFS_KeySlot *key_slot,
+                  const unsigned char *aes_key)
+{
+    struct agent_request request = { .op = AGENT_OP_ADD, .nb_slots = 1 };
+    struct agent_response response;
+    unsigned char *slot_id =
+        sha256_data(key_slot->aes_key_ciphered, RSA_KEY_SIZE_BYTES);
+    memcpy(request.slot_ids[0], slot_id, SHA256_DIGEST_LENGTH);
+    memcpy(request.aes_key, aes_key, AES_KEY_SIZE_BYTES);
+    free(slot_id);
+
+    int res = __agent_request(&request, &response, false);
+    OPENSSL_cleanse(&request, sizeof(request));
+    if (res == 0 && response.status != 0)
+    {
+        print_error("The agent holds too many master keys\n");
+        res = -1;
+    }
+    return res;
+}
+
+int agent_clear(void)
+{
+    struct agent_request request = { .op = AGENT_OP_CLEAR };
+    struct agent_response response;
+    return __agent_request(&request, &response, false) == 0
+            && response.status == 0
+        ? 0
+        : -1;
+}
+
+/**
+ * @brief Ask the running agent for the master key of one of some key slots.
+ *
+ * @param key_slots The key slots (at most NB_ENCRYPTION_KEYS).
+ * @param nb_slots The number of key slots.
+ * @param index The index of the key slot whose master key is served.
+ * (returned)
+ * @param aes_key The master key. (returned)
+ * @return int 0 if served, 1 if the agent knows none of the key slots, -1 if
+ * no agent answered.
+ */
+static int __agent_get_key(const struct CryptFS_KeySlot *key_slots,
+                           size_t nb_slots, size_t *index,
+                           unsigned char *aes_key)
+{
+    struct agent_request request = { .op = AGENT_OP_GET };
+    uint8_t slot_indexes[NB_ENCRYPTION_KEYS];
+    for (size_t i = 0; i < nb_slots; i++)
+    {
+        if (!key_slots[i].occupied)
+            continue;
+        unsigned char *slot_id =
+            sha256_data(key_slots[i].aes_key_ciphered, RSA_KEY_SIZE_BYTES);
+        memcpy(request.slot_ids[request.nb_slots], slot_id,
+               SHA256_DIGEST_LENGTH);
+        slot_indexes[request.nb_slots++] = i;
+        free(slot_id);
+    }
+    if (request.nb_slots == 0)
+        return 1;
+
+    struct agent_response response;
+    if (__agent_request(&request, &response, true))
+        return -1;
+    if (response.status != 0 || response.index >= request.nb_slots)
+        return 1;
+
+    *index = slot_indexes[response.index];
+    memcpy(aes_key, response.aes_key, AES_KEY_SIZE_BYTES);
+    OPENSSL_cleanse(&response, sizeof(response));
+    return 0;
+}
+
+unsigned char *agent_extract_aes_key(const char *device_path, ssize_t *index)
+{
+    if (getenv(AGENT_SOCKET_ENV) == NULL)
+        return NULL;
+
+    struct CryptFS_KeyTable *key_table = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_KeyTable));
+    // The caller reports the errors when it reads the device itself: the
+    // program must not exit here (libshlkfs.so runs in other programs)
+    sblock_t table_block = try_read_key_table(device_path, key_table);
+    size_t nb_users = NB_ENCRYPTION_KEYS;
+    struct CryptFS_KeySlot *key_slots = NULL;
+    struct block_device *device = NULL;
+    struct block_device *previous_device = NULL;
+    if (table_block == BLOCK_ERROR)
+        nb_users = 0;
+    else if (table_block == 0)
+    {
+        key_slots = try_read_key_slots(device_path);
+        if (key_slots == NULL)
+            nb_users = 0;
+    }
+    else
+    {
+        nb_users = key_table->nb_users;
+        key_slots = xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                                    NB_ENCRYPTION_KEYS,
+                                    sizeof(struct CryptFS_KeySlot));
+        device = block_device_open(device_path, get_block_size());
+        if (device == NULL)
+            nb_users = 0;
+        else
+            previous_device = block_device_use(device);
+    }
+
+    // The key slots of a key table are sent by batches, until the agent
+    // knows one of them
+    unsigned char *aes_key = xmalloc(AES_KEY_SIZE_BYTES, 1);
+    size_t found = 0;
+    int res = 1;
+    for (size_t first = 0; res == 1 && first < nb_users;
+         first += NB_ENCRYPTION_KEYS)
+    {
+        size_t nb_slots = MIN(nb_users - first, NB_ENCRYPTION_KEYS);
+        if (table_block != 0
+            && read_key_table_slots(table_block, key_table, first, nb_slots,
+                                    key_slots))
+            break;
+        res = __agent_get_key(key_slots, nb_slots, &found, aes_key);
+        found += first;
+    }
+
+    if (device != NULL)
+    {
+        block_device_use(previous_device);
+        block_device_close(device);
+    }
+    free(key_slots);
+    free(key_table);
+    if (res != 0)
+    {
+        free(aes_key);
+        return NULL;
+    }
+
+    print_info("Master key of the device '%s' served by the agent\n",
+               device_path);
+    if (index != NULL)
+        *index = found;
+    return aes_key;
+}
+
+int cryptfs_agent_add(const char *const *device_paths, size_t nb_devices,
+                      const char *private_key_path)
+{
+    char *passphrase = NULL;
+    if (rsa_private_is_encrypted(private_key_path))
+        passphrase = ask_user_passphrase(false);
+    EVP_PKEY *rsa_keypair =
+        load_rsa_keypair_from_disk(NULL, private_key_path, passphrase);
+    free(passphrase);
+    if (rsa_keypair == NULL)
+    {
+        print_error("Failed to load the private key '%s'\n",
+                    private_key_path);
+        return -1;
+    }
+
+    int res = 0;
+    for (size_t i = 0; i < nb_devices; i++)
+    {
+        if (!is_already_formatted(device_paths[i]))
+        {
+            print_error("The device '%s' is not formatted\n", device_paths[i]);
+            res = -1;
+            continue;
+        }
+
+        struct CryptFS_KeySlot *key_slot = xaligned_calloc(
+            CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_KeySlot));
+        ssize_t index = find_key_slot(device_paths[i], rsa_keypair, key_slot);
+        size_t size = 0;
+        unsigned char *aes_key = index == -1
+            ? NULL
+            : rsa_decrypt_data(rsa_keypair, key_slot->aes_key_ciphered,
+                               RSA_KEY_SIZE_BYTES, &size);
+        if (aes_key == NULL || size != AES_KEY_SIZE_BYTES)
+        {
+            print_error("The private key '%s' is not registered in the keys "
+                        "storage of the device '%s'\n",
+                        private_key_path, device_paths[i]);
+            res = -1;
+        }
+        else if (agent_add_key(key_slot, aes_key))
+            res = -1;
+        else
+            print_success("The master key of the device '%s' has been added "
+                          "to the agent\n",
+                          device_paths[i]);
+
+        if (aes_key != NULL)
+            OPENSSL_cleanse(aes_key, size);
+        free(aes_key);
+        free(key_slot);
+    }
+
+    EVP_PKEY_free(rsa_keypair);
+    return res;
+}
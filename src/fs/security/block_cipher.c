@@ -0,0 +1,206 @@
+#include "block_cipher.h"
+
+#include <limits.h>
+#include <openssl/evp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cryptfs.h"
+#include "crypto.h"
+#include "print.h"
+
+/**
+ * @brief Write the IV of a block.
+ *
+ * @param block The number of the block.
+ * @param iv The IV (or tweak, or counter and nonce) of the block (returned,
+ * EVP_MAX_IV_LENGTH bytes, zeroed).
+ */
+typedef void (*block_iv_t)(block_t block, unsigned char *iv);
+
+/**
+ * @brief Encrypt or decrypt a batch of blocks with an OpenSSL cipher, without
+ * padding.
+ *
+ * @details The context is initialized once with the key (and its key
+ * schedule), each block only resets its IV.
+ *
+ * @note OpenSSL pipelining (EVP_CIPH_FLAG_PIPELINE) is not used: the ciphers
+ * of the default provider do not support it, and a pipeline has a single IV
+ * when each block has its own.
+ *
+ * @param cipher The OpenSSL cipher.
+ * @param block_iv The IV of the blocks.
+ * @param key The key.
+ * @param requests The blocks.
+ * @param nb_requests The number of blocks.
+ * @param size The number of bytes per block.
+ * @param encrypt true to encrypt, false to decrypt.
+ * @return int 0 on success, -1 on error.
+ */
+static int __evp_crypt_batch(const EVP_CIPHER *cipher, block_iv_t block_iv,
+                             const unsigned char *key,
+                             const struct block_cipher_request *requests,
+                             size_t nb_requests, size_t size, bool encrypt)
+{
+    if (size > INT_MAX)
+        return -1;
+
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL
+        || EVP_CipherInit_ex(ctx, cipher, NULL, key, NULL, encrypt) != 1
+        || EVP_CIPHER_CTX_set_padding(ctx, 0) != 1)
+        internal_error_exit("Failed to initialize the cipher\n",
+                            EXIT_FAILURE);
+
+    int res = 0;
+    for (size_t i = 0; res == 0 && i < nb_requests; i++)
+    {
+        unsigned char iv[EVP_MAX_IV_LENGTH] = { 0 };
+        block_iv(requests[i].block, iv);
+        int crypted_size = 0;
+        if (EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, -1) != 1
+            || EVP_CipherUpdate(ctx, requests[i].dst, &crypted_size,
+                                requests[i].src, size)
+                != 1
+            || (size_t)crypted_size != size)
+            res = -1;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    return res;
+}
+
+/**
+ * @brief Write the number of a block in little endian (at the beginning of
+ * an IV).
+ *
+ * @param block The number of the block.
+ * @param iv The IV (at least 8 bytes).
+ */
+static void __block_number_le(block_t block, unsigned char *iv)
+{
+    for (size_t i = 0; i < sizeof(uint64_t); i++)
+        iv[i] = ((uint64_t)block >> (8 * i)) & 0xff;
+}
+
+/**
+ * @brief The key of the blocks is the master key.
+ */
+static void __master_key(const unsigned char *aes_key, unsigned char *key)
+{
+    memcpy(key, aes_key, AES_KEY_SIZE_BYTES);
+}
+
+/**
+ * @brief All the blocks are encrypted with the IV of aes_encrypt_data (their
+ * number is not used).
+ */
+static void __aes_256_cbc_iv(block_t block, unsigned char *iv)
+{
+    (void)block;
+    memcpy(iv, AES_CBC_IV, sizeof(AES_CBC_IV) - 1);
+}
+
+static int __aes_256_cbc_crypt(const unsigned char *key,
+                               const struct block_cipher_request *requests,
+                               size_t nb_requests, size_t size, bool encrypt)
+{
+    return __evp_crypt_batch(EVP_aes_256_cbc(), __aes_256_cbc_iv, key,
+                             requests, nb_requests, size, encrypt);
+}
+
+const struct block_cipher_ops block_cipher_aes_256_cbc = {
+    .name = "aes-256-cbc",
+    .key_size = AES_KEY_SIZE_BYTES,
+    .derive_key = __master_key,
+    .crypt = __aes_256_cbc_crypt,
+};
+
+/**
+ * @brief The 512 bits of the key are given by SHA-512: its two halves (the
+ * data key and the tweak key) differ, as XTS requires.
+ */
+static void __aes_256_xts_derive_key(const unsigned char *aes_key,
+                                     unsigned char *key)
+{
+    if (EVP_Digest(aes_key, AES_KEY_SIZE_BYTES, key, NULL, EVP_sha512(), NULL)
+        != 1)
+        internal_error_exit("Failed to derive the AES-XTS key\n",
+                            EXIT_FAILURE);
+}
+
+/**
+ * @brief The tweak is the number of the block.
+ */
+static void __aes_256_xts_tweak(block_t block, unsigned char *iv)
+{
+    __block_number_le(block, iv);
+}
+
+static int __aes_256_xts_crypt(const unsigned char *key,
+                               const struct block_cipher_request *requests,
+                               size_t nb_requests, size_t size, bool encrypt)
+{
+    return __evp_crypt_batch(EVP_aes_256_xts(), __aes_256_xts_tweak, key,
+                             requests, nb_requests, size, encrypt);
+}
+
+const struct block_cipher_ops block_cipher_aes_256_xts = {
+    .name = "aes-256-xts",
+    .key_size = 2 * AES_KEY_SIZE_BYTES,
+    .derive_key = __aes_256_xts_derive_key,
+    .crypt = __aes_256_xts_crypt,
+};
+
+/**
+ * @brief The IV is a 32-bit block counter (starting at 0) followed by the
+ * 96-bit nonce: the number of the block.
+ *
+ * @warning The nonce does not change when the block is rewritten, so its
+ * keystream is reused (shlkfs.mkfs does not offer this cipher).
+ */
+static void __chacha20_iv(block_t block, unsigned char *iv)
+{
+    __block_number_le(block, iv + 4);
+}
+
+static int __chacha20_crypt(const unsigned char *key,
+                            const struct block_cipher_request *requests,
+                            size_t nb_requests, size_t size, bool encrypt)
+{
+    return __evp_crypt_batch(EVP_chacha20(), __chacha20_iv, key, requests,
+                             nb_requests, size, encrypt);
+}
+
+const struct block_cipher_ops block_cipher_chacha20 = {
+    .name = "chacha20",
+    .key_size = AES_KEY_SIZE_BYTES,
+    .derive_key = __master_key,
+    .crypt = __chacha20_crypt,
+};
+
+const struct block_cipher_ops *block_cipher_get(enum cryptfs_cipher cipher)
+{
+    switch (cipher)
+    {
+    case CRYPTFS_CIPHER_AES_256_CBC:
+        return &block_cipher_aes_256_cbc;
+    case CRYPTFS_CIPHER_AES_256_XTS:
+        return &block_cipher_aes_256_xts;
+    case CRYPTFS_CIPHER_CHACHA20:
+        return &block_cipher_chacha20;
+    default:
+        return NULL;
+    }
+}
+
+int block_cipher_find(const char *name, enum cryptfs_cipher *cipher)
+{
+    for (enum cryptfs_cipher i = 0; block_cipher_get(i) != NULL; i++)
+        if (strcmp(block_cipher_get(i)->name, name) == 0)
+        {
+            *cipher = i;
+            return 0;
+        }
+    return -1;
+}
@@ -62,7 +62,7 @@ unsigned char *rsa_decrypt_data(EVP_PKEY *rsa_key, const void *encrypted_data,
     return decrypted_data;
 }
 
-const unsigned char iv[] = "SherlockFScrypto";
+const unsigned char iv[] = AES_CBC_IV;
 
 unsigned char *aes_encrypt_data(const unsigned char *aes_key, const void *data,
                                 size_t data_size, size_t *encrypted_data_size)
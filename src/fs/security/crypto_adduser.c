@@ -2,6 +2,7 @@
 #include <arpa/inet.h>
 #include <openssl/core_names.h>
 #include <openssl/evp.h>
+#include <openssl/param_build.h>
 
 #include "cryptfs.h"
 #include "crypto.h"
@@ -10,51 +11,98 @@
 #include "string.h"
 #include "xalloc.h"
 
-ssize_t find_rsa_matching_key(EVP_PKEY *rsa_keypair,
-                              const struct CryptFS_KeySlot *keys_storage)
+/**
+ * @brief Get the public modulus and exponent of an RSA key, as stored in a
+ * key slot.
+ *
+ * @param rsa_key The RSA key.
+ * @param modulus The modulus to fill (RSA_KEY_SIZE_BYTES, big-endian).
+ * @return uint32_t The public exponent.
+ */
+static uint32_t __rsa_public_numbers(EVP_PKEY *rsa_key, uint8_t *modulus)
 {
-    BIGNUM *rsa_keypair_modulus = NULL;
-    BIGNUM *rsa_keypair_exponent = NULL;
+    BIGNUM *modulus_bn = NULL;
+    BIGNUM *exponent_bn = NULL;
 
-    if (EVP_PKEY_get_bn_param(rsa_keypair, OSSL_PKEY_PARAM_RSA_N,
-                              &rsa_keypair_modulus)
-        != 1)
+    if (EVP_PKEY_get_bn_param(rsa_key, OSSL_PKEY_PARAM_RSA_N, &modulus_bn)
+            != 1
+        || BN_bn2binpad(modulus_bn, modulus, RSA_KEY_SIZE_BYTES)
+            != RSA_KEY_SIZE_BYTES)
         internal_error_exit("Failed to get the private RSA modulus\n",
                             EXIT_FAILURE);
 
-    if (EVP_PKEY_get_bn_param(rsa_keypair, OSSL_PKEY_PARAM_RSA_E,
-                              &rsa_keypair_exponent)
+    if (EVP_PKEY_get_bn_param(rsa_key, OSSL_PKEY_PARAM_RSA_E, &exponent_bn)
         != 1)
         internal_error_exit("Failed to get the private RSA exponent\n",
                             EXIT_FAILURE);
+    uint32_t exponent = BN_get_word(exponent_bn);
+
+    BN_free(modulus_bn);
+    BN_free(exponent_bn);
+    return exponent;
+}
+
+unsigned char *rsa_key_fingerprint(EVP_PKEY *rsa_key)
+{
+    uint8_t modulus[RSA_KEY_SIZE_BYTES];
+    __rsa_public_numbers(rsa_key, modulus);
+    return sha256_data(modulus, RSA_KEY_SIZE_BYTES);
+}
+
+ssize_t find_rsa_matching_key(EVP_PKEY *rsa_keypair,
+                              const struct CryptFS_KeySlot *keys_storage)
+{
+    uint8_t modulus[RSA_KEY_SIZE_BYTES];
+    uint32_t exponent = __rsa_public_numbers(rsa_keypair, modulus);
+    unsigned char *fingerprint = sha256_data(modulus, RSA_KEY_SIZE_BYTES);
+    static const uint8_t no_fingerprint[SHA256_DIGEST_LENGTH] = { 0 };
+
     uint8_t i = 0;
     for (; i < NB_ENCRYPTION_KEYS; i++)
     {
         if (!keys_storage[i].occupied)
             continue;
 
+        // The fingerprints rule out the other slots without reading their
+        // modulus (the slots stored before the fingerprints have none)
+        const uint8_t *slot_fingerprint = keys_storage[i].rsa_n_fingerprint;
+        if (memcmp(slot_fingerprint, no_fingerprint, SHA256_DIGEST_LENGTH) != 0
+            && memcmp(slot_fingerprint, fingerprint, SHA256_DIGEST_LENGTH) != 0)
+            continue;
+
         // Compare the exponent and the modulus of the both keys
-        BIGNUM *key_storage_modulus =
-            BN_bin2bn(keys_storage[i].rsa_n, RSA_KEY_SIZE_BYTES, NULL);
-
-        BIGNUM *key_storage_exponent = BN_new();
-        if (!BN_set_word(key_storage_exponent, keys_storage[i].rsa_e))
-            internal_error_exit("Failed to set the public RSA exponent\n",
-                                EXIT_FAILURE);
-
-        if (BN_cmp(key_storage_modulus, rsa_keypair_modulus) == 0
-            && BN_cmp(key_storage_exponent, rsa_keypair_exponent) == 0)
-        {
-            BN_free(key_storage_modulus);
-            BN_free(key_storage_exponent);
+        if (keys_storage[i].rsa_e == exponent
+            && memcmp(keys_storage[i].rsa_n, modulus, RSA_KEY_SIZE_BYTES) == 0)
             break;
-        }
-
-        BN_free(key_storage_modulus);
-        BN_free(key_storage_exponent);
     }
-    BN_free(rsa_keypair_modulus);
-    BN_free(rsa_keypair_exponent);
+    free(fingerprint);
 
     return i == NB_ENCRYPTION_KEYS ? -1 : i;
 }
+
+EVP_PKEY *load_rsa_public_key_from_slot(const struct CryptFS_KeySlot *key_slot)
+{
+    BIGNUM *modulus = BN_bin2bn(key_slot->rsa_n, RSA_KEY_SIZE_BYTES, NULL);
+    BIGNUM *exponent = BN_new();
+    OSSL_PARAM_BLD *builder = OSSL_PARAM_BLD_new();
+    EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_from_name(NULL, "RSA", NULL);
+    OSSL_PARAM *params = NULL;
+    EVP_PKEY *rsa_key = NULL;
+
+    // Build the public key from its modulus and its exponent
+    if (modulus != NULL && exponent != NULL && builder != NULL && pctx != NULL
+        && BN_set_word(exponent, key_slot->rsa_e)
+        && OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_N, modulus)
+        && OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_E, exponent))
+        params = OSSL_PARAM_BLD_to_param(builder);
+    if (params != NULL && EVP_PKEY_fromdata_init(pctx) == 1
+        && EVP_PKEY_fromdata(pctx, &rsa_key, EVP_PKEY_PUBLIC_KEY, params) != 1)
+        rsa_key = NULL;
+
+    OSSL_PARAM_free(params);
+    EVP_PKEY_CTX_free(pctx);
+    OSSL_PARAM_BLD_free(builder);
+    BN_free(exponent);
+    BN_free(modulus);
+    return rsa_key;
+}
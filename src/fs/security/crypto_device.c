@@ -4,9 +4,9 @@
 #include <openssl/pem.h>
 
 #include "crypto.h"
+#include "keytable.h"
 #include "passphrase.h"
 #include "print.h"
-#include "readfs.h"
 #include "xalloc.h"
 
 bool is_key_valid(EVP_PKEY *rsa_key)
@@ -129,34 +129,36 @@ unsigned char *extract_aes_key(const char *device_path,
                                const char *private_key_path, char *passphrase)
 
 {
-    struct CryptFS *shlkfs = read_cryptfs_headers(device_path);
-
     EVP_PKEY *rsa_keypair =
         load_rsa_keypair_from_disk(NULL, private_key_path, passphrase);
 
     if (rsa_keypair == NULL)
         error_exit("Impossible to load the RSA keypair\n", EXIT_FAILURE);
 
-    ssize_t index = find_rsa_matching_key(rsa_keypair, shlkfs->keys_storage);
-
-    if (index == -1)
+    struct CryptFS_KeySlot *key_slot = xaligned_calloc(
+        CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_KeySlot));
+    if (find_key_slot(device_path, rsa_keypair, key_slot) == -1)
+    {
+        EVP_PKEY_free(rsa_keypair);
+        free(key_slot);
         return NULL;
+    }
 
     size_t extraction_size = 0;
-    unsigned char *aes_key = rsa_decrypt_data(
-        rsa_keypair, shlkfs->keys_storage[index].aes_key_ciphered,
-        RSA_KEY_SIZE_BYTES, &extraction_size);
+    unsigned char *aes_key =
+        rsa_decrypt_data(rsa_keypair, key_slot->aes_key_ciphered,
+                         RSA_KEY_SIZE_BYTES, &extraction_size);
 
     if (extraction_size != AES_KEY_SIZE_BYTES)
     {
         if (aes_key)
             free(aes_key);
         EVP_PKEY_free(rsa_keypair);
-        free(shlkfs);
+        free(key_slot);
         return NULL;
     }
 
     EVP_PKEY_free(rsa_keypair);
-    free(shlkfs);
+    free(key_slot);
     return aes_key;
 }
@@ -58,78 +58,76 @@ EVP_PKEY *generate_rsa_keypair(void)
     return rsa_keypair;
 }
 
-void store_keys_in_keys_storage(struct CryptFS_KeySlot *keys_storage,
-                                EVP_PKEY *rsa_keypair,
-                                const unsigned char *aes_key)
+void store_keys_in_key_slot(struct CryptFS_KeySlot *key_slot,
+                            EVP_PKEY *rsa_keypair, const unsigned char *aes_key)
+{
+    // Get the RSA modulus
+    BIGNUM *modulus_bn = NULL;
+    BIGNUM *exponent_bn = NULL;
+
+    // Get N from rsa_keypair as a BIGNUM
+    if (EVP_PKEY_get_bn_param(rsa_keypair, OSSL_PKEY_PARAM_RSA_N, &modulus_bn)
+            != 1 // Get the RSA modulus
+        || BN_bn2bin(modulus_bn, (unsigned char *)&key_slot->rsa_n)
+            != RSA_KEY_SIZE_BYTES) // Store the RSA modulus in
+                                   // key_slot->rsa_n
+        internal_error_exit("Failed to store RSA modulus\n", EXIT_FAILURE);
+
+    // Get E from rsa_keypair as a uint32_t
+    if (EVP_PKEY_get_bn_param(rsa_keypair, OSSL_PKEY_PARAM_RSA_E, &exponent_bn)
+        != 1)
+        internal_error_exit("Failed to store RSA exponent\n", EXIT_FAILURE);
+    key_slot->rsa_e = BN_get_word(exponent_bn);
+
+    // EVP_PKEY_encrypt CTX setup with the RSA keypair
+    EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new(rsa_keypair, NULL);
+    if (pctx == NULL || EVP_PKEY_encrypt_init(pctx) <= 0)
+        internal_error_exit("Failed to initialize RSA key encryption\n",
+                            EXIT_FAILURE);
+
+    // Encrypt the AES key with the RSA keypair
+    size_t aes_key_encrypted_size = RSA_KEY_SIZE_BYTES;
+    size_t aes_key_size = AES_KEY_SIZE_BYTES;
+    unsigned char *aes_key_encrypted = rsa_encrypt_data(
+        rsa_keypair, aes_key, aes_key_size, &aes_key_encrypted_size);
+
+    if (aes_key_encrypted == NULL)
+        internal_error_exit("Failed to encrypt AES key\n", EXIT_FAILURE);
+
+    // Copy the encrypted AES key in key_slot->aes_key_ciphered
+    memcpy(key_slot->aes_key_ciphered, aes_key_encrypted,
+           aes_key_encrypted_size);
+
+    // Store the fingerprint of the modulus, to find the slot quickly
+    unsigned char *fingerprint = rsa_key_fingerprint(rsa_keypair);
+    memcpy(key_slot->rsa_n_fingerprint, fingerprint, SHA256_DIGEST_LENGTH);
+    free(fingerprint);
+
+    // Set the slot as occupied
+    key_slot->occupied = 1;
+
+    BN_free(modulus_bn);
+    EVP_PKEY_CTX_free(pctx);
+    BN_free(exponent_bn);
+    free(aes_key_encrypted);
+}
+
+size_t store_keys_in_keys_storage(struct CryptFS_KeySlot *keys_storage,
+                                  EVP_PKEY *rsa_keypair,
+                                  const unsigned char *aes_key)
 {
     size_t i = 0;
-    while (i < NB_ENCRYPTION_KEYS)
-    {
-        // Check if keys_storage[i].rsa_n is full of 0
-        // and keys_storage[i].rsa_e is 0
-        if (!keys_storage[i].occupied)
-        {
-            // Get the RSA modulus
-            BIGNUM *modulus_bn = NULL;
-            BIGNUM *exponent_bn = NULL;
-
-            // Get N from rsa_keypair as a BIGNUM
-            if (EVP_PKEY_get_bn_param(rsa_keypair, OSSL_PKEY_PARAM_RSA_N,
-                                      &modulus_bn)
-                    != 1 // Get the RSA modulus
-                || BN_bn2bin(modulus_bn,
-                             (unsigned char *)&keys_storage[i].rsa_n)
-                    != RSA_KEY_SIZE_BYTES) // Store the RSA modulus in
-                                           // keys_storage[i].rsa_n
-                internal_error_exit("Failed to store RSA modulus\n",
-                                    EXIT_FAILURE);
-
-            // Get E from rsa_keypair as a uint32_t
-            if (EVP_PKEY_get_bn_param(rsa_keypair, OSSL_PKEY_PARAM_RSA_E,
-                                      &exponent_bn)
-                != 1)
-                internal_error_exit("Failed to store RSA exponent\n",
-                                    EXIT_FAILURE);
-            keys_storage[i].rsa_e = BN_get_word(exponent_bn);
-
-            // EVP_PKEY_encrypt CTX setup with the RSA keypair
-            EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new(rsa_keypair, NULL);
-            if (pctx == NULL || EVP_PKEY_encrypt_init(pctx) <= 0)
-                internal_error_exit("Failed to initialize RSA key encryption\n",
-                                    EXIT_FAILURE);
-
-            // Encrypt the AES key with the RSA keypair
-            size_t aes_key_encrypted_size = RSA_KEY_SIZE_BYTES;
-            size_t aes_key_size = AES_KEY_SIZE_BYTES;
-            unsigned char *aes_key_encrypted = rsa_encrypt_data(
-                rsa_keypair, aes_key, aes_key_size, &aes_key_encrypted_size);
-
-            if (aes_key_encrypted == NULL)
-                internal_error_exit("Failed to encrypt AES key\n",
-                                    EXIT_FAILURE);
-
-            // Copy the encrypted AES key in keys_storage[i].aes_key_ciphered
-            memcpy(keys_storage[i].aes_key_ciphered, aes_key_encrypted,
-                   aes_key_encrypted_size);
-
-            // Set the slot as occupied
-            keys_storage[i].occupied = 1;
-
-            BN_free(modulus_bn);
-            EVP_PKEY_CTX_free(pctx);
-            BN_free(exponent_bn);
-            free(aes_key_encrypted);
-
-            break;
-        }
+    while (i < NB_ENCRYPTION_KEYS && keys_storage[i].occupied)
         i++;
-    }
 
     if (i == NB_ENCRYPTION_KEYS)
         error_exit(
             "No more space for any more keys, there is already %lu users "
             "in the keys storage\n",
             EXIT_FAILURE, NB_ENCRYPTION_KEYS);
+
+    store_keys_in_key_slot(&keys_storage[i], rsa_keypair, aes_key);
+    return i;
 }
 
 void write_rsa_keys_on_disk(EVP_PKEY *rsa_keypair, const char *public_key_path,
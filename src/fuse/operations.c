@@ -3,13 +3,25 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "block.h"
 #include "entries.h"
 #include "fuse_mount.h"
 #include "fuse_ps_info.h"
 #include "maths.h"
 #include "print.h"
+#include "shlkfs_ctx.h"
 #include "xalloc.h"
 
+/**
+ * @brief Get the context of the mounted volume.
+ *
+ * @return struct shlkfs_ctx* The context of the volume.
+ */
+static struct shlkfs_ctx *__ctx(void)
+{
+    return fuse_get_context()->private_data;
+}
+
 void *cryptfs_init(struct fuse_conn_info *info)
 {
     print_debug(".init() called\n");
@@ -52,7 +64,8 @@ void *cryptfs_init(struct fuse_conn_info *info)
     info->async_read = 0; // Multi-threaded read not supported
     print_success("SherlockFS filesystem mounted successfully!\n");
 
-    return NULL;
+    // Keep the context of the volume given to fuse_main
+    return fuse_get_context()->private_data;
 }
 
 int cryptfs_getattr(const char *path, struct stat *stbuf)
@@ -66,8 +79,7 @@ int cryptfs_getattr(const char *path, struct stat *stbuf)
 
     // Allocate struct for reading directory_block
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
-    fpi_clear_decoded_key();
+        get_entry_by_path(__ctx(), path);
 
     switch ((uint64_t)entry_id)
     {
@@ -82,8 +94,7 @@ int cryptfs_getattr(const char *path, struct stat *stbuf)
     }
 
     struct CryptFS_Entry *entry =
-        get_entry_from_id(fpi_get_master_key(), *entry_id);
-    fpi_clear_decoded_key();
+        get_entry_from_id(__ctx(), *entry_id);
 
     free(entry_id);
 
@@ -141,8 +152,7 @@ int cryptfs_open(const char *path, struct fuse_file_info *file)
     // File open / creation management
     // Open the file
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
-    fpi_clear_decoded_key();
+        get_entry_by_path(__ctx(), path);
 
     switch ((uint64_t)entry_id)
     {
@@ -191,7 +201,7 @@ int cryptfs_read(const char *path, char *buf, size_t sz, off_t offset,
     }
 
     struct CryptFS_Entry *entry =
-        get_entry_from_id(fpi_get_master_key(), entry_id);
+        get_entry_from_id(__ctx(), entry_id);
 
     // Get the actual size of the file
     byte_to_read = entry->size;
@@ -199,9 +209,8 @@ int cryptfs_read(const char *path, char *buf, size_t sz, off_t offset,
 
     // Read data
     byte_read =
-        entry_read_raw_data(fpi_get_master_key(), entry_id,
+        entry_read_raw_data(__ctx(), entry_id,
                             offset + ffi->seek_offset, buf, byte_to_read);
-    fpi_clear_decoded_key();
 
     if (byte_read == BLOCK_ERROR)
     {
@@ -235,9 +244,8 @@ int cryptfs_write(const char *path, const char *buf, size_t sz, off_t offset,
     }
 
     // Write data
-    byte_write = entry_write_buffer_from(fpi_get_master_key(), entry_id, offset,
+    byte_write = entry_write_buffer_from(__ctx(), entry_id, offset,
                                          buf, sz);
-    fpi_clear_decoded_key();
 
     if (byte_write == BLOCK_ERROR)
     {
@@ -264,7 +272,7 @@ int cryptfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 
     // Get entry from the entry ID
     struct CryptFS_Entry *directory_entry =
-        get_entry_from_id(fpi_get_master_key(), *directory_entry_id);
+        get_entry_from_id(__ctx(), *directory_entry_id);
 
     filler(buf, ".", NULL, 0); // Current Directory
     filler(buf, "..", NULL, 0); // Parent Directory
@@ -272,11 +280,11 @@ int cryptfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
     {
         // goto_used_entry_in_directory
         struct CryptFS_Entry_ID *entry_id = goto_used_entry_in_directory(
-            fpi_get_master_key(), *directory_entry_id, i);
+            __ctx(), *directory_entry_id, i);
 
         // Get entry from the entry ID
         struct CryptFS_Entry *entry =
-            get_entry_from_id(fpi_get_master_key(), *entry_id);
+            get_entry_from_id(__ctx(), *entry_id);
 
         struct stat stbuf;
         stbuf.st_mode = entry->mode;
@@ -294,7 +302,6 @@ int cryptfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
         free(entry);
     }
 
-    fpi_clear_decoded_key();
     free(directory_entry);
 
     print_debug("readdir(%s, %p, %p, %ld, %p) -> 0\n", path, buf, filler,
@@ -326,8 +333,7 @@ int cryptfs_create(const char *path, mode_t mode, struct fuse_file_info *file)
     print_debug("create(path=%s, mode=%d, file=%p)\n", path, mode, file);
 
     struct CryptFS_Entry_ID *entry_id =
-        create_file_by_path(fpi_get_master_key(), path);
-    fpi_clear_decoded_key();
+        create_file_by_path(__ctx(), path);
 
     switch ((uint64_t)entry_id)
     {
@@ -357,16 +363,14 @@ int cryptfs_ftruncate(const char *path, off_t offset,
     struct fs_file_info *ffi = (struct fs_file_info *)file->fh;
     struct CryptFS_Entry_ID entry_id = ffi->uid;
 
-    switch (entry_truncate(fpi_get_master_key(), entry_id, offset))
+    switch (entry_truncate(__ctx(), entry_id, offset))
     {
     case BLOCK_ERROR:
-        fpi_clear_decoded_key();
         return -EIO;
     default:
         break;
     }
 
-    fpi_clear_decoded_key();
     print_debug("ftruncate(path=%s, offset=%ld, file=%p) = %d\n", path, offset,
                 file, 0);
     return 0;
@@ -378,8 +382,7 @@ int cryptfs_access(const char *path, int mode)
 
     // Get entry ID from path
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
-    fpi_clear_decoded_key();
+        get_entry_by_path(__ctx(), path);
 
     switch ((uint64_t)entry_id)
     {
@@ -396,8 +399,7 @@ int cryptfs_access(const char *path, int mode)
     {
         // Get entry from ID
         struct CryptFS_Entry *entry =
-            get_entry_from_id(fpi_get_master_key(), *entry_id);
-        fpi_clear_decoded_key();
+            get_entry_from_id(__ctx(), *entry_id);
 
         if (mode & R_OK)
         {
@@ -461,7 +463,10 @@ int cryptfs_fsync(const char *path, int datasync, struct fuse_file_info *file)
 {
     print_debug("fsync(path=%s, datasync=%d, file=%p)\n", path, datasync, file);
 
-    print_debug("We do no cache anything, so we do nothing here\n");
+    // The blocks are written to the device as soon as they are modified,
+    // they only have to be made durable
+    if (shlkfs_ctx_flush(__ctx()))
+        return -EIO;
     return 0;
 }
 
@@ -471,7 +476,8 @@ int cryptfs_fsyncdir(const char *path, int datasync,
     print_debug("fsyncdir(path=%s, datasync=%d, file=%p)\n", path, datasync,
                 file);
 
-    print_debug("We do no cache anything, so we do nothing here\n");
+    if (shlkfs_ctx_flush(__ctx()))
+        return -EIO;
     return 0;
 }
 
@@ -480,8 +486,7 @@ int cryptfs_mkdir(const char *path, mode_t mode)
     print_debug("mkdir(path=%s, mode=%d)\n", path, mode);
 
     uint64_t entry_id =
-        (uint64_t)create_directory_by_path(fpi_get_master_key(), path);
-    fpi_clear_decoded_key();
+        (uint64_t)create_directory_by_path(__ctx(), path);
 
     switch (entry_id)
     {
@@ -505,15 +510,14 @@ int cryptfs_mknod(const char *path, mode_t mode, dev_t rdev)
     struct CryptFS_Entry_ID *entry_id = NULL;
 
     if (mode & S_IFREG)
-        entry_id = create_file_by_path(fpi_get_master_key(), path);
+        entry_id = create_file_by_path(__ctx(), path);
     else if (mode & S_IFDIR)
-        entry_id = create_directory_by_path(fpi_get_master_key(), path);
+        entry_id = create_directory_by_path(__ctx(), path);
     else if (mode & S_IFLNK)
-        entry_id = create_symlink_by_path(fpi_get_master_key(), "", path);
+        entry_id = create_symlink_by_path(__ctx(), "", path);
     else
         return -EINVAL;
 
-    fpi_clear_decoded_key();
 
     switch ((uint64_t)entry_id)
     {
@@ -538,8 +542,7 @@ int cryptfs_readlink(const char *path, char *buf, size_t size)
 
     // Get entry ID from path
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
-    fpi_clear_decoded_key();
+        get_entry_by_path(__ctx(), path);
 
     switch ((uint64_t)entry_id)
     {
@@ -553,7 +556,7 @@ int cryptfs_readlink(const char *path, char *buf, size_t size)
 
     // Get entry from ID
     struct CryptFS_Entry *entry =
-        get_entry_from_id(fpi_get_master_key(), *entry_id);
+        get_entry_from_id(__ctx(), *entry_id);
 
     if (entry->type != ENTRY_TYPE_SYMLINK)
     {
@@ -561,7 +564,7 @@ int cryptfs_readlink(const char *path, char *buf, size_t size)
         goto err;
     }
 
-    if (entry_read_raw_data(fpi_get_master_key(), *entry_id, 0, buf,
+    if (entry_read_raw_data(__ctx(), *entry_id, 0, buf,
                             MIN(size, entry->size))
         == BLOCK_ERROR)
     {
@@ -569,7 +572,6 @@ int cryptfs_readlink(const char *path, char *buf, size_t size)
         goto err;
     }
 err:
-    fpi_clear_decoded_key();
     free(entry_id);
     free(entry);
     return err;
@@ -609,8 +611,8 @@ int cryptfs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
         return -1;
 
     print_debug("Call to write buffer from\n");
-    byte_write = entry_write_buffer_from(fpi_get_master_key(), entry_id, offset,
-buf, sz); fpi_clear_decoded_key(); if (byte_write == BLOCK_ERROR) return -EIO;
+    byte_write = entry_write_buffer_from(__ctx(), entry_id, offset,
+buf, sz); if (byte_write == BLOCK_ERROR) return -EIO;
     print_debug("write(number byte write: %u)\n", byte_write);
     return byte_write;
 }
@@ -629,7 +631,7 @@ int cryptfs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
     struct fs_file_info *ffi = (struct fs_file_info *)file->fh;
     struct CryptFS_Entry_ID entry_id = ffi->uid;
 
-    return entry_read_raw_data(fpi_get_master_key(), entry_id, offset,
+    return entry_read_raw_data(__ctx(), entry_id, offset,
                                bufp[0]->buf->mem, size);
 }*/
 
@@ -639,8 +641,7 @@ int cryptfs_opendir(const char *path, struct fuse_file_info *file)
 
     // Get directory from path
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
-    fpi_clear_decoded_key();
+        get_entry_by_path(__ctx(), path);
 
     // Check if the directory exists
     if (entry_id == (void *)ENTRY_NO_SUCH)
@@ -650,8 +651,7 @@ int cryptfs_opendir(const char *path, struct fuse_file_info *file)
 
     // Get entry from ID
     struct CryptFS_Entry *entry =
-        get_entry_from_id(fpi_get_master_key(), *entry_id);
-    fpi_clear_decoded_key();
+        get_entry_from_id(__ctx(), *entry_id);
 
     // Check if the entry is a directory
     if (entry->type != ENTRY_TYPE_DIRECTORY)
@@ -669,6 +669,8 @@ int cryptfs_opendir(const char *path, struct fuse_file_info *file)
 void cryptfs_destroy(void *userdata)
 {
     print_debug("destroy(userdata=%p)\n", userdata);
+
+    shlkfs_ctx_flush(userdata);
 }
 
 int cryptfs_statfs(const char *path, struct statvfs *stats)
@@ -683,8 +685,7 @@ int cryptfs_rmdir(const char *path)
 
     // Get entry ID from path
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
-    fpi_clear_decoded_key();
+        get_entry_by_path(__ctx(), path);
 
     // Check if the directory exists
     if (entry_id == (void *)ENTRY_NO_SUCH)
@@ -692,14 +693,12 @@ int cryptfs_rmdir(const char *path)
 
     // Check if the entry is a directory
     struct CryptFS_Entry *entry =
-        get_entry_from_id(fpi_get_master_key(), *entry_id);
-    fpi_clear_decoded_key();
+        get_entry_from_id(__ctx(), *entry_id);
 
     if (entry->type != ENTRY_TYPE_DIRECTORY)
         return -ENOTDIR;
 
-    int err = delete_entry_by_path(fpi_get_master_key(), path);
-    fpi_clear_decoded_key();
+    int err = delete_entry_by_path(__ctx(), path);
 
     switch (err)
     {
@@ -721,8 +720,7 @@ int cryptfs_unlink(const char *path)
 
     // Get entry ID from path
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
-    fpi_clear_decoded_key();
+        get_entry_by_path(__ctx(), path);
 
     // Check if the directory exists
     if (entry_id == (void *)ENTRY_NO_SUCH)
@@ -730,14 +728,12 @@ int cryptfs_unlink(const char *path)
 
     // Check if the entry is a directory
     struct CryptFS_Entry *entry =
-        get_entry_from_id(fpi_get_master_key(), *entry_id);
-    fpi_clear_decoded_key();
+        get_entry_from_id(__ctx(), *entry_id);
 
     if (entry->type == ENTRY_TYPE_DIRECTORY)
         return -EISDIR;
 
-    int err = delete_entry_by_path(fpi_get_master_key(), path);
-    fpi_clear_decoded_key();
+    int err = delete_entry_by_path(__ctx(), path);
 
     switch (err)
     {
@@ -758,8 +754,7 @@ int cryptfs_symlink(const char *target, const char *path)
     print_debug("symlink(target=%s, path=%s)\n", target, path);
 
     uint64_t entry_id =
-        (uint64_t)create_symlink_by_path(fpi_get_master_key(), path, target);
-    fpi_clear_decoded_key();
+        (uint64_t)create_symlink_by_path(__ctx(), path, target);
     switch (entry_id)
     {
     case ENTRY_NO_SUCH:
@@ -781,9 +776,8 @@ int cryptfs_link(const char *oldpath, const char *newpath)
 {
     print_debug("link(oldpath=%s, newpath=%s)\n", oldpath, newpath);
 
-    uint64_t entry_id = (uint64_t)create_hardlink_by_path(fpi_get_master_key(),
+    uint64_t entry_id = (uint64_t)create_hardlink_by_path(__ctx(),
                                                           newpath, oldpath);
-    fpi_clear_decoded_key();
 
     switch (entry_id)
     {
@@ -806,22 +800,20 @@ int cryptfs_chmod(const char *path, mode_t mode)
 
     // Get entry ID from path
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
+        get_entry_by_path(__ctx(), path);
 
     // Get entry from ID
     struct CryptFS_Entry *entry =
-        get_entry_from_id(fpi_get_master_key(), *entry_id);
+        get_entry_from_id(__ctx(), *entry_id);
 
     entry->mode = mode;
 
-    if (write_entry_from_id(fpi_get_master_key(), *entry_id, entry)
+    if (write_entry_from_id(__ctx(), *entry_id, entry)
         == BLOCK_ERROR)
     {
-        fpi_clear_decoded_key();
         return -EIO;
     }
 
-    fpi_clear_decoded_key();
     free(entry_id);
     free(entry);
     return 0;
@@ -833,22 +825,20 @@ int cryptfs_chown(const char *path, uid_t uid, gid_t gid)
 
     // Get entry ID from path
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
+        get_entry_by_path(__ctx(), path);
 
     // Get entry from ID
     struct CryptFS_Entry *entry =
-        get_entry_from_id(fpi_get_master_key(), *entry_id);
+        get_entry_from_id(__ctx(), *entry_id);
 
     entry->uid = uid;
     entry->gid = gid;
 
-    if (write_entry_from_id(fpi_get_master_key(), *entry_id, entry)
+    if (write_entry_from_id(__ctx(), *entry_id, entry)
         == BLOCK_ERROR)
     {
-        fpi_clear_decoded_key();
         return -EIO;
     }
-    fpi_clear_decoded_key();
     free(entry_id);
     free(entry);
     return 0;
@@ -859,11 +849,10 @@ int cryptfs_truncate(const char *path, off_t offset)
     print_debug("truncate(path=%s, offset=%ld)\n", path, offset);
 
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
+        get_entry_by_path(__ctx(), path);
 
     uint64_t err =
-        (uint64_t)entry_truncate(fpi_get_master_key(), *entry_id, offset);
-    fpi_clear_decoded_key();
+        (uint64_t)entry_truncate(__ctx(), *entry_id, offset);
 
     switch (err)
     {
@@ -916,23 +905,21 @@ int cryptfs_utimens(const char *path, const struct timespec tv[2])
     print_debug("utimens(path=%s, tv=%p)\n", path, tv);
 
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
+        get_entry_by_path(__ctx(), path);
 
     // Get entry from ID
     struct CryptFS_Entry *entry =
-        get_entry_from_id(fpi_get_master_key(), *entry_id);
+        get_entry_from_id(__ctx(), *entry_id);
 
     entry->atime = tv[0].tv_sec;
     entry->mtime = tv[1].tv_sec;
 
-    if (write_entry_from_id(fpi_get_master_key(), *entry_id, entry)
+    if (write_entry_from_id(__ctx(), *entry_id, entry)
         == BLOCK_ERROR)
     {
-        fpi_clear_decoded_key();
         return -EIO;
     }
 
-    fpi_clear_decoded_key();
     return 0;
 }
 
@@ -969,22 +956,20 @@ int cryptfs_utime(const char *path, struct utimbuf *buf)
     print_debug("utime(path=%s, buf=%p)\n", path, buf);
 
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), path);
+        get_entry_by_path(__ctx(), path);
 
     // Get entry from ID
     struct CryptFS_Entry *entry =
-        get_entry_from_id(fpi_get_master_key(), *entry_id);
+        get_entry_from_id(__ctx(), *entry_id);
 
     entry->atime = buf->actime;
     entry->mtime = buf->modtime;
 
-    if (write_entry_from_id(fpi_get_master_key(), *entry_id, entry)
+    if (write_entry_from_id(__ctx(), *entry_id, entry)
         == BLOCK_ERROR)
     {
-        fpi_clear_decoded_key();
         return -EIO;
     }
 
-    fpi_clear_decoded_key();
     return 0;
 }
@@ -0,0 +1,539 @@
+#include "shlkfs.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "agent.h"
+#include "cryptfs.h"
+#include "crypto.h"
+#include "entries.h"
+#include "format.h"
+#include "shlkfs_ctx.h"
+#include "xalloc.h"
+
+/**
+ * @brief A file opened with shlkfs_open.
+ */
+struct shlkfs_file
+{
+    bool used; // true if the file descriptor is in use
+    struct CryptFS_Entry_ID entry_id; // The entry of the file
+    size_t offset; // Current offset (shlkfs_read/shlkfs_write)
+    bool readable; // Whether the file is open for reading
+    bool writable; // Whether the file is open for writing
+    bool append; // Whether the writes go to the end of the file
+};
+
+struct shlkfs
+{
+    struct shlkfs_ctx *ctx; // The context of the volume
+    struct shlkfs_file *files; // The files, indexed by file descriptor
+    size_t nb_files; // Number of file descriptors allocated
+};
+
+/**
+ * @brief Set errno and return -1.
+ *
+ * @param err The error number.
+ * @return -1.
+ */
+static int __fail(int err)
+{
+    errno = err;
+    return -1;
+}
+
+/**
+ * @brief Check if a pointer returned by the entries functions is an error
+ * code (e.g. ENTRY_NO_SUCH).
+ *
+ * @param ptr The pointer.
+ * @return true if the pointer is an error code, false otherwise.
+ */
+static bool __is_error(const void *ptr)
+{
+    return (ssize_t)ptr < 0;
+}
+
+/**
+ * @brief Set errno from an error code of the entries functions, and return
+ * -1.
+ *
+ * @param code The error code (ENTRY_NO_SUCH, ENTRY_EXISTS, BLOCK_ERROR...).
+ * @return -1.
+ */
+static int __fail_entry(ssize_t code)
+{
+    switch (code)
+    {
+    case ENTRY_NO_SUCH:
+        return __fail(ENOENT);
+    case ENTRY_EXISTS:
+        return __fail(EEXIST);
+    default:
+        return __fail(EIO);
+    }
+}
+
+/**
+ * @brief Fill the attributes of an entry. The scope of the volume must be
+ * entered.
+ *
+ * @param fs The volume.
+ * @param entry_id The ID of the entry (its inode number).
+ * @param entry The entry.
+ * @param st The attributes to fill.
+ */
+static void __entry_stat(struct shlkfs *fs, struct CryptFS_Entry_ID entry_id,
+                         const struct CryptFS_Entry *entry, struct stat *st)
+{
+    memset(st, 0, sizeof(struct stat));
+
+    // The same entry can be identified by several IDs (see
+    // goto_entry_in_directory): its inode number comes from the real one
+    goto_entry_in_directory(fs->ctx, &entry_id);
+    st->st_ino = entry_id.directory_block * NB_ENTRIES_PER_BLOCK
+        + entry_id.directory_index + 1;
+    if (entry->type == ENTRY_TYPE_DIRECTORY)
+        st->st_mode = S_IFDIR | entry->mode;
+    else if (entry->type == ENTRY_TYPE_SYMLINK)
+        st->st_mode = S_IFLNK | entry->mode;
+    else
+        st->st_mode = S_IFREG | entry->mode;
+
+    st->st_nlink = 1;
+    st->st_uid = entry->uid;
+    st->st_gid = entry->gid;
+    st->st_size = entry->size;
+    st->st_blksize = get_block_size();
+    st->st_blocks = (entry->size + 511) / 512;
+    st->st_atime = entry->atime;
+    st->st_mtime = entry->mtime;
+    st->st_ctime = entry->ctime;
+}
+
+/**
+ * @brief Get an opened file of a volume. The scope of the volume must be
+ * entered.
+ *
+ * @param fs The volume.
+ * @param fd The file descriptor.
+ * @return struct shlkfs_file* The file, NULL (errno set to EBADF) if the file
+ * descriptor is not opened.
+ */
+static struct shlkfs_file *__file(struct shlkfs *fs, int fd)
+{
+    if (fd < 0 || (size_t)fd >= fs->nb_files || !fs->files[fd].used)
+    {
+        errno = EBADF;
+        return NULL;
+    }
+    return &fs->files[fd];
+}
+
+/**
+ * @brief Allocate a file descriptor (the lowest one available). The scope of
+ * the volume must be entered.
+ *
+ * @param fs The volume.
+ * @return The file descriptor.
+ */
+static int __alloc_fd(struct shlkfs *fs)
+{
+    for (size_t i = 0; i < fs->nb_files; i++)
+        if (!fs->files[i].used)
+            return i;
+
+    size_t nb_files = fs->nb_files ? fs->nb_files * 2 : 16;
+    fs->files = xrealloc(fs->files, nb_files, sizeof(struct shlkfs_file));
+    memset(fs->files + fs->nb_files, 0,
+           (nb_files - fs->nb_files) * sizeof(struct shlkfs_file));
+
+    int fd = fs->nb_files;
+    fs->nb_files = nb_files;
+    return fd;
+}
+
+struct shlkfs *shlkfs_mount(const char *device_path,
+                            const char *private_key_path,
+                            const char *passphrase)
+{
+    if (!is_already_formatted(device_path))
+    {
+        errno = ENODEV;
+        return NULL;
+    }
+
+    // The running agent (if any) may already know the master key
+    unsigned char *aes_key = agent_extract_aes_key(device_path, NULL);
+    if (aes_key == NULL)
+        aes_key =
+            extract_aes_key(device_path, private_key_path, (char *)passphrase);
+    if (aes_key == NULL)
+    {
+        errno = EACCES;
+        return NULL;
+    }
+
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(device_path, aes_key);
+    memset(aes_key, 0, AES_KEY_SIZE_BYTES);
+    free(aes_key);
+    if (ctx == NULL)
+    {
+        errno = EIO;
+        return NULL;
+    }
+
+    struct shlkfs *fs = xcalloc(1, sizeof(struct shlkfs));
+    fs->ctx = ctx;
+    return fs;
+}
+
+int shlkfs_umount(struct shlkfs *fs)
+{
+    int res = shlkfs_ctx_flush(fs->ctx);
+    shlkfs_ctx_close(fs->ctx);
+    free(fs->files);
+    free(fs);
+
+    return res ? __fail(EIO) : 0;
+}
+
+int shlkfs_open(struct shlkfs *fs, const char *path, int flags, mode_t mode)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    bool readable = (flags & O_ACCMODE) != O_WRONLY;
+    bool writable = (flags & O_ACCMODE) != O_RDONLY;
+
+    struct CryptFS_Entry_ID *entry_id = NULL;
+    bool created = false;
+    if (flags & O_CREAT)
+    {
+        entry_id = create_file_by_path(fs->ctx, path);
+        if (entry_id == (void *)ENTRY_EXISTS && (flags & O_EXCL))
+            return __fail(EEXIST);
+        created = !__is_error(entry_id);
+        if (entry_id == (void *)ENTRY_EXISTS)
+            entry_id = get_entry_by_path(fs->ctx, path);
+    }
+    else
+        entry_id = get_entry_by_path(fs->ctx, path);
+    if (__is_error(entry_id))
+        return __fail_entry((ssize_t)entry_id);
+
+    struct CryptFS_Entry *entry = get_entry_from_id(fs->ctx, *entry_id);
+    if (entry == NULL)
+    {
+        free(entry_id);
+        return __fail(EIO);
+    }
+
+    int err = 0;
+    if (entry->type == ENTRY_TYPE_DIRECTORY && writable)
+        err = EISDIR;
+    else if (created)
+    {
+        entry->mode = mode & 07777;
+        if (write_entry_from_id(fs->ctx, *entry_id, entry))
+            err = EIO;
+    }
+    else if ((flags & O_TRUNC) && writable && entry->size != 0
+             && entry_truncate(fs->ctx, *entry_id, 0))
+        err = EIO;
+    free(entry);
+    if (err)
+    {
+        free(entry_id);
+        return __fail(err);
+    }
+
+    int fd = __alloc_fd(fs);
+    fs->files[fd] = (struct shlkfs_file){ .used = true,
+                                          .entry_id = *entry_id,
+                                          .offset = 0,
+                                          .readable = readable,
+                                          .writable = writable,
+                                          .append = flags & O_APPEND };
+    free(entry_id);
+    return fd;
+}
+
+int shlkfs_close(struct shlkfs *fs, int fd)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    struct shlkfs_file *file = __file(fs, fd);
+    if (file == NULL)
+        return -1;
+
+    file->used = false;
+    return 0;
+}
+
+ssize_t shlkfs_pread(struct shlkfs *fs, int fd, void *buf, size_t count,
+                     off_t offset)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    struct shlkfs_file *file = __file(fs, fd);
+    if (file == NULL)
+        return -1;
+    if (!file->readable)
+        return __fail(EBADF);
+    if (offset < 0)
+        return __fail(EINVAL);
+
+    struct CryptFS_Entry *entry = get_entry_from_id(fs->ctx, file->entry_id);
+    if (entry == NULL)
+        return __fail(EIO);
+    bool is_directory = entry->type == ENTRY_TYPE_DIRECTORY;
+    size_t size = entry->size;
+    free(entry);
+    if (is_directory)
+        return __fail(EISDIR);
+
+    // Nothing to read past the end of the file
+    if ((size_t)offset >= size || count == 0)
+        return 0;
+    if (count > size - offset)
+        count = size - offset;
+
+    ssize_t read = entry_read_raw_data(fs->ctx, file->entry_id, offset, buf,
+                                       count);
+    if (read < 0)
+        return __fail(EIO);
+    return read;
+}
+
+ssize_t shlkfs_pwrite(struct shlkfs *fs, int fd, const void *buf,
+                      size_t count, off_t offset)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    struct shlkfs_file *file = __file(fs, fd);
+    if (file == NULL)
+        return -1;
+    if (!file->writable)
+        return __fail(EBADF);
+    if (offset < 0)
+        return __fail(EINVAL);
+    if (count == 0)
+        return 0;
+
+    if (entry_write_buffer_from(fs->ctx, file->entry_id, offset, buf, count))
+        return __fail(EIO);
+    return count;
+}
+
+ssize_t shlkfs_read(struct shlkfs *fs, int fd, void *buf, size_t count)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    struct shlkfs_file *file = __file(fs, fd);
+    if (file == NULL)
+        return -1;
+
+    ssize_t read = shlkfs_pread(fs, fd, buf, count, file->offset);
+    if (read > 0)
+        file->offset += read;
+    return read;
+}
+
+ssize_t shlkfs_write(struct shlkfs *fs, int fd, const void *buf, size_t count)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    struct shlkfs_file *file = __file(fs, fd);
+    if (file == NULL)
+        return -1;
+
+    if (file->append)
+    {
+        struct CryptFS_Entry *entry =
+            get_entry_from_id(fs->ctx, file->entry_id);
+        if (entry == NULL)
+            return __fail(EIO);
+        file->offset = entry->size;
+        free(entry);
+    }
+
+    ssize_t written = shlkfs_pwrite(fs, fd, buf, count, file->offset);
+    if (written > 0)
+        file->offset += written;
+    return written;
+}
+
+off_t shlkfs_lseek(struct shlkfs *fs, int fd, off_t offset, int whence)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    struct shlkfs_file *file = __file(fs, fd);
+    if (file == NULL)
+        return -1;
+
+    off_t base = 0;
+    if (whence == SEEK_CUR)
+        base = file->offset;
+    else if (whence == SEEK_END)
+    {
+        struct CryptFS_Entry *entry =
+            get_entry_from_id(fs->ctx, file->entry_id);
+        if (entry == NULL)
+            return __fail(EIO);
+        base = entry->size;
+        free(entry);
+    }
+    else if (whence != SEEK_SET)
+        return __fail(EINVAL);
+
+    if (base + offset < 0)
+        return __fail(EINVAL);
+    file->offset = base + offset;
+    return file->offset;
+}
+
+int shlkfs_stat(struct shlkfs *fs, const char *path, struct stat *st)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(fs->ctx, path);
+    if (__is_error(entry_id))
+        return __fail_entry((ssize_t)entry_id);
+
+    struct CryptFS_Entry *entry = get_entry_from_id(fs->ctx, *entry_id);
+    if (entry == NULL)
+    {
+        free(entry_id);
+        return __fail(EIO);
+    }
+
+    __entry_stat(fs, *entry_id, entry, st);
+    free(entry);
+    free(entry_id);
+    return 0;
+}
+
+int shlkfs_fstat(struct shlkfs *fs, int fd, struct stat *st)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    struct shlkfs_file *file = __file(fs, fd);
+    if (file == NULL)
+        return -1;
+
+    struct CryptFS_Entry *entry = get_entry_from_id(fs->ctx, file->entry_id);
+    if (entry == NULL)
+        return __fail(EIO);
+
+    __entry_stat(fs, file->entry_id, entry, st);
+    free(entry);
+    return 0;
+}
+
+int shlkfs_readdir(struct shlkfs *fs, const char *path,
+                   shlkfs_readdir_cb callback, void *arg)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    struct CryptFS_Entry_ID *directory_entry_id =
+        get_entry_by_path(fs->ctx, path);
+    if (__is_error(directory_entry_id))
+        return __fail_entry((ssize_t)directory_entry_id);
+
+    struct CryptFS_Entry *directory_entry =
+        get_entry_from_id(fs->ctx, *directory_entry_id);
+    if (directory_entry == NULL)
+    {
+        free(directory_entry_id);
+        return __fail(EIO);
+    }
+    if (directory_entry->type != ENTRY_TYPE_DIRECTORY)
+    {
+        free(directory_entry);
+        free(directory_entry_id);
+        return __fail(ENOTDIR);
+    }
+
+    int res = 0;
+    for (size_t i = 0; i < directory_entry->size; i++)
+    {
+        struct CryptFS_Entry_ID *entry_id =
+            goto_used_entry_in_directory(fs->ctx, *directory_entry_id, i);
+        if (__is_error(entry_id))
+        {
+            res = __fail(EIO);
+            break;
+        }
+
+        struct CryptFS_Entry *entry = get_entry_from_id(fs->ctx, *entry_id);
+        if (entry == NULL)
+        {
+            free(entry_id);
+            res = __fail(EIO);
+            break;
+        }
+
+        struct stat st;
+        __entry_stat(fs, *entry_id, entry, &st);
+        free(entry_id);
+        int stop = callback(arg, entry->name, &st);
+        free(entry);
+        if (stop)
+            break;
+    }
+
+    free(directory_entry);
+    free(directory_entry_id);
+    return res;
+}
+
+int shlkfs_mkdir(struct shlkfs *fs, const char *path, mode_t mode)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    struct CryptFS_Entry_ID *entry_id =
+        create_directory_by_path(fs->ctx, path);
+    if (__is_error(entry_id))
+        return __fail_entry((ssize_t)entry_id);
+
+    int err = 0;
+    struct CryptFS_Entry *entry = get_entry_from_id(fs->ctx, *entry_id);
+    if (entry == NULL)
+        err = EIO;
+    else
+    {
+        entry->mode = mode & 07777;
+        if (write_entry_from_id(fs->ctx, *entry_id, entry))
+            err = EIO;
+        free(entry);
+    }
+    free(entry_id);
+
+    return err ? __fail(err) : 0;
+}
+
+int shlkfs_unlink(struct shlkfs *fs, const char *path)
+{
+    SHLKFS_CTX_SCOPE(fs->ctx);
+
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(fs->ctx, path);
+    if (__is_error(entry_id))
+        return __fail_entry((ssize_t)entry_id);
+
+    struct CryptFS_Entry *entry = get_entry_from_id(fs->ctx, *entry_id);
+    free(entry_id);
+    if (entry == NULL)
+        return __fail(EIO);
+    bool is_directory = entry->type == ENTRY_TYPE_DIRECTORY;
+    free(entry);
+    if (is_directory)
+        return __fail(EISDIR);
+
+    int res = delete_entry_by_path(fs->ctx, path);
+    if (res)
+        return __fail_entry(res);
+    return 0;
+}
@@ -0,0 +1,994 @@
+// The 64 bits variants of the functions (open64, pread64...) are interposed
+// with their own names: the redirections of _FILE_OFFSET_BITS are disabled
+#undef _FILE_OFFSET_BITS
+#define _GNU_SOURCE // RTLD_NEXT, open64, struct dirent64...
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crypto.h"
+#include "shlkfs.h"
+#include "xalloc.h"
+
+/**
+ * @brief LD_PRELOAD library serving the files of a SherlockFS volume through
+ * the libc functions, without FUSE.
+ *
+ * @details The accesses to the absolute paths starting with the prefix
+ * SHLKFS_PRELOAD_PREFIX are served by libshlkfs from the volume
+ * SHLKFS_PRELOAD_DEVICE, opened on the first access with the private key
+ * SHLKFS_PRELOAD_PRIVATE_KEY (~/.shlkfs/private.pem by default) and the
+ * passphrase SHLKFS_PRELOAD_PASSPHRASE (if the private key is encrypted).
+ * Everything else goes to the libc.
+ *
+ * A file opened in the volume is given a real file descriptor (opened on
+ * /dev/null), so that its number cannot be given to another file by the
+ * kernel: read, write, pread, pwrite, lseek, fstat, dup, dup2, dup3 and close
+ * on this file descriptor are served by libshlkfs. The paths are resolved by
+ * open, openat, stat, lstat, fstatat, statx and opendir, and the directories
+ * are read with readdir, rewinddir and closedir.
+ *
+ * @note Only the absolute paths are resolved, and the files of the volume
+ * are not kept across exec. The other functions (fcntl, mmap, fdopendir...)
+ * are not interposed: on a file of the volume, they see /dev/null.
+ */
+
+// Functions of the libc (or of the next library)
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+static int (*real_openat64)(int, const char *, int, ...);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_pread)(int, void *, size_t, off_t);
+static ssize_t (*real_pread64)(int, void *, size_t, off64_t);
+static ssize_t (*real_pwrite)(int, const void *, size_t, off_t);
+static ssize_t (*real_pwrite64)(int, const void *, size_t, off64_t);
+static off_t (*real_lseek)(int, off_t, int);
+static off64_t (*real_lseek64)(int, off64_t, int);
+static int (*real_fstat)(int, struct stat *);
+static int (*real_fstat64)(int, struct stat64 *);
+static int (*real___fxstat)(int, int, struct stat *);
+static int (*real___fxstat64)(int, int, struct stat64 *);
+static int (*real_stat)(const char *, struct stat *);
+static int (*real_stat64)(const char *, struct stat64 *);
+static int (*real_lstat)(const char *, struct stat *);
+static int (*real_lstat64)(const char *, struct stat64 *);
+static int (*real___xstat)(int, const char *, struct stat *);
+static int (*real___xstat64)(int, const char *, struct stat64 *);
+static int (*real___lxstat)(int, const char *, struct stat *);
+static int (*real___lxstat64)(int, const char *, struct stat64 *);
+static int (*real_fstatat)(int, const char *, struct stat *, int);
+static int (*real_fstatat64)(int, const char *, struct stat64 *, int);
+static int (*real_statx)(int, const char *, int, unsigned int,
+                         struct statx *);
+static int (*real_dup)(int);
+static int (*real_dup2)(int, int);
+static int (*real_dup3)(int, int, int);
+static int (*real_close)(int);
+static DIR *(*real_opendir)(const char *);
+static struct dirent *(*real_readdir)(DIR *);
+static struct dirent64 *(*real_readdir64)(DIR *);
+static void (*real_rewinddir)(DIR *);
+static int (*real_dirfd)(DIR *);
+static int (*real_closedir)(DIR *);
+
+// Resolve (once) the function of the libc with the same name
+#define RESOLVE(fn)                                                            \
+    do                                                                         \
+    {                                                                          \
+        if (real_##fn == NULL)                                                 \
+            real_##fn = dlsym(RTLD_NEXT, #fn);                                 \
+    } while (0)
+
+/**
+ * @brief A directory of the volume opened with opendir.
+ */
+struct preload_dir
+{
+    struct preload_dir *next; // Next directory opened in the volume
+    struct dirent64 *entries; // Entries of the directory (with . and ..)
+    size_t nb_entries; // Number of entries
+    size_t capacity; // Number of entries allocated
+    size_t position; // Index of the next entry returned by readdir
+    struct dirent current; // Last entry returned by readdir
+};
+
+static pthread_once_t volume_once = PTHREAD_ONCE_INIT;
+static struct shlkfs *volume = NULL; // The volume, NULL if not opened
+static int volume_errno = 0; // errno of shlkfs_mount if it failed
+
+// Table of the file descriptors of the volume and list of its directories
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static int *volume_fds = NULL; // (libshlkfs fd + 1), indexed by real fd
+static size_t nb_volume_fds = 0;
+static struct preload_dir *volume_dirs = NULL;
+
+/**
+ * @brief Get the path in the volume of a path (if it starts with the prefix).
+ * The "." and ".." components are resolved.
+ *
+ * @param path The path given to the libc function.
+ * @param volume_path The path in the volume to fill (PATH_MAX bytes).
+ * @return true if the path is in the volume, false otherwise (e.g. if a ".."
+ * component leaves the volume).
+ */
+static bool __volume_path(const char *path, char *volume_path)
+{
+    const char *prefix = getenv("SHLKFS_PRELOAD_PREFIX");
+    if (path == NULL || prefix == NULL || prefix[0] != '/')
+        return false;
+
+    // The trailing slashes of the prefix are ignored
+    size_t prefix_len = strlen(prefix);
+    while (prefix_len > 1 && prefix[prefix_len - 1] == '/')
+        prefix_len--;
+    if (strncmp(path, prefix, prefix_len) != 0)
+        return false;
+    const char *component = path + prefix_len;
+    if (component[0] != '\0' && component[0] != '/' && prefix_len != 1)
+        return false;
+
+    size_t len = 0;
+    while (*component != '\0')
+    {
+        while (*component == '/')
+            component++;
+        size_t component_len = strcspn(component, "/");
+        if (component_len == 0)
+            break;
+
+        bool is_dot = component_len == 1 && component[0] == '.';
+        bool is_dot_dot =
+            component_len == 2 && strncmp(component, "..", 2) == 0;
+        if (is_dot_dot)
+        {
+            // Parent directory (outside of the volume from its root)
+            if (len == 0)
+                return false;
+            while (volume_path[len - 1] != '/')
+                len--;
+            len--;
+        }
+        else if (!is_dot)
+        {
+            if (len + 1 + component_len >= PATH_MAX)
+                return false;
+            volume_path[len++] = '/';
+            memcpy(volume_path + len, component, component_len);
+            len += component_len;
+        }
+        component += component_len;
+    }
+
+    if (len == 0)
+        volume_path[len++] = '/';
+    volume_path[len] = '\0';
+    return true;
+}
+
+/**
+ * @brief Open the volume (called once, on the first access to the volume).
+ */
+static void __mount_volume(void)
+{
+    const char *device_path = getenv("SHLKFS_PRELOAD_DEVICE");
+    if (device_path == NULL)
+    {
+        volume_errno = ENODEV;
+        return;
+    }
+
+    char *private_key_path = NULL;
+    if (getenv("SHLKFS_PRELOAD_PRIVATE_KEY"))
+        private_key_path = strdup(getenv("SHLKFS_PRELOAD_PRIVATE_KEY"));
+    else if (getenv("HOME"))
+        get_rsa_keys_home_paths(NULL, &private_key_path);
+    if (private_key_path == NULL)
+    {
+        volume_errno = EACCES;
+        return;
+    }
+
+    volume = shlkfs_mount(device_path, private_key_path,
+                          getenv("SHLKFS_PRELOAD_PASSPHRASE"));
+    if (volume == NULL)
+        volume_errno = errno;
+    free(private_key_path);
+}
+
+/**
+ * @brief Get the volume, opened on the first call.
+ *
+ * @return struct shlkfs* The volume, NULL (errno set) if it cannot be opened.
+ */
+static struct shlkfs *__volume(void)
+{
+    pthread_once(&volume_once, __mount_volume);
+    if (volume == NULL)
+        errno = volume_errno;
+    return volume;
+}
+
+/**
+ * @brief Get the file descriptor of the volume of a real file descriptor.
+ *
+ * @param fd The real file descriptor.
+ * @return The file descriptor of the volume, -1 if the real file descriptor
+ * is not a file of the volume.
+ */
+static int __volume_fd(int fd)
+{
+    int volume_fd = -1;
+    pthread_mutex_lock(&table_lock);
+    if (fd >= 0 && (size_t)fd < nb_volume_fds)
+        volume_fd = volume_fds[fd] - 1;
+    pthread_mutex_unlock(&table_lock);
+
+    // The volume is closed at exit (see __umount_volume)
+    return volume != NULL ? volume_fd : -1;
+}
+
+/**
+ * @brief Associate a real file descriptor with a file descriptor of the
+ * volume.
+ *
+ * @param fd The real file descriptor.
+ * @param volume_fd The file descriptor of the volume, -1 to remove the
+ * association.
+ */
+static void __set_volume_fd(int fd, int volume_fd)
+{
+    pthread_mutex_lock(&table_lock);
+    if ((size_t)fd >= nb_volume_fds)
+    {
+        size_t nb_fds = nb_volume_fds ? nb_volume_fds : 64;
+        while (nb_fds <= (size_t)fd)
+            nb_fds *= 2;
+        volume_fds = xrealloc(volume_fds, nb_fds, sizeof(int));
+        memset(volume_fds + nb_volume_fds, 0,
+               (nb_fds - nb_volume_fds) * sizeof(int));
+        nb_volume_fds = nb_fds;
+    }
+    volume_fds[fd] = volume_fd + 1;
+    pthread_mutex_unlock(&table_lock);
+}
+
+/**
+ * @brief Remove the association of a real file descriptor with a file of the
+ * volume, and close the file of the volume if no other real file descriptor
+ * (see dup) is associated with it.
+ *
+ * @param fd The real file descriptor.
+ * @param volume_fd The file descriptor of the volume associated with fd.
+ * @return 0 on success, -1 on error.
+ */
+static int __release_volume_fd(int fd, int volume_fd)
+{
+    bool last = true;
+    pthread_mutex_lock(&table_lock);
+    volume_fds[fd] = 0;
+    for (size_t i = 0; i < nb_volume_fds && last; i++)
+        last = volume_fds[i] != volume_fd + 1;
+    pthread_mutex_unlock(&table_lock);
+
+    return last ? shlkfs_close(volume, volume_fd) : 0;
+}
+
+/**
+ * @brief Open a file of the volume.
+ *
+ * @param volume_path The path of the file in the volume.
+ * @param flags The flags of the opening.
+ * @param mode The permissions of the file if it is created.
+ * @return The real file descriptor, -1 on error.
+ */
+static int __open(const char *volume_path, int flags, mode_t mode)
+{
+    struct shlkfs *fs = __volume();
+    if (fs == NULL)
+        return -1;
+
+    int volume_fd = shlkfs_open(fs, volume_path, flags, mode);
+    if (volume_fd < 0)
+        return -1;
+
+    RESOLVE(open);
+    int fd = real_open("/dev/null", O_RDONLY | (flags & O_CLOEXEC));
+    if (fd < 0)
+    {
+        int err = errno;
+        shlkfs_close(fs, volume_fd);
+        errno = err;
+        return -1;
+    }
+
+    __set_volume_fd(fd, volume_fd);
+    return fd;
+}
+
+/**
+ * @brief Get the mode given to open (only present with O_CREAT).
+ */
+#define OPEN_MODE(flags, mode)                                                 \
+    do                                                                         \
+    {                                                                          \
+        if ((flags) & O_CREAT)                                                 \
+        {                                                                      \
+            va_list args;                                                      \
+            va_start(args, flags);                                             \
+            mode = va_arg(args, mode_t);                                       \
+            va_end(args);                                                      \
+        }                                                                      \
+    } while (0)
+
+int open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    OPEN_MODE(flags, mode);
+
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __open(volume_path, flags, mode);
+
+    RESOLVE(open);
+    return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    OPEN_MODE(flags, mode);
+
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __open(volume_path, flags, mode);
+
+    RESOLVE(open64);
+    return real_open64(path, flags, mode);
+}
+
+// The absolute paths do not depend on dirfd
+int openat(int dirfd, const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    OPEN_MODE(flags, mode);
+
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __open(volume_path, flags, mode);
+
+    RESOLVE(openat);
+    return real_openat(dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    OPEN_MODE(flags, mode);
+
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __open(volume_path, flags, mode);
+
+    RESOLVE(openat64);
+    return real_openat64(dirfd, path, flags, mode);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return shlkfs_read(volume, volume_fd, buf, count);
+
+    RESOLVE(read);
+    return real_read(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return shlkfs_write(volume, volume_fd, buf, count);
+
+    RESOLVE(write);
+    return real_write(fd, buf, count);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return shlkfs_pread(volume, volume_fd, buf, count, offset);
+
+    RESOLVE(pread);
+    return real_pread(fd, buf, count, offset);
+}
+
+ssize_t pread64(int fd, void *buf, size_t count, off64_t offset)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return shlkfs_pread(volume, volume_fd, buf, count, offset);
+
+    RESOLVE(pread64);
+    return real_pread64(fd, buf, count, offset);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return shlkfs_pwrite(volume, volume_fd, buf, count, offset);
+
+    RESOLVE(pwrite);
+    return real_pwrite(fd, buf, count, offset);
+}
+
+ssize_t pwrite64(int fd, const void *buf, size_t count, off64_t offset)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return shlkfs_pwrite(volume, volume_fd, buf, count, offset);
+
+    RESOLVE(pwrite64);
+    return real_pwrite64(fd, buf, count, offset);
+}
+
+off_t lseek(int fd, off_t offset, int whence)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return shlkfs_lseek(volume, volume_fd, offset, whence);
+
+    RESOLVE(lseek);
+    return real_lseek(fd, offset, whence);
+}
+
+off64_t lseek64(int fd, off64_t offset, int whence)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return shlkfs_lseek(volume, volume_fd, offset, whence);
+
+    RESOLVE(lseek64);
+    return real_lseek64(fd, offset, whence);
+}
+
+/**
+ * @brief Fill a struct stat64 from a struct stat.
+ *
+ * @param st The attributes.
+ * @param st64 The attributes to fill.
+ */
+static void __stat64(const struct stat *st, struct stat64 *st64)
+{
+    memset(st64, 0, sizeof(struct stat64));
+    st64->st_ino = st->st_ino;
+    st64->st_mode = st->st_mode;
+    st64->st_nlink = st->st_nlink;
+    st64->st_uid = st->st_uid;
+    st64->st_gid = st->st_gid;
+    st64->st_size = st->st_size;
+    st64->st_blksize = st->st_blksize;
+    st64->st_blocks = st->st_blocks;
+    st64->st_atime = st->st_atime;
+    st64->st_mtime = st->st_mtime;
+    st64->st_ctime = st->st_ctime;
+}
+
+/**
+ * @brief Get the attributes of a file of the volume.
+ *
+ * @param volume_fd The file descriptor of the volume.
+ * @param st The attributes to fill (NULL if st64 is used).
+ * @param st64 The attributes to fill (NULL if st is used).
+ * @return 0 on success, -1 on error.
+ */
+static int __fstat(int volume_fd, struct stat *st, struct stat64 *st64)
+{
+    struct stat volume_st;
+    if (shlkfs_fstat(volume, volume_fd, &volume_st))
+        return -1;
+
+    if (st != NULL)
+        *st = volume_st;
+    else
+        __stat64(&volume_st, st64);
+    return 0;
+}
+
+int fstat(int fd, struct stat *st)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return __fstat(volume_fd, st, NULL);
+
+    RESOLVE(fstat);
+    return real_fstat(fd, st);
+}
+
+int fstat64(int fd, struct stat64 *st)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return __fstat(volume_fd, NULL, st);
+
+    RESOLVE(fstat64);
+    return real_fstat64(fd, st);
+}
+
+// Entry points of fstat for the programs linked with a libc older than 2.33
+int __fxstat(int ver, int fd, struct stat *st);
+int __fxstat64(int ver, int fd, struct stat64 *st);
+
+int __fxstat(int ver, int fd, struct stat *st)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return __fstat(volume_fd, st, NULL);
+
+    RESOLVE(__fxstat);
+    return real___fxstat(ver, fd, st);
+}
+
+int __fxstat64(int ver, int fd, struct stat64 *st)
+{
+    int volume_fd = __volume_fd(fd);
+    if (volume_fd >= 0)
+        return __fstat(volume_fd, NULL, st);
+
+    RESOLVE(__fxstat64);
+    return real___fxstat64(ver, fd, st);
+}
+
+/**
+ * @brief Get the attributes of an entry of the volume.
+ *
+ * @param volume_path The path of the entry in the volume.
+ * @param st The attributes to fill (NULL if st64 is used).
+ * @param st64 The attributes to fill (NULL if st is used).
+ * @return 0 on success, -1 on error.
+ */
+static int __stat(const char *volume_path, struct stat *st,
+                  struct stat64 *st64)
+{
+    struct shlkfs *fs = __volume();
+    if (fs == NULL)
+        return -1;
+
+    struct stat volume_st;
+    if (shlkfs_stat(fs, volume_path, &volume_st))
+        return -1;
+
+    if (st != NULL)
+        *st = volume_st;
+    else
+        __stat64(&volume_st, st64);
+    return 0;
+}
+
+int stat(const char *path, struct stat *st)
+{
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __stat(volume_path, st, NULL);
+
+    RESOLVE(stat);
+    return real_stat(path, st);
+}
+
+int stat64(const char *path, struct stat64 *st)
+{
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __stat(volume_path, NULL, st);
+
+    RESOLVE(stat64);
+    return real_stat64(path, st);
+}
+
+// The symbolic links of the volume are not followed by shlkfs_stat
+int lstat(const char *path, struct stat *st)
+{
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __stat(volume_path, st, NULL);
+
+    RESOLVE(lstat);
+    return real_lstat(path, st);
+}
+
+int lstat64(const char *path, struct stat64 *st)
+{
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __stat(volume_path, NULL, st);
+
+    RESOLVE(lstat64);
+    return real_lstat64(path, st);
+}
+
+// Entry points of stat and lstat for the programs linked with a libc older
+// than 2.33
+int __xstat(int ver, const char *path, struct stat *st);
+int __xstat64(int ver, const char *path, struct stat64 *st);
+int __lxstat(int ver, const char *path, struct stat *st);
+int __lxstat64(int ver, const char *path, struct stat64 *st);
+
+int __xstat(int ver, const char *path, struct stat *st)
+{
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __stat(volume_path, st, NULL);
+
+    RESOLVE(__xstat);
+    return real___xstat(ver, path, st);
+}
+
+int __xstat64(int ver, const char *path, struct stat64 *st)
+{
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __stat(volume_path, NULL, st);
+
+    RESOLVE(__xstat64);
+    return real___xstat64(ver, path, st);
+}
+
+int __lxstat(int ver, const char *path, struct stat *st)
+{
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __stat(volume_path, st, NULL);
+
+    RESOLVE(__lxstat);
+    return real___lxstat(ver, path, st);
+}
+
+int __lxstat64(int ver, const char *path, struct stat64 *st)
+{
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __stat(volume_path, NULL, st);
+
+    RESOLVE(__lxstat64);
+    return real___lxstat64(ver, path, st);
+}
+
+/**
+ * @brief Get the attributes of an entry of the volume given to a *at
+ * function: an absolute path of the volume, or an empty path with
+ * AT_EMPTY_PATH and a file descriptor of the volume.
+ *
+ * @param dirfd The file descriptor given to the function.
+ * @param path The path given to the function.
+ * @param flags The flags given to the function.
+ * @param st The attributes to fill (NULL if st64 is used).
+ * @param st64 The attributes to fill (NULL if st is used).
+ * @return 0 on success, -1 on error, 1 if the entry is not in the volume.
+ */
+static int __statat(int dirfd, const char *path, int flags, struct stat *st,
+                    struct stat64 *st64)
+{
+    char volume_path[PATH_MAX];
+    if (__volume_path(path, volume_path))
+        return __stat(volume_path, st, st64);
+
+    int volume_fd = __volume_fd(dirfd);
+    if (path[0] == '\0' && (flags & AT_EMPTY_PATH) && volume_fd >= 0)
+        return __fstat(volume_fd, st, st64);
+    return 1;
+}
+
+int fstatat(int dirfd, const char *path, struct stat *st, int flags)
+{
+    int res = __statat(dirfd, path, flags, st, NULL);
+    if (res <= 0)
+        return res;
+
+    RESOLVE(fstatat);
+    return real_fstatat(dirfd, path, st, flags);
+}
+
+int fstatat64(int dirfd, const char *path, struct stat64 *st, int flags)
+{
+    int res = __statat(dirfd, path, flags, NULL, st);
+    if (res <= 0)
+        return res;
+
+    RESOLVE(fstatat64);
+    return real_fstatat64(dirfd, path, st, flags);
+}
+
+/**
+ * @brief Convert a struct statx timestamp from seconds.
+ */
+static struct statx_timestamp __statx_timestamp(time_t seconds)
+{
+    return (struct statx_timestamp){ .tv_sec = seconds };
+}
+
+int statx(int dirfd, const char *path, int flags, unsigned int mask,
+          struct statx *stx)
+{
+    struct stat st;
+    int res = __statat(dirfd, path, flags, &st, NULL);
+    if (res > 0)
+    {
+        RESOLVE(statx);
+        return real_statx(dirfd, path, flags, mask, stx);
+    }
+    if (res < 0)
+        return res;
+
+    memset(stx, 0, sizeof(struct statx));
+    stx->stx_mask = STATX_BASIC_STATS;
+    stx->stx_ino = st.st_ino;
+    stx->stx_mode = st.st_mode;
+    stx->stx_nlink = st.st_nlink;
+    stx->stx_uid = st.st_uid;
+    stx->stx_gid = st.st_gid;
+    stx->stx_size = st.st_size;
+    stx->stx_blksize = st.st_blksize;
+    stx->stx_blocks = st.st_blocks;
+    stx->stx_atime = __statx_timestamp(st.st_atime);
+    stx->stx_mtime = __statx_timestamp(st.st_mtime);
+    stx->stx_ctime = __statx_timestamp(st.st_ctime);
+    return 0;
+}
+
+/**
+ * @brief Associate a duplicated real file descriptor with the file of the
+ * volume of the original one (the files share their offset, as with the
+ * libc).
+ *
+ * @param oldfd The original real file descriptor.
+ * @param newfd The duplicated real file descriptor (-1 if the duplication
+ * failed).
+ * @return newfd.
+ */
+static int __dup_volume_fd(int oldfd, int newfd)
+{
+    int volume_fd = __volume_fd(oldfd);
+    if (newfd >= 0 && volume_fd >= 0)
+        __set_volume_fd(newfd, volume_fd);
+    return newfd;
+}
+
+int dup(int oldfd)
+{
+    RESOLVE(dup);
+    return __dup_volume_fd(oldfd, real_dup(oldfd));
+}
+
+int dup2(int oldfd, int newfd)
+{
+    // newfd is closed first (if it is not oldfd)
+    int volume_fd = __volume_fd(newfd);
+    if (volume_fd >= 0 && oldfd != newfd && __volume_fd(oldfd) != volume_fd)
+        __release_volume_fd(newfd, volume_fd);
+
+    RESOLVE(dup2);
+    return __dup_volume_fd(oldfd, real_dup2(oldfd, newfd));
+}
+
+int dup3(int oldfd, int newfd, int flags)
+{
+    int volume_fd = __volume_fd(newfd);
+    if (volume_fd >= 0 && oldfd != newfd && __volume_fd(oldfd) != volume_fd)
+        __release_volume_fd(newfd, volume_fd);
+
+    RESOLVE(dup3);
+    return __dup_volume_fd(oldfd, real_dup3(oldfd, newfd, flags));
+}
+
+int close(int fd)
+{
+    int volume_fd = __volume_fd(fd);
+    RESOLVE(close);
+    if (volume_fd < 0)
+        return real_close(fd);
+
+    int res = __release_volume_fd(fd, volume_fd);
+    real_close(fd);
+    return res;
+}
+
+/**
+ * @brief Add an entry to a directory opened with opendir.
+ *
+ * @param dir The directory.
+ * @param name The name of the entry.
+ * @param st The attributes of the entry.
+ */
+static void __dir_add(struct preload_dir *dir, const char *name,
+                      const struct stat *st)
+{
+    if (dir->nb_entries == dir->capacity)
+    {
+        dir->capacity = dir->capacity ? dir->capacity * 2 : 16;
+        dir->entries =
+            xrealloc(dir->entries, dir->capacity, sizeof(struct dirent64));
+    }
+
+    struct dirent64 *entry = &dir->entries[dir->nb_entries];
+    memset(entry, 0, sizeof(struct dirent64));
+    entry->d_ino = st->st_ino;
+    entry->d_off = dir->nb_entries + 1;
+    entry->d_reclen = sizeof(struct dirent64);
+    entry->d_type = IFTODT(st->st_mode);
+    strncpy(entry->d_name, name, sizeof(entry->d_name) - 1);
+    dir->nb_entries++;
+}
+
+/**
+ * @brief Callback of shlkfs_readdir, adding the entries to a preload_dir.
+ */
+static int __dir_fill(void *arg, const char *name, const struct stat *st)
+{
+    __dir_add(arg, name, st);
+    return 0;
+}
+
+/**
+ * @brief Check if a directory was opened in the volume, and remove it from
+ * the list of the directories of the volume.
+ *
+ * @param dirp The directory.
+ * @param remove true to remove the directory from the list.
+ * @return struct preload_dir* The directory of the volume, NULL if the
+ * directory was opened by the libc.
+ */
+static struct preload_dir *__volume_dir(DIR *dirp, bool remove)
+{
+    pthread_mutex_lock(&table_lock);
+    struct preload_dir **dir = &volume_dirs;
+    while (*dir != NULL && *dir != (struct preload_dir *)dirp)
+        dir = &(*dir)->next;
+
+    struct preload_dir *found = *dir;
+    if (found != NULL && remove)
+        *dir = found->next;
+    pthread_mutex_unlock(&table_lock);
+    return found;
+}
+
+DIR *opendir(const char *path)
+{
+    char volume_path[PATH_MAX];
+    if (!__volume_path(path, volume_path))
+    {
+        RESOLVE(opendir);
+        return real_opendir(path);
+    }
+
+    struct shlkfs *fs = __volume();
+    if (fs == NULL)
+        return NULL;
+
+    struct stat st;
+    if (shlkfs_stat(fs, volume_path, &st))
+        return NULL;
+
+    struct preload_dir *dir = xcalloc(1, sizeof(struct preload_dir));
+    __dir_add(dir, ".", &st);
+    __dir_add(dir, "..", &st);
+    if (shlkfs_readdir(fs, volume_path, __dir_fill, dir))
+    {
+        int err = errno;
+        free(dir->entries);
+        free(dir);
+        errno = err;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&table_lock);
+    dir->next = volume_dirs;
+    volume_dirs = dir;
+    pthread_mutex_unlock(&table_lock);
+    return (DIR *)dir;
+}
+
+struct dirent64 *readdir64(DIR *dirp)
+{
+    struct preload_dir *dir = __volume_dir(dirp, false);
+    if (dir == NULL)
+    {
+        RESOLVE(readdir64);
+        return real_readdir64(dirp);
+    }
+
+    if (dir->position == dir->nb_entries)
+        return NULL;
+    return &dir->entries[dir->position++];
+}
+
+struct dirent *readdir(DIR *dirp)
+{
+    struct preload_dir *dir = __volume_dir(dirp, false);
+    if (dir == NULL)
+    {
+        RESOLVE(readdir);
+        return real_readdir(dirp);
+    }
+
+    struct dirent64 *entry = readdir64(dirp);
+    if (entry == NULL)
+        return NULL;
+
+    memset(&dir->current, 0, sizeof(struct dirent));
+    dir->current.d_ino = entry->d_ino;
+    dir->current.d_off = entry->d_off;
+    dir->current.d_reclen = sizeof(struct dirent);
+    dir->current.d_type = entry->d_type;
+    memcpy(dir->current.d_name, entry->d_name, sizeof(dir->current.d_name));
+    return &dir->current;
+}
+
+void rewinddir(DIR *dirp)
+{
+    struct preload_dir *dir = __volume_dir(dirp, false);
+    if (dir == NULL)
+    {
+        RESOLVE(rewinddir);
+        real_rewinddir(dirp);
+        return;
+    }
+
+    dir->position = 0;
+}
+
+int dirfd(DIR *dirp)
+{
+    struct preload_dir *dir = __volume_dir(dirp, false);
+    if (dir == NULL)
+    {
+        RESOLVE(dirfd);
+        return real_dirfd(dirp);
+    }
+
+    // The directories of the volume have no file descriptor
+    errno = ENOTSUP;
+    return -1;
+}
+
+int closedir(DIR *dirp)
+{
+    struct preload_dir *dir = __volume_dir(dirp, true);
+    if (dir == NULL)
+    {
+        RESOLVE(closedir);
+        return real_closedir(dirp);
+    }
+
+    free(dir->entries);
+    free(dir);
+    return 0;
+}
+
+/**
+ * @brief Close the volume (if it was opened) when the program exits, so that
+ * its blocks are made durable on the device.
+ */
+__attribute__((destructor)) static void __umount_volume(void)
+{
+    struct shlkfs *fs = volume;
+    if (fs == NULL)
+        return;
+
+    // The files still opened are then served by the libc (/dev/null)
+    volume = NULL;
+    shlkfs_umount(fs);
+}
@@ -0,0 +1,139 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "agent.h"
+#include "cryptfs.h"
+#include "crypto.h"
+
+/**
+ * @brief Print the usage of the program.
+ *
+ * @param program_name The name of the program.
+ * @return int EXIT_FAILURE.
+ */
+static int __usage(const char *program_name)
+{
+    printf("SherlockFS v%d - Caching the master keys of devices\n",
+           CRYPTFS_VERSION);
+    printf("\tUsage: %s [-D] [-a <socket path>]\n", program_name);
+    printf("\t       %s add [-k <private key path>] <device>...\n",
+           program_name);
+    printf("\t       %s clear\n", program_name);
+    printf("\t'-D' runs the agent in the foreground\n");
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief Start an agent, and print the shell commands to use it.
+ *
+ * @param socket_path The path of the socket (NULL for a new temporary one).
+ * @param foreground true to run the agent in the foreground.
+ * @return int EXIT_SUCCESS or EXIT_FAILURE.
+ */
+static int __start(const char *socket_path, bool foreground)
+{
+    char directory[] = "/tmp/shlkfs-XXXXXX";
+    char path[PATH_MAX];
+    if (socket_path == NULL)
+    {
+        if (mkdtemp(directory) == NULL)
+        {
+            perror("mkdtemp");
+            return EXIT_FAILURE;
+        }
+        snprintf(path, sizeof(path), "%s/agent.sock", directory);
+        socket_path = path;
+    }
+
+    int fd = agent_listen(socket_path);
+    if (fd == -1)
+        return EXIT_FAILURE;
+
+    pid_t pid = foreground ? getpid() : fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (pid != 0)
+    {
+        printf("%s=%s; export %s;\n", AGENT_SOCKET_ENV, socket_path,
+               AGENT_SOCKET_ENV);
+        printf("echo Agent pid %d;\n", (int)pid);
+        fflush(stdout);
+        if (!foreground)
+            return EXIT_SUCCESS;
+    }
+    else
+    {
+        // The agent is detached from the terminal (and from the shell
+        // evaluating its output)
+        setsid();
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd != -1)
+        {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            if (null_fd > STDERR_FILENO)
+                close(null_fd);
+        }
+    }
+
+    int ret = agent_serve(fd, socket_path);
+    if (socket_path == path)
+        rmdir(directory);
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *program_name = argv[0];
+
+    // add [-k <private key path>] <device>...
+    if (argc > 2 && strcmp(argv[1], "add") == 0)
+    {
+        char *private_key_path = NULL;
+        int first_device = 2;
+        if (strcmp(argv[2], "-k") == 0 || strcmp(argv[2], "--key") == 0)
+        {
+            if (argc < 5)
+                return __usage(program_name);
+            private_key_path = argv[3];
+            first_device = 4;
+        }
+        else
+            get_rsa_keys_home_paths(NULL, &private_key_path);
+
+        int ret = cryptfs_agent_add((const char *const *)argv + first_device,
+                                    argc - first_device, private_key_path);
+
+        if (first_device == 2) // if `private_key_path` was malloced
+            free(private_key_path);
+        return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // clear
+    if (argc == 2 && strcmp(argv[1], "clear") == 0)
+        return agent_clear() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // [-D] [-a <socket path>]
+    bool foreground = false;
+    const char *socket_path = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-D") == 0)
+            foreground = true;
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+            socket_path = argv[++i];
+        else
+            return __usage(program_name);
+    }
+
+    return __start(socket_path, foreground);
+}
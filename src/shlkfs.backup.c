@@ -0,0 +1,43 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backup.h"
+#include "cryptfs.h"
+
+int main(int argc, char *argv[])
+{
+    const char *program_name = argv[0];
+    bool incremental = false;
+    bool restore = false;
+
+    // if '--incremental' or '--restore' option is provided
+    if (argc > 1 && strcmp(argv[1], "--incremental") == 0)
+        incremental = true;
+    else if (argc > 1 && strcmp(argv[1], "--restore") == 0)
+        restore = true;
+    if (incremental || restore)
+    {
+        argv++; // skip the option
+        argc--; // sub the option
+    }
+
+    if (argc != 3)
+    {
+        printf("SherlockFS v%d - Backing up the blocks of a device\n",
+               CRYPTFS_VERSION);
+        printf("\tUsage: %s [--incremental] <device> <backup file>\n",
+               program_name);
+        printf("\t       %s --restore <device> <backup file>\n",
+               program_name);
+        printf("\t'--incremental' only copies the blocks written since the "
+               "previous backup\n");
+        return EXIT_FAILURE;
+    }
+
+    int ret = restore ? cryptfs_restore(argv[1], argv[2])
+                      : cryptfs_backup(argv[1], argv[2], incremental);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,48 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cryptfs.h"
+#include "crypto.h"
+#include "defrag.h"
+
+int main(int argc, char *argv[])
+{
+    const char *program_name = argv[0];
+    bool dry_run = false;
+    char *private_key_path = NULL;
+
+    // if '-n' or '--dry-run' option is provided
+    if (argc > 1
+        && (strcmp(argv[1], "-n") == 0 || strcmp(argv[1], "--dry-run") == 0))
+    {
+        dry_run = true;
+        argv++; // skip the option
+        argc--; // sub the option
+    }
+
+    switch (argc)
+    {
+    case 2: // <device>
+        get_rsa_keys_home_paths(NULL, &private_key_path);
+        break;
+    case 3: // <device> <private key>
+        private_key_path = argv[2];
+        break;
+    default:
+        printf("SherlockFS v%d - Defragmenting the files of a device\n",
+               CRYPTFS_VERSION);
+        printf("\tUsage: %s [-n|--dry-run] <device> [private key path]\n",
+               program_name);
+        printf("\t'--dry-run' only prints the fragmentation statistics\n");
+        return EXIT_FAILURE;
+    }
+
+    int ret = cryptfs_defrag(argv[1], private_key_path, dry_run);
+
+    if (argc == 2) // if `private_key_path` was malloced
+        free(private_key_path);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cryptfs.h"
+#include "crypto.h"
+#include "export.h"
+
+int main(int argc, char *argv[])
+{
+    char *device_path = NULL;
+    char *volume_path = NULL;
+    char *destination_path = NULL;
+    char *private_key_path = NULL;
+
+    switch (argc)
+    {
+    case 4: // <device> <volume path> <destination directory|->
+        device_path = argv[1];
+        volume_path = argv[2];
+        destination_path = argv[3];
+        get_rsa_keys_home_paths(NULL, &private_key_path);
+        break;
+    case 5: // <device> <volume path> <destination directory|-> <private key>
+        device_path = argv[1];
+        volume_path = argv[2];
+        destination_path = argv[3];
+        private_key_path = argv[4];
+        break;
+    default:
+        printf("SherlockFS v%d - Exporting a directory tree from a device\n",
+               CRYPTFS_VERSION);
+        printf("\tUsage: %s <device> <volume path> <destination "
+               "directory|-> [private key path]\n",
+               argv[0]);
+        printf("\t'-' writes a tar archive to the standard output\n");
+        return EXIT_FAILURE;
+    }
+
+    int ret = cryptfs_export(device_path, volume_path, destination_path,
+                             private_key_path);
+
+    if (argc == 4) // if `private_key_path` was malloced
+        free(private_key_path);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
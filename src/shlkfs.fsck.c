@@ -0,0 +1,49 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cryptfs.h"
+#include "crypto.h"
+#include "fsck.h"
+
+int main(int argc, char *argv[])
+{
+    const char *program_name = argv[0];
+    bool repair = false;
+    char *private_key_path = NULL;
+
+    // if '-r' or '--repair' option is provided
+    if (argc > 1
+        && (strcmp(argv[1], "-r") == 0 || strcmp(argv[1], "--repair") == 0))
+    {
+        repair = true;
+        argv++; // skip the option
+        argc--; // sub the option
+    }
+
+    switch (argc)
+    {
+    case 2: // <device>
+        get_rsa_keys_home_paths(NULL, &private_key_path);
+        break;
+    case 3: // <device> <private key>
+        private_key_path = argv[2];
+        break;
+    default:
+        printf("SherlockFS v%d - Checking the consistency of a device\n",
+               CRYPTFS_VERSION);
+        printf("\tUsage: %s [-r|--repair] <device> [private key path]\n",
+               program_name);
+        printf("\t'--repair' fixes the errors found (the exit codes are the "
+               "ones of fsck(8))\n");
+        return FSCK_FAILURE;
+    }
+
+    int ret = cryptfs_fsck(argv[1], private_key_path, repair);
+
+    if (argc == 2) // if `private_key_path` was malloced
+        free(private_key_path);
+
+    return ret;
+}
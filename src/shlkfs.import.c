@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cryptfs.h"
+#include "crypto.h"
+#include "import.h"
+
+int main(int argc, char *argv[])
+{
+    char *device_path = NULL;
+    char *source_path = NULL;
+    char *private_key_path = NULL;
+
+    switch (argc)
+    {
+    case 3: // <device> <source directory|->
+        device_path = argv[1];
+        source_path = argv[2];
+        get_rsa_keys_home_paths(NULL, &private_key_path);
+        break;
+    case 4: // <device> <source directory|-> <private key path>
+        device_path = argv[1];
+        source_path = argv[2];
+        private_key_path = argv[3];
+        break;
+    default:
+        printf("SherlockFS v%d - Importing a directory tree to a device\n",
+               CRYPTFS_VERSION);
+        printf("\tUsage: %s <device> <source directory|-> [private key "
+               "path]\n",
+               argv[0]);
+        printf("\t'-' reads a tar archive from the standard input\n");
+        return EXIT_FAILURE;
+    }
+
+    int ret = cryptfs_import(device_path, source_path, private_key_path);
+
+    if (argc == 3) // if `private_key_path` was malloced
+        free(private_key_path);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
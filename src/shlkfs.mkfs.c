@@ -3,7 +3,10 @@
 #include <openssl/pem.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "block.h"
+#include "block_cipher.h"
 #include "crypto.h"
 #include "format.h"
 #include "io.h"
@@ -26,12 +29,66 @@ static void ask_new_password(char **passphrase)
         *passphrase = ask_user_passphrase(true);
 }
 
+/**
+ * @brief Parse a block size given in bytes, or in KiB with a 'K' suffix.
+ *
+ * @param arg The block size argument (e.g. "65536" or "64K").
+ * @return size_t The block size in bytes, 0 if the argument is invalid.
+ */
+static size_t parse_block_size(const char *arg)
+{
+    char *end = NULL;
+    size_t block_size = strtoul(arg, &end, 10);
+    if (end == arg)
+        return 0;
+    if (*end == 'K' || *end == 'k')
+    {
+        block_size *= 1024;
+        end++;
+    }
+    return *end == '\0' ? block_size : 0;
+}
+
 int main(int argc, char *argv[])
 {
     char *passphrase = NULL;
     char *path = NULL;
     char *label = NULL;
     EVP_PKEY *existing_rsa_keypair = NULL;
+    const char *program_name = argv[0];
+
+    while (argc > 2)
+    {
+        // if '-b' option is provided, format with the given block size
+        if (strcmp(argv[1], "-b") == 0 || strcmp(argv[1], "--block-size") == 0)
+        {
+            size_t block_size = parse_block_size(argv[2]);
+            if (!is_block_size_supported(block_size))
+                error_exit("The block size '%s' is not supported (power of "
+                           "two between %d and %d bytes expected)\n",
+                           EXIT_FAILURE, argv[2], CRYPTFS_BLOCK_SIZE_BYTES,
+                           CRYPTFS_BLOCK_SIZE_MAX_BYTES);
+            set_block_size(block_size);
+        }
+        // if '-c' option is provided, encrypt the blocks with the given cipher
+        else if (strcmp(argv[1], "-c") == 0
+                 || strcmp(argv[1], "--cipher") == 0)
+        {
+            enum cryptfs_cipher cipher = CRYPTFS_CIPHER_AES_256_CBC;
+            // ChaCha20 reuses the keystream of a rewritten block: it only
+            // opens the volumes already formatted with it
+            if (block_cipher_find(argv[2], &cipher)
+                || cipher == CRYPTFS_CIPHER_CHACHA20)
+                error_exit("The cipher '%s' is not supported (aes-256-cbc or "
+                           "aes-256-xts expected)\n",
+                           EXIT_FAILURE, argv[2]);
+            set_block_cipher(cipher);
+        }
+        else
+            break;
+        argv += 2; // skip the option and its value
+        argc -= 2; // sub the option and its value
+    }
 
     switch (argc)
     {
@@ -44,7 +101,10 @@ int main(int argc, char *argv[])
         break;
     default:
         printf("SherlockFS v%d - Format a device\n", CRYPTFS_VERSION);
-        printf("\tUsage: %s <device> [label]\n", argv[0]);
+        printf("\tUsage: %s [-b|--block-size <BLOCK SIZE>] "
+               "[-c|--cipher <CIPHER>] <device> [label]\n",
+               program_name);
+        printf("\tCiphers: aes-256-cbc (default), aes-256-xts\n");
         return EXIT_FAILURE;
     }
 
@@ -67,7 +67,22 @@ static struct fuse_operations ops = {
 #define IS_USING_V_ARG(argv)                                                   \
     (strcmp(*(argv), "-v") == 0 || strcmp(*(argv), "--verbose") == 0)
 
-#define IS_USING_SHLK_ARG(argv) (IS_USING_K_ARG(argv) || IS_USING_V_ARG(argv))
+#define IS_USING_D_ARG(argv)                                                   \
+    (strcmp(*(argv), "-d") == 0 || strcmp(*(argv), "--discard") == 0)
+
+#define IS_USING_U_ARG(argv)                                                   \
+    (strcmp(*(argv), "-u") == 0 || strcmp(*(argv), "--io-uring") == 0)
+
+#define IS_USING_DIRECT_ARG(argv)                                              \
+    (strcmp(*(argv), "-D") == 0 || strcmp(*(argv), "--direct-io") == 0)
+
+#define IS_USING_M_ARG(argv)                                                   \
+    (strcmp(*(argv), "-m") == 0 || strcmp(*(argv), "--mmap") == 0)
+
+#define IS_USING_SHLK_ARG(argv)                                                \
+    (IS_USING_K_ARG(argv) || IS_USING_V_ARG(argv) || IS_USING_D_ARG(argv)      \
+     || IS_USING_U_ARG(argv) || IS_USING_DIRECT_ARG(argv)                      \
+     || IS_USING_M_ARG(argv))
 
 int main(int argc, char *argv[])
 {
@@ -76,8 +91,8 @@ int main(int argc, char *argv[])
         printf("SherlockFS v%d - Mounting a SherlockFS file system\n",
                CRYPTFS_VERSION);
         printf("\tUsage: %s [-k|--key <PRIVATE KEY PATH>] [-v|--verbose] "
-               "<DEVICE> [FUSE "
-               "OPTIONS] <MOUNTPOINT>\n",
+               "[-d|--discard] [-u|--io-uring] [-D|--direct-io] [-m|--mmap] "
+               "<DEVICE> [FUSE OPTIONS] <MOUNTPOINT>\n",
                argv[0]);
         return EXIT_FAILURE;
     }
@@ -106,8 +121,43 @@ int main(int argc, char *argv[])
             argv += 1; // skip '-v' or '--debug'
             argc -= 1; // sub '-v' or '--debug'
         }
+        // if '-d' or '--discard' option is provided, discard freed blocks
+        else if (IS_USING_D_ARG(argv))
+        {
+            set_discard_mode(true);
+            argv += 1; // skip '-d' or '--discard'
+            argc -= 1; // sub '-d' or '--discard'
+        }
+        // if '-u' or '--io-uring' option is provided, access the device
+        // through io_uring
+        else if (IS_USING_U_ARG(argv))
+        {
+            set_io_uring_mode(true);
+            argv += 1; // skip '-u' or '--io-uring'
+            argc -= 1; // sub '-u' or '--io-uring'
+        }
+        // if '-D' or '--direct-io' option is provided, bypass the page cache
+        // of the host when accessing the device
+        else if (IS_USING_DIRECT_ARG(argv))
+        {
+            set_direct_io_mode(true);
+            argv += 1; // skip '-D' or '--direct-io'
+            argc -= 1; // sub '-D' or '--direct-io'
+        }
+        // if '-m' or '--mmap' option is provided, map the device in memory
+        else if (IS_USING_M_ARG(argv))
+        {
+            set_mmap_mode(true);
+            argv += 1; // skip '-m' or '--mmap'
+            argc -= 1; // sub '-m' or '--mmap'
+        }
     }
 
+    if (get_mmap_mode() && (get_direct_io_mode() || get_io_uring_mode()))
+        error_exit("The '-m' option cannot be used with the '-D' and '-u' "
+                   "options.\n",
+                   EXIT_FAILURE);
+
     if (private_key_path == NULL)
     {
         if (keypair_in_home_exist())
@@ -162,16 +212,18 @@ int main(int argc, char *argv[])
             EXIT_FAILURE, device_path);
     }
 
-    fpi_register_master_key_from_path(device_path, private_key_path);
+    struct shlkfs_ctx *ctx =
+        fpi_open_ctx_from_path(device_path, private_key_path);
 
     print_info("Mounting a SherlockFS filesystem instance...\n");
-    int ret = fuse_main(argc, new_argv, &ops, NULL);
+    int ret = fuse_main(argc, new_argv, &ops, ctx);
     if (ret == 0)
         print_success("SherlockFS instance exited successfully.\n");
     else
         print_error("SherlockFS instance exited with an error: '%s'\n",
                     strerror(ret));
 
+    shlkfs_ctx_close(ctx);
     free(new_argv);
     return ret;
 }
@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cryptfs.h"
+#include "crypto.h"
+#include "rekey.h"
+
+int main(int argc, char *argv[])
+{
+    char *private_key_path = NULL;
+
+    switch (argc)
+    {
+    case 2: // <device>
+        get_rsa_keys_home_paths(NULL, &private_key_path);
+        break;
+    case 3: // <device> <private key>
+        private_key_path = argv[2];
+        break;
+    default:
+        printf("SherlockFS v%d - Rotating the master key of a device\n",
+               CRYPTFS_VERSION);
+        printf("\tUsage: %s <device> [private key path]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int ret = cryptfs_rekey(argv[1], private_key_path);
+
+    if (argc == 2) // if `private_key_path` was malloced
+        free(private_key_path);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "adduser.h"
 #include "cryptfs.h"
@@ -11,6 +12,16 @@ int main(int argc, char *argv[])
     char *other_public_key_path = NULL;
     char *my_private_key_path = NULL;
 
+    // if '-k' or '--key' option is provided, all the arguments after the
+    // device are public keys, added in one pass
+    if (argc > 4
+        && (strcmp(argv[1], "-k") == 0 || strcmp(argv[1], "--key") == 0))
+    {
+        int ret = cryptfs_addusers(argv[3], (const char *const *)argv + 4,
+                                   argc - 4, argv[2]);
+        return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     switch (argc)
     {
     case 3: // <device> <other user public key path>
@@ -29,6 +40,9 @@ int main(int argc, char *argv[])
         printf("\tUsage: %s <device> <other user public key path> [registred "
                "user private key path]\n",
                argv[0]);
+        printf("\t       %s -k|--key <registred user private key path> "
+               "<device> <other user public key path>...\n",
+               argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -172,3 +172,68 @@ Test(shlkfs_useradd, already_exists, .timeout = 10, .init = cr_redirect_stdall)
     EVP_PKEY_free(other_rsa);
     free(shlkfs);
 }
+
+Test(shlkfs_useradd, batch, .timeout = 20, .init = cr_redirect_stdall)
+{
+    system("dd if=/dev/zero of=build/tests/shlkfs.useradd.batch.test.shlkfs "
+           "bs=4096 count=1000 2> /dev/null");
+
+    format_fs("build/tests/shlkfs.useradd.batch.test.shlkfs",
+              "build/tests/shlkfs.useradd.batch.test.public.pem",
+              "build/tests/shlkfs.useradd.batch.test.private.pem", "label",
+              NULL, NULL);
+
+    EVP_PKEY *first_rsa = generate_rsa_keypair();
+    EVP_PKEY *second_rsa = generate_rsa_keypair();
+    write_rsa_keys_on_disk(
+        first_rsa, "build/tests/shlkfs.useradd.batch.first_public.pem",
+        "build/tests/shlkfs.useradd.batch.first_private.pem", NULL);
+    write_rsa_keys_on_disk(second_rsa,
+                           "build/tests/shlkfs.useradd.batch.second_public.pem",
+                           NULL, NULL);
+
+    // Nothing is added if one of the users is already registered
+    const char *public_key_paths[] = {
+        "build/tests/shlkfs.useradd.batch.first_public.pem",
+        "build/tests/shlkfs.useradd.batch.second_public.pem",
+        "build/tests/shlkfs.useradd.batch.test.public.pem",
+    };
+    cr_assert_eq(
+        cryptfs_addusers("build/tests/shlkfs.useradd.batch.test.shlkfs",
+                         public_key_paths, 3,
+                         "build/tests/shlkfs.useradd.batch.test.private.pem"),
+        -1);
+    struct CryptFS_KeySlot *keys_storage =
+        read_key_slots("build/tests/shlkfs.useradd.batch.test.shlkfs");
+    cr_assert_eq(keys_storage[1].occupied, 0);
+    cr_assert_eq(keys_storage[2].occupied, 0);
+    free(keys_storage);
+
+    cr_assert_eq(
+        cryptfs_addusers("build/tests/shlkfs.useradd.batch.test.shlkfs",
+                         public_key_paths, 2,
+                         "build/tests/shlkfs.useradd.batch.test.private.pem"),
+        0);
+    keys_storage =
+        read_key_slots("build/tests/shlkfs.useradd.batch.test.shlkfs");
+    cr_assert_eq(keys_storage[1].occupied, 1);
+    cr_assert_eq(keys_storage[2].occupied, 1);
+    cr_assert_eq(keys_storage[3].occupied, 0);
+    free(keys_storage);
+
+    // The new users get the master key
+    unsigned char *my_key = extract_aes_key(
+        "build/tests/shlkfs.useradd.batch.test.shlkfs",
+        "build/tests/shlkfs.useradd.batch.test.private.pem", NULL);
+    unsigned char *first_key = extract_aes_key(
+        "build/tests/shlkfs.useradd.batch.test.shlkfs",
+        "build/tests/shlkfs.useradd.batch.first_private.pem", NULL);
+    cr_assert_not_null(first_key);
+    cr_assert_arr_eq(my_key, first_key, AES_KEY_SIZE_BYTES);
+
+    // Free memory
+    EVP_PKEY_free(first_rsa);
+    EVP_PKEY_free(second_rsa);
+    free(my_key);
+    free(first_key);
+}
@@ -0,0 +1,87 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "agent.h"
+#include "crypto.h"
+#include "rekey.h"
+#include "shlkfs.h"
+#include "test_volume.h"
+
+void cr_redirect_stdall(void);
+
+/**
+ * @brief Start an agent in a child process, and point the tools to it.
+ *
+ * @param socket_path The path of the socket of the agent.
+ * @return pid_t The PID of the agent.
+ */
+static pid_t start_agent(const char *socket_path)
+{
+    int fd = agent_listen(socket_path);
+    cr_assert_geq(fd, 0);
+    pid_t pid = fork();
+    cr_assert_neq(pid, -1);
+    if (pid == 0)
+        _exit(agent_serve(fd, socket_path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    close(fd);
+    cr_assert_eq(setenv(AGENT_SOCKET_ENV, socket_path, 1), 0);
+    return pid;
+}
+
+Test(agent, serve, .init = cr_redirect_stdall, .timeout = 60)
+{
+    struct test_volume volume;
+    format_test_volume("agent.serve", 1000, &volume);
+    const char *device_path = volume.device_path;
+    const char *private_key_path = volume.private_key_path;
+    unsigned char *aes_key =
+        extract_aes_key(device_path, private_key_path, NULL);
+
+    // Without agent, the master key comes from the private key only
+    cr_assert_null(agent_extract_aes_key(device_path, NULL));
+    pid_t pid = start_agent("build/tests/agent.serve.sock");
+    cr_assert_null(agent_extract_aes_key(device_path, NULL));
+    cr_assert_null(
+        agent_extract_aes_key("build/tests/agent.serve.missing", NULL));
+
+    cr_assert_eq(cryptfs_agent_add(&device_path, 1, private_key_path), 0);
+    ssize_t index = -1;
+    unsigned char *agent_key = agent_extract_aes_key(device_path, &index);
+    cr_assert_not_null(agent_key);
+    cr_assert_eq(index, 0);
+    cr_assert_arr_eq(agent_key, aes_key, AES_KEY_SIZE_BYTES);
+    free(agent_key);
+
+    // The private key is not needed anymore
+    struct shlkfs *fs =
+        shlkfs_mount(device_path, "build/tests/agent.serve.missing.pem", NULL);
+    cr_assert_not_null(fs);
+    cr_assert_eq(shlkfs_mkdir(fs, "/dir", 0755), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+
+    // The master key replaced by a rotation is not served anymore
+    cr_assert_eq(cryptfs_rekey(device_path, private_key_path), 0);
+    cr_assert_null(agent_extract_aes_key(device_path, NULL));
+    cr_assert_eq(cryptfs_agent_add(&device_path, 1, private_key_path), 0);
+    agent_key = agent_extract_aes_key(device_path, NULL);
+    cr_assert_not_null(agent_key);
+    free(agent_key);
+
+    cr_assert_eq(agent_clear(), 0);
+    cr_assert_null(agent_extract_aes_key(device_path, NULL));
+
+    // The socket is removed when the agent stops
+    int status = 0;
+    cr_assert_eq(kill(pid, SIGTERM), 0);
+    cr_assert_eq(waitpid(pid, &status, 0), pid);
+    cr_assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    cr_assert_eq(access("build/tests/agent.serve.sock", F_OK), -1);
+    cr_assert_null(agent_extract_aes_key(device_path, NULL));
+    free(aes_key);
+}
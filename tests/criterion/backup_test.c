@@ -0,0 +1,200 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "backup.h"
+#include "block_backend.h"
+#include "cbt.h"
+#include "shlkfs.h"
+#include "test_volume.h"
+
+void cr_redirect_stdall(void);
+
+/**
+ * @brief Format a volume in an image file (without changed-block tracking).
+ *
+ * @param name The name of the test (prefix of its files in build/tests).
+ */
+static void create_test_volume(const char *name)
+{
+    struct test_volume volume;
+    format_test_volume(name, 1000, &volume);
+    // The device opened by format_fs would keep the volume locked
+    set_block_backend(NULL);
+}
+
+/**
+ * @brief Get the size of a file.
+ *
+ * @param path The path of the file.
+ * @return off_t The size of the file.
+ */
+static off_t file_size(const char *path)
+{
+    struct stat st;
+    cr_assert_eq(stat(path, &st), 0);
+    return st.st_size;
+}
+
+Test(backup, incremental, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("backup.incremental");
+
+    // Nothing is tracked before the first full backup
+    cr_assert_eq(cryptfs_backup("build/tests/backup.incremental.test.shlkfs",
+                                "build/tests/backup.incremental.0", true),
+                 -1);
+
+    cr_assert_eq(cryptfs_backup("build/tests/backup.incremental.test.shlkfs",
+                                "build/tests/backup.incremental.0", false),
+                 0);
+    cr_assert_eq(file_size("build/tests/backup.incremental.0"),
+                 sizeof(struct CryptFS_Backup_Header)
+                     + 2 * sizeof(struct CryptFS_Backup_Extent)
+                     + 1000 * 4096);
+
+    // Nothing was written since the full backup
+    cr_assert_eq(cryptfs_backup("build/tests/backup.incremental.test.shlkfs",
+                                "build/tests/backup.incremental.1", true),
+                 0);
+    cr_assert_eq(file_size("build/tests/backup.incremental.1"),
+                 sizeof(struct CryptFS_Backup_Header)
+                     + sizeof(struct CryptFS_Backup_Extent));
+
+    // Only the written blocks are backed up
+    struct shlkfs *fs =
+        shlkfs_mount("build/tests/backup.incremental.test.shlkfs",
+                     "build/tests/backup.incremental.private.pem", NULL);
+    cr_assert_not_null(fs);
+    int fd = shlkfs_open(fs, "/file", O_CREAT | O_WRONLY, 0644);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(shlkfs_write(fs, fd, "content\n", 8), 8);
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+
+    cr_assert_eq(cryptfs_backup("build/tests/backup.incremental.test.shlkfs",
+                                "build/tests/backup.incremental.2", true),
+                 0);
+    off_t size = file_size("build/tests/backup.incremental.2");
+    cr_assert_gt(size, sizeof(struct CryptFS_Backup_Header) + 4096);
+    cr_assert_lt(size, 20 * 4096);
+
+    struct cbt *cbt = NULL;
+    cr_assert_eq(
+        cbt_open("build/tests/backup.incremental.test.shlkfs", &cbt), 0);
+    cr_assert_not_null(cbt);
+    cr_assert_eq(cbt_header(cbt)->epoch, 2);
+    cr_assert_eq(cbt_next_changed(cbt, 0), 1000);
+    cbt_close(cbt);
+
+    // The full backup and the incremental ones restore the device, in order
+    cr_assert_eq(cryptfs_restore("build/tests/backup.incremental.restored",
+                                 "build/tests/backup.incremental.1"),
+                 -1);
+    cr_assert_eq(cryptfs_restore("build/tests/backup.incremental.restored",
+                                 "build/tests/backup.incremental.0"),
+                 0);
+    cr_assert_eq(cryptfs_restore("build/tests/backup.incremental.restored",
+                                 "build/tests/backup.incremental.2"),
+                 -1);
+    cr_assert_eq(cryptfs_restore("build/tests/backup.incremental.restored",
+                                 "build/tests/backup.incremental.1"),
+                 0);
+    cr_assert_eq(cryptfs_restore("build/tests/backup.incremental.restored",
+                                 "build/tests/backup.incremental.1"),
+                 -1);
+    cr_assert_eq(cryptfs_restore("build/tests/backup.incremental.restored",
+                                 "build/tests/backup.incremental.2"),
+                 0);
+    cr_assert_eq(system("cmp build/tests/backup.incremental.test.shlkfs "
+                        "build/tests/backup.incremental.restored"),
+                 0);
+}
+
+Test(backup, restore_invalid, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("backup.restore_invalid");
+
+    FILE *file = fopen("build/tests/backup.restore_invalid.bak", "w");
+    fputs("not a backup", file);
+    fclose(file);
+    cr_assert_eq(
+        cryptfs_restore("build/tests/backup.restore_invalid.test.shlkfs",
+                        "build/tests/backup.restore_invalid.bak"),
+        -1);
+
+    // A truncated backup is detected
+    cr_assert_eq(
+        cryptfs_backup("build/tests/backup.restore_invalid.test.shlkfs",
+                       "build/tests/backup.restore_invalid.bak", false),
+        0);
+    cr_assert_eq(truncate("build/tests/backup.restore_invalid.bak", 10000), 0);
+    cr_assert_eq(
+        cryptfs_restore("build/tests/backup.restore_invalid.restored",
+                        "build/tests/backup.restore_invalid.bak"),
+        -1);
+}
+
+Test(backup, mounted, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("backup.mounted");
+
+    // A mounted volume cannot be backed up
+    struct shlkfs *fs = shlkfs_mount("build/tests/backup.mounted.test.shlkfs",
+                                     "build/tests/backup.mounted.private.pem",
+                                     NULL);
+    cr_assert_not_null(fs);
+    cr_assert_eq(cryptfs_backup("build/tests/backup.mounted.test.shlkfs",
+                                "build/tests/backup.mounted.0", false),
+                 -1);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+
+    cr_assert_eq(cryptfs_backup("build/tests/backup.mounted.test.shlkfs",
+                                "build/tests/backup.mounted.0", false),
+                 0);
+}
+
+Test(backup, failed, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("backup.failed");
+
+    // A failed full backup does not enable the tracking
+    cr_assert_eq(cryptfs_backup("build/tests/backup.failed.test.shlkfs",
+                                "build/tests/backup.failed.missing/0", false),
+                 -1);
+    struct cbt *cbt = NULL;
+    cr_assert_eq(cbt_open("build/tests/backup.failed.test.shlkfs", &cbt), 0);
+    cr_assert_null(cbt);
+
+    cr_assert_eq(cryptfs_backup("build/tests/backup.failed.test.shlkfs",
+                                "build/tests/backup.failed.0", false),
+                 0);
+    struct shlkfs *fs = shlkfs_mount("build/tests/backup.failed.test.shlkfs",
+                                     "build/tests/backup.failed.private.pem",
+                                     NULL);
+    cr_assert_not_null(fs);
+    int fd = shlkfs_open(fs, "/file", O_CREAT | O_WRONLY, 0644);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(shlkfs_write(fs, fd, "content\n", 8), 8);
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+
+    // The blocks written since the full backup are still tracked after a
+    // failed incremental backup
+    cr_assert_eq(cryptfs_backup("build/tests/backup.failed.test.shlkfs",
+                                "build/tests/backup.failed.missing/1", true),
+                 -1);
+    cr_assert_eq(cbt_open("build/tests/backup.failed.test.shlkfs", &cbt), 0);
+    cr_assert_not_null(cbt);
+    cr_assert_eq(cbt_header(cbt)->epoch, 0);
+    cr_assert_lt(cbt_next_changed(cbt, 0), 1000);
+    cbt_close(cbt);
+
+    cr_assert_eq(cryptfs_backup("build/tests/backup.failed.test.shlkfs",
+                                "build/tests/backup.failed.1", true),
+                 0);
+    cr_assert_gt(file_size("build/tests/backup.failed.1"),
+                 sizeof(struct CryptFS_Backup_Header) + 4096);
+}
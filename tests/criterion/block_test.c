@@ -2,11 +2,17 @@
 #include <criterion/redirect.h>
 #include <openssl/rand.h>
 #include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "block.h"
+#include "block_backend.h"
 #include "cryptfs.h"
 #include "crypto.h"
 #include "format.h"
+#include "thread_pool.h"
 #include "xalloc.h"
 
 Test(block, read_write, .init = cr_redirect_stdout, .timeout = 10)
@@ -75,3 +81,643 @@ Test(block, read_write_with_encryption_decryption, .init = cr_redirect_stdout,
     free(buffer_before_encryption);
     free(buffer_after_decryption);
 }
+
+Test(block, discard, .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/block_discard.test.shlkfs "
+           "bs=4096 count=1000 2> /dev/null");
+
+    set_device_path("build/tests/block_discard.test.shlkfs");
+
+    uint8_t *buffer_before = xcalloc(4, CRYPTFS_BLOCK_SIZE_BYTES);
+    uint8_t *buffer_after = xcalloc(4, CRYPTFS_BLOCK_SIZE_BYTES);
+    uint8_t *zeros = xcalloc(4, CRYPTFS_BLOCK_SIZE_BYTES);
+
+    cr_assert(RAND_bytes(buffer_before, 4 * CRYPTFS_BLOCK_SIZE_BYTES) == 1);
+    cr_assert_eq(write_blocks(100, 4, buffer_before), 0);
+
+    // Discard mode disabled: nothing happens
+    set_discard_mode(false);
+    cr_assert_eq(discard_blocks(100, 4), 0);
+    cr_assert_eq(read_blocks(100, 4, buffer_after), 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // Discard mode enabled: the blocks are zeroed (hole punched)
+    set_discard_mode(true);
+    cr_assert_eq(discard_blocks(101, 2), 0);
+    cr_assert_eq(read_blocks(100, 4, buffer_after), 0);
+    cr_assert_arr_eq(buffer_before, buffer_after, CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_arr_eq(zeros, buffer_after + CRYPTFS_BLOCK_SIZE_BYTES,
+                     2 * CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_arr_eq(buffer_before + 3 * CRYPTFS_BLOCK_SIZE_BYTES,
+                     buffer_after + 3 * CRYPTFS_BLOCK_SIZE_BYTES,
+                     CRYPTFS_BLOCK_SIZE_BYTES);
+
+    if (remove("build/tests/block_discard.test.shlkfs") != 0)
+        cr_assert(false, "Impossible to delete the file");
+
+    free(buffer_before);
+    free(buffer_after);
+    free(zeros);
+}
+
+Test(block, read_write_with_encryption_decryption_parallel,
+     .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/block_parallel.test.shlkfs "
+           "bs=4096 count=1000 2> /dev/null");
+
+    set_device_path("build/tests/block_parallel.test.shlkfs");
+    thread_pool_init(4);
+
+    // Large enough to be spread on the thread pool
+    size_t nb_blocks = 256;
+    unsigned char *aes_key = generate_aes_key();
+    unsigned char *buffer_before = xcalloc(nb_blocks, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *buffer_after = xcalloc(nb_blocks, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *block = xcalloc(1, CRYPTFS_BLOCK_SIZE_BYTES);
+
+    cr_assert_eq(
+        RAND_bytes(buffer_before, nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES), 1);
+
+    cr_assert_eq(
+        write_blocks_with_encryption(aes_key, 100, nb_blocks, buffer_before),
+        0);
+    cr_assert_eq(
+        read_blocks_with_decryption(aes_key, 100, nb_blocks, buffer_after), 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // Each block is encrypted independently: same result one by one
+    for (size_t i = 0; i < nb_blocks; i += 37)
+    {
+        cr_assert_eq(read_blocks_with_decryption(aes_key, 100 + i, 1, block),
+                     0);
+        cr_assert_arr_eq(block, buffer_before + i * CRYPTFS_BLOCK_SIZE_BYTES,
+                         CRYPTFS_BLOCK_SIZE_BYTES);
+    }
+
+    if (remove("build/tests/block_parallel.test.shlkfs") != 0)
+        cr_assert(false, "Impossible to delete the file");
+
+    thread_pool_destroy();
+    free(aes_key);
+    free(buffer_before);
+    free(buffer_after);
+    free(block);
+}
+
+Test(block, read_write_with_encryption_decryption_pipelined,
+     .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/block_pipelined.test.shlkfs "
+           "bs=4096 count=1200 2> /dev/null");
+
+    set_device_path("build/tests/block_pipelined.test.shlkfs");
+
+    // Several chunks of the pipeline, the last one being partial
+    size_t nb_blocks = 1100;
+    unsigned char *aes_key = generate_aes_key();
+    unsigned char *buffer_before = xcalloc(nb_blocks, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *buffer_after = xcalloc(nb_blocks, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *block = xcalloc(1, CRYPTFS_BLOCK_SIZE_BYTES);
+
+    cr_assert_eq(
+        RAND_bytes(buffer_before, nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES), 1);
+
+    cr_assert_eq(
+        write_blocks_with_encryption(aes_key, 42, nb_blocks, buffer_before),
+        0);
+    cr_assert_eq(
+        read_blocks_with_decryption(aes_key, 42, nb_blocks, buffer_after), 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // Same result block by block, across the chunk boundaries
+    for (size_t i = 0; i < nb_blocks; i += 97)
+    {
+        cr_assert_eq(read_blocks_with_decryption(aes_key, 42 + i, 1, block),
+                     0);
+        cr_assert_arr_eq(block, buffer_before + i * CRYPTFS_BLOCK_SIZE_BYTES,
+                         CRYPTFS_BLOCK_SIZE_BYTES);
+    }
+    cr_assert_eq(
+        read_blocks_with_decryption(aes_key, 42 + nb_blocks - 1, 1, block), 0);
+    cr_assert_arr_eq(block,
+                     buffer_before + (nb_blocks - 1) * CRYPTFS_BLOCK_SIZE_BYTES,
+                     CRYPTFS_BLOCK_SIZE_BYTES);
+
+    if (remove("build/tests/block_pipelined.test.shlkfs") != 0)
+        cr_assert(false, "Impossible to delete the file");
+
+    free(aes_key);
+    free(buffer_before);
+    free(buffer_after);
+    free(block);
+}
+
+Test(block, read_write_batch_with_encryption_decryption,
+     .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/block_batch.test.shlkfs "
+           "bs=4096 count=1000 2> /dev/null");
+
+    set_device_path("build/tests/block_batch.test.shlkfs");
+
+    unsigned char *aes_key = generate_aes_key();
+    unsigned char *buffer_before = xcalloc(7, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *buffer_after = xcalloc(7, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *block = xcalloc(1, CRYPTFS_BLOCK_SIZE_BYTES);
+
+    cr_assert_eq(RAND_bytes(buffer_before, 7 * CRYPTFS_BLOCK_SIZE_BYTES), 1);
+
+    // Non contiguous requests, of different sizes
+    struct block_request requests_before[] = {
+        { .start_block = 500, .nb_blocks = 3, .buffer = buffer_before },
+        { .start_block = 100,
+          .nb_blocks = 1,
+          .buffer = buffer_before + 3 * CRYPTFS_BLOCK_SIZE_BYTES },
+        { .start_block = 900,
+          .nb_blocks = 3,
+          .buffer = buffer_before + 4 * CRYPTFS_BLOCK_SIZE_BYTES },
+    };
+    struct block_request requests_after[] = {
+        { .start_block = 500, .nb_blocks = 3, .buffer = buffer_after },
+        { .start_block = 100,
+          .nb_blocks = 1,
+          .buffer = buffer_after + 3 * CRYPTFS_BLOCK_SIZE_BYTES },
+        { .start_block = 900,
+          .nb_blocks = 3,
+          .buffer = buffer_after + 4 * CRYPTFS_BLOCK_SIZE_BYTES },
+    };
+
+    cr_assert_eq(
+        write_blocks_batch_with_encryption(aes_key, requests_before, 3), 0);
+    cr_assert_eq(read_blocks_batch_with_decryption(aes_key, requests_after, 3),
+                 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     7 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // Same result as a single block read
+    cr_assert_eq(read_blocks_with_decryption(aes_key, 901, 1, block), 0);
+    cr_assert_arr_eq(block, buffer_before + 5 * CRYPTFS_BLOCK_SIZE_BYTES,
+                     CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // Raw batch: the ciphertext as read_blocks sees it
+    cr_assert_eq(read_blocks_batch(requests_after, 3), 0);
+    cr_assert_eq(read_blocks(100, 1, block), 0);
+    cr_assert_arr_eq(block, buffer_after + 3 * CRYPTFS_BLOCK_SIZE_BYTES,
+                     CRYPTFS_BLOCK_SIZE_BYTES);
+
+    if (remove("build/tests/block_batch.test.shlkfs") != 0)
+        cr_assert(false, "Impossible to delete the file");
+
+    free(aes_key);
+    free(buffer_before);
+    free(buffer_after);
+    free(block);
+}
+
+Test(block, read_write_direct_io, .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/block_direct_io.test.shlkfs "
+           "bs=4096 count=1000 2> /dev/null");
+
+    set_device_path("build/tests/block_direct_io.test.shlkfs");
+    set_direct_io_mode(true);
+    cr_assert(get_direct_io_mode());
+
+    unsigned char *aes_key = generate_aes_key();
+    unsigned char *aligned_before =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, 4, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *aligned_after =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, 4, CRYPTFS_BLOCK_SIZE_BYTES);
+    // Unaligned buffers go through a bounce buffer
+    unsigned char *unaligned = xcalloc(4 * CRYPTFS_BLOCK_SIZE_BYTES + 1, 1);
+
+    cr_assert_eq(RAND_bytes(aligned_before, 4 * CRYPTFS_BLOCK_SIZE_BYTES), 1);
+
+    cr_assert_eq(write_blocks(200, 4, aligned_before), 0);
+    cr_assert_eq(read_blocks(200, 4, aligned_after), 0);
+    cr_assert_arr_eq(aligned_before, aligned_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(read_blocks(200, 4, unaligned + 1), 0);
+    cr_assert_arr_eq(aligned_before, unaligned + 1,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    cr_assert_eq(
+        write_blocks_with_encryption(aes_key, 300, 4, unaligned + 1), 0);
+    cr_assert_eq(
+        read_blocks_with_decryption(aes_key, 300, 4, aligned_after), 0);
+    cr_assert_arr_eq(aligned_before, aligned_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // Unaligned ranges of bytes go through the enclosing blocks
+    cr_assert_eq(write_device_bytes("build/tests/block_direct_io.test.shlkfs",
+                                    400 * CRYPTFS_BLOCK_SIZE_BYTES - 10, 100,
+                                    unaligned + 1),
+                 0);
+    memset(aligned_after, 0, 4 * CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(read_device_bytes("build/tests/block_direct_io.test.shlkfs",
+                                   400 * CRYPTFS_BLOCK_SIZE_BYTES - 10, 100,
+                                   aligned_after + 1),
+                 0);
+    cr_assert_arr_eq(unaligned + 1, aligned_after + 1, 100);
+    cr_assert_eq(read_blocks(399, 1, aligned_after), 0);
+    for (size_t i = 0; i < CRYPTFS_BLOCK_SIZE_BYTES - 10; i++)
+        cr_assert_eq(aligned_after[i], 0);
+
+    // The blocks written with O_DIRECT are seen without it
+    set_direct_io_mode(false);
+    memset(aligned_after, 0, 4 * CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(read_blocks(200, 4, aligned_after), 0);
+    cr_assert_arr_eq(aligned_before, aligned_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    if (remove("build/tests/block_direct_io.test.shlkfs") != 0)
+        cr_assert(false, "Impossible to delete the file");
+
+    free(aes_key);
+    free(aligned_before);
+    free(aligned_after);
+    free(unaligned);
+}
+
+Test(block, device_modes, .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/block_device_modes.test.shlkfs "
+           "bs=4096 count=1000 2> /dev/null");
+
+    // A device keeps the modes set when it was opened
+    set_direct_io_mode(true);
+    set_discard_mode(true);
+    struct block_device *device = block_device_open(
+        "build/tests/block_device_modes.test.shlkfs", CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_not_null(device);
+    set_direct_io_mode(false);
+    set_discard_mode(false);
+
+    struct block_device *previous = block_device_use(device);
+    cr_assert(get_direct_io_mode());
+    cr_assert(get_discard_mode());
+    unsigned char *buffer =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, 4, CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(write_blocks(200, 4, buffer), 0);
+    cr_assert_eq(read_blocks(200, 4, buffer), 0);
+    block_device_use(previous);
+    cr_assert_not(get_direct_io_mode());
+    cr_assert_not(get_discard_mode());
+
+    block_device_close(device);
+    free(buffer);
+    if (remove("build/tests/block_device_modes.test.shlkfs") != 0)
+        cr_assert(false, "Impossible to delete the file");
+}
+
+Test(block, no_device, .init = cr_redirect_stderr, .exit_code = EXIT_FAILURE,
+     .timeout = 10)
+{
+    // Without device, the default device is not silently used
+    set_block_backend(NULL);
+    unsigned char buffer[CRYPTFS_BLOCK_SIZE_BYTES];
+    read_blocks(0, 1, buffer);
+}
+
+Test(block, read_write_mmap, .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/block_mmap.test.shlkfs "
+           "bs=4096 count=1000 2> /dev/null");
+
+    set_device_path("build/tests/block_mmap.test.shlkfs");
+    set_mmap_mode(true);
+    cr_assert(get_mmap_mode());
+
+    unsigned char *aes_key = generate_aes_key();
+    unsigned char *buffer_before = xcalloc(4, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *buffer_after = xcalloc(4, CRYPTFS_BLOCK_SIZE_BYTES);
+
+    cr_assert_eq(RAND_bytes(buffer_before, 4 * CRYPTFS_BLOCK_SIZE_BYTES), 1);
+
+    cr_assert_eq(write_blocks(200, 4, buffer_before), 0);
+    cr_assert_eq(read_blocks(200, 4, buffer_after), 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    cr_assert_eq(write_blocks_with_encryption(aes_key, 300, 4, buffer_before),
+                 0);
+    cr_assert_eq(read_blocks_with_decryption(aes_key, 300, 4, buffer_after),
+                 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // Writing past the end of the image file grows it
+    cr_assert_eq(
+        write_blocks_with_encryption(aes_key, 1100, 4, buffer_before), 0);
+    cr_assert_eq(flush_blocks(), 0);
+    set_mmap_mode(false);
+
+    FILE *file = fopen("build/tests/block_mmap.test.shlkfs", "r");
+    cr_assert_not_null(file);
+    fseek(file, 0, SEEK_END);
+    cr_assert_eq(ftell(file), 1104 * CRYPTFS_BLOCK_SIZE_BYTES);
+    fclose(file);
+
+    // The blocks written in the mapping are seen without it
+    memset(buffer_after, 0, 4 * CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(read_blocks(200, 4, buffer_after), 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(read_blocks_with_decryption(aes_key, 1100, 4, buffer_after),
+                 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    if (remove("build/tests/block_mmap.test.shlkfs") != 0)
+        cr_assert(false, "Impossible to delete the file");
+
+    free(aes_key);
+    free(buffer_before);
+    free(buffer_after);
+}
+
+#ifdef SHLKFS_IO_URING
+Test(block, read_write_io_uring, .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/block_io_uring.test.shlkfs "
+           "bs=4096 count=1000 2> /dev/null");
+
+    set_block_backend(&block_backend_uring);
+    set_device_path("build/tests/block_io_uring.test.shlkfs");
+    cr_assert_eq(get_block_backend(), &block_backend_uring);
+
+    unsigned char *aes_key = generate_aes_key();
+    unsigned char *buffer_before = xcalloc(8, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *buffer_after = xcalloc(8, CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(RAND_bytes(buffer_before, 8 * CRYPTFS_BLOCK_SIZE_BYTES), 1);
+
+    struct block_request requests[] = {
+        { .start_block = 200, .nb_blocks = 1, .buffer = buffer_before },
+        { .start_block = 210,
+          .nb_blocks = 3,
+          .buffer = buffer_before + CRYPTFS_BLOCK_SIZE_BYTES },
+    };
+    cr_assert_eq(write_blocks_batch_with_encryption(aes_key, requests, 2), 0);
+    cr_assert_eq(read_blocks_with_decryption(aes_key, 200, 1, buffer_after),
+                 0);
+    cr_assert_eq(read_blocks_with_decryption(aes_key, 210, 3,
+                                             buffer_after
+                                                 + CRYPTFS_BLOCK_SIZE_BYTES),
+                 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // The requests are in blocks of the device of the handle, not of the
+    // device used by the calling thread
+    struct block_device *device = block_device_open(
+        "build/tests/block_io_uring.test.shlkfs", 2 * CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_not_null(device);
+    struct block_device *previous = block_device_use(device);
+    struct block_request large_request = { .start_block = 150,
+                                           .nb_blocks = 4,
+                                           .buffer = buffer_before };
+    cr_assert_eq(write_blocks_batch(&large_request, 1), 0);
+    block_device_use(previous);
+    block_device_close(device);
+    cr_assert_eq(read_blocks(300, 8, buffer_after), 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     8 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    set_block_backend(NULL);
+    if (remove("build/tests/block_io_uring.test.shlkfs") != 0)
+        cr_assert(false, "Impossible to delete the file");
+
+    free(aes_key);
+    free(buffer_before);
+    free(buffer_after);
+}
+#endif /* SHLKFS_IO_URING */
+
+Test(block, read_write_ram_disk, .init = cr_redirect_stdout, .timeout = 10)
+{
+    ram_disk_create("ram:block_ram_disk", 1000 * CRYPTFS_BLOCK_SIZE_BYTES);
+    set_block_backend(&block_backend_ram);
+    cr_assert_eq(get_block_backend(), &block_backend_ram);
+
+    // The filesystem is formatted in memory
+    format_fs("ram:block_ram_disk", "build/tests/block_ram_disk.public.pem",
+              "build/tests/block_ram_disk.private.pem", "label", NULL, NULL);
+    cr_assert(is_already_formatted("ram:block_ram_disk"));
+    cr_assert_eq(access("ram:block_ram_disk", F_OK), -1);
+
+    unsigned char *aes_key =
+        extract_aes_key("ram:block_ram_disk",
+                        "build/tests/block_ram_disk.private.pem", NULL);
+    unsigned char *buffer_before = xcalloc(4, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *buffer_after = xcalloc(4, CRYPTFS_BLOCK_SIZE_BYTES);
+
+    cr_assert_eq(RAND_bytes(buffer_before, 4 * CRYPTFS_BLOCK_SIZE_BYTES), 1);
+
+    cr_assert_eq(write_blocks(200, 4, buffer_before), 0);
+    cr_assert_eq(read_blocks(200, 4, buffer_after), 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // Writing past the end of the RAM disk grows it
+    cr_assert_eq(
+        write_blocks_with_encryption(aes_key, 1100, 4, buffer_before), 0);
+    cr_assert_eq(read_blocks_with_decryption(aes_key, 1100, 4, buffer_after),
+                 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(flush_blocks(), 0);
+
+    // A discarded range reads as zeros
+    set_discard_mode(true);
+    cr_assert_eq(discard_blocks(200, 4), 0);
+    set_discard_mode(false);
+    memset(buffer_before, 0, 4 * CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(read_blocks(200, 4, buffer_after), 0);
+    cr_assert_arr_eq(buffer_before, buffer_after,
+                     4 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    set_block_backend(NULL);
+    ram_disk_destroy("ram:block_ram_disk");
+
+    free(aes_key);
+    free(buffer_before);
+    free(buffer_after);
+}
+
+/**
+ * @brief Check that a cipher encrypts each block with its own number.
+ *
+ * @param name The name of the test (prefix of its files in build/tests).
+ * @param cipher The cipher.
+ */
+/**
+ * @brief Check the batches of the device used by the calling thread: their
+ * blocks are encrypted and decrypted by batches spanning the requests, as
+ * when they are processed one by one.
+ *
+ * @param aes_key The AES key of the volume.
+ */
+static void check_batches(const unsigned char *aes_key)
+{
+    // The last request makes a job of more than one batch of blocks
+    struct block_request requests[] = {
+        { .start_block = 300, .nb_blocks = 3 },
+        { .start_block = 310, .nb_blocks = 1 },
+        { .start_block = 320, .nb_blocks = 20 },
+    };
+    size_t nb_requests = sizeof(requests) / sizeof(requests[0]);
+    size_t nb_blocks = 24;
+    unsigned char *plain = xcalloc(nb_blocks, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *buffer = xcalloc(nb_blocks, CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(RAND_bytes(plain, nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES), 1);
+    size_t offset = 0;
+    for (size_t i = 0; i < nb_requests; i++)
+    {
+        requests[i].buffer = plain + offset;
+        offset += requests[i].nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES;
+    }
+    cr_assert_eq(write_blocks_batch_with_encryption(aes_key, requests,
+                                                    nb_requests),
+                 0);
+
+    offset = 0;
+    for (size_t i = 0; i < nb_requests; i++)
+    {
+        requests[i].buffer = buffer + offset;
+        cr_assert_eq(read_blocks_with_decryption(aes_key,
+                                                 requests[i].start_block,
+                                                 requests[i].nb_blocks,
+                                                 requests[i].buffer),
+                     0);
+        offset += requests[i].nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES;
+    }
+    cr_assert_arr_eq(buffer, plain, nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // In place, on the ciphertexts
+    cr_assert_eq(read_blocks_batch(requests, nb_requests), 0);
+    cr_assert_eq(decrypt_blocks_batch(aes_key, requests, nb_requests), 0);
+    cr_assert_arr_eq(buffer, plain, nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(encrypt_blocks_batch(aes_key, requests, nb_requests), 0);
+    cr_assert_eq(write_blocks_batch(requests, nb_requests), 0);
+    memset(buffer, 0, nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(read_blocks_batch_with_decryption(aes_key, requests,
+                                                   nb_requests),
+                 0);
+    cr_assert_arr_eq(buffer, plain, nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    free(plain);
+    free(buffer);
+}
+
+static void check_block_cipher(const char *name, enum cryptfs_cipher cipher)
+{
+    char command[1024];
+    char device_path[256];
+    char public_key_path[256];
+    char private_key_path[256];
+    snprintf(command, sizeof(command),
+             "dd if=/dev/zero of=build/tests/%s.test.shlkfs bs=4096 "
+             "count=1000 2> /dev/null",
+             name);
+    cr_assert_eq(system(command), 0);
+    snprintf(device_path, sizeof(device_path), "build/tests/%s.test.shlkfs",
+             name);
+    snprintf(public_key_path, sizeof(public_key_path),
+             "build/tests/%s.public.pem", name);
+    snprintf(private_key_path, sizeof(private_key_path),
+             "build/tests/%s.private.pem", name);
+
+    set_device_path(device_path);
+    set_block_cipher(cipher);
+    format_fs(device_path, public_key_path, private_key_path, "label", NULL,
+              NULL);
+    cr_assert(is_already_formatted(device_path));
+
+    unsigned char *aes_key =
+        extract_aes_key(device_path, private_key_path, NULL);
+    unsigned char *plain = xcalloc(2, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *encrypted = xcalloc(2, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *decrypted = xcalloc(2, CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(RAND_bytes(plain, CRYPTFS_BLOCK_SIZE_BYTES), 1);
+    memcpy(plain + CRYPTFS_BLOCK_SIZE_BYTES, plain, CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // The same block is encrypted differently at two places
+    cr_assert_eq(write_blocks_with_encryption(aes_key, 200, 2, plain), 0);
+    cr_assert_eq(read_blocks(200, 2, encrypted), 0);
+    cr_assert_arr_neq(encrypted, encrypted + CRYPTFS_BLOCK_SIZE_BYTES,
+                      CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(read_blocks_with_decryption(aes_key, 200, 2, decrypted), 0);
+    cr_assert_arr_eq(plain, decrypted, 2 * CRYPTFS_BLOCK_SIZE_BYTES);
+
+    // A block only decrypts with its own number
+    block_t blocks[] = { 201, 200 };
+    cr_assert_eq(decrypt_blocks(aes_key, blocks, encrypted, decrypted, 2), 0);
+    cr_assert_arr_neq(plain, decrypted, CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char head[AES_BLOCK_SIZE];
+    cr_assert_eq(decrypt_block_head(aes_key, 201,
+                                    encrypted + CRYPTFS_BLOCK_SIZE_BYTES,
+                                    head, AES_BLOCK_SIZE),
+                 0);
+    cr_assert_arr_eq(head, plain, AES_BLOCK_SIZE);
+
+    check_batches(aes_key);
+
+    free(aes_key);
+    free(plain);
+    free(encrypted);
+    free(decrypted);
+}
+
+Test(block, read_write_aes_xts, .init = cr_redirect_stdout, .timeout = 10)
+{
+    check_block_cipher("block_aes_xts", CRYPTFS_CIPHER_AES_256_XTS);
+}
+
+Test(block, read_write_chacha20, .init = cr_redirect_stdout, .timeout = 10)
+{
+    check_block_cipher("block_chacha20", CRYPTFS_CIPHER_CHACHA20);
+}
+
+Test(block, batch_aes_cbc, .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/block_batch_aes_cbc.test.shlkfs "
+           "bs=4096 count=1000 2> /dev/null");
+    set_device_path("build/tests/block_batch_aes_cbc.test.shlkfs");
+    set_block_cipher(CRYPTFS_CIPHER_AES_256_CBC);
+    format_fs("build/tests/block_batch_aes_cbc.test.shlkfs",
+              "build/tests/block_batch_aes_cbc.test.public.pem",
+              "build/tests/block_batch_aes_cbc.test.private.pem", "label",
+              NULL, NULL);
+    unsigned char *aes_key =
+        extract_aes_key("build/tests/block_batch_aes_cbc.test.shlkfs",
+                        "build/tests/block_batch_aes_cbc.test.private.pem",
+                        NULL);
+
+    // The blocks of the batches are encrypted as by aes_encrypt_data (the
+    // volumes of version 1)
+    unsigned char *plain = xcalloc(2, CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(RAND_bytes(plain, 2 * CRYPTFS_BLOCK_SIZE_BYTES), 1);
+    size_t encrypted_size = 0;
+    unsigned char *expected = aes_encrypt_data(
+        aes_key, plain + CRYPTFS_BLOCK_SIZE_BYTES, CRYPTFS_BLOCK_SIZE_BYTES,
+        &encrypted_size);
+    struct block_request request = {
+        .start_block = 400,
+        .nb_blocks = 2,
+        .buffer = plain,
+    };
+    cr_assert_eq(encrypt_blocks_batch(aes_key, &request, 1), 0);
+    cr_assert_arr_eq(plain + CRYPTFS_BLOCK_SIZE_BYTES, expected,
+                     CRYPTFS_BLOCK_SIZE_BYTES);
+
+    check_batches(aes_key);
+
+    free(aes_key);
+    free(plain);
+    free(expected);
+}
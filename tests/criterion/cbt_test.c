@@ -0,0 +1,105 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cbt.h"
+
+void cr_redirect_stdall(void);
+
+Test(cbt, disabled, .init = cr_redirect_stdall, .timeout = 10)
+{
+    remove("build/tests/cbt.disabled.img.cbt");
+
+    struct cbt *cbt = (struct cbt *)1;
+    cr_assert_eq(cbt_open("build/tests/cbt.disabled.img", &cbt), 0);
+    cr_assert_null(cbt);
+    cbt_mark(cbt, 0, 4096); // Nothing is tracked
+}
+
+Test(cbt, state_path, .init = cr_redirect_stdall, .timeout = 10)
+{
+    // An image file (or a device that does not exist yet) keeps its state
+    // next to it, a block (or character) device in CBT_STATE_DIR
+    char *path = cbt_state_path("build/tests/cbt.state_path.img", CBT_SUFFIX);
+    cr_assert_str_eq(path, "build/tests/cbt.state_path.img.cbt");
+    free(path);
+    path = cbt_state_path("/dev/null", CBT_SUFFIX);
+    cr_assert_str_eq(path, CBT_STATE_DIR "/!dev!null.cbt");
+    free(path);
+}
+
+Test(cbt, mark, .init = cr_redirect_stdall, .timeout = 10)
+{
+    cr_assert_eq(cbt_enable("build/tests/cbt.mark.img", 4096, 100, 3), 0);
+
+    struct cbt *cbt = NULL;
+    cr_assert_eq(cbt_open("build/tests/cbt.mark.img", &cbt), 0);
+    cr_assert_not_null(cbt);
+    cr_assert_eq(cbt_header(cbt)->epoch, 3);
+    cr_assert_eq(cbt_next_changed(cbt, 0), 100);
+
+    cbt_mark(cbt, 4096 * 5 + 10, 4096); // Blocks 5 and 6
+    cbt_mark(cbt, 4096 * 20, 4096 * 30); // Blocks 20 to 49
+    cbt_mark(cbt, 4096 * 99, 4096 * 10); // Block 99 (the others are beyond)
+    cbt_close(cbt);
+
+    // The marks are persistent
+    cr_assert_eq(cbt_open("build/tests/cbt.mark.img", &cbt), 0);
+    for (size_t block = 0; block < 100; block++)
+        cr_assert_eq(cbt_is_changed(cbt, block),
+                     block == 5 || block == 6 || (block >= 20 && block < 50)
+                         || block == 99,
+                     "block %zu", block);
+    cr_assert(cbt_is_changed(cbt, 100));
+    cr_assert_eq(cbt_next_changed(cbt, 0), 5);
+    cr_assert_eq(cbt_next_changed(cbt, 7), 20);
+    cr_assert_eq(cbt_next_changed(cbt, 50), 99);
+    cr_assert_eq(cbt_next_changed(cbt, 120), 120);
+    cr_assert_eq(cbt_sync(cbt), 0);
+    cbt_close(cbt);
+
+    // A reset clears the marks
+    cr_assert_eq(cbt_enable("build/tests/cbt.mark.img", 4096, 100, 4), 0);
+    cr_assert_eq(cbt_open("build/tests/cbt.mark.img", &cbt), 0);
+    cr_assert_eq(cbt_next_changed(cbt, 0), 100);
+    cbt_close(cbt);
+}
+
+Test(cbt, corrupted, .init = cr_redirect_stdall, .timeout = 10)
+{
+    FILE *file = fopen("build/tests/cbt.corrupted.img.cbt", "w");
+    fputs("not a tracking file", file);
+    fclose(file);
+
+    struct cbt *cbt = NULL;
+    cr_assert_eq(cbt_open("build/tests/cbt.corrupted.img", &cbt), -1);
+    cr_assert_null(cbt);
+}
+
+Test(cbt, merge, .init = cr_redirect_stdall, .timeout = 10)
+{
+    cr_assert_eq(cbt_enable("build/tests/cbt.merge.img", 4096, 80, 5), 0);
+    struct cbt *previous = NULL;
+    cr_assert_eq(cbt_open("build/tests/cbt.merge.img", &previous), 0);
+    cbt_mark(previous, 4096 * 3, 4096 * 2); // Blocks 3 and 4
+
+    // The previous file stays mapped once replaced (the device grew)
+    cr_assert_eq(cbt_enable("build/tests/cbt.merge.img", 4096, 100, 6), 0);
+    struct cbt *cbt = NULL;
+    cr_assert_eq(cbt_open("build/tests/cbt.merge.img", &cbt), 0);
+    cbt_mark(cbt, 4096 * 10, 4096); // Block 10
+    cbt_merge(cbt, previous);
+    cbt_close(previous);
+
+    cr_assert_eq(cbt_header(cbt)->epoch, 5);
+    for (size_t block = 0; block < 100; block++)
+        cr_assert_eq(cbt_is_changed(cbt, block),
+                     block == 3 || block == 4 || block == 10 || block >= 80,
+                     "block %zu", block);
+    cbt_close(cbt);
+
+    cr_assert_eq(cbt_disable("build/tests/cbt.merge.img"), 0);
+    cr_assert_eq(cbt_open("build/tests/cbt.merge.img", &cbt), 0);
+    cr_assert_null(cbt);
+}
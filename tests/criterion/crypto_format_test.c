@@ -166,3 +166,37 @@ Test(find_rsa_matching_key, key, .init = cr_redirect_stdout, .timeout = 10)
     free(aes_key);
     EVP_PKEY_free(rsa_keypair);
 }
+
+Test(find_rsa_matching_key, fingerprint, .init = cr_redirect_stdout,
+     .timeout = 10)
+{
+    struct CryptFS_KeySlot *keys_storage =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, NB_ENCRYPTION_KEYS,
+                        sizeof(struct CryptFS_KeySlot));
+
+    EVP_PKEY *rsa_keypair = generate_rsa_keypair();
+    EVP_PKEY *rsa_keypair_other = generate_rsa_keypair();
+
+    unsigned char *aes_key = generate_aes_key();
+
+    store_keys_in_keys_storage(keys_storage, rsa_keypair_other, aes_key);
+    store_keys_in_keys_storage(keys_storage, rsa_keypair, aes_key);
+
+    // The fingerprint of the modulus is stored in the key slot
+    unsigned char *fingerprint = rsa_key_fingerprint(rsa_keypair);
+    cr_assert_arr_eq(keys_storage[1].rsa_n_fingerprint, fingerprint,
+                     SHA256_DIGEST_LENGTH);
+    cr_assert_eq(find_rsa_matching_key(rsa_keypair, keys_storage), 1);
+
+    // The key slots stored without fingerprint are still found
+    memset(keys_storage[0].rsa_n_fingerprint, 0, SHA256_DIGEST_LENGTH);
+    memset(keys_storage[1].rsa_n_fingerprint, 0, SHA256_DIGEST_LENGTH);
+    cr_assert_eq(find_rsa_matching_key(rsa_keypair, keys_storage), 1);
+    cr_assert_eq(find_rsa_matching_key(rsa_keypair_other, keys_storage), 0);
+
+    free(fingerprint);
+    free(keys_storage);
+    free(aes_key);
+    EVP_PKEY_free(rsa_keypair);
+    EVP_PKEY_free(rsa_keypair_other);
+}
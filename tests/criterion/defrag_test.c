@@ -0,0 +1,163 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypto.h"
+#include "defrag.h"
+#include "entries.h"
+#include "fat.h"
+#include "fsck.h"
+#include "shlkfs.h"
+#include "shlkfs_ctx.h"
+#include "test_volume.h"
+
+void cr_redirect_stdall(void);
+
+// Number of blocks of /a and /b
+#define FILE_BLOCKS 20
+
+/**
+ * @brief Format a volume in an image file, write /a and /b (FILE_BLOCKS
+ * blocks each, block by block in turn, so that their chains are interleaved)
+ * and the hardlink /link to /a.
+ *
+ * @param name The name of the test (prefix of its files in build/tests).
+ */
+static void create_test_volume(const char *name)
+{
+    struct test_volume volume;
+    format_test_volume(name, 1000, &volume);
+
+    struct shlkfs *fs =
+        shlkfs_mount(volume.device_path, volume.private_key_path, NULL);
+    cr_assert_not_null(fs);
+    int fd_a = shlkfs_open(fs, "/a", O_CREAT | O_WRONLY, 0644);
+    int fd_b = shlkfs_open(fs, "/b", O_CREAT | O_WRONLY, 0644);
+    cr_assert_geq(fd_a, 0);
+    cr_assert_geq(fd_b, 0);
+    char block[4096];
+    for (size_t i = 0; i < FILE_BLOCKS; i++)
+    {
+        memset(block, 'a' + i, sizeof(block));
+        cr_assert_eq(shlkfs_write(fs, fd_a, block, sizeof(block)),
+                     sizeof(block));
+        memset(block, 'A' + i, sizeof(block));
+        cr_assert_eq(shlkfs_write(fs, fd_b, block, sizeof(block)),
+                     sizeof(block));
+    }
+    cr_assert_eq(shlkfs_close(fs, fd_a), 0);
+    cr_assert_eq(shlkfs_close(fs, fd_b), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+
+    unsigned char *aes_key =
+        extract_aes_key(volume.device_path, volume.private_key_path, NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(volume.device_path, aes_key);
+    cr_assert_not_null(ctx);
+    free(create_hardlink_by_path(ctx, "/link", "/a"));
+    shlkfs_ctx_close(ctx);
+    free(aes_key);
+}
+
+/**
+ * @brief Count the fragments of the chain of a file.
+ *
+ * @param name The name of the test.
+ * @param path The path of the file in the volume.
+ * @return size_t The number of runs of contiguous blocks of the chain.
+ */
+static size_t count_fragments(const char *name, const char *path)
+{
+    char device_path[256];
+    char private_key_path[256];
+    snprintf(device_path, sizeof(device_path), "build/tests/%s.test.shlkfs",
+             name);
+    snprintf(private_key_path, sizeof(private_key_path),
+             "build/tests/%s.private.pem", name);
+    unsigned char *aes_key =
+        extract_aes_key(device_path, private_key_path, NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(device_path, aes_key);
+    cr_assert_not_null(ctx);
+
+    size_t nb_fragments = 0;
+    {
+        SHLKFS_CTX_SCOPE(ctx);
+        struct CryptFS_Entry_ID *id = get_entry_by_path(ctx, path);
+        struct CryptFS_Entry *entry = get_entry_from_id(ctx, *id);
+        block_t previous = 0;
+        for (block_t block = entry->start_block; block != (uint32_t)BLOCK_END;
+             block = read_fat_offset(ctx, block))
+        {
+            if (block != previous + 1)
+                nb_fragments++;
+            previous = block;
+        }
+        free(entry);
+        free(id);
+    }
+
+    shlkfs_ctx_close(ctx);
+    free(aes_key);
+    return nb_fragments;
+}
+
+/**
+ * @brief Check the content of a file written by create_test_volume.
+ *
+ * @param fs The mounted volume.
+ * @param path The path of the file.
+ * @param first The first character of the file (incremented at each block).
+ */
+static void check_content(struct shlkfs *fs, const char *path, char first)
+{
+    int fd = shlkfs_open(fs, path, O_RDONLY, 0);
+    cr_assert_geq(fd, 0);
+    char block[4096];
+    char expected[4096];
+    for (size_t i = 0; i < FILE_BLOCKS; i++)
+    {
+        memset(expected, first + i, sizeof(expected));
+        cr_assert_eq(shlkfs_read(fs, fd, block, sizeof(block)),
+                     sizeof(block));
+        cr_assert_arr_eq(block, expected, sizeof(block));
+    }
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+}
+
+Test(defrag, interleaved, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("defrag.interleaved");
+    cr_assert_eq(count_fragments("defrag.interleaved", "/a"), FILE_BLOCKS);
+    cr_assert_eq(count_fragments("defrag.interleaved", "/b"), FILE_BLOCKS);
+
+    // A dry run changes nothing
+    cr_assert_eq(cryptfs_defrag("build/tests/defrag.interleaved.test.shlkfs",
+                                "build/tests/defrag.interleaved.private.pem",
+                                true),
+                 0);
+    cr_assert_eq(count_fragments("defrag.interleaved", "/a"), FILE_BLOCKS);
+
+    cr_assert_eq(cryptfs_defrag("build/tests/defrag.interleaved.test.shlkfs",
+                                "build/tests/defrag.interleaved.private.pem",
+                                false),
+                 0);
+    cr_assert_eq(count_fragments("defrag.interleaved", "/a"), 1);
+    cr_assert_eq(count_fragments("defrag.interleaved", "/b"), 1);
+    cr_assert_eq(count_fragments("defrag.interleaved", "/link"), 1);
+
+    // The old blocks are freed, and the content is kept
+    cr_assert_eq(cryptfs_fsck("build/tests/defrag.interleaved.test.shlkfs",
+                              "build/tests/defrag.interleaved.private.pem",
+                              false),
+                 FSCK_CLEAN);
+    struct shlkfs *fs =
+        shlkfs_mount("build/tests/defrag.interleaved.test.shlkfs",
+                     "build/tests/defrag.interleaved.private.pem", NULL);
+    cr_assert_not_null(fs);
+    check_content(fs, "/a", 'a');
+    check_content(fs, "/b", 'A');
+    check_content(fs, "/link", 'a');
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
@@ -46,21 +46,23 @@ Test(entry_truncate, file_add_blocks, .timeout = 10, .init = cr_redirect_stdout)
     unsigned char *aes_key = extract_aes_key(
         "build/tests/entry_truncate.file_add_blocks.test.shlkfs",
         "build/tests/entry_truncate.file_add_blocks.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_truncate.file_add_blocks.test.shlkfs", aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
-    int64_t entry_block = find_first_free_block_safe(aes_key);
+    int64_t entry_block = find_first_free_block_safe(ctx);
     struct CryptFS_Entry entry = { .used = 1,
                                    .type = ENTRY_TYPE_FILE,
                                    .start_block = entry_block,
@@ -76,18 +78,18 @@ Test(entry_truncate, file_add_blocks, .timeout = 10, .init = cr_redirect_stdout)
     // Write Directory in BLOCK and update FAT
     dir->entries[0] = entry;
     write_blocks_with_encryption(aes_key, dir_block, 1, dir);
-    write_fat_offset(aes_key, entry_block, BLOCK_END);
+    write_fat_offset(ctx, entry_block, BLOCK_END);
 
     size_t resize_number = 25000;
 
     // Check if function ended properly
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
-    int result = entry_truncate(aes_key, entry_id, resize_number);
+    int result = entry_truncate(ctx, entry_id, resize_number);
     cr_assert_eq(result, 0);
 
     cr_assert_eq(
         read_fat_offset(
-            aes_key, entry_block + __blocks_needed_for_file(resize_number) - 1),
+            ctx, entry_block + __blocks_needed_for_file(resize_number) - 1),
         BLOCK_END);
 
     read_blocks_with_decryption(aes_key, dir_block, 1, dir);
@@ -95,6 +97,7 @@ Test(entry_truncate, file_add_blocks, .timeout = 10, .init = cr_redirect_stdout)
     cr_assert_eq(dir->entries[0].size, resize_number);
 
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -131,21 +134,23 @@ Test(entry_truncate, file_remove_blocks, .timeout = 10,
     unsigned char *aes_key = extract_aes_key(
         "build/tests/entry_truncate.file_remove_blocks.test.shlkfs",
         "build/tests/entry_truncate.file_remove_blocks.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_truncate.file_remove_blocks.test.shlkfs", aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
-    int64_t entry_block = find_first_free_block_safe(aes_key);
+    int64_t entry_block = find_first_free_block_safe(ctx);
     struct CryptFS_Entry entry = { .used = 1,
                                    .type = ENTRY_TYPE_FILE,
                                    .start_block = entry_block,
@@ -161,20 +166,20 @@ Test(entry_truncate, file_remove_blocks, .timeout = 10,
     // Write Directory in BLOCK and update FAT
     dir->entries[0] = entry;
     write_blocks_with_encryption(aes_key, dir_block, 1, dir);
-    write_fat_offset(aes_key, entry_block, BLOCK_END);
+    write_fat_offset(ctx, entry_block, BLOCK_END);
 
     // Adding blocks to the entry
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
-    entry_truncate(aes_key, entry_id, 25000);
+    entry_truncate(ctx, entry_id, 25000);
 
     size_t resize_number = 4500;
 
-    int result = entry_truncate(aes_key, entry_id, resize_number);
+    int result = entry_truncate(ctx, entry_id, resize_number);
     cr_assert_eq(result, 0);
 
     cr_assert_eq(
         read_fat_offset(
-            aes_key, entry_block + __blocks_needed_for_file(resize_number) - 1),
+            ctx, entry_block + __blocks_needed_for_file(resize_number) - 1),
         BLOCK_END);
 
     read_blocks_with_decryption(aes_key, dir_block, 1, dir);
@@ -182,6 +187,7 @@ Test(entry_truncate, file_remove_blocks, .timeout = 10,
     cr_assert_eq(dir->entries[0].size, resize_number);
 
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -221,21 +227,24 @@ Test(entry_truncate, file_remove_blocks_till_empty, .timeout = 10,
         "build/tests/entry_truncate.file_remove_blocks_to_empty.test.shlkfs",
         "build/tests/entry_truncate.file_remove_blocks_to_empty.private.pem",
         NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_truncate.file_remove_blocks_to_empty.test.shlkfs",
+        aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
-    int64_t entry_block = find_first_free_block_safe(aes_key);
+    int64_t entry_block = find_first_free_block_safe(ctx);
     struct CryptFS_Entry entry = { .used = 1,
                                    .type = ENTRY_TYPE_FILE,
                                    .start_block = entry_block,
@@ -251,12 +260,12 @@ Test(entry_truncate, file_remove_blocks_till_empty, .timeout = 10,
     // Write Directory in BLOCK and update FAT
     dir->entries[0] = entry;
     write_blocks_with_encryption(aes_key, dir_block, 1, dir);
-    write_fat_offset(aes_key, entry_block, BLOCK_END);
+    write_fat_offset(ctx, entry_block, BLOCK_END);
 
     size_t resize_number = 0;
 
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
-    int result = entry_truncate(aes_key, entry_id, resize_number);
+    int result = entry_truncate(ctx, entry_id, resize_number);
     cr_assert_eq(result, 0);
 
     read_blocks_with_decryption(aes_key, dir_block, 1, dir);
@@ -265,6 +274,7 @@ Test(entry_truncate, file_remove_blocks_till_empty, .timeout = 10,
     cr_assert_eq(dir->entries[0].size, resize_number);
 
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -301,21 +311,23 @@ Test(entry_truncate, directory_add_blocks, .timeout = 10,
     unsigned char *aes_key = extract_aes_key(
         "build/tests/entry_truncate.directory_add_blocks.test.shlkfs",
         "build/tests/entry_truncate.directory_add_blocks.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_truncate.directory_add_blocks.test.shlkfs", aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
-    int64_t entry_block = find_first_free_block_safe(aes_key);
+    int64_t entry_block = find_first_free_block_safe(ctx);
     struct CryptFS_Entry entry = { .used = 1,
                                    .type = ENTRY_TYPE_DIRECTORY,
                                    .start_block = entry_block,
@@ -331,18 +343,18 @@ Test(entry_truncate, directory_add_blocks, .timeout = 10,
     // Write Directory in BLOCK and update FAT
     dir->entries[0] = entry;
     write_blocks_with_encryption(aes_key, dir_block, 1, dir);
-    write_fat_offset(aes_key, entry_block, BLOCK_END);
+    write_fat_offset(ctx, entry_block, BLOCK_END);
 
     size_t resize_number = 28;
 
     // Check if function ended properly
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
-    int result = entry_truncate(aes_key, entry_id, resize_number);
+    int result = entry_truncate(ctx, entry_id, resize_number);
     cr_assert_eq(result, 0);
 
     cr_assert_eq(
         read_fat_offset(
-            aes_key, entry_block + __blocks_needed_for_dir(resize_number) - 1),
+            ctx, entry_block + __blocks_needed_for_dir(resize_number) - 1),
         BLOCK_END);
 
     read_blocks_with_decryption(aes_key, dir_block, 1, dir);
@@ -350,6 +362,7 @@ Test(entry_truncate, directory_add_blocks, .timeout = 10,
     cr_assert_eq(dir->entries[0].size, resize_number);
 
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -387,18 +400,21 @@ Test(entry_write_buffer_from, begining_add, .timeout = 10,
     unsigned char *aes_key = extract_aes_key(
         "build/tests/entry_write_buffer_from.begining_add.test.shlkfs",
         "build/tests/entry_write_buffer_from.begining_add.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_write_buffer_from.begining_add.test.shlkfs",
+        aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
     struct CryptFS_Entry entry = { .used = 1,
@@ -424,7 +440,7 @@ Test(entry_write_buffer_from, begining_add, .timeout = 10,
     // TEST
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
     char *added_string = "This is a Test";
-    int result = entry_write_buffer_from(aes_key, entry_id, 0, added_string,
+    int result = entry_write_buffer_from(ctx, entry_id, 0, added_string,
                                          strlen(added_string));
     cr_assert_eq(result, 0);
 
@@ -437,6 +453,7 @@ Test(entry_write_buffer_from, begining_add, .timeout = 10,
 
     free(block_buffer);
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -478,21 +495,24 @@ Test(entry_write_buffer_from, between_blocks_adding, .timeout = 10,
         "build/tests/"
         "entry_write_buffer_from.between_blocks_adding.private.pem",
         NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_write_buffer_from.between_blocks_adding.test.shlkfs",
+        aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
-    int64_t entry_block = find_first_free_block_safe(aes_key);
+    int64_t entry_block = find_first_free_block_safe(ctx);
     struct CryptFS_Entry entry = { .used = 1,
                                    .type = ENTRY_TYPE_FILE,
                                    .start_block = entry_block,
@@ -508,7 +528,7 @@ Test(entry_write_buffer_from, between_blocks_adding, .timeout = 10,
     // Write Directory in BLOCK and update FAT
     dir->entries[0] = entry;
     write_blocks_with_encryption(aes_key, dir_block, 1, dir);
-    write_fat_offset(aes_key, entry_block, BLOCK_END);
+    write_fat_offset(ctx, entry_block, BLOCK_END);
 
     // Initial Buffer
     char *block_buffer_1 = xmalloc(1, CRYPTFS_BLOCK_SIZE_BYTES);
@@ -517,13 +537,13 @@ Test(entry_write_buffer_from, between_blocks_adding, .timeout = 10,
     // TEST
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
     char *added_string = "This is a Test";
-    int result = entry_write_buffer_from(aes_key, entry_id, 4090, added_string,
+    int result = entry_write_buffer_from(ctx, entry_id, 4090, added_string,
                                          strlen(added_string));
     cr_assert_eq(result, 0);
 
     // Read BLOCKS result
     read_blocks_with_decryption(aes_key, entry_block, 1, block_buffer_1);
-    read_blocks_with_decryption(aes_key, read_fat_offset(aes_key, entry_block),
+    read_blocks_with_decryption(aes_key, read_fat_offset(ctx, entry_block),
                                 1, block_buffer_2);
     char *expected_string = "This i";
     result =
@@ -537,6 +557,7 @@ Test(entry_write_buffer_from, between_blocks_adding, .timeout = 10,
     free(block_buffer_1);
     free(block_buffer_2);
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -582,21 +603,25 @@ Test(entry_read_raw_data, reading_between_blocks, .timeout = 10,
         "build/tests/"
         "entry_write_buffer_from.reading_between_blocks.private.pem",
         NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/"
+        "entry_write_buffer_from.reading_between_blocks.test.shlkfs",
+        aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
-    int64_t entry_block = find_first_free_block_safe(aes_key);
+    int64_t entry_block = find_first_free_block_safe(ctx);
     struct CryptFS_Entry entry = { .used = 1,
                                    .type = ENTRY_TYPE_FILE,
                                    .start_block = entry_block,
@@ -612,7 +637,7 @@ Test(entry_read_raw_data, reading_between_blocks, .timeout = 10,
     // Write Directory in BLOCK and update FAT
     dir->entries[0] = entry;
     write_blocks_with_encryption(aes_key, dir_block, 1, dir);
-    write_fat_offset(aes_key, entry_block, BLOCK_END);
+    write_fat_offset(ctx, entry_block, BLOCK_END);
 
     // Buffer to write
     char *buff = xmalloc(1, 5600);
@@ -623,17 +648,18 @@ Test(entry_read_raw_data, reading_between_blocks, .timeout = 10,
 
     // Writing in file
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
-    entry_write_buffer_from(aes_key, entry_id, 2000, buff, 5600);
+    entry_write_buffer_from(ctx, entry_id, 2000, buff, 5600);
 
     // Reset buff and TEST
     memset(buff, '\0', 5600);
-    cr_assert_eq(entry_read_raw_data(aes_key, entry_id, 2000, buff, 5600),
+    cr_assert_eq(entry_read_raw_data(ctx, entry_id, 2000, buff, 5600),
                  5600);
     cr_assert_eq(memcmp(buff, buff_2, 5600), 0);
 
     free(buff);
     free(buff_2);
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -670,6 +696,8 @@ Test(entry_delete, file_and_directory, .timeout = 10,
     unsigned char *aes_key = extract_aes_key(
         "build/tests/entry_delete.file_and_directory.test.shlkfs",
         "build/tests/entry_delete.file_and_directory.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_delete.file_and_directory.test.shlkfs", aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
@@ -680,18 +708,18 @@ Test(entry_delete, file_and_directory, .timeout = 10,
                                                   ROOT_ENTRY_BLOCK,
                                               .directory_index = 0 };
     // Create a file
-    entry_create_empty_file(aes_key, root_entry_id, "file_test");
-    entry_create_directory(aes_key, root_entry_id, "dir_test");
+    entry_create_empty_file(ctx, root_entry_id, "file_test");
+    entry_create_directory(ctx, root_entry_id, "dir_test");
     struct CryptFS_Entry_ID file_id = { .directory_block = ROOT_DIR_BLOCK,
                                         .directory_index = 0 };
     struct CryptFS_Entry_ID dir_id = { .directory_block = ROOT_DIR_BLOCK,
                                        .directory_index = 1 };
 
     // Create file in to fill new dir
-    entry_create_empty_file(aes_key, dir_id, "file_in_dir_test");
+    entry_create_empty_file(ctx, dir_id, "file_in_dir_test");
 
-    cr_assert_eq(entry_delete(aes_key, file_id), 0);
-    cr_assert_eq(entry_delete(aes_key, dir_id), BLOCK_ERROR);
+    cr_assert_eq(entry_delete(ctx, file_id), 0);
+    cr_assert_eq(entry_delete(ctx, dir_id), BLOCK_ERROR);
 
     // Checking
     struct CryptFS_Directory *dir = xaligned_alloc(
@@ -705,8 +733,8 @@ Test(entry_delete, file_and_directory, .timeout = 10,
                                                    dir->entries[1].start_block,
                                                .directory_index = 0 };
 
-    entry_delete(aes_key, file_in_dir_id);
-    entry_delete(aes_key, dir_id);
+    entry_delete(ctx, file_in_dir_id);
+    entry_delete(ctx, dir_id);
     read_blocks_with_decryption(aes_key, ROOT_DIR_BLOCK, 1, dir);
     // Successfully deleted new dir when it is empty
     cr_assert_eq(dir->entries[1].used, 0);
@@ -719,6 +747,7 @@ Test(entry_delete, file_and_directory, .timeout = 10,
 
     free(root_entry);
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -756,18 +785,21 @@ Test(entry_create_empty_file, in_one_block, .timeout = 10,
     unsigned char *aes_key = extract_aes_key(
         "build/tests/entry_create_empty_file.in_one_block.test.shlkfs",
         "build/tests/entry_create_empty_file.in_one_block.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_create_empty_file.in_one_block.test.shlkfs",
+        aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
     struct CryptFS_Entry new_dir = { .used = 1,
@@ -786,9 +818,9 @@ Test(entry_create_empty_file, in_one_block, .timeout = 10,
 
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
     // adding Files
-    cr_assert_eq(entry_create_empty_file(aes_key, entry_id, "Vacances"), 0);
-    cr_assert_eq(entry_create_empty_file(aes_key, entry_id, "Vacances2"), 1);
-    cr_assert_eq(entry_create_empty_file(aes_key, entry_id, "LALA"), 2);
+    cr_assert_eq(entry_create_empty_file(ctx, entry_id, "Vacances"), 0);
+    cr_assert_eq(entry_create_empty_file(ctx, entry_id, "Vacances2"), 1);
+    cr_assert_eq(entry_create_empty_file(ctx, entry_id, "LALA"), 2);
 
     // Reading Parent Directory metadata
     read_blocks_with_decryption(aes_key, dir_block, 1, dir);
@@ -800,6 +832,7 @@ Test(entry_create_empty_file, in_one_block, .timeout = 10,
     cr_assert_eq(dir->entries[0].used, 1);
 
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -839,18 +872,21 @@ Test(entry_create_empty_file, in_multiple_blocks, .timeout = 10,
         "build/tests/entry_create_empty_file.in_multiple_blocks.test.shlkfs",
         "build/tests/entry_create_empty_file.in_multiple_blocks.private.pem",
         NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_create_empty_file.in_multiple_blocks.test.shlkfs",
+        aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
     struct CryptFS_Entry new_dir = { .used = 1,
@@ -872,7 +908,7 @@ Test(entry_create_empty_file, in_multiple_blocks, .timeout = 10,
     size_t number_files = 26;
     for (size_t i = 0; i < number_files; i++)
     {
-        cr_assert_eq(entry_create_empty_file(aes_key, entry_id, "TEST"), i);
+        cr_assert_eq(entry_create_empty_file(ctx, entry_id, "TEST"), i);
     }
 
     // Reading Parent Directory metadata
@@ -885,17 +921,18 @@ Test(entry_create_empty_file, in_multiple_blocks, .timeout = 10,
         if (i == NB_ENTRIES_PER_BLOCK)
         {
             // read next directory block
-            if (read_fat_offset(aes_key, dir->entries[0].start_block)
+            if (read_fat_offset(ctx, dir->entries[0].start_block)
                 != (u_int32_t)BLOCK_END)
                 read_blocks_with_decryption(
                     aes_key,
-                    read_fat_offset(aes_key, dir->entries[0].start_block), 1,
+                    read_fat_offset(ctx, dir->entries[0].start_block), 1,
                     dir);
         }
         cr_assert_eq(dir->entries[i % NB_ENTRIES_PER_BLOCK].used, 1);
     }
 
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -936,18 +973,21 @@ Test(entry_create_directory, embedded_directories, .timeout = 10,
         "build/tests/entry_create_directory.embedded_directories.test.shlkfs",
         "build/tests/entry_create_directory.embedded_directories.private.pem",
         NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_create_directory.embedded_directories.test.shlkfs",
+        aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
     struct CryptFS_Entry new_dir = { .used = 1,
@@ -967,7 +1007,7 @@ Test(entry_create_directory, embedded_directories, .timeout = 10,
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
 
     // adding Directory in Dossier Vacances
-    cr_assert_eq(entry_create_directory(aes_key, entry_id, "Dossier Secret"),
+    cr_assert_eq(entry_create_directory(ctx, entry_id, "Dossier Secret"),
                  0);
 
     // Update Dossier Vacances metadata
@@ -976,7 +1016,7 @@ Test(entry_create_directory, embedded_directories, .timeout = 10,
 
     struct CryptFS_Entry_ID vac_entry_id = { start_dossier_vac_block, 0 };
     // adding directory in the Dossier Secret
-    cr_assert_eq(entry_create_directory(aes_key, vac_entry_id, "Treees Secret"),
+    cr_assert_eq(entry_create_directory(ctx, vac_entry_id, "Treees Secret"),
                  0);
 
     // Update Dossier Secret metadata
@@ -997,6 +1037,7 @@ Test(entry_create_directory, embedded_directories, .timeout = 10,
     cr_assert_str_eq(dir->entries[0].name, "Treees Secret");
 
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -1034,18 +1075,21 @@ Test(entry_create_hardlink, simple_hardlink, .timeout = 10,
     unsigned char *aes_key = extract_aes_key(
         "build/tests/entry_create_hardlink.simple_hardlink.test.shlkfs",
         "build/tests/entry_create_hardlink.simple_hardlink.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_create_hardlink.simple_hardlink.test.shlkfs",
+        aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
     struct CryptFS_Entry new_dir = { .used = 1,
@@ -1064,19 +1108,19 @@ Test(entry_create_hardlink, simple_hardlink, .timeout = 10,
 
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
     // adding Original File in TEST directory placed in dir_block[0]
-    entry_create_empty_file(aes_key, entry_id, "Original");
+    entry_create_empty_file(ctx, entry_id, "Original");
     // Update dir_block
     read_blocks_with_decryption(aes_key, dir_block, 1, dir);
     // Write into it
     size_t size = 17; // Eroor asan if > real size
     char *content = "Testing Hardlink";
     struct CryptFS_Entry_ID file_entry_id = { dir->entries[0].start_block, 0 };
-    entry_write_buffer(aes_key, file_entry_id, content, size);
+    entry_write_buffer(ctx, file_entry_id, content, size);
 
     // Update dir_block
     read_blocks_with_decryption(aes_key, dir_block, 1, dir);
     // Creating Hardlink
-    uint32_t res = entry_create_hardlink(aes_key, entry_id,
+    uint32_t res = entry_create_hardlink(ctx, entry_id,
                                          "Hardlink_to_Original", file_entry_id);
 
     // Check TEST directory metadata
@@ -1098,14 +1142,15 @@ Test(entry_create_hardlink, simple_hardlink, .timeout = 10,
     // buff
     char *buff1 = malloc(size);
     char *buff2 = malloc(size);
-    entry_read_raw_data(aes_key, file_original_entry_id, 0, buff1, size);
-    entry_read_raw_data(aes_key, file_hard_entry_id, 0, buff2, size);
+    entry_read_raw_data(ctx, file_original_entry_id, 0, buff1, size);
+    entry_read_raw_data(ctx, file_hard_entry_id, 0, buff2, size);
     cr_assert_str_eq(buff1, buff2);
     cr_assert_eq(res, 1);
 
     free(buff1);
     free(buff2);
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -1143,18 +1188,20 @@ Test(entry_create_symlink, simple_symlink, .timeout = 10,
     unsigned char *aes_key = extract_aes_key(
         "build/tests/entry_create_symlink.simple_symlink.test.shlkfs",
         "build/tests/entry_create_symlink.simple_symlink.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_create_symlink.simple_symlink.test.shlkfs", aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
     struct CryptFS_Entry new_dir = { .used = 1,
@@ -1175,7 +1222,7 @@ Test(entry_create_symlink, simple_symlink, .timeout = 10,
     char *path = "/usr/bin/shlkfs";
     char *name = "Symlink_test";
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
-    uint32_t res = entry_create_symlink(aes_key, entry_id, name, path);
+    uint32_t res = entry_create_symlink(ctx, entry_id, name, path);
 
     // Update dir_block
     read_blocks_with_decryption(aes_key, dir_block, 1, dir);
@@ -1195,11 +1242,12 @@ Test(entry_create_symlink, simple_symlink, .timeout = 10,
     struct CryptFS_Entry_ID file_entry_id = { TEST_entry.start_block, 0 };
     // buff
     char *buff1 = malloc(strlen(path));
-    entry_read_raw_data(aes_key, file_entry_id, 0, buff1, strlen(path));
+    entry_read_raw_data(ctx, file_entry_id, 0, buff1, strlen(path));
     cr_assert_eq(res, 0);
 
     free(buff1);
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -1236,18 +1284,20 @@ Test(entry_create_symlink, bad_path_ascii, .timeout = 10,
     unsigned char *aes_key = extract_aes_key(
         "build/tests/entry_create_symlink.bad_path_ascii.test.shlkfs",
         "build/tests/entry_create_symlink.bad_path_ascii.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/entry_create_symlink.bad_path_ascii.test.shlkfs", aes_key);
 
     write_blocks_with_encryption(aes_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(aes_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
     // Create a directory
-    int64_t dir_block = find_first_free_block_safe(aes_key);
+    int64_t dir_block = find_first_free_block_safe(ctx);
     struct CryptFS_Directory *dir = xaligned_alloc(
         CRYPTFS_BLOCK_SIZE_BYTES, 1, sizeof(struct CryptFS_Directory));
 
     // Update FAT
-    write_fat_offset(aes_key, dir_block, BLOCK_END);
+    write_fat_offset(ctx, dir_block, BLOCK_END);
 
     // Create an entry
     struct CryptFS_Entry new_dir = { .used = 1,
@@ -1268,11 +1318,12 @@ Test(entry_create_symlink, bad_path_ascii, .timeout = 10,
     char *path = "/usr/bin$*!你好@(#_++=/shlkfs";
     char *name = "Symlink_test";
     struct CryptFS_Entry_ID entry_id = { dir_block, 0 };
-    uint32_t res = entry_create_symlink(aes_key, entry_id, name, path);
+    uint32_t res = entry_create_symlink(ctx, entry_id, name, path);
 
     cr_assert_eq(res, BLOCK_ERROR);
 
     free(dir);
+    shlkfs_ctx_close(ctx);
     free(aes_key);
     free(shlkfs);
 }
@@ -1289,17 +1340,17 @@ Test(get_entry_by_path, root, .init = cr_redirect_stdall, .timeout = 10)
               "build/tests/get_entry_by_path.root.private.pem", "label", NULL,
               NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/get_entry_by_path.root.test.shlkfs",
         "build/tests/get_entry_by_path.root.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
     free(entry_id);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, not_existing, .init = cr_redirect_stdall, .timeout = 10)
@@ -1315,14 +1366,14 @@ Test(get_entry_by_path, not_existing, .init = cr_redirect_stdall, .timeout = 10)
               "build/tests/get_entry_by_path.not_existing.private.pem", "label",
               NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/get_entry_by_path.not_existing.test.shlkfs",
         "build/tests/get_entry_by_path.not_existing.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/not_existing");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/not_existing");
 
     cr_assert_eq(entry_id, ENTRY_NO_SUCH);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, not_existing_ending_slash, .init = cr_redirect_stdall,
@@ -1342,14 +1393,15 @@ Test(get_entry_by_path, not_existing_ending_slash, .init = cr_redirect_stdall,
         "build/tests/get_entry_by_path.not_existing_ending_slash.private.pem",
         "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/get_entry_by_path.not_existing_ending_slash.test.shlkfs",
         "build/tests/get_entry_by_path.not_existing_ending_slash.private.pem");
 
     struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/not_existing/");
+        get_entry_by_path(ctx, "/not_existing/");
 
     cr_assert_eq(entry_id, ENTRY_NO_SUCH);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, create_single_file, .init = cr_redirect_stdall,
@@ -1367,20 +1419,19 @@ Test(get_entry_by_path, create_single_file, .init = cr_redirect_stdall,
               "build/tests/get_entry_by_path.create_single_file.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/get_entry_by_path.create_single_file.test.shlkfs",
         "build/tests/get_entry_by_path.create_single_file.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_empty_file(fpi_get_master_key(), *entry_id, "test_file");
+    entry_create_empty_file(ctx, *entry_id, "test_file");
 
     struct CryptFS_Entry_ID *entry_id_test_file =
-        get_entry_by_path(fpi_get_master_key(), "/test_file");
+        get_entry_by_path(ctx, "/test_file");
 
     cr_assert_neq(entry_id_test_file, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_file->directory_block, ROOT_DIR_BLOCK,
@@ -1390,6 +1441,7 @@ Test(get_entry_by_path, create_single_file, .init = cr_redirect_stdall,
 
     free(entry_id);
     free(entry_id_test_file);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, create_two_file, .init = cr_redirect_stdall,
@@ -1407,28 +1459,27 @@ Test(get_entry_by_path, create_two_file, .init = cr_redirect_stdall,
               "build/tests/get_entry_by_path.create_two_file.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/get_entry_by_path.create_two_file.test.shlkfs",
         "build/tests/get_entry_by_path.create_two_file.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_empty_file(fpi_get_master_key(), *entry_id, "test_file");
-    entry_create_empty_file(fpi_get_master_key(), *entry_id, "test_file2");
+    entry_create_empty_file(ctx, *entry_id, "test_file");
+    entry_create_empty_file(ctx, *entry_id, "test_file2");
 
     struct CryptFS_Entry_ID *entry_id_test_file =
-        get_entry_by_path(fpi_get_master_key(), "/test_file");
+        get_entry_by_path(ctx, "/test_file");
 
     cr_assert_neq(entry_id_test_file, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_file->directory_block, ROOT_DIR_BLOCK);
     cr_assert_eq(entry_id_test_file->directory_index, 0);
 
     struct CryptFS_Entry_ID *entry_id_test_file2 =
-        get_entry_by_path(fpi_get_master_key(), "/test_file2");
+        get_entry_by_path(ctx, "/test_file2");
 
     cr_assert_neq(entry_id_test_file2, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_file2->directory_block, ROOT_DIR_BLOCK);
@@ -1437,6 +1488,7 @@ Test(get_entry_by_path, create_two_file, .init = cr_redirect_stdall,
     free(entry_id);
     free(entry_id_test_file);
     free(entry_id_test_file2);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, create_one_file_one_non_existing,
@@ -1459,26 +1511,26 @@ Test(get_entry_by_path, create_one_file_one_non_existing,
               "get_entry_by_path.create_one_file_one_non_existing.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/"
         "get_entry_by_path.create_one_file_one_non_existing.test.shlkfs",
         "build/tests/"
         "get_entry_by_path.create_one_file_one_non_existing.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_empty_file(fpi_get_master_key(), *entry_id, "test_file");
+    entry_create_empty_file(ctx, *entry_id, "test_file");
 
     struct CryptFS_Entry_ID *entry_id_non_existing =
-        get_entry_by_path(fpi_get_master_key(), "/non_existing");
+        get_entry_by_path(ctx, "/non_existing");
 
     cr_assert_eq(entry_id_non_existing, ENTRY_NO_SUCH);
 
     free(entry_id);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, create_one_directory, .init = cr_redirect_stdall,
@@ -1496,20 +1548,19 @@ Test(get_entry_by_path, create_one_directory, .init = cr_redirect_stdall,
               "build/tests/get_entry_by_path.create_one_directory.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/get_entry_by_path.create_one_directory.test.shlkfs",
         "build/tests/get_entry_by_path.create_one_directory.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id, "test_directory");
+    entry_create_directory(ctx, *entry_id, "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory");
+        get_entry_by_path(ctx, "/test_directory");
 
     cr_assert_neq(entry_id_test_directory, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory->directory_block, ROOT_DIR_BLOCK);
@@ -1517,6 +1568,7 @@ Test(get_entry_by_path, create_one_directory, .init = cr_redirect_stdall,
 
     free(entry_id);
     free(entry_id_test_directory);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, create_one_directory_ending_slash,
@@ -1539,22 +1591,21 @@ Test(get_entry_by_path, create_one_directory_ending_slash,
               "get_entry_by_path.create_one_directory_ending_slash.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/"
         "get_entry_by_path.create_one_directory_ending_slash.test.shlkfs",
         "build/tests/"
         "get_entry_by_path.create_one_directory_ending_slash.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id, "test_directory");
+    entry_create_directory(ctx, *entry_id, "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/");
+        get_entry_by_path(ctx, "/test_directory/");
 
     cr_assert_neq(entry_id_test_directory, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory->directory_block, ROOT_DIR_BLOCK);
@@ -1562,6 +1613,7 @@ Test(get_entry_by_path, create_one_directory_ending_slash,
 
     free(entry_id);
     free(entry_id_test_directory);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, create_two_directory, .init = cr_redirect_stdall,
@@ -1579,28 +1631,27 @@ Test(get_entry_by_path, create_two_directory, .init = cr_redirect_stdall,
               "build/tests/get_entry_by_path.create_two_directory.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/get_entry_by_path.create_two_directory.test.shlkfs",
         "build/tests/get_entry_by_path.create_two_directory.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id, "test_directory");
-    entry_create_directory(fpi_get_master_key(), *entry_id, "test_directory2");
+    entry_create_directory(ctx, *entry_id, "test_directory");
+    entry_create_directory(ctx, *entry_id, "test_directory2");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory");
+        get_entry_by_path(ctx, "/test_directory");
 
     cr_assert_neq(entry_id_test_directory, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory->directory_block, ROOT_DIR_BLOCK);
     cr_assert_eq(entry_id_test_directory->directory_index, 0);
 
     struct CryptFS_Entry_ID *entry_id_test_directory2 =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory2");
+        get_entry_by_path(ctx, "/test_directory2");
 
     cr_assert_neq(entry_id_test_directory2, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory2->directory_block, ROOT_DIR_BLOCK);
@@ -1609,6 +1660,7 @@ Test(get_entry_by_path, create_two_directory, .init = cr_redirect_stdall,
     free(entry_id);
     free(entry_id_test_directory);
     free(entry_id_test_directory2);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, one_file_in_one_dir, .init = cr_redirect_stdall,
@@ -1626,33 +1678,32 @@ Test(get_entry_by_path, one_file_in_one_dir, .init = cr_redirect_stdall,
               "build/tests/get_entry_by_path.one_file_in_one_dir.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/get_entry_by_path.one_file_in_one_dir.test.shlkfs",
         "build/tests/get_entry_by_path.one_file_in_one_dir.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id, "test_directory");
+    entry_create_directory(ctx, *entry_id, "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory");
+        get_entry_by_path(ctx, "/test_directory");
 
     cr_assert_neq(entry_id_test_directory, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory->directory_block, ROOT_DIR_BLOCK);
     cr_assert_eq(entry_id_test_directory->directory_index, 0);
 
-    entry_create_empty_file(fpi_get_master_key(), *entry_id_test_directory,
+    entry_create_empty_file(ctx, *entry_id_test_directory,
                             "test_file");
 
     // Get entry from ID
     struct CryptFS_Entry *test_directory =
-        get_entry_from_id(fpi_get_master_key(), *entry_id_test_directory);
+        get_entry_from_id(ctx, *entry_id_test_directory);
     struct CryptFS_Entry_ID *entry_id_test_file =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/test_file");
+        get_entry_by_path(ctx, "/test_directory/test_file");
 
     cr_assert_neq(entry_id_test_file, ENTRY_NO_SUCH);
     cr_assert_eq(
@@ -1665,6 +1716,7 @@ Test(get_entry_by_path, one_file_in_one_dir, .init = cr_redirect_stdall,
     free(entry_id);
     free(entry_id_test_directory);
     free(entry_id_test_file);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, two_file_in_one_dir, .init = cr_redirect_stdall,
@@ -1682,35 +1734,34 @@ Test(get_entry_by_path, two_file_in_one_dir, .init = cr_redirect_stdall,
               "build/tests/get_entry_by_path.two_file_in_one_dir.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/get_entry_by_path.two_file_in_one_dir.test.shlkfs",
         "build/tests/get_entry_by_path.two_file_in_one_dir.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id, "test_directory");
+    entry_create_directory(ctx, *entry_id, "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory");
+        get_entry_by_path(ctx, "/test_directory");
 
     cr_assert_neq(entry_id_test_directory, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory->directory_block, ROOT_DIR_BLOCK);
     cr_assert_eq(entry_id_test_directory->directory_index, 0);
 
-    entry_create_empty_file(fpi_get_master_key(), *entry_id_test_directory,
+    entry_create_empty_file(ctx, *entry_id_test_directory,
                             "test_file");
-    entry_create_empty_file(fpi_get_master_key(), *entry_id_test_directory,
+    entry_create_empty_file(ctx, *entry_id_test_directory,
                             "test_file2");
 
     // Get entry from ID
     struct CryptFS_Entry *test_directory =
-        get_entry_from_id(fpi_get_master_key(), *entry_id_test_directory);
+        get_entry_from_id(ctx, *entry_id_test_directory);
     struct CryptFS_Entry_ID *entry_id_test_file =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/test_file");
+        get_entry_by_path(ctx, "/test_directory/test_file");
 
     cr_assert_neq(entry_id_test_file, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_file->directory_block,
@@ -1718,9 +1769,10 @@ Test(get_entry_by_path, two_file_in_one_dir, .init = cr_redirect_stdall,
     cr_assert_eq(entry_id_test_file->directory_index, 0);
 
     struct CryptFS_Entry_ID *entry_id_test_file2 =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/test_file2");
+        get_entry_by_path(ctx, "/test_directory/test_file2");
 
     cr_assert_neq(entry_id_test_file2, ENTRY_NO_SUCH);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, one_dir_in_one_dir, .init = cr_redirect_stdall,
@@ -1738,33 +1790,32 @@ Test(get_entry_by_path, one_dir_in_one_dir, .init = cr_redirect_stdall,
               "build/tests/get_entry_by_path.one_dir_in_one_dir.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/get_entry_by_path.one_dir_in_one_dir.test.shlkfs",
         "build/tests/get_entry_by_path.one_dir_in_one_dir.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id, "test_directory");
+    entry_create_directory(ctx, *entry_id, "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory");
+        get_entry_by_path(ctx, "/test_directory");
 
     cr_assert_neq(entry_id_test_directory, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory->directory_block, ROOT_DIR_BLOCK);
     cr_assert_eq(entry_id_test_directory->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id_test_directory,
+    entry_create_directory(ctx, *entry_id_test_directory,
                            "test_directory2");
     // Get entry from ID
     struct CryptFS_Entry *test_directory =
-        get_entry_from_id(fpi_get_master_key(), *entry_id_test_directory);
+        get_entry_from_id(ctx, *entry_id_test_directory);
 
     struct CryptFS_Entry_ID *entry_id_test_directory2 = get_entry_by_path(
-        fpi_get_master_key(), "/test_directory/test_directory2");
+        ctx, "/test_directory/test_directory2");
 
     cr_assert_neq(entry_id_test_directory2, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory2->directory_block,
@@ -1774,6 +1825,7 @@ Test(get_entry_by_path, one_dir_in_one_dir, .init = cr_redirect_stdall,
     free(entry_id);
     free(entry_id_test_directory);
     free(entry_id_test_directory2);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, one_dir_in_one_dir_ending_slash,
@@ -1797,35 +1849,34 @@ Test(get_entry_by_path, one_dir_in_one_dir_ending_slash,
               "get_entry_by_path.one_dir_in_one_dir_ending_slash.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/"
         "get_entry_by_path.one_dir_in_one_dir_ending_slash.test.shlkfs",
         "build/tests/"
         "get_entry_by_path.one_dir_in_one_dir_ending_slash.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id, "test_directory");
+    entry_create_directory(ctx, *entry_id, "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory");
+        get_entry_by_path(ctx, "/test_directory");
 
     cr_assert_neq(entry_id_test_directory, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory->directory_block, ROOT_DIR_BLOCK);
     cr_assert_eq(entry_id_test_directory->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id_test_directory,
+    entry_create_directory(ctx, *entry_id_test_directory,
                            "test_directory2");
     // Get entry from ID
     struct CryptFS_Entry *test_directory =
-        get_entry_from_id(fpi_get_master_key(), *entry_id_test_directory);
+        get_entry_from_id(ctx, *entry_id_test_directory);
 
     struct CryptFS_Entry_ID *entry_id_test_directory2 = get_entry_by_path(
-        fpi_get_master_key(), "/test_directory/test_directory2/");
+        ctx, "/test_directory/test_directory2/");
 
     cr_assert_neq(entry_id_test_directory2, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory2->directory_block,
@@ -1835,6 +1886,7 @@ Test(get_entry_by_path, one_dir_in_one_dir_ending_slash,
     free(entry_id);
     free(entry_id_test_directory);
     free(entry_id_test_directory2);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, two_dir_in_one_dir, .init = cr_redirect_stdall,
@@ -1852,33 +1904,32 @@ Test(get_entry_by_path, two_dir_in_one_dir, .init = cr_redirect_stdall,
               "build/tests/get_entry_by_path.two_dir_in_one_dir.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/get_entry_by_path.two_dir_in_one_dir.test.shlkfs",
         "build/tests/get_entry_by_path.two_dir_in_one_dir.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id, "test_directory");
+    entry_create_directory(ctx, *entry_id, "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/");
+        get_entry_by_path(ctx, "/test_directory/");
 
     cr_assert_neq(entry_id_test_directory, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory->directory_block, ROOT_DIR_BLOCK);
     cr_assert_eq(entry_id_test_directory->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id_test_directory,
+    entry_create_directory(ctx, *entry_id_test_directory,
                            "test_directory2");
     // Get entry from ID
     struct CryptFS_Entry *test_directory =
-        get_entry_from_id(fpi_get_master_key(), *entry_id_test_directory);
+        get_entry_from_id(ctx, *entry_id_test_directory);
 
     struct CryptFS_Entry_ID *entry_id_test_directory2 = get_entry_by_path(
-        fpi_get_master_key(), "/test_directory/test_directory2");
+        ctx, "/test_directory/test_directory2");
 
     cr_assert_neq(entry_id_test_directory2, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory2->directory_block,
@@ -1886,11 +1937,11 @@ Test(get_entry_by_path, two_dir_in_one_dir, .init = cr_redirect_stdall,
     cr_assert_eq(entry_id_test_directory2->directory_index, 0);
 
     // Create a third directory /test_directory/test_directory3
-    entry_create_directory(fpi_get_master_key(), *entry_id_test_directory,
+    entry_create_directory(ctx, *entry_id_test_directory,
                            "test_directory3");
 
     struct CryptFS_Entry_ID *entry_id_test_directory3 = get_entry_by_path(
-        fpi_get_master_key(), "/test_directory/test_directory3");
+        ctx, "/test_directory/test_directory3");
 
     cr_assert_neq(entry_id_test_directory3, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory3->directory_block,
@@ -1901,6 +1952,7 @@ Test(get_entry_by_path, two_dir_in_one_dir, .init = cr_redirect_stdall,
     free(entry_id_test_directory);
     free(entry_id_test_directory2);
     free(entry_id_test_directory3);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(get_entry_by_path, one_file_and_one_dir_in_one_dir,
@@ -1923,47 +1975,46 @@ Test(get_entry_by_path, one_file_and_one_dir_in_one_dir,
               "get_entry_by_path.one_file_and_one_dir_in_one_dir.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/"
         "get_entry_by_path.one_file_and_one_dir_in_one_dir.test.shlkfs",
         "build/tests/"
         "get_entry_by_path.one_file_and_one_dir_in_one_dir.private.pem");
 
-    struct CryptFS_Entry_ID *entry_id =
-        get_entry_by_path(fpi_get_master_key(), "/");
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/");
 
     cr_assert_eq(entry_id->directory_block, ROOT_ENTRY_BLOCK);
     cr_assert_eq(entry_id->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id, "test_directory");
+    entry_create_directory(ctx, *entry_id, "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory");
+        get_entry_by_path(ctx, "/test_directory");
 
     cr_assert_neq(entry_id_test_directory, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory->directory_block, ROOT_DIR_BLOCK);
     cr_assert_eq(entry_id_test_directory->directory_index, 0);
 
-    entry_create_empty_file(fpi_get_master_key(), *entry_id_test_directory,
+    entry_create_empty_file(ctx, *entry_id_test_directory,
                             "test_file");
 
     // Get entry from ID
     struct CryptFS_Entry *test_directory =
-        get_entry_from_id(fpi_get_master_key(), *entry_id_test_directory);
+        get_entry_from_id(ctx, *entry_id_test_directory);
 
     struct CryptFS_Entry_ID *entry_id_test_file =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/test_file");
+        get_entry_by_path(ctx, "/test_directory/test_file");
 
     cr_assert_neq(entry_id_test_file, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_file->directory_block,
                  test_directory->start_block);
     cr_assert_eq(entry_id_test_file->directory_index, 0);
 
-    entry_create_directory(fpi_get_master_key(), *entry_id_test_directory,
+    entry_create_directory(ctx, *entry_id_test_directory,
                            "test_directory2");
 
     struct CryptFS_Entry_ID *entry_id_test_directory2 = get_entry_by_path(
-        fpi_get_master_key(), "/test_directory/test_directory2");
+        ctx, "/test_directory/test_directory2");
 
     cr_assert_neq(entry_id_test_directory2, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_directory2->directory_block,
@@ -1973,6 +2024,7 @@ Test(get_entry_by_path, one_file_and_one_dir_in_one_dir,
     free(entry_id);
     free(entry_id_test_directory);
     free(entry_id_test_file);
+    shlkfs_ctx_close(ctx);
 }
 
 // create_file_by_path
@@ -1989,19 +2041,18 @@ Test(create_file_by_path, root, .init = cr_redirect_stdall, .timeout = 10)
               "build/tests/create_file_by_path.root.private.pem", "label", NULL,
               NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/create_file_by_path.root.test.shlkfs",
         "build/tests/create_file_by_path.root.private.pem");
 
     // Create file and remember its entry ID
-    struct CryptFS_Entry_ID *entry_id =
-        create_file_by_path(fpi_get_master_key(), "/test_file");
+    struct CryptFS_Entry_ID *entry_id = create_file_by_path(ctx, "/test_file");
 
     cr_assert_neq(entry_id, ENTRY_NO_SUCH);
 
     // Get file entry ID
     struct CryptFS_Entry_ID *entry_id_test_file =
-        get_entry_by_path(fpi_get_master_key(), "/test_file");
+        get_entry_by_path(ctx, "/test_file");
 
     // Check if the entry ID is correct
     cr_assert_neq(entry_id_test_file, ENTRY_NO_SUCH);
@@ -2012,6 +2063,7 @@ Test(create_file_by_path, root, .init = cr_redirect_stdall, .timeout = 10)
 
     free(entry_id);
     free(entry_id_test_file);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(create_file_by_path, root_already_exists, .init = cr_redirect_stdall,
@@ -2029,24 +2081,24 @@ Test(create_file_by_path, root_already_exists, .init = cr_redirect_stdall,
               "build/tests/create_file_by_path.root_already_exists.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/create_file_by_path.root_already_exists.test.shlkfs",
         "build/tests/create_file_by_path.root_already_exists.private.pem");
 
     // Create file and remember its entry ID
-    struct CryptFS_Entry_ID *entry_id =
-        create_file_by_path(fpi_get_master_key(), "/test_file");
+    struct CryptFS_Entry_ID *entry_id = create_file_by_path(ctx, "/test_file");
 
     cr_assert_neq(entry_id, ENTRY_NO_SUCH);
 
     // Create file again
     struct CryptFS_Entry_ID *entry_id_test_file =
-        create_file_by_path(fpi_get_master_key(), "/test_file");
+        create_file_by_path(ctx, "/test_file");
 
     // Check if the entry ID is correct
     cr_assert_eq(entry_id_test_file, ENTRY_EXISTS);
 
     free(entry_id);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(create_file_by_path, in_directory_file, .init = cr_redirect_stdall,
@@ -2064,7 +2116,7 @@ Test(create_file_by_path, in_directory_file, .init = cr_redirect_stdall,
               "build/tests/create_file_by_path.in_directory_file.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/create_file_by_path.in_directory_file.test.shlkfs",
         "build/tests/create_file_by_path.in_directory_file.private.pem");
 
@@ -2072,16 +2124,16 @@ Test(create_file_by_path, in_directory_file, .init = cr_redirect_stdall,
                                                            ROOT_ENTRY_BLOCK,
                                                        .directory_index = 0 };
 
-    entry_create_directory(fpi_get_master_key(), root_dirctory_entry_id,
+    entry_create_directory(ctx, root_dirctory_entry_id,
                            "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/");
+        get_entry_by_path(ctx, "/test_directory/");
 
     struct CryptFS_Entry_ID *entry_id =
-        create_file_by_path(fpi_get_master_key(), "/test_directory/test_file");
+        create_file_by_path(ctx, "/test_directory/test_file");
     struct CryptFS_Entry_ID *entry_id_test_file =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/test_file");
+        get_entry_by_path(ctx, "/test_directory/test_file");
 
     cr_assert_neq(entry_id, ENTRY_NO_SUCH);
     cr_assert_neq(entry_id, ENTRY_EXISTS);
@@ -2098,6 +2150,7 @@ Test(create_file_by_path, in_directory_file, .init = cr_redirect_stdall,
     free(entry_id);
     free(entry_id_test_file);
     free(entry_id_test_directory);
+    shlkfs_ctx_close(ctx);
 }
 
 // create_directory_by_path
@@ -2114,19 +2167,19 @@ Test(create_directory_by_path, root, .init = cr_redirect_stdall, .timeout = 10)
               "build/tests/create_directory_by_path.root.private.pem", "label",
               NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/create_directory_by_path.root.test.shlkfs",
         "build/tests/create_directory_by_path.root.private.pem");
 
     // Create directory and remember its entry ID
     struct CryptFS_Entry_ID *entry_id =
-        create_directory_by_path(fpi_get_master_key(), "/test_directory");
+        create_directory_by_path(ctx, "/test_directory");
 
     cr_assert_neq(entry_id, ENTRY_NO_SUCH);
 
     // Get directory entry ID
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory");
+        get_entry_by_path(ctx, "/test_directory");
 
     // Check if the entry ID is correct
     cr_assert_neq(entry_id_test_directory, ENTRY_NO_SUCH);
@@ -2137,6 +2190,7 @@ Test(create_directory_by_path, root, .init = cr_redirect_stdall, .timeout = 10)
 
     free(entry_id);
     free(entry_id_test_directory);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(create_directory_by_path, root_already_exists, .init = cr_redirect_stdall,
@@ -2156,24 +2210,25 @@ Test(create_directory_by_path, root_already_exists, .init = cr_redirect_stdall,
         "build/tests/create_directory_by_path.root_already_exists.private.pem",
         "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/create_directory_by_path.root_already_exists.test.shlkfs",
         "build/tests/create_directory_by_path.root_already_exists.private.pem");
 
     // Create directory and remember its entry ID
     struct CryptFS_Entry_ID *entry_id =
-        create_directory_by_path(fpi_get_master_key(), "/test_directory");
+        create_directory_by_path(ctx, "/test_directory");
 
     cr_assert_neq(entry_id, ENTRY_NO_SUCH);
 
     // Create directory again
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        create_directory_by_path(fpi_get_master_key(), "/test_directory");
+        create_directory_by_path(ctx, "/test_directory");
 
     // Check if the entry ID is correct
     cr_assert_eq(entry_id_test_directory, ENTRY_EXISTS);
 
     free(entry_id);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(create_directory_by_path, in_directory_directory,
@@ -2196,7 +2251,7 @@ Test(create_directory_by_path, in_directory_directory,
               "create_directory_by_path.in_directory_directory.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/"
         "create_directory_by_path.in_directory_directory.test.shlkfs",
         "build/tests/"
@@ -2206,16 +2261,16 @@ Test(create_directory_by_path, in_directory_directory,
                                                            ROOT_ENTRY_BLOCK,
                                                        .directory_index = 0 };
 
-    entry_create_directory(fpi_get_master_key(), root_dirctory_entry_id,
+    entry_create_directory(ctx, root_dirctory_entry_id,
                            "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/");
+        get_entry_by_path(ctx, "/test_directory/");
 
     struct CryptFS_Entry_ID *entry_id = create_directory_by_path(
-        fpi_get_master_key(), "/test_directory/test_directory2");
+        ctx, "/test_directory/test_directory2");
     struct CryptFS_Entry_ID *entry_id_test_directory2 = get_entry_by_path(
-        fpi_get_master_key(), "/test_directory/test_directory2");
+        ctx, "/test_directory/test_directory2");
 
     cr_assert_neq(entry_id, ENTRY_NO_SUCH);
     cr_assert_neq(entry_id, ENTRY_EXISTS);
@@ -2232,6 +2287,7 @@ Test(create_directory_by_path, in_directory_directory,
     free(entry_id);
     free(entry_id_test_directory2);
     free(entry_id_test_directory);
+    shlkfs_ctx_close(ctx);
 }
 
 // create_symlink_by_path
@@ -2248,19 +2304,19 @@ Test(create_symlink_by_path, root, .init = cr_redirect_stdall, .timeout = 10)
               "build/tests/create_symlink_by_path.root.private.pem", "label",
               NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/create_symlink_by_path.root.test.shlkfs",
         "build/tests/create_symlink_by_path.root.private.pem");
 
     // Create symlink and remember its entry ID
     struct CryptFS_Entry_ID *entry_id = create_symlink_by_path(
-        fpi_get_master_key(), "/test_symlink", "/test_symlink_target");
+        ctx, "/test_symlink", "/test_symlink_target");
 
     cr_assert_neq(entry_id, ENTRY_NO_SUCH);
 
     // Get symlink entry ID
     struct CryptFS_Entry_ID *entry_id_test_symlink =
-        get_entry_by_path(fpi_get_master_key(), "/test_symlink");
+        get_entry_by_path(ctx, "/test_symlink");
 
     // Check if the entry ID is correct
     cr_assert_neq(entry_id_test_symlink, ENTRY_NO_SUCH);
@@ -2271,6 +2327,7 @@ Test(create_symlink_by_path, root, .init = cr_redirect_stdall, .timeout = 10)
 
     free(entry_id);
     free(entry_id_test_symlink);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(create_symlink_by_path, root_already_exists, .init = cr_redirect_stdall,
@@ -2290,24 +2347,25 @@ Test(create_symlink_by_path, root_already_exists, .init = cr_redirect_stdall,
         "build/tests/create_symlink_by_path.root_already_exists.private.pem",
         "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/create_symlink_by_path.root_already_exists.test.shlkfs",
         "build/tests/create_symlink_by_path.root_already_exists.private.pem");
 
     // Create symlink and remember its entry ID
     struct CryptFS_Entry_ID *entry_id = create_symlink_by_path(
-        fpi_get_master_key(), "/test_symlink", "/test_symlink_target");
+        ctx, "/test_symlink", "/test_symlink_target");
 
     cr_assert_neq(entry_id, ENTRY_NO_SUCH);
 
     // Create symlink again
     struct CryptFS_Entry_ID *entry_id_test_symlink = create_symlink_by_path(
-        fpi_get_master_key(), "/test_symlink", "/test_symlink_target");
+        ctx, "/test_symlink", "/test_symlink_target");
 
     // Check if the entry ID is correct
     cr_assert_eq(entry_id_test_symlink, ENTRY_EXISTS);
 
     free(entry_id);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(create_symlink_by_path, in_directory_symlink, .init = cr_redirect_stdall,
@@ -2327,7 +2385,7 @@ Test(create_symlink_by_path, in_directory_symlink, .init = cr_redirect_stdall,
         "build/tests/create_symlink_by_path.in_directory_symlink.private.pem",
         "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/create_symlink_by_path.in_directory_symlink.test.shlkfs",
         "build/tests/create_symlink_by_path.in_directory_symlink.private.pem");
 
@@ -2335,17 +2393,17 @@ Test(create_symlink_by_path, in_directory_symlink, .init = cr_redirect_stdall,
                                                            ROOT_ENTRY_BLOCK,
                                                        .directory_index = 0 };
 
-    entry_create_directory(fpi_get_master_key(), root_dirctory_entry_id,
+    entry_create_directory(ctx, root_dirctory_entry_id,
                            "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/");
+        get_entry_by_path(ctx, "/test_directory/");
 
     struct CryptFS_Entry_ID *entry_id = create_symlink_by_path(
-        fpi_get_master_key(), "/test_directory/test_symlink",
+        ctx, "/test_directory/test_symlink",
         "/test_directory/test_symlink_target");
     struct CryptFS_Entry_ID *entry_id_test_symlink =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/test_symlink");
+        get_entry_by_path(ctx, "/test_directory/test_symlink");
 
     cr_assert_neq(entry_id, ENTRY_NO_SUCH);
     cr_assert_neq(entry_id, ENTRY_EXISTS);
@@ -2362,6 +2420,7 @@ Test(create_symlink_by_path, in_directory_symlink, .init = cr_redirect_stdall,
     free(entry_id);
     free(entry_id_test_symlink);
     free(entry_id_test_directory);
+    shlkfs_ctx_close(ctx);
 }
 
 // create_hardlink_by_path
@@ -2378,22 +2437,22 @@ Test(create_hardlink_by_path, root, .init = cr_redirect_stdall, .timeout = 10)
               "build/tests/create_hardlink_by_path.root.private.pem", "label",
               NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/create_hardlink_by_path.root.test.shlkfs",
         "build/tests/create_hardlink_by_path.root.private.pem");
 
     struct CryptFS_Entry_ID *entry_id =
-        create_file_by_path(fpi_get_master_key(), "/test_hardlink_target");
+        create_file_by_path(ctx, "/test_hardlink_target");
 
     // Create hardlink and remember its entry ID
     struct CryptFS_Entry_ID *hardlink_entry_id = create_hardlink_by_path(
-        fpi_get_master_key(), "/test_hardlink", "/test_hardlink_target");
+        ctx, "/test_hardlink", "/test_hardlink_target");
 
     cr_assert_neq(hardlink_entry_id, ENTRY_NO_SUCH);
 
     // Get hardlink entry ID
     struct CryptFS_Entry_ID *entry_id_test_hardlink =
-        get_entry_by_path(fpi_get_master_key(), "/test_hardlink");
+        get_entry_by_path(ctx, "/test_hardlink");
 
     // Check if the entry ID is correct
     cr_assert_neq(entry_id_test_hardlink, ENTRY_NO_SUCH);
@@ -2405,6 +2464,7 @@ Test(create_hardlink_by_path, root, .init = cr_redirect_stdall, .timeout = 10)
     free(entry_id);
     free(hardlink_entry_id);
     free(entry_id_test_hardlink);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(create_hardlink_by_path, root_already_exists, .init = cr_redirect_stdall,
@@ -2424,28 +2484,29 @@ Test(create_hardlink_by_path, root_already_exists, .init = cr_redirect_stdall,
         "build/tests/create_hardlink_by_path.root_already_exists.private.pem",
         "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/create_hardlink_by_path.root_already_exists.test.shlkfs",
         "build/tests/create_hardlink_by_path.root_already_exists.private.pem");
 
     struct CryptFS_Entry_ID *entry_id =
-        create_file_by_path(fpi_get_master_key(), "/test_hardlink_target");
+        create_file_by_path(ctx, "/test_hardlink_target");
 
     // Create hardlink and remember its entry ID
     struct CryptFS_Entry_ID *hardlink_entry_id = create_hardlink_by_path(
-        fpi_get_master_key(), "/test_hardlink", "/test_hardlink_target");
+        ctx, "/test_hardlink", "/test_hardlink_target");
 
     cr_assert_neq(hardlink_entry_id, ENTRY_NO_SUCH);
 
     // Create hardlink again
     struct CryptFS_Entry_ID *entry_id_test_hardlink = create_hardlink_by_path(
-        fpi_get_master_key(), "/test_hardlink", "/test_hardlink_target");
+        ctx, "/test_hardlink", "/test_hardlink_target");
 
     // Check if the entry ID is correct
     cr_assert_eq(entry_id_test_hardlink, ENTRY_EXISTS);
 
     free(entry_id);
     free(hardlink_entry_id);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(create_hardlink_by_path, in_directory_hardlink, .init = cr_redirect_stdall,
@@ -2466,7 +2527,7 @@ Test(create_hardlink_by_path, in_directory_hardlink, .init = cr_redirect_stdall,
         "build/tests/create_hardlink_by_path.in_directory_hardlink.private.pem",
         "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/create_hardlink_by_path.in_directory_hardlink.test.shlkfs",
         "build/tests/"
         "create_hardlink_by_path.in_directory_hardlink.private.pem");
@@ -2475,25 +2536,25 @@ Test(create_hardlink_by_path, in_directory_hardlink, .init = cr_redirect_stdall,
                                                            ROOT_ENTRY_BLOCK,
                                                        .directory_index = 0 };
 
-    entry_create_directory(fpi_get_master_key(), root_dirctory_entry_id,
+    entry_create_directory(ctx, root_dirctory_entry_id,
                            "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/");
+        get_entry_by_path(ctx, "/test_directory/");
 
     struct CryptFS_Entry_ID *entry_id =
-        create_file_by_path(fpi_get_master_key(), "/test_directory/test_file");
+        create_file_by_path(ctx, "/test_directory/test_file");
 
     // Create hardlink and remember its entry ID
     struct CryptFS_Entry_ID *hardlink_entry_id = create_hardlink_by_path(
-        fpi_get_master_key(), "/test_directory/test_hardlink",
+        ctx, "/test_directory/test_hardlink",
         "/test_directory/test_file");
 
     cr_assert_neq(hardlink_entry_id, ENTRY_NO_SUCH);
 
     // Get hardlink entry ID
     struct CryptFS_Entry_ID *entry_id_test_hardlink = get_entry_by_path(
-        fpi_get_master_key(), "/test_directory/test_hardlink");
+        ctx, "/test_directory/test_hardlink");
 
     // Check if the entry ID is correct
     cr_assert_neq(entry_id_test_hardlink, ENTRY_NO_SUCH);
@@ -2506,6 +2567,7 @@ Test(create_hardlink_by_path, in_directory_hardlink, .init = cr_redirect_stdall,
     free(hardlink_entry_id);
     free(entry_id_test_hardlink);
     free(entry_id_test_directory);
+    shlkfs_ctx_close(ctx);
 }
 
 // delete_entry_by_path
@@ -2522,21 +2584,22 @@ Test(delete_entry_by_path, root, .init = cr_redirect_stdall, .timeout = 10)
               "build/tests/delete_entry_by_path.root.private.pem", "label",
               NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/delete_entry_by_path.root.test.shlkfs",
         "build/tests/delete_entry_by_path.root.private.pem");
 
-    free(create_file_by_path(fpi_get_master_key(), "/test_file"));
+    free(create_file_by_path(ctx, "/test_file"));
 
     // Delete entry
-    cr_assert_eq(delete_entry_by_path(fpi_get_master_key(), "/test_file"), 0);
+    cr_assert_eq(delete_entry_by_path(ctx, "/test_file"), 0);
 
     // Get entry ID
     struct CryptFS_Entry_ID *entry_id_test_file =
-        get_entry_by_path(fpi_get_master_key(), "/test_file");
+        get_entry_by_path(ctx, "/test_file");
 
     // Check if the entry ID is correct
     cr_assert_eq(entry_id_test_file, ENTRY_NO_SUCH);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(delete_entry_by_path, root_not_exists, .init = cr_redirect_stdall,
@@ -2554,20 +2617,21 @@ Test(delete_entry_by_path, root_not_exists, .init = cr_redirect_stdall,
               "build/tests/delete_entry_by_path.root_not_exists.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/delete_entry_by_path.root_not_exists.test.shlkfs",
         "build/tests/delete_entry_by_path.root_not_exists.private.pem");
 
     // Delete entry
-    cr_assert_eq(delete_entry_by_path(fpi_get_master_key(), "/test_file"),
+    cr_assert_eq(delete_entry_by_path(ctx, "/test_file"),
                  ENTRY_NO_SUCH);
 
     // Get entry ID
     struct CryptFS_Entry_ID *entry_id_test_file =
-        get_entry_by_path(fpi_get_master_key(), "/test_file");
+        get_entry_by_path(ctx, "/test_file");
 
     // Check if the entry ID is correct
     cr_assert_eq(entry_id_test_file, ENTRY_NO_SUCH);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(delete_entry_by_path, in_directory_file, .init = cr_redirect_stdall,
@@ -2585,7 +2649,7 @@ Test(delete_entry_by_path, in_directory_file, .init = cr_redirect_stdall,
               "build/tests/delete_entry_by_path.in_directory_file.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/delete_entry_by_path.in_directory_file.test.shlkfs",
         "build/tests/delete_entry_by_path.in_directory_file.private.pem");
 
@@ -2593,30 +2657,31 @@ Test(delete_entry_by_path, in_directory_file, .init = cr_redirect_stdall,
                                                            ROOT_ENTRY_BLOCK,
                                                        .directory_index = 0 };
 
-    entry_create_directory(fpi_get_master_key(), root_dirctory_entry_id,
+    entry_create_directory(ctx, root_dirctory_entry_id,
                            "test_directory");
 
     struct CryptFS_Entry_ID *entry_id_test_directory =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/");
+        get_entry_by_path(ctx, "/test_directory/");
 
     struct CryptFS_Entry_ID *entry_id =
-        create_file_by_path(fpi_get_master_key(), "/test_directory/test_file");
+        create_file_by_path(ctx, "/test_directory/test_file");
 
     // Delete entry
-    cr_assert_eq(delete_entry_by_path(fpi_get_master_key(),
+    cr_assert_eq(delete_entry_by_path(ctx,
                                       "/test_directory/"
                                       "test_file"),
                  0);
 
     // Get entry ID
     struct CryptFS_Entry_ID *entry_id_test_file =
-        get_entry_by_path(fpi_get_master_key(), "/test_directory/test_file");
+        get_entry_by_path(ctx, "/test_directory/test_file");
 
     // Check if the entry ID is correct
     cr_assert_eq(entry_id_test_file, ENTRY_NO_SUCH);
 
     free(entry_id);
     free(entry_id_test_directory);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(goto_used_entry_in_directory, all_used_files, .init = cr_redirect_stdall,
@@ -2636,7 +2701,7 @@ Test(goto_used_entry_in_directory, all_used_files, .init = cr_redirect_stdall,
         "build/tests/goto_used_entry_in_directory.all_used_files.private.pem",
         "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/goto_used_entry_in_directory.all_used_files.test.shlkfs",
         "build/tests/goto_used_entry_in_directory.all_used_files.private.pem");
 
@@ -2645,14 +2710,14 @@ Test(goto_used_entry_in_directory, all_used_files, .init = cr_redirect_stdall,
                                                        .directory_index = 0 };
 
     struct CryptFS_Entry_ID *entry_id1 =
-        create_file_by_path(fpi_get_master_key(), "/test_file1");
+        create_file_by_path(ctx, "/test_file1");
     struct CryptFS_Entry_ID *entry_id2 =
-        create_file_by_path(fpi_get_master_key(), "/test_file2");
+        create_file_by_path(ctx, "/test_file2");
     struct CryptFS_Entry_ID *entry_id3 =
-        create_file_by_path(fpi_get_master_key(), "/test_file3");
+        create_file_by_path(ctx, "/test_file3");
 
     struct CryptFS_Entry_ID *entry_id_test_file1 = goto_used_entry_in_directory(
-        fpi_get_master_key(), root_dirctory_entry_id, 0);
+        ctx, root_dirctory_entry_id, 0);
 
     cr_assert_neq(entry_id_test_file1, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_file1->directory_block,
@@ -2664,6 +2729,7 @@ Test(goto_used_entry_in_directory, all_used_files, .init = cr_redirect_stdall,
     free(entry_id2);
     free(entry_id3);
     free(entry_id_test_file1);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(goto_used_entry_in_directory, first_file_deleted,
@@ -2687,7 +2753,7 @@ Test(goto_used_entry_in_directory, first_file_deleted,
               "goto_used_entry_in_directory.first_file_deleted.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/"
         "goto_used_entry_in_directory.first_file_deleted.test.shlkfs",
         "build/tests/"
@@ -2698,20 +2764,19 @@ Test(goto_used_entry_in_directory, first_file_deleted,
                                                        .directory_index = 0 };
 
     struct CryptFS_Entry_ID *entry_id1 =
-        create_file_by_path(fpi_get_master_key(), "/test_file1");
+        create_file_by_path(ctx, "/test_file1");
     struct CryptFS_Entry_ID *entry_id2 =
-        create_file_by_path(fpi_get_master_key(), "/test_file2");
+        create_file_by_path(ctx, "/test_file2");
     struct CryptFS_Entry_ID *entry_id3 =
-        create_file_by_path(fpi_get_master_key(), "/test_file3");
+        create_file_by_path(ctx, "/test_file3");
 
-    delete_entry_by_path(fpi_get_master_key(), "/test_file1");
+    delete_entry_by_path(ctx, "/test_file1");
 
     struct CryptFS_Entry_ID *entry_id_test_file2 = goto_used_entry_in_directory(
-        fpi_get_master_key(), root_dirctory_entry_id, 0);
+        ctx, root_dirctory_entry_id, 0);
 
     // Get entry 1 by ID
-    struct CryptFS_Entry *entry1 =
-        get_entry_from_id(fpi_get_master_key(), *entry_id1);
+    struct CryptFS_Entry *entry1 = get_entry_from_id(ctx, *entry_id1);
     cr_assert_neq(entry1, ENTRY_NO_SUCH);
     cr_assert_eq(entry1->used, 0);
 
@@ -2725,6 +2790,7 @@ Test(goto_used_entry_in_directory, first_file_deleted,
     free(entry_id2);
     free(entry_id3);
     free(entry_id_test_file2);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(goto_used_entry_in_directory, second_file_deleted,
@@ -2748,7 +2814,7 @@ Test(goto_used_entry_in_directory, second_file_deleted,
               "goto_used_entry_in_directory.second_file_deleted.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/"
         "goto_used_entry_in_directory.second_file_deleted.test.shlkfs",
         "build/tests/"
@@ -2759,20 +2825,19 @@ Test(goto_used_entry_in_directory, second_file_deleted,
                                                        .directory_index = 0 };
 
     struct CryptFS_Entry_ID *entry_id1 =
-        create_file_by_path(fpi_get_master_key(), "/test_file1");
+        create_file_by_path(ctx, "/test_file1");
     struct CryptFS_Entry_ID *entry_id2 =
-        create_file_by_path(fpi_get_master_key(), "/test_file2");
+        create_file_by_path(ctx, "/test_file2");
     struct CryptFS_Entry_ID *entry_id3 =
-        create_file_by_path(fpi_get_master_key(), "/test_file3");
+        create_file_by_path(ctx, "/test_file3");
 
-    delete_entry_by_path(fpi_get_master_key(), "/test_file2");
+    delete_entry_by_path(ctx, "/test_file2");
 
     struct CryptFS_Entry_ID *entry_id_test_file3 = goto_used_entry_in_directory(
-        fpi_get_master_key(), root_dirctory_entry_id, 1);
+        ctx, root_dirctory_entry_id, 1);
 
     // Get entry 2 by ID
-    struct CryptFS_Entry *entry2 =
-        get_entry_from_id(fpi_get_master_key(), *entry_id2);
+    struct CryptFS_Entry *entry2 = get_entry_from_id(ctx, *entry_id2);
     cr_assert_neq(entry2, ENTRY_NO_SUCH);
     cr_assert_eq(entry2->used, 0);
 
@@ -2786,6 +2851,7 @@ Test(goto_used_entry_in_directory, second_file_deleted,
     free(entry_id2);
     free(entry_id3);
     free(entry_id_test_file3);
+    shlkfs_ctx_close(ctx);
 }
 
 Test(goto_used_entry_in_directory, third_file_deleted,
@@ -2809,7 +2875,7 @@ Test(goto_used_entry_in_directory, third_file_deleted,
               "goto_used_entry_in_directory.third_file_deleted.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/"
         "goto_used_entry_in_directory.third_file_deleted.test.shlkfs",
         "build/tests/"
@@ -2820,20 +2886,19 @@ Test(goto_used_entry_in_directory, third_file_deleted,
                                                        .directory_index = 0 };
 
     struct CryptFS_Entry_ID *entry_id1 =
-        create_file_by_path(fpi_get_master_key(), "/test_file1");
+        create_file_by_path(ctx, "/test_file1");
     struct CryptFS_Entry_ID *entry_id2 =
-        create_file_by_path(fpi_get_master_key(), "/test_file2");
+        create_file_by_path(ctx, "/test_file2");
     struct CryptFS_Entry_ID *entry_id3 =
-        create_file_by_path(fpi_get_master_key(), "/test_file3");
+        create_file_by_path(ctx, "/test_file3");
 
-    delete_entry_by_path(fpi_get_master_key(), "/test_file3");
+    delete_entry_by_path(ctx, "/test_file3");
 
     struct CryptFS_Entry_ID *entry_id_test_file2 = goto_used_entry_in_directory(
-        fpi_get_master_key(), root_dirctory_entry_id, 1);
+        ctx, root_dirctory_entry_id, 1);
 
     // Get entry 3 by ID
-    struct CryptFS_Entry *entry3 =
-        get_entry_from_id(fpi_get_master_key(), *entry_id3);
+    struct CryptFS_Entry *entry3 = get_entry_from_id(ctx, *entry_id3);
     cr_assert_neq(entry3, ENTRY_NO_SUCH);
     cr_assert_eq(entry3->used, 0);
 
@@ -2847,6 +2912,7 @@ Test(goto_used_entry_in_directory, third_file_deleted,
     free(entry_id2);
     free(entry_id3);
     free(entry_id_test_file2);
+    shlkfs_ctx_close(ctx);
 }
 
 // ! FIXME: This test is disabled because it is not working as expected
@@ -2871,7 +2937,7 @@ Test(goto_used_entry_in_directory, 30_files_27_29_deleted,
               "goto_used_entry_in_directory.30_files_27_29_deleted.private.pem",
               "label", NULL, NULL);
 
-    fpi_register_master_key_from_path(
+    struct shlkfs_ctx *ctx = fpi_open_ctx_from_path(
         "build/tests/"
         "goto_used_entry_in_directory.30_files_27_29_deleted.test.shlkfs",
         "build/"
@@ -2887,14 +2953,14 @@ Test(goto_used_entry_in_directory, 30_files_27_29_deleted,
     {
         char path[100];
         sprintf(path, "/test_file%d", i);
-        entry_ids[i] = create_file_by_path(fpi_get_master_key(), path);
+        entry_ids[i] = create_file_by_path(ctx, path);
     }
 
     for (int i = 26; i < 28; i++)
     {
         char path[100];
         sprintf(path, "/test_file%d", i);
-        delete_entry_by_path(fpi_get_master_key(), path);
+        delete_entry_by_path(ctx, path);
     }
 
     // FIXME: entry_delete must use a sanitized block/index, not a
@@ -2902,10 +2968,10 @@ Test(goto_used_entry_in_directory, 30_files_27_29_deleted,
 
     // Ask entry index 25, must return 25
     struct CryptFS_Entry_ID *entry_id_test_file25 =
-        goto_used_entry_in_directory(fpi_get_master_key(),
+        goto_used_entry_in_directory(ctx,
                                      root_dirctory_entry_id, 25);
     // Index 25 entry
-    goto_entry_in_directory(fpi_get_master_key(), entry_ids[25]);
+    goto_entry_in_directory(ctx, entry_ids[25]);
 
     cr_assert_neq(entry_id_test_file25, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_file25->directory_block,
@@ -2918,10 +2984,10 @@ Test(goto_used_entry_in_directory, 30_files_27_29_deleted,
 
     // Ask entry index 26, must return 28
     struct CryptFS_Entry_ID *entry_id_test_file26 =
-        goto_used_entry_in_directory(fpi_get_master_key(),
+        goto_used_entry_in_directory(ctx,
                                      root_dirctory_entry_id, 26);
     // Index 29 entry
-    goto_entry_in_directory(fpi_get_master_key(), entry_ids[29]);
+    goto_entry_in_directory(ctx, entry_ids[29]);
 
     cr_assert_neq(entry_id_test_file26, ENTRY_NO_SUCH);
     cr_assert_eq(entry_id_test_file26->directory_block,
@@ -2934,7 +3000,7 @@ Test(goto_used_entry_in_directory, 30_files_27_29_deleted,
 
     // Ask entry index 27, must return ENTRY_NO_SUCH
     struct CryptFS_Entry_ID *entry_id_test_file27 =
-        goto_used_entry_in_directory(fpi_get_master_key(),
+        goto_used_entry_in_directory(ctx,
                                      root_dirctory_entry_id, 27);
 
     cr_assert_eq(entry_id_test_file27, ENTRY_NO_SUCH);
@@ -2943,4 +3009,5 @@ Test(goto_used_entry_in_directory, 30_files_27_29_deleted,
         free(entry_ids[i]);
 
     free(entry_id_test_file25);
+    shlkfs_ctx_close(ctx);
 }
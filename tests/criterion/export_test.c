@@ -0,0 +1,127 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "export.h"
+#include "import.h"
+#include "test_volume.h"
+
+void cr_redirect_stdall(void);
+
+// Size of the large file of the test tree (more than an export chunk)
+#define LARGE_FILE_SIZE (17 * 1024 * 1024 + 123)
+
+/**
+ * @brief Format a volume in an image file, and import a directory tree in
+ * it: /large (LARGE_FILE_SIZE bytes), /empty, /directory/small ("small\n")
+ * and /directory/link (-> small).
+ *
+ * @param name The name of the test (prefix of its files in build/tests).
+ */
+static void create_test_volume(const char *name)
+{
+    struct test_volume volume;
+    format_test_volume(name, 12000, &volume);
+
+    char command[1024];
+    snprintf(command, sizeof(command), "mkdir -p build/tests/%s.src/directory",
+             name);
+    cr_assert_eq(system(command), 0);
+
+    char path[256];
+    snprintf(path, sizeof(path), "build/tests/%s.src/large", name);
+    FILE *file = fopen(path, "w");
+    cr_assert_not_null(file);
+    for (size_t i = 0; i < LARGE_FILE_SIZE; i++)
+        fputc((i * 7) % 251, file);
+    fclose(file);
+
+    snprintf(path, sizeof(path), "build/tests/%s.src/empty", name);
+    file = fopen(path, "w");
+    fclose(file);
+
+    snprintf(path, sizeof(path), "build/tests/%s.src/directory/small", name);
+    file = fopen(path, "w");
+    fputs("small\n", file);
+    fclose(file);
+    chmod(path, 0640);
+
+    snprintf(path, sizeof(path), "build/tests/%s.src/directory/link", name);
+    cr_assert_eq(symlink("small", path), 0);
+
+    snprintf(path, sizeof(path), "build/tests/%s.src", name);
+    cr_assert_eq(
+        cryptfs_import(volume.device_path, path, volume.private_key_path), 0);
+}
+
+Test(export, directory, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("export.directory");
+
+    cr_assert_eq(cryptfs_export("build/tests/export.directory.test.shlkfs",
+                                "/", "build/tests/export.directory.dst",
+                                "build/tests/export.directory.private.pem"),
+                 0);
+    cr_assert_eq(system("diff -r --no-dereference "
+                        "build/tests/export.directory.src "
+                        "build/tests/export.directory.dst"),
+                 0);
+
+    struct stat st;
+    cr_assert_eq(
+        stat("build/tests/export.directory.dst/directory/small", &st), 0);
+    cr_assert_eq(st.st_mode & 07777, 0640);
+
+    // A file is exported under its name
+    cr_assert_eq(cryptfs_export("build/tests/export.directory.test.shlkfs",
+                                "/directory/small",
+                                "build/tests/export.directory.dst/file",
+                                "build/tests/export.directory.private.pem"),
+                 0);
+    cr_assert_eq(system("cmp build/tests/export.directory.src/directory/small "
+                        "build/tests/export.directory.dst/file/small"),
+                 0);
+}
+
+Test(export, tar_stream, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("export.tar_stream");
+
+    int fd = open("build/tests/export.tar_stream.tar",
+                  O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    cr_assert_geq(fd, 0);
+    fflush(stdout);
+    int stdout_fd = dup(STDOUT_FILENO);
+    cr_assert_eq(dup2(fd, STDOUT_FILENO), STDOUT_FILENO);
+    close(fd);
+
+    int res = cryptfs_export("build/tests/export.tar_stream.test.shlkfs",
+                             "/", "-",
+                             "build/tests/export.tar_stream.private.pem");
+    dup2(stdout_fd, STDOUT_FILENO);
+    close(stdout_fd);
+    cr_assert_eq(res, 0);
+
+    cr_assert_eq(system("mkdir -p build/tests/export.tar_stream.dst "
+                        "&& tar -C build/tests/export.tar_stream.dst -xf "
+                        "build/tests/export.tar_stream.tar "
+                        "&& diff -r --no-dereference "
+                        "build/tests/export.tar_stream.src "
+                        "build/tests/export.tar_stream.dst"),
+                 0);
+}
+
+Test(export, no_such_path, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("export.no_such_path");
+
+    cr_assert_eq(
+        cryptfs_export("build/tests/export.no_such_path.test.shlkfs",
+                       "/missing", "build/tests/export.no_such_path.dst",
+                       "build/tests/export.no_such_path.private.pem"),
+        -1);
+}
@@ -32,12 +32,15 @@ Test(find_first_free_block, out_of_band_available, .timeout = 10,
     unsigned char *ase_key = extract_aes_key(
         "build/tests/find_first_free_block.not_found.test.shlkfs",
         "build/tests/find_first_free_block.not_found.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/find_first_free_block.not_found.test.shlkfs", ase_key);
 
     write_blocks_with_encryption(ase_key, FIRST_FAT_BLOCK, 1, &first_fat);
 
-    int64_t result = find_first_free_block(ase_key);
+    int64_t result = find_first_free_block(ctx);
     cr_assert_eq(result, -NB_FAT_ENTRIES_PER_BLOCK, "result = %ld", result);
 
+    shlkfs_ctx_close(ctx);
     free(ase_key);
 
     // Removing the file after the test
@@ -68,6 +71,8 @@ Test(find_first_free_block, on_first_fat, .timeout = 10,
     unsigned char *ase_key = extract_aes_key(
         "build/tests/find_first_free_block.on_first_fat.test.shlkfs",
         "build/tests/find_first_free_block.on_first_fat.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/find_first_free_block.on_first_fat.test.shlkfs", ase_key);
 
     size_t index = 42;
     cr_assert(index < NB_FAT_ENTRIES_PER_BLOCK);
@@ -76,13 +81,14 @@ Test(find_first_free_block, on_first_fat, .timeout = 10,
     write_blocks_with_encryption(ase_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
 
-    int64_t result = find_first_free_block(ase_key);
+    int64_t result = find_first_free_block(ctx);
     cr_assert_eq(result, index, "result = %ld", result);
 
-    result = create_fat(ase_key);
+    result = create_fat(ctx);
 
     cr_assert_eq(result, index);
 
+    shlkfs_ctx_close(ctx);
     free(ase_key);
     free(shlkfs);
 
@@ -133,19 +139,22 @@ Test(find_first_free_block, on_second_fat, .timeout = 10,
     unsigned char *ase_key = extract_aes_key(
         "build/tests/find_first_free_block.on_second_fat.test.shlkfs",
         "build/tests/find_first_free_block.on_second_fat.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/find_first_free_block.on_second_fat.test.shlkfs", ase_key);
 
     write_blocks_with_encryption(ase_key, FIRST_FAT_BLOCK, 1,
                                  &shlkfs->first_fat);
     write_blocks_with_encryption(ase_key, ROOT_ENTRY_BLOCK + 2, 1, second_fat);
 
-    int64_t result = find_first_free_block(ase_key);
+    int64_t result = find_first_free_block(ctx);
     cr_assert_eq(result, NB_FAT_ENTRIES_PER_BLOCK + index, "result = %ld",
                  result);
 
-    result = create_fat(ase_key);
+    result = create_fat(ctx);
 
     cr_assert_eq(result, NB_FAT_ENTRIES_PER_BLOCK + index);
 
+    shlkfs_ctx_close(ctx);
     free(ase_key);
     free(shlkfs);
 }
@@ -173,23 +182,27 @@ Test(find_first_free_block_safe, not_found, .timeout = 10,
     unsigned char *ase_key = extract_aes_key(
         "build/tests/find_first_free_block_safe.not_found.test.shlkfs",
         "build/tests/find_first_free_block_safe.not_found.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/find_first_free_block_safe.not_found.test.shlkfs",
+        ase_key);
 
     if (write_blocks_with_encryption(ase_key, FIRST_FAT_BLOCK, 1, &first_fat)
         != 0)
         cr_assert_fail("Failed to write the first FAT block");
 
-    int64_t result = find_first_free_block_safe(ase_key);
+    int64_t result = find_first_free_block_safe(ctx);
     cr_assert_eq(result, NB_FAT_ENTRIES_PER_BLOCK + 1,
                  "result_first = %ld  expected = %ld", result,
                  NB_FAT_ENTRIES_PER_BLOCK);
 
     // Check if the new block is free
-    result = find_first_free_block(ase_key);
+    result = find_first_free_block(ctx);
 
     cr_assert_eq(result, NB_FAT_ENTRIES_PER_BLOCK + 1,
                  "result_second = %ld expected = %ld", result,
                  NB_FAT_ENTRIES_PER_BLOCK + 1);
 
+    shlkfs_ctx_close(ctx);
     free(ase_key);
 }
 
@@ -211,8 +224,10 @@ Test(create_fat, two_fat_overflow_then_add_one_fat, .init = cr_redirect_stdout,
     unsigned char *ase_key =
         extract_aes_key("build/tests/create_fat.second_fat.test.shlkfs",
                         "build/tests/create_fat.second_fat.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/create_fat.second_fat.test.shlkfs", ase_key);
 
-    int second_fat_index = create_fat(ase_key);
+    int second_fat_index = create_fat(ctx);
     cr_assert_eq(second_fat_index, ROOT_ENTRY_BLOCK + 2);
 
     struct CryptFS_FAT fat_full_1 = { 0 };
@@ -226,16 +241,17 @@ Test(create_fat, two_fat_overflow_then_add_one_fat, .init = cr_redirect_stdout,
     write_blocks_with_encryption(ase_key, FIRST_FAT_BLOCK, 1, &fat_full_1);
     write_blocks_with_encryption(ase_key, ROOT_ENTRY_BLOCK + 2, 1, &fat_full_2);
 
-    int64_t result = find_first_free_block(ase_key);
+    int64_t result = find_first_free_block(ctx);
     cr_assert_eq(result, -2 * NB_FAT_ENTRIES_PER_BLOCK, "result = %ld", result);
 
-    result = create_fat(ase_key);
+    result = create_fat(ctx);
 
     cr_assert_eq(result, 2 * NB_FAT_ENTRIES_PER_BLOCK);
     // Deleting the file
     if (remove("build/tests/create_fat.second_fat.test.shlkfs") != 0)
         cr_assert(false, "Failed to remove the file");
 
+    shlkfs_ctx_close(ctx);
     free(ase_key);
 }
 
@@ -264,8 +280,10 @@ Test(create_fat, third_fat, .init = cr_redirect_stdout, .timeout = 10)
     unsigned char *ase_key =
         extract_aes_key("build/tests/create_fat.third_fat.test.shlkfs",
                         "build/tests/create_fat.third_fat.private.pem", NULL);
-    int64_t result1 = create_fat(ase_key);
-    int64_t result2 = create_fat(ase_key);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/create_fat.third_fat.test.shlkfs", ase_key);
+    int64_t result1 = create_fat(ctx);
+    int64_t result2 = create_fat(ctx);
 
     cr_assert_eq(result1, ROOT_ENTRY_BLOCK + 2, "result1 = %ld", result1);
     cr_assert_eq(result2, ROOT_ENTRY_BLOCK + 3, "result2 = %ld", result2);
@@ -274,6 +292,84 @@ Test(create_fat, third_fat, .init = cr_redirect_stdout, .timeout = 10)
     if (remove("build/tests/create_fat.third_fat.test.shlkfs") != 0)
         cr_assert(false, "Failed to remove the file");
 
+    shlkfs_ctx_close(ctx);
     free(ase_key);
     free(shlkfs);
 }
+
+Test(fat_cache, allocate_blocks, .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero "
+           "of=build/tests/fat_cache.allocate_blocks.test.shlkfs bs=4096 "
+           "count=3000 2> /dev/null");
+    format_fs("build/tests/fat_cache.allocate_blocks.test.shlkfs",
+              "build/tests/fat_cache.allocate_blocks.public.pem",
+              "build/tests/fat_cache.allocate_blocks.private.pem", "label",
+              NULL, NULL);
+
+    unsigned char *aes_key =
+        extract_aes_key("build/tests/fat_cache.allocate_blocks.test.shlkfs",
+                        "build/tests/fat_cache.allocate_blocks.private.pem",
+                        NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/fat_cache.allocate_blocks.test.shlkfs", aes_key);
+    cr_assert_eq(fat_cache_load(ctx), 0);
+
+    // The two FAT tables needed are created first, then the chain follows
+    block_t first_block = allocate_blocks(ctx, 2000);
+    cr_assert_eq(first_block, ROOT_DIR_BLOCK + 3, "first = %zu", first_block);
+    for (block_t block = first_block; block < first_block + 1999; block++)
+        cr_assert_eq(read_fat_offset(ctx, block), block + 1);
+    cr_assert_eq(read_fat_offset(ctx, first_block + 1999),
+                 (uint32_t)BLOCK_END);
+
+    // Nothing is written before the commit
+    struct CryptFS_Header *header =
+        xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, get_block_size());
+    cr_assert_eq(read_blocks(HEADER_BLOCK, 1, header), 0);
+    cr_assert_eq(header->last_fat_block, FIRST_FAT_BLOCK);
+
+    cr_assert_eq(fat_cache_commit(ctx), 0);
+    fat_cache_unload(ctx);
+
+    cr_assert_eq(read_blocks(HEADER_BLOCK, 1, header), 0);
+    cr_assert_eq(header->last_fat_block, ROOT_DIR_BLOCK + 2);
+    for (block_t block = first_block; block < first_block + 1999; block++)
+        cr_assert_eq(read_fat_offset(ctx, block), block + 1);
+    cr_assert_eq(find_first_free_block(ctx), first_block + 2000);
+
+    free(header);
+    shlkfs_ctx_close(ctx);
+    free(aes_key);
+}
+
+Test(fat_cache, close_commits, .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/fat_cache.close_commits.test.shlkfs "
+           "bs=4096 count=1000 2> /dev/null");
+    format_fs("build/tests/fat_cache.close_commits.test.shlkfs",
+              "build/tests/fat_cache.close_commits.public.pem",
+              "build/tests/fat_cache.close_commits.private.pem", "label",
+              NULL, NULL);
+
+    unsigned char *aes_key =
+        extract_aes_key("build/tests/fat_cache.close_commits.test.shlkfs",
+                        "build/tests/fat_cache.close_commits.private.pem",
+                        NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/fat_cache.close_commits.test.shlkfs", aes_key);
+    cr_assert_eq(fat_cache_load(ctx), 0);
+    block_t first_block = allocate_blocks(ctx, 3);
+    cr_assert_eq(first_block, ROOT_DIR_BLOCK + 1);
+    shlkfs_ctx_close(ctx);
+
+    // Without the FAT loaded in memory
+    ctx = shlkfs_ctx_open("build/tests/fat_cache.close_commits.test.shlkfs",
+                          aes_key);
+    cr_assert_eq(read_fat_offset(ctx, first_block), first_block + 1);
+    cr_assert_eq(allocate_blocks(ctx, 2), first_block + 3);
+    cr_assert_eq(read_fat_offset(ctx, first_block + 3), first_block + 4);
+    cr_assert_eq(read_fat_offset(ctx, first_block + 4), (uint32_t)BLOCK_END);
+    shlkfs_ctx_close(ctx);
+    free(aes_key);
+}
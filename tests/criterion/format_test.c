@@ -5,6 +5,7 @@
 #include "block.h"
 #include "cryptfs.h"
 #include "crypto.h"
+#include "entries.h"
 #include "format.h"
 #include "print.h"
 #include "writefs.h"
@@ -355,3 +356,100 @@ Test(format, label_higher_CRYPTFS_LABEL_SIZE, .init = cr_redirect_stdout,
         exit(EXIT_FAILURE);
     }
 }
+
+Test(format_fs, large_block_size, .init = cr_redirect_stdout, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/large_block_size.test.shlkfs "
+           "bs=65536 count=200 2> /dev/null");
+
+    set_block_size(65536);
+    set_device_path("build/tests/large_block_size.test.shlkfs");
+
+    format_fs("build/tests/large_block_size.test.shlkfs",
+              "build/tests/large_block_size.test.pub.pem",
+              "build/tests/large_block_size.test.private.pem", "label", NULL,
+              NULL);
+    cr_assert(is_already_formatted("build/tests/large_block_size.test.shlkfs"));
+
+    // The block size is taken from the header
+    set_block_size(CRYPTFS_BLOCK_SIZE_BYTES);
+    unsigned char *aes_key =
+        extract_aes_key("build/tests/large_block_size.test.shlkfs",
+                        "build/tests/large_block_size.test.private.pem", NULL);
+    struct shlkfs_ctx *ctx =
+        shlkfs_ctx_open("build/tests/large_block_size.test.shlkfs", aes_key);
+    cr_assert_neq(aes_key, NULL);
+    cr_assert_eq(get_block_size(), 65536);
+
+    // A file spanning several large blocks can be written and read back
+    size_t size = 3 * 65536 + 42;
+    char *buffer_before = xcalloc(size, 1);
+    char *buffer_after = xcalloc(size, 1);
+    cr_assert(RAND_bytes((unsigned char *)buffer_before, size) == 1);
+
+    struct CryptFS_Entry_ID *entry_id =
+        create_file_by_path(ctx, "/large_block_file");
+    cr_assert_neq(entry_id, (void *)ENTRY_NO_SUCH);
+    cr_assert_eq(entry_write_buffer(ctx, *entry_id, buffer_before, size),
+                 0);
+    cr_assert_eq(
+        entry_read_raw_data(ctx, *entry_id, 0, buffer_after, size),
+        (ssize_t)size);
+    cr_assert_arr_eq(buffer_before, buffer_after, size);
+
+    free(entry_id);
+    free(buffer_before);
+    free(buffer_after);
+    shlkfs_ctx_close(ctx);
+    free(aes_key);
+
+    if (remove("build/tests/large_block_size.test.shlkfs") != 0)
+        cr_assert(false, "Impossible to delete the file");
+}
+
+Test(is_already_formatted, unsupported_blocksize, .init = cr_redirect_stdout,
+     .timeout = 10)
+{
+    cr_assert(!is_block_size_supported(1024));
+    cr_assert(!is_block_size_supported(20000));
+    cr_assert(!is_block_size_supported(2 * CRYPTFS_BLOCK_SIZE_MAX_BYTES));
+    cr_assert(is_block_size_supported(CRYPTFS_BLOCK_SIZE_BYTES));
+    cr_assert(is_block_size_supported(16384));
+    cr_assert(is_block_size_supported(CRYPTFS_BLOCK_SIZE_MAX_BYTES));
+}
+
+Test(is_already_formatted, version_and_cipher, .init = cr_redirect_stdall,
+     .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/version_and_cipher.test.shlkfs "
+           "bs=4096 count=1000 2> /dev/null");
+    set_device_path("build/tests/version_and_cipher.test.shlkfs");
+    format_fs("build/tests/version_and_cipher.test.shlkfs",
+              "build/tests/version_and_cipher.test.pub.pem",
+              "build/tests/version_and_cipher.test.private.pem", "label", NULL,
+              NULL);
+
+    struct CryptFS_Header *header =
+        xaligned_calloc(CRYPTFS_BLOCK_SIZE_BYTES, 1, CRYPTFS_BLOCK_SIZE_BYTES);
+    cr_assert_eq(read_blocks(HEADER_BLOCK, 1, header), 0);
+    cr_assert_eq(header->version, CRYPTFS_VERSION);
+    cr_assert_eq(header->cipher, CRYPTFS_CIPHER_AES_256_CBC);
+
+    // The volumes of version 1 (without cipher) are still supported
+    header->version = 1;
+    cr_assert_eq(write_blocks(HEADER_BLOCK, 1, header), 0);
+    cr_assert(
+        is_already_formatted("build/tests/version_and_cipher.test.shlkfs"));
+
+    header->cipher = 0xff;
+    cr_assert_eq(write_blocks(HEADER_BLOCK, 1, header), 0);
+    cr_assert(
+        !is_already_formatted("build/tests/version_and_cipher.test.shlkfs"));
+
+    header->cipher = CRYPTFS_CIPHER_AES_256_CBC;
+    header->version = CRYPTFS_VERSION + 1;
+    cr_assert_eq(write_blocks(HEADER_BLOCK, 1, header), 0);
+    cr_assert(
+        !is_already_formatted("build/tests/version_and_cipher.test.shlkfs"));
+    free(header);
+}
@@ -0,0 +1,154 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "crypto.h"
+#include "entries.h"
+#include "fat.h"
+#include "fsck.h"
+#include "shlkfs.h"
+#include "shlkfs_ctx.h"
+#include "test_volume.h"
+
+void cr_redirect_stdall(void);
+
+/**
+ * @brief Format a volume in an image file, and write /a and /b (5000 bytes
+ * each) and /directory/c (100 bytes) in it.
+ *
+ * @param name The name of the test (prefix of its files in build/tests).
+ */
+static void create_test_volume(const char *name)
+{
+    struct test_volume volume;
+    format_test_volume(name, 1000, &volume);
+
+    struct shlkfs *fs =
+        shlkfs_mount(volume.device_path, volume.private_key_path, NULL);
+    cr_assert_not_null(fs);
+    cr_assert_eq(shlkfs_mkdir(fs, "/directory", 0755), 0);
+    const char *paths[] = { "/a", "/b", "/directory/c" };
+    const size_t sizes[] = { 5000, 5000, 100 };
+    char data[5000];
+    memset(data, 'x', sizeof(data));
+    for (size_t i = 0; i < 3; i++)
+    {
+        int fd = shlkfs_open(fs, paths[i], O_CREAT | O_WRONLY, 0644);
+        cr_assert_geq(fd, 0);
+        cr_assert_eq(shlkfs_write(fs, fd, data, sizes[i]), (ssize_t)sizes[i]);
+        cr_assert_eq(shlkfs_close(fs, fd), 0);
+    }
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
+
+/**
+ * @brief Corrupt the volume of create_test_volume: leak a block, cross-link
+ * /b to the chain of /a, and make the size of /directory/c too big.
+ *
+ * @param ctx The context of the volume.
+ */
+static void corrupt_test_volume(struct shlkfs_ctx *ctx)
+{
+    SHLKFS_CTX_SCOPE(ctx);
+
+    block_t leaked = find_first_free_block_safe(ctx);
+    cr_assert_gt(leaked, 0);
+    cr_assert_eq(write_fat_offset(ctx, leaked, BLOCK_END), 0);
+
+    struct CryptFS_Entry_ID *a_id = get_entry_by_path(ctx, "/a");
+    struct CryptFS_Entry_ID *b_id = get_entry_by_path(ctx, "/b");
+    struct CryptFS_Entry_ID *c_id = get_entry_by_path(ctx, "/directory/c");
+    cr_assert_not_null(a_id);
+    cr_assert_not_null(b_id);
+    cr_assert_not_null(c_id);
+
+    struct CryptFS_Entry *a = get_entry_from_id(ctx, *a_id);
+    struct CryptFS_Entry *b = get_entry_from_id(ctx, *b_id);
+    struct CryptFS_Entry *c = get_entry_from_id(ctx, *c_id);
+    b->start_block = a->start_block;
+    c->size = 10000;
+    cr_assert_eq(write_entry_from_id(ctx, *b_id, b), 0);
+    cr_assert_eq(write_entry_from_id(ctx, *c_id, c), 0);
+
+    free(a);
+    free(b);
+    free(c);
+    free(a_id);
+    free(b_id);
+    free(c_id);
+}
+
+Test(fsck, clean, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("fsck.clean");
+
+    cr_assert_eq(cryptfs_fsck("build/tests/fsck.clean.test.shlkfs",
+                              "build/tests/fsck.clean.private.pem", false),
+                 FSCK_CLEAN);
+    cr_assert_eq(cryptfs_fsck("build/tests/fsck.clean.test.shlkfs",
+                              "build/tests/fsck.clean.private.pem", true),
+                 FSCK_CLEAN);
+}
+
+Test(fsck, repair, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("fsck.repair");
+
+    unsigned char *aes_key =
+        extract_aes_key("build/tests/fsck.repair.test.shlkfs",
+                        "build/tests/fsck.repair.private.pem", NULL);
+    struct shlkfs_ctx *ctx =
+        shlkfs_ctx_open("build/tests/fsck.repair.test.shlkfs", aes_key);
+    cr_assert_not_null(ctx);
+    corrupt_test_volume(ctx);
+    shlkfs_ctx_close(ctx);
+    free(aes_key);
+
+    // The errors are only reported...
+    cr_assert_eq(cryptfs_fsck("build/tests/fsck.repair.test.shlkfs",
+                              "build/tests/fsck.repair.private.pem", false),
+                 FSCK_ERRORS);
+    cr_assert_eq(cryptfs_fsck("build/tests/fsck.repair.test.shlkfs",
+                              "build/tests/fsck.repair.private.pem", false),
+                 FSCK_ERRORS);
+
+    // ...until they are repaired
+    cr_assert_eq(cryptfs_fsck("build/tests/fsck.repair.test.shlkfs",
+                              "build/tests/fsck.repair.private.pem", true),
+                 FSCK_REPAIRED);
+    cr_assert_eq(cryptfs_fsck("build/tests/fsck.repair.test.shlkfs",
+                              "build/tests/fsck.repair.private.pem", false),
+                 FSCK_CLEAN);
+
+    // The repaired volume is usable
+    struct shlkfs *fs = shlkfs_mount("build/tests/fsck.repair.test.shlkfs",
+                                     "build/tests/fsck.repair.private.pem",
+                                     NULL);
+    cr_assert_not_null(fs);
+    struct stat st;
+    cr_assert_eq(shlkfs_stat(fs, "/directory/c", &st), 0);
+    cr_assert_eq(st.st_size, 4096);
+    cr_assert_eq(shlkfs_unlink(fs, "/a"), 0);
+    cr_assert_eq(shlkfs_unlink(fs, "/b"), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+    cr_assert_eq(cryptfs_fsck("build/tests/fsck.repair.test.shlkfs",
+                              "build/tests/fsck.repair.private.pem", false),
+                 FSCK_CLEAN);
+}
+
+Test(fsck, not_formatted, .init = cr_redirect_stdall, .timeout = 60)
+{
+    cr_assert_eq(system("dd if=/dev/zero "
+                        "of=build/tests/fsck.not_formatted.test.shlkfs "
+                        "bs=4096 count=100 2> /dev/null"),
+                 0);
+
+    cr_assert_eq(cryptfs_fsck("build/tests/fsck.not_formatted.test.shlkfs",
+                              "build/tests/fsck.not_formatted.private.pem",
+                              false),
+                 FSCK_FAILURE);
+}
@@ -0,0 +1,240 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crypto.h"
+#include "entries.h"
+#include "fat.h"
+#include "format.h"
+#include "import.h"
+#include "shlkfs.h"
+#include "xalloc.h"
+
+void cr_redirect_stdall(void);
+
+// Size of the large file of the test trees (more than an import chunk)
+#define LARGE_FILE_SIZE (17 * 1024 * 1024 + 123)
+
+/**
+ * @brief Format a volume in an image file, and create a directory tree to
+ * import: /large (LARGE_FILE_SIZE bytes), /empty, /directory/small
+ * ("small\n") and /directory/link (-> small).
+ *
+ * @param name The name of the test (prefix of its files in build/tests).
+ */
+static void create_test_files(const char *name)
+{
+    char command[1024];
+    snprintf(command, sizeof(command),
+             "rm -rf build/tests/%s.src "
+             "&& mkdir -p build/tests/%s.src/directory "
+             "&& dd if=/dev/zero of=build/tests/%s.test.shlkfs bs=4096 "
+             "count=6000 2> /dev/null",
+             name, name, name);
+    cr_assert_eq(system(command), 0);
+
+    char device_path[256];
+    char public_key_path[256];
+    char private_key_path[256];
+    snprintf(device_path, sizeof(device_path), "build/tests/%s.test.shlkfs",
+             name);
+    snprintf(public_key_path, sizeof(public_key_path),
+             "build/tests/%s.public.pem", name);
+    snprintf(private_key_path, sizeof(private_key_path),
+             "build/tests/%s.private.pem", name);
+    format_fs(device_path, public_key_path, private_key_path, "label", NULL,
+              NULL);
+
+    char path[256];
+    snprintf(path, sizeof(path), "build/tests/%s.src/large", name);
+    FILE *file = fopen(path, "w");
+    cr_assert_not_null(file);
+    for (size_t i = 0; i < LARGE_FILE_SIZE; i++)
+        fputc((i * 7) % 251, file);
+    fclose(file);
+
+    snprintf(path, sizeof(path), "build/tests/%s.src/empty", name);
+    file = fopen(path, "w");
+    fclose(file);
+
+    snprintf(path, sizeof(path), "build/tests/%s.src/directory/small", name);
+    file = fopen(path, "w");
+    fputs("small\n", file);
+    fclose(file);
+    chmod(path, 0640);
+
+    snprintf(path, sizeof(path), "build/tests/%s.src/directory/link", name);
+    cr_assert_eq(symlink("small", path), 0);
+}
+
+/**
+ * @brief Check that the tree of create_test_files was imported in a volume.
+ *
+ * @param name The name of the test (prefix of its files in build/tests).
+ */
+static void check_imported_files(const char *name)
+{
+    char device_path[256];
+    char private_key_path[256];
+    snprintf(device_path, sizeof(device_path), "build/tests/%s.test.shlkfs",
+             name);
+    snprintf(private_key_path, sizeof(private_key_path),
+             "build/tests/%s.private.pem", name);
+
+    struct shlkfs *fs = shlkfs_mount(device_path, private_key_path, NULL);
+    cr_assert_not_null(fs);
+
+    struct stat st;
+    cr_assert_eq(shlkfs_stat(fs, "/large", &st), 0);
+    cr_assert_eq(st.st_size, LARGE_FILE_SIZE);
+    cr_assert_eq(shlkfs_stat(fs, "/empty", &st), 0);
+    cr_assert_eq(st.st_size, 0);
+    cr_assert_eq(shlkfs_stat(fs, "/directory", &st), 0);
+    cr_assert(S_ISDIR(st.st_mode));
+    cr_assert_eq(shlkfs_stat(fs, "/directory/small", &st), 0);
+    cr_assert_eq(st.st_mode & 07777, 0640);
+    cr_assert_eq(shlkfs_stat(fs, "/directory/link", &st), 0);
+
+    unsigned char *buffer = xcalloc(LARGE_FILE_SIZE, 1);
+    int fd = shlkfs_open(fs, "/large", O_RDONLY, 0);
+    cr_assert_eq(shlkfs_pread(fs, fd, buffer, LARGE_FILE_SIZE, 0),
+                 LARGE_FILE_SIZE);
+    for (size_t i = 0; i < LARGE_FILE_SIZE; i++)
+        cr_assert_eq(buffer[i], (i * 7) % 251, "byte %zu", i);
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+
+    memset(buffer, 0, 16);
+    fd = shlkfs_open(fs, "/directory/small", O_RDONLY, 0);
+    cr_assert_eq(shlkfs_read(fs, fd, buffer, 16), 6);
+    cr_assert_str_eq((char *)buffer, "small\n");
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+
+    free(buffer);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
+
+Test(import, directory, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_files("import.directory");
+
+    cr_assert_eq(cryptfs_import("build/tests/import.directory.test.shlkfs",
+                                "build/tests/import.directory.src",
+                                "build/tests/import.directory.private.pem"),
+                 0);
+    check_imported_files("import.directory");
+
+    // The blocks of the large file are contiguous on the fresh volume
+    unsigned char *aes_key =
+        extract_aes_key("build/tests/import.directory.test.shlkfs",
+                        "build/tests/import.directory.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/import.directory.test.shlkfs", aes_key);
+    struct CryptFS_Entry_ID *entry_id = get_entry_by_path(ctx, "/large");
+    struct CryptFS_Entry *entry = get_entry_from_id(ctx, *entry_id);
+    size_t nb_blocks = 1;
+    for (block_t block = entry->start_block;
+         read_fat_offset(ctx, block) != (uint32_t)BLOCK_END; block++)
+    {
+        cr_assert_eq(read_fat_offset(ctx, block), block + 1);
+        nb_blocks++;
+    }
+    cr_assert_eq(nb_blocks, (LARGE_FILE_SIZE + 4095) / 4096);
+    free(entry);
+    free(entry_id);
+    shlkfs_ctx_close(ctx);
+    free(aes_key);
+
+    // The directories are merged, the other entries cannot be replaced
+    cr_assert_eq(cryptfs_import("build/tests/import.directory.test.shlkfs",
+                                "build/tests/import.directory.src",
+                                "build/tests/import.directory.private.pem"),
+                 -1);
+}
+
+Test(import, tar_stream, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_files("import.tar_stream");
+
+    // A name longer than the ustar name field
+    char long_path[256];
+    snprintf(long_path, sizeof(long_path),
+             "build/tests/import.tar_stream.src/%0100d", 0);
+    mkdir(long_path, 0755);
+    strcat(long_path, "/long_name");
+    FILE *file = fopen(long_path, "w");
+    fputs("long\n", file);
+    fclose(file);
+
+    cr_assert_eq(system("tar -C build/tests/import.tar_stream.src -cf "
+                        "build/tests/import.tar_stream.tar ."),
+                 0);
+    int fd = open("build/tests/import.tar_stream.tar", O_RDONLY);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(dup2(fd, STDIN_FILENO), STDIN_FILENO);
+    close(fd);
+
+    cr_assert_eq(cryptfs_import("build/tests/import.tar_stream.test.shlkfs",
+                                "-",
+                                "build/tests/import.tar_stream.private.pem"),
+                 0);
+    check_imported_files("import.tar_stream");
+
+    struct shlkfs *fs =
+        shlkfs_mount("build/tests/import.tar_stream.test.shlkfs",
+                     "build/tests/import.tar_stream.private.pem", NULL);
+    char path[256];
+    snprintf(path, sizeof(path), "/%0100d/long_name", 0);
+    char buffer[8] = { 0 };
+    fd = shlkfs_open(fs, path, O_RDONLY, 0);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(shlkfs_read(fs, fd, buffer, sizeof(buffer)), 5);
+    cr_assert_str_eq(buffer, "long\n");
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
+
+Test(import, truncated_tar, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_files("import.truncated_tar");
+
+    unsigned char *aes_key =
+        extract_aes_key("build/tests/import.truncated_tar.test.shlkfs",
+                        "build/tests/import.truncated_tar.private.pem", NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(
+        "build/tests/import.truncated_tar.test.shlkfs", aes_key);
+    sblock_t first_free = find_first_free_block(ctx);
+    shlkfs_ctx_close(ctx);
+
+    // The archive ends in the middle of the large file
+    cr_assert_eq(system("tar -C build/tests/import.truncated_tar.src -cf "
+                        "build/tests/import.truncated_tar.tar large && "
+                        "truncate -s 1M build/tests/import.truncated_tar.tar"),
+                 0);
+    int fd = open("build/tests/import.truncated_tar.tar", O_RDONLY);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(dup2(fd, STDIN_FILENO), STDIN_FILENO);
+    close(fd);
+
+    cr_assert_eq(cryptfs_import("build/tests/import.truncated_tar.test.shlkfs",
+                                "-",
+                                "build/tests/import.truncated_tar.private.pem"),
+                 -1);
+
+    // The blocks allocated for the large file are still free
+    ctx = shlkfs_ctx_open("build/tests/import.truncated_tar.test.shlkfs",
+                          aes_key);
+    cr_assert_eq(find_first_free_block(ctx), first_free);
+    shlkfs_ctx_close(ctx);
+    free(aes_key);
+}
+
+Test(import, not_a_directory, .init = cr_redirect_stdall, .timeout = 10)
+{
+    cr_assert_eq(cryptfs_import("build/tests/import.not_a_directory.shlkfs",
+                                "build/tests/import.missing",
+                                "build/tests/import.missing.pem"),
+                 -1);
+}
@@ -0,0 +1,197 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adduser.h"
+#include "crypto.h"
+#include "deluser.h"
+#include "fsck.h"
+#include "hash.h"
+#include "keytable.h"
+#include "readfs.h"
+#include "rekey.h"
+#include "shlkfs.h"
+#include "shlkfs_ctx.h"
+#include "test_volume.h"
+#include "xalloc.h"
+
+void cr_redirect_stdall(void);
+
+/**
+ * @brief Format a volume in an image file, write the file /a, and move its
+ * key slots to a key table.
+ *
+ * @param name The name of the test (prefix of its files in build/tests).
+ */
+static void create_test_volume(const char *name)
+{
+    struct test_volume volume;
+    format_test_volume(name, 1000, &volume);
+
+    struct shlkfs *fs =
+        shlkfs_mount(volume.device_path, volume.private_key_path, NULL);
+    cr_assert_not_null(fs);
+    int fd = shlkfs_open(fs, "/a", O_CREAT | O_WRONLY, 0644);
+    cr_assert_geq(fd, 0);
+    char block[4096];
+    memset(block, 'a', sizeof(block));
+    cr_assert_eq(shlkfs_write(fs, fd, block, sizeof(block)), sizeof(block));
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+
+    struct shlkfs_ctx *ctx =
+        shlkfs_ctx_open_with_key(volume.device_path, volume.private_key_path);
+    cr_assert_not_null(ctx);
+    cr_assert_eq(key_table_add(ctx, NULL, 0), 0);
+    shlkfs_ctx_close(ctx);
+}
+
+/**
+ * @brief Check that the file /a of a volume is intact.
+ *
+ * @param device_path The path of the image file.
+ * @param private_key_path The path of a registered private key.
+ */
+static void check_volume(const char *device_path, const char *private_key_path)
+{
+    cr_assert_eq(cryptfs_fsck(device_path, private_key_path, false),
+                 FSCK_CLEAN);
+
+    struct shlkfs *fs = shlkfs_mount(device_path, private_key_path, NULL);
+    cr_assert_not_null(fs);
+    int fd = shlkfs_open(fs, "/a", O_RDONLY, 0);
+    cr_assert_geq(fd, 0);
+    char block[4096];
+    char expected[4096];
+    memset(expected, 'a', sizeof(expected));
+    cr_assert_eq(shlkfs_read(fs, fd, block, sizeof(block)), sizeof(block));
+    cr_assert_arr_eq(block, expected, sizeof(block));
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
+
+Test(key_table, migrate, .init = cr_redirect_stdall, .timeout = 60)
+{
+    const char *device_path = "build/tests/key_table.migrate.test.shlkfs";
+    const char *private_key_path = "build/tests/key_table.migrate.private.pem";
+    create_test_volume("key_table.migrate");
+
+    // The keys storage is wiped once its key slots are in the key table
+    struct CryptFS_KeyTable key_table = { 0 };
+    cr_assert_neq(read_key_table(device_path, &key_table), 0);
+    cr_assert_eq(key_table.nb_users, 1);
+    cr_assert_geq(key_table.nb_slots, 2 * NB_ENCRYPTION_KEYS);
+    struct CryptFS_KeySlot *keys_storage = read_key_slots(device_path);
+    cr_assert_eq(keys_storage[0].occupied, 0);
+    free(keys_storage);
+
+    EVP_PKEY *first_rsa = generate_rsa_keypair();
+    EVP_PKEY *second_rsa = generate_rsa_keypair();
+    write_rsa_keys_on_disk(first_rsa,
+                           "build/tests/key_table.migrate.first_public.pem",
+                           "build/tests/key_table.migrate.first_private.pem",
+                           NULL);
+    write_rsa_keys_on_disk(second_rsa,
+                           "build/tests/key_table.migrate.second_public.pem",
+                           "build/tests/key_table.migrate.second_private.pem",
+                           NULL);
+    const char *public_key_paths[] = {
+        "build/tests/key_table.migrate.first_public.pem",
+        "build/tests/key_table.migrate.second_public.pem",
+    };
+    cr_assert_eq(cryptfs_addusers(device_path, public_key_paths, 2,
+                                  private_key_path),
+                 0);
+    cr_assert_eq(cryptfs_adduser(device_path, public_key_paths[0],
+                                 private_key_path),
+                 -1);
+    read_key_table(device_path, &key_table);
+    cr_assert_eq(key_table.nb_users, 3);
+    cr_assert_eq(find_key_slot(device_path, second_rsa, NULL), 2);
+
+    // The key table is not encrypted, its key slots are rewrapped
+    unsigned char *old_key =
+        extract_aes_key(device_path, private_key_path, NULL);
+    cr_assert_eq(cryptfs_rekey(device_path, private_key_path), 0);
+    unsigned char *new_key = extract_aes_key(
+        device_path, "build/tests/key_table.migrate.second_private.pem", NULL);
+    cr_assert_not_null(new_key);
+    cr_assert_arr_neq(old_key, new_key, AES_KEY_SIZE_BYTES);
+    check_volume(device_path,
+                 "build/tests/key_table.migrate.first_private.pem");
+
+    // The last key slot takes the place of a deleted one
+    cr_assert_eq(cryptfs_deluser(device_path, private_key_path,
+                                 public_key_paths[0]),
+                 0);
+    cr_assert_eq(find_key_slot(device_path, first_rsa, NULL), -1);
+    cr_assert_eq(find_key_slot(device_path, second_rsa, NULL), 1);
+    cr_assert_null(extract_aes_key(
+        device_path, "build/tests/key_table.migrate.first_private.pem", NULL));
+    read_key_table(device_path, &key_table);
+    cr_assert_eq(key_table.nb_users, 2);
+    check_volume(device_path,
+                 "build/tests/key_table.migrate.second_private.pem");
+
+    EVP_PKEY_free(first_rsa);
+    EVP_PKEY_free(second_rsa);
+    free(old_key);
+    free(new_key);
+}
+
+Test(key_table, grow, .init = cr_redirect_stdall, .timeout = 60)
+{
+    const char *device_path = "build/tests/key_table.grow.test.shlkfs";
+    const char *private_key_path = "build/tests/key_table.grow.private.pem";
+    create_test_volume("key_table.grow");
+    struct CryptFS_KeyTable key_table = { 0 };
+    block_t table_block = read_key_table(device_path, &key_table);
+    size_t nb_slots = key_table.nb_slots;
+
+    // Users whose modulus differ from the one of the first user
+    EVP_PKEY *rsa_key =
+        load_rsa_keypair_from_disk(NULL, private_key_path, NULL);
+    struct CryptFS_KeySlot key_slot;
+    cr_assert_eq(find_key_slot(device_path, rsa_key, &key_slot), 0);
+    size_t nb_users = nb_slots + 10;
+    struct CryptFS_KeySlot *key_slots =
+        xaligned_calloc(4096, nb_users, sizeof(struct CryptFS_KeySlot));
+    for (size_t i = 0; i < nb_users; i++)
+    {
+        memcpy(&key_slots[i], &key_slot, sizeof(key_slot));
+        memcpy(key_slots[i].rsa_n, &i, sizeof(i));
+        unsigned char *fingerprint =
+            sha256_data(key_slots[i].rsa_n, RSA_KEY_SIZE_BYTES);
+        memcpy(key_slots[i].rsa_n_fingerprint, fingerprint,
+               SHA256_DIGEST_LENGTH);
+        free(fingerprint);
+    }
+
+    // The key table is rebuilt twice as large once full
+    struct shlkfs_ctx *ctx =
+        shlkfs_ctx_open_with_key(device_path, private_key_path);
+    cr_assert_not_null(ctx);
+    cr_assert_eq(key_table_add(ctx, key_slots, 10), 0);
+    cr_assert_eq(read_key_table(device_path, &key_table), table_block);
+    cr_assert_eq(key_table_add(ctx, key_slots + 10, nb_users - 10), 0);
+    shlkfs_ctx_close(ctx);
+    cr_assert_neq(read_key_table(device_path, &key_table), table_block);
+    cr_assert_eq(key_table.nb_users, nb_users + 1);
+    cr_assert_geq(key_table.nb_slots, 2 * nb_slots);
+
+    // The former key table is freed, the users are still found
+    check_volume(device_path, private_key_path);
+    cr_assert_eq(find_key_slot(device_path, rsa_key, NULL), 0);
+    for (size_t i = 0; i < nb_users; i++)
+        cr_assert_eq(key_table_remove(device_path, 1), 0);
+    read_key_table(device_path, &key_table);
+    cr_assert_eq(key_table.nb_users, 1);
+    cr_assert_eq(find_key_slot(device_path, rsa_key, NULL), 0);
+    check_volume(device_path, private_key_path);
+
+    EVP_PKEY_free(rsa_key);
+    free(key_slots);
+}
@@ -0,0 +1,257 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adduser.h"
+#include "block.h"
+#include "crypto.h"
+#include "deluser.h"
+#include "fsck.h"
+#include "hash.h"
+#include "readfs.h"
+#include "rekey.h"
+#include "shlkfs.h"
+#include "test_volume.h"
+#include "xalloc.h"
+
+void cr_redirect_stdall(void);
+
+// Number of blocks of /dir/a
+#define FILE_BLOCKS 20
+
+/**
+ * @brief Format a volume in an image file, and write the file /dir/a
+ * (FILE_BLOCKS blocks).
+ *
+ * @param name The name of the test (prefix of its files in build/tests).
+ */
+static void create_test_volume(const char *name)
+{
+    struct test_volume volume;
+    format_test_volume(name, 1000, &volume);
+
+    struct shlkfs *fs =
+        shlkfs_mount(volume.device_path, volume.private_key_path, NULL);
+    cr_assert_not_null(fs);
+    cr_assert_eq(shlkfs_mkdir(fs, "/dir", 0755), 0);
+    int fd = shlkfs_open(fs, "/dir/a", O_CREAT | O_WRONLY, 0644);
+    cr_assert_geq(fd, 0);
+    char block[4096];
+    for (size_t i = 0; i < FILE_BLOCKS; i++)
+    {
+        memset(block, 'a' + i, sizeof(block));
+        cr_assert_eq(shlkfs_write(fs, fd, block, sizeof(block)),
+                     sizeof(block));
+    }
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
+
+/**
+ * @brief Check the content of the volume written by create_test_volume.
+ *
+ * @param name The name of the test.
+ */
+static void check_volume(const char *name)
+{
+    char device_path[256];
+    char private_key_path[256];
+    snprintf(device_path, sizeof(device_path), "build/tests/%s.test.shlkfs",
+             name);
+    snprintf(private_key_path, sizeof(private_key_path),
+             "build/tests/%s.private.pem", name);
+    cr_assert_eq(cryptfs_fsck(device_path, private_key_path, false),
+                 FSCK_CLEAN);
+
+    struct shlkfs *fs = shlkfs_mount(device_path, private_key_path, NULL);
+    cr_assert_not_null(fs);
+    int fd = shlkfs_open(fs, "/dir/a", O_RDONLY, 0);
+    cr_assert_geq(fd, 0);
+    char block[4096];
+    char expected[4096];
+    for (size_t i = 0; i < FILE_BLOCKS; i++)
+    {
+        memset(expected, 'a' + i, sizeof(expected));
+        cr_assert_eq(shlkfs_read(fs, fd, block, sizeof(block)),
+                     sizeof(block));
+        cr_assert_arr_eq(block, expected, sizeof(block));
+    }
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
+
+Test(rekey, rotate, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("rekey.rotate");
+    const char *device_path = "build/tests/rekey.rotate.test.shlkfs";
+    const char *private_key_path = "build/tests/rekey.rotate.private.pem";
+
+    // A deleted user keeps the master key in its (free) key slot
+    EVP_PKEY *other_rsa = generate_rsa_keypair();
+    write_rsa_keys_on_disk(other_rsa, "build/tests/rekey.rotate.other.pem",
+                           NULL, NULL);
+    EVP_PKEY_free(other_rsa);
+    cr_assert_eq(cryptfs_adduser(device_path,
+                                 "build/tests/rekey.rotate.other.pem",
+                                 private_key_path),
+                 0);
+    cr_assert_eq(cryptfs_deluser(device_path, private_key_path,
+                                 "build/tests/rekey.rotate.other.pem"),
+                 0);
+
+    unsigned char *old_key =
+        extract_aes_key(device_path, private_key_path, NULL);
+    cr_assert_eq(cryptfs_rekey(device_path, private_key_path), 0);
+    unsigned char *new_key =
+        extract_aes_key(device_path, private_key_path, NULL);
+    cr_assert_not_null(new_key);
+    cr_assert_arr_neq(old_key, new_key, AES_KEY_SIZE_BYTES);
+    free(old_key);
+    free(new_key);
+
+    // The free key slots are wiped, and the rotation is finished
+    struct CryptFS *cryptfs = read_cryptfs_headers(device_path);
+    struct CryptFS_KeySlot empty_slot = { 0 };
+    cr_assert_eq(cryptfs->header.rekey_in_progress, 0);
+    cr_assert_eq(cryptfs->keys_storage[0].occupied, 1);
+    cr_assert_arr_eq(&cryptfs->keys_storage[1], &empty_slot,
+                     sizeof(empty_slot));
+    free(cryptfs);
+    cr_assert_eq(access("build/tests/rekey.rotate.test.shlkfs" REKEY_SUFFIX,
+                        F_OK),
+                 -1);
+
+    check_volume("rekey.rotate");
+}
+
+Test(rekey, resume, .init = cr_redirect_stdall, .timeout = 60)
+{
+    create_test_volume("rekey.resume");
+    const char *device_path = "build/tests/rekey.resume.test.shlkfs";
+    const char *private_key_path = "build/tests/rekey.resume.private.pem";
+
+    EVP_PKEY *other_rsa = generate_rsa_keypair();
+    write_rsa_keys_on_disk(other_rsa, "build/tests/rekey.resume.other.pem",
+                           "build/tests/rekey.resume.other.private.pem", NULL);
+    EVP_PKEY_free(other_rsa);
+    cr_assert_eq(cryptfs_adduser(device_path,
+                                 "build/tests/rekey.resume.other.pem",
+                                 private_key_path),
+                 0);
+
+    // Interrupt a rotation while the blocks 65 to 67 are written: the blocks
+    // 65 and 67 are encrypted with the new key, the block 66 is not yet
+    unsigned char *old_key =
+        extract_aes_key(device_path, private_key_path, NULL);
+    unsigned char *new_key = generate_aes_key();
+    struct block_device *device = block_device_open(device_path, 4096);
+    cr_assert_not_null(device);
+    struct block_device *previous_device = block_device_use(device);
+
+    struct CryptFS_Header *header = xaligned_calloc(4096, 1, 4096);
+    cr_assert_eq(read_blocks(HEADER_BLOCK, 1, header), 0);
+    EVP_PKEY *rsa_keypair =
+        load_rsa_keypair_from_disk(NULL, private_key_path, NULL);
+    size_t size = 0;
+    unsigned char *wrapped_key =
+        rsa_encrypt_data(rsa_keypair, new_key, AES_KEY_SIZE_BYTES, &size);
+    unsigned char *fingerprint = rsa_key_fingerprint(rsa_keypair);
+    memcpy(header->rekey_new_key, wrapped_key, RSA_KEY_SIZE_BYTES);
+    memcpy(header->rekey_fingerprint, fingerprint, SHA256_DIGEST_LENGTH);
+    free(wrapped_key);
+    free(fingerprint);
+    EVP_PKEY_free(rsa_keypair);
+    header->rekey_watermark = FIRST_FAT_BLOCK;
+    header->rekey_in_progress = 1;
+    cr_assert_eq(write_blocks(HEADER_BLOCK, 1, header), 0);
+    free(header);
+
+    unsigned char *blocks = xaligned_alloc(4096, 3, 4096);
+    unsigned char *old_block = xaligned_alloc(4096, 1, 4096);
+    cr_assert_eq(read_blocks(FIRST_FAT_BLOCK + 1, 1, old_block), 0);
+    cr_assert_eq(read_blocks_with_decryption(old_key, FIRST_FAT_BLOCK, 3,
+                                             blocks),
+                 0);
+    block_t numbers[] = { FIRST_FAT_BLOCK, FIRST_FAT_BLOCK + 1,
+                          FIRST_FAT_BLOCK + 2 };
+    cr_assert_eq(encrypt_blocks(new_key, numbers, blocks, blocks, 3), 0);
+    struct CryptFS_Rekey_Journal journal = {
+        .version = REKEY_VERSION,
+        .start_block = FIRST_FAT_BLOCK,
+        .end_block = FIRST_FAT_BLOCK + 3,
+        .nb_blocks = 3,
+    };
+    memcpy(journal.magic, REKEY_MAGIC, REKEY_MAGIC_SIZE);
+    struct CryptFS_Rekey_Block journaled[3];
+    for (size_t i = 0; i < 3; i++)
+    {
+        journaled[i].block = FIRST_FAT_BLOCK + i;
+        unsigned char *hash = sha256_data(blocks + i * 4096, 4096);
+        memcpy(journaled[i].hash, hash, SHA256_DIGEST_LENGTH);
+        free(hash);
+    }
+    FILE *file =
+        fopen("build/tests/rekey.resume.test.shlkfs" REKEY_SUFFIX, "w");
+    cr_assert_not_null(file);
+    cr_assert_eq(fwrite(&journal, sizeof(journal), 1, file), 1);
+    cr_assert_eq(fwrite(journaled, sizeof(journaled), 1, file), 1);
+    fclose(file);
+    memcpy(blocks + 4096, old_block, 4096);
+    cr_assert_eq(write_blocks(FIRST_FAT_BLOCK, 3, blocks), 0);
+    cr_assert_eq(flush_blocks(), 0);
+    free(old_block);
+    free(blocks);
+    block_device_use(previous_device);
+    block_device_close(device);
+
+    // The volume cannot be opened until the rotation is resumed
+    cr_assert_null(shlkfs_mount(device_path, private_key_path, NULL));
+
+    // Only the user who started the rotation knows the new key
+    cr_assert_eq(cryptfs_rekey(device_path,
+                               "build/tests/rekey.resume.other.private.pem"),
+                 -1);
+    cr_assert_eq(cryptfs_rekey(device_path, private_key_path), 0);
+
+    // The new key is the one of the interrupted rotation
+    unsigned char *key = extract_aes_key(device_path, private_key_path, NULL);
+    cr_assert_arr_eq(key, new_key, AES_KEY_SIZE_BYTES);
+    free(key);
+    free(new_key);
+    free(old_key);
+
+    check_volume("rekey.resume");
+}
+
+Test(rekey, aes_xts, .init = cr_redirect_stdall, .timeout = 60)
+{
+    // The blocks are re-encrypted with their own tweak
+    set_block_cipher(CRYPTFS_CIPHER_AES_256_XTS);
+    create_test_volume("rekey.aes_xts");
+    const char *device_path = "build/tests/rekey.aes_xts.test.shlkfs";
+    const char *private_key_path = "build/tests/rekey.aes_xts.private.pem";
+    set_block_cipher(CRYPTFS_CIPHER_AES_256_CBC);
+
+    cr_assert_eq(cryptfs_rekey(device_path, private_key_path), 0);
+    struct CryptFS *cryptfs = read_cryptfs_headers(device_path);
+    cr_assert_eq(cryptfs->header.cipher, CRYPTFS_CIPHER_AES_256_XTS);
+    free(cryptfs);
+
+    check_volume("rekey.aes_xts");
+}
+
+Test(rekey, chacha20, .init = cr_redirect_stdall, .timeout = 60)
+{
+    set_block_cipher(CRYPTFS_CIPHER_CHACHA20);
+    create_test_volume("rekey.chacha20");
+    set_block_cipher(CRYPTFS_CIPHER_AES_256_CBC);
+
+    cr_assert_eq(cryptfs_rekey("build/tests/rekey.chacha20.test.shlkfs",
+                               "build/tests/rekey.chacha20.private.pem"),
+                 0);
+    check_volume("rekey.chacha20");
+}
@@ -0,0 +1,173 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "block.h"
+#include "cryptfs.h"
+#include "crypto.h"
+#include "entries.h"
+#include "format.h"
+#include "shlkfs_ctx.h"
+#include "xalloc.h"
+
+void cr_redirect_stdall(void);
+
+/**
+ * @brief Check if a pointer returned by the entries functions is an error code
+ * (e.g. ENTRY_NO_SUCH).
+ */
+static bool is_error(const void *ptr)
+{
+    return (ssize_t)ptr < 0;
+}
+
+/**
+ * @brief Format a volume in an image file, and open its context.
+ *
+ * @param name The name of the volume (prefix of its files in build/tests).
+ * @return struct shlkfs_ctx* The context of the volume.
+ */
+static struct shlkfs_ctx *open_test_volume(const char *name)
+{
+    char device_path[256];
+    char public_key_path[256];
+    char private_key_path[256];
+    snprintf(device_path, sizeof(device_path), "build/tests/%s.test.shlkfs",
+             name);
+    snprintf(public_key_path, sizeof(public_key_path),
+             "build/tests/%s.public.pem", name);
+    snprintf(private_key_path, sizeof(private_key_path),
+             "build/tests/%s.private.pem", name);
+
+    char command[512];
+    snprintf(command, sizeof(command),
+             "dd if=/dev/zero of=%s bs=4096 count=200 2> /dev/null",
+             device_path);
+    system(command);
+
+    format_fs(device_path, public_key_path, private_key_path, "label", NULL,
+              NULL);
+
+    unsigned char *aes_key =
+        extract_aes_key(device_path, private_key_path, NULL);
+    struct shlkfs_ctx *ctx = shlkfs_ctx_open(device_path, aes_key);
+    free(aes_key);
+    cr_assert_not_null(ctx);
+
+    return ctx;
+}
+
+Test(shlkfs_ctx, not_formatted, .init = cr_redirect_stdall, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/shlkfs_ctx.not_formatted.shlkfs "
+           "bs=4096 count=10 2> /dev/null");
+
+    unsigned char aes_key[AES_KEY_SIZE_BYTES] = { 0 };
+    cr_assert_null(shlkfs_ctx_open(
+        "build/tests/shlkfs_ctx.not_formatted.shlkfs", aes_key));
+}
+
+Test(shlkfs_ctx, independent_volumes, .init = cr_redirect_stdall,
+     .timeout = 20)
+{
+    struct shlkfs_ctx *first = open_test_volume("shlkfs_ctx.first");
+    struct shlkfs_ctx *second = open_test_volume("shlkfs_ctx.second");
+
+    struct CryptFS_Entry_ID *entry_id = create_file_by_path(first, "/first");
+    cr_assert(!is_error(entry_id));
+    free(entry_id);
+    entry_id = create_directory_by_path(second, "/second");
+    cr_assert(!is_error(entry_id));
+    free(entry_id);
+
+    // Each entry only exists in its own volume
+    cr_assert_eq(get_entry_by_path(first, "/second"), (void *)ENTRY_NO_SUCH);
+    cr_assert_eq(get_entry_by_path(second, "/first"), (void *)ENTRY_NO_SUCH);
+
+    entry_id = get_entry_by_path(first, "/first");
+    cr_assert(!is_error(entry_id));
+    struct CryptFS_Entry *entry = get_entry_from_id(first, *entry_id);
+    cr_assert_eq(entry->type, ENTRY_TYPE_FILE);
+    free(entry);
+    free(entry_id);
+
+    entry_id = get_entry_by_path(second, "/second");
+    cr_assert(!is_error(entry_id));
+    entry = get_entry_from_id(second, *entry_id);
+    cr_assert_eq(entry->type, ENTRY_TYPE_DIRECTORY);
+    free(entry);
+    free(entry_id);
+
+    cr_assert_eq(shlkfs_ctx_flush(first), 0);
+    cr_assert_eq(shlkfs_ctx_flush(second), 0);
+    shlkfs_ctx_close(first);
+    shlkfs_ctx_close(second);
+}
+
+#define NB_FILES_PER_VOLUME 16
+
+static void *create_files(void *arg)
+{
+    struct shlkfs_ctx *ctx = arg;
+    char path[32];
+
+    for (size_t i = 0; i < NB_FILES_PER_VOLUME; i++)
+    {
+        snprintf(path, sizeof(path), "/file_%zu", i);
+        struct CryptFS_Entry_ID *entry_id = create_file_by_path(ctx, path);
+        if (is_error(entry_id))
+            return (void *)1;
+        int err =
+            entry_write_buffer_from(ctx, *entry_id, 0, path, strlen(path));
+        free(entry_id);
+        if (err)
+            return (void *)1;
+    }
+
+    return NULL;
+}
+
+Test(shlkfs_ctx, concurrent_volumes, .init = cr_redirect_stdall,
+     .timeout = 30)
+{
+    struct shlkfs_ctx *ctxs[2] = {
+        open_test_volume("shlkfs_ctx.concurrent_first"),
+        open_test_volume("shlkfs_ctx.concurrent_second"),
+    };
+
+    pthread_t threads[2];
+    for (size_t i = 0; i < 2; i++)
+        cr_assert_eq(pthread_create(&threads[i], NULL, create_files, ctxs[i]),
+                     0);
+    for (size_t i = 0; i < 2; i++)
+    {
+        void *res = NULL;
+        pthread_join(threads[i], &res);
+        cr_assert_null(res);
+    }
+
+    // Check the content of the files of both volumes
+    char path[32];
+    char buffer[32];
+    for (size_t v = 0; v < 2; v++)
+        for (size_t i = 0; i < NB_FILES_PER_VOLUME; i++)
+        {
+            snprintf(path, sizeof(path), "/file_%zu", i);
+            struct CryptFS_Entry_ID *entry_id =
+                get_entry_by_path(ctxs[v], path);
+            cr_assert(!is_error(entry_id), "%s not found", path);
+
+            memset(buffer, 0, sizeof(buffer));
+            cr_assert_eq(entry_read_raw_data(ctxs[v], *entry_id, 0, buffer,
+                                             strlen(path)),
+                         (ssize_t)strlen(path));
+            cr_assert_str_eq(buffer, path);
+            free(entry_id);
+        }
+
+    shlkfs_ctx_close(ctxs[0]);
+    shlkfs_ctx_close(ctxs[1]);
+}
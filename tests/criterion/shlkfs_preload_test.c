@@ -0,0 +1,128 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "format.h"
+#include "shlkfs.h"
+
+void cr_redirect_stdall(void);
+
+// Environment of the commands run with the LD_PRELOAD library
+#define PRELOAD_ENV(name)                                                      \
+    "LD_PRELOAD=build/libshlkfs_preload.so "                                   \
+    "SHLKFS_PRELOAD_PREFIX=/shlkfs_preload "                                   \
+    "SHLKFS_PRELOAD_DEVICE=build/tests/" name ".test.shlkfs "                  \
+    "SHLKFS_PRELOAD_PRIVATE_KEY=build/tests/" name ".private.pem "
+
+/**
+ * @brief Format a volume in an image file, and create /file (containing
+ * "content\n") and /directory in it.
+ *
+ * @param name The name of the volume (prefix of its files in build/tests).
+ */
+static void create_test_volume(const char *name)
+{
+    char device_path[256];
+    char public_key_path[256];
+    char private_key_path[256];
+    snprintf(device_path, sizeof(device_path), "build/tests/%s.test.shlkfs",
+             name);
+    snprintf(public_key_path, sizeof(public_key_path),
+             "build/tests/%s.public.pem", name);
+    snprintf(private_key_path, sizeof(private_key_path),
+             "build/tests/%s.private.pem", name);
+
+    char command[512];
+    snprintf(command, sizeof(command),
+             "dd if=/dev/zero of=%s bs=4096 count=300 2> /dev/null",
+             device_path);
+    system(command);
+
+    format_fs(device_path, public_key_path, private_key_path, "label", NULL,
+              NULL);
+
+    struct shlkfs *fs = shlkfs_mount(device_path, private_key_path, NULL);
+    cr_assert_not_null(fs);
+    int fd = shlkfs_open(fs, "/file", O_CREAT | O_WRONLY, 0644);
+    cr_assert_eq(shlkfs_write(fs, fd, "content\n", 8), 8);
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    cr_assert_eq(shlkfs_mkdir(fs, "/directory", 0755), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
+
+/**
+ * @brief Read the content of a file of the host.
+ *
+ * @param path The path of the file.
+ * @param buffer The buffer to fill (NUL terminated).
+ * @param size The size of the buffer.
+ */
+static void read_host_file(const char *path, char *buffer, size_t size)
+{
+    memset(buffer, 0, size);
+    FILE *file = fopen(path, "r");
+    cr_assert_not_null(file);
+    fread(buffer, 1, size - 1, file);
+    fclose(file);
+}
+
+Test(shlkfs_preload, read_file, .init = cr_redirect_stdall, .timeout = 20)
+{
+    create_test_volume("shlkfs_preload.read_file");
+
+    cr_assert_eq(system(PRELOAD_ENV("shlkfs_preload.read_file")
+                        "cat /shlkfs_preload/file "
+                        "> build/tests/shlkfs_preload.read_file.out"),
+                 0);
+
+    char buffer[64];
+    read_host_file("build/tests/shlkfs_preload.read_file.out", buffer,
+                   sizeof(buffer));
+    cr_assert_str_eq(buffer, "content\n");
+
+    // The other paths are not in the volume
+    cr_assert_neq(system(PRELOAD_ENV("shlkfs_preload.read_file")
+                         "cat /shlkfs_preload_other/file"),
+                  0);
+}
+
+Test(shlkfs_preload, write_file, .init = cr_redirect_stdall, .timeout = 20)
+{
+    create_test_volume("shlkfs_preload.write_file");
+
+    // The redirections of the shell are made with open and dup2
+    cr_assert_eq(system(PRELOAD_ENV("shlkfs_preload.write_file")
+                        "sh -c 'echo first > /shlkfs_preload/directory/new "
+                        "&& echo second >> /shlkfs_preload/directory/new'"),
+                 0);
+
+    struct shlkfs *fs =
+        shlkfs_mount("build/tests/shlkfs_preload.write_file.test.shlkfs",
+                     "build/tests/shlkfs_preload.write_file.private.pem", NULL);
+    cr_assert_not_null(fs);
+    char buffer[64] = { 0 };
+    int fd = shlkfs_open(fs, "/directory/new", O_RDONLY, 0);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(shlkfs_read(fs, fd, buffer, sizeof(buffer)), 13);
+    cr_assert_str_eq(buffer, "first\nsecond\n");
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
+
+Test(shlkfs_preload, list_directory, .init = cr_redirect_stdall,
+     .timeout = 20)
+{
+    create_test_volume("shlkfs_preload.list_directory");
+
+    cr_assert_eq(system(PRELOAD_ENV("shlkfs_preload.list_directory")
+                        "ls /shlkfs_preload/./directory/.. "
+                        "> build/tests/shlkfs_preload.list_directory.out"),
+                 0);
+
+    char buffer[64];
+    read_host_file("build/tests/shlkfs_preload.list_directory.out", buffer,
+                   sizeof(buffer));
+    cr_assert_str_eq(buffer, "directory\nfile\n");
+}
@@ -0,0 +1,231 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "format.h"
+#include "shlkfs.h"
+#include "xalloc.h"
+
+void cr_redirect_stdall(void);
+
+/**
+ * @brief Format a volume in an image file, and mount it with libshlkfs.
+ *
+ * @param name The name of the volume (prefix of its files in build/tests).
+ * @return struct shlkfs* The volume.
+ */
+static struct shlkfs *mount_test_volume(const char *name)
+{
+    char device_path[256];
+    char public_key_path[256];
+    char private_key_path[256];
+    snprintf(device_path, sizeof(device_path), "build/tests/%s.test.shlkfs",
+             name);
+    snprintf(public_key_path, sizeof(public_key_path),
+             "build/tests/%s.public.pem", name);
+    snprintf(private_key_path, sizeof(private_key_path),
+             "build/tests/%s.private.pem", name);
+
+    char command[512];
+    snprintf(command, sizeof(command),
+             "dd if=/dev/zero of=%s bs=4096 count=300 2> /dev/null",
+             device_path);
+    system(command);
+
+    format_fs(device_path, public_key_path, private_key_path, "label", NULL,
+              NULL);
+
+    struct shlkfs *fs = shlkfs_mount(device_path, private_key_path, NULL);
+    cr_assert_not_null(fs);
+    return fs;
+}
+
+Test(shlkfs, mount_not_formatted, .init = cr_redirect_stdall, .timeout = 10)
+{
+    system("dd if=/dev/zero of=build/tests/shlkfs.mount_not_formatted.shlkfs "
+           "bs=4096 count=10 2> /dev/null");
+
+    errno = 0;
+    cr_assert_null(shlkfs_mount("build/tests/shlkfs.mount_not_formatted.shlkfs",
+                                "build/tests/not_existing.pem", NULL));
+    cr_assert_eq(errno, ENODEV);
+}
+
+Test(shlkfs, write_read, .init = cr_redirect_stdall, .timeout = 20)
+{
+    struct shlkfs *fs = mount_test_volume("shlkfs.write_read");
+
+    int fd = shlkfs_open(fs, "/file", O_CREAT | O_RDWR, 0640);
+    cr_assert_geq(fd, 0);
+
+    // Sequential writes (more than a block)
+    size_t size = 10000;
+    unsigned char *data = xmalloc(size, 1);
+    for (size_t i = 0; i < size; i++)
+        data[i] = i * 7;
+    cr_assert_eq(shlkfs_write(fs, fd, data, 6000), 6000);
+    cr_assert_eq(shlkfs_write(fs, fd, data + 6000, size - 6000), size - 6000);
+
+    // Positioned read, and sequential reads up to the end of the file
+    unsigned char *buffer = xcalloc(size, 1);
+    cr_assert_eq(shlkfs_pread(fs, fd, buffer, 100, 4050), 100);
+    cr_assert_arr_eq(buffer, data + 4050, 100);
+    cr_assert_eq(shlkfs_pread(fs, fd, buffer, 100, size), 0);
+
+    int rfd = shlkfs_open(fs, "/file", O_RDONLY, 0);
+    cr_assert_geq(rfd, 0);
+    cr_assert_neq(rfd, fd);
+    memset(buffer, 0, size);
+    cr_assert_eq(shlkfs_read(fs, rfd, buffer, 4096), 4096);
+    cr_assert_eq(shlkfs_read(fs, rfd, buffer + 4096, size), size - 4096);
+    cr_assert_eq(shlkfs_read(fs, rfd, buffer, size), 0);
+    cr_assert_arr_eq(buffer, data, size);
+
+    // A read only file cannot be written
+    cr_assert_eq(shlkfs_write(fs, rfd, data, 1), -1);
+    cr_assert_eq(errno, EBADF);
+
+    struct stat st;
+    cr_assert_eq(shlkfs_stat(fs, "/file", &st), 0);
+    cr_assert(S_ISREG(st.st_mode));
+    cr_assert_eq(st.st_mode & 07777, 0640);
+    cr_assert_eq(st.st_size, size);
+
+    cr_assert_eq(shlkfs_close(fs, rfd), 0);
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    cr_assert_eq(shlkfs_close(fs, fd), -1);
+    cr_assert_eq(errno, EBADF);
+
+    free(buffer);
+    free(data);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
+
+Test(shlkfs, open_flags, .init = cr_redirect_stdall, .timeout = 20)
+{
+    struct shlkfs *fs = mount_test_volume("shlkfs.open_flags");
+
+    cr_assert_eq(shlkfs_open(fs, "/missing", O_RDONLY, 0), -1);
+    cr_assert_eq(errno, ENOENT);
+
+    int fd = shlkfs_open(fs, "/file", O_CREAT | O_EXCL | O_WRONLY, 0644);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(shlkfs_write(fs, fd, "hello", 5), 5);
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+
+    cr_assert_eq(shlkfs_open(fs, "/file", O_CREAT | O_EXCL | O_WRONLY, 0644),
+                 -1);
+    cr_assert_eq(errno, EEXIST);
+
+    // Append to the existing content
+    fd = shlkfs_open(fs, "/file", O_CREAT | O_WRONLY | O_APPEND, 0644);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(shlkfs_write(fs, fd, " world", 6), 6);
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+
+    char buffer[16] = { 0 };
+    fd = shlkfs_open(fs, "/file", O_RDONLY, 0);
+    cr_assert_eq(shlkfs_read(fs, fd, buffer, sizeof(buffer)), 11);
+    cr_assert_str_eq(buffer, "hello world");
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+
+    // Truncate the content
+    fd = shlkfs_open(fs, "/file", O_RDWR | O_TRUNC, 0);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(shlkfs_read(fs, fd, buffer, sizeof(buffer)), 0);
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
+
+Test(shlkfs, lseek_fstat, .init = cr_redirect_stdall, .timeout = 20)
+{
+    struct shlkfs *fs = mount_test_volume("shlkfs.lseek_fstat");
+
+    int fd = shlkfs_open(fs, "/file", O_CREAT | O_RDWR, 0600);
+    cr_assert_eq(shlkfs_write(fs, fd, "0123456789", 10), 10);
+
+    char buffer[4] = { 0 };
+    cr_assert_eq(shlkfs_lseek(fs, fd, 2, SEEK_SET), 2);
+    cr_assert_eq(shlkfs_lseek(fs, fd, 3, SEEK_CUR), 5);
+    cr_assert_eq(shlkfs_read(fs, fd, buffer, 3), 3);
+    cr_assert_str_eq(buffer, "567");
+    cr_assert_eq(shlkfs_lseek(fs, fd, -2, SEEK_END), 8);
+    cr_assert_eq(shlkfs_read(fs, fd, buffer, 3), 2);
+    cr_assert_eq(shlkfs_lseek(fs, fd, -11, SEEK_END), -1);
+    cr_assert_eq(errno, EINVAL);
+
+    struct stat st;
+    struct stat path_st;
+    cr_assert_eq(shlkfs_fstat(fs, fd, &st), 0);
+    cr_assert_eq(shlkfs_stat(fs, "/file", &path_st), 0);
+    cr_assert_eq(st.st_size, 10);
+    cr_assert_eq(st.st_ino, path_st.st_ino);
+    cr_assert_eq(shlkfs_stat(fs, "/", &path_st), 0);
+    cr_assert_neq(st.st_ino, path_st.st_ino);
+
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    cr_assert_eq(shlkfs_fstat(fs, fd, &st), -1);
+    cr_assert_eq(errno, EBADF);
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
+
+/**
+ * @brief Count the entries of a directory, and check that they are the
+ * expected ones (see the readdir test).
+ */
+static int count_entry(void *arg, const char *name, const struct stat *st)
+{
+    size_t *count = arg;
+    if (strcmp(name, "directory") == 0)
+        cr_assert(S_ISDIR(st->st_mode));
+    else
+        cr_assert(strcmp(name, "file") == 0 && S_ISREG(st->st_mode));
+    (*count)++;
+    return 0;
+}
+
+Test(shlkfs, directories, .init = cr_redirect_stdall, .timeout = 20)
+{
+    struct shlkfs *fs = mount_test_volume("shlkfs.directories");
+
+    cr_assert_eq(shlkfs_mkdir(fs, "/directory", 0750), 0);
+    cr_assert_eq(shlkfs_mkdir(fs, "/directory", 0750), -1);
+    cr_assert_eq(errno, EEXIST);
+    cr_assert_eq(shlkfs_mkdir(fs, "/missing/directory", 0750), -1);
+    cr_assert_eq(errno, ENOENT);
+
+    int fd = shlkfs_open(fs, "/file", O_CREAT | O_WRONLY, 0600);
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+    fd = shlkfs_open(fs, "/directory/nested", O_CREAT | O_WRONLY, 0600);
+    cr_assert_eq(shlkfs_close(fs, fd), 0);
+
+    struct stat st;
+    cr_assert_eq(shlkfs_stat(fs, "/directory", &st), 0);
+    cr_assert(S_ISDIR(st.st_mode));
+    cr_assert_eq(st.st_mode & 07777, 0750);
+    cr_assert_eq(shlkfs_open(fs, "/directory", O_WRONLY, 0), -1);
+    cr_assert_eq(errno, EISDIR);
+
+    size_t count = 0;
+    cr_assert_eq(shlkfs_readdir(fs, "/", count_entry, &count), 0);
+    cr_assert_eq(count, 2);
+    cr_assert_eq(shlkfs_readdir(fs, "/file", count_entry, &count), -1);
+    cr_assert_eq(errno, ENOTDIR);
+
+    // Only files can be unlinked
+    cr_assert_eq(shlkfs_unlink(fs, "/directory"), -1);
+    cr_assert_eq(errno, EISDIR);
+    cr_assert_eq(shlkfs_unlink(fs, "/directory/nested"), 0);
+    cr_assert_eq(shlkfs_stat(fs, "/directory/nested", &st), -1);
+    cr_assert_eq(errno, ENOENT);
+    cr_assert_eq(shlkfs_unlink(fs, "/file"), 0);
+
+    count = 0;
+    cr_assert_eq(shlkfs_readdir(fs, "/", count_entry, &count), 0);
+    cr_assert_eq(count, 1);
+
+    cr_assert_eq(shlkfs_umount(fs), 0);
+}
@@ -0,0 +1,28 @@
+#include "test_volume.h"
+
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "format.h"
+
+void format_test_volume(const char *name, size_t nb_blocks,
+                        struct test_volume *volume)
+{
+    char command[1024];
+    snprintf(command, sizeof(command),
+             "rm -rf build/tests/%s.* "
+             "&& dd if=/dev/zero of=build/tests/%s.test.shlkfs bs=4096 "
+             "count=%zu 2> /dev/null",
+             name, name, nb_blocks);
+    cr_assert_eq(system(command), 0);
+
+    snprintf(volume->device_path, sizeof(volume->device_path),
+             "build/tests/%s.test.shlkfs", name);
+    snprintf(volume->public_key_path, sizeof(volume->public_key_path),
+             "build/tests/%s.public.pem", name);
+    snprintf(volume->private_key_path, sizeof(volume->private_key_path),
+             "build/tests/%s.private.pem", name);
+    format_fs(volume->device_path, volume->public_key_path,
+              volume->private_key_path, "label", NULL, NULL);
+}
@@ -0,0 +1,27 @@
+#ifndef TEST_VOLUME_H
+#define TEST_VOLUME_H
+
+#include <stddef.h>
+
+/**
+ * @brief Paths of the files of a test volume (in build/tests).
+ */
+struct test_volume
+{
+    char device_path[256]; // The image file: <name>.test.shlkfs
+    char public_key_path[256]; // The public key: <name>.public.pem
+    char private_key_path[256]; // The private key: <name>.private.pem
+};
+
+/**
+ * @brief Format a volume in an image file, after removing the files left by
+ * a previous run of the test.
+ *
+ * @param name The name of the test (prefix of its files in build/tests).
+ * @param nb_blocks The number of blocks (of 4096 bytes) of the image file.
+ * @param volume The paths of the files of the volume. (returned)
+ */
+void format_test_volume(const char *name, size_t nb_blocks,
+                        struct test_volume *volume);
+
+#endif /* TEST_VOLUME_H */
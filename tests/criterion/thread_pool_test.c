@@ -0,0 +1,96 @@
+#include <criterion/criterion.h>
+#include <criterion/redirect.h>
+
+#include "thread_pool.h"
+#include "xalloc.h"
+
+static int mark_item(void *arg, size_t index)
+{
+    int *visited = arg;
+    __atomic_add_fetch(&visited[index], 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int fail_on_odd_item(void *arg, size_t index)
+{
+    (void)arg;
+    return index % 2;
+}
+
+/**
+ * @brief Submit a job from a task (as the block layer does in the tasks of
+ * fsck and rekey).
+ */
+static int nested_job(void *arg, size_t index)
+{
+    int *visited = arg;
+    return thread_pool_parallel_for(mark_item, visited + index * 10, 10);
+}
+
+Test(thread_pool, all_items_once, .timeout = 10)
+{
+    size_t nb_items = 10007;
+    int *visited = xcalloc(nb_items, sizeof(int));
+
+    thread_pool_init(4);
+    cr_assert_eq(thread_pool_size(), 4);
+    cr_assert_eq(thread_pool_parallel_for(mark_item, visited, nb_items), 0);
+
+    for (size_t i = 0; i < nb_items; i++)
+        cr_assert_eq(visited[i], 1, "Item %zu visited %d times", i,
+                     visited[i]);
+
+    thread_pool_destroy();
+    free(visited);
+}
+
+Test(thread_pool, fewer_items_than_threads, .timeout = 10)
+{
+    int visited[3] = { 0 };
+
+    thread_pool_init(8);
+    cr_assert_eq(thread_pool_parallel_for(mark_item, visited, 3), 0);
+    cr_assert_eq(thread_pool_parallel_for(mark_item, visited, 0), 0);
+
+    for (size_t i = 0; i < 3; i++)
+        cr_assert_eq(visited[i], 1);
+
+    thread_pool_destroy();
+}
+
+Test(thread_pool, single_thread, .timeout = 10)
+{
+    size_t nb_items = 100;
+    int *visited = xcalloc(nb_items, sizeof(int));
+
+    thread_pool_init(1);
+    cr_assert_eq(thread_pool_parallel_for(mark_item, visited, nb_items), 0);
+    for (size_t i = 0; i < nb_items; i++)
+        cr_assert_eq(visited[i], 1);
+
+    thread_pool_destroy();
+    free(visited);
+}
+
+Test(thread_pool, error, .timeout = 10)
+{
+    thread_pool_init(4);
+    cr_assert_eq(thread_pool_parallel_for(fail_on_odd_item, NULL, 1000), -1);
+    cr_assert_eq(thread_pool_parallel_for(fail_on_odd_item, NULL, 1), 0);
+    thread_pool_destroy();
+}
+
+Test(thread_pool, nested_job, .timeout = 10)
+{
+    size_t nb_items = 64;
+    int *visited = xcalloc(nb_items * 10, sizeof(int));
+
+    // The nested jobs run inline instead of waiting for the pool
+    thread_pool_init(4);
+    cr_assert_eq(thread_pool_parallel_for(nested_job, visited, nb_items), 0);
+    for (size_t i = 0; i < nb_items * 10; i++)
+        cr_assert_eq(visited[i], 1);
+
+    thread_pool_destroy();
+    free(visited);
+}
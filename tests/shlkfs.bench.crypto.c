@@ -0,0 +1,256 @@
+#include <openssl/rand.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "block.h"
+#include "block_cipher.h"
+#include "cryptfs.h"
+#include "crypto.h"
+#include "print.h"
+#include "thread_pool.h"
+#include "xalloc.h"
+
+// Numbers of blocks of a request (multiplied by 4 from one to the next)
+#define BENCH_MIN_BLOCKS 1
+#define BENCH_MAX_BLOCKS 1024
+// Minimum duration of a measure, in seconds (first argument)
+#define BENCH_DEFAULT_SECONDS 0.1
+
+/**
+ * @brief A request of the benchmark: blocks encrypted or decrypted in place.
+ */
+struct bench_request
+{
+    const struct block_cipher_ops *cipher; // The cipher of the blocks
+    const unsigned char *aes_key; // The master key
+    const unsigned char *key; // The key of the blocks (see derive_key)
+    unsigned char *buffer; // The blocks
+    size_t nb_blocks; // The number of blocks
+    bool encrypt; // true to encrypt, false to decrypt
+};
+
+/**
+ * @brief A way to encrypt/decrypt the blocks of a request.
+ *
+ * @param request The request.
+ * @return int 0 on success, -1 on error.
+ */
+typedef int (*bench_path_t)(struct bench_request *request);
+
+/**
+ * @brief Encrypt/decrypt a block with aes_encrypt_data/aes_decrypt_data
+ * (thread_pool_task_t).
+ */
+static int __aes_data_task(void *arg, size_t index)
+{
+    struct bench_request *request = arg;
+    unsigned char *block = request->buffer + index * CRYPTFS_BLOCK_SIZE_BYTES;
+    size_t size = 0;
+    unsigned char *crypted = request->encrypt
+        ? aes_encrypt_data(request->aes_key, block, CRYPTFS_BLOCK_SIZE_BYTES,
+                           &size)
+        : aes_decrypt_data(request->aes_key, block, CRYPTFS_BLOCK_SIZE_BYTES,
+                           &size);
+    if (crypted == NULL)
+        return -1;
+
+    memcpy(block, crypted, CRYPTFS_BLOCK_SIZE_BYTES);
+    free(crypted);
+    return 0;
+}
+
+/**
+ * @brief A context, a key schedule and an allocation per block, as the AES
+ * keys storage and the volumes of version 1 were first handled.
+ */
+static int __aes_data_path(struct bench_request *request)
+{
+    return thread_pool_parallel_for(__aes_data_task, request,
+                                    request->nb_blocks);
+}
+
+/**
+ * @brief Encrypt/decrypt a block with a call to the cipher
+ * (thread_pool_task_t).
+ */
+static int __per_block_task(void *arg, size_t index)
+{
+    struct bench_request *request = arg;
+    unsigned char *block = request->buffer + index * CRYPTFS_BLOCK_SIZE_BYTES;
+    struct block_cipher_request block_request = {
+        .block = index,
+        .src = block,
+        .dst = block,
+    };
+    return request->cipher->crypt(request->key, &block_request, 1,
+                                  CRYPTFS_BLOCK_SIZE_BYTES, request->encrypt);
+}
+
+/**
+ * @brief The key of the blocks is derived once, but each block has its own
+ * context (a batch of one block).
+ */
+static int __per_block_path(struct bench_request *request)
+{
+    return thread_pool_parallel_for(__per_block_task, request,
+                                    request->nb_blocks);
+}
+
+/**
+ * @brief The block layer: the blocks are given to the cipher by batches
+ * sharing a context (see encrypt_blocks_batch).
+ */
+static int __batched_path(struct bench_request *request)
+{
+    struct block_request block_request = {
+        .start_block = 0,
+        .nb_blocks = request->nb_blocks,
+        .buffer = request->buffer,
+    };
+    return request->encrypt
+        ? encrypt_blocks_batch(request->aes_key, &block_request, 1)
+        : decrypt_blocks_batch(request->aes_key, &block_request, 1);
+}
+
+/**
+ * @brief Get the current time.
+ *
+ * @return double The time, in seconds.
+ */
+static double __now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Measure a path, and print its result (a JSON object).
+ *
+ * @param path The path.
+ * @param path_name The name of the path.
+ * @param request The request (its cipher is the one of the block layer).
+ * @param nb_threads The number of threads of the thread pool.
+ * @param min_seconds The minimum duration of the measure.
+ * @param first true if this is the first result printed.
+ */
+static void __measure(bench_path_t path, const char *path_name,
+                      struct bench_request *request, size_t nb_threads,
+                      double min_seconds, bool first)
+{
+    size_t nb_requests = 0;
+    double start = __now();
+    double elapsed = 0;
+    do
+    {
+        if (path(request))
+            error_exit("The '%s' path failed\n", EXIT_FAILURE, path_name);
+        nb_requests++;
+        elapsed = __now() - start;
+    } while (elapsed < min_seconds);
+
+    double nb_blocks = (double)nb_requests * request->nb_blocks;
+    printf("%s\n    {\"path\": \"%s\", \"cipher\": \"%s\", "
+           "\"operation\": \"%s\", \"blocks\": %zu, \"threads\": %zu, "
+           "\"mb_per_s\": %.1f, \"ns_per_block\": %.1f}",
+           first ? "" : ",", path_name, request->cipher->name,
+           request->encrypt ? "encrypt" : "decrypt", request->nb_blocks,
+           nb_threads, nb_blocks * CRYPTFS_BLOCK_SIZE_BYTES / elapsed / 1e6,
+           elapsed * 1e9 / nb_blocks);
+}
+
+/**
+ * @brief Get the next number of threads to measure (doubled, up to the
+ * maximum).
+ *
+ * @param nb_threads The number of threads measured.
+ * @param max_threads The maximum number of threads.
+ * @return size_t The next number of threads, above `max_threads` once it is
+ * measured.
+ */
+static size_t __next_nb_threads(size_t nb_threads, size_t max_threads)
+{
+    if (nb_threads == max_threads)
+        return max_threads + 1;
+    return nb_threads * 2 < max_threads ? nb_threads * 2 : max_threads;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 3)
+    {
+        print_error("Usage: %s [min_seconds [max_threads]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    double min_seconds = argc > 1 ? atof(argv[1]) : BENCH_DEFAULT_SECONDS;
+    long nb_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = argc > 2 ? strtoul(argv[2], NULL, 10)
+                                  : (size_t)(nb_cores > 0 ? nb_cores : 1);
+    if (min_seconds <= 0 || max_threads == 0)
+    {
+        print_error("Usage: %s [min_seconds [max_threads]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    unsigned char aes_key[AES_KEY_SIZE_BYTES];
+    unsigned char *buffer = xaligned_alloc(CRYPTFS_BLOCK_SIZE_BYTES,
+                                           BENCH_MAX_BLOCKS,
+                                           CRYPTFS_BLOCK_SIZE_BYTES);
+    if (RAND_bytes(aes_key, sizeof(aes_key)) != 1
+        || RAND_bytes(buffer, BENCH_MAX_BLOCKS * CRYPTFS_BLOCK_SIZE_BYTES)
+            != 1)
+        internal_error_exit("Failed to generate random bytes\n",
+                            EXIT_FAILURE);
+
+    // The block layer encrypts the blocks of a default device (no path)
+    set_block_size(CRYPTFS_BLOCK_SIZE_BYTES);
+    printf("{\n  \"block_size\": %d,\n  \"results\": [",
+           CRYPTFS_BLOCK_SIZE_BYTES);
+    bool first = true;
+    for (size_t nb_threads = 1; nb_threads <= max_threads;
+         nb_threads = __next_nb_threads(nb_threads, max_threads))
+    {
+        thread_pool_init(nb_threads);
+        for (enum cryptfs_cipher cipher = 0; block_cipher_get(cipher) != NULL;
+             cipher++)
+        {
+            set_block_cipher(cipher);
+            unsigned char key[BLOCK_CIPHER_KEY_MAX_BYTES];
+            block_cipher_get(cipher)->derive_key(aes_key, key);
+            for (size_t nb_blocks = BENCH_MIN_BLOCKS;
+                 nb_blocks <= BENCH_MAX_BLOCKS; nb_blocks *= 4)
+                for (int encrypt = 1; encrypt >= 0; encrypt--)
+                {
+                    struct bench_request request = {
+                        .cipher = block_cipher_get(cipher),
+                        .aes_key = aes_key,
+                        .key = key,
+                        .buffer = buffer,
+                        .nb_blocks = nb_blocks,
+                        .encrypt = encrypt,
+                    };
+                    // aes_encrypt_data is AES-256-CBC only
+                    if (cipher == CRYPTFS_CIPHER_AES_256_CBC)
+                    {
+                        __measure(__aes_data_path, "aes_data", &request,
+                                  nb_threads, min_seconds, first);
+                        first = false;
+                    }
+                    __measure(__per_block_path, "per_block", &request,
+                              nb_threads, min_seconds, first);
+                    __measure(__batched_path, "batched", &request, nb_threads,
+                              min_seconds, false);
+                    first = false;
+                }
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    thread_pool_destroy();
+    free(buffer);
+    return EXIT_SUCCESS;
+}